@@ -0,0 +1,268 @@
+
+
+#include "config.h"
+#include "pmalloc.h"
+#include "cstring.h"
+#include "arena.h"
+
+
+#define __ARENA_ALIGN__(n)                                              \
+    (((n) + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1))
+
+
+#define __ARENA_BLOCK_HEADER__                                          \
+    __ARENA_ALIGN__(sizeof(arena_block_t))
+
+
+static arena_block_t* __arena_block_new__(arena_t *arena, size_t size);
+static void __arena_block_free__(arena_t *arena, arena_block_t *block);
+
+
+/* each thread works through its units with arenas of its own */
+static THREAD_LOCAL arena_t *__arenas__[ARENA_PHASE_MAX];
+
+
+arena_t* arena_create(void)
+{
+    return arena_create_n(ARENA_BLOCK_SIZE);
+}
+
+
+arena_t* arena_create_n(size_t block_size)
+{
+    arena_t *arena;
+
+    arena = (arena_t *) pmalloc(sizeof(arena_t));
+    if (!arena) {
+        return NULL;
+    }
+
+    arena->block = NULL;
+    arena->spare = NULL;
+    arena->block_size = block_size;
+    arena->allocated = 0;
+
+    return arena;
+}
+
+
+void arena_destroy(arena_t *arena)
+{
+    arena_block_t *block, *next;
+
+    assert(arena != NULL);
+
+    for (block = arena->block; block; block = next) {
+        next = block->next;
+        pfree(block);
+    }
+
+    if (arena->spare != NULL) {
+        pfree(arena->spare);
+    }
+
+    pfree(arena);
+}
+
+
+/**
+ * Hands every block of from over to arena and destroys from. What was
+ * allocated from it lives on until arena_destroy(arena).
+ **/
+void arena_absorb(arena_t *arena, arena_t *from)
+{
+    arena_block_t *tail;
+
+    assert(arena != NULL && from != NULL && arena != from);
+
+    if (from->block != NULL) {
+        for (tail = from->block; tail->next; tail = tail->next) {
+            continue;
+        }
+
+        /* the current block of arena stays in front to be filled up */
+        if (arena->block == NULL) {
+            arena->block = from->block;
+        } else {
+            tail->next = arena->block->next;
+            arena->block->next = from->block;
+        }
+    }
+
+    arena->allocated += from->allocated;
+
+    if (from->spare != NULL) {
+        pfree(from->spare);
+    }
+
+    pfree(from);
+}
+
+
+void* arena_alloc(arena_t *arena, size_t size)
+{
+    arena_block_t *block;
+    void *p;
+
+    size = __ARENA_ALIGN__(size);
+
+    block = arena->block;
+    if (block == NULL || block->size - block->used < size) {
+        /* oversized requests get a block of their own behind the current
+           one so the space left in the current block is not wasted */
+        if (size > arena->block_size / 4 && block != NULL) {
+            block = __arena_block_new__(arena, size);
+            if (!block) {
+                return NULL;
+            }
+            block->next = arena->block->next;
+            arena->block->next = block;
+
+        } else {
+            block = __arena_block_new__(arena, size > arena->block_size ?
+                size : arena->block_size);
+            if (!block) {
+                return NULL;
+            }
+            block->next = arena->block;
+            arena->block = block;
+        }
+    }
+
+    p = (unsigned char *) block + __ARENA_BLOCK_HEADER__ + block->used;
+    block->used += size;
+    arena->allocated += size;
+
+    return p;
+}
+
+
+/**
+ * Copy n bytes into the arena laid out as a cstring_t, so the result can
+ * be read with the cstring accessors. It must not be grown or freed.
+ **/
+unsigned char* arena_cstring(arena_t *arena, const unsigned char *s, size_t n)
+{
+    void *mem;
+
+    mem = arena_alloc(arena, cstring_space(n));
+    if (!mem) {
+        return NULL;
+    }
+
+    return cstring_place_n(mem, s, n);
+}
+
+
+/**
+ * Where arena is now, for arena_reset() to come back to.
+ **/
+arena_mark_t arena_mark(arena_t *arena)
+{
+    arena_mark_t mark;
+
+    mark.block = arena->block;
+    mark.next = arena->block != NULL ? arena->block->next : NULL;
+    mark.used = arena->block != NULL ? arena->block->used : 0;
+    mark.allocated = arena->allocated;
+    return mark;
+}
+
+
+/**
+ * Frees all that was allocated from arena since mark, absorbed arenas
+ * included. The marks of an arena are reset in the reverse order they
+ * were taken, one reset drops those taken after its mark.
+ **/
+void arena_reset(arena_t *arena, arena_mark_t mark)
+{
+    arena_block_t *block, *next;
+
+    /* the blocks started since, in front of the marked one */
+    while (arena->block != mark.block) {
+        next = arena->block->next;
+        __arena_block_free__(arena, arena->block);
+        arena->block = next;
+    }
+
+    if (mark.block != NULL) {
+        for (block = mark.block->next; block != mark.next; block = next) {
+            next = block->next;
+            __arena_block_free__(arena, block);
+        }
+
+        mark.block->next = mark.next;
+        mark.block->used = mark.used;
+    }
+
+    arena->allocated = mark.allocated;
+}
+
+
+/**
+ * The arena of the calling thread for phase, made on first use.
+ **/
+arena_t* arena_of(arena_phase_t phase)
+{
+    assert(phase < ARENA_PHASE_MAX);
+
+    if (__arenas__[phase] == NULL) {
+        __arenas__[phase] = arena_create_n(phase == ARENA_PHASE_UNIT ?
+            ARENA_BLOCK_SIZE : ARENA_SCRATCH_BLOCK_SIZE);
+    }
+
+    return __arenas__[phase];
+}
+
+
+/**
+ * Frees the arenas of the calling thread, nothing may point into them.
+ **/
+void arena_cleanup(void)
+{
+    int i;
+
+    for (i = 0; i < ARENA_PHASE_MAX; i++) {
+        if (__arenas__[i] != NULL) {
+            arena_destroy(__arenas__[i]);
+            __arenas__[i] = NULL;
+        }
+    }
+}
+
+
+static
+arena_block_t* __arena_block_new__(arena_t *arena, size_t size)
+{
+    arena_block_t *block;
+
+    if (arena->spare != NULL && arena->spare->size >= size) {
+        block = arena->spare;
+        arena->spare = NULL;
+    } else {
+        block = (arena_block_t *) pmalloc(__ARENA_BLOCK_HEADER__ + size);
+        if (!block) {
+            return NULL;
+        }
+
+        block->size = size;
+    }
+
+    block->next = NULL;
+    block->used = 0;
+
+    return block;
+}
+
+
+/* one block of the usual size is kept back, resets come again and again */
+static
+void __arena_block_free__(arena_t *arena, arena_block_t *block)
+{
+    if (arena->spare == NULL && block->size == arena->block_size) {
+        arena->spare = block;
+        return;
+    }
+
+    pfree(block);
+}
@@ -0,0 +1,87 @@
+#ifndef __ARENA__H__
+#define __ARENA__H__
+
+
+#include "config.h"
+
+
+#ifndef ARENA_BLOCK_SIZE
+#define ARENA_BLOCK_SIZE                (64 * 1024)
+#endif
+
+
+/* the blocks of the per expansion and per directive arenas */
+#ifndef ARENA_SCRATCH_BLOCK_SIZE
+#define ARENA_SCRATCH_BLOCK_SIZE        (4 * 1024)
+#endif
+
+
+#define ARENA_ALIGNMENT                 (2 * sizeof(void*))
+
+
+typedef struct arena_block_s {
+    struct arena_block_s *next;
+    size_t size;
+    size_t used;
+} arena_block_t;
+
+
+/**
+ * Bump-pointer allocator. Objects carved out of an arena are never freed
+ * one by one, everything goes away together in arena_destroy(), or all
+ * that came after a mark in arena_reset(). spare is a block given back by
+ * a reset, kept for the next one needed.
+ **/
+typedef struct arena_s {
+    arena_block_t *block;
+    arena_block_t *spare;
+    size_t block_size;
+    size_t allocated;
+} arena_t;
+
+
+/**
+ * Where an arena was, see arena_mark(). next is what followed block then,
+ * the blocks an oversized request puts behind it come before next.
+ **/
+typedef struct arena_mark_s {
+    arena_block_t *block;
+    arena_block_t *next;
+    size_t used;
+    size_t allocated;
+} arena_mark_t;
+
+
+/**
+ * The lifetimes the arenas of a thread are for: the translation unit
+ * being preprocessed, a macro expansion and a directive. The last two
+ * nest inside the first and are marked and reset around their work.
+ **/
+typedef enum arena_phase_e {
+    ARENA_PHASE_UNIT,
+    ARENA_PHASE_EXPANSION,
+    ARENA_PHASE_DIRECTIVE,
+    ARENA_PHASE_MAX,
+} arena_phase_t;
+
+
+arena_t* arena_create(void);
+arena_t* arena_create_n(size_t block_size);
+void arena_destroy(arena_t *arena);
+void arena_absorb(arena_t *arena, arena_t *from);
+void* arena_alloc(arena_t *arena, size_t size);
+unsigned char* arena_cstring(arena_t *arena, const unsigned char *s, size_t n);
+arena_mark_t arena_mark(arena_t *arena);
+void arena_reset(arena_t *arena, arena_mark_t mark);
+arena_t* arena_of(arena_phase_t phase);
+void arena_cleanup(void);
+
+
+static inline
+size_t arena_allocated(arena_t *arena)
+{
+    return arena->allocated;
+}
+
+
+#endif
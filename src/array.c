@@ -46,7 +46,7 @@ array_t* array_create_n(size_t size, size_t n)
 
 void array_destroy(array_t *a)
 {
-    assert(a && a->elts);
+    assert(a != NULL);
 
     if (a->elts != NULL) {
         pfree(a->elts);
@@ -117,6 +117,27 @@ bool array_extend(array_t *a, array_t *b)
 }
 
 
+/**
+ * The elements of a typed array moved to room for n, out of the inline
+ * ones the first time, see ARRAY_DEFINE. NULL when out of memory, with
+ * elts left alone.
+ **/
+void* __array_grow(void *elts, const void *inlined, size_t nelts, size_t size, size_t n)
+{
+    void *grown;
+
+    if (elts != inlined) {
+        return prealloc(elts, size * n);
+    }
+
+    if ((grown = pmalloc(size * n)) != NULL) {
+        memcpy(grown, inlined, size * nelts);
+    }
+
+    return grown;
+}
+
+
 static inline
 int __array_resize__(array_t *a, size_t n)
 {
@@ -5,6 +5,7 @@
 
 
 #include "config.h"
+#include "pmalloc.h"
 
 
 typedef struct array_s {
@@ -83,6 +84,7 @@ void array_destroy(array_t *a);
 void *array_push_back(array_t *a);
 void *array_push_back_n(array_t *a, size_t n);
 bool array_extend(array_t *a, array_t *b);
+void* __array_grow(void *elts, const void *inlined, size_t nelts, size_t size, size_t n);
 
 
 static inline
@@ -109,4 +111,130 @@ void* __array_back(array_t *a)
 }
 
 
+/**
+ * ARRAY_DEFINE(name, type, n) makes name_array_t, an array of type known
+ * at compile time: no element size to multiply by, and its first n
+ * elements held in the array itself, so that a short one costs no
+ * allocation of its own. It keeps the fields of array_t, the macros
+ * above work on it. It must not be moved while it holds them inline.
+ **/
+#define ARRAY_DEFINE(name, type, n)                                         \
+    typedef struct name##_array_s {                                         \
+        type   *elts;                                                       \
+        size_t  nelts;                                                      \
+        size_t  nalloc;                                                     \
+        type    inlined[n];                                                 \
+    } name##_array_t;                                                       \
+                                                                            \
+    static inline                                                           \
+    void name##_array_init(name##_array_t *a)                               \
+    {                                                                       \
+        a->elts = a->inlined;                                               \
+        a->nelts = 0;                                                       \
+        a->nalloc = (n);                                                    \
+    }                                                                       \
+                                                                            \
+    static inline                                                           \
+    void name##_array_uninit(name##_array_t *a)                             \
+    {                                                                       \
+        if (a->elts != a->inlined) {                                        \
+            pfree(a->elts);                                                 \
+        }                                                                   \
+    }                                                                       \
+                                                                            \
+    static inline                                                           \
+    name##_array_t* name##_array_create(void)                               \
+    {                                                                       \
+        name##_array_t *a;                                                  \
+                                                                            \
+        if ((a = (name##_array_t *) pmalloc(sizeof(name##_array_t))) != NULL) { \
+            name##_array_init(a);                                           \
+        }                                                                   \
+                                                                            \
+        return a;                                                           \
+    }                                                                       \
+                                                                            \
+    static inline                                                           \
+    void name##_array_destroy(name##_array_t *a)                            \
+    {                                                                       \
+        name##_array_uninit(a);                                             \
+        pfree(a);                                                           \
+    }                                                                       \
+                                                                            \
+    static inline                                                           \
+    bool name##_array_reserve(name##_array_t *a, size_t m)                  \
+    {                                                                       \
+        type *elts;                                                         \
+                                                                            \
+        if (m <= a->nalloc) {                                               \
+            return true;                                                    \
+        }                                                                   \
+                                                                            \
+        if (m < a->nalloc * 2) {                                            \
+            m = a->nalloc * 2;                                              \
+        }                                                                   \
+                                                                            \
+        elts = (type *) __array_grow(a->elts, a->inlined, a->nelts, sizeof(type), m); \
+        if (elts == NULL) {                                                 \
+            return false;                                                   \
+        }                                                                   \
+                                                                            \
+        a->elts = elts;                                                     \
+        a->nalloc = m;                                                      \
+        return true;                                                        \
+    }                                                                       \
+                                                                            \
+    static inline                                                           \
+    type* name##_array_push_back(name##_array_t *a)                         \
+    {                                                                       \
+        if (a->nelts == a->nalloc && !name##_array_reserve(a, a->nelts + 1)) { \
+            return NULL;                                                    \
+        }                                                                   \
+                                                                            \
+        return &a->elts[a->nelts++];                                        \
+    }                                                                       \
+                                                                            \
+    static inline                                                           \
+    bool name##_array_append(name##_array_t *a, type element)               \
+    {                                                                       \
+        type *elt;                                                          \
+                                                                            \
+        if ((elt = name##_array_push_back(a)) == NULL) {                    \
+            return false;                                                   \
+        }                                                                   \
+                                                                            \
+        *elt = element;                                                     \
+        return true;                                                        \
+    }                                                                       \
+                                                                            \
+    static inline                                                           \
+    bool name##_array_append_n(name##_array_t *a, const type *elts, size_t m) \
+    {                                                                       \
+        if (!name##_array_reserve(a, a->nelts + m)) {                       \
+            return false;                                                   \
+        }                                                                   \
+                                                                            \
+        if (m != 0) {                                                       \
+            memcpy(&a->elts[a->nelts], elts, m * sizeof(type));             \
+        }                                                                   \
+                                                                            \
+        a->nelts += m;                                                      \
+        return true;                                                        \
+    }                                                                       \
+                                                                            \
+    static inline                                                           \
+    type* name##_array_at(name##_array_t *a, size_t i)                      \
+    {                                                                       \
+        assert(a->nelts > i);                                               \
+        return &a->elts[i];                                                 \
+    }                                                                       \
+                                                                            \
+    static inline                                                           \
+    type* name##_array_back(name##_array_t *a)                              \
+    {                                                                       \
+        assert(a->nelts > 0);                                               \
+        return &a->elts[a->nelts - 1];                                      \
+    }
+
+
 #endif
@@ -0,0 +1,425 @@
+#include "config.h"
+#include "pmalloc.h"
+#include "cstring.h"
+#include "array.h"
+#include "bench.h"
+
+#if defined(UNIX)
+#   include <sys/resource.h>
+#endif
+
+
+/* the sources of the compiler read as the corpus, those here that exist */
+static const char *__corpus__[] = {
+    "lexer.c", "preprocessor.c", "reader.c", "diagnostor.c", "dict.c",
+    "cstring.c", "hideset.c", "tokbuf.c", "encoding.c", "scan.c",
+};
+
+
+static bench_input_t* __bench_input__(array_t *inputs, const char *name, bool generated);
+static bool __bench_add__(bench_input_t *input, const char *fn);
+static FILE* __bench_create__(bench_input_t *input, const char *fn);
+static bool __bench_close__(FILE *fp);
+static bool __bench_comments__(array_t *inputs);
+static bool __bench_macros__(array_t *inputs);
+static bool __bench_strings__(array_t *inputs);
+static bool __bench_nested__(array_t *inputs);
+static bool __bench_corpus__(array_t *inputs);
+
+
+/**
+ * The files given, all units of one input, or the synthetic inputs and
+ * the corpus when there are none. The synthetic ones are written in the
+ * current directory.
+ **/
+array_t* bench_inputs(int argc, char *argv[])
+{
+    array_t *inputs;
+    bench_input_t *input;
+    int i;
+
+    if ((inputs = array_create_n(sizeof(bench_input_t), 8)) == NULL) {
+        return NULL;
+    }
+
+    if (argc > 1) {
+        if ((input = __bench_input__(inputs, "argv", false)) == NULL) {
+            goto failure;
+        }
+
+        for (i = 1; i < argc; i++) {
+            if (!__bench_add__(input, argv[i])) {
+                goto failure;
+            }
+        }
+
+        input->nunits = bench_nfiles(input);
+        return inputs;
+    }
+
+    if (!__bench_comments__(inputs) || !__bench_macros__(inputs) ||
+        !__bench_strings__(inputs) || !__bench_nested__(inputs) ||
+        !__bench_corpus__(inputs)) {
+        goto failure;
+    }
+
+    return inputs;
+
+failure:
+    fprintf(stderr, "bench: cannot make the inputs\n");
+    bench_inputs_destroy(inputs);
+    return NULL;
+}
+
+
+void bench_inputs_destroy(array_t *inputs)
+{
+    bench_input_t *input;
+    size_t i, j;
+
+    array_foreach(inputs, input, i) {
+        for (j = 0; j < bench_nfiles(&input[i]); j++) {
+            if (input[i].generated) {
+                remove(bench_file(&input[i], j));
+            }
+            cstring_free(array_cast_at(cstring_t, input[i].files, j));
+        }
+        array_destroy(input[i].files);
+    }
+
+    array_destroy(inputs);
+}
+
+
+/**
+ * Runs trial over input, BENCH_WARMUP times untimed and BENCH_TRIALS
+ * times timed, and prints a line: the throughput of the best trial, the
+ * allocations per item of the last and the peak RSS of the process up
+ * to now.
+ **/
+void bench_run(const char *stage, const char *item, bench_input_t *input,
+               bench_trial_pt trial, void *ud)
+{
+    bench_counts_t counts;
+    size_t allocs = 0;
+    double best = 0, total = 0, begin, elapsed;
+    int i;
+
+    for (i = 0; i < BENCH_WARMUP; i++) {
+        counts.bytes = counts.items = 0;
+        trial(input, &counts, ud);
+    }
+
+    for (i = 0; i < BENCH_TRIALS; i++) {
+        counts.bytes = counts.items = 0;
+        allocs = pmalloc_count();
+        begin = bench_now();
+
+        trial(input, &counts, ud);
+
+        elapsed = bench_now() - begin;
+        allocs = pmalloc_count() - allocs;
+
+        if (i == 0 || elapsed < best) {
+            best = elapsed;
+        }
+        total += elapsed;
+    }
+
+    if (best <= 0) {
+        best = 1e-9;
+    }
+
+    printf("%-6s %-9s %9.2f MB/s %9.2f M%ss/s %8.3f allocs/%s %9.3f ms best %9.3f ms mean %8lu KB peak rss\n",
+           stage, input->name, counts.bytes / best / 1e6, counts.items / best / 1e6, item,
+           counts.items != 0 ? (double) allocs / counts.items : 0.0, item,
+           best * 1e3, total / BENCH_TRIALS * 1e3, (unsigned long) bench_peak_rss());
+    fflush(stdout);
+}
+
+
+double bench_now(void)
+{
+#if defined(UNIX)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+#else
+    return (double) clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+
+/* in KB, 0 where it is not known */
+size_t bench_peak_rss(void)
+{
+#if defined(UNIX)
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+
+#   if defined(__APPLE__)
+    return (size_t) usage.ru_maxrss / 1024;
+#   else
+    return (size_t) usage.ru_maxrss;
+#   endif
+#else
+    return 0;
+#endif
+}
+
+
+static
+bench_input_t* __bench_input__(array_t *inputs, const char *name, bool generated)
+{
+    bench_input_t *input;
+
+    if ((input = array_push_back(inputs)) == NULL) {
+        return NULL;
+    }
+
+    input->name = name;
+    input->nunits = 1;
+    input->generated = generated;
+
+    if ((input->files = array_create_n(sizeof(cstring_t), 4)) == NULL) {
+        array_pop_back(inputs);
+        return NULL;
+    }
+
+    return input;
+}
+
+
+static
+bool __bench_add__(bench_input_t *input, const char *fn)
+{
+    cstring_t *slot;
+
+    if ((slot = array_push_back(input->files)) == NULL) {
+        return false;
+    }
+
+    if ((*slot = cstring_new(fn)) == NULL) {
+        array_pop_back(input->files);
+        return false;
+    }
+
+    return true;
+}
+
+
+static
+FILE* __bench_create__(bench_input_t *input, const char *fn)
+{
+    FILE *fp;
+
+    if ((fp = fopen(fn, "wb")) == NULL) {
+        return NULL;
+    }
+
+    if (!__bench_add__(input, fn)) {
+        fclose(fp);
+        remove(fn);
+        return NULL;
+    }
+
+    return fp;
+}
+
+
+static
+bool __bench_close__(FILE *fp)
+{
+    bool ok = !ferror(fp);
+
+    return fclose(fp) == 0 && ok;
+}
+
+
+/* long block and line comments between a few declarations */
+static
+bool __bench_comments__(array_t *inputs)
+{
+    bench_input_t *input;
+    FILE *fp;
+    long n;
+
+    if ((input = __bench_input__(inputs, "comments", true)) == NULL ||
+        (fp = __bench_create__(input, "bench-comments.c")) == NULL) {
+        return false;
+    }
+
+    for (n = 0; ftell(fp) < (long) BENCH_SYNTHETIC_SIZE; n++) {
+        fprintf(fp,
+                "/**\n"
+                " * The %ld-th block of the comment-heavy input: the lexer skips it\n"
+                " * byte by byte looking for the end, with * and / inside it, as in\n"
+                " * a / b * c, and a few lines of it to go through the line map.\n"
+                " **/\n"
+                "int x%ld;   // a line comment after a declaration, up to the newline\n"
+                "// and one on its own line, with a \\ that is not at its end\n"
+                "/* one on a line */ int y%ld; /* and one more after */\n\n",
+                n, n, n);
+    }
+
+    return __bench_close__(fp);
+}
+
+
+/* chains of function-like macros, each use expanding all of a chain */
+static
+bool __bench_macros__(array_t *inputs)
+{
+    bench_input_t *input;
+    FILE *fp;
+    long n;
+    int i;
+
+    if ((input = __bench_input__(inputs, "macros", true)) == NULL ||
+        (fp = __bench_create__(input, "bench-macros.c")) == NULL) {
+        return false;
+    }
+
+    for (n = 0; ftell(fp) < (long) BENCH_SYNTHETIC_SIZE; n++) {
+        fprintf(fp, "#define M%ld_0(a, b) ((a) + (b))\n", n);
+        for (i = 1; i < 16; i++) {
+            fprintf(fp, "#define M%ld_%d(a, b) (M%ld_%d((a), (b)) * (a) - (b))\n", n, i, n, i - 1);
+        }
+
+        fprintf(fp, "#define S%ld(x) #x\n#define C%ld(x, y) x ## y\n", n, n);
+        for (i = 0; i < 16; i++) {
+            fprintf(fp, "int C%ld(v%ld_, %d) = M%ld_%d(x, y + %d); const char *s%ld_%d = S%ld(M%ld_%d);\n",
+                    n, n, i, n, i, i, n, i, n, n, i);
+        }
+
+        fputc('\n', fp);
+    }
+
+    return __bench_close__(fp);
+}
+
+
+/* long string literals with escapes, some of them adjacent */
+static
+bool __bench_strings__(array_t *inputs)
+{
+    bench_input_t *input;
+    FILE *fp;
+    long n;
+    int i;
+
+    if ((input = __bench_input__(inputs, "strings", true)) == NULL ||
+        (fp = __bench_create__(input, "bench-strings.c")) == NULL) {
+        return false;
+    }
+
+    for (n = 0; ftell(fp) < (long) BENCH_SYNTHETIC_SIZE; n++) {
+        fprintf(fp, "static const char *s%ld = \"", n);
+        for (i = 0; i < 64; i++) {
+            fputs("the quick brown fox jumps over the lazy dog\\t", fp);
+        }
+        fputs("\\n\"\n    \"an escaped \\\"quote\\\", \\x41\\101 and a \\\\ to end with\";\n", fp);
+    }
+
+    return __bench_close__(fp);
+}
+
+
+/* a unit including headers BENCH_NESTED_DEPTH deep, each guarded */
+static
+bool __bench_nested__(array_t *inputs)
+{
+    bench_input_t *input;
+    FILE *fp;
+    char fn[64];
+    long n;
+    int depth, i;
+
+    if ((input = __bench_input__(inputs, "nested", true)) == NULL ||
+        (fp = __bench_create__(input, "bench-nested.c")) == NULL) {
+        return false;
+    }
+
+    fprintf(fp, "#include \"bench-nested-1.h\"\n\n");
+    for (n = 0; ftell(fp) < (long) BENCH_SYNTHETIC_SIZE / 4; n++) {
+        fprintf(fp, "int f%ld(struct s%d *p) { return p->a%d + NESTED_%d(%ld); }\n",
+                n, (int) (n % BENCH_NESTED_DEPTH) + 1, (int) (n % 4),
+                (int) (n % BENCH_NESTED_DEPTH) + 1, n);
+    }
+
+    if (!__bench_close__(fp)) {
+        return false;
+    }
+
+    for (depth = 1; depth <= BENCH_NESTED_DEPTH; depth++) {
+        sprintf(fn, "bench-nested-%d.h", depth);
+        if ((fp = __bench_create__(input, fn)) == NULL) {
+            return false;
+        }
+
+        fprintf(fp, "#ifndef BENCH_NESTED_%d_H\n#define BENCH_NESTED_%d_H\n\n", depth, depth);
+        if (depth < BENCH_NESTED_DEPTH) {
+            fprintf(fp, "#include \"bench-nested-%d.h\"\n\n", depth + 1);
+        }
+
+        fprintf(fp, "#define NESTED_%d(x) ((x) + %d)\n\nstruct s%d {\n", depth, depth, depth);
+        for (i = 0; i < 4; i++) {
+            fprintf(fp, "    int a%d;\n", i);
+        }
+        fprintf(fp, "};\n\nint g%d(struct s%d *p, const char *name);\n\n#endif\n", depth, depth);
+
+        if (!__bench_close__(fp)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+static
+bool __bench_corpus__(array_t *inputs)
+{
+    bench_input_t *input;
+    cstring_t fn;
+    FILE *fp;
+    size_t i;
+    bool ok;
+
+    if ((input = __bench_input__(inputs, "corpus", false)) == NULL) {
+        return false;
+    }
+
+    for (i = 0; i < sizeof(__corpus__) / sizeof(__corpus__[0]); i++) {
+        fn = cstring_concat_pf(cstring_new(BENCH_CORPUS), "/%s", __corpus__[i]);
+        if (fn == NULL) {
+            return false;
+        }
+
+        if ((fp = fopen(fn, "rb")) == NULL) {
+            cstring_free(fn);
+            continue;
+        }
+
+        fclose(fp);
+        ok = __bench_add__(input, fn);
+        cstring_free(fn);
+
+        if (!ok) {
+            return false;
+        }
+    }
+
+    input->nunits = bench_nfiles(input);
+
+    if (input->nunits == 0) {
+        fprintf(stderr, "bench: no corpus in %s\n", BENCH_CORPUS);
+        array_destroy(input->files);
+        array_pop_back(inputs);
+    }
+
+    return true;
+}
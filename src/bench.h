@@ -0,0 +1,92 @@
+
+
+#ifndef __BENCH__H__
+#define __BENCH__H__
+
+
+#include "config.h"
+#include "cstring.h"
+#include "array.h"
+
+
+/**
+ * What the benchmarks share: the inputs, the trials and the report. Every
+ * stage runs over the same inputs, synthetic ones that stress one thing
+ * each and a corpus of real sources, the files of the compiler itself.
+ **/
+
+
+#ifndef BENCH_WARMUP
+#define BENCH_WARMUP            1
+#endif
+
+
+#ifndef BENCH_TRIALS
+#define BENCH_TRIALS            5
+#endif
+
+
+/* the size of a synthetic input, about */
+#ifndef BENCH_SYNTHETIC_SIZE
+#define BENCH_SYNTHETIC_SIZE    (2 * 1024 * 1024)
+#endif
+
+
+/* how deep the headers of the nested input include each other */
+#ifndef BENCH_NESTED_DEPTH
+#define BENCH_NESTED_DEPTH      48
+#endif
+
+
+/* where the sources of the compiler are, set by the build */
+#ifndef BENCH_CORPUS
+#define BENCH_CORPUS            "src"
+#endif
+
+
+/**
+ * An input is a few files. The first nunits are units, the rest is what
+ * they include, read by the stages that do not follow includes. Files
+ * generated are removed by bench_inputs_destroy().
+ **/
+typedef struct bench_input_s {
+    const char *name;
+    array_t *files;
+    size_t nunits;
+    bool generated;
+} bench_input_t;
+
+
+/* what a trial went through: the bytes read and the items made, tokens or else */
+typedef struct bench_counts_s {
+    size_t bytes;
+    size_t items;
+} bench_counts_t;
+
+
+typedef void (*bench_trial_pt)(bench_input_t *input, bench_counts_t *counts, void *ud);
+
+
+array_t* bench_inputs(int argc, char *argv[]);
+void bench_inputs_destroy(array_t *inputs);
+void bench_run(const char *stage, const char *item, bench_input_t *input,
+               bench_trial_pt trial, void *ud);
+double bench_now(void);
+size_t bench_peak_rss(void);
+
+
+static inline
+const char* bench_file(bench_input_t *input, size_t i)
+{
+    return array_cast_at(cstring_t, input->files, i);
+}
+
+
+static inline
+size_t bench_nfiles(bench_input_t *input)
+{
+    return array_length(input->files);
+}
+
+
+#endif
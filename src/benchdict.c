@@ -0,0 +1,157 @@
+#include "config.h"
+#include "pmalloc.h"
+#include "cstring.h"
+#include "array.h"
+#include "dict.h"
+#include "bench.h"
+
+
+/**
+ * Dict throughput on identifiers, as the preprocessor and the interner
+ * use it: the words of each input in the order they occur, each added
+ * or found, then all of them looked up once more. Chained and swiss
+ * tables both. The words are gathered before the trials, so what is
+ * counted is the table and its entries; the items are operations.
+ **/
+
+
+typedef struct benchdict_s {
+    array_t *words;
+    size_t bytes;
+    bool swiss;
+} benchdict_t;
+
+
+static void __words__(bench_input_t *input, benchdict_t *bd);
+static void __lookup__(bench_input_t *input, bench_counts_t *counts, void *ud);
+static uint64_t __hash_fn__(const void *key);
+static int __compare_fn__(void *privdata, const void *key1, const void *key2);
+
+
+static dict_type_t __dict_type__ = {
+    __hash_fn__,
+    NULL,
+    NULL,
+    __compare_fn__,
+    NULL,
+    NULL,
+};
+
+
+/* the identifiers of the files of input, the keywords among them */
+static
+void __words__(bench_input_t *input, benchdict_t *bd)
+{
+    FILE *fp;
+    cstring_t word;
+    unsigned char buf[4096];
+    size_t i, j, n;
+
+    for (i = 0; i < bench_nfiles(input); i++) {
+        if ((fp = fopen(bench_file(input, i), "rb")) == NULL) {
+            continue;
+        }
+
+        word = cstring_new_n(NULL, 64);
+        cstring_clear(word);
+
+        while ((n = fread(buf, 1, sizeof(buf), fp)) != 0) {
+            for (j = 0; j < n; j++) {
+                if (isalpha(buf[j]) || buf[j] == '_' ||
+                    (isdigit(buf[j]) && cstring_length(word) != 0)) {
+                    word = cstring_push_ch(word, buf[j]);
+                    continue;
+                }
+
+                if (cstring_length(word) != 0) {
+                    array_cast_append(cstring_t, bd->words, cstring_dup(word));
+                    bd->bytes += cstring_length(word);
+                    cstring_clear(word);
+                }
+            }
+        }
+
+        cstring_free(word);
+        fclose(fp);
+    }
+}
+
+
+static
+void __lookup__(bench_input_t *input, bench_counts_t *counts, void *ud)
+{
+    benchdict_t *bd = (benchdict_t *) ud;
+    cstring_t *words;
+    dict_t *d;
+    size_t i, n, hits = 0;
+
+    d = bd->swiss ? dict_create_swiss(&__dict_type__, NULL) : dict_create(&__dict_type__, NULL);
+
+    words = array_prototype(bd->words, cstring_t);
+    n = array_length(bd->words);
+
+    for (i = 0; i < n; i++) {
+        dict_add_or_find(d, words[i]);
+    }
+
+    for (i = 0; i < n; i++) {
+        hits += dict_find(d, words[i]) != NULL;
+    }
+
+    if (hits != n) {
+        fprintf(stderr, "benchdict: %lu words of %lu not found\n",
+                (unsigned long) (n - hits), (unsigned long) n);
+    }
+
+    dict_destroy(d);
+
+    counts->bytes += 2 * bd->bytes;
+    counts->items += 2 * n;
+}
+
+
+static
+uint64_t __hash_fn__(const void *key)
+{
+    return dict_gen_hash_function(key, (int) cstring_length((cstring_t) key));
+}
+
+
+static
+int __compare_fn__(void *privdata, const void *key1, const void *key2)
+{
+    DICT_NOTUSED(privdata);
+    return cstring_compare_cs((cstring_t) key1, (cstring_t) key2) == 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    array_t *inputs;
+    bench_input_t *input;
+    benchdict_t bd;
+    size_t i, j;
+
+    if ((inputs = bench_inputs(argc, argv)) == NULL) {
+        return 1;
+    }
+
+    array_foreach(inputs, input, i) {
+        bd.words = array_create_n(sizeof(cstring_t), 1024);
+        bd.bytes = 0;
+        __words__(&input[i], &bd);
+
+        bd.swiss = false;
+        bench_run("dict", "op", &input[i], __lookup__, &bd);
+        bd.swiss = true;
+        bench_run("swiss", "op", &input[i], __lookup__, &bd);
+
+        for (j = 0; j < array_length(bd.words); j++) {
+            cstring_free(array_cast_at(cstring_t, bd.words, j));
+        }
+        array_destroy(bd.words);
+    }
+
+    bench_inputs_destroy(inputs);
+    return 0;
+}
@@ -0,0 +1,356 @@
+
+
+#include "config.h"
+#include "pmalloc.h"
+#include "hash.h"
+
+#include <math.h>
+
+
+/**
+ * Hash throughput and quality on identifiers. The corpus is the words of
+ * the files given on the command line, or synthetic names like those of
+ * a C program when there are none. For each hash it prints the best of a
+ * few rounds over every word as it occurs, then for the distinct words
+ * the full 64 bit collisions and how they fall into buckets: by the low
+ * bits as the chained dict picks them, and by the bits above the seventh
+ * as the open addressed one picks its groups.
+ **/
+
+
+#ifndef BENCHHASH_ROUNDS
+#define BENCHHASH_ROUNDS            5
+#endif
+
+
+#ifndef BENCHHASH_MIN_WORDS
+#define BENCHHASH_MIN_WORDS         (1024 * 1024)
+#endif
+
+
+#ifndef BENCHHASH_SYNTHETIC_WORDS
+#define BENCHHASH_SYNTHETIC_WORDS   200000
+#endif
+
+
+typedef uint64_t (*benchhash_pt)(const uint8_t *in, const size_t inlen, const uint8_t *k);
+
+
+typedef struct benchhash_word_s {
+    size_t offset;
+    size_t length;
+} benchhash_word_t;
+
+
+typedef struct benchhash_corpus_s {
+    unsigned char *text;
+    size_t size;
+    size_t capacity;
+    benchhash_word_t *words;
+    size_t nwords;
+    benchhash_word_t *distinct;
+    size_t ndistinct;
+    size_t wcapacity;
+} benchhash_corpus_t;
+
+
+static const struct {
+    const char *name;
+    benchhash_pt fn;
+} __hashes__[] = {
+    { "siphash", siphash },
+    { "wyhash", wyhash },
+    { "crc32c", crc32c_hash },
+};
+
+
+static const uint8_t __seed__[16] = {
+    0x3c, 0x6e, 0xf3, 0x72, 0xfe, 0x94, 0xf8, 0x2b,
+    0xa5, 0x4f, 0xf5, 0x3a, 0x5f, 0x1d, 0x36, 0xf1,
+};
+
+
+static const char *__synthetic__[] = {
+    "%s", "__%s__", "%s_t", "%s_s", "%s_create", "%s_destroy", "%s_push", "%s%d",
+    "TOKEN_%s", "__%s_%d__", "%s_length", "is_%s", "%s_%s",
+};
+
+
+static const char *__stems__[] = {
+    "i", "n", "p", "s", "cs", "tok", "lexer", "token", "reader", "stream", "hideset",
+    "preprocessor", "macro", "include", "value", "buffer", "size", "next", "count",
+    "location", "line", "column", "file", "name", "entry", "dict", "array", "cstring",
+};
+
+
+static double __now__(void)
+{
+#if defined(UNIX)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+#else
+    return (double) clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+
+static void __add_word__(benchhash_corpus_t *corpus, const unsigned char *s, size_t n)
+{
+    if (corpus->size + n > corpus->capacity) {
+        corpus->capacity = (corpus->size + n) * 2;
+        corpus->text = prealloc(corpus->text, corpus->capacity);
+    }
+
+    if (corpus->nwords == corpus->wcapacity) {
+        corpus->wcapacity = corpus->wcapacity ? corpus->wcapacity * 2 : 4096;
+        corpus->words = prealloc(corpus->words, corpus->wcapacity * sizeof(benchhash_word_t));
+    }
+
+    memcpy(corpus->text + corpus->size, s, n);
+    corpus->words[corpus->nwords].offset = corpus->size;
+    corpus->words[corpus->nwords].length = n;
+    corpus->size += n;
+    corpus->nwords++;
+}
+
+
+static bool __read_words__(benchhash_corpus_t *corpus, const char *fn)
+{
+    unsigned char buf[4096], word[256];
+    size_t n, i, len = 0;
+    FILE *fp;
+
+    if ((fp = fopen(fn, "rb")) == NULL) {
+        fprintf(stderr, "benchhash: cannot read %s\n", fn);
+        return false;
+    }
+
+    while ((n = fread(buf, 1, sizeof(buf), fp)) != 0) {
+        for (i = 0; i < n; i++) {
+            if (buf[i] == '_' || isalpha(buf[i]) || (len != 0 && isdigit(buf[i]))) {
+                if (len < sizeof(word)) {
+                    word[len++] = buf[i];
+                }
+            } else if (len != 0) {
+                __add_word__(corpus, word, len);
+                len = 0;
+            }
+        }
+    }
+
+    if (len != 0) {
+        __add_word__(corpus, word, len);
+    }
+
+    fclose(fp);
+    return true;
+}
+
+
+static void __synthesize__(benchhash_corpus_t *corpus)
+{
+    size_t nforms = sizeof(__synthetic__) / sizeof(__synthetic__[0]);
+    size_t nstems = sizeof(__stems__) / sizeof(__stems__[0]);
+    const char *stem;
+    char word[128];
+    size_t i, form;
+    int n;
+
+    for (i = 0; i < BENCHHASH_SYNTHETIC_WORDS; i++) {
+        stem = __stems__[i % nstems];
+        form = (i / nstems) % nforms;
+
+        switch (form) {
+        case 7:
+        case 9:
+            n = sprintf(word, __synthetic__[form], stem, (int) (i / (nstems * nforms)));
+            break;
+        case 12:
+            n = sprintf(word, __synthetic__[form], stem, __stems__[(i / (nstems * nforms)) % nstems]);
+            break;
+        default:
+            n = sprintf(word, __synthetic__[form], stem);
+            break;
+        }
+
+        __add_word__(corpus, (unsigned char *) word, (size_t) n);
+    }
+}
+
+
+static const unsigned char *__corpus_text__;
+
+
+static int __compare_words__(const void *l, const void *r)
+{
+    const benchhash_word_t *a = (const benchhash_word_t *) l;
+    const benchhash_word_t *b = (const benchhash_word_t *) r;
+
+    if (a->length != b->length) {
+        return a->length < b->length ? -1 : 1;
+    }
+
+    return memcmp(__corpus_text__ + a->offset, __corpus_text__ + b->offset, a->length);
+}
+
+
+static int __compare_hashes__(const void *l, const void *r)
+{
+    uint64_t a = *(const uint64_t *) l, b = *(const uint64_t *) r;
+    return a < b ? -1 : a > b;
+}
+
+
+static void __dedupe__(benchhash_corpus_t *corpus)
+{
+    size_t i;
+
+    corpus->distinct = pmalloc((corpus->nwords + 1) * sizeof(benchhash_word_t));
+    memcpy(corpus->distinct, corpus->words, corpus->nwords * sizeof(benchhash_word_t));
+
+    __corpus_text__ = corpus->text;
+    qsort(corpus->distinct, corpus->nwords, sizeof(benchhash_word_t), __compare_words__);
+
+    corpus->ndistinct = 0;
+    for (i = 0; i < corpus->nwords; i++) {
+        if (corpus->ndistinct == 0 ||
+            __compare_words__(&corpus->distinct[corpus->ndistinct - 1], &corpus->distinct[i]) != 0) {
+            corpus->distinct[corpus->ndistinct++] = corpus->distinct[i];
+        }
+    }
+}
+
+
+static size_t __next_power__(size_t n)
+{
+    size_t i = 1;
+
+    while (i < n) {
+        i *= 2;
+    }
+
+    return i;
+}
+
+
+/* the share of empty buckets, and the fullest */
+static void __buckets__(const uint64_t *hashes, size_t n, size_t nbuckets, int shift,
+    double *empty, size_t *fullest)
+{
+    size_t *counts, i, nempty = 0;
+
+    counts = pcalloc(nbuckets, sizeof(size_t));
+    *fullest = 0;
+
+    for (i = 0; i < n; i++) {
+        size_t b = (size_t) (hashes[i] >> shift) & (nbuckets - 1);
+        if (++counts[b] > *fullest) {
+            *fullest = counts[b];
+        }
+    }
+
+    for (i = 0; i < nbuckets; i++) {
+        nempty += counts[i] == 0;
+    }
+
+    *empty = (double) nempty / (double) nbuckets;
+    pfree(counts);
+}
+
+
+static void __bench__(benchhash_corpus_t *corpus, const char *name, benchhash_pt fn)
+{
+    volatile uint64_t sink = 0;
+    uint64_t acc, *hashes;
+    size_t i, j, passes, nbuckets, ngroups, collisions, fullest, fullest_group;
+    double best = 0, begin, elapsed, empty, empty_groups;
+    int round;
+
+    passes = (BENCHHASH_MIN_WORDS + corpus->nwords - 1) / corpus->nwords;
+
+    for (round = 0; round < BENCHHASH_ROUNDS; round++) {
+        acc = 0;
+        begin = __now__();
+
+        for (j = 0; j < passes; j++) {
+            for (i = 0; i < corpus->nwords; i++) {
+                acc ^= fn(corpus->text + corpus->words[i].offset, corpus->words[i].length, __seed__);
+            }
+        }
+
+        elapsed = __now__() - begin;
+        sink ^= acc;
+        if (round == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+
+    hashes = pmalloc(corpus->ndistinct * sizeof(uint64_t));
+    for (i = 0; i < corpus->ndistinct; i++) {
+        hashes[i] = fn(corpus->text + corpus->distinct[i].offset, corpus->distinct[i].length, __seed__);
+    }
+
+    nbuckets = __next_power__(corpus->ndistinct);
+    __buckets__(hashes, corpus->ndistinct, nbuckets, 0, &empty, &fullest);
+
+    /* groups of 16 slots at most seven eighths full */
+    ngroups = __next_power__((corpus->ndistinct + 13) / 14);
+    __buckets__(hashes, corpus->ndistinct, ngroups, 7, &empty_groups, &fullest_group);
+
+    qsort(hashes, corpus->ndistinct, sizeof(uint64_t), __compare_hashes__);
+    for (collisions = 0, i = 1; i < corpus->ndistinct; i++) {
+        collisions += hashes[i] == hashes[i - 1];
+    }
+
+    printf("%-8s %9.2f %9.2f %10lu %8.2f%% %8lu %8lu\n", name,
+           (double) (passes * corpus->nwords) / best / 1e6,
+           (double) (passes * corpus->size) / best / 1e6,
+           (unsigned long) collisions, empty * 100, (unsigned long) fullest,
+           (unsigned long) fullest_group);
+
+    pfree(hashes);
+    (void) sink;
+}
+
+
+int main(int argc, char *argv[])
+{
+    benchhash_corpus_t corpus;
+    size_t i, nbuckets;
+    int arg;
+
+    memset(&corpus, 0, sizeof(corpus));
+
+    for (arg = 1; arg < argc; arg++) {
+        __read_words__(&corpus, argv[arg]);
+    }
+
+    if (argc < 2) {
+        __synthesize__(&corpus);
+    }
+
+    if (corpus.nwords == 0) {
+        fprintf(stderr, "benchhash: no words\n");
+        return EXIT_FAILURE;
+    }
+
+    __dedupe__(&corpus);
+
+    nbuckets = __next_power__(corpus.ndistinct);
+    printf("%lu words, %lu distinct, %lu bytes, %lu buckets (%.2f%% empty when uniform)\n",
+           (unsigned long) corpus.nwords, (unsigned long) corpus.ndistinct,
+           (unsigned long) corpus.size, (unsigned long) nbuckets,
+           exp(-(double) corpus.ndistinct / (double) nbuckets) * 100);
+    printf("%-8s %9s %9s %10s %9s %8s %8s\n", "hash", "Mhash/s", "MB/s", "collisions",
+           "empty", "bucket", "group");
+
+    for (i = 0; i < sizeof(__hashes__) / sizeof(__hashes__[0]); i++) {
+        __bench__(&corpus, __hashes__[i].name, __hashes__[i].fn);
+    }
+
+    pfree(corpus.text);
+    pfree(corpus.words);
+    pfree(corpus.distinct);
+    return 0;
+}
@@ -0,0 +1,70 @@
+#include "config.h"
+#include "srcloc.h"
+#include "token.h"
+#include "reader.h"
+#include "lexer.h"
+#include "bench.h"
+
+
+/**
+ * Lexer throughput: every file of each input scanned into tokens, the
+ * spaces left out of the count. The inputs are those of bench_inputs().
+ **/
+
+
+static void __scan__(bench_input_t *input, bench_counts_t *counts, void *ud);
+
+
+static
+void __scan__(bench_input_t *input, bench_counts_t *counts, void *ud)
+{
+    lexer_t *lexer;
+    token_t *token;
+    token_type_t type;
+    size_t i, offset;
+
+    for (i = 0; i < bench_nfiles(input); i++) {
+        lexer = lexer_create();
+
+        if (!lexer_push(lexer, STREAM_TYPE_FILE, (const unsigned char *) bench_file(input, i))) {
+            fprintf(stderr, "benchlexer: cannot read %s\n", bench_file(input, i));
+            lexer_destroy(lexer);
+            continue;
+        }
+
+        do {
+            token = lexer_scan(lexer);
+            type = token->type;
+            if (type != TOKEN_SPACE) {
+                counts->items++;
+            }
+            if (type == TOKEN_EOF && srcloc_buffer(token->loc, &offset) != NULL) {
+                counts->bytes += offset;
+            }
+            token_destroy(token);
+        } while (type != TOKEN_END);
+
+        lexer_destroy(lexer);
+    }
+
+    srcloc_cleanup();
+}
+
+
+int main(int argc, char *argv[])
+{
+    array_t *inputs;
+    bench_input_t *input;
+    size_t i;
+
+    if ((inputs = bench_inputs(argc, argv)) == NULL) {
+        return 1;
+    }
+
+    array_foreach(inputs, input, i) {
+        bench_run("lexer", "token", &input[i], __scan__, NULL);
+    }
+
+    bench_inputs_destroy(inputs);
+    return 0;
+}
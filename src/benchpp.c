@@ -0,0 +1,113 @@
+#include "config.h"
+#include "option.h"
+#include "srcloc.h"
+#include "token.h"
+#include "reader.h"
+#include "diagnostor.h"
+#include "hideset.h"
+#include "lexer.h"
+#include "incpath.h"
+#include "preprocessor.h"
+#include "bench.h"
+
+
+/**
+ * Preprocessor throughput: each unit of the inputs expanded to the end,
+ * its includes followed through the corpus and the system directories.
+ * The bytes are those of the files of the input, the tokens those that
+ * come out. What is diagnosed is dropped, a corpus file read as a unit
+ * may well have errors without the flags it is built with. It is run
+ * with -fpipeline as well.
+ **/
+
+
+static void __expand__(bench_input_t *input, bench_counts_t *counts, void *ud);
+static size_t __size__(const char *fn);
+
+
+static
+void __expand__(bench_input_t *input, bench_counts_t *counts, void *ud)
+{
+    incpath_t *inc = (incpath_t *) ud;
+    diagnostor_t *diag, *saved_diagnostor;
+    preprocessor_t *pp;
+    lexer_t *lexer;
+    token_t *tok;
+    size_t i;
+
+    for (i = 0; i < bench_nfiles(input); i++) {
+        counts->bytes += __size__(bench_file(input, i));
+    }
+
+    for (i = 0; i < input->nunits; i++) {
+        diag = diagnostor_create();
+        saved_diagnostor = diagnostor;
+        diagnostor = diag;
+
+        lexer = lexer_create();
+        lexer_set_trivia(lexer, false);
+
+        if (!lexer_push(lexer, STREAM_TYPE_FILE, (const unsigned char *) bench_file(input, i))) {
+            fprintf(stderr, "benchpp: cannot read %s\n", bench_file(input, i));
+        } else {
+            pp = preprocessor_create_incpath(lexer, inc);
+
+            while ((tok = preprocessor_expand(pp))->type != TOKEN_END && tok->type != TOKEN_EOF) {
+                counts->items++;
+                token_destroy(tok);
+            }
+            token_destroy(tok);
+
+            preprocessor_destroy(pp);
+        }
+
+        lexer_destroy(lexer);
+        hideset_cleanup();
+        srcloc_cleanup();
+
+        diagnostor = saved_diagnostor;
+        diagnostor_destroy(diag);
+    }
+}
+
+
+static
+size_t __size__(const char *fn)
+{
+    struct stat st;
+
+    return stat(fn, &st) == 0 ? (size_t) st.st_size : 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    array_t *inputs;
+    bench_input_t *input;
+    incpath_t *inc;
+    size_t i;
+
+    if ((inputs = bench_inputs(argc, argv)) == NULL) {
+        return 1;
+    }
+
+    /* the errors of a trial are counted, never enough to stop it */
+    option->ferror_limit = (size_t) -1;
+
+    inc = incpath_create();
+    incpath_add(inc, BENCH_CORPUS);
+    incpath_add_std(inc);
+
+    array_foreach(inputs, input, i) {
+        bench_run("pp", "token", &input[i], __expand__, inc);
+
+        /* the same with the big files lexed on a thread of their own */
+        option->pipeline = true;
+        bench_run("pp-pipeline", "token", &input[i], __expand__, inc);
+        option->pipeline = false;
+    }
+
+    incpath_destroy(inc);
+    bench_inputs_destroy(inputs);
+    return 0;
+}
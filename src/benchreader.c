@@ -0,0 +1,60 @@
+#include "config.h"
+#include "srcloc.h"
+#include "reader.h"
+#include "bench.h"
+
+
+/**
+ * Reader throughput: every file of each input read a character at a time
+ * with reader_get(), through the line splicing and trigraphs it does.
+ * The inputs are those of bench_inputs(), the items are characters.
+ **/
+
+
+static void __read__(bench_input_t *input, bench_counts_t *counts, void *ud);
+
+
+static
+void __read__(bench_input_t *input, bench_counts_t *counts, void *ud)
+{
+    reader_t *reader;
+    size_t i;
+
+    for (i = 0; i < bench_nfiles(input); i++) {
+        reader = reader_create();
+
+        if (!reader_push(reader, STREAM_TYPE_FILE, (const unsigned char *) bench_file(input, i))) {
+            fprintf(stderr, "benchreader: cannot read %s\n", bench_file(input, i));
+            reader_destroy(reader);
+            continue;
+        }
+
+        while (reader_get(reader) != EOF) {
+            counts->items++;
+        }
+
+        counts->bytes += reader_offset(reader);
+        reader_destroy(reader);
+    }
+
+    srcloc_cleanup();
+}
+
+
+int main(int argc, char *argv[])
+{
+    array_t *inputs;
+    bench_input_t *input;
+    size_t i;
+
+    if ((inputs = bench_inputs(argc, argv)) == NULL) {
+        return 1;
+    }
+
+    array_foreach(inputs, input, i) {
+        bench_run("reader", "char", &input[i], __read__, NULL);
+    }
+
+    bench_inputs_destroy(inputs);
+    return 0;
+}
@@ -0,0 +1,49 @@
+#ifndef __CHARCLASS__H__
+#define __CHARCLASS__H__
+
+
+#include "config.h"
+
+
+#define CHARCLASS_SPACE             0x01    /* ' ' \t \n \v \f \r */
+#define CHARCLASS_DIGIT             0x02    /* 0-9 */
+#define CHARCLASS_HEX               0x04    /* 0-9 a-f A-F */
+#define CHARCLASS_ALPHA             0x08    /* a-z A-Z */
+#define CHARCLASS_WORD              0x10    /* a-z A-Z 0-9 _ */
+#define CHARCLASS_IDENT             0x20    /* word, $ and 0x80-0xfd */
+#define CHARCLASS_PUNCT             0x40    /* first byte of a punctuator */
+
+
+/**
+ * Character classes of the C source character set, independent of the
+ * locale. EOF indexes the 0xff entry, which belongs to no class.
+ **/
+static const unsigned char __charclass__[256] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x01, 0x01, 0x01, 0x01, 0x00, 0x00,   /* 00 */
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,   /* 10 */
+    0x01, 0x40, 0x00, 0x40, 0x20, 0x40, 0x40, 0x00, 0x40, 0x40, 0x40, 0x40, 0x40, 0x40, 0x40, 0x40,   /* 20 */
+    0x36, 0x36, 0x36, 0x36, 0x36, 0x36, 0x36, 0x36, 0x36, 0x36, 0x40, 0x40, 0x40, 0x40, 0x40, 0x40,   /* 30 */
+    0x00, 0x3c, 0x3c, 0x3c, 0x3c, 0x3c, 0x3c, 0x38, 0x38, 0x38, 0x38, 0x38, 0x38, 0x38, 0x38, 0x38,   /* 40 */
+    0x38, 0x38, 0x38, 0x38, 0x38, 0x38, 0x38, 0x38, 0x38, 0x38, 0x38, 0x40, 0x00, 0x40, 0x40, 0x30,   /* 50 */
+    0x00, 0x3c, 0x3c, 0x3c, 0x3c, 0x3c, 0x3c, 0x38, 0x38, 0x38, 0x38, 0x38, 0x38, 0x38, 0x38, 0x38,   /* 60 */
+    0x38, 0x38, 0x38, 0x38, 0x38, 0x38, 0x38, 0x38, 0x38, 0x38, 0x38, 0x40, 0x40, 0x40, 0x40, 0x00,   /* 70 */
+    0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,   /* 80 */
+    0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,   /* 90 */
+    0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,   /* a0 */
+    0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,   /* b0 */
+    0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,   /* c0 */
+    0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,   /* d0 */
+    0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,   /* e0 */
+    0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x00, 0x00,   /* f0 */
+};
+
+
+#define CHARCLASS(ch)                                                   \
+    (__charclass__[(unsigned char) (ch)])
+
+
+#define CHARCLASS_IS(ch, c)                                             \
+    ((CHARCLASS(ch) & (c)) != 0)
+
+
+#endif
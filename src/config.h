@@ -7,6 +7,7 @@
 
 #if defined(DEBUG)
 //#   define     USE_MALLOC
+//#   define     PMALLOC_PROFILE
 #endif
 
 #if defined(WIN32) || defined(_WIN32) || defined(WINDOWS)
@@ -56,6 +57,14 @@ typedef enum {
 #endif
 
 
+/* state a translation unit keeps for itself, one per worker thread */
+#if defined(_MSC_VER)
+#   define THREAD_LOCAL __declspec(thread)
+#else
+#   define THREAD_LOCAL __thread
+#endif
+
+
 #ifndef va_copy 
 #   ifdef __va_copy 
 #       define va_copy(DEST,SRC)  __va_copy((DEST),(SRC)) 
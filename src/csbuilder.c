@@ -0,0 +1,375 @@
+
+
+#include "config.h"
+#include "pmalloc.h"
+#include "list.h"
+#include "cstring.h"
+#include "csbuilder.h"
+
+#include <errno.h>
+
+#if defined(UNIX)
+#   include <unistd.h>
+#   include <sys/uio.h>
+#else
+#   include <io.h>
+#endif
+
+
+/* enough for a long long in base 2 with its sign and '\0' */
+#ifndef CSBUILDER_NUMBER_SIZE
+#define CSBUILDER_NUMBER_SIZE       (72)
+#endif
+
+
+/* the chunks handed to a single writev() */
+#ifndef CSBUILDER_IOV_SIZE
+#define CSBUILDER_IOV_SIZE          (16)
+#endif
+
+
+static csbuilder_chunk_t* __csbuilder_room__(csbuilder_t *b, size_t n);
+#if defined(UNIX)
+static bool __csbuilder_writev__(int fd, struct iovec *iov, int cnt);
+#endif
+
+
+csbuilder_t* csbuilder_create(void)
+{
+    csbuilder_t *b;
+
+    b = (csbuilder_t *) pmalloc(sizeof(csbuilder_t));
+    if (!b) {
+        return NULL;
+    }
+
+    list_init(b->chunks);
+    b->last = NULL;
+    b->length = 0;
+    b->ok = true;
+    return b;
+}
+
+
+void csbuilder_destroy(csbuilder_t *b)
+{
+    list_iter_t iter;
+
+    while (!list_is_empty(b->chunks)) {
+        iter = list_begin(b->chunks);
+        list_erase(b->chunks, *iter);
+        pfree(list_element(iter, csbuilder_chunk_t*, node));
+    }
+
+    pfree(b);
+}
+
+
+/**
+ * Empties b, keeping its first chunk for what comes next.
+ **/
+void csbuilder_clear(csbuilder_t *b)
+{
+    csbuilder_chunk_t *first;
+    list_iter_t iter;
+
+    if (list_is_empty(b->chunks)) {
+        b->ok = true;
+        return;
+    }
+
+    first = list_element(list_begin(b->chunks), csbuilder_chunk_t*, node);
+
+    while (!list_is_singular(b->chunks)) {
+        iter = list_rbegin(b->chunks);
+        list_erase(b->chunks, *iter);
+        pfree(list_element(iter, csbuilder_chunk_t*, node));
+    }
+
+    first->used = 0;
+    b->last = first;
+    b->length = 0;
+    b->ok = true;
+}
+
+
+bool csbuilder_append_n(csbuilder_t *b, const void *data, size_t n)
+{
+    const unsigned char *p = (const unsigned char *) data;
+    csbuilder_chunk_t *chunk;
+    size_t room;
+
+    if (!b->ok) {
+        return false;
+    }
+
+    if (b->last != NULL) {
+        room = b->last->size - b->last->used;
+        room = room < n ? room : n;
+
+        memcpy(b->last->data + b->last->used, p, room);
+        b->last->used += room;
+        b->length += room;
+        p += room;
+        n -= room;
+    }
+
+    if (n == 0) {
+        return true;
+    }
+
+    if ((chunk = __csbuilder_room__(b, n)) == NULL) {
+        return false;
+    }
+
+    memcpy(chunk->data, p, n);
+    chunk->used = n;
+    b->length += n;
+    return true;
+}
+
+
+/**
+ * The digits go straight into the chunk, as do those of the functions
+ * below.
+ **/
+bool csbuilder_append_ll(csbuilder_t *b, long long value)
+{
+    csbuilder_chunk_t *chunk;
+    size_t n;
+
+    if ((chunk = __csbuilder_room__(b, CSBUILDER_NUMBER_SIZE)) == NULL) {
+        return false;
+    }
+
+    n = ll2str((char *) chunk->data + chunk->used, value);
+    chunk->used += n;
+    b->length += n;
+    return true;
+}
+
+
+bool csbuilder_append_ull(csbuilder_t *b, unsigned long long value, int base)
+{
+    csbuilder_chunk_t *chunk;
+    size_t n;
+
+    if ((chunk = __csbuilder_room__(b, CSBUILDER_NUMBER_SIZE)) == NULL) {
+        return false;
+    }
+
+    n = ull2str((char *) chunk->data + chunk->used, value, base);
+    chunk->used += n;
+    b->length += n;
+    return true;
+}
+
+
+/**
+ * Formats into what is left of the last chunk, and only if that is too
+ * little a second time into a chunk with room for all of it.
+ **/
+bool csbuilder_append_vpf(csbuilder_t *b, const char *fmt, va_list ap)
+{
+    csbuilder_chunk_t *chunk;
+    cstring_t cs;
+    va_list cpy;
+    size_t room;
+    int n;
+    bool ok;
+
+    if (!b->ok) {
+        return false;
+    }
+
+    room = b->last != NULL ? b->last->size - b->last->used : 0;
+
+    if (room != 0) {
+        va_copy(cpy, ap);
+        n = vsnprintf((char *) b->last->data + b->last->used, room, fmt, cpy);
+        va_end(cpy);
+
+        if (n >= 0 && (size_t) n < room) {
+            b->last->used += (size_t) n;
+            b->length += (size_t) n;
+            return true;
+        }
+    } else {
+        va_copy(cpy, ap);
+        n = vsnprintf(NULL, 0, fmt, cpy);
+        va_end(cpy);
+    }
+
+    if (n >= 0) {
+        if ((chunk = __csbuilder_room__(b, (size_t) n + 1)) == NULL) {
+            return false;
+        }
+
+        va_copy(cpy, ap);
+        vsnprintf((char *) chunk->data + chunk->used, (size_t) n + 1, fmt, cpy);
+        va_end(cpy);
+
+        chunk->used += (size_t) n;
+        b->length += (size_t) n;
+        return true;
+    }
+
+    /* a vsnprintf() that does not tell the length */
+    if ((cs = cstring_concat_vpf(cstring_new_n(NULL, 0), fmt, ap)) == NULL) {
+        b->ok = false;
+        return false;
+    }
+
+    ok = csbuilder_append_n(b, cs, cstring_length(cs));
+    cstring_free(cs);
+    return ok;
+}
+
+
+bool csbuilder_append_pf(csbuilder_t *b, const char *fmt, ...)
+{
+    va_list ap;
+    bool ok;
+
+    va_start(ap, fmt);
+
+    ok = csbuilder_append_vpf(b, fmt, ap);
+
+    va_end(ap);
+
+    return ok;
+}
+
+
+/**
+ * The text glued into one string, NULL if an append failed.
+ **/
+cstring_t csbuilder_to_cstring(csbuilder_t *b)
+{
+    csbuilder_chunk_t *chunk;
+    list_iter_t iter;
+    cstring_t cs;
+
+    if (!b->ok || (cs = cstring_new_n(NULL, b->length + 1)) == NULL) {
+        return NULL;
+    }
+
+    list_for_each(b->chunks, iter) {
+        chunk = list_element(iter, csbuilder_chunk_t*, node);
+        cs = cstring_concat_n(cs, chunk->data, chunk->used);
+    }
+
+    return cs;
+}
+
+
+/**
+ * Writes the text to fd, as few chunks as it takes for a system call,
+ * and empties b. False if an append or a write failed.
+ **/
+bool csbuilder_flush(csbuilder_t *b, int fd)
+{
+    csbuilder_chunk_t *chunk;
+    list_iter_t iter;
+    bool ok = b->ok;
+#if defined(UNIX)
+    struct iovec iov[CSBUILDER_IOV_SIZE];
+    int cnt = 0;
+#endif
+
+    list_for_each(b->chunks, iter) {
+        chunk = list_element(iter, csbuilder_chunk_t*, node);
+
+        if (!ok || chunk->used == 0) {
+            continue;
+        }
+
+#if defined(UNIX)
+        if (cnt == CSBUILDER_IOV_SIZE) {
+            ok = __csbuilder_writev__(fd, iov, cnt);
+            cnt = 0;
+        }
+
+        iov[cnt].iov_base = chunk->data;
+        iov[cnt].iov_len = chunk->used;
+        cnt++;
+#else
+        ok = _write(fd, chunk->data, (unsigned int) chunk->used) == (int) chunk->used;
+#endif
+    }
+
+#if defined(UNIX)
+    if (ok && cnt != 0) {
+        ok = __csbuilder_writev__(fd, iov, cnt);
+    }
+#endif
+
+    csbuilder_clear(b);
+    return ok;
+}
+
+
+/**
+ * The chunk to append n bytes to in one piece, the last one if it has
+ * the room, else a new one.
+ **/
+static
+csbuilder_chunk_t* __csbuilder_room__(csbuilder_t *b, size_t n)
+{
+    csbuilder_chunk_t *chunk;
+    size_t size;
+
+    if (!b->ok) {
+        return NULL;
+    }
+
+    if (b->last != NULL && b->last->size - b->last->used >= n) {
+        return b->last;
+    }
+
+    size = n > CSBUILDER_CHUNK_SIZE ? n : CSBUILDER_CHUNK_SIZE;
+
+    chunk = (csbuilder_chunk_t *) pmalloc(sizeof(csbuilder_chunk_t) + size);
+    if (!chunk) {
+        b->ok = false;
+        return NULL;
+    }
+
+    chunk->used = 0;
+    chunk->size = size;
+
+    list_push_back(b->chunks, chunk->node);
+    b->last = chunk;
+    return chunk;
+}
+
+
+#if defined(UNIX)
+static
+bool __csbuilder_writev__(int fd, struct iovec *iov, int cnt)
+{
+    ssize_t written;
+    int i = 0;
+
+    while (i < cnt) {
+        written = writev(fd, iov + i, cnt - i);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+
+        for (; i < cnt && (size_t) written >= iov[i].iov_len; i++) {
+            written -= (ssize_t) iov[i].iov_len;
+        }
+
+        if (i < cnt) {
+            iov[i].iov_base = (unsigned char *) iov[i].iov_base + written;
+            iov[i].iov_len -= (size_t) written;
+        }
+    }
+
+    return true;
+}
+#endif
@@ -0,0 +1,79 @@
+
+
+#ifndef __CSBUILDER__H__
+#define __CSBUILDER__H__
+
+
+#include "config.h"
+#include "list.h"
+#include "cstring.h"
+
+
+#ifndef CSBUILDER_CHUNK_SIZE
+#define CSBUILDER_CHUNK_SIZE        (4 * 1024)
+#endif
+
+
+typedef struct csbuilder_chunk_s {
+    list_node_t node;
+    size_t used;
+    size_t size;
+    unsigned char data[1];
+} csbuilder_chunk_t;
+
+
+/**
+ * Text put together from many pieces, in chunks of CSBUILDER_CHUNK_SIZE
+ * that are never moved once written: the text is copied once, when it
+ * is glued into a cstring_t or written out. last is the chunk appended
+ * to, length the bytes in all of them. ok is cleared by the first append
+ * that runs out of memory, those after it are dropped.
+ **/
+typedef struct csbuilder_s {
+    list_t chunks;
+    csbuilder_chunk_t *last;
+    size_t length;
+    bool ok;
+} csbuilder_t;
+
+
+csbuilder_t* csbuilder_create(void);
+void csbuilder_destroy(csbuilder_t *b);
+void csbuilder_clear(csbuilder_t *b);
+bool csbuilder_append_n(csbuilder_t *b, const void *data, size_t n);
+bool csbuilder_append_ll(csbuilder_t *b, long long value);
+bool csbuilder_append_ull(csbuilder_t *b, unsigned long long value, int base);
+bool csbuilder_append_vpf(csbuilder_t *b, const char *fmt, va_list ap);
+bool csbuilder_append_pf(csbuilder_t *b, const char *fmt, ...);
+cstring_t csbuilder_to_cstring(csbuilder_t *b);
+bool csbuilder_flush(csbuilder_t *b, int fd);
+
+
+static inline
+bool csbuilder_append_ch(csbuilder_t *b, unsigned char ch)
+{
+    if (b->last != NULL && b->last->used < b->last->size) {
+        b->last->data[b->last->used++] = ch;
+        b->length++;
+        return true;
+    }
+
+    return csbuilder_append_n(b, &ch, 1);
+}
+
+
+static inline
+bool csbuilder_append(csbuilder_t *b, const char *s)
+{
+    return csbuilder_append_n(b, s, strlen(s));
+}
+
+
+static inline
+size_t csbuilder_length(csbuilder_t *b)
+{
+    return b->length;
+}
+
+
+#endif
@@ -17,6 +17,11 @@ static inline
 int __compare_fn__(void *privdata, const void *key1, const void *key2)
 {
     DICT_NOTUSED(privdata);
+
+    if (key1 == key2) {
+        return 1;
+    }
+
     return cstring_compare((cstring_t)key2, (char*)key1) == 0;
 }
 
@@ -46,6 +51,14 @@ cspool_t* cspool_create(void)
 }
 
 
+cspool_t* cspool_create_swiss(void)
+{
+    cspool_t *pool = (cspool_t *)pmalloc(sizeof(cspool_t));
+    pool->d = dict_create_swiss(&__cspool_dict_type__, NULL);
+    return pool;
+}
+
+
 void cspool_destroy(cspool_t *pool)
 {
     dict_destroy(pool->d);
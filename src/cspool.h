@@ -16,6 +16,7 @@ typedef struct cspool_s {
 
 
 cspool_t* cspool_create(void);
+cspool_t* cspool_create_swiss(void);
 void cspool_destroy(cspool_t *pool);
 cstring_t cspool_push(cspool_t *pool, const char *s);
 cstring_t cspool_push_cs(cspool_t *pool, cstring_t cs);
@@ -0,0 +1,280 @@
+
+
+#include "config.h"
+#include "pmalloc.h"
+#include "dict.h"
+#include "cstring.h"
+#include "thread.h"
+#include "cstable.h"
+
+
+static cstable_slots_t* __cstable_slots_create__(size_t nslots);
+static cstring_t __cstable_lookup__(cstable_slots_t *slots, uint64_t hash, const void *s, size_t n);
+static cstring_t __cstable_insert__(cstable_shard_t *shard, uint64_t hash, const void *s, size_t n,
+    cstring_t cs);
+static cstable_slots_t* __cstable_grow__(cstable_shard_t *shard);
+
+
+static inline
+cstable_shard_t* __cstable_shard__(cstable_t *table, uint64_t hash)
+{
+    /* the low bits index the slots, the shard is picked by others */
+    return &table->shards[(size_t) (hash >> 32) & (CSTABLE_SHARDS - 1)];
+}
+
+
+cstable_t* cstable_create(void)
+{
+    cstable_t *table;
+    size_t i;
+
+    table = (cstable_t *) pmalloc(sizeof(cstable_t));
+    if (!table) {
+        return NULL;
+    }
+
+    for (i = 0; i < CSTABLE_SHARDS; i++) {
+        table->shards[i].slots = __cstable_slots_create__(CSTABLE_SHARD_SIZE);
+        table->shards[i].used = 0;
+        mutex_init(&table->shards[i].mutex);
+    }
+
+    return table;
+}
+
+
+/**
+ * No thread may use the table any more, nor the strings it gave out.
+ **/
+void cstable_destroy(cstable_t *table)
+{
+    cstable_slots_t *slots, *retired;
+    size_t i, j;
+
+    for (i = 0; i < CSTABLE_SHARDS; i++) {
+        slots = table->shards[i].slots;
+
+        /* the retired slots hold the same strings, they are freed once */
+        for (j = 0; j <= slots->mask; j++) {
+            if (slots->slots[j].cs != NULL) {
+                cstring_free(slots->slots[j].cs);
+            }
+        }
+
+        for (; slots != NULL; slots = retired) {
+            retired = slots->retired;
+            pfree(slots);
+        }
+
+        mutex_destroy(&table->shards[i].mutex);
+    }
+
+    pfree(table);
+}
+
+
+/**
+ * The interned string spelled by the n bytes at s, NULL if there is none
+ * yet. It takes no lock.
+ **/
+cstring_t cstable_find(cstable_t *table, const void *s, size_t n)
+{
+    cstable_shard_t *shard;
+    uint64_t hash;
+
+    hash = dict_gen_hash_function(s, (int) n);
+    shard = __cstable_shard__(table, hash);
+
+    return __cstable_lookup__(atomic_load_acquire(&shard->slots), hash, s, n);
+}
+
+
+cstring_t cstable_push(cstable_t *table, const char *s)
+{
+    return cstable_push_n(table, s, strlen(s));
+}
+
+
+cstring_t cstable_push_n(cstable_t *table, const void *s, size_t n)
+{
+    cstable_shard_t *shard;
+    cstring_t found;
+    uint64_t hash;
+
+    hash = dict_gen_hash_function(s, (int) n);
+    shard = __cstable_shard__(table, hash);
+
+    found = __cstable_lookup__(atomic_load_acquire(&shard->slots), hash, s, n);
+    if (found != NULL) {
+        return found;
+    }
+
+    return __cstable_insert__(shard, hash, s, n, NULL);
+}
+
+
+/**
+ * Like cspool_push_cs(), cs is taken: kept if it is the first of its
+ * text, freed otherwise.
+ **/
+cstring_t cstable_push_cs(cstable_t *table, cstring_t cs)
+{
+    cstable_shard_t *shard;
+    cstring_t found;
+    uint64_t hash;
+    size_t n;
+
+    n = cstring_length(cs);
+    hash = dict_gen_hash_function(cs, (int) n);
+    shard = __cstable_shard__(table, hash);
+
+    found = __cstable_lookup__(atomic_load_acquire(&shard->slots), hash, cs, n);
+    if (found != NULL) {
+        if (found != cs) {
+            cstring_free(cs);
+        }
+        return found;
+    }
+
+    return __cstable_insert__(shard, hash, cs, n, cs);
+}
+
+
+size_t cstable_length(cstable_t *table)
+{
+    size_t i, n = 0;
+
+    for (i = 0; i < CSTABLE_SHARDS; i++) {
+        mutex_lock(&table->shards[i].mutex);
+        n += table->shards[i].used;
+        mutex_unlock(&table->shards[i].mutex);
+    }
+
+    return n;
+}
+
+
+static
+cstable_slots_t* __cstable_slots_create__(size_t nslots)
+{
+    cstable_slots_t *slots;
+
+    slots = (cstable_slots_t *) pcalloc(1, sizeof(cstable_slots_t) + (nslots - 1) * sizeof(cstable_slot_t));
+    if (!slots) {
+        return NULL;
+    }
+
+    slots->mask = nslots - 1;
+    slots->retired = NULL;
+    return slots;
+}
+
+
+/**
+ * Linear probing up to the first empty slot, there always is one since
+ * the slots are never more than three quarters full.
+ **/
+static
+cstring_t __cstable_lookup__(cstable_slots_t *slots, uint64_t hash, const void *s, size_t n)
+{
+    cstring_t cs;
+    size_t i;
+
+    for (i = (size_t) hash & slots->mask; ; i = (i + 1) & slots->mask) {
+        cs = atomic_load_acquire(&slots->slots[i].cs);
+        if (cs == NULL) {
+            return NULL;
+        }
+
+        if (slots->slots[i].hash == hash && cstring_length(cs) == n && memcmp(cs, s, n) == 0) {
+            return cs;
+        }
+    }
+}
+
+
+/**
+ * Under the shard's lock, where another thread may have just interned
+ * the same text. The hash is written before the string is published, a
+ * reader that sees the string sees its hash.
+ **/
+static
+cstring_t __cstable_insert__(cstable_shard_t *shard, uint64_t hash, const void *s, size_t n,
+    cstring_t cs)
+{
+    cstable_slots_t *slots;
+    cstring_t found;
+    size_t i;
+
+    mutex_lock(&shard->mutex);
+
+    slots = shard->slots;
+
+    found = __cstable_lookup__(slots, hash, s, n);
+    if (found != NULL) {
+        mutex_unlock(&shard->mutex);
+        if (cs != NULL && cs != found) {
+            cstring_free(cs);
+        }
+        return found;
+    }
+
+    if ((shard->used + 1) * 4 > (slots->mask + 1) * 3) {
+        slots = __cstable_grow__(shard);
+        if (slots == NULL) {
+            mutex_unlock(&shard->mutex);
+            return NULL;
+        }
+    }
+
+    if (cs == NULL) {
+        cs = cstring_new_n(s, n);
+    }
+
+    for (i = (size_t) hash & slots->mask; slots->slots[i].cs != NULL; i = (i + 1) & slots->mask) {
+        continue;
+    }
+
+    slots->slots[i].hash = hash;
+    atomic_store_release(&slots->slots[i].cs, cs);
+    shard->used++;
+
+    mutex_unlock(&shard->mutex);
+    return cs;
+}
+
+
+/**
+ * Twice the slots, filled in before they are published. The old ones are
+ * not written to again.
+ **/
+static
+cstable_slots_t* __cstable_grow__(cstable_shard_t *shard)
+{
+    cstable_slots_t *old, *slots;
+    size_t i, j;
+
+    old = shard->slots;
+
+    slots = __cstable_slots_create__((old->mask + 1) * 2);
+    if (!slots) {
+        return NULL;
+    }
+
+    for (i = 0; i <= old->mask; i++) {
+        if (old->slots[i].cs == NULL) {
+            continue;
+        }
+
+        for (j = (size_t) old->slots[i].hash & slots->mask; slots->slots[j].cs != NULL;
+             j = (j + 1) & slots->mask) {
+            continue;
+        }
+
+        slots->slots[j] = old->slots[i];
+    }
+
+    slots->retired = old;
+    atomic_store_release(&shard->slots, slots);
+    return slots;
+}
@@ -0,0 +1,62 @@
+
+
+#ifndef __CSTABLE__H__
+#define __CSTABLE__H__
+
+
+#include "config.h"
+#include "cstring.h"
+#include "thread.h"
+
+
+#define CSTABLE_SHARDS          16          /* a power of two */
+#define CSTABLE_SHARD_SIZE      64          /* slots a shard starts with, a power of two */
+
+
+typedef struct cstable_slot_s {
+    uint64_t hash;
+    cstring_t cs;
+} cstable_slot_t;
+
+
+/**
+ * An open addressed array of slots. One that has been outgrown is kept
+ * on retired until the table goes, a reader may still be probing it.
+ **/
+typedef struct cstable_slots_s {
+    size_t mask;
+    struct cstable_slots_s *retired;
+    cstable_slot_t slots[1];
+} cstable_slots_t;
+
+
+typedef struct cstable_shard_s {
+    cstable_slots_t *slots;
+    size_t used;
+    mutex_t mutex;
+} cstable_shard_t;
+
+
+/**
+ * cspool_t for strings shared between threads. The top bits of the hash
+ * pick a shard, whose lock only interning takes: a lookup probes the
+ * slots without it, a slot is filled in and the slots are swapped with
+ * release stores. An interned cstring_t stays where it is until the
+ * table is destroyed, so two threads interning the same text get the
+ * same pointer.
+ **/
+typedef struct cstable_s {
+    cstable_shard_t shards[CSTABLE_SHARDS];
+} cstable_t;
+
+
+cstable_t* cstable_create(void);
+void cstable_destroy(cstable_t *table);
+cstring_t cstable_find(cstable_t *table, const void *s, size_t n);
+cstring_t cstable_push(cstable_t *table, const char *s);
+cstring_t cstable_push_n(cstable_t *table, const void *s, size_t n);
+cstring_t cstable_push_cs(cstable_t *table, cstring_t cs);
+size_t cstable_length(cstable_t *table);
+
+
+#endif
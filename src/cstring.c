@@ -20,78 +20,67 @@
 
 
 static inline cstring_t __cstring_make_space__(cstring_t cs, size_t size);
+static inline cstring_t __cstring_init__(void *mem, const void *data, size_t length, size_t capacity);
 
 
 cstring_t cstring_new_n(const void *data, size_t size)
 {
-    cstring_header_t *hdr;
+    void *mem;
 
-    if (data) {
-        hdr = (cstring_header_t *) pmalloc(sizeof(cstring_header_t) + size);
-    } else {
-        hdr = (cstring_header_t *) pmalloc(sizeof(cstring_header_t) + size);
-    }
-
-    if (!hdr) {
+    if ((mem = pmalloc(cstring_space(size))) == NULL) {
         return NULL;
     }
 
-    if (data && size) {
-        memcpy(hdr->buffer, data, size);
-
-        hdr->length = size;
-        hdr->unused = 0;
-        hdr->buffer[size] = '\0';
+    return __cstring_init__(mem, data, (data && size) ? size : 0, size);
+}
 
-    } else {
-        hdr->length = 0;
-        hdr->unused = size;
-        hdr->buffer[0] = '\0';
-    }
 
-    return (cstring_t) hdr->buffer;
+/**
+ * Lays out size bytes of data as a cstring_t in mem, cstring_space(size)
+ * bytes, with no room to spare: for a string that lives in memory of
+ * someone else's, which the cstring functions must not grow or free.
+ **/
+cstring_t cstring_place_n(void *mem, const void *data, size_t size)
+{
+    return __cstring_init__(mem, data, size, size);
 }
 
 
 cstring_t cstring_concat_n(cstring_t cs, const void *data, size_t size)
 {
-    cstring_header_t *hdr;
-    
+    size_t length;
+
     cs = __cstring_make_space__(cs, size);
     if (!cs) {
         return NULL;
     }
 
-    hdr = cstring_of(cs);
+    length = cstring_length(cs);
 
-    memcpy(&hdr->buffer[hdr->length], data, size);
+    memcpy(&cs[length], data, size);
 
-    hdr->length += size;
-    hdr->unused -= size;
-    hdr->buffer[hdr->length] = '\0';
+    __cstring_set_lengths(cs, length + size, cstring_capacity(cs) - size);
+    cs[length + size] = '\0';
 	return cs;
 }
 
 
 cstring_t cstring_copy_n(cstring_t cs, const void *data, size_t size)
 {
-    cstring_header_t *hdr = cstring_of(cs);
-    size_t total = hdr->unused + hdr->length;
+    size_t total = cstring_capacity(cs) + cstring_length(cs);
 
     if (total < size) {
         if ((cs = __cstring_make_space__(cs, size)) == NULL) {
             return NULL;
         }
 
-        hdr = cstring_of(cs);
-        total = hdr->unused + hdr->length;
+        total = cstring_capacity(cs) + cstring_length(cs);
     }
 
     memcpy(cs, data, size);
 
     cs[size] = '\0';
-    hdr->length = size;
-    hdr->unused = total - size;
+    __cstring_set_lengths(cs, size, total - size);
     return cs;
 }
 
@@ -180,7 +169,6 @@ cstring_t cstring_concat_pf(cstring_t cs, const char *fmt, ...)
 
 cstring_t cstring_trim(cstring_t cs, const char *cset)
 {
-    cstring_header_t *hdr;
     unsigned char *end, *sp, *ep;
     size_t len;
 
@@ -192,14 +180,12 @@ cstring_t cstring_trim(cstring_t cs, const char *cset)
 
     len = (sp > ep) ? 0 : ((ep - sp) + 1);
 
-    hdr = cstring_of(cs);
-    if (hdr->buffer != sp) {
+    if (cs != sp) {
         memmove(cs, sp, len);
     }
     
-    hdr->buffer[len] = '\0';
-    hdr->unused = hdr->unused + (hdr->length - len);
-    hdr->length = len;
+    cs[len] = '\0';
+    __cstring_set_lengths(cs, len, cstring_capacity(cs) + (cstring_length(cs) - len));
 
     return cs;
 }
@@ -291,6 +277,8 @@ void cstring_tolower(cstring_t cs)
     for (i = 0; i < len; i++) {
         cs[i] = (char) tolower(cs[i]);
     }
+
+    cstring_set_hash(cs, 0);
 }
 
 
@@ -301,34 +289,74 @@ void cstring_toupper(cstring_t cs)
     for (i = 0; i < len; i++) {
         cs[i] = (char) toupper(cs[i]);
     }
+
+    cstring_set_hash(cs, 0);
 }
 
 
+/* the header picked for capacity, which mem has room for */
+static inline
+cstring_t __cstring_init__(void *mem, const void *data, size_t length, size_t capacity)
+{
+    int type = __cstring_type_for(capacity);
+    cstring_t cs = (cstring_t) mem + __cstring_header_size(type);
+
+    cs[-1] = (unsigned char) type;
+
+    if (length) {
+        memcpy(cs, data, length);
+    }
+
+    cs[length] = '\0';
+    __cstring_set_lengths(cs, length, capacity - length);
+    return cs;
+}
+
+
+/**
+ * A string that outgrows its header moves on to a larger one, the text
+ * shifted up inside the block.
+ **/
 static inline
 cstring_t __cstring_make_space__(cstring_t cs, size_t size)
 {
-    cstring_header_t *hdr, *newhdr;
-    size_t newsize;
+    unsigned char *mem;
+    size_t length, newsize, oldheader, newheader;
+    uint64_t hash;
+    int type;
 
-    hdr = cstring_of(cs);
-    if (hdr->unused > size) {
+    if (cstring_capacity(cs) > size) {
         return cs;
     }
 
-    newsize = hdr->length + size;
+    length = cstring_length(cs);
+
+    newsize = length + size;
     if (newsize <= CSTRING_MAX_PREALLOC) {
         newsize *= 2;
     } else {
         newsize += CSTRING_MAX_PREALLOC;
     }
 
-    newhdr = (cstring_header_t *) prealloc(hdr, sizeof(cstring_header_t) + newsize);
-    if (newhdr == NULL) {
+    type = __cstring_type_for(newsize);
+    hash = cstring_get_hash(cs);
+    oldheader = __cstring_header_size(cstring_type(cs));
+    newheader = __cstring_header_size(type);
+
+    mem = (unsigned char *) prealloc(cstring_of(cs), newheader + newsize + 1);
+    if (mem == NULL) {
         return NULL;
     }
 
-    newhdr->unused = newsize - newhdr->length;
-    return (cstring_t) newhdr->buffer;
+    if (newheader != oldheader) {
+        memmove(mem + newheader, mem + oldheader, length + 1);
+    }
+
+    cs = mem + newheader;
+    cs[-1] = (unsigned char) type;
+    __cstring_set_lengths(cs, length, newsize - length);
+    cstring_set_hash(cs, hash);
+    return cs;
 }
 
 
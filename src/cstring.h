@@ -8,9 +8,47 @@
 #include "pmalloc.h"
 
 
+/**
+ * The text is preceded by the smallest of four headers that can count its
+ * room, the type of which is kept in flags, the byte right before the
+ * text: most strings are short spellings and need no more than one byte
+ * for each count. hash comes first in all of them, it is what
+ * cstring_set_hash() cached, 0 for none. The functions here that change
+ * the text drop it, one writing the buffer directly has to call
+ * cstring_update_length() or cstring_set_hash(cs, 0).
+ **/
+typedef struct cstring_header8_s {
+    uint64_t hash;
+    uint8_t length;
+    uint8_t unused;
+    unsigned char flags;
+    unsigned char buffer[1];
+} cstring_header8_t;
+
+
+typedef struct cstring_header16_s {
+    uint64_t hash;
+    uint16_t length;
+    uint16_t unused;
+    unsigned char flags;
+    unsigned char buffer[1];
+} cstring_header16_t;
+
+
+typedef struct cstring_header32_s {
+    uint64_t hash;
+    uint32_t length;
+    uint32_t unused;
+    unsigned char flags;
+    unsigned char buffer[1];
+} cstring_header32_t;
+
+
 typedef struct cstring_header_s {
+    uint64_t hash;
     size_t length;
     size_t unused;
+    unsigned char flags;
     unsigned char buffer[1];
 } cstring_header_t;
 
@@ -18,9 +56,28 @@ typedef struct cstring_header_s {
 typedef unsigned char* cstring_t;
 
 
+#define CSTRING_TYPE_8                  0
+#define CSTRING_TYPE_16                 1
+#define CSTRING_TYPE_32                 2
+#define CSTRING_TYPE_SIZE               3
+#define CSTRING_TYPE_MASK               3
+
+
+#define cstring_type(cs)                                                \
+    (((unsigned char*)(cs))[-1] & CSTRING_TYPE_MASK)
+
+
+#define __cstring_offset(type)                                          \
+    ((size_t)(&(((type *)0)->buffer)))
+
+
+#define __cstring_header(type, cs)                                      \
+    ((type *)(((unsigned char*)(cs)) - __cstring_offset(type)))
+
+
+/* the start of the block holding cs, where its header begins */
 #define cstring_of(cs)                                                  \
-    ((cstring_header_t *)(((unsigned char*)(cs)) -                      \
-            (unsigned char*)(&(((cstring_header_t *)0)->buffer))))
+    ((void *)(((unsigned char*)(cs)) - __cstring_header_size(cstring_type(cs))))
 
 
 #define str2ll(ptr, base)                                               \
@@ -32,6 +89,7 @@ typedef unsigned char* cstring_t;
 
 
 cstring_t cstring_new_n(const void *data, size_t size);
+cstring_t cstring_place_n(void *mem, const void *data, size_t size);
 cstring_t cstring_concat_n(cstring_t cs, const void *data, size_t size);
 cstring_t cstring_copy_n(cstring_t cs, const void *data, size_t size);
 cstring_t cstring_from_ll(long long value);
@@ -51,6 +109,115 @@ size_t ull2str(char *s, unsigned long long value, int base);
 size_t ll2str(char *s, long long value);
 
 
+static inline
+size_t __cstring_header_size(int type)
+{
+    switch (type) {
+    case CSTRING_TYPE_8:
+        return __cstring_offset(cstring_header8_t);
+    case CSTRING_TYPE_16:
+        return __cstring_offset(cstring_header16_t);
+    case CSTRING_TYPE_32:
+        return __cstring_offset(cstring_header32_t);
+    default:
+        return __cstring_offset(cstring_header_t);
+    }
+}
+
+
+/* the type of header for a string with room for capacity bytes */
+static inline
+int __cstring_type_for(size_t capacity)
+{
+    if (capacity <= 0xff) {
+        return CSTRING_TYPE_8;
+    }
+
+    if (capacity <= 0xffff) {
+        return CSTRING_TYPE_16;
+    }
+
+    if (capacity <= 0xffffffffUL) {
+        return CSTRING_TYPE_32;
+    }
+
+    return CSTRING_TYPE_SIZE;
+}
+
+
+/**
+ * The bytes a string of size bytes with no room to spare takes, header
+ * and '\0' included, see cstring_place_n().
+ **/
+static inline
+size_t cstring_space(size_t size)
+{
+    return __cstring_header_size(__cstring_type_for(size)) + size + 1;
+}
+
+
+static inline
+size_t cstring_length(const cstring_t cs)
+{
+    switch (cstring_type(cs)) {
+    case CSTRING_TYPE_8:
+        return __cstring_header(cstring_header8_t, cs)->length;
+    case CSTRING_TYPE_16:
+        return __cstring_header(cstring_header16_t, cs)->length;
+    case CSTRING_TYPE_32:
+        return __cstring_header(cstring_header32_t, cs)->length;
+    default:
+        return __cstring_header(cstring_header_t, cs)->length;
+    }
+}
+
+
+static inline
+size_t cstring_capacity(const cstring_t cs)
+{
+    switch (cstring_type(cs)) {
+    case CSTRING_TYPE_8:
+        return __cstring_header(cstring_header8_t, cs)->unused;
+    case CSTRING_TYPE_16:
+        return __cstring_header(cstring_header16_t, cs)->unused;
+    case CSTRING_TYPE_32:
+        return __cstring_header(cstring_header32_t, cs)->unused;
+    default:
+        return __cstring_header(cstring_header_t, cs)->unused;
+    }
+}
+
+
+/**
+ * Sets the counts of cs and drops its hash, length + unused must fit the
+ * header it has.
+ **/
+static inline
+void __cstring_set_lengths(cstring_t cs, size_t length, size_t unused)
+{
+    switch (cstring_type(cs)) {
+    case CSTRING_TYPE_8:
+        __cstring_header(cstring_header8_t, cs)->length = (uint8_t) length;
+        __cstring_header(cstring_header8_t, cs)->unused = (uint8_t) unused;
+        break;
+    case CSTRING_TYPE_16:
+        __cstring_header(cstring_header16_t, cs)->length = (uint16_t) length;
+        __cstring_header(cstring_header16_t, cs)->unused = (uint16_t) unused;
+        break;
+    case CSTRING_TYPE_32:
+        __cstring_header(cstring_header32_t, cs)->length = (uint32_t) length;
+        __cstring_header(cstring_header32_t, cs)->unused = (uint32_t) unused;
+        break;
+    default:
+        __cstring_header(cstring_header_t, cs)->length = length;
+        __cstring_header(cstring_header_t, cs)->unused = unused;
+        break;
+    }
+
+    ((cstring_header8_t *) cstring_of(cs))->hash = 0;
+}
+
+
 static inline
 cstring_t cstring_new(const char *s)
 {
@@ -62,8 +229,7 @@ cstring_t cstring_new(const char *s)
 static inline 
 size_t cstring_sizeof(const cstring_t cs)
 {
-    cstring_header_t *hdr = cstring_of(cs);
-    return sizeof(cstring_header_t) + hdr->length + hdr->unused;
+    return __cstring_header_size(cstring_type(cs)) + cstring_length(cs) + cstring_capacity(cs) + 1;
 }
 
 
@@ -84,16 +250,13 @@ cstring_t cstring_push_ch(cstring_t cs, unsigned char ch)
 static inline 
 int cstring_pop_ch(cstring_t cs)
 {
-    cstring_header_t *hdr;
+    size_t length = cstring_length(cs);
     unsigned char ch;
 
-    hdr = cstring_of(cs);
-
-    if (hdr->length > 0) {
-        ch = hdr->buffer[hdr->length - 1];
-        hdr->buffer[hdr->length - 1] = '\0';
-        hdr->length--;
-        hdr->unused++;
+    if (length > 0) {
+        ch = cs[length - 1];
+        cs[length - 1] = '\0';
+        __cstring_set_lengths(cs, length - 1, cstring_capacity(cs) + 1);
         return ch;
     }
 
@@ -104,41 +267,47 @@ int cstring_pop_ch(cstring_t cs)
 static inline
 void cstring_update_length(cstring_t cs)
 {
-    cstring_header_t *hdr = cstring_of(cs);
-    size_t n = strlen(cs);
-    hdr->unused += (hdr->length - n);
-    hdr->length = n;
+    size_t n = strlen((const char *) cs);
+    __cstring_set_lengths(cs, n, cstring_length(cs) + cstring_capacity(cs) - n);
+}
+
+
+/* for bytes written past the end of cs by hand, within its capacity */
+static inline
+void cstring_set_length(cstring_t cs, size_t n)
+{
+    assert(n <= cstring_length(cs) + cstring_capacity(cs));
+    __cstring_set_lengths(cs, n, cstring_length(cs) + cstring_capacity(cs) - n);
+    cs[n] = '\0';
 }
 
 
 static inline
 void cstring_clear(cstring_t cs)
 {
-    cstring_header_t *hdr = cstring_of(cs);
-    hdr->unused += hdr->length;
-    hdr->length = 0;
-    hdr->buffer[0] = '\0';
+    __cstring_set_lengths(cs, 0, cstring_length(cs) + cstring_capacity(cs));
+    cs[0] = '\0';
 }
 
 
 static inline
-size_t cstring_length(const cstring_t cs)
+uint64_t cstring_get_hash(const cstring_t cs)
 {
-    return cstring_of(cs)->length;
+    return ((cstring_header8_t *) cstring_of(cs))->hash;
 }
 
 
 static inline
-cstring_t cstring_dup(const cstring_t cs)
+void cstring_set_hash(cstring_t cs, uint64_t hash)
 {
-    return cstring_new_n(cs, cstring_length(cs));
+    ((cstring_header8_t *) cstring_of(cs))->hash = hash;
 }
 
 
 static inline
-size_t cstring_capacity(const cstring_t cs)
+cstring_t cstring_dup(const cstring_t cs)
 {
-    return cstring_of(cs)->unused;
+    return cstring_new_n(cs, cstring_length(cs));
 }
 
 
@@ -0,0 +1,220 @@
+
+
+#include "config.h"
+#include "pmalloc.h"
+#include "array.h"
+#include "set.h"
+#include "cstring.h"
+#include "csbuilder.h"
+#include "depfile.h"
+
+#if defined(UNIX)
+#   include <unistd.h>
+#endif
+
+
+static void __depfile_build__(depfile_t *dep, csbuilder_t *b, const char *target, const char *input,
+    bool system);
+static void __depfile_escape__(csbuilder_t *b, const char *s, size_t n);
+
+
+depfile_t* depfile_create(void)
+{
+    depfile_t *dep;
+
+    dep = (depfile_t *) pmalloc(sizeof(depfile_t));
+    if (!dep) {
+        return NULL;
+    }
+
+    dep->entries = array_create_n(sizeof(depfile_entry_t), 16);
+    dep->seen = set_create();
+
+    return dep;
+}
+
+
+void depfile_destroy(depfile_t *dep)
+{
+    depfile_entry_t *base;
+    size_t i;
+
+    array_foreach(dep->entries, base, i) {
+        cstring_free(base[i].path);
+    }
+
+    array_destroy(dep->entries);
+    set_destroy(dep->seen);
+    pfree(dep);
+}
+
+
+/**
+ * A file included again, by the same path, is not added a second time.
+ **/
+void depfile_add(depfile_t *dep, cstring_t path, bool system)
+{
+    depfile_entry_t *entry;
+
+    if (set_has(dep->seen, path)) {
+        return;
+    }
+
+    set_add(dep->seen, path);
+
+    entry = array_push_back(dep->entries);
+    entry->path = cstring_dup(path);
+    entry->system = system;
+}
+
+
+size_t depfile_length(depfile_t *dep)
+{
+    return array_length(dep->entries);
+}
+
+
+/**
+ * The object the rule is for when -MT does not name one: the input with
+ * neither its directory nor its suffix, then ".o".
+ **/
+cstring_t depfile_target(const char *input)
+{
+    const char *base, *dot;
+
+    base = strrchr(input, '/');
+    base = base != NULL ? base + 1 : input;
+
+    dot = strrchr(base, '.');
+    if (dot == NULL) {
+        dot = base + strlen(base);
+    }
+
+    return cstring_concat_n(cstring_new_n(base, (size_t) (dot - base)), ".o", 2);
+}
+
+
+/**
+ * The target quoted the way make reads it back, as -MQ asks for.
+ **/
+cstring_t depfile_quote(const char *target)
+{
+    csbuilder_t *b;
+    cstring_t cs;
+
+    if ((b = csbuilder_create()) == NULL) {
+        return NULL;
+    }
+
+    __depfile_escape__(b, target, strlen(target));
+
+    cs = csbuilder_to_cstring(b);
+    csbuilder_destroy(b);
+    return cs;
+}
+
+
+/**
+ * The make rule, the target depending on the input and then on every
+ * header, a line each. The target goes in as it is, the input and the
+ * headers quoted. With system false the headers found in a system
+ * directory are left out, as -MM does.
+ **/
+cstring_t depfile_rule(depfile_t *dep, const char *target, const char *input, bool system)
+{
+    csbuilder_t *b;
+    cstring_t rule;
+
+    if ((b = csbuilder_create()) == NULL) {
+        return NULL;
+    }
+
+    __depfile_build__(dep, b, target, input, system);
+
+    rule = csbuilder_to_cstring(b);
+    csbuilder_destroy(b);
+    return rule;
+}
+
+
+/**
+ * Writes the rule to fn, to the standard output if fn is NULL.
+ **/
+bool depfile_write(depfile_t *dep, const char *fn, const char *target, const char *input, bool system)
+{
+    csbuilder_t *b;
+    FILE *fp;
+    bool ok;
+
+    if ((b = csbuilder_create()) == NULL) {
+        return false;
+    }
+
+    fp = fn != NULL ? fopen(fn, "w") : stdout;
+    if (fp == NULL) {
+        csbuilder_destroy(b);
+        return false;
+    }
+
+    __depfile_build__(dep, b, target, input, system);
+
+    /* what is buffered in fp goes out before the rule */
+    ok = fflush(fp) == 0;
+    ok = csbuilder_flush(b, fileno(fp)) && ok;
+
+    if (fn != NULL) {
+        ok = fclose(fp) == 0 && ok;
+    }
+
+    csbuilder_destroy(b);
+    return ok;
+}
+
+
+static
+void __depfile_build__(depfile_t *dep, csbuilder_t *b, const char *target, const char *input,
+    bool system)
+{
+    depfile_entry_t *base;
+    size_t i;
+
+    csbuilder_append(b, target);
+    csbuilder_append_ch(b, ':');
+
+    if (input != NULL) {
+        csbuilder_append_ch(b, ' ');
+        __depfile_escape__(b, input, strlen(input));
+    }
+
+    array_foreach(dep->entries, base, i) {
+        if (base[i].system && !system) {
+            continue;
+        }
+
+        csbuilder_append_n(b, " \\\n  ", 5);
+        __depfile_escape__(b, (const char *) base[i].path, cstring_length(base[i].path));
+    }
+
+    csbuilder_append_ch(b, '\n');
+}
+
+
+/**
+ * make splits words on blanks, takes '#' for a comment and '$' for a
+ * variable, those are escaped the way make reads them back.
+ **/
+static
+void __depfile_escape__(csbuilder_t *b, const char *s, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if (s[i] == ' ' || s[i] == '\t' || s[i] == '#') {
+            csbuilder_append_ch(b, '\\');
+        } else if (s[i] == '$') {
+            csbuilder_append_ch(b, '$');
+        }
+
+        csbuilder_append_ch(b, (unsigned char) s[i]);
+    }
+}
@@ -0,0 +1,43 @@
+
+
+#ifndef __DEPFILE__H__
+#define __DEPFILE__H__
+
+
+#include "config.h"
+#include "cstring.h"
+
+
+typedef struct array_s      array_t;
+typedef struct set_s        set_t;
+
+
+typedef struct depfile_entry_s {
+    cstring_t path;
+    bool system;
+} depfile_entry_t;
+
+
+/**
+ * The files a translation unit depends on, in the order they were first
+ * included and each of them once, for the make rule of -M and -MD. The
+ * preprocessor adds a header when its #include resolves, before a guard
+ * or #pragma once may skip it, so a skipped header is in the rule too.
+ **/
+typedef struct depfile_s {
+    array_t *entries;
+    set_t *seen;
+} depfile_t;
+
+
+depfile_t* depfile_create(void);
+void depfile_destroy(depfile_t *dep);
+void depfile_add(depfile_t *dep, cstring_t path, bool system);
+size_t depfile_length(depfile_t *dep);
+cstring_t depfile_target(const char *input);
+cstring_t depfile_quote(const char *target);
+cstring_t depfile_rule(depfile_t *dep, const char *target, const char *input, bool system);
+bool depfile_write(depfile_t *dep, const char *fn, const char *target, const char *input, bool system);
+
+
+#endif
@@ -2,6 +2,10 @@
 
 #include "config.h"
 #include "color.h"
+#include "pmalloc.h"
+#include "array.h"
+#include "arena.h"
+#include "csbuilder.h"
 #include "token.h"
 #include "option.h"
 #include "diagnostor.h"
@@ -21,12 +25,12 @@
 int get_console_width() {
 #if defined(WINDOWS)
     CONSOLE_SCREEN_BUFFER_INFO csbi;
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+    HANDLE hConsole = GetStdHandle(STD_ERROR_HANDLE);
     GetConsoleScreenBufferInfo(hConsole, &csbi);
 	return csbi.srWindow.Right - csbi.srWindow.Left;
 #elif defined(UNIX)
     struct winsize w;
-    ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
+    ioctl(STDERR_FILENO, TIOCGWINSZ, &w);
     return w.ws_col;
 #endif
     return 80;
@@ -36,12 +40,12 @@ int get_console_width() {
 int get_console_height() {
 #if defined(WINDOWS)
     CONSOLE_SCREEN_BUFFER_INFO csbi;
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+    HANDLE hConsole = GetStdHandle(STD_ERROR_HANDLE);
     GetConsoleScreenBufferInfo(hConsole, &csbi);
 	return csbi.srWindow.Bottom - csbi.srWindow.Top;
 #elif defined(UNIX)
     struct winsize w;
-    ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
+    ioctl(STDERR_FILENO, TIOCGWINSZ, &w);
     return w.ws_row;
 #endif
     return 25;
@@ -53,17 +57,50 @@ int get_console_height() {
 #endif
 
 
+/* most messages are formatted here, without a second vsnprintf() */
+#ifndef DIAGNOSTOR_MESSAGE_SIZE
+#define DIAGNOSTOR_MESSAGE_SIZE     256
+#endif
+
+
 diagnostor_t __diagnostor__ = {
     0,
     0,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    0,
+    NULL,
+    NULL,
 };
 
-diagnostor_t* diagnostor = &__diagnostor__;
-
-
-static void __write_linenote__(const unsigned char *linenote, size_t outputed, size_t width);
-static void __write_linenote_caution__(diagnostor_level_t level, linenote_t linenote,
+THREAD_LOCAL diagnostor_t* diagnostor = &__diagnostor__;
+
+
+static void __diagnostor_record__(diagnostor_t *diag, diagnostor_level_t level, const char *fn,
+                                  size_t line, size_t column, linenote_t linenote,
+                                  linenote_caution_t *linenote_caution, const char *fmt, va_list args);
+static void __diagnostor_with_token__(diagnostor_level_t level, token_t *token, const char *fmt, va_list args);
+static bool __diagnostor_seen__(diagnostor_t *diag, diagnostor_entry_t *entry);
+static void __diagnostor_enter__(diagnostor_t *diag);
+static bool __diagnostor_prepare__(diagnostor_t *diag);
+static void __diagnostor_clear__(diagnostor_t *diag);
+static void __diagnostor_exit__(diagnostor_t *diag);
+static void __diagnostor_panic__(diagnostor_t *diag, const char *fn, size_t line, size_t column,
+                                 const char *fmt, va_list args);
+static void __render_text__(csbuilder_t *b, diagnostor_entry_t *entry, int width);
+static void __render_json__(csbuilder_t *b, diagnostor_entry_t *entry);
+static void __render_json_string__(csbuilder_t *b, const char *s);
+static void __render_level__(csbuilder_t *b, diagnostor_level_t level);
+static void __render_linenote__(csbuilder_t *b, linenote_t linenote, int width);
+static void __render_linenote_caution__(csbuilder_t *b, diagnostor_level_t level, linenote_t linenote,
+                                        size_t start, size_t length, int width);
+static void __write_linenote__(csbuilder_t *b, const unsigned char *linenote, size_t outputed, size_t width);
+static void __write_linenote_caution__(csbuilder_t *b, diagnostor_level_t level, linenote_t linenote,
                                        size_t start, size_t length, size_t width);
+static void __write_out__(csbuilder_t *b);
+static uint64_t __hash__(uint64_t hash, const void *data, size_t n);
 
 
 void warningf(const char *fmt, ...)
@@ -107,7 +144,7 @@ void warningf_with_linenote(const char *fn, size_t line, size_t column, linenote
 {
     va_list ap;
     va_start(ap, fmt);
-    diagnostor_notef_with_linenote(diagnostor, DIAGNOSTOR_LEVEL_WARNING, fn, line, column, linenote, fmt, ap);
+    diagnostor_notevf_with_linenote(diagnostor, DIAGNOSTOR_LEVEL_WARNING, fn, line, column, linenote, fmt, ap);
     va_end(ap);
 }
 
@@ -117,7 +154,7 @@ void errorf_with_linenote(const char *fn, size_t line, size_t column, linenote_t
 {
     va_list ap;
     va_start(ap, fmt);
-    diagnostor_notef_with_linenote(diagnostor, DIAGNOSTOR_LEVEL_ERROR, fn, line, column, linenote, fmt, ap);
+    diagnostor_notevf_with_linenote(diagnostor, DIAGNOSTOR_LEVEL_ERROR, fn, line, column, linenote, fmt, ap);
     va_end(ap);
 }
 
@@ -198,15 +235,7 @@ void warningf_with_token(token_t *token, const char *fmt, ...)
 
     va_start(ap, fmt);
 
-    diagnostor_notevf_with_linenote_caution(diagnostor,
-                                            DIAGNOSTOR_LEVEL_WARNING,
-                                            token->location.filename,
-                                            token->location.line,
-                                            token->location.column,
-                                            token->location.linenote,
-                                            &token->location.linenote_caution,
-                                            fmt,
-                                            ap);
+    __diagnostor_with_token__(DIAGNOSTOR_LEVEL_WARNING, token, fmt, ap);
 
     va_end(ap);
 }
@@ -218,15 +247,7 @@ void errorf_with_token(token_t *token, const char *fmt, ...)
 
     va_start(ap, fmt);
 
-    diagnostor_notevf_with_linenote_caution(diagnostor,
-                                            DIAGNOSTOR_LEVEL_ERROR,
-                                            token->location.filename,
-                                            token->location.line,
-                                            token->location.column,
-                                            token->location.linenote,
-                                            &token->location.linenote_caution,
-                                            fmt,
-                                            ap);
+    __diagnostor_with_token__(DIAGNOSTOR_LEVEL_ERROR, token, fmt, ap);
 
     va_end(ap);
 }
@@ -256,13 +277,34 @@ diagnostor_t* diagnostor_create(void)
     diagnostor_t *diag = pmalloc(sizeof(diagnostor_t));
     diag->nerrors = 0;
     diag->nwarnings = 0;
+    diag->escape = NULL;
+    diag->queue = NULL;
+    diag->arena = NULL;
+    diag->seen = NULL;
+    diag->nseen = 0;
+    diag->last_fn = NULL;
+    diag->last_fn_copy = NULL;
     return diag;
 }
 
 
+/**
+ * What is still queued is dropped, diagnostor_flush() it first.
+ **/
 void diagnostor_destroy(diagnostor_t *diag)
 {
     assert(diag != NULL);
+
+    __diagnostor_clear__(diag);
+
+    if (diag->queue != NULL) {
+        array_destroy(diag->queue);
+    }
+
+    if (diag->seen != NULL) {
+        pfree(diag->seen);
+    }
+
     pfree(diag);
 }
 
@@ -278,27 +320,7 @@ void diagnostor_notef(diagnostor_t *diag, diagnostor_level_t level, const char *
 
 void diagnostor_notevf(diagnostor_t *diag, diagnostor_level_t level, const char *fmt, va_list args)
 {
-    switch (level) {
-    case DIAGNOSTOR_LEVEL_NORMAL:
-        break;
-    case DIAGNOSTOR_LEVEL_NOTE:
-        printf(BRUSH_BOLD_CYAN("note: "));
-        break;
-    case DIAGNOSTOR_LEVEL_WARNING:
-        printf(BRUSH_BOLD_PURPLE("warning: "));
-        diag->nwarnings++;
-        break;
-    case DIAGNOSTOR_LEVEL_ERROR:
-        printf(BRUSH_BOLD_RED("error: "));
-        diag->nerrors++;
-        break;
-    default:
-        assert(false);
-        break;
-    }
-
-    vprintf(fmt, args);
-    printf("\n");
+    __diagnostor_record__(diag, level, NULL, 0, 0, NULL, NULL, fmt, args);
 }
 
 
@@ -315,37 +337,10 @@ void diagnostor_notef_with_location(diagnostor_t *diag, diagnostor_level_t level
 void diagnostor_notevf_with_location(diagnostor_t *diag, diagnostor_level_t level,
                                     const char *fn, size_t line, size_t column, const char *fmt, va_list args)
 {
-    printf("%s:%lu:%lu: ", fn, line, column);
-
-    switch (level) {
-    case DIAGNOSTOR_LEVEL_NORMAL:
-        break;
-    case DIAGNOSTOR_LEVEL_NOTE:
-        printf(BRUSH_BOLD_CYAN("note: "));
-        break;
-    case DIAGNOSTOR_LEVEL_WARNING:
-        printf(BRUSH_BOLD_PURPLE("warning: "));
-        diag->nwarnings++;
-        break;
-    case DIAGNOSTOR_LEVEL_ERROR:
-        printf(BRUSH_BOLD_RED("error: "));
-        diag->nerrors++;
-        if (diag->nerrors >= option->ferror_limit) {
-            diagnostor_report(diag);
-            exit(-1);
-        }
-        break;
-    default:
-        assert(false);
-        break;
-    }
-
-    vprintf(fmt, args);
-    printf("\n");
+    __diagnostor_record__(diag, level, fn, line, column, NULL, NULL, fmt, args);
 }
 
 
-
 void diagnostor_notef_with_linenote(diagnostor_t *diag, diagnostor_level_t level, const char *fn,
                                     size_t line, size_t column, linenote_t linenote, const char *fmt, ...)
 {
@@ -359,36 +354,7 @@ void diagnostor_notef_with_linenote(diagnostor_t *diag, diagnostor_level_t level
 void diagnostor_notevf_with_linenote(diagnostor_t *diag, diagnostor_level_t level, const char *fn,
                                      size_t line, size_t column, linenote_t linenote, const char *fmt, va_list args)
 {
-    printf("%s:%lu:%lu: ", fn, line, column);
-
-    switch (level) {
-    case DIAGNOSTOR_LEVEL_NORMAL:
-        break;
-    case DIAGNOSTOR_LEVEL_NOTE:
-        printf(BRUSH_BOLD_CYAN("note: "));
-        break;
-    case DIAGNOSTOR_LEVEL_WARNING:
-        printf(BRUSH_BOLD_PURPLE("warning: "));
-        diag->nwarnings++;
-        break;
-    case DIAGNOSTOR_LEVEL_ERROR:
-        printf(BRUSH_BOLD_RED("error: "));
-        diag->nerrors++;
-        break;
-    default:
-        assert(false);
-        break;
-    }
-
-    vprintf(fmt, args);
-    printf("\n");
-
-    diagnostor_note_linenote(diag, linenote);
-
-    if (diag->nerrors >= option->ferror_limit) {
-        diagnostor_report(diag);
-        exit(-1);
-    }
+    __diagnostor_record__(diag, level, fn, line, column, linenote, NULL, fmt, args);
 }
 
 
@@ -408,83 +374,43 @@ void diagnostor_notevf_with_linenote_caution(diagnostor_t *diag, diagnostor_leve
                                             const char *fn, size_t line, size_t column, linenote_t linenote,
                                             linenote_caution_t *linenote_caution, const char *fmt, va_list args)
 {
-    printf("%s:%lu:%lu: ", fn, line, column);
-
-    switch (level) {
-    case DIAGNOSTOR_LEVEL_NORMAL:
-        break;
-    case DIAGNOSTOR_LEVEL_NOTE:
-        printf(BRUSH_BOLD_CYAN("note: "));
-        break;
-    case DIAGNOSTOR_LEVEL_WARNING:
-        printf(BRUSH_BOLD_PURPLE("warning: "));
-        diag->nwarnings++;
-        break;
-    case DIAGNOSTOR_LEVEL_ERROR:
-        printf(BRUSH_BOLD_RED("error: "));
-        diag->nerrors++;
-        break;
-    default:
-        assert(false);
-        break;
-    }
-
-    vprintf(fmt, args);
-    printf("\n");
-
-    diagnostor_note_linenote_caution(diag, level, linenote, linenote_caution);
-
-    if (diag->nerrors >= option->ferror_limit) {
-        diagnostor_report(diag);
-        exit(-1);
-    }
+    __diagnostor_record__(diag, level, fn, line, column, linenote, linenote_caution, fmt, args);
 }
 
 
+/**
+ * Shows linenote at once, as does the function below, the queue is
+ * flushed before it.
+ **/
 void diagnostor_note_linenote(diagnostor_t *diag, linenote_t linenote)
 {
-    int width;
-    size_t outputed = 0;
+    csbuilder_t *b;
 
-    width = get_console_width();
-    if (width < MIN_LINE_LIMIT) {
+    diagnostor_flush(diag);
+
+    if ((b = csbuilder_create()) == NULL) {
         return;
     }
 
-    outputed += printf("   ");
-
-    __write_linenote__(linenote, outputed, width);
+    __render_linenote__(b, linenote, get_console_width());
+    __write_out__(b);
 }
 
 
 void diagnostor_note_linenote_caution(diagnostor_t *diag, diagnostor_level_t level,
                                       linenote_t linenote, linenote_caution_t *linenote_caution)
 {
-    int width;
-    int zoom, zoom_limit;
-    size_t start = linenote_caution->start;
-    size_t length = linenote_caution->length;
-    size_t outputed = 0;
+    csbuilder_t *b;
 
-    width = get_console_width();
-    if (width < MIN_LINE_LIMIT) {
-        return;
-    }
+    diagnostor_flush(diag);
 
-    zoom = width - (int)start;
-    zoom_limit = (int)length;
-    if (zoom <= zoom_limit) {
-        outputed += printf("   ...");
-        linenote = linenote + start - 1;
-        start = outputed + 1;
-    } else {
-        outputed += printf("   ");
-        start += outputed;
+    if ((b = csbuilder_create()) == NULL) {
+        return;
     }
 
-    __write_linenote__(linenote, outputed, width);
-
-    __write_linenote_caution__(level, linenote, start, length, width);
+    __render_linenote_caution__(b, level, linenote, linenote_caution->start,
+                                linenote_caution->length, get_console_width());
+    __write_out__(b);
 }
 
 
@@ -501,12 +427,7 @@ void diagnostor_panicf(diagnostor_t *diag, const char *fmt, ...)
 
 void diagnostor_panicvf(diagnostor_t *diag, const char *fmt, va_list args)
 {
-    printf(BRUSH_BOLD_RED("fatal error: "));
-    vprintf(fmt, args);
-    printf("\n");
-    diagnostor_report(diag);
-    printf("compilation terminated.");
-    exit(-1);
+    __diagnostor_panic__(diag, NULL, 0, 0, fmt, args);
 }
 
 
@@ -525,33 +446,506 @@ void diagnostor_panicf_with_location(diagnostor_t *diag, const char *fn,
 void diagnostor_panicvf_with_location(diagnostor_t *diag, const char *fn,
                                       size_t line, size_t column, const char *fmt, va_list args)
 {
-    printf("%s:%lu:%lu: ", fn, line, column);
-    printf(BRUSH_BOLD_RED("fatal error: "));
-    vprintf(fmt, args);
-    printf("\n");
-    diagnostor_report(diag);
-    printf("compilation terminated.");
-    exit(-1);
+    __diagnostor_panic__(diag, fn, line, column, fmt, args);
+}
+
+
+/**
+ * Renders the queue, as text or with -fdiagnostics-format=json as one
+ * object a line, and writes it out at once.
+ **/
+void diagnostor_flush(diagnostor_t *diag)
+{
+    diagnostor_entry_t *entries;
+    csbuilder_t *b;
+    size_t i;
+    int width;
+
+    if (diag->queue == NULL || array_is_empty(diag->queue)) {
+        return;
+    }
+
+    if ((b = csbuilder_create()) != NULL) {
+        width = option->diagnostics_json ? 0 : get_console_width();
+
+        array_foreach(diag->queue, entries, i) {
+            if (option->diagnostics_json) {
+                __render_json__(b, &entries[i]);
+            } else {
+                __render_text__(b, &entries[i], width);
+            }
+        }
+
+        __write_out__(b);
+    }
+
+    __diagnostor_clear__(diag);
 }
 
 
 void diagnostor_report(diagnostor_t *diag)
 {
-    if (diag->nwarnings != 0 && diag->nerrors != 0) {
-        printf("%d warning and %d error generated.\n", diag->nwarnings, diag->nerrors);
+    diagnostor_flush(diag);
+
+    if (option->diagnostics_json) {
+        /* the counts are the objects */
+    } else if (diag->nwarnings != 0 && diag->nerrors != 0) {
+        fprintf(stderr, "%lu warning and %lu error generated.\n",
+                (unsigned long) diag->nwarnings, (unsigned long) diag->nerrors);
     } else if (diag->nwarnings != 0) {
-        printf("%d warning generated.\n", diag->nwarnings);
+        fprintf(stderr, "%lu warning generated.\n", (unsigned long) diag->nwarnings);
     } else if (diag->nerrors != 0) {
-        printf("%d error generated.\n", diag->nerrors);
+        fprintf(stderr, "%lu error generated.\n", (unsigned long) diag->nerrors);
     }
 
     if (diag->nerrors != 0) {
-        exit(-1);
+        __diagnostor_exit__(diag);
     }
 }
 
 
-static void __write_linenote__(const unsigned char *linenote, size_t outputed, size_t width)
+/**
+ * Queues a diagnostic, nothing is written yet. The message is formatted
+ * now, as the arguments may not live until the flush, and the line it is
+ * about is copied up to its end. ferror_limit is met right away.
+ **/
+static
+void __diagnostor_record__(diagnostor_t *diag, diagnostor_level_t level, const char *fn,
+                           size_t line, size_t column, linenote_t linenote,
+                           linenote_caution_t *linenote_caution, const char *fmt, va_list args)
+{
+    char buf[DIAGNOSTOR_MESSAGE_SIZE];
+    diagnostor_entry_t entry, *queued;
+    const unsigned char *end;
+    unsigned char *copy;
+    char *message = buf;
+    va_list cpy;
+    int n;
+
+    assert(level >= DIAGNOSTOR_LEVEL_NORMAL && level <= DIAGNOSTOR_LEVEL_ERROR);
+
+    if (!__diagnostor_prepare__(diag)) {
+        return;
+    }
+
+    va_copy(cpy, args);
+    n = vsnprintf(buf, sizeof(buf), fmt, cpy);
+    va_end(cpy);
+
+    if (n < 0) {
+        n = 0;
+        buf[0] = '\0';
+    } else if ((size_t) n >= sizeof(buf)) {
+        if ((message = (char *) arena_alloc(diag->arena, (size_t) n + 1)) == NULL) {
+            return;
+        }
+        va_copy(cpy, args);
+        vsnprintf(message, (size_t) n + 1, fmt, cpy);
+        va_end(cpy);
+    }
+
+    entry.level = level;
+    entry.fn = fn;
+    entry.line = line;
+    entry.column = column;
+    entry.message = message;
+    entry.linenote = NULL;
+    entry.caution = linenote_caution != NULL;
+    entry.start = linenote_caution != NULL ? linenote_caution->start : 0;
+    entry.length = linenote_caution != NULL ? linenote_caution->length : 0;
+
+    entry.hash = __hash__(14695981039346656037ULL, &level, sizeof(level));
+    entry.hash = __hash__(entry.hash, &line, sizeof(line));
+    entry.hash = __hash__(entry.hash, &column, sizeof(column));
+    entry.hash = __hash__(entry.hash, message, (size_t) n);
+    if (fn != NULL) {
+        entry.hash = __hash__(entry.hash, fn, strlen(fn));
+    }
+
+    /* notes go with the diagnostic before them, they are never dropped */
+    if (level >= DIAGNOSTOR_LEVEL_WARNING && __diagnostor_seen__(diag, &entry)) {
+        return;
+    }
+
+    if (message == buf) {
+        message = (char *) arena_cstring(diag->arena, (const unsigned char *) buf, (size_t) n);
+        if (message == NULL) {
+            return;
+        }
+    }
+
+    /* a storm comes from one file mostly, its name is copied once */
+    if (fn != NULL && (fn != diag->last_fn || strcmp(fn, diag->last_fn_copy) != 0)) {
+        diag->last_fn_copy = (const char *) arena_cstring(diag->arena,
+            (const unsigned char *) fn, strlen(fn));
+        diag->last_fn = diag->last_fn_copy != NULL ? fn : NULL;
+    }
+
+    if (linenote != NULL) {
+        for (end = linenote; *end && *end != '\r' && *end != '\n'; end++) {
+            continue;
+        }
+        copy = arena_cstring(diag->arena, linenote, end - linenote);
+        entry.linenote = copy;
+    }
+
+    if ((queued = (diagnostor_entry_t *) array_push_back(diag->queue)) == NULL) {
+        return;
+    }
+
+    entry.message = message;
+    entry.fn = fn != NULL ? diag->last_fn_copy : NULL;
+    *queued = entry;
+
+    if (level >= DIAGNOSTOR_LEVEL_WARNING) {
+        __diagnostor_enter__(diag);
+    }
+
+    if (level == DIAGNOSTOR_LEVEL_WARNING) {
+        diag->nwarnings++;
+    } else if (level == DIAGNOSTOR_LEVEL_ERROR) {
+        diag->nerrors++;
+        if (diag->nerrors >= option->ferror_limit) {
+            diagnostor_report(diag);
+            __diagnostor_exit__(diag);
+        }
+    }
+}
+
+
+/**
+ * At the spelling of the token, and for one that came out of a macro a
+ * note at the use of the outermost macro, named from its line, if the
+ * diagnostic was not dropped.
+ **/
+static
+void __diagnostor_with_token__(diagnostor_level_t level, token_t *token, const char *fmt, va_list args)
+{
+    linenote_caution_t lc;
+    const unsigned char *linenote, *name;
+    cstring_t fn;
+    size_t line, column, queued, n;
+    srcloc_t use;
+
+    srcloc_resolve(token->loc, &fn, &line, &column, &linenote);
+
+    lc.start = token->caution_start;
+    lc.length = token->caution_length;
+
+    queued = diagnostor->queue != NULL ? array_length(diagnostor->queue) : 0;
+
+    __diagnostor_record__(diagnostor, level, (const char *) fn, line, column, linenote, &lc, fmt, args);
+
+    if (diagnostor->queue == NULL || array_length(diagnostor->queue) == queued ||
+        (use = srcloc_expansion(token->loc)) == token->loc ||
+        !srcloc_resolve(use, &fn, &line, &column, &linenote) || linenote == NULL) {
+        return;
+    }
+
+    /* a token is where the spaces before it begin */
+    for (name = &linenote[column - 1]; *name == ' ' || *name == '\t'; name++) {
+        continue;
+    }
+
+    for (n = 0; name[n] == '_' || isalnum(name[n]); n++) {
+        continue;
+    }
+
+    diagnostor_notef_with_linenote(diagnostor, DIAGNOSTOR_LEVEL_NOTE, (const char *) fn, line, column,
+                                   linenote, "in expansion of macro '%.*s'", (int) n, name);
+}
+
+
+/* whether a diagnostic like entry is queued already */
+static
+bool __diagnostor_seen__(diagnostor_t *diag, diagnostor_entry_t *entry)
+{
+    diagnostor_entry_t *other;
+    size_t i;
+
+    if (diag->nseen == 0) {
+        return false;
+    }
+
+    for (i = (size_t) entry->hash & (diag->nseen - 1); diag->seen[i]; i = (i + 1) & (diag->nseen - 1)) {
+        other = (diagnostor_entry_t *) __array_at(diag->queue, diag->seen[i] - 1);
+
+        if (other->hash == entry->hash && other->level == entry->level &&
+            other->line == entry->line && other->column == entry->column &&
+            (other->fn == entry->fn || (other->fn && entry->fn && !strcmp(other->fn, entry->fn))) &&
+            !strcmp(other->message, entry->message)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/* enters the last entry queued, the table is kept at most half full */
+static
+void __diagnostor_enter__(diagnostor_t *diag)
+{
+    diagnostor_entry_t *entry;
+    size_t i, j, n, *seen;
+
+    n = array_length(diag->queue);
+
+    if (2 * n > diag->nseen) {
+        if ((seen = (size_t *) pcalloc(diag->nseen ? 2 * diag->nseen : 64, sizeof(size_t))) == NULL) {
+            return;
+        }
+
+        if (diag->seen != NULL) {
+            pfree(diag->seen);
+        }
+
+        diag->seen = seen;
+        diag->nseen = diag->nseen ? 2 * diag->nseen : 64;
+    } else {
+        n = 1;
+    }
+
+    /* all of them again after growing, just the last one otherwise */
+    for (j = array_length(diag->queue) - n; j < array_length(diag->queue); j++) {
+        entry = (diagnostor_entry_t *) __array_at(diag->queue, j);
+        if (entry->level < DIAGNOSTOR_LEVEL_WARNING) {
+            continue;
+        }
+
+        for (i = (size_t) entry->hash & (diag->nseen - 1); diag->seen[i]; i = (i + 1) & (diag->nseen - 1)) {
+            continue;
+        }
+        diag->seen[i] = j + 1;
+    }
+}
+
+
+static
+bool __diagnostor_prepare__(diagnostor_t *diag)
+{
+    if (diag->queue == NULL &&
+        (diag->queue = array_create_n(sizeof(diagnostor_entry_t), 16)) == NULL) {
+        return false;
+    }
+
+    if (diag->arena == NULL &&
+        (diag->arena = arena_create_n(ARENA_SCRATCH_BLOCK_SIZE)) == NULL) {
+        return false;
+    }
+
+    return true;
+}
+
+
+/* the counts stay, they are what diagnostor_report() tells */
+static
+void __diagnostor_clear__(diagnostor_t *diag)
+{
+    if (diag->queue != NULL) {
+        array_clear(diag->queue);
+    }
+
+    if (diag->arena != NULL) {
+        arena_destroy(diag->arena);
+        diag->arena = NULL;
+    }
+
+    if (diag->seen != NULL) {
+        memset(diag->seen, 0, diag->nseen * sizeof(size_t));
+    }
+
+    diag->last_fn = NULL;
+    diag->last_fn_copy = NULL;
+}
+
+
+static
+void __diagnostor_panic__(diagnostor_t *diag, const char *fn, size_t line, size_t column,
+                          const char *fmt, va_list args)
+{
+    csbuilder_t *b;
+
+    diagnostor_flush(diag);
+
+    if ((b = csbuilder_create()) != NULL) {
+        if (fn != NULL) {
+            csbuilder_append_pf(b, "%s:%lu:%lu: ", fn, (unsigned long) line, (unsigned long) column);
+        }
+        csbuilder_append(b, BRUSH_BOLD_RED("fatal error: "));
+        csbuilder_append_vpf(b, fmt, args);
+        csbuilder_append_ch(b, '\n');
+        __write_out__(b);
+    }
+
+    diagnostor_report(diag);
+    fprintf(stderr, "compilation terminated.\n");
+    __diagnostor_exit__(diag);
+}
+
+
+static
+void __diagnostor_exit__(diagnostor_t *diag)
+{
+    if (diag->escape != NULL) {
+        /* the unit failed, if only by a fatal error */
+        if (diag->nerrors == 0) {
+            diag->nerrors = 1;
+        }
+        longjmp(*diag->escape, 1);
+    }
+
+    exit(-1);
+}
+
+
+static
+void __render_text__(csbuilder_t *b, diagnostor_entry_t *entry, int width)
+{
+    if (entry->fn != NULL) {
+        csbuilder_append_pf(b, "%s:%lu:%lu: ", entry->fn,
+                            (unsigned long) entry->line, (unsigned long) entry->column);
+    }
+
+    __render_level__(b, entry->level);
+    csbuilder_append(b, entry->message);
+    csbuilder_append_ch(b, '\n');
+
+    if (entry->linenote == NULL) {
+        return;
+    }
+
+    if (entry->caution && entry->level != DIAGNOSTOR_LEVEL_NORMAL) {
+        __render_linenote_caution__(b, entry->level, entry->linenote, entry->start, entry->length, width);
+    } else {
+        __render_linenote__(b, entry->linenote, width);
+    }
+}
+
+
+static
+void __render_json__(csbuilder_t *b, diagnostor_entry_t *entry)
+{
+    static const char *kinds[] = { "normal", "note", "warning", "error" };
+
+    csbuilder_append(b, "{\"kind\":\"");
+    csbuilder_append(b, kinds[entry->level]);
+    csbuilder_append_ch(b, '"');
+
+    if (entry->fn != NULL) {
+        csbuilder_append(b, ",\"file\":");
+        __render_json_string__(b, entry->fn);
+        csbuilder_append_pf(b, ",\"line\":%lu,\"column\":%lu",
+                            (unsigned long) entry->line, (unsigned long) entry->column);
+    }
+
+    csbuilder_append(b, ",\"message\":");
+    __render_json_string__(b, entry->message);
+
+    if (entry->caution) {
+        csbuilder_append_pf(b, ",\"start\":%lu,\"length\":%lu",
+                            (unsigned long) entry->start, (unsigned long) entry->length);
+    }
+
+    csbuilder_append(b, "}\n");
+}
+
+
+static
+void __render_json_string__(csbuilder_t *b, const char *s)
+{
+    const unsigned char *p;
+
+    csbuilder_append_ch(b, '"');
+
+    for (p = (const unsigned char *) s; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            csbuilder_append_ch(b, '\\');
+            csbuilder_append_ch(b, *p);
+        } else if (*p == '\n') {
+            csbuilder_append(b, "\\n");
+        } else if (*p < 0x20) {
+            csbuilder_append_pf(b, "\\u%04x", *p);
+        } else {
+            csbuilder_append_ch(b, *p);
+        }
+    }
+
+    csbuilder_append_ch(b, '"');
+}
+
+
+static
+void __render_level__(csbuilder_t *b, diagnostor_level_t level)
+{
+    switch (level) {
+    case DIAGNOSTOR_LEVEL_NORMAL:
+        break;
+    case DIAGNOSTOR_LEVEL_NOTE:
+        csbuilder_append(b, BRUSH_BOLD_CYAN("note: "));
+        break;
+    case DIAGNOSTOR_LEVEL_WARNING:
+        csbuilder_append(b, BRUSH_BOLD_PURPLE("warning: "));
+        break;
+    case DIAGNOSTOR_LEVEL_ERROR:
+        csbuilder_append(b, BRUSH_BOLD_RED("error: "));
+        break;
+    default:
+        assert(false);
+        break;
+    }
+}
+
+
+static
+void __render_linenote__(csbuilder_t *b, linenote_t linenote, int width)
+{
+    if (width < MIN_LINE_LIMIT) {
+        return;
+    }
+
+    csbuilder_append(b, "   ");
+
+    __write_linenote__(b, linenote, 3, width);
+}
+
+
+static
+void __render_linenote_caution__(csbuilder_t *b, diagnostor_level_t level, linenote_t linenote,
+                                 size_t start, size_t length, int width)
+{
+    int zoom, zoom_limit;
+    size_t outputed;
+
+    if (width < MIN_LINE_LIMIT) {
+        return;
+    }
+
+    /* the line is a copy, which ends where it does */
+    if (start > strlen((const char *) linenote) + 1) {
+        start = strlen((const char *) linenote) + 1;
+    }
+
+    zoom = width - (int)start;
+    zoom_limit = (int)length;
+    if (zoom <= zoom_limit) {
+        csbuilder_append(b, "   ...");
+        outputed = 6;
+        linenote = linenote + start - 1;
+        start = outputed + 1;
+    } else {
+        csbuilder_append(b, "   ");
+        outputed = 3;
+        start += outputed;
+    }
+
+    __write_linenote__(b, linenote, outputed, width);
+
+    __write_linenote_caution__(b, level, linenote, start, length, width);
+}
+
+
+static void __write_linenote__(csbuilder_t *b, const unsigned char *linenote, size_t outputed, size_t width)
 {
     size_t i;
 
@@ -561,19 +955,20 @@ static void __write_linenote__(const unsigned char *linenote, size_t outputed, s
             *linenote &&
             (width != 0 && i < width);
          linenote++, i++) {
-        putchar(*linenote);
+        csbuilder_append_ch(b, *linenote);
     }
 
     if (i == width && *linenote != '\r' && *linenote != '\n' && *linenote) {
-        printf("...\n");
+        csbuilder_append(b, "...\n");
     } else {
-        printf("\n");
+        csbuilder_append_ch(b, '\n');
     }
 }
 
 
 static
-void __write_linenote_caution__(diagnostor_level_t level,
+void __write_linenote_caution__(csbuilder_t *b,
+                                diagnostor_level_t level,
                                 linenote_t linenote,
                                 size_t start,
                                 size_t length,
@@ -584,7 +979,7 @@ void __write_linenote_caution__(diagnostor_level_t level,
     const char *caret;
 
     for (i = 1, j = 1; i < start; i++, j++) {
-        putchar(' ');
+        csbuilder_append_ch(b, ' ');
     }
 
     if (level == DIAGNOSTOR_LEVEL_WARNING) {
@@ -598,11 +993,37 @@ void __write_linenote_caution__(diagnostor_level_t level,
         tilde = BRUSH_BOLD_CYAN("~");
     } else {
         assert(false);
+        return;
     }
 
-    printf(caret);
+    csbuilder_append(b, caret);
     for (i = 1; i < length && j < width; i++, j++) {
-        printf(tilde);
+        csbuilder_append(b, tilde);
+    }
+    csbuilder_append_ch(b, '\n');
+}
+
+
+/* to stderr, after what was buffered for it, and frees b */
+static
+void __write_out__(csbuilder_t *b)
+{
+    fflush(stderr);
+    csbuilder_flush(b, fileno(stderr));
+    csbuilder_destroy(b);
+}
+
+
+/* FNV-1a */
+static inline
+uint64_t __hash__(uint64_t hash, const void *data, size_t n)
+{
+    const unsigned char *p = (const unsigned char *) data;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        hash = (hash ^ p[i]) * 1099511628211ULL;
     }
-    printf("\n");
+
+    return hash;
 }
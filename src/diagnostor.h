@@ -6,8 +6,11 @@
 
 #include "config.h"
 
+#include <setjmp.h>
+
 
 typedef struct array_s array_t;
+typedef struct arena_s arena_t;
 typedef struct token_s token_t;
 typedef struct linenote_caution_s linenote_caution_t;
 
@@ -20,13 +23,48 @@ typedef enum diagnostor_level_e {
 } diagnostor_level_t;
 
 
+/**
+ * A diagnostic waiting in the queue. fn, message and linenote are copied
+ * into the arena of the diagnostor, fn is NULL without a location and
+ * linenote NULL without a line, caution tells whether start and length
+ * mark a part of it.
+ **/
+typedef struct diagnostor_entry_s {
+    diagnostor_level_t level;
+    const char *fn;
+    size_t line;
+    size_t column;
+    const char *message;
+    const unsigned char *linenote;
+    bool caution;
+    size_t start;
+    size_t length;
+    uint64_t hash;
+} diagnostor_entry_t;
+
+
+/**
+ * Diagnostics are queued as they are raised and rendered together by
+ * diagnostor_flush(), into one write to the standard error. The same
+ * one raised again at the same place is dropped. seen is a table of
+ * indexes into queue plus one, by hash, nseen slots long. A fatal error,
+ * or one errors too many, ends the process, or jumps to escape if it is
+ * set, for a caller that outlives the unit.
+ **/
 typedef struct diagnostor_s {
     size_t nerrors;
     size_t nwarnings;
+    jmp_buf *escape;
+    array_t *queue;
+    arena_t *arena;
+    size_t *seen;
+    size_t nseen;
+    const char *last_fn;
+    const char *last_fn_copy;
 } diagnostor_t;
 
 
-extern diagnostor_t* diagnostor;
+extern THREAD_LOCAL diagnostor_t* diagnostor;
 
 
 #define diagnostor_has_error(diag) \
@@ -96,6 +134,7 @@ void diagnostor_note_linenote(diagnostor_t *diag, linenote_t linenote);
 void diagnostor_note_linenote_caution(diagnostor_t *diag, diagnostor_level_t level, linenote_t linenote,
                                       linenote_caution_t *linenote_caution);
 
+void diagnostor_flush(diagnostor_t *diag);
 void diagnostor_report(diagnostor_t *diag);
 
 
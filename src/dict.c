@@ -40,31 +40,82 @@
 #include "hash.h"
 
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   include <emmintrin.h>
+#   define DICT_SWISS_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#   include <arm_neon.h>
+#   define DICT_SWISS_NEON
+#endif
+
+#if defined(_MSC_VER)
+#   include <intrin.h>
+#endif
+
+
 static inline bool __dict_expand_if_needed__(dict_t *ht);
 static inline unsigned long __dict_next_power__(unsigned long size);
 static inline int __dict_key_index__(dict_t *d, const void *key, unsigned int hash, dict_entry_t **existing);
 static inline bool __dict_init__(dict_t *ht, dict_type_t *type, void *ud);
+static dict_entry_t* __dict_entry_new__(dict_t *d);
+static void __dict_slabs_release__(dict_t *d, bool keep);
+static unsigned long __dict_swiss_size_for__(unsigned long n);
+static bool __dict_swiss_resize__(dict_t *d, unsigned long size);
+static dict_entry_t* __dict_swiss_find__(dict_t *d, const void *key, uint64_t hash);
+static dict_entry_t* __dict_swiss_add_raw__(dict_t *d, void *key, dict_entry_t **existing);
+static dict_entry_t* __dict_swiss_delete__(dict_t *d, const void *key, bool nofree);
+static void __dict_swiss_clear__(dict_t *d, void(*callback)(void *));
+static dict_entry_t* __dict_swiss_next__(dict_iterator_t *iter);
 
 
 static unsigned int dict_force_resize_ratio = 5;
 static uint8_t dict_hash_function_seed[16];
 
+/* the tables the calling thread grew into, counted whatever the build */
+static THREAD_LOCAL unsigned long dict_rehash_count = 0;
+
 
 void dict_set_hash_function_seed(uint8_t *seed) {
     memcpy(dict_hash_function_seed, seed, sizeof(dict_hash_function_seed));
 }
 
 
+unsigned long dict_rehashes(void) {
+    return dict_rehash_count;
+}
+
+
 uint8_t* dict_get_hash_function_seed(void) {
     return dict_hash_function_seed;
 }
 
 
 uint64_t dict_gen_hash_function(const void *key, int len) {
+#if DICT_HASH == DICT_HASH_WYHASH
+    return wyhash(key, len, dict_hash_function_seed);
+#elif DICT_HASH == DICT_HASH_CRC32C
+    return crc32c_hash(key, len, dict_hash_function_seed);
+#else
+    return siphash(key, len, dict_hash_function_seed);
+#endif
+}
+
+
+uint64_t dict_gen_siphash_function(const void *key, int len) {
     return siphash(key, len, dict_hash_function_seed);
 }
 
 
+uint64_t dict_gen_wyhash_function(const void *key, int len) {
+    return wyhash(key, len, dict_hash_function_seed);
+}
+
+
+uint64_t dict_gen_crc32c_function(const void *key, int len) {
+    return crc32c_hash(key, len, dict_hash_function_seed);
+}
+
+
 uint64_t dict_gen_case_hash_function(const unsigned char *buf, int len) {
     return siphash_nocase(buf, len, dict_hash_function_seed);
 }
@@ -84,6 +135,78 @@ void __dict_reset__(dict_hash_table_t *ht)
 }
 
 
+/**
+ * An entry off the free list, or the next one of the current slab.
+ **/
+static
+dict_entry_t* __dict_entry_new__(dict_t *d)
+{
+    dict_entry_t *entry;
+    dict_slab_t *slab;
+    unsigned long size;
+
+    if ((entry = d->free_entries) != NULL) {
+        d->free_entries = entry->next;
+        return entry;
+    }
+
+    slab = d->slabs;
+    if (slab == NULL || slab->used == slab->size) {
+        size = slab == NULL ? DICT_SLAB_MIN_ENTRIES : slab->size * 2;
+        if (size > DICT_SLAB_MAX_ENTRIES) {
+            size = DICT_SLAB_MAX_ENTRIES;
+        }
+
+        slab = pmalloc(sizeof(dict_slab_t) + (size - 1) * sizeof(dict_entry_t));
+        if (!slab) {
+            return NULL;
+        }
+
+        slab->next = d->slabs;
+        slab->size = size;
+        slab->used = 0;
+        d->slabs = slab;
+    }
+
+    return &slab->entries[slab->used++];
+}
+
+
+static inline
+void __dict_entry_free__(dict_t *d, dict_entry_t *entry)
+{
+    entry->next = d->free_entries;
+    d->free_entries = entry;
+}
+
+
+/**
+ * Takes back every entry at once. With keep the newest slab, the largest,
+ * stays to be filled again.
+ **/
+static
+void __dict_slabs_release__(dict_t *d, bool keep)
+{
+    dict_slab_t *slab, *next;
+
+    slab = d->slabs;
+    if (keep && slab != NULL) {
+        slab->used = 0;
+        slab = slab->next;
+        d->slabs->next = NULL;
+    } else {
+        d->slabs = NULL;
+    }
+
+    for (; slab != NULL; slab = next) {
+        next = slab->next;
+        pfree(slab);
+    }
+
+    d->free_entries = NULL;
+}
+
+
 dict_t* dict_create(dict_type_t *type, void *ud)
 {
     dict_t* d = pmalloc(sizeof(dict_t));
@@ -94,6 +217,22 @@ dict_t* dict_create(dict_type_t *type, void *ud)
 }
 
 
+/**
+ * A dict on the open addressed backend. It takes the same dict_type_t and
+ * is used through the same functions, but an entry is not allocated on
+ * its own: a dict_entry_t it gives out moves when the table grows, it
+ * must not be kept across an add to the same dict.
+ **/
+dict_t* dict_create_swiss(dict_type_t *type, void *ud)
+{
+    dict_t *d = dict_create(type, ud);
+
+    d->swiss = pcalloc(1, sizeof(dict_swiss_t));
+
+    return d;
+}
+
+
 bool __dict_init__(dict_t *d, dict_type_t *type, void *ud)
 {
     __dict_reset__(&d->ht[0]);
@@ -103,6 +242,9 @@ bool __dict_init__(dict_t *d, dict_type_t *type, void *ud)
     d->ud        = ud;
     d->rehashidx = -1;
     d->iterators = 0;
+    d->swiss     = NULL;
+    d->slabs     = NULL;
+    d->free_entries = NULL;
 
     return true;
 }
@@ -120,6 +262,11 @@ bool dict_resize(dict_t *d)
         return false;
     }
 
+    if (d->swiss) {
+        minimal = __dict_swiss_size_for__(d->ht[0].used);
+        return (unsigned long) minimal != d->swiss->size ? __dict_swiss_resize__(d, minimal) : false;
+    }
+
     minimal = d->ht[0].used;
 
     if (minimal < DICT_HASH_TABLE_INITIAL_SIZE) {
@@ -138,6 +285,12 @@ bool dict_expand(dict_t *d, unsigned long size)
     dict_hash_table_t n;
     unsigned long realsize;
 
+    if (d->swiss) {
+        if (d->ht[0].used > size || (realsize = __dict_swiss_size_for__(size)) <= d->swiss->size) {
+            return false;
+        }
+        return __dict_swiss_resize__(d, realsize);
+    }
 
     realsize = __dict_next_power__(size);
 
@@ -171,6 +324,7 @@ bool dict_expand(dict_t *d, unsigned long size)
     /* Prepare a second hash table for incremental rehashing */
     d->ht[1] = n;
     d->rehashidx = 0;
+    dict_rehash_count++;
     return true;
 }
 
@@ -296,6 +450,10 @@ dict_entry_t* dict_add_raw(dict_t *d, void *key, dict_entry_t **existing)
     dict_entry_t *entry;
     dict_hash_table_t *ht;
 
+    if (d->swiss) {
+        return __dict_swiss_add_raw__(d, key, existing);
+    }
+
     if (dict_is_rehashing(d)) {
         __dict_rehash_step__(d);
     }
@@ -314,7 +472,11 @@ dict_entry_t* dict_add_raw(dict_t *d, void *key, dict_entry_t **existing)
      * more frequently.
      **/
     ht = dict_is_rehashing(d) ? &d->ht[1] : &d->ht[0];
-    entry = pmalloc(sizeof(*entry));
+    entry = __dict_entry_new__(d);
+    if (!entry) {
+        return NULL;
+    }
+
     entry->next = ht->table[index];
     ht->table[index] = entry;
     ht->used++;
@@ -395,6 +557,10 @@ static dict_entry_t* __dict_generic_delete__(dict_t *d, const void *key, bool no
         return NULL;
     }
 
+    if (d->swiss) {
+        return __dict_swiss_delete__(d, key, nofree);
+    }
+
     if (dict_is_rehashing(d)) {
         __dict_rehash_step__(d);
     }
@@ -418,7 +584,7 @@ static dict_entry_t* __dict_generic_delete__(dict_t *d, const void *key, bool no
                 if (!nofree) {
                     dict_free_key(d, he);
                     dict_free_val(d, he);
-                    pfree(he);
+                    __dict_entry_free__(d, he);
                 }
 
                 d->ht[table].used--;
@@ -486,15 +652,23 @@ void dict_free_unlinked_entry(dict_t *d, dict_entry_t *he)
 
     dict_free_key(d, he);
     dict_free_val(d, he);
-    pfree(he);
+    __dict_entry_free__(d, he);
 }
 
 
+/**
+ * The entries go back with their slabs, they are only walked for the key
+ * and value destructors.
+ **/
 static
 bool __dict_clear__(dict_t *d, dict_hash_table_t *ht, void(*callback)(void *))
 {
     unsigned long i;
 
+    if (!callback && !d->type->key_destructor && !d->type->val_destructor) {
+        ht->used = 0;
+    }
+
     for (i = 0; i < ht->size && ht->used > 0; i++) {
         dict_entry_t *he, *next;
 
@@ -510,7 +684,6 @@ bool __dict_clear__(dict_t *d, dict_hash_table_t *ht, void(*callback)(void *))
             next = he->next;
             dict_free_key(d, he);
             dict_free_val(d, he);
-            pfree(he);
             ht->used--;
             he = next;
         }
@@ -524,8 +697,14 @@ bool __dict_clear__(dict_t *d, dict_hash_table_t *ht, void(*callback)(void *))
 
 void dict_destroy(dict_t *d)
 {
+    if (d->swiss) {
+        __dict_swiss_clear__(d, NULL);
+        pfree(d->swiss);
+    }
+
     __dict_clear__(d, &d->ht[0], NULL);
     __dict_clear__(d, &d->ht[1], NULL);
+    __dict_slabs_release__(d, false);
     pfree(d);
 }
 
@@ -539,6 +718,10 @@ dict_entry_t* dict_find(dict_t *d, const void *key)
         return NULL;
     }
 
+    if (d->swiss) {
+        return __dict_swiss_find__(d, key, dict_hash_key(d, key));
+    }
+
     if (dict_is_rehashing(d)) {
         __dict_rehash_step__(d);
     }
@@ -584,7 +767,7 @@ long long dict_finger_print(dict_t *d) {
     long long integers[6], hash = 0;
     int j;
 
-    integers[0] = (long)d->ht[0].table;
+    integers[0] = d->swiss ? (long)d->swiss->ctrl : (long)d->ht[0].table;
     integers[1] = d->ht[0].size;
     integers[2] = d->ht[0].used;
     integers[3] = (long)d->ht[1].table;
@@ -640,6 +823,10 @@ dict_iterator_t* dict_get_safe_iterator(dict_t *d) {
 
 dict_entry_t* dict_next(dict_iterator_t *iter)
 {
+    if (iter->d->swiss) {
+        return __dict_swiss_next__(iter);
+    }
+
     for(;;) {
         if (iter->entry == NULL) {
             dict_hash_table_t *ht = &iter->d->ht[iter->table];
@@ -807,6 +994,16 @@ unsigned long dict_scan(dict_t *d, unsigned long v, dict_scan_function_pt scan_f
         return 0;
     }
 
+    /* the slots are not buckets, the open addressed table goes in one step */
+    if (d->swiss) {
+        for (m0 = 0; m0 < d->swiss->size; m0++) {
+            if (d->swiss->ctrl[m0] < DICT_SWISS_EMPTY) {
+                scan_fn(ud, &d->swiss->slots[m0]);
+            }
+        }
+        return 0;
+    }
+
     if (!dict_is_rehashing(d)) {
         t0 = &(d->ht[0]);
         m0 = t0->mask;
@@ -979,14 +1176,76 @@ static int __dict_key_index__(dict_t *d, const void *key, unsigned int hash, dic
 
 
 void dict_empty(dict_t *d, void(*callback)(void*)) {
+    if (d->swiss) {
+        __dict_swiss_clear__(d, callback);
+    }
+
     __dict_clear__(d, &d->ht[0], callback);
     __dict_clear__(d, &d->ht[1], callback);
+    __dict_slabs_release__(d, false);
 
     d->rehashidx = -1;
     d->iterators = 0;
 }
 
 
+/**
+ * Empties d for it to be filled again, keeping its table and its largest
+ * slab: a dict used for a short while and then thrown away can be reset
+ * instead. The entries are not visited unless the type has a destructor.
+ * Unlinked entries not yet freed go too.
+ **/
+void dict_reset(dict_t *d)
+{
+    dict_hash_table_t *ht;
+    dict_entry_t *he;
+    unsigned long i;
+    int table;
+
+    for (table = 0; table <= 1; table++) {
+        ht = &d->ht[table];
+
+        if (d->type->key_destructor || d->type->val_destructor) {
+            for (i = 0; i < ht->size && ht->used > 0; i++) {
+                for (he = ht->table[i]; he != NULL; he = he->next) {
+                    dict_free_key(d, he);
+                    dict_free_val(d, he);
+                    ht->used--;
+                }
+            }
+        }
+
+        if (ht->table != NULL) {
+            memset(ht->table, 0, ht->size * sizeof(dict_entry_t*));
+        }
+        ht->used = 0;
+    }
+
+    /* a rehash in progress is dropped, the larger table is kept */
+    if (dict_is_rehashing(d)) {
+        pfree(d->ht[0].table);
+        d->ht[0] = d->ht[1];
+        __dict_reset__(&d->ht[1]);
+        d->rehashidx = -1;
+    }
+
+    if (d->swiss && d->swiss->size != 0) {
+        for (i = 0; i < d->swiss->size; i++) {
+            if (d->swiss->ctrl[i] < DICT_SWISS_EMPTY) {
+                dict_free_key(d, &d->swiss->slots[i]);
+                dict_free_val(d, &d->swiss->slots[i]);
+            }
+        }
+
+        memset(d->swiss->ctrl, DICT_SWISS_EMPTY, d->swiss->size);
+        d->swiss->growth_left = d->swiss->size - d->swiss->size / 8;
+        d->ht[0].used = 0;
+    }
+
+    __dict_slabs_release__(d, true);
+}
+
+
 void dict_enable_resize(dict_t *d) {
     d->dict_can_resize = true;
 }
@@ -1013,7 +1272,8 @@ dict_entry_t** dict_find_entry_ref_by_ptr_and_hash(dict_t *d, const void *oldptr
     dict_entry_t *he, **heref;
     unsigned int idx, table;
 
-    if (d->ht[0].used + d->ht[1].used == 0) {
+    /* an open addressed entry is referenced by no other */
+    if (d->ht[0].used + d->ht[1].used == 0 || d->swiss) {
         return NULL;
     }
 
@@ -1039,6 +1299,364 @@ dict_entry_t** dict_find_entry_ref_by_ptr_and_hash(dict_t *d, const void *oldptr
 }
 
 
+/**
+ * The open addressed backend. A mask has a bit for each control byte of
+ * a group that matched, DICT_SWISS_SHIFT says how far apart they are.
+ **/
+#if defined(DICT_SWISS_NEON)
+#   define DICT_SWISS_SHIFT     2
+#else
+#   define DICT_SWISS_SHIFT     0
+#endif
+
+
+static inline
+uint64_t __dict_swiss_match__(const uint8_t *group, uint8_t c)
+{
+#if defined(DICT_SWISS_SSE2)
+    return (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) group),
+                                                       _mm_set1_epi8((char) c)));
+#elif defined(DICT_SWISS_NEON)
+    uint8x16_t eq = vceqq_u8(vld1q_u8(group), vdupq_n_u8(c));
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0) &
+           0x8888888888888888ULL;
+#else
+    uint64_t mask = 0;
+    int i;
+
+    for (i = 0; i < DICT_SWISS_GROUP; i++) {
+        mask |= (uint64_t) (group[i] == c) << i;
+    }
+    return mask;
+#endif
+}
+
+
+/* the slots of a group that are empty or deleted, both have the top bit set */
+static inline
+uint64_t __dict_swiss_match_free__(const uint8_t *group)
+{
+#if defined(DICT_SWISS_SSE2)
+    return (unsigned) _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) group));
+#elif defined(DICT_SWISS_NEON)
+    uint8x16_t top = vtstq_u8(vld1q_u8(group), vdupq_n_u8(0x80));
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(top), 4)), 0) &
+           0x8888888888888888ULL;
+#else
+    uint64_t mask = 0;
+    int i;
+
+    for (i = 0; i < DICT_SWISS_GROUP; i++) {
+        mask |= (uint64_t) (group[i] >> 7) << i;
+    }
+    return mask;
+#endif
+}
+
+
+static inline
+unsigned long __dict_swiss_first__(uint64_t mask)
+{
+#if defined(_MSC_VER)
+    unsigned long i;
+
+    if ((uint32_t) mask != 0) {
+        _BitScanForward(&i, (uint32_t) mask);
+    } else {
+        _BitScanForward(&i, (uint32_t) (mask >> 32));
+        i += 32;
+    }
+    return i >> DICT_SWISS_SHIFT;
+#else
+    return (unsigned long) __builtin_ctzll(mask) >> DICT_SWISS_SHIFT;
+#endif
+}
+
+
+/* the low seven bits are kept in the control byte, the others pick a group */
+#define __dict_swiss_h2__(hash)         ((uint8_t) ((hash) & 0x7F))
+#define __dict_swiss_group__(t, hash)   ((unsigned long) ((hash) >> 7) & ((t)->size / DICT_SWISS_GROUP - 1))
+
+
+/**
+ * The slots for n entries: at most seven eighths of them are filled, and
+ * they come in a power of two of groups.
+ **/
+static
+unsigned long __dict_swiss_size_for__(unsigned long n)
+{
+    unsigned long size = DICT_SWISS_GROUP;
+
+    while (size - size / 8 < n) {
+        size *= 2;
+    }
+
+    return size;
+}
+
+
+/**
+ * The first empty or deleted slot on the probe sequence of hash. The
+ * groups are visited at triangular steps, which goes through all of them
+ * as there are a power of two.
+ **/
+static
+unsigned long __dict_swiss_free_slot__(dict_swiss_t *t, uint64_t hash)
+{
+    unsigned long g, step;
+    uint64_t mask;
+
+    g = __dict_swiss_group__(t, hash);
+
+    for (step = 1; ; step++) {
+        mask = __dict_swiss_match_free__(t->ctrl + g * DICT_SWISS_GROUP);
+        if (mask != 0) {
+            return g * DICT_SWISS_GROUP + __dict_swiss_first__(mask);
+        }
+        g = (g + step) & (t->size / DICT_SWISS_GROUP - 1);
+    }
+}
+
+
+/**
+ * Moves the entries to size slots, which also drops the deleted ones.
+ * Their hashes are not kept, they are computed again.
+ **/
+static
+bool __dict_swiss_resize__(dict_t *d, unsigned long size)
+{
+    dict_swiss_t *t, n;
+    unsigned long i, j;
+    uint64_t hash;
+
+    t = d->swiss;
+
+    n.slots = pmalloc(size * (sizeof(dict_entry_t) + 1));
+    if (!n.slots) {
+        return false;
+    }
+
+    n.ctrl = (uint8_t *) (n.slots + size);
+    n.size = size;
+    n.growth_left = size - size / 8 - d->ht[0].used;
+    memset(n.ctrl, DICT_SWISS_EMPTY, size);
+
+    for (i = 0; i < t->size; i++) {
+        if (t->ctrl[i] >= DICT_SWISS_EMPTY) {
+            continue;
+        }
+
+        hash = dict_hash_key(d, t->slots[i].key);
+        j = __dict_swiss_free_slot__(&n, hash);
+        n.ctrl[j] = __dict_swiss_h2__(hash);
+        n.slots[j] = t->slots[i];
+    }
+
+    if (t->size != 0) {
+        dict_rehash_count++;
+    }
+
+    pfree(t->slots);
+    *t = n;
+    return true;
+}
+
+
+static
+dict_entry_t* __dict_swiss_find__(dict_t *d, const void *key, uint64_t hash)
+{
+    dict_swiss_t *t;
+    dict_entry_t *he;
+    unsigned long g, step;
+    uint64_t mask;
+    uint8_t *group;
+
+    t = d->swiss;
+    if (t->size == 0) {
+        return NULL;
+    }
+
+    g = __dict_swiss_group__(t, hash);
+
+    for (step = 1; ; step++) {
+        group = t->ctrl + g * DICT_SWISS_GROUP;
+
+        for (mask = __dict_swiss_match__(group, __dict_swiss_h2__(hash)); mask != 0; mask &= mask - 1) {
+            he = &t->slots[g * DICT_SWISS_GROUP + __dict_swiss_first__(mask)];
+            if (key == he->key || dict_compare_keys(d, key, he->key)) {
+                return he;
+            }
+        }
+
+        /* an empty slot ends the probe sequence, no key went past it */
+        if (__dict_swiss_match__(group, DICT_SWISS_EMPTY) != 0) {
+            return NULL;
+        }
+
+        g = (g + step) & (t->size / DICT_SWISS_GROUP - 1);
+    }
+}
+
+
+static
+dict_entry_t* __dict_swiss_add_raw__(dict_t *d, void *key, dict_entry_t **existing)
+{
+    dict_swiss_t *t;
+    dict_entry_t *entry;
+    unsigned long i, size;
+    uint64_t hash;
+
+    if (existing) {
+        *existing = NULL;
+    }
+
+    t = d->swiss;
+    hash = dict_hash_key(d, key);
+
+    if ((entry = __dict_swiss_find__(d, key, hash)) != NULL) {
+        if (existing) {
+            *existing = entry;
+        }
+        return NULL;
+    }
+
+    i = t->size != 0 ? __dict_swiss_free_slot__(t, hash) : 0;
+
+    /* a deleted slot can be taken again, an empty one needs room */
+    if (t->size == 0 || (t->growth_left == 0 && t->ctrl[i] == DICT_SWISS_EMPTY)) {
+        /* when half the room went to deleted slots, dropping them is enough */
+        size = __dict_swiss_size_for__(d->ht[0].used + 1);
+        if (size < t->size) {
+            size = t->size;
+        } else if (size == t->size && d->ht[0].used + 1 > (t->size - t->size / 8) / 2) {
+            size *= 2;
+        }
+
+        if (!__dict_swiss_resize__(d, size)) {
+            return NULL;
+        }
+
+        i = __dict_swiss_free_slot__(t, hash);
+    }
+
+    if (t->ctrl[i] == DICT_SWISS_EMPTY) {
+        t->growth_left--;
+    }
+
+    t->ctrl[i] = __dict_swiss_h2__(hash);
+    d->ht[0].used++;
+
+    entry = &t->slots[i];
+    entry->next = NULL;
+    dict_set_key(d, entry, key);
+
+    return entry;
+}
+
+
+/**
+ * A slot whose group still has an empty one ends no probe sequence that
+ * would not have ended there anyway, so it can be emptied. Otherwise it
+ * is marked deleted, for the lookups to go on. An unlinked entry is
+ * copied out for dict_free_unlinked_entry().
+ **/
+static
+dict_entry_t* __dict_swiss_delete__(dict_t *d, const void *key, bool nofree)
+{
+    dict_swiss_t *t;
+    dict_entry_t *he, *copy;
+    unsigned long i;
+
+    t = d->swiss;
+
+    if ((he = __dict_swiss_find__(d, key, dict_hash_key(d, key))) == NULL) {
+        return NULL;
+    }
+
+    i = (unsigned long) (he - t->slots);
+
+    if (nofree) {
+        if ((copy = __dict_entry_new__(d)) == NULL) {
+            return NULL;
+        }
+        *copy = *he;
+    } else {
+        copy = he;
+        dict_free_key(d, he);
+        dict_free_val(d, he);
+    }
+
+    if (__dict_swiss_match__(t->ctrl + (i & ~(unsigned long) (DICT_SWISS_GROUP - 1)), DICT_SWISS_EMPTY) != 0) {
+        t->ctrl[i] = DICT_SWISS_EMPTY;
+        t->growth_left++;
+    } else {
+        t->ctrl[i] = DICT_SWISS_DELETED;
+    }
+
+    d->ht[0].used--;
+    return copy;
+}
+
+
+static
+void __dict_swiss_clear__(dict_t *d, void(*callback)(void *))
+{
+    dict_swiss_t *t;
+    unsigned long i;
+
+    t = d->swiss;
+
+    for (i = 0; i < t->size && d->ht[0].used > 0; i++) {
+        if (callback && (i & 65535) == 0) {
+            callback(d->ud);
+        }
+
+        if (t->ctrl[i] < DICT_SWISS_EMPTY) {
+            dict_free_key(d, &t->slots[i]);
+            dict_free_val(d, &t->slots[i]);
+            d->ht[0].used--;
+        }
+    }
+
+    pfree(t->slots);
+    t->slots = NULL;
+    t->ctrl = NULL;
+    t->size = 0;
+    t->growth_left = 0;
+    d->ht[0].used = 0;
+}
+
+
+/**
+ * Entries stay in their slots until the table grows, so deleting the
+ * one just returned is fine, adding while iterating is not.
+ **/
+static
+dict_entry_t* __dict_swiss_next__(dict_iterator_t *iter)
+{
+    dict_swiss_t *t = iter->d->swiss;
+
+    if (iter->index == -1) {
+        if (iter->safe) {
+            iter->d->iterators++;
+        } else {
+            iter->fingerprint = dict_finger_print(iter->d);
+        }
+    }
+
+    while (++iter->index < (long) t->size) {
+        if (t->ctrl[iter->index] < DICT_SWISS_EMPTY) {
+            iter->entry = &t->slots[iter->index];
+            return iter->entry;
+        }
+    }
+
+    /* stay past the end, a further call must not count the iterator again */
+    iter->index = (long) t->size;
+    return NULL;
+}
+
+
 #ifdef COLLECT_DICT_STATS
 
 
@@ -1105,6 +1723,13 @@ void dict_get_stats(dict_t *d, dict_stat_t* stats)
     __init_dict_hash_table_stat__(&stats->main);
     __init_dict_hash_table_stat__(&stats->rehashing);
 
+    if (d->swiss) {
+        stats->main.table_size = d->swiss->size;
+        stats->main.number_of_elements = d->ht[0].used;
+        stats->main.different_slots = d->ht[0].used;
+        return;
+    }
+
     __dict_get_stats_ht__(&d->ht[0], &stats->main);
 
     if (dict_is_rehashing(d)) {
@@ -83,6 +83,35 @@ typedef struct dict_hash_table_s {
 } dict_hash_table_t;
 
 
+/**
+ * The open addressed table of dict_create_swiss(). The entries are kept
+ * in the slots themselves, with a control byte for each: the low seven
+ * bits of the hash of its key, or DICT_SWISS_EMPTY or DICT_SWISS_DELETED.
+ * The control bytes are probed a group at a time, the groups in turn
+ * from the one the rest of the hash picks. The number of entries is
+ * kept in ht[0].used, as for the chained tables.
+ **/
+typedef struct dict_swiss_s {
+    dict_entry_t  *slots;
+    uint8_t       *ctrl;
+    unsigned long  size;
+    unsigned long  growth_left;
+} dict_swiss_t;
+
+
+/**
+ * The entries of a chained table are carved out of slabs that belong to
+ * the dict, a deleted one goes on a free list for the next add. The slabs
+ * double in size up to DICT_SLAB_MAX_ENTRIES.
+ **/
+typedef struct dict_slab_s {
+    struct dict_slab_s *next;
+    unsigned long       size;
+    unsigned long       used;
+    dict_entry_t        entries[1];
+} dict_slab_t;
+
+
 typedef struct dict_s {
     dict_type_t      *type;
     void             *ud;
@@ -90,6 +119,9 @@ typedef struct dict_s {
     long              rehashidx;
     bool              dict_can_resize;
     unsigned long     iterators;
+    dict_swiss_t     *swiss;
+    dict_slab_t      *slabs;
+    dict_entry_t     *free_entries;
 } dict_t;
 
 
@@ -117,7 +149,27 @@ typedef void (*dict_scan_function_pt)(void *privdata, const dict_entry_t *de);
 typedef void (*dict_scan_bucket_function_pt)(void *privdata, dict_entry_t **bucketref);
 
 
+/**
+ * What dict_gen_hash_function() runs. SipHash resists keys chosen to
+ * collide, the others are faster for keys from trusted input; any of them
+ * may also be called on its own from a dict_type_t. benchhash compares
+ * them.
+ **/
+#define DICT_HASH_SIPHASH                   0
+#define DICT_HASH_WYHASH                    1
+#define DICT_HASH_CRC32C                    2
+
+#ifndef DICT_HASH
+#define DICT_HASH                           DICT_HASH_WYHASH
+#endif
+
+
 #define DICT_HASH_TABLE_INITIAL_SIZE        4
+#define DICT_SLAB_MIN_ENTRIES               8
+#define DICT_SLAB_MAX_ENTRIES               1024
+#define DICT_SWISS_GROUP                    16          /* control bytes probed at once */
+#define DICT_SWISS_EMPTY                    0x80
+#define DICT_SWISS_DELETED                  0xFE
 #define DICT_STATS_VECTLEN                  50
 #define DICT_NOTUSED(D)                     ((void)D)
 
@@ -182,6 +234,7 @@ typedef void (*dict_scan_bucket_function_pt)(void *privdata, dict_entry_t **buck
 
 
 dict_t* dict_create(dict_type_t *type, void *ud);
+dict_t* dict_create_swiss(dict_type_t *type, void *ud);
 void dict_destroy(dict_t *d);
 bool dict_expand(dict_t *d, unsigned long size);
 bool dict_add(dict_t *d, void *key, void *val);
@@ -200,12 +253,17 @@ dict_entry_t* dict_next(dict_iterator_t *iter);
 void dict_release_iterator(dict_iterator_t *iter);
 
 uint64_t dict_gen_hash_function(const void *key, int len);
+uint64_t dict_gen_siphash_function(const void *key, int len);
+uint64_t dict_gen_wyhash_function(const void *key, int len);
+uint64_t dict_gen_crc32c_function(const void *key, int len);
 uint64_t dict_gen_case_hash_function(const unsigned char *buf, int len);
 void dict_empty(dict_t *d, void(*callback)(void*));
+void dict_reset(dict_t *d);
 void dict_enable_resize(dict_t *d);
 void dict_disable_resize(dict_t *d);
 bool dict_rehash(dict_t *d, int n);
 void dict_set_hash_function_seed(uint8_t *seed);
+unsigned long dict_rehashes(void);
 uint8_t* dict_get_hash_function_seed(void);
 unsigned long dict_scan(dict_t *d, unsigned long v, dict_scan_function_pt scan_fn, dict_scan_bucket_function_pt bucket_fn, void *ud);
 unsigned int dict_get_hash(dict_t *d, const void *key);
@@ -0,0 +1,602 @@
+
+
+#include "config.h"
+#include "pmalloc.h"
+#include "array.h"
+#include "arena.h"
+#include "set.h"
+#include "cstring.h"
+#include "cspool.h"
+#include "option.h"
+#include "token.h"
+#include "diagnostor.h"
+#include "srcpool.h"
+#include "incpath.h"
+#include "reader.h"
+#include "lexer.h"
+#include "hideset.h"
+#include "srcloc.h"
+#include "depfile.h"
+#include "writer.h"
+#include "trace.h"
+#include "preprocessor.h"
+#include "tokcache.h"
+#include "prefetch.h"
+#include "driver.h"
+
+
+#if defined(UNIX)
+#   include <sys/stat.h>
+#endif
+
+
+static void __driver_worker__(void *ud);
+static void __driver_unit__(driver_t *drv, size_t index);
+static bool __driver_to_stdout__(option_t *opt);
+static bool __driver_has_outfile__(option_t *opt);
+static void __driver_depends__(depfile_t *dep, option_t *opt, const char *fn);
+static void __driver_trace__(option_t *opt, const char *fn);
+static cstring_t __driver_output_name__(option_t *opt, const char *fn, const char *suffix);
+static prefetch_t* __driver_prefetch__(driver_t *drv);
+
+
+driver_t* driver_create(option_t *option)
+{
+    driver_t *drv;
+
+    drv = (driver_t *) pmalloc(sizeof(driver_t));
+    if (!drv) {
+        return NULL;
+    }
+
+    drv->option = option;
+    drv->inputs = array_create_n(sizeof(cstring_t), 8);
+    drv->finished = array_create_n(sizeof(bool), 8);
+    drv->srcpool = srcpool_create();
+    drv->include_paths = incpath_create();
+    drv->tokcache = NULL;
+    drv->prefetch = NULL;
+    drv->shared = false;
+
+    mutex_init(&drv->mutex);
+    cond_init(&drv->turn_done);
+    drv->next = 0;
+    drv->turn = 0;
+    drv->nerrors = 0;
+    drv->nwarnings = 0;
+    drv->nfailed = 0;
+    memset(&drv->stats, 0, sizeof(drv->stats));
+
+    return drv;
+}
+
+
+void driver_destroy(driver_t *drv)
+{
+    cstring_t *inputs;
+    size_t i;
+
+    array_foreach(drv->inputs, inputs, i) {
+        cstring_free(inputs[i]);
+    }
+
+    array_destroy(drv->inputs);
+    array_destroy(drv->finished);
+
+    if (!drv->shared) {
+        srcpool_destroy(drv->srcpool);
+        incpath_destroy(drv->include_paths);
+
+        if (drv->tokcache != NULL) {
+            tokcache_destroy(drv->tokcache);
+        }
+    }
+
+    cond_destroy(&drv->turn_done);
+    mutex_destroy(&drv->mutex);
+    pfree(drv);
+}
+
+
+void driver_add_input(driver_t *drv, const char *fn)
+{
+    array_cast_append(cstring_t, drv->inputs, cstring_new(fn));
+    array_cast_append(bool, drv->finished, false);
+}
+
+
+/**
+ * Searched before the system directories, which driver_run() adds last.
+ **/
+void driver_add_include_path(driver_t *drv, const char *path)
+{
+    incpath_add(drv->include_paths, path);
+}
+
+
+/**
+ * Has the runs use what outlives them, which the driver does not own:
+ * its own buffers and include paths, with the search directories added
+ * so far, are let go for those. tokcache may be NULL.
+ **/
+void driver_share(driver_t *drv, srcpool_t *srcpool, incpath_t *include_paths, tokcache_t *tokcache)
+{
+    if (!drv->shared) {
+        srcpool_destroy(drv->srcpool);
+        incpath_destroy(drv->include_paths);
+
+        if (drv->tokcache != NULL) {
+            tokcache_destroy(drv->tokcache);
+        }
+    }
+
+    drv->srcpool = srcpool;
+    drv->include_paths = include_paths;
+    drv->tokcache = tokcache;
+    drv->shared = true;
+}
+
+
+/**
+ * Runs every input on up to jobs workers, on the calling thread alone
+ * for a single one, then reports the stats asked for to stderr. The
+ * number of units that had errors; with -o or -MF for more than one
+ * input none is run and all count.
+ **/
+size_t driver_run(driver_t *drv, size_t jobs)
+{
+    thread_t threads[DRIVER_MAX_JOBS];
+    size_t i, n;
+
+    incpath_add_std(drv->include_paths);
+
+    n = array_length(drv->inputs);
+
+    /* the units would each write over the one file, gcc refuses it as well */
+    if (n > 1 && __driver_has_outfile__(drv->option)) {
+        errorf("cannot specify '-o' with multiple files");
+        diagnostor_flush(diagnostor);
+        return n;
+    }
+
+    if (n > 1 && drv->option->MF != NULL) {
+        errorf("cannot specify '-MF' with multiple files");
+        diagnostor_flush(diagnostor);
+        return n;
+    }
+
+    if (n > 1 && drv->option->save_snapshot != NULL) {
+        errorf("cannot specify '-fsave-snapshot' with multiple files");
+        diagnostor_flush(diagnostor);
+        return n;
+    }
+
+    jobs = jobs < 1 ? 1 : jobs > DRIVER_MAX_JOBS ? DRIVER_MAX_JOBS : jobs;
+    jobs = jobs > n ? n : jobs;
+
+    /* one prefetcher for all the workers, a header they share is loaded once */
+    if (drv->option->prefetch) {
+        drv->prefetch = __driver_prefetch__(drv);
+    }
+
+    /* the tokcache is of the calling thread, the workers go without */
+    if (jobs > 1) {
+        if (!drv->shared && drv->tokcache != NULL) {
+            tokcache_destroy(drv->tokcache);
+        }
+        drv->tokcache = NULL;
+    }
+
+    if (jobs <= 1) {
+        /* with -fcache-dir a run of its own reads what runs before it lexed */
+        if (!drv->shared && drv->tokcache == NULL && drv->option->cache_dir != NULL) {
+#if defined(UNIX)
+            mkdir(drv->option->cache_dir, 0777);
+#endif
+            drv->tokcache = tokcache_create(drv->option->cache_dir);
+        }
+
+        __driver_worker__(drv);
+        goto done;
+    }
+
+    for (i = 0; i < jobs; i++) {
+        if (!thread_create(&threads[i], __driver_worker__, drv)) {
+            break;
+        }
+    }
+
+    /* the workers that did start take on the units of those that did not */
+    if (i == 0) {
+        __driver_worker__(drv);
+    }
+
+    for (n = i, i = 0; i < n; i++) {
+        thread_join(&threads[i]);
+    }
+
+done:
+    if (drv->prefetch != NULL) {
+        prefetch_destroy(drv->prefetch);
+        drv->prefetch = NULL;
+    }
+
+    if (drv->option->time_report || drv->option->print_stats) {
+        stats_report(&drv->stats, stderr, drv->option->time_report, drv->option->print_stats);
+    }
+
+    return drv->nfailed;
+}
+
+
+static
+void __driver_worker__(void *ud)
+{
+    driver_t *drv = (driver_t *) ud;
+    size_t index;
+
+    for (;;) {
+        mutex_lock(&drv->mutex);
+        index = drv->next++;
+        mutex_unlock(&drv->mutex);
+
+        if (index >= array_length(drv->inputs)) {
+            break;
+        }
+
+        __driver_unit__(drv, index);
+    }
+
+    arena_cleanup();
+    pmalloc_profile_merge();
+}
+
+
+/**
+ * Preprocesses one unit with option and diagnostor pointing at its own,
+ * then puts them back. A unit writing to the standard output waits for
+ * the units before it to be finished.
+ **/
+static
+void __driver_unit__(driver_t *drv, size_t index)
+{
+    option_t opt, *saved_option;
+    diagnostor_t *diag, *saved_diagnostor;
+    preprocessor_t * volatile pp = NULL;
+    arena_t *arena;
+    arena_mark_t mark;
+    depfile_t * volatile dep = NULL;
+    cspool_t *csp;
+    lexer_t *lexer;
+    writer_t * volatile w = NULL;
+    token_t *batch[LEXER_BATCH];
+    jmp_buf escape;
+    bool *finished;
+    FILE * volatile fp = NULL;
+    const char *fn;
+    size_t span, i, n;
+    int fd;
+    bool ok, end;
+
+    fn = (const char *) array_cast_at(cstring_t, drv->inputs, index);
+
+    opt = *drv->option;
+    opt.infile = fn;
+
+    diag = diagnostor_create();
+
+    saved_option = option;
+    saved_diagnostor = diagnostor;
+    option = &opt;
+    diagnostor = diag;
+
+    if (__driver_to_stdout__(&opt)) {
+        mutex_lock(&drv->mutex);
+        while (drv->turn != index) {
+            cond_wait(&drv->turn_done, &drv->mutex);
+        }
+        mutex_unlock(&drv->mutex);
+    }
+
+    /* counted from here, not the wait for the turn */
+    stats_begin(opt.time_report);
+
+    if (opt.time_trace) {
+        trace_begin(opt.time_trace_granularity);
+    }
+
+    span = trace_enter(TRACE_SOURCE, fn, strlen(fn));
+
+    /* the tokens of the unit go at once, the blocks stay for the next */
+    arena = arena_of(ARENA_PHASE_UNIT);
+    mark = arena_mark(arena);
+
+    csp = cspool_create();
+    lexer = lexer_create_srcpool(csp, drv->srcpool);
+    lexer_set_arena(lexer, arena);
+
+    /* the preprocessor takes no trivia, the writer spaces tokens itself */
+    lexer_set_trivia(lexer, false);
+
+    if (drv->prefetch != NULL) {
+        reader_set_prefetch(lexer->reader, drv->prefetch);
+    }
+
+    /* a driver that outlives the run does not let a unit end the process */
+    if (drv->shared) {
+        diag->escape = &escape;
+        if (setjmp(escape) != 0) {
+            goto given_up;
+        }
+    }
+
+    if (!lexer_push(lexer, STREAM_TYPE_FILE, (const unsigned char *) fn)) {
+        errorf("%s: No such file or directory", fn);
+        goto done;
+    }
+
+    pp = preprocessor_create_incpath(lexer, drv->include_paths);
+    if (drv->tokcache != NULL) {
+        preprocessor_set_tokcache(pp, drv->tokcache);
+    }
+
+    /* the prefix the snapshot was saved after stands read before the unit */
+    if (opt.load_snapshot != NULL && !preprocessor_load_snapshot(pp, opt.load_snapshot)) {
+        errorf("cannot load snapshot '%s'", opt.load_snapshot);
+    }
+
+    if (opt.Mflag || opt.MDflag) {
+        dep = depfile_create();
+        preprocessor_set_depfile(pp, dep);
+    }
+
+    if (opt.Eflag && !opt.Mflag && __driver_has_outfile__(&opt) &&
+        (fp = fopen(opt.outfile, "wb")) == NULL) {
+        errorf("cannot open '%s'", opt.outfile);
+    }
+
+    if (opt.Eflag && !opt.Mflag && (fp != NULL || !__driver_has_outfile__(&opt))) {
+        /* what printf() has buffered goes out before the writer's output */
+        fflush(stdout);
+        fd = fp != NULL ? fileno(fp) : fileno(stdout);
+
+        w = writer_create(fd, 0);
+        ok = writer_preprocess(w, pp);
+        if (!writer_destroy(w) || !ok) {
+            errorf("error writing the output of '%s'", fn);
+        }
+        w = NULL;
+    } else {
+        do {
+            n = preprocessor_expand_batch(pp, batch, LEXER_BATCH);
+            end = batch[n - 1]->type == TOKEN_END || batch[n - 1]->type == TOKEN_EOF;
+
+            for (i = 0; i < n; i++) {
+                token_destroy(batch[i]);
+            }
+        } while (!end);
+    }
+
+    if (fp != NULL) {
+        fclose(fp);
+        fp = NULL;
+    }
+
+    if (dep != NULL) {
+        __driver_depends__(dep, &opt, fn);
+        depfile_destroy(dep);
+        dep = NULL;
+    }
+
+    if (opt.save_snapshot != NULL && diag->nerrors == 0 &&
+        !preprocessor_save_snapshot(pp, opt.save_snapshot)) {
+        errorf("cannot write snapshot '%s'", opt.save_snapshot);
+    }
+
+    preprocessor_destroy(pp);
+    goto done;
+
+given_up:
+    /* what the unit wrote goes out, what it was at is let go */
+    diag->escape = NULL;
+
+    if (w != NULL) {
+        writer_destroy(w);
+    }
+
+    if (fp != NULL) {
+        fclose(fp);
+    }
+
+    if (dep != NULL) {
+        depfile_destroy(dep);
+    }
+
+    if (pp != NULL) {
+        preprocessor_destroy(pp);
+    }
+
+done:
+    trace_leave(span, 0);
+    if (tracing) {
+        __driver_trace__(&opt, fn);
+    }
+
+    lexer_destroy(lexer);
+    cspool_destroy(csp);
+    arena_reset(arena, mark);
+
+    /* no token of the unit is left to hold one of its hidesets or locations */
+    hideset_cleanup();
+    srcloc_cleanup();
+    fflush(stdout);
+    diagnostor_flush(diag);
+
+    mutex_lock(&drv->mutex);
+
+    drv->nerrors += diag->nerrors;
+    drv->nwarnings += diag->nwarnings;
+    drv->nfailed += diag->nerrors != 0 ? 1 : 0;
+    stats_end(&drv->stats);
+
+    if (tracing) {
+        trace_summary(stderr, fn, TRACE_TOP);
+        trace_end();
+    }
+
+    finished = array_prototype(drv->finished, bool);
+    finished[index] = true;
+    while (drv->turn < array_length(drv->finished) && finished[drv->turn]) {
+        drv->turn++;
+    }
+
+    cond_broadcast(&drv->turn_done);
+    mutex_unlock(&drv->mutex);
+
+    option = saved_option;
+    diagnostor = saved_diagnostor;
+    diagnostor_destroy(diag);
+}
+
+
+static
+bool __driver_to_stdout__(option_t *opt)
+{
+    if (opt->Mflag) {
+        return opt->MF == NULL;
+    }
+
+    return opt->Eflag && !__driver_has_outfile__(opt);
+}
+
+
+static
+bool __driver_has_outfile__(option_t *opt)
+{
+    return opt->outfile != NULL && opt->outfile[0] != '\0';
+}
+
+
+/**
+ * The target of the rule: -MT as it is and -MQ quoted, else the object
+ * quoted. The rule goes to -MF, else to the output for -M and next to
+ * the output for -MD, named after it with ".d".
+ **/
+static
+void __driver_depends__(depfile_t *dep, option_t *opt, const char *fn)
+{
+    cstring_t target, quoted, mf = NULL;
+    const char *to;
+
+    if (opt->MT != NULL || opt->MQ != NULL) {
+        target = cstring_new(opt->MT != NULL ? opt->MT : "");
+
+        if (opt->MQ != NULL) {
+            if (cstring_length(target) > 0) {
+                target = cstring_concat_ch(target, ' ');
+            }
+            quoted = depfile_quote(opt->MQ);
+            target = cstring_concat_n(target, quoted, cstring_length(quoted));
+            cstring_free(quoted);
+        }
+    } else {
+        quoted = depfile_target(fn);
+        target = depfile_quote((const char *) quoted);
+        cstring_free(quoted);
+    }
+
+    if (opt->MF != NULL) {
+        to = opt->MF;
+    } else if (opt->Mflag) {
+        to = NULL;
+    } else {
+        mf = __driver_output_name__(opt, fn, ".d");
+        to = (const char *) mf;
+    }
+
+    if (!depfile_write(dep, to, (const char *) target, fn, !opt->MMflag)) {
+        errorf("cannot write the dependencies of '%s'", fn);
+    }
+
+    if (mf != NULL) {
+        cstring_free(mf);
+    }
+
+    cstring_free(target);
+}
+
+
+/**
+ * The trace goes next to the output, named after it with ".json" for
+ * its suffix.
+ **/
+static
+void __driver_trace__(option_t *opt, const char *fn)
+{
+    cstring_t path;
+    FILE *fp;
+    bool ok;
+
+    path = __driver_output_name__(opt, fn, ".json");
+
+    if ((fp = fopen(path, "wb")) == NULL) {
+        errorf("cannot open '%s'", path);
+    } else {
+        ok = trace_write(fp, fn);
+        if (fclose(fp) != 0 || !ok) {
+            errorf("cannot write the trace of '%s'", fn);
+        }
+    }
+
+    cstring_free(path);
+}
+
+
+/**
+ * A file that goes with the output: -o with suffix for its own, else the
+ * input with neither its directory nor its suffix, as the object would be.
+ **/
+static
+cstring_t __driver_output_name__(option_t *opt, const char *fn, const char *suffix)
+{
+    const char *from, *base, *dot;
+
+    from = __driver_has_outfile__(opt) ? opt->outfile : fn;
+
+    base = strrchr(from, '/');
+    base = base != NULL ? base + 1 : from;
+
+    if (from == fn) {
+        from = base;
+    }
+
+    dot = strrchr(base, '.');
+    if (dot == NULL) {
+        dot = base + strlen(base);
+    }
+
+    return cstring_concat_n(cstring_new_n(from, (size_t) (dot - from)), suffix, strlen(suffix));
+}
+
+
+/**
+ * A prefetcher on the buffers of the units, searching the directories
+ * they do: those of -I and the system ones, in that order.
+ **/
+static
+prefetch_t* __driver_prefetch__(driver_t *drv)
+{
+    prefetch_t *prefetch;
+    incpath_dir_t *dirs;
+    size_t i;
+
+    prefetch = prefetch_create(drv->srcpool);
+
+    mutex_lock(&drv->include_paths->mutex);
+    array_foreach(drv->include_paths->dirs, dirs, i) {
+        prefetch_add_path(prefetch, (const char *) dirs[i].path);
+    }
+    mutex_unlock(&drv->include_paths->mutex);
+
+    return prefetch;
+}
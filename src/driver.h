@@ -0,0 +1,69 @@
+
+
+#ifndef __DRIVER__H__
+#define __DRIVER__H__
+
+
+#include "config.h"
+#include "thread.h"
+#include "stats.h"
+
+
+typedef struct array_s      array_t;
+typedef struct option_s     option_t;
+typedef struct srcpool_s    srcpool_t;
+typedef struct incpath_s    incpath_t;
+typedef struct tokcache_s   tokcache_t;
+typedef struct prefetch_s   prefetch_t;
+
+
+#define DRIVER_MAX_JOBS     64
+
+
+/**
+ * Runs the translation units of the command line on a pool of workers.
+ * Each unit gets an option_t copied from option and a diagnostor_t of
+ * its own, made current on its thread, and a lexer and preprocessor of
+ * its own. The source buffers and the include paths with what they
+ * resolved are shared by all of them. Units writing to the standard
+ * output take turns in the order they were given, so the output reads
+ * as if they ran one after the other. What each unit counted is added
+ * up in stats, reported at the end with -ftime-report or -print-stats.
+ * The buffers and include paths may be another's, as the tokcache is,
+ * which only a run on the calling thread alone uses. A driver of its own
+ * makes one on the directory of -fcache-dir, for those runs. With
+ * -fprefetch the headers the units include are loaded into the buffers
+ * ahead of them, by a thread of the run. -fsave-snapshot keeps the
+ * macros and guards a unit ended with, -fload-snapshot starts each unit
+ * with them, as if it began with the same prefix.
+ **/
+typedef struct driver_s {
+    option_t *option;
+    array_t *inputs;
+    array_t *finished;
+    srcpool_t *srcpool;
+    incpath_t *include_paths;
+    tokcache_t *tokcache;
+    prefetch_t *prefetch;
+    bool shared;
+
+    mutex_t mutex;
+    cond_t turn_done;
+    size_t next;
+    size_t turn;
+    size_t nerrors;
+    size_t nwarnings;
+    size_t nfailed;
+    stats_t stats;
+} driver_t;
+
+
+driver_t* driver_create(option_t *option);
+void driver_destroy(driver_t *drv);
+void driver_add_input(driver_t *drv, const char *fn);
+void driver_add_include_path(driver_t *drv, const char *path);
+void driver_share(driver_t *drv, srcpool_t *srcpool, incpath_t *include_paths, tokcache_t *tokcache);
+size_t driver_run(driver_t *drv, size_t jobs);
+
+
+#endif
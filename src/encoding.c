@@ -4,11 +4,23 @@
 #include "encoding.h"
 
 
-static inline int __count_leading_ones__(char ch);
-static inline bool __parse_rune__(uint32_t *rune, size_t *rune_size, char *s, int n);
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   include <emmintrin.h>
+#   define ENCODING_USE_SSE2
+#elif defined(__aarch64__) && defined(__ARM_NEON) && !defined(__ARM_BIG_ENDIAN)
+#   include <arm_neon.h>
+#   define ENCODING_USE_NEON
+#endif
+
+
+static inline int __count_leading_ones__(unsigned char ch);
+static inline bool __parse_rune__(uint32_t *rune, size_t *rune_size, const unsigned char *s, size_t n);
+static size_t __ascii_run__(const unsigned char *s, size_t n);
+static void __widen16__(unsigned char *to, const unsigned char *s, size_t n);
+static void __widen32__(unsigned char *to, const unsigned char *s, size_t n);
 static inline cstring_t __write8__(cstring_t cs, uint8_t u);
-static inline cstring_t __write16__(cstring_t cs, uint16_t u);
-static inline cstring_t __write32__(cstring_t cs, uint32_t u);
+static inline unsigned char* __put16__(unsigned char *to, uint16_t u);
+static inline unsigned char* __put32__(unsigned char *to, uint32_t u);
 
 
 cstring_t cstring_append_utf8(cstring_t cs, uint32_t rune)
@@ -42,10 +54,19 @@ cstring_t cstring_append_utf8(cstring_t cs, uint32_t rune)
 }
 
 
+/**
+ * The code units go little endian into a string made once: no rune takes
+ * more units of two bytes than it has bytes. Runs of ASCII are widened a
+ * vector at a time. NULL if cs is not valid UTF-8.
+ **/
 cstring_t cstring_cast_to_utf16(cstring_t cs)
 {
+    const unsigned char *s = (const unsigned char *) cs;
+    unsigned char *p;
     cstring_t to;
-    size_t i, length;
+    size_t i, n, length;
+    uint32_t rune;
+    size_t rune_size;
 
     length = cstring_length(cs);
     to = cstring_new_n(NULL, length * sizeof(uint16_t));
@@ -53,58 +74,108 @@ cstring_t cstring_cast_to_utf16(cstring_t cs)
         return NULL;
     }
 
+    p = (unsigned char *) to;
+
     for (i = 0; i < length;) {
-        uint32_t rune;
-        size_t rune_size;
+        if ((n = __ascii_run__(s + i, length - i)) != 0) {
+            __widen16__(p, s + i, n);
+            p += n * sizeof(uint16_t);
+            i += n;
+            continue;
+        }
 
-        if (!__parse_rune__(&rune, &rune_size, &cs[i], length - i)) {
+        if (!__parse_rune__(&rune, &rune_size, s + i, length - i)) {
             cstring_free(to);
             return NULL;
         }
 
         if (rune < 0x10000) {
-            to = __write16__(to, rune);
+            p = __put16__(p, (uint16_t) rune);
         } else {
-            to = __write16__(to, (rune >> 10) + 0xD7C0);
-            to = __write16__(to, (rune & 0x3FF) + 0xDC00);
+            p = __put16__(p, (uint16_t) ((rune >> 10) + 0xD7C0));
+            p = __put16__(p, (uint16_t) ((rune & 0x3FF) + 0xDC00));
         }
 
         i += rune_size;
     }
 
+    cstring_set_length(to, p - (unsigned char *) to);
     return to;
 }
 
 
 cstring_t cstring_cast_to_utf32(cstring_t cs)
 {
+    const unsigned char *s = (const unsigned char *) cs;
+    unsigned char *p;
     cstring_t to;
-    size_t i, length;
+    size_t i, n, length;
+    uint32_t rune;
+    size_t rune_size;
 
     length = cstring_length(cs);
     if ((to = cstring_new_n(NULL, length * sizeof(uint32_t))) == NULL) {
         return NULL;
     }
 
+    p = (unsigned char *) to;
+
     for (i = 0; i < length; ) {
-        uint32_t rune;
-        size_t rune_size;
+        if ((n = __ascii_run__(s + i, length - i)) != 0) {
+            __widen32__(p, s + i, n);
+            p += n * sizeof(uint32_t);
+            i += n;
+            continue;
+        }
 
-        if (!__parse_rune__(&rune, &rune_size, cs, length - i)) {
+        if (!__parse_rune__(&rune, &rune_size, s + i, length - i)) {
+            cstring_free(to);
             return NULL;
         }
 
-        to = __write32__(to, rune);
+        p = __put32__(p, rune);
 
         i += rune_size;
     }
 
+    cstring_set_length(to, p - (unsigned char *) to);
     return to;
 }
 
 
+/**
+ * Whether the n bytes at s are UTF-8, with no overlong forms, surrogates
+ * or runes past U+10FFFF.
+ **/
+bool utf8_validate(const unsigned char *s, size_t n)
+{
+    uint32_t rune;
+    size_t i, rune_size;
+
+    for (i = 0; i < n; ) {
+        i += __ascii_run__(s + i, n - i);
+
+        if (i < n) {
+            if (!__parse_rune__(&rune, &rune_size, s + i, n - i)) {
+                return false;
+            }
+            i += rune_size;
+        }
+    }
+
+    return true;
+}
+
+
+size_t utf8_rune_size(int ch)
+{
+    size_t step = __count_leading_ones__((unsigned char) ch);
+    return step == 0 ? 1 : step;
+}
+
+
 static inline
-int __count_leading_ones__(char ch)
+int __count_leading_ones__(unsigned char ch)
 {
     int i;
 
@@ -119,12 +190,12 @@ int __count_leading_ones__(char ch)
 
 
 static inline
-bool __parse_rune__(uint32_t *rune, size_t *rune_size, char *s, int n) {
-
-    int len;
-    int i;
+bool __parse_rune__(uint32_t *rune, size_t *rune_size, const unsigned char *s, size_t n)
+{
+    size_t len;
+    size_t i;
 
-    len = __count_leading_ones__(s[0]);
+    len = (size_t) __count_leading_ones__(s[0]);
 
     if (len == 0) {
         *rune = s[0];
@@ -145,51 +216,164 @@ bool __parse_rune__(uint32_t *rune, size_t *rune_size, char *s, int n) {
     switch (len) {
     case 2:
         *rune = ((s[0] & 0x1F) << 6) | (s[1] & 0x3F);
-        *rune_size = 2;
+        if (*rune < 0x80) {
+            return false;
+        }
         break;
     case 3:
         *rune = ((s[0] & 0xF) << 12) | ((s[1] & 0x3F) << 6) | (s[2] & 0x3F);
-        *rune_size = 3;
+        if (*rune < 0x800 || (*rune >= 0xD800 && *rune <= 0xDFFF)) {
+            return false;
+        }
         break;
     case 4:
-        *rune = ((s[0] & 0x7) << 18) | ((s[1] & 0x3F) << 12) | ((s[2] & 0x3F) << 6) | (s[3] & 0x3F);
-        *rune_size = 4;
+        *rune = ((uint32_t) (s[0] & 0x7) << 18) | ((s[1] & 0x3F) << 12) | ((s[2] & 0x3F) << 6) | (s[3] & 0x3F);
+        if (*rune < 0x10000 || *rune > 0x10FFFF) {
+            return false;
+        }
         break;
     default:
         return false;
     }
 
+    *rune_size = len;
     return true;
 }
 
 
-static inline 
-cstring_t __write8__(cstring_t cs, uint8_t u)
+/* the bytes at s below 0x80, a vector and then a word at a time */
+static
+size_t __ascii_run__(const unsigned char *s, size_t n)
 {
-    return cstring_concat_n(cs, &u, sizeof(uint8_t));
+    size_t i = 0;
+    uint64_t word;
+
+#if defined(ENCODING_USE_SSE2)
+    unsigned int mask;
+
+    for (; n - i >= 16; i += 16) {
+        mask = (unsigned int) _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) (s + i)));
+        if (mask != 0) {
+            break;
+        }
+    }
+#elif defined(ENCODING_USE_NEON)
+    for (; n - i >= 16; i += 16) {
+        if (vmaxvq_u8(vld1q_u8(s + i)) >= 0x80) {
+            break;
+        }
+    }
+#endif
+
+    for (; n - i >= 8; i += 8) {
+        memcpy(&word, s + i, sizeof(uint64_t));
+        if ((word & 0x8080808080808080ULL) != 0) {
+            break;
+        }
+    }
+
+    while (i < n && s[i] < 0x80) {
+        i++;
+    }
+
+    return i;
+}
+
+
+/* n ASCII bytes to as many code units of two bytes */
+static
+void __widen16__(unsigned char *to, const unsigned char *s, size_t n)
+{
+    size_t i = 0;
+
+#if defined(ENCODING_USE_SSE2)
+    __m128i zero = _mm_setzero_si128();
+    __m128i v;
+
+    for (; n - i >= 16; i += 16) {
+        v = _mm_loadu_si128((const __m128i *) (s + i));
+        _mm_storeu_si128((__m128i *) (to + 2 * i), _mm_unpacklo_epi8(v, zero));
+        _mm_storeu_si128((__m128i *) (to + 2 * i + 16), _mm_unpackhi_epi8(v, zero));
+    }
+#elif defined(ENCODING_USE_NEON)
+    uint8x16_t v;
+
+    for (; n - i >= 16; i += 16) {
+        v = vld1q_u8(s + i);
+        vst1q_u16((uint16_t *) (to + 2 * i), vmovl_u8(vget_low_u8(v)));
+        vst1q_u16((uint16_t *) (to + 2 * i + 16), vmovl_u8(vget_high_u8(v)));
+    }
+#endif
+
+    for (; i < n; i++) {
+        to[2 * i] = s[i];
+        to[2 * i + 1] = 0;
+    }
+}
+
+
+/* n ASCII bytes to as many code units of four bytes */
+static
+void __widen32__(unsigned char *to, const unsigned char *s, size_t n)
+{
+    size_t i = 0;
+
+#if defined(ENCODING_USE_SSE2)
+    __m128i zero = _mm_setzero_si128();
+    __m128i v, lo, hi;
+
+    for (; n - i >= 16; i += 16) {
+        v = _mm_loadu_si128((const __m128i *) (s + i));
+        lo = _mm_unpacklo_epi8(v, zero);
+        hi = _mm_unpackhi_epi8(v, zero);
+        _mm_storeu_si128((__m128i *) (to + 4 * i), _mm_unpacklo_epi16(lo, zero));
+        _mm_storeu_si128((__m128i *) (to + 4 * i + 16), _mm_unpackhi_epi16(lo, zero));
+        _mm_storeu_si128((__m128i *) (to + 4 * i + 32), _mm_unpacklo_epi16(hi, zero));
+        _mm_storeu_si128((__m128i *) (to + 4 * i + 48), _mm_unpackhi_epi16(hi, zero));
+    }
+#elif defined(ENCODING_USE_NEON)
+    uint16x8_t lo, hi;
+    uint8x16_t v;
+
+    for (; n - i >= 16; i += 16) {
+        v = vld1q_u8(s + i);
+        lo = vmovl_u8(vget_low_u8(v));
+        hi = vmovl_u8(vget_high_u8(v));
+        vst1q_u32((uint32_t *) (to + 4 * i), vmovl_u16(vget_low_u16(lo)));
+        vst1q_u32((uint32_t *) (to + 4 * i + 16), vmovl_u16(vget_high_u16(lo)));
+        vst1q_u32((uint32_t *) (to + 4 * i + 32), vmovl_u16(vget_low_u16(hi)));
+        vst1q_u32((uint32_t *) (to + 4 * i + 48), vmovl_u16(vget_high_u16(hi)));
+    }
+#endif
+
+    for (; i < n; i++) {
+        to[4 * i] = s[i];
+        to[4 * i + 1] = 0;
+        to[4 * i + 2] = 0;
+        to[4 * i + 3] = 0;
+    }
 }
 
 
 static inline
-cstring_t __write16__(cstring_t cs, uint16_t u)
+cstring_t __write8__(cstring_t cs, uint8_t u)
 {
-    cs = cstring_push_ch(cs, u & 0xFF);
-    cs = cstring_push_ch(cs, u >> 8);
-    return cs;
+    return cstring_concat_n(cs, &u, sizeof(uint8_t));
 }
 
 
 static inline
-cstring_t __write32__(cstring_t cs, uint32_t u)
+unsigned char* __put16__(unsigned char *to, uint16_t u)
 {
-    cs = __write16__(cs, u & 0xFFFF);
-    cs = __write16__(cs, u >> 16);
-    return cs;
+    to[0] = (unsigned char) (u & 0xFF);
+    to[1] = (unsigned char) (u >> 8);
+    return to + 2;
 }
 
 
-size_t utf8_rune_size(int ch)
+static inline
+unsigned char* __put32__(unsigned char *to, uint32_t u)
 {
-    size_t step = __count_leading_ones__(ch);
-    return step == 0 ? 1 : step;
+    to = __put16__(to, (uint16_t) (u & 0xFFFF));
+    return __put16__(to, (uint16_t) (u >> 16));
 }
@@ -21,6 +21,7 @@ cstring_t cstring_append_utf8(cstring_t cs, uint32_t rune);
 cstring_t cstring_cast_to_utf16(cstring_t cs);
 cstring_t cstring_cast_to_utf32(cstring_t cs);
 
+bool utf8_validate(const unsigned char *s, size_t n);
 size_t utf8_rune_size(int ch);
 
 
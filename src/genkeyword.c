@@ -0,0 +1,158 @@
+
+
+#include "config.h"
+#include "keyword.h"
+
+
+/**
+ * Writes the keyword and directive tables of keyword.c. For each list it
+ * searches the smallest table and a seed for which KEYWORD_HASH() places
+ * every spelling in a slot of its own.
+ **/
+
+
+typedef struct entry_s {
+    const char *spelling;
+    const char *type;
+} entry_t;
+
+
+static const entry_t __keywords__[] = {
+#define KEYWORD(s, t)       {#s, #t},
+#define DIRECTIVE(s, t)
+#include "keyword.def"
+#undef  KEYWORD
+#undef  DIRECTIVE
+};
+
+
+static const entry_t __directives__[] = {
+#define KEYWORD(s, t)
+#define DIRECTIVE(s, t)     {#s, #t},
+#include "keyword.def"
+#undef  KEYWORD
+#undef  DIRECTIVE
+};
+
+
+#define GENKEYWORD_MAX_BITS         12
+#define GENKEYWORD_TRIES            (1 << 20)
+
+
+static bool __search__(const entry_t *entries, size_t n, uint32_t *seed, int *bits)
+{
+    static unsigned char used[1 << GENKEYWORD_MAX_BITS];
+    uint32_t candidate = 0x9e3779b9u;
+    size_t i, tries;
+    int b;
+
+    for (b = 1; ((size_t) 1 << b) < n; b++) {
+        continue;
+    }
+
+    for (; b <= GENKEYWORD_MAX_BITS; b++) {
+        for (tries = 0; tries < GENKEYWORD_TRIES; tries++) {
+            /* odd multipliers from a xorshift sequence */
+            candidate ^= candidate << 13;
+            candidate ^= candidate >> 17;
+            candidate ^= candidate << 5;
+            candidate |= 1;
+
+            memset(used, 0, (size_t) 1 << b);
+
+            for (i = 0; i < n; i++) {
+                const unsigned char *s = (const unsigned char *) entries[i].spelling;
+                uint32_t h = KEYWORD_HASH(s, strlen(entries[i].spelling), candidate, b);
+                if (used[h]) {
+                    break;
+                }
+                used[h] = 1;
+            }
+
+            if (i == n) {
+                *seed = candidate;
+                *bits = b;
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+
+static bool __emit__(FILE *fp, const char *name, const char *prefix,
+                     const entry_t *entries, size_t n)
+{
+    const entry_t *slots[1 << GENKEYWORD_MAX_BITS];
+    size_t i, min = (size_t) -1, max = 0;
+    uint32_t seed;
+    int bits;
+
+    if (!__search__(entries, n, &seed, &bits)) {
+        fprintf(stderr, "genkeyword: no perfect hash for %s\n", name);
+        return false;
+    }
+
+    memset(slots, 0, sizeof(slots));
+
+    for (i = 0; i < n; i++) {
+        const unsigned char *s = (const unsigned char *) entries[i].spelling;
+        size_t length = strlen(entries[i].spelling);
+
+        slots[KEYWORD_HASH(s, length, seed, bits)] = &entries[i];
+        min = length < min ? length : min;
+        max = length > max ? length : max;
+    }
+
+    fprintf(fp, "#define %s_SEED              0x%08lxu\n", prefix, (unsigned long) seed);
+    fprintf(fp, "#define %s_BITS              %d\n", prefix, bits);
+    fprintf(fp, "#define %s_MIN_LENGTH        %lu\n", prefix, (unsigned long) min);
+    fprintf(fp, "#define %s_MAX_LENGTH        %lu\n\n\n", prefix, (unsigned long) max);
+
+    fprintf(fp, "static const keyword_t %s[%d] = {\n", name, 1 << bits);
+    for (i = 0; i < ((size_t) 1 << bits); i++) {
+        if (slots[i] == NULL) {
+            fprintf(fp, "    {NULL, 0, TOKEN_UNKNOWN},\n");
+        } else {
+            fprintf(fp, "    {\"%s\", %lu, %s},\n", slots[i]->spelling,
+                    (unsigned long) strlen(slots[i]->spelling), slots[i]->type);
+        }
+    }
+    fprintf(fp, "};\n\n\n");
+
+    return true;
+}
+
+
+int main(int argc, char *argv[])
+{
+    FILE *fp;
+    bool ok;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: genkeyword <output>\n");
+        return 1;
+    }
+
+    if ((fp = fopen(argv[1], "w")) == NULL) {
+        fprintf(stderr, "genkeyword: cannot open %s\n", argv[1]);
+        return 1;
+    }
+
+    fprintf(fp, "/* generated by genkeyword from keyword.def, do not edit */\n\n\n");
+
+    ok = __emit__(fp, "__keywords__", "KEYWORD", __keywords__,
+                  sizeof(__keywords__) / sizeof(__keywords__[0])) &&
+         __emit__(fp, "__directives__", "DIRECTIVE", __directives__,
+                  sizeof(__directives__) / sizeof(__directives__[0]));
+
+    fclose(fp);
+
+    if (!ok) {
+        remove(argv[1]);
+        return 1;
+    }
+
+    return 0;
+}
@@ -9,6 +9,9 @@
 
 uint64_t siphash(const uint8_t *in, const size_t inlen, const uint8_t *k);
 uint64_t siphash_nocase(const uint8_t *in, const size_t inlen, const uint8_t *k);
+uint64_t wyhash(const uint8_t *in, const size_t inlen, const uint8_t *k);
+uint64_t crc32c_hash(const uint8_t *in, const size_t inlen, const uint8_t *k);
+uint32_t crc32c(uint32_t crc, const void *data, size_t n);
 
 
 #endif
@@ -0,0 +1,446 @@
+
+
+#include "config.h"
+#include "pmalloc.h"
+#include "dict.h"
+#include "cspool.h"
+#include "cstring.h"
+#include "stats.h"
+#include "hideset.h"
+
+
+typedef enum hideset_op_e {
+    HIDESET_OP_NONE,
+    HIDESET_OP_ADD,
+    HIDESET_OP_UNION,
+    HIDESET_OP_INTERSECTION,
+} hideset_op_t;
+
+
+/**
+ * An operation and its result, the operands by id so that a freed hideset
+ * whose address is reused cannot hit. The slot holds a reference on the
+ * result until it is overwritten.
+ **/
+typedef struct hideset_memo_s {
+    hideset_op_t op;
+    size_t a;
+    size_t b;
+    hideset_t *result;
+} hideset_memo_t;
+
+
+/* each thread preprocesses with hidesets of its own */
+static THREAD_LOCAL dict_t *__hidesets__ = NULL;
+static THREAD_LOCAL cspool_t *__hideset_names__ = NULL;
+static THREAD_LOCAL hideset_memo_t __hideset_memo__[HIDESET_MEMO_SIZE];
+static THREAD_LOCAL size_t __hideset_next_id__ = 1;
+static THREAD_LOCAL hideset_t *__hideset_scratch__ = NULL;
+static THREAD_LOCAL size_t __hideset_scratch_capacity__ = 0;
+
+
+static bool __hideset_init__(void);
+static bool __hideset_reserve__(size_t n);
+static hideset_t* __hideset_intern__(void);
+static hideset_memo_t* __hideset_memo_slot__(hideset_op_t op, size_t a, size_t b);
+static hideset_t* __hideset_memo_put__(hideset_memo_t *slot, hideset_op_t op, size_t a, size_t b, hideset_t *result);
+static inline bool __hideset_before__(cstring_t a, cstring_t b);
+
+
+static inline
+uint64_t __hash_fn__(const void *key)
+{
+    return ((const hideset_t *) key)->hash;
+}
+
+
+static inline
+int __compare_fn__(void *privdata, const void *key1, const void *key2)
+{
+    const hideset_t *a = key1;
+    const hideset_t *b = key2;
+    DICT_NOTUSED(privdata);
+
+    return a->length == b->length &&
+           memcmp(a->names, b->names, a->length * sizeof(cstring_t)) == 0;
+}
+
+
+static inline
+void __free_fn__(void *privdata, void *key)
+{
+    DICT_NOTUSED(privdata);
+    pfree(key);
+}
+
+
+dict_type_t __hideset_dict_type__ = {
+    __hash_fn__,
+    NULL,
+    NULL,
+    __compare_fn__,
+    __free_fn__,
+    NULL
+};
+
+
+hideset_t* hideset_ref(hideset_t *hs)
+{
+    if (hs != NULL) {
+        hs->refs++;
+    }
+
+    return hs;
+}
+
+
+void hideset_release(hideset_t *hs)
+{
+    if (hs != NULL && --hs->refs == 0) {
+        dict_delete(__hidesets__, hs);
+    }
+}
+
+
+hideset_t* hideset_add(hideset_t *hs, cstring_t name)
+{
+    hideset_memo_t *slot;
+    cstring_t interned;
+    size_t i, n, id;
+
+    if (!__hideset_init__()) {
+        return NULL;
+    }
+
+    interned = cspool_push(__hideset_names__, name);
+    if (!interned) {
+        return NULL;
+    }
+
+    id = hs ? hs->id : 0;
+
+    slot = __hideset_memo_slot__(HIDESET_OP_ADD, id, (size_t) interned);
+    if (slot->op == HIDESET_OP_ADD && slot->a == id && slot->b == (size_t) interned) {
+        stats_count(STATS_HIDESET_MEMO_HITS);
+        return hideset_ref(slot->result);
+    }
+
+    stats_count(STATS_HIDESET_MEMO_MISSES);
+
+    n = hs ? hs->length : 0;
+    if (!__hideset_reserve__(n + 1)) {
+        return NULL;
+    }
+
+    for (i = 0; i < n && __hideset_before__(hs->names[i], interned); i++) {
+        __hideset_scratch__->names[i] = hs->names[i];
+    }
+
+    if (i < n && hs->names[i] == interned) {
+        return __hideset_memo_put__(slot, HIDESET_OP_ADD, id, (size_t) interned,
+                                    hideset_ref(hs));
+    }
+
+    __hideset_scratch__->names[i] = interned;
+
+    for (; i < n; i++) {
+        __hideset_scratch__->names[i + 1] = hs->names[i];
+    }
+
+    __hideset_scratch__->length = n + 1;
+
+    return __hideset_memo_put__(slot, HIDESET_OP_ADD, id, (size_t) interned,
+                                __hideset_intern__());
+}
+
+
+hideset_t* hideset_union(hideset_t *a, hideset_t *b)
+{
+    hideset_memo_t *slot;
+    hideset_t *t;
+    size_t i, j, n;
+
+    if (a == NULL || a == b) {
+        return hideset_ref(b);
+    }
+
+    if (b == NULL) {
+        return hideset_ref(a);
+    }
+
+    if (a->id > b->id) {
+        t = a, a = b, b = t;
+    }
+
+    stats_count(STATS_HIDESET_UNIONS);
+
+    slot = __hideset_memo_slot__(HIDESET_OP_UNION, a->id, b->id);
+    if (slot->op == HIDESET_OP_UNION && slot->a == a->id && slot->b == b->id) {
+        stats_count(STATS_HIDESET_MEMO_HITS);
+        return hideset_ref(slot->result);
+    }
+
+    stats_count(STATS_HIDESET_MEMO_MISSES);
+
+    if (!__hideset_reserve__(a->length + b->length)) {
+        return NULL;
+    }
+
+    for (i = 0, j = 0, n = 0; i < a->length || j < b->length; n++) {
+        if (j == b->length || (i < a->length && __hideset_before__(a->names[i], b->names[j]))) {
+            __hideset_scratch__->names[n] = a->names[i++];
+        } else if (i == a->length || a->names[i] != b->names[j]) {
+            __hideset_scratch__->names[n] = b->names[j++];
+        } else {
+            __hideset_scratch__->names[n] = a->names[i++];
+            j++;
+        }
+    }
+
+    __hideset_scratch__->length = n;
+
+    return __hideset_memo_put__(slot, HIDESET_OP_UNION, a->id, b->id, __hideset_intern__());
+}
+
+
+hideset_t* hideset_intersection(hideset_t *a, hideset_t *b)
+{
+    hideset_memo_t *slot;
+    hideset_t *t;
+    size_t i, j, n;
+
+    if (a == NULL || b == NULL) {
+        return NULL;
+    }
+
+    if (a == b) {
+        return hideset_ref(a);
+    }
+
+    if (a->id > b->id) {
+        t = a, a = b, b = t;
+    }
+
+    slot = __hideset_memo_slot__(HIDESET_OP_INTERSECTION, a->id, b->id);
+    if (slot->op == HIDESET_OP_INTERSECTION && slot->a == a->id && slot->b == b->id) {
+        stats_count(STATS_HIDESET_MEMO_HITS);
+        return hideset_ref(slot->result);
+    }
+
+    stats_count(STATS_HIDESET_MEMO_MISSES);
+
+    if (!__hideset_reserve__(a->length < b->length ? a->length : b->length)) {
+        return NULL;
+    }
+
+    for (i = 0, j = 0, n = 0; i < a->length && j < b->length; ) {
+        if (a->names[i] == b->names[j]) {
+            __hideset_scratch__->names[n++] = a->names[i];
+            i++, j++;
+        } else if (__hideset_before__(a->names[i], b->names[j])) {
+            i++;
+        } else {
+            j++;
+        }
+    }
+
+    __hideset_scratch__->length = n;
+
+    return __hideset_memo_put__(slot, HIDESET_OP_INTERSECTION, a->id, b->id,
+                                __hideset_intern__());
+}
+
+
+bool hideset_has(hideset_t *hs, cstring_t name)
+{
+    dict_entry_t *entry;
+    cstring_t interned;
+    size_t lo, hi, mid;
+
+    if (hs == NULL) {
+        return false;
+    }
+
+    entry = dict_find(__hideset_names__->d, name);
+    if (!entry) {
+        return false;
+    }
+
+    interned = dict_get_key(entry);
+
+    for (lo = 0, hi = hs->length; lo < hi; ) {
+        mid = lo + (hi - lo) / 2;
+
+        if (hs->names[mid] == interned) {
+            return true;
+        }
+
+        if (__hideset_before__(hs->names[mid], interned)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return false;
+}
+
+
+/**
+ * The number of distinct hidesets alive, those held by the memo included.
+ **/
+size_t hideset_count(void)
+{
+    return __hidesets__ ? dict_length(__hidesets__) : 0;
+}
+
+
+/**
+ * Frees the tables and every hideset left, which no token may still hold.
+ **/
+void hideset_cleanup(void)
+{
+    size_t i;
+
+    if (__hidesets__ == NULL) {
+        return;
+    }
+
+    for (i = 0; i < HIDESET_MEMO_SIZE; i++) {
+        __hideset_memo__[i].op = HIDESET_OP_NONE;
+        __hideset_memo__[i].result = NULL;
+    }
+
+    dict_destroy(__hidesets__);
+    cspool_destroy(__hideset_names__);
+    pfree(__hideset_scratch__);
+
+    __hidesets__ = NULL;
+    __hideset_names__ = NULL;
+    __hideset_scratch__ = NULL;
+    __hideset_scratch_capacity__ = 0;
+}
+
+
+static
+bool __hideset_init__(void)
+{
+    if (__hidesets__ != NULL) {
+        return true;
+    }
+
+    __hidesets__ = dict_create_swiss(&__hideset_dict_type__, NULL);
+    if (!__hidesets__) {
+        return false;
+    }
+
+    __hideset_names__ = cspool_create_swiss();
+    if (!__hideset_names__) {
+        dict_destroy(__hidesets__);
+        __hidesets__ = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+
+static
+bool __hideset_reserve__(size_t n)
+{
+    hideset_t *scratch;
+    size_t capacity;
+
+    if (n <= __hideset_scratch_capacity__ && __hideset_scratch__ != NULL) {
+        return true;
+    }
+
+    for (capacity = 16; capacity < n; capacity *= 2) {
+        continue;
+    }
+
+    scratch = prealloc(__hideset_scratch__, sizeof(hideset_t) + capacity * sizeof(cstring_t));
+    if (!scratch) {
+        return false;
+    }
+
+    __hideset_scratch__ = scratch;
+    __hideset_scratch_capacity__ = capacity;
+    return true;
+}
+
+
+/**
+ * The hideset with the names the scratch holds, a new reference.
+ **/
+static
+hideset_t* __hideset_intern__(void)
+{
+    hideset_t *scratch = __hideset_scratch__;
+    hideset_t *hs;
+    dict_entry_t *entry;
+    size_t size;
+
+    if (scratch->length == 0) {
+        return NULL;
+    }
+
+    scratch->hash = dict_gen_hash_function(scratch->names, (int) (scratch->length * sizeof(cstring_t)));
+
+    entry = dict_find(__hidesets__, scratch);
+    if (entry) {
+        return hideset_ref(dict_get_key(entry));
+    }
+
+    size = sizeof(hideset_t) + (scratch->length - 1) * sizeof(cstring_t);
+
+    hs = pmalloc(size);
+    if (!hs) {
+        return NULL;
+    }
+
+    memcpy(hs, scratch, size);
+    hs->refs = 1;
+    hs->id = __hideset_next_id__++;
+
+    if (!dict_add(__hidesets__, hs, NULL)) {
+        pfree(hs);
+        return NULL;
+    }
+
+    return hs;
+}
+
+
+static inline
+hideset_memo_t* __hideset_memo_slot__(hideset_op_t op, size_t a, size_t b)
+{
+    size_t h = a * 2654435761u ^ (b >> 3) * 40503u ^ (size_t) op;
+    return &__hideset_memo__[h & (HIDESET_MEMO_SIZE - 1)];
+}
+
+
+/**
+ * Remembers result in slot and hands it back.
+ **/
+static
+hideset_t* __hideset_memo_put__(hideset_memo_t *slot, hideset_op_t op, size_t a, size_t b,
+                                hideset_t *result)
+{
+    hideset_t *old = slot->op != HIDESET_OP_NONE ? slot->result : NULL;
+
+    slot->op = op;
+    slot->a = a;
+    slot->b = b;
+    slot->result = hideset_ref(result);
+
+    hideset_release(old);
+    return result;
+}
+
+
+static inline
+bool __hideset_before__(cstring_t a, cstring_t b)
+{
+    return (uintptr_t) a < (uintptr_t) b;
+}
@@ -0,0 +1,45 @@
+
+
+#ifndef __HIDESET__H__
+#define __HIDESET__H__
+
+
+#include "config.h"
+#include "cstring.h"
+
+
+#ifndef HIDESET_MEMO_SIZE
+#define HIDESET_MEMO_SIZE       (1024)      /* a power of two */
+#endif
+
+
+/**
+ * The macro names a token came out of, interned: two hidesets with the
+ * same names are the same pointer, NULL is the empty one. They are never
+ * modified, every operation hands back a reference the caller releases,
+ * and a hideset is freed with its last reference.
+ *
+ * Names are interned too and kept sorted by address, so membership, union
+ * and intersection only compare pointers. The tables are not locked, a
+ * hideset must stay on the thread that made it.
+ **/
+typedef struct hideset_s {
+    size_t refs;
+    size_t id;                  /* never reused, keys the memo */
+    uint64_t hash;
+    size_t length;
+    cstring_t names[1];
+} hideset_t;
+
+
+hideset_t* hideset_ref(hideset_t *hs);
+void hideset_release(hideset_t *hs);
+hideset_t* hideset_add(hideset_t *hs, cstring_t name);
+hideset_t* hideset_union(hideset_t *a, hideset_t *b);
+hideset_t* hideset_intersection(hideset_t *a, hideset_t *b);
+bool hideset_has(hideset_t *hs, cstring_t name);
+size_t hideset_count(void);
+void hideset_cleanup(void);
+
+
+#endif
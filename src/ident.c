@@ -0,0 +1,139 @@
+
+
+#include "config.h"
+#include "pmalloc.h"
+#include "dict.h"
+#include "cstring.h"
+#include "token.h"
+#include "keyword.h"
+#include "ident.h"
+
+
+static inline
+uint64_t __hash_fn__(const void *key)
+{
+    return dict_gen_hash_function((unsigned char*)key, cstring_length((cstring_t)key));
+}
+
+
+static inline
+int __compare_fn__(void *privdata, const void *key1, const void *key2)
+{
+    size_t l1, l2;
+    DICT_NOTUSED(privdata);
+
+    l1 = cstring_length((cstring_t)key1);
+    l2 = cstring_length((cstring_t)key2);
+
+    return l1 == l2 && memcmp(key1, key2, l1) == 0;
+}
+
+
+static inline
+void __free_fn__(void *privdata, void *val)
+{
+    ident_t *ident = (ident_t *)val;
+    DICT_NOTUSED(privdata);
+
+    cstring_free(ident->name);
+    pfree(ident);
+}
+
+
+/* the key is the name of the record, freed along with it */
+dict_type_t __identtab_dict_type__ = {
+    __hash_fn__,
+    NULL,
+    NULL,
+    __compare_fn__,
+    NULL,
+    __free_fn__
+};
+
+
+identtab_t* identtab_create(void)
+{
+    identtab_t *tab;
+
+    tab = (identtab_t *)pmalloc(sizeof(identtab_t));
+    if (!tab) {
+        return NULL;
+    }
+
+    tab->d = dict_create_swiss(&__identtab_dict_type__, NULL);
+    tab->key = cstring_new_n(NULL, 64);
+
+    return tab;
+}
+
+
+void identtab_destroy(identtab_t *tab)
+{
+    dict_destroy(tab->d);
+    cstring_free(tab->key);
+    pfree(tab);
+}
+
+
+/**
+ * The record of the spelling s, made on first sight. The macro binding
+ * is for the caller to set.
+ **/
+ident_t* identtab_lookup(identtab_t *tab, const unsigned char *s, size_t n)
+{
+    dict_entry_t *entry;
+    ident_t *ident;
+
+    cstring_clear(tab->key);
+    tab->key = cstring_concat_n(tab->key, s, n);
+
+    entry = dict_find(tab->d, tab->key);
+    if (entry) {
+        return dict_get_val(entry);
+    }
+
+    ident = (ident_t *)pmalloc(sizeof(ident_t));
+    if (!ident) {
+        return NULL;
+    }
+
+    ident->name = cstring_new_n(s, n);
+    ident->macro = NULL;
+    ident->was_macro = false;
+    ident->version = 0;
+    ident->consulted = 0;
+    ident->keyword = keyword_lookup(s, n);
+    ident->directive = directive_lookup(s, n);
+
+    if (!dict_add(tab->d, ident->name, ident)) {
+        cstring_free(ident->name);
+        pfree(ident);
+        return NULL;
+    }
+
+    return ident;
+}
+
+
+ident_t* identtab_lookup_cs(identtab_t *tab, cstring_t cs)
+{
+    return identtab_lookup(tab, (const unsigned char *)cs, cstring_length(cs));
+}
+
+
+void identtab_scan(identtab_t *tab, ident_scan_pt fn, void *ud)
+{
+    dict_iterator_t *iter;
+    dict_entry_t *entry;
+
+    iter = dict_get_iterator(tab->d);
+    if (!iter) {
+        return;
+    }
+
+    while ((entry = dict_next(iter)) != NULL) {
+        fn(ud, dict_get_val(entry));
+    }
+
+    dict_release_iterator(iter);
+}
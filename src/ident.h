@@ -0,0 +1,55 @@
+
+
+#ifndef __IDENT__H__
+#define __IDENT__H__
+
+
+#include "config.h"
+#include "cstring.h"
+#include "token.h"
+
+
+typedef struct dict_s       dict_t;
+typedef struct macro_s      macro_t;
+
+
+/**
+ * What is known about an identifier, one record per spelling, so that
+ * the preprocessor answers "is it a macro" with a load instead of a hash
+ * lookup. macro is the current binding, was_macro stays set after an
+ * #undef, version counts the #define and #undef of the name. keyword and
+ * directive are those the spelling names, if any. consulted is the mark
+ * of the preprocessor when it last noted the name down as looked up.
+ **/
+typedef struct ident_s {
+    cstring_t name;
+    macro_t *macro;
+    bool was_macro;
+    size_t version;
+    size_t consulted;
+    token_type_t keyword;
+    token_type_t directive;
+} ident_t;
+
+
+/**
+ * The records by spelling. Like cspool_t, each spelling is held once, and
+ * only the thread that owns the table may look up in it.
+ **/
+typedef struct identtab_s {
+    dict_t *d;
+    cstring_t key;
+} identtab_t;
+
+
+typedef void (*ident_scan_pt) (void *ud, ident_t *ident);
+
+
+identtab_t* identtab_create(void);
+void identtab_destroy(identtab_t *tab);
+ident_t* identtab_lookup(identtab_t *tab, const unsigned char *s, size_t n);
+ident_t* identtab_lookup_cs(identtab_t *tab, cstring_t cs);
+void identtab_scan(identtab_t *tab, ident_scan_pt fn, void *ud);
+
+
+#endif
@@ -0,0 +1,522 @@
+
+
+#include "config.h"
+#include "pmalloc.h"
+#include "array.h"
+#include "dict.h"
+#include "set.h"
+#include "cstring.h"
+#include "stats.h"
+#include "incpath.h"
+
+
+#if defined(UNIX)
+#   include <dirent.h>
+#endif
+
+
+static incpath_file_t* __incpath_probe__(incpath_t *inc, cstring_t path);
+static bool __incpath_may_have__(incpath_t *inc, incpath_dir_t *dir, cstring_t name);
+static void __incpath_list__(incpath_dir_t *dir);
+static bool __incpath_add__(incpath_t *inc, const char *path, bool system);
+static bool __incpath_is_system__(incpath_t *inc, cstring_t path);
+static incpath_file_t* __incpath_resolve__(incpath_t *inc, cstring_t name, cstring_t from, size_t start);
+static bool __incpath_changed__(incpath_t *inc);
+static int64_t __incpath_modify_time__(const struct stat *st);
+static void __incpath_identity__(char *buf, const struct stat *st);
+
+
+static inline
+uint64_t __hash_fn__(const void *key)
+{
+    return dict_gen_hash_function((unsigned char*)key, cstring_length((cstring_t)key));
+}
+
+
+static inline
+int __compare_fn__(void *privdata, const void *key1, const void *key2)
+{
+    size_t l1, l2;
+    DICT_NOTUSED(privdata);
+
+    l1 = cstring_length((cstring_t)key1);
+    l2 = cstring_length((cstring_t)key2);
+
+    return l1 == l2 && memcmp(key1, key2, l1) == 0;
+}
+
+
+static inline
+void __key_free_fn__(void *privdata, void *key)
+{
+    DICT_NOTUSED(privdata);
+    cstring_free((cstring_t)key);
+}
+
+
+static inline
+void __file_free_fn__(void *privdata, void *val)
+{
+    incpath_file_t *file = (incpath_file_t *)val;
+    DICT_NOTUSED(privdata);
+
+    if (file != NULL) {
+        cstring_free(file->path);
+        cstring_free(file->identity);
+        pfree(file);
+    }
+}
+
+
+/* the files are those of the probes, a lookup only points at one */
+dict_type_t __incpath_lookup_dict_type__ = {
+    __hash_fn__,
+    NULL,
+    NULL,
+    __compare_fn__,
+    __key_free_fn__,
+    NULL
+};
+
+
+dict_type_t __incpath_probe_dict_type__ = {
+    __hash_fn__,
+    NULL,
+    NULL,
+    __compare_fn__,
+    __key_free_fn__,
+    __file_free_fn__
+};
+
+
+incpath_t* incpath_create(void)
+{
+    incpath_t *inc;
+
+    inc = (incpath_t *)pmalloc(sizeof(incpath_t));
+    if (!inc) {
+        return NULL;
+    }
+
+    inc->dirs = array_create_n(sizeof(incpath_dir_t), 8);
+    inc->lookups = dict_create(&__incpath_lookup_dict_type__, NULL);
+    inc->probes = dict_create(&__incpath_probe_dict_type__, NULL);
+    inc->key = cstring_new_n(NULL, 64);
+    inc->component = cstring_new_n(NULL, 64);
+    inc->std = false;
+    mutex_init(&inc->mutex);
+
+    return inc;
+}
+
+
+void incpath_destroy(incpath_t *inc)
+{
+    incpath_dir_t *dirs;
+    size_t i;
+
+    array_foreach(inc->dirs, dirs, i) {
+        cstring_free(dirs[i].path);
+        if (dirs[i].entries != NULL) {
+            set_destroy(dirs[i].entries);
+        }
+    }
+
+    array_destroy(inc->dirs);
+    dict_destroy(inc->lookups);
+    dict_destroy(inc->probes);
+    cstring_free(inc->key);
+    cstring_free(inc->component);
+    mutex_destroy(&inc->mutex);
+    pfree(inc);
+}
+
+
+bool incpath_add(incpath_t *inc, const char *path)
+{
+    return __incpath_add__(inc, path, false);
+}
+
+
+/**
+ * A directory of system headers, which -MM leaves out of the depfile.
+ **/
+bool incpath_add_system(incpath_t *inc, const char *path)
+{
+    return __incpath_add__(inc, path, true);
+}
+
+
+/**
+ * The system directories searched when nothing else is said, added once.
+ **/
+void incpath_add_std(incpath_t *inc)
+{
+    const char *std_paths[] = {
+        "/usr/local/lib/occ/include",
+        "/usr/local/include",
+        "/usr/include",
+        "/usr/include/linux",
+        "/usr/include/x86_64-linux-gnu",
+    };
+
+    size_t npaths = sizeof(std_paths) / sizeof(const char*);
+    size_t i;
+
+    if (inc->std) {
+        return;
+    }
+
+    inc->std = true;
+
+    for (i = 0; i < npaths; i++) {
+        __incpath_add__(inc, std_paths[i], true);
+    }
+}
+
+
+/**
+ * Appends a search directory. What was looked up so far is forgotten, a
+ * miss may not be one any more.
+ **/
+static
+bool __incpath_add__(incpath_t *inc, const char *path, bool system)
+{
+    incpath_dir_t *dir;
+
+    mutex_lock(&inc->mutex);
+
+    dir = array_push_back(inc->dirs);
+    if (dir != NULL) {
+        dir->path = cstring_new(path);
+        dir->entries = NULL;
+        dir->modify_time = 0;
+        dir->listed = false;
+        dir->system = system;
+
+        dict_empty(inc->lookups, NULL);
+    }
+
+    mutex_unlock(&inc->mutex);
+    return dir != NULL;
+}
+
+
+size_t incpath_count(incpath_t *inc)
+{
+    size_t n;
+
+    mutex_lock(&inc->mutex);
+    n = array_length(inc->dirs);
+    mutex_unlock(&inc->mutex);
+
+    return n;
+}
+
+
+/**
+ * The file #include finds for name: an absolute name as it is, else
+ * first in from, the directory of the including file with its slash or
+ * "" for the current one, for the "name" form, NULL for <name>, then in
+ * the search directories from start on. NULL if there is none.
+ **/
+incpath_file_t* incpath_resolve(incpath_t *inc, cstring_t name, cstring_t from, size_t start)
+{
+    incpath_file_t *file;
+
+    mutex_lock(&inc->mutex);
+    file = __incpath_resolve__(inc, name, from, start);
+    mutex_unlock(&inc->mutex);
+
+    return file;
+}
+
+
+/**
+ * Forgets all that was looked up, probed and listed if any of it is not
+ * as it was: a search directory listed whose time changed, a path that
+ * is now a file or is not, or is another one. True if it did.
+ **/
+bool incpath_refresh(incpath_t *inc)
+{
+    incpath_dir_t *dirs;
+    size_t i;
+    bool changed;
+
+    mutex_lock(&inc->mutex);
+
+    changed = __incpath_changed__(inc);
+    if (changed) {
+        dict_empty(inc->lookups, NULL);
+        dict_empty(inc->probes, NULL);
+
+        array_foreach(inc->dirs, dirs, i) {
+            if (dirs[i].entries != NULL) {
+                set_destroy(dirs[i].entries);
+                dirs[i].entries = NULL;
+            }
+            dirs[i].listed = false;
+        }
+    }
+
+    mutex_unlock(&inc->mutex);
+    return changed;
+}
+
+
+static
+incpath_file_t* __incpath_resolve__(incpath_t *inc, cstring_t name, cstring_t from, size_t start)
+{
+    incpath_dir_t *dirs;
+    incpath_file_t *file = NULL;
+    dict_entry_t *entry;
+    cstring_t path;
+    size_t i, n;
+
+    /* start and a NUL, from and a NUL unless it is <name>, a NUL and the name */
+    cstring_clear(inc->key);
+    inc->key = cstring_concat_pf(inc->key, "%lu", (unsigned long) start);
+    inc->key = cstring_concat_ch(inc->key, '\0');
+    if (from != NULL) {
+        inc->key = cstring_concat_n(inc->key, from, cstring_length(from));
+        inc->key = cstring_concat_ch(inc->key, '\0');
+    }
+    inc->key = cstring_concat_ch(inc->key, '\0');
+    inc->key = cstring_concat_n(inc->key, name, cstring_length(name));
+
+    entry = dict_find(inc->lookups, inc->key);
+    if (entry) {
+        stats_count(STATS_INCLUDE_HITS);
+        return dict_get_val(entry);
+    }
+
+    stats_count(STATS_INCLUDE_MISSES);
+
+    path = cstring_new_n(NULL, 128);
+
+    if (name[0] == '/') {
+        path = cstring_concat_n(path, name, cstring_length(name));
+        file = __incpath_probe__(inc, path);
+        goto done;
+    }
+
+    if (from != NULL) {
+        path = cstring_concat_n(path, from, cstring_length(from));
+        path = cstring_concat_n(path, name, cstring_length(name));
+
+        file = __incpath_probe__(inc, path);
+        if (file != NULL) {
+            goto done;
+        }
+    }
+
+    dirs = array_prototype(inc->dirs, incpath_dir_t);
+
+    for (i = start, n = array_length(inc->dirs); i < n; i++) {
+        if (!__incpath_may_have__(inc, &dirs[i], name)) {
+            continue;
+        }
+
+        cstring_clear(path);
+        path = cstring_concat_n(path, dirs[i].path, cstring_length(dirs[i].path));
+        path = cstring_concat_ch(path, '/');
+        path = cstring_concat_n(path, name, cstring_length(name));
+
+        file = __incpath_probe__(inc, path);
+        if (file != NULL) {
+            break;
+        }
+    }
+
+done:
+    cstring_free(path);
+    dict_add(inc->lookups, cstring_dup(inc->key), file);
+    return file;
+}
+
+
+/**
+ * What the file system says about path, asked once.
+ **/
+static
+incpath_file_t* __incpath_probe__(incpath_t *inc, cstring_t path)
+{
+    incpath_file_t *file = NULL;
+    dict_entry_t *entry;
+    struct stat st;
+    char buf[64];
+
+    entry = dict_find(inc->probes, path);
+    if (entry) {
+        return dict_get_val(entry);
+    }
+
+    if (stat((const char *) path, &st) == 0 && S_ISREG(st.st_mode)) {
+        file = (incpath_file_t *)pmalloc(sizeof(incpath_file_t));
+        if (!file) {
+            return NULL;
+        }
+
+        __incpath_identity__(buf, &st);
+
+        file->path = cstring_dup(path);
+        file->identity = cstring_new(buf);
+        file->system = __incpath_is_system__(inc, path);
+    }
+
+    dict_add(inc->probes, cstring_dup(path), file);
+    return file;
+}
+
+
+/**
+ * Whether the directory can hold name, going by the first component of
+ * the name against its listing. Without a listing any name may be there.
+ **/
+static
+bool __incpath_may_have__(incpath_t *inc, incpath_dir_t *dir, cstring_t name)
+{
+    const char *slash;
+    size_t n;
+
+    if (!dir->listed) {
+        __incpath_list__(dir);
+    }
+
+    if (dir->entries == NULL) {
+        return true;
+    }
+
+    slash = strchr((const char *) name, '/');
+    n = slash != NULL ? (size_t) (slash - (const char *) name) : cstring_length(name);
+
+    cstring_clear(inc->component);
+    inc->component = cstring_concat_n(inc->component, name, n);
+
+    return set_has(dir->entries, inc->component);
+}
+
+
+/**
+ * Whether path lies under one of the system directories known when it
+ * was first probed, so a header next to a system one is one as well.
+ **/
+static
+bool __incpath_is_system__(incpath_t *inc, cstring_t path)
+{
+    incpath_dir_t *dirs;
+    size_t i, n;
+
+    array_foreach(inc->dirs, dirs, i) {
+        n = cstring_length(dirs[i].path);
+
+        if (dirs[i].system && cstring_length(path) > n &&
+            memcmp(path, dirs[i].path, n) == 0 && path[n] == '/') {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+static
+void __incpath_list__(incpath_dir_t *dir)
+{
+#if defined(UNIX)
+    struct dirent *ent;
+    struct stat st;
+    cstring_t cs;
+    DIR *d;
+    size_t n = 0;
+
+    dir->listed = true;
+    dir->entries = set_create();
+    dir->modify_time = stat((const char *) dir->path, &st) == 0 ? __incpath_modify_time__(&st) : 0;
+
+    d = opendir((const char *) dir->path);
+    if (d == NULL) {
+        /* no directory, no files */
+        return;
+    }
+
+    cs = cstring_new_n(NULL, 64);
+
+    while ((ent = readdir(d)) != NULL) {
+        if (++n > INCPATH_LISTING_MAX) {
+            set_destroy(dir->entries);
+            dir->entries = NULL;
+            break;
+        }
+
+        cstring_clear(cs);
+        cs = cstring_concat_n(cs, ent->d_name, strlen(ent->d_name));
+        set_add(dir->entries, cs);
+    }
+
+    cstring_free(cs);
+    closedir(d);
+#else
+    dir->listed = true;
+    dir->entries = NULL;
+#endif
+}
+
+
+static
+bool __incpath_changed__(incpath_t *inc)
+{
+    incpath_dir_t *dirs;
+    incpath_file_t *file;
+    dict_iterator_t *iter;
+    dict_entry_t *entry;
+    struct stat st;
+    char buf[64];
+    size_t i;
+    bool changed = false;
+
+    array_foreach(inc->dirs, dirs, i) {
+        if (dirs[i].listed && dirs[i].modify_time !=
+            (stat((const char *) dirs[i].path, &st) == 0 ? __incpath_modify_time__(&st) : 0)) {
+            return true;
+        }
+    }
+
+    iter = dict_get_iterator(inc->probes);
+
+    while (!changed && (entry = dict_next(iter)) != NULL) {
+        file = (incpath_file_t *) dict_get_val(entry);
+
+        if (stat((const char *) dict_get_key(entry), &st) != 0 || !S_ISREG(st.st_mode)) {
+            changed = file != NULL;
+        } else if (file == NULL) {
+            changed = true;
+        } else {
+            __incpath_identity__(buf, &st);
+            changed = strcmp(buf, (const char *) file->identity) != 0;
+        }
+    }
+
+    dict_release_iterator(iter);
+    return changed;
+}
+
+
+/* to the nanosecond where there is one, a second is long between edits */
+static
+int64_t __incpath_modify_time__(const struct stat *st)
+{
+#if defined(__linux__)
+    return (int64_t) st->st_mtim.tv_sec * 1000000000 + (int64_t) st->st_mtim.tv_nsec;
+#else
+    return (int64_t) st->st_mtime;
+#endif
+}
+
+
+/* the device and inode, which two paths to the same file share */
+static
+void __incpath_identity__(char *buf, const struct stat *st)
+{
+    sprintf(buf, "%llx:%llx", (unsigned long long) st->st_dev, (unsigned long long) st->st_ino);
+}
@@ -0,0 +1,80 @@
+
+
+#ifndef __INCPATH__H__
+#define __INCPATH__H__
+
+
+#include "config.h"
+#include "cstring.h"
+#include "thread.h"
+
+
+typedef struct array_s      array_t;
+typedef struct dict_s       dict_t;
+typedef struct set_s        set_t;
+
+
+/* a directory with more entries than this is probed file by file */
+#ifndef INCPATH_LISTING_MAX
+#define INCPATH_LISTING_MAX     8192
+#endif
+
+
+/**
+ * A file an #include resolved to: the path it was opened by and the
+ * identity of the file, its device and inode, which two paths to the
+ * same file share. system if the path lies under a system directory.
+ **/
+typedef struct incpath_file_s {
+    cstring_t path;
+    cstring_t identity;
+    bool system;
+} incpath_file_t;
+
+
+/**
+ * A search directory. Its listing is taken the first time it is asked
+ * for a file, so that a name it lacks is answered from memory. entries
+ * stays NULL for a directory too big to list. modify_time is of when it
+ * was listed, 0 if it was not there.
+ **/
+typedef struct incpath_dir_s {
+    cstring_t path;
+    set_t *entries;
+    int64_t modify_time;
+    bool listed;
+    bool system;
+} incpath_dir_t;
+
+
+/**
+ * The include search path and what it answered before. Lookups map the
+ * spelling, the including directory and the first search path index to
+ * the file found, probes map a path to its file, misses included as
+ * NULL, so the file system is asked at most once about either. The
+ * files and directories are taken to stay as they are for the run, one
+ * that outlives it asks again after incpath_refresh() found them not to.
+ * The preprocessors of several threads may share it, mutex guards it all.
+ **/
+typedef struct incpath_s {
+    array_t *dirs;
+    dict_t *lookups;
+    dict_t *probes;
+    cstring_t key;
+    cstring_t component;
+    bool std;
+    mutex_t mutex;
+} incpath_t;
+
+
+incpath_t* incpath_create(void);
+void incpath_destroy(incpath_t *inc);
+bool incpath_add(incpath_t *inc, const char *dir);
+bool incpath_add_system(incpath_t *inc, const char *dir);
+void incpath_add_std(incpath_t *inc);
+size_t incpath_count(incpath_t *inc);
+incpath_file_t* incpath_resolve(incpath_t *inc, cstring_t name, cstring_t from, size_t start);
+bool incpath_refresh(incpath_t *inc);
+
+
+#endif
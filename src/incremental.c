@@ -0,0 +1,975 @@
+
+
+#include "config.h"
+#include "pmalloc.h"
+#include "array.h"
+#include "dict.h"
+#include "linemap.h"
+#include "srcloc.h"
+#include "ident.h"
+#include "token.h"
+#include "option.h"
+#include "diagnostor.h"
+#include "reader.h"
+#include "lexer.h"
+#include "incpath.h"
+#include "preprocessor.h"
+#include "incremental.h"
+
+
+/**
+ * A text kept for the locations of the tokens made from it, placed at
+ * loc, and the edit that made the next one of it: [start, end) replaced,
+ * what follows moved by delta.
+ **/
+typedef struct incremental_text_s {
+    cstring_t text;
+    linemap_t *lines;
+    srcloc_t loc;
+    size_t start;
+    size_t end;
+    size_t delta;
+} incremental_text_t;
+
+
+/**
+ * What an edit left of the run before it, from the checkpoint gone back
+ * to on: the later checkpoints, the journal and the names looked up from
+ * there, and the tokens out, to be moved over for the stretches reused.
+ * The old templates from token on are those of the new text from resync
+ * on, their offsets moved by delta. bindings has what the names bound
+ * otherwise since, the journal of either run taken in so far, were bound
+ * to in the old run at the old checkpoint next; expansions the ranges of
+ * expansions made again at the new text, by their base.
+ **/
+typedef struct incremental_old_s {
+    array_t *checkpoints;
+    array_t *journal;
+    array_t *consulted;
+    array_t *output;
+    size_t journal_base;
+    size_t consulted_base;
+    size_t output_base;
+    size_t token;
+    size_t resync;
+    size_t delta;
+    size_t next;
+    size_t absorbed;
+    size_t seen;
+    dict_t *bindings;
+    dict_t *expansions;
+} incremental_old_t;
+
+
+static void __incremental_enter__(incremental_t *inc, option_t **saved_option,
+    diagnostor_t **saved_diagnostor);
+static void __incremental_reset__(incremental_t *inc, const char *text, size_t length);
+static void __incremental_edit__(incremental_t *inc, size_t start, size_t end,
+    const char *text, size_t length, bool reuse);
+static void __incremental_start__(incremental_t *inc);
+static void __incremental_clear__(incremental_t *inc);
+static void __incremental_full__(incremental_t *inc);
+static void __incremental_run__(incremental_t *inc, incremental_old_t *old);
+static bool __incremental_checkpoint__(incremental_t *inc);
+static void __incremental_reuse__(incremental_t *inc, incremental_old_t *old);
+static void __incremental_absorb__(incremental_old_t *old, preprocessor_t *pp, size_t journal);
+static bool __incremental_region__(incremental_t *inc, incremental_old_t *old, size_t m);
+static srcloc_t __incremental_rebase__(incremental_t *inc, incremental_old_t *old, srcloc_t loc);
+static bool __incremental_same__(incremental_t *inc, incremental_old_t *old, macro_t *a, macro_t *b);
+static bool __incremental_same_tokens__(incremental_t *inc, incremental_old_t *old,
+                                        token_t **a, token_t **b, size_t n, bool located);
+static size_t __incremental_line_end__(const unsigned char *text, size_t length, size_t offset);
+static size_t __incremental_line_start__(array_t *templates, const unsigned char *text,
+                                         size_t length, size_t offset);
+
+
+static inline
+uint64_t __hash_fn__(const void *key)
+{
+    return dict_gen_hash_function((unsigned char*)&key, sizeof(key));
+}
+
+
+static inline
+int __compare_fn__(void *privdata, const void *key1, const void *key2)
+{
+    DICT_NOTUSED(privdata);
+    return key1 == key2;
+}
+
+
+dict_type_t __incremental_dict_type__ = {
+    __hash_fn__,
+    NULL,
+    NULL,
+    __compare_fn__,
+    NULL,
+    NULL
+};
+
+
+incremental_t* incremental_create(const char *fn)
+{
+    incremental_t *inc = (incremental_t *) pmalloc(sizeof(incremental_t));
+
+    /* a name of its own, its ranges are told apart from those of headers by it */
+    inc->fn = cstring_new(fn);
+    inc->include_paths = incpath_create();
+    incpath_add_std(inc->include_paths);
+    inc->text = cstring_new_n(NULL, 0);
+    inc->lines = linemap_create((const unsigned char *) inc->text, 0);
+    inc->loc = SRCLOC_NONE;
+    inc->texts = array_create(sizeof(incremental_text_t));
+    inc->kept = 0;
+    inc->templates = array_create_n(sizeof(token_t*), 256);
+    inc->checkpoints = array_create(sizeof(incremental_checkpoint_t));
+    inc->output = array_create_n(sizeof(token_t*), 256);
+    inc->diag = diagnostor_create();
+    inc->opt = *option;
+    inc->replayed = false;
+    inc->relexed = 0;
+    inc->reused = 0;
+    inc->expanded = 0;
+
+    __incremental_start__(inc);
+    return inc;
+}
+
+
+void incremental_destroy(incremental_t *inc)
+{
+    __incremental_clear__(inc);
+
+    preprocessor_destroy(inc->pp);
+    lexer_destroy(inc->lexer);
+
+    cstring_free(inc->text);
+    linemap_destroy(inc->lines);
+
+    array_destroy(inc->texts);
+    array_destroy(inc->templates);
+    array_destroy(inc->checkpoints);
+    array_destroy(inc->output);
+    diagnostor_destroy(inc->diag);
+    incpath_destroy(inc->include_paths);
+    cstring_free(inc->fn);
+    pfree(inc);
+}
+
+
+/**
+ * Only takes effect with the next incremental_set_text().
+ **/
+void incremental_add_include_path(incremental_t *inc, const char *path)
+{
+    incpath_add(inc->include_paths, path);
+}
+
+
+/**
+ * Preprocesses text from scratch, what was kept of the text before let go.
+ **/
+void incremental_set_text(incremental_t *inc, const char *text, size_t length)
+{
+    option_t *saved_option;
+    diagnostor_t *saved_diagnostor;
+
+    __incremental_enter__(inc, &saved_option, &saved_diagnostor);
+    __incremental_reset__(inc, text, length);
+
+    option = saved_option;
+    diagnostor = saved_diagnostor;
+}
+
+
+/**
+ * Replaces the bytes [start, end) of the text with the length of text and
+ * preprocesses again what the edit changes. False if the range is not
+ * one of the text, which is left as it was.
+ **/
+bool incremental_edit(incremental_t *inc, size_t start, size_t end,
+                      const char *text, size_t length)
+{
+    option_t *saved_option;
+    diagnostor_t *saved_diagnostor;
+    bool ok;
+
+    if (start > end || end > cstring_length(inc->text)) {
+        return false;
+    }
+
+    ok = inc->diag->nerrors == 0 && inc->diag->nwarnings == 0;
+
+    __incremental_enter__(inc, &saved_option, &saved_diagnostor);
+    __incremental_edit__(inc, start, end, text, length, ok);
+
+    option = saved_option;
+    diagnostor = saved_diagnostor;
+    return true;
+}
+
+
+/**
+ * What the run before reported goes, and the option and diagnostor of the
+ * session stand in for the caller's until it is done.
+ **/
+static
+void __incremental_enter__(incremental_t *inc, option_t **saved_option,
+    diagnostor_t **saved_diagnostor)
+{
+    *saved_option = option;
+    *saved_diagnostor = diagnostor;
+
+    diagnostor_destroy(inc->diag);
+    inc->diag = diagnostor_create();
+
+    /* a text being typed is seldom whole, an error is no reason to stop */
+    inc->opt = *option;
+    inc->opt.ferror_limit = (size_t) -1;
+
+    option = &inc->opt;
+    diagnostor = inc->diag;
+}
+
+
+static
+void __incremental_reset__(incremental_t *inc, const char *text, size_t length)
+{
+    __incremental_clear__(inc);
+
+    preprocessor_destroy(inc->pp);
+    lexer_destroy(inc->lexer);
+
+    cstring_free(inc->text);
+    linemap_destroy(inc->lines);
+
+    inc->text = cstring_new_n(text, length);
+    inc->lines = linemap_create((const unsigned char *) inc->text, length);
+
+    inc->reused = 0;
+    inc->expanded = 0;
+
+    __incremental_start__(inc);
+    __incremental_full__(inc);
+
+    inc->relexed = array_length(inc->templates);
+}
+
+
+/**
+ * The edit of incremental_edit(), from scratch unless reuse, which is
+ * false when the run before had anything to report.
+ **/
+static
+void __incremental_edit__(incremental_t *inc, size_t start, size_t end,
+                          const char *text, size_t length, bool reuse)
+{
+    incremental_checkpoint_t *checkpoints, *cp;
+    incremental_old_t old;
+    incremental_text_t *kept;
+    token_t **templates, **tokens, *token;
+    array_t *relexed, *joined;
+    cstring_t changed;
+    linemap_t *lines;
+    reader_t *reader;
+    size_t old_length, new_length, depth, k, i, n, q, j;
+    srcloc_t loc;
+    bool ok;
+
+    old_length = cstring_length(inc->text);
+
+    new_length = old_length - (end - start) + length;
+
+    changed = cstring_new_n(inc->text, start);
+    changed = cstring_concat_n(changed, text, length);
+    changed = cstring_concat_n(changed, inc->text + end, old_length - end);
+
+    if (!reuse || !inc->replayed || array_length(inc->texts) >= INCREMENTAL_KEEP_TEXTS ||
+        inc->kept + old_length > INCREMENTAL_KEEP + INCREMENTAL_KEEP_FACTOR * new_length ||
+        array_length(inc->pp->macros) > INCREMENTAL_KEEP_MACROS + 2 * array_length(inc->pp->journal)) {
+        __incremental_reset__(inc, changed, new_length);
+        cstring_free(changed);
+        return;
+    }
+
+    lines = linemap_create((const unsigned char *) changed, new_length);
+    reader = inc->lexer->reader;
+
+    /**
+     * Back to the last checkpoint at or before the edit. One right at it
+     * is not taken after a lone '\r', the edit could join a '\n' to the
+     * newline before.
+     **/
+    checkpoints = array_prototype(inc->checkpoints, incremental_checkpoint_t);
+    for (k = array_length(inc->checkpoints); k-- > 1; ) {
+        if (checkpoints[k].offset < start ||
+            (checkpoints[k].offset == start && inc->text[start - 1] == '\n')) {
+            break;
+        }
+    }
+
+    cp = &checkpoints[k];
+
+    /* lex anew from its line until a line ends where one of the old text did */
+    depth = reader_depth(reader);
+    lexer_push_text(inc->lexer, inc->fn, (const unsigned char *) changed, new_length, lines, SRCLOC_NONE);
+    loc = inc->loc;
+    inc->loc = reader_loc(reader);
+    reader_seek(reader, (const unsigned char *) changed + cp->offset);
+
+    relexed = array_create_n(sizeof(token_t*), 64);
+    old.delta = length - (end - start);
+    old.token = array_length(inc->templates);
+
+    for (;;) {
+        if (!(ok = lexer_record_line(inc->lexer, relexed))) {
+            break;
+        }
+
+        token = array_cast_back(token_t*, relexed);
+        if (token->type != TOKEN_NEWLINE) {
+            token_destroy(token);
+            array_pop_back(relexed);
+            break;
+        }
+
+        q = __incremental_line_end__((const unsigned char *) changed, new_length, token->loc);
+        if (q != (size_t) -1 && q >= start + length) {
+            j = __incremental_line_start__(inc->templates, (const unsigned char *) inc->text,
+                                           old_length, q - old.delta);
+            if (j != (size_t) -1) {
+                old.token = j;
+                break;
+            }
+        }
+    }
+
+    if (reader_depth(reader) > depth) {
+        reader_pop(reader);
+    }
+
+    if (!ok) {
+        tokens_free(relexed);
+        linemap_destroy(lines);
+        inc->loc = loc;
+        __incremental_reset__(inc, changed, new_length);
+        cstring_free(changed);
+        return;
+    }
+
+    /* the templates before the checkpoint, those lexed anew, the old ones moved */
+    templates = array_prototype(inc->templates, token_t*);
+    n = array_length(inc->templates);
+
+    for (i = cp->token; i < old.token; i++) {
+        token_destroy(templates[i]);
+    }
+
+    for (i = old.token; i < n; i++) {
+        templates[i]->loc += (srcloc_t) old.delta;
+    }
+
+    inc->relexed = array_length(relexed);
+    old.resync = cp->token + array_length(relexed);
+
+    joined = array_create_n(sizeof(token_t*), n - (old.token - cp->token) + array_length(relexed));
+    tokens = array_push_back_n(joined, cp->token);
+    memcpy(tokens, templates, cp->token * sizeof(token_t*));
+    array_extend(joined, relexed);
+    tokens = array_push_back_n(joined, n - old.token);
+    memcpy(tokens, templates + old.token, (n - old.token) * sizeof(token_t*));
+
+    array_destroy(relexed);
+    array_destroy(inc->templates);
+    inc->templates = joined;
+
+    /* keep what the run had from the checkpoint on, and go back there */
+    old.journal_base = cp->pp.journal;
+    old.consulted_base = cp->pp.consulted;
+    old.output_base = cp->output;
+
+    old.checkpoints = array_create_n(sizeof(incremental_checkpoint_t),
+                                     array_length(inc->checkpoints) - k);
+    array_push_back_n(old.checkpoints, array_length(inc->checkpoints) - k);
+    memcpy(old.checkpoints->elts, cp, (array_length(inc->checkpoints) - k) * sizeof(incremental_checkpoint_t));
+
+    n = array_length(inc->pp->journal) - old.journal_base;
+    old.journal = array_create_n(sizeof(pp_journal_t), n + 1);
+    array_push_back_n(old.journal, n);
+    memcpy(old.journal->elts, array_prototype(inc->pp->journal, pp_journal_t) + old.journal_base,
+           n * sizeof(pp_journal_t));
+
+    n = array_length(inc->pp->consulted) - old.consulted_base;
+    old.consulted = array_create_n(sizeof(ident_t*), n + 1);
+    array_push_back_n(old.consulted, n);
+    memcpy(old.consulted->elts, array_prototype(inc->pp->consulted, ident_t*) + old.consulted_base,
+           n * sizeof(ident_t*));
+
+    n = array_length(inc->output) - old.output_base;
+    old.output = array_create_n(sizeof(token_t*), n + 1);
+    array_push_back_n(old.output, n);
+    memcpy(old.output->elts, array_prototype(inc->output, token_t*) + old.output_base,
+           n * sizeof(token_t*));
+
+    array_pop_back_n(inc->output, n);
+    array_pop_back_n(inc->checkpoints, array_length(inc->checkpoints) - k - 1);
+    preprocessor_restore(inc->pp, &array_cast_back(incremental_checkpoint_t, inc->checkpoints).pp);
+
+    /* the old text stays, for the locations of the tokens reused */
+    kept = array_push_back(inc->texts);
+    kept->text = inc->text;
+    kept->lines = inc->lines;
+    kept->loc = loc;
+    kept->start = start;
+    kept->end = end;
+    kept->delta = old.delta;
+    inc->kept += old_length;
+
+    inc->text = changed;
+    inc->lines = lines;
+
+    old.next = 1;
+    old.absorbed = 0;
+    old.seen = array_length(inc->pp->journal);
+    old.bindings = dict_create(&__incremental_dict_type__, NULL);
+    old.expansions = dict_create(&__incremental_dict_type__, NULL);
+
+    inc->reused = 0;
+    inc->expanded = 0;
+
+    k = array_cast_back(incremental_checkpoint_t, inc->checkpoints).token;
+    lexer_push_text(inc->lexer, inc->fn, (const unsigned char *) inc->text, new_length, inc->lines, inc->loc);
+    reader_seek(reader, (const unsigned char *) inc->text + new_length);
+    lexer_replay(inc->lexer, array_prototype(inc->templates, token_t*) + k,
+                 array_length(inc->templates) - k, inc->loc);
+
+    __incremental_run__(inc, &old);
+
+    /* the tokens of the stretches not reused */
+    tokens = array_prototype(old.output, token_t*);
+    for (i = 0; i < array_length(old.output); i++) {
+        if (tokens[i] != NULL) {
+            token_destroy(tokens[i]);
+        }
+    }
+
+    array_destroy(old.checkpoints);
+    array_destroy(old.journal);
+    array_destroy(old.consulted);
+    array_destroy(old.output);
+    dict_destroy(old.expansions);
+    dict_destroy(old.bindings);
+}
+
+
+static
+void __incremental_start__(incremental_t *inc)
+{
+    inc->lexer = lexer_create();
+    inc->pp = preprocessor_create_incpath(inc->lexer, inc->include_paths);
+    preprocessor_set_journal(inc->pp);
+}
+
+
+/**
+ * Lets go of the run and the texts kept, the current one aside.
+ **/
+static
+void __incremental_clear__(incremental_t *inc)
+{
+    incremental_text_t *texts;
+    token_t **tokens;
+    size_t i;
+
+    tokens = array_prototype(inc->output, token_t*);
+    for (i = 0; i < array_length(inc->output); i++) {
+        token_destroy(tokens[i]);
+    }
+
+    tokens = array_prototype(inc->templates, token_t*);
+    for (i = 0; i < array_length(inc->templates); i++) {
+        token_destroy(tokens[i]);
+    }
+
+    texts = array_prototype(inc->texts, incremental_text_t);
+    for (i = 0; i < array_length(inc->texts); i++) {
+        cstring_free(texts[i].text);
+        linemap_destroy(texts[i].lines);
+    }
+
+    array_clear(inc->output);
+    array_clear(inc->templates);
+    array_clear(inc->checkpoints);
+    array_clear(inc->texts);
+    inc->kept = 0;
+    inc->replayed = false;
+}
+
+
+/**
+ * Lexes the text into templates and preprocesses them, taking the
+ * checkpoints, or if the lexing had anything to report reads the text
+ * as it is, for the report, with none to be taken.
+ **/
+static
+void __incremental_full__(incremental_t *inc)
+{
+    reader_t *reader = inc->lexer->reader;
+    size_t depth, length;
+    token_t *token;
+    bool ok;
+
+    length = cstring_length(inc->text);
+    depth = reader_depth(reader);
+
+    lexer_push_text(inc->lexer, inc->fn, (const unsigned char *) inc->text, length, inc->lines, SRCLOC_NONE);
+    inc->loc = reader_loc(reader);
+
+    for (;;) {
+        if (!(ok = lexer_record_line(inc->lexer, inc->templates))) {
+            break;
+        }
+
+        token = array_cast_back(token_t*, inc->templates);
+        if (token->type != TOKEN_NEWLINE) {
+            token_destroy(token);
+            array_pop_back(inc->templates);
+            break;
+        }
+    }
+
+    if (reader_depth(reader) > depth) {
+        reader_pop(reader);
+    }
+
+    /* read again at the same place, the stream only to name the file and end it */
+    lexer_push_text(inc->lexer, inc->fn, (const unsigned char *) inc->text, length, inc->lines, inc->loc);
+
+    if (ok) {
+        reader_seek(reader, (const unsigned char *) inc->text + length);
+        lexer_replay(inc->lexer, array_prototype(inc->templates, token_t*),
+                     array_length(inc->templates), inc->loc);
+    } else {
+        tokens_free(inc->templates);
+        inc->templates = array_create_n(sizeof(token_t*), 256);
+    }
+
+    inc->replayed = ok;
+    __incremental_run__(inc, NULL);
+}
+
+
+static
+void __incremental_run__(incremental_t *inc, incremental_old_t *old)
+{
+    incremental_checkpoint_t *cp;
+    token_t *token;
+
+    if (inc->replayed && array_is_empty(inc->checkpoints)) {
+        cp = array_push_back(inc->checkpoints);
+        cp->offset = 0;
+        cp->token = 0;
+        cp->output = 0;
+        preprocessor_checkpoint(inc->pp, &cp->pp);
+    }
+
+    for (;;) {
+        token = preprocessor_expand(inc->pp);
+        if (token->type == TOKEN_END) {
+            token_destroy(token);
+            break;
+        }
+
+        if (old != NULL) {
+            token->loc = __incremental_rebase__(inc, old, token->loc);
+        }
+
+        array_cast_append(token_t*, inc->output, token);
+
+        if (token->type == TOKEN_NEWLINE && inc->replayed && __incremental_checkpoint__(inc)) {
+            inc->expanded++;
+
+            if (old != NULL) {
+                __incremental_reuse__(inc, old);
+            }
+        }
+    }
+}
+
+
+/**
+ * Takes a checkpoint after the newline just out, if the preprocessor
+ * stands at the start of a line of the templates with nothing open.
+ **/
+static
+bool __incremental_checkpoint__(incremental_t *inc)
+{
+    incremental_checkpoint_t checkpoint;
+    token_t **cursor, **templates;
+    size_t n;
+
+    cursor = lexer_replay_cursor(inc->lexer);
+    templates = array_prototype(inc->templates, token_t*);
+    n = array_length(inc->templates);
+
+    if (cursor == NULL || cursor <= templates || cursor > templates + n ||
+        cursor[-1]->type != TOKEN_NEWLINE) {
+        return false;
+    }
+
+    checkpoint.offset = __incremental_line_end__((const unsigned char *) inc->text,
+                                                 cstring_length(inc->text), cursor[-1]->loc);
+    if (checkpoint.offset == (size_t) -1 || !preprocessor_checkpoint(inc->pp, &checkpoint.pp)) {
+        return false;
+    }
+
+    checkpoint.token = (size_t) (cursor - templates);
+    checkpoint.output = array_length(inc->output);
+
+    *(incremental_checkpoint_t *) array_push_back(inc->checkpoints) = checkpoint;
+    return true;
+}
+
+
+/**
+ * At the checkpoint just taken, past the lines lexed anew, lines up with
+ * the old run and takes over the stretches that follow, for as long as
+ * they come to what they did.
+ **/
+static
+void __incremental_reuse__(incremental_t *inc, incremental_old_t *old)
+{
+    incremental_checkpoint_t *cp, *checkpoints;
+    size_t target, ncheckpoints;
+    bool reused = false;
+
+    cp = &array_cast_back(incremental_checkpoint_t, inc->checkpoints);
+    if (cp->token < old->resync) {
+        return;
+    }
+
+    checkpoints = array_prototype(old->checkpoints, incremental_checkpoint_t);
+    ncheckpoints = array_length(old->checkpoints);
+    target = cp->offset - old->delta;
+
+    while (old->next < ncheckpoints && checkpoints[old->next].offset < target) {
+        old->next++;
+    }
+
+    if (old->next >= ncheckpoints || checkpoints[old->next].offset != target) {
+        return;
+    }
+
+    __incremental_absorb__(old, inc->pp, checkpoints[old->next].pp.journal);
+
+    while (old->next + 1 < ncheckpoints && __incremental_region__(inc, old, old->next)) {
+        old->next++;
+        reused = true;
+    }
+
+    if (reused) {
+        cp = &array_cast_back(incremental_checkpoint_t, inc->checkpoints);
+        lexer_replay_seek(inc->lexer, array_prototype(inc->templates, token_t*) + cp->token);
+    }
+}
+
+
+/**
+ * Takes the journal of the old run up to journal in, and that of the new
+ * one so far: a name the new one bound first was bound in the old one as
+ * before, unless the old one bound it too.
+ **/
+static
+void __incremental_absorb__(incremental_old_t *old, preprocessor_t *pp, size_t journal)
+{
+    pp_journal_t *entries;
+    size_t i, n;
+
+    entries = array_prototype(old->journal, pp_journal_t);
+    for (i = old->absorbed; i + old->journal_base < journal; i++) {
+        if (entries[i].ident != NULL) {
+            dict_replace(old->bindings, entries[i].ident, entries[i].after);
+        }
+    }
+    old->absorbed = i;
+
+    entries = array_prototype(pp->journal, pp_journal_t);
+    n = array_length(pp->journal);
+    for (i = old->seen; i < n; i++) {
+        if (entries[i].ident != NULL && dict_find(old->bindings, entries[i].ident) == NULL) {
+            dict_add(old->bindings, entries[i].ident, entries[i].before);
+        }
+    }
+    old->seen = n;
+}
+
+
+/**
+ * Reuses the old stretch from checkpoint m to the next if none of the
+ * names it looked up is bound otherwise than it was then and it did not
+ * #include: its tokens are moved over, its #define and #undef done again.
+ **/
+static
+bool __incremental_region__(incremental_t *inc, incremental_old_t *old, size_t m)
+{
+    incremental_checkpoint_t *from, *to, checkpoint;
+    dict_entry_t *entry;
+    ident_t **consulted;
+    token_t **tokens;
+    size_t i;
+
+    from = &array_cast_at(incremental_checkpoint_t, old->checkpoints, m);
+    to = from + 1;
+
+    if (to->pp.included != from->pp.included) {
+        return false;
+    }
+
+    consulted = array_prototype(old->consulted, ident_t*);
+    for (i = from->pp.consulted; i < to->pp.consulted; i++) {
+        entry = dict_find(old->bindings, consulted[i - old->consulted_base]);
+        if (entry != NULL && !__incremental_same__(inc, old, consulted[i - old->consulted_base]->macro,
+                                                   (macro_t *) dict_get_val(entry))) {
+            return false;
+        }
+    }
+
+    tokens = array_prototype(old->output, token_t*);
+    for (i = from->output - old->output_base; i < to->output - old->output_base; i++) {
+        tokens[i]->loc = __incremental_rebase__(inc, old, tokens[i]->loc);
+        array_cast_append(token_t*, inc->output, tokens[i]);
+        tokens[i] = NULL;
+    }
+
+    preprocessor_redo(inc->pp,
+                      array_prototype(old->journal, pp_journal_t) + from->pp.journal - old->journal_base,
+                      to->pp.journal - from->pp.journal,
+                      consulted + from->pp.consulted - old->consulted_base,
+                      to->pp.consulted - from->pp.consulted);
+
+    __incremental_absorb__(old, inc->pp, to->pp.journal);
+
+    checkpoint.offset = to->offset + old->delta;
+    checkpoint.token = to->token - old->token + old->resync;
+    checkpoint.output = array_length(inc->output);
+    preprocessor_checkpoint(inc->pp, &checkpoint.pp);
+
+    *(incremental_checkpoint_t *) array_push_back(inc->checkpoints) = checkpoint;
+    inc->reused++;
+    return true;
+}
+
+
+/**
+ * Moves a location in a text kept to the current one, through the edits
+ * since, and an expansion to one made again with its spelling and use
+ * moved so. A location in what an edit replaced stays where it was.
+ **/
+static
+srcloc_t __incremental_rebase__(incremental_t *inc, incremental_old_t *old, srcloc_t loc)
+{
+    incremental_text_t *texts;
+    srcloc_range_t *range;
+    dict_entry_t *entry;
+    srcloc_t base, spelling, use, moved_spelling, moved_use, moved;
+    size_t low, high, middle, n, offset, size;
+
+    if (loc == SRCLOC_NONE || (range = srcloc_range(loc)) == NULL || range->base == inc->loc) {
+        return loc;
+    }
+
+    base = range->base;
+    offset = loc - base;
+
+    if (!srcloc_is_expansion(range)) {
+        if (range->filename != inc->fn) {
+            return loc;
+        }
+
+        texts = array_prototype(inc->texts, incremental_text_t);
+        n = array_length(inc->texts);
+        low = 0;
+        high = n;
+
+        while (low < high) {
+            middle = low + (high - low) / 2;
+
+            if (texts[middle].loc < base) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+
+        if (low == n || texts[low].loc != base) {
+            return loc;
+        }
+
+        for (; low < n; low++) {
+            if (offset >= texts[low].end) {
+                offset += texts[low].delta;
+            } else if (offset >= texts[low].start) {
+                return loc;
+            }
+        }
+
+        return inc->loc + (srcloc_t) offset;
+    }
+
+    if ((entry = dict_find(old->expansions, (void *) (uintptr_t) base)) != NULL) {
+        return (srcloc_t) (uintptr_t) dict_get_val(entry) + (srcloc_t) offset;
+    }
+
+    /* the range goes where the next expansion may put the array */
+    spelling = range->spelling;
+    size = range->size;
+    use = range->expansion;
+
+    moved_spelling = __incremental_rebase__(inc, old, spelling);
+    moved_use = __incremental_rebase__(inc, old, use);
+
+    moved = base;
+    if (moved_spelling != spelling || moved_use != use) {
+        moved = srcloc_add_expansion(moved_spelling, size, moved_use);
+    }
+
+    dict_add(old->expansions, (void *) (uintptr_t) base, (void *) (uintptr_t) moved);
+    return moved + (srcloc_t) offset;
+}
+
+
+/**
+ * Whether two bindings come to the same: the same macro, or two spelled
+ * alike with their bodies where each other's are in the current text. A
+ * macro of a snapshot not read in yet is only itself.
+ **/
+static
+bool __incremental_same__(incremental_t *inc, incremental_old_t *old, macro_t *a, macro_t *b)
+{
+    token_t **params_a, **params_b;
+    size_t i, n;
+
+    if (a == b) {
+        return true;
+    }
+
+    if (a == NULL || b == NULL || a->type != b->type ||
+        a->record != NULL || b->record != NULL) {
+        return false;
+    }
+
+    switch (a->type) {
+    case PP_MACRO_OBJECT:
+        return a->object_like.body->nelts == b->object_like.body->nelts &&
+               __incremental_same_tokens__(inc, old, a->object_like.body->elts, b->object_like.body->elts,
+                                           a->object_like.body->nelts, true);
+
+    case PP_MACRO_FUNCTION:
+        n = array_length(a->function_like.params);
+        if (n != array_length(b->function_like.params) ||
+            a->function_like.is_variadic != b->function_like.is_variadic ||
+            a->function_like.body->nelts != b->function_like.body->nelts) {
+            return false;
+        }
+
+        params_a = array_prototype(a->function_like.params, token_t*);
+        params_b = array_prototype(b->function_like.params, token_t*);
+        for (i = 0; i < n; i++) {
+            if (params_a[i]->is_vararg != params_b[i]->is_vararg) {
+                return false;
+            }
+        }
+
+        return __incremental_same_tokens__(inc, old, params_a, params_b, n, false) &&
+               __incremental_same_tokens__(inc, old, a->function_like.body->elts, b->function_like.body->elts,
+                                           a->function_like.body->nelts, true);
+
+    default:
+        return a->native_macro_fn == b->native_macro_fn;
+    }
+}
+
+
+/**
+ * Whether n tokens are spelled alike and, located, moved to the same
+ * places: a token is where its spaces begin, which an edit just before
+ * it may or may not move.
+ **/
+static
+bool __incremental_same_tokens__(incremental_t *inc, incremental_old_t *old,
+                                 token_t **a, token_t **b, size_t n, bool located)
+{
+    const unsigned char *sa, *sb;
+    size_t i, na, nb;
+
+    for (i = 0; i < n; i++) {
+        sa = token_spelling(a[i], &na);
+        sb = token_spelling(b[i], &nb);
+
+        if (a[i]->type != b[i]->type || (a[i]->spaces > 0) != (b[i]->spaces > 0) ||
+            na != nb || memcmp(sa, sb, na) != 0) {
+            return false;
+        }
+
+        if (located && __incremental_rebase__(inc, old, a[i]->loc) !=
+                       __incremental_rebase__(inc, old, b[i]->loc)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/**
+ * The offset after the newline at offset, "\r\n" taken as one, or
+ * (size_t) -1 if a TOKEN_NEWLINE is there for none, as at the end of a
+ * text that ends in a splice.
+ **/
+static
+size_t __incremental_line_end__(const unsigned char *text, size_t length, size_t offset)
+{
+    if (offset >= length || (text[offset] != '\r' && text[offset] != '\n')) {
+        return (size_t) -1;
+    }
+
+    if (text[offset] == '\r' && offset + 1 < length && text[offset + 1] == '\n') {
+        return offset + 2;
+    }
+
+    return offset + 1;
+}
+
+
+/**
+ * The template a line of the text begins with at offset, the newline
+ * before it one of the templates, or (size_t) -1 if none does.
+ **/
+static
+size_t __incremental_line_start__(array_t *templates, const unsigned char *text,
+                                  size_t length, size_t offset)
+{
+    token_t **tokens;
+    size_t low, high, middle;
+
+    tokens = array_prototype(templates, token_t*);
+    low = 0;
+    high = array_length(templates);
+
+    while (low < high) {
+        middle = low + (high - low) / 2;
+
+        if (tokens[middle]->loc < offset) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    if (low == 0 || tokens[low - 1]->type != TOKEN_NEWLINE ||
+        __incremental_line_end__(text, length, tokens[low - 1]->loc) != offset) {
+        return (size_t) -1;
+    }
+
+    return low;
+}
@@ -0,0 +1,114 @@
+
+
+#ifndef __INCREMENTAL__H__
+#define __INCREMENTAL__H__
+
+
+#include "config.h"
+#include "cstring.h"
+#include "srcloc.h"
+#include "option.h"
+#include "preprocessor.h"
+
+
+typedef struct array_s      array_t;
+typedef struct lexer_s      lexer_t;
+typedef struct linemap_s    linemap_t;
+typedef struct incpath_s    incpath_t;
+typedef struct diagnostor_s diagnostor_t;
+
+
+/**
+ * The texts of earlier edits are kept, for the locations of the tokens
+ * made from them, up to INCREMENTAL_KEEP_TEXTS of them and in all up to
+ * INCREMENTAL_KEEP_FACTOR times the text plus INCREMENTAL_KEEP; past
+ * that, or with as many macros made again, the next edit preprocesses
+ * the text from scratch and lets them all go.
+ **/
+#ifndef INCREMENTAL_KEEP
+#define INCREMENTAL_KEEP            (1024 * 1024)
+#endif
+
+#ifndef INCREMENTAL_KEEP_TEXTS
+#define INCREMENTAL_KEEP_TEXTS      64
+#endif
+
+#ifndef INCREMENTAL_KEEP_FACTOR
+#define INCREMENTAL_KEEP_FACTOR     8
+#endif
+
+#ifndef INCREMENTAL_KEEP_MACROS
+#define INCREMENTAL_KEEP_MACROS     4096
+#endif
+
+
+/**
+ * A line of the text the preprocessor stood at the start of, with nothing
+ * open: offset is where the line begins, token its first template and
+ * output the tokens that came out before it.
+ **/
+typedef struct incremental_checkpoint_s {
+    size_t offset;
+    size_t token;
+    size_t output;
+    pp_checkpoint_t pp;
+} incremental_checkpoint_t;
+
+
+/**
+ * A text, one file named fn, preprocessed again after each edit as far
+ * as the edit goes, for an editor that asks on every keystroke. Between
+ * edits the session keeps the text lexed into templates, as the token
+ * cache has them, a checkpoint at every line the preprocessor was there
+ * with nothing open, and the preprocessor itself, whose journal tells
+ * what every stretch between two checkpoints defined and looked up.
+ *
+ * An edit lexes anew only the lines from the checkpoint before it until
+ * the templates line up with the old ones again, lets the preprocessor go
+ * back to that checkpoint and reads on from there. Once it is past the
+ * edit, at a checkpoint of the old text, a stretch whose tokens do not
+ * depend on what the edit changed, none of the names it looked up bound
+ * otherwise and no #include in it, is not read again but has its tokens
+ * moved over and its #define and #undef done again. The locations of the
+ * tokens out, and those of the macro bodies they were spelled by, are
+ * moved to the current text through the edits since.
+ *
+ * A text whose lexing or preprocessing has anything to report is read as
+ * a whole each time, for the report. diag has what the last run reported,
+ * queued and not written out; it is the session's own, and a run goes on
+ * past any number of errors, with opt for the option it runs under.
+ * output has the tokens the text came to, good until the next edit;
+ * relexed, reused and expanded what the last one did: the templates
+ * lexed, the stretches reused and read again.
+ **/
+typedef struct incremental_s {
+    cstring_t fn;
+    incpath_t *include_paths;
+    lexer_t *lexer;
+    preprocessor_t *pp;
+    cstring_t text;
+    linemap_t *lines;
+    srcloc_t loc;
+    array_t *texts;
+    size_t kept;
+    array_t *templates;
+    array_t *checkpoints;
+    array_t *output;
+    diagnostor_t *diag;
+    option_t opt;
+    bool replayed;
+    size_t relexed;
+    size_t reused;
+    size_t expanded;
+} incremental_t;
+
+
+incremental_t* incremental_create(const char *fn);
+void incremental_destroy(incremental_t *inc);
+void incremental_add_include_path(incremental_t *inc, const char *path);
+void incremental_set_text(incremental_t *inc, const char *text, size_t length);
+bool incremental_edit(incremental_t *inc, size_t start, size_t end,
+                      const char *text, size_t length);
+
+
+#endif
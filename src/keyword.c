@@ -0,0 +1,45 @@
+
+
+#include "config.h"
+#include "token.h"
+#include "keyword.h"
+
+
+typedef struct keyword_s {
+    const char *spelling;
+    size_t length;
+    token_type_t type;
+} keyword_t;
+
+
+#include "keyword.inc"
+
+
+token_type_t keyword_lookup(const unsigned char *s, size_t n)
+{
+    const keyword_t *k;
+
+    if (n < KEYWORD_MIN_LENGTH || n > KEYWORD_MAX_LENGTH) {
+        return TOKEN_UNKNOWN;
+    }
+
+    k = &__keywords__[KEYWORD_HASH(s, n, KEYWORD_SEED, KEYWORD_BITS)];
+
+    return k->length == n && memcmp(k->spelling, s, n) == 0 ?
+        k->type : TOKEN_UNKNOWN;
+}
+
+
+token_type_t directive_lookup(const unsigned char *s, size_t n)
+{
+    const keyword_t *k;
+
+    if (n < DIRECTIVE_MIN_LENGTH || n > DIRECTIVE_MAX_LENGTH) {
+        return TOKEN_UNKNOWN;
+    }
+
+    k = &__directives__[KEYWORD_HASH(s, n, DIRECTIVE_SEED, DIRECTIVE_BITS)];
+
+    return k->length == n && memcmp(k->spelling, s, n) == 0 ?
+        k->type : TOKEN_UNKNOWN;
+}
@@ -0,0 +1,29 @@
+#ifndef __KEYWORD__H__
+#define __KEYWORD__H__
+
+
+#include "config.h"
+
+
+typedef enum token_type_e token_type_t;
+
+
+/**
+ * Multiplicative hash over the first, middle and last byte and the
+ * length. genkeyword picks a seed that makes it perfect for keyword.def,
+ * so a lookup is one probe and one compare.
+ **/
+#define KEYWORD_KEY(s, n)                                               \
+    ((uint32_t) (s)[0] | (uint32_t) (s)[(n) - 1] << 8 |                 \
+     (uint32_t) (s)[(n) >> 1] << 16 | (uint32_t) (n) << 24)
+
+
+#define KEYWORD_HASH(s, n, seed, bits)                                  \
+    ((uint32_t) (KEYWORD_KEY(s, n) * (uint32_t) (seed)) >> (32 - (bits)))
+
+
+token_type_t keyword_lookup(const unsigned char *s, size_t n);
+token_type_t directive_lookup(const unsigned char *s, size_t n);
+
+
+#endif
@@ -4,6 +4,10 @@
 #include "pmalloc.h"
 #include "token.h"
 #include "reader.h"
+#include "scan.h"
+#include "arena.h"
+#include "keyword.h"
+#include "charclass.h"
 #include "diagnostor.h"
 #include "lexer.h"
 #include "array.h"
@@ -11,18 +15,231 @@
 #include "cstring.h"
 #include "encoding.h"
 #include "option.h"
+#include "thread.h"
+#include "tokbuf.h"
+#include "ident.h"
+#include "cspool.h"
+#include "srcpool.h"
+#include "tokcache.h"
+#include "stats.h"
+#include "tokpipe.h"
+
+
+/**
+ * lexer_tokenize() splits a clean stream of at least LEXER_PARALLEL_MIN
+ * bytes left into as many as LEXER_PARALLEL_JOBS chunks lexed at once.
+ **/
+#ifndef LEXER_PARALLEL_MIN
+#define LEXER_PARALLEL_MIN      (1024 * 1024)
+#endif
+
+#ifndef LEXER_PARALLEL_JOBS
+#define LEXER_PARALLEL_JOBS     (4)
+#endif
+
+/* the fewest integers worth a TOKEN_NUMBER_RUN */
+#ifndef LEXER_RUN_MIN
+#define LEXER_RUN_MIN           (8)
+#endif
+
+
+/**
+ * A run of tokens handed back to the lexer, read from next up to end. A
+ * span of a single token has no tokens array, a stash has no token
+ * either. array is destroyed along with the span, if the lexer owns it.
+ * The tokens of a borrowed span are not the lexer's, each read is a copy.
+ * A stream pushed over spans is one as well, with neither: the streams
+ * are read before the spans below until the reader is back under end.
+ **/
+typedef struct lexer_span_s {
+    token_t **tokens;
+    token_t *token;
+    size_t next;
+    size_t end;
+    array_t *array;
+    bool borrowed;
+    /* set for cached tokens, whose copies are placed at loc, the replay */
+    bool cached;
+    bool stream;
+    srcloc_t loc;
+} lexer_span_t;
+
+
+/**
+ * A run of whole lines lexed on a thread of its own, on the guess that no
+ * comment is open where it starts. The first kept tokens take it as far
+ * as stop, the end of the last line lexed without anything to report;
+ * stop is end if ok is set.
+ **/
+typedef struct lexer_chunk_s {
+    const unsigned char *begin;
+    const unsigned char *end;
+    const unsigned char *stop;
+    lexer_t *lexer;
+    array_t *tokens;
+    size_t kept;
+    thread_t thread;
+    bool running;
+    bool ok;
+} lexer_chunk_t;
+
+
+/**
+ * Punctuators grouped by their first byte, longest spelling first, each
+ * group ending with the single byte one. __punctuator_group__ gives the
+ * group of a byte of class CHARCLASS_PUNCT.
+ **/
+typedef struct punctuator_s {
+    const char *spelling;
+    size_t length;
+    token_type_t type;
+} punctuator_t;
+
+
+static const punctuator_t __punctuators__[] = {
+    {"[",     1, TOKEN_L_SQUARE},
+
+    {"]",     1, TOKEN_R_SQUARE},
+
+    {"(",     1, TOKEN_L_PAREN},
 
+    {")",     1, TOKEN_R_PAREN},
 
-static inline token_t* __lexer_parse_number__(lexer_t *lexer, token_t *token, int ch);
+    {"{",     1, TOKEN_L_BRACE},
+
+    {"}",     1, TOKEN_R_BRACE},
+
+    {"...",   3, TOKEN_ELLIPSIS},
+    {".",     1, TOKEN_PERIOD},
+
+    {"&&",    2, TOKEN_AMPAMP},
+    {"&=",    2, TOKEN_AMPEQUAL},
+    {"&",     1, TOKEN_AMP},
+
+    {"*=",    2, TOKEN_STAREQUAL},
+    {"*",     1, TOKEN_STAR},
+
+    {"++",    2, TOKEN_PLUSPLUS},
+    {"+=",    2, TOKEN_PLUSEQUAL},
+    {"+",     1, TOKEN_PLUS},
+
+    {"->",    2, TOKEN_ARROW},
+    {"--",    2, TOKEN_MINUSMINUS},
+    {"-=",    2, TOKEN_MINUSEQUAL},
+    {"-",     1, TOKEN_MINUS},
+
+    {"~",     1, TOKEN_TILDE},
+
+    {"!=",    2, TOKEN_EXCLAIMEQUAL},
+    {"!",     1, TOKEN_EXCLAIM},
+
+    {"/=",    2, TOKEN_SLASHEQUAL},
+    {"/",     1, TOKEN_SLASH},
+
+    {"%:%:",  4, TOKEN_HASHHASH},
+    {"%=",    2, TOKEN_PERCENTEQUAL},
+    {"%>",    2, TOKEN_R_BRACE},
+    {"%:",    2, TOKEN_HASH},
+    {"%",     1, TOKEN_PERCENT},
+
+    {"<<=",   3, TOKEN_LESSLESSEQUAL},
+    {"<<",    2, TOKEN_LESSLESS},
+    {"<=",    2, TOKEN_LESSEQUAL},
+    {"<:",    2, TOKEN_L_SQUARE},
+    {"<%",    2, TOKEN_L_BRACE},
+    {"<",     1, TOKEN_LESS},
+
+    {">>=",   3, TOKEN_GREATERGREATEREQUAL},
+    {">>",    2, TOKEN_GREATERGREATER},
+    {">=",    2, TOKEN_GREATEREQUAL},
+    {">",     1, TOKEN_GREATER},
+
+    {"^=",    2, TOKEN_CARETEQUAL},
+    {"^",     1, TOKEN_CARET},
+
+    {"||",    2, TOKEN_PIPEPIPE},
+    {"|=",    2, TOKEN_PIPEEQUAL},
+    {"|",     1, TOKEN_PIPE},
+
+    {"?",     1, TOKEN_QUESTION},
+
+    {":>",    2, TOKEN_R_SQUARE},
+    {":",     1, TOKEN_COLON},
+
+    {";",     1, TOKEN_SEMI},
+
+    {"==",    2, TOKEN_EQUALEQUAL},
+    {"=",     1, TOKEN_EQUAL},
+
+    {",",     1, TOKEN_COMMA},
+
+    {"##",    2, TOKEN_HASHHASH},
+    {"#",     1, TOKEN_HASH},
+};
+
+
+static const unsigned char __punctuator_group__[256] = {
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   /* 00 */
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   /* 10 */
+     0, 21,  0, 52,  0, 25,  8,  0,  2,  3, 11, 13, 51, 16,  6, 23,   /* 20 */
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 46, 48, 30, 49, 36, 45,   /* 30 */
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   /* 40 */
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  1, 40,  0,   /* 50 */
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   /* 60 */
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  4, 42,  5, 20,  0,   /* 70 */
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   /* 80 */
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   /* 90 */
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   /* a0 */
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   /* b0 */
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   /* c0 */
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   /* d0 */
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   /* e0 */
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   /* f0 */
+};
+
+
+static bool __lexer_tokenize_parallel__(lexer_t *lexer, array_t *tokens,
+                                        const unsigned char *begin, const unsigned char *end);
+static const unsigned char* __lexer_resync__(lexer_t *lexer, array_t *tokens,
+                                             lexer_chunk_t *chunks, size_t n, size_t i);
+static void __lexer_chunk_worker__(void *ud);
+static inline void __lexer_drop_span__(lexer_t *lexer);
+static inline token_t* __lexer_next__(lexer_t *lexer);
+static inline bool __lexer_ends_batch__(token_t *token);
+static token_t* __lexer_piped__(lexer_t *lexer);
+static token_t* __lexer_scan__(lexer_t *lexer);
+static token_t* __lexer_scan_header_name__(lexer_t *lexer);
+static token_t* __lexer_copy_borrowed__(lexer_t *lexer, lexer_span_t *span, token_t *token);
+static bool __lexer_is_copy__(lexer_span_t *span, token_t *token, token_t *copy);
+static void __lexer_push_stream__(lexer_t *lexer);
+static inline bool __lexer_streaming__(lexer_t *lexer, lexer_span_t *span);
+static array_t* __lexer_record__(lexer_t *lexer);
+static inline token_t* __lexer_parse_number__(lexer_t *lexer, token_t *token, int ch,
+                                              const unsigned char *head);
+static token_t* __lexer_parse_run__(lexer_t *lexer, token_t *token, const unsigned char *head, size_t n);
+static bool __lexer_decode_integer__(const unsigned char *s, const unsigned char *end, uint64_t *value);
+static void __lexer_unget_run__(lexer_t *lexer, token_t *token);
 static inline encoding_type_t __lexer_parse_encoding__(lexer_t *lexer, int ch);
 static inline token_t* __lexer_parse_character__(lexer_t *lexer, token_t *token, encoding_type_t ent);
 static inline token_t* __lexer_parse_string__(lexer_t *lexer, token_t *token, encoding_type_t ent);
-static inline token_t* __lexer_parse_identifier__(lexer_t *lexer, token_t *token);
+static inline void __lexer_name_identifier__(lexer_t *lexer, token_t *token,
+                                             const unsigned char *s, size_t n);
+static inline token_t* __lexer_parse_identifier__(lexer_t *lexer, token_t *token,
+                                                  const unsigned char *head);
 static inline bool __lexer_parse_spaces__(lexer_t *lexer, token_t *token);
 static inline token_t* __lexer_parse_comment__(lexer_t *lexer, token_t *token);
+static inline token_type_t __lexer_parse_punctuator__(lexer_t *lexer, int ch);
+static inline bool __lexer_try_tail__(lexer_t *lexer, const char *tail, size_t n);
 
+static inline token_t* __lexer_new_token__(lexer_t *lexer);
+static inline const unsigned char* __lexer_head__(lexer_t *lexer, const unsigned char *start, size_t n);
+static inline token_t* __lexer_make_slice__(lexer_t *lexer, token_t *token, token_type_t type,
+                                            const unsigned char *spelling, size_t length);
 static inline token_t* __lexer_make_token__(lexer_t *lexer, token_t *token, token_type_t type);
+static inline token_t* __lexer_make_comment__(lexer_t *lexer, token_t *token);
+static inline void __lexer_track_line__(lexer_t *lexer, token_t *token);
 static inline void __lexer_mark_location__(lexer_t *lexer, token_t *token);
+static inline void __lexer_error__(lexer_t *lexer, token_t *token, const char *msg);
 static inline void __remark_location__(lexer_t *lexer, token_t *token);
 
 
@@ -33,6 +250,18 @@ lexer_t* lexer_create(void)
     lexer = pmalloc(sizeof(struct lexer_s));
 
     lexer->reader = reader_create();
+    lexer->spans = array_create_n(sizeof(lexer_span_t), 16);
+    lexer->arena = arena_create();
+    lexer->clean_arena = true;
+    lexer->scratch = cstring_new_n(NULL, 64);
+    lexer->trivia = option_get(Eflag);
+    lexer->begin_of_line = true;
+    lexer->speculative = false;
+    lexer->suppressed = 0;
+    lexer->idents = NULL;
+    lexer->pipe = NULL;
+    lexer->runs = false;
+    lexer->values = array_create_n(sizeof(uint64_t), 64);
 
     return lexer;
 }
@@ -45,6 +274,30 @@ lexer_t* lexer_create_csp(cspool_t *csp)
     lexer = pmalloc(sizeof(struct lexer_s));
 
     lexer->reader = reader_create_csp(csp);
+    lexer->spans = array_create_n(sizeof(lexer_span_t), 16);
+    lexer->arena = arena_create();
+    lexer->clean_arena = true;
+    lexer->scratch = cstring_new_n(NULL, 64);
+    lexer->trivia = option_get(Eflag);
+    lexer->begin_of_line = true;
+    lexer->speculative = false;
+    lexer->suppressed = 0;
+    lexer->idents = NULL;
+    lexer->pipe = NULL;
+    lexer->runs = false;
+    lexer->values = array_create_n(sizeof(uint64_t), 64);
+
+    return lexer;
+}
+
+
+lexer_t* lexer_create_srcpool(cspool_t *csp, srcpool_t *srcpool)
+{
+    lexer_t *lexer;
+
+    lexer = lexer_create_csp(csp);
+    reader_destroy(lexer->reader);
+    lexer->reader = reader_create_srcpool(csp, srcpool);
 
     return lexer;
 }
@@ -52,7 +305,103 @@ lexer_t* lexer_create_csp(cspool_t *csp)
 
 bool lexer_push(lexer_t *lexer, stream_type_t type, const unsigned char* s)
 {
-    return reader_push(lexer->reader, type, s);
+    lexer->begin_of_line = true;
+
+    if (!reader_push(lexer->reader, type, s)) {
+        return false;
+    }
+
+    __lexer_push_stream__(lexer);
+
+    /* the tokens of a pipe are made in the arena, to outlive its lexer */
+    if (type == STREAM_TYPE_FILE && option_get(pipeline) && lexer->arena != NULL) {
+        if (lexer->pipe == NULL) {
+            lexer->pipe = tokpipe_create();
+        }
+
+        if (lexer->pipe != NULL) {
+            tokpipe_open(lexer->pipe, lexer->reader, lexer->trivia, lexer->arena);
+        }
+    }
+
+    return true;
+}
+
+
+/**
+ * Pushes text as reader_push_text() has it, borrowed along with its lines.
+ **/
+bool lexer_push_text(lexer_t *lexer, cstring_t fn, const unsigned char *text,
+                     size_t length, linemap_t *lines, srcloc_t loc)
+{
+    lexer->begin_of_line = true;
+
+    if (!reader_push_text(lexer->reader, fn, text, length, lines, loc)) {
+        return false;
+    }
+
+    __lexer_push_stream__(lexer);
+    return true;
+}
+
+
+/**
+ * A stream pushed while tokens are handed back, an #include in a file
+ * replayed from the cache, is read before them.
+ **/
+static
+void __lexer_push_stream__(lexer_t *lexer)
+{
+    lexer_span_t *span;
+
+    /* those of the streams read through go first, the depth is taken again */
+    while (!array_is_empty(lexer->spans) &&
+           array_cast_back(lexer_span_t, lexer->spans).stream &&
+           reader_depth(lexer->reader) <= array_cast_back(lexer_span_t, lexer->spans).end) {
+        array_pop_back(lexer->spans);
+    }
+
+    if (array_is_empty(lexer->spans)) {
+        return;
+    }
+
+    span = array_push_back(lexer->spans);
+    span->tokens = NULL;
+    span->token = NULL;
+    span->next = 0;
+    span->end = reader_depth(lexer->reader);
+    span->array = NULL;
+    span->borrowed = false;
+    span->cached = false;
+    span->stream = true;
+    span->loc = SRCLOC_NONE;
+}
+
+
+static inline
+bool __lexer_streaming__(lexer_t *lexer, lexer_span_t *span)
+{
+    return span->stream && reader_depth(lexer->reader) >= span->end;
+}
+
+
+/**
+ * With trivia the lexer hands out TOKEN_SPACE and TOKEN_COMMENT tokens,
+ * which only -E needs. Without, whitespace and comments just add to the
+ * spaces of the next token. TOKEN_NEWLINE is kept either way.
+ **/
+void lexer_set_trivia(lexer_t *lexer, bool trivia)
+{
+    lexer->trivia = trivia;
+}
+
+
+/**
+ * The table stays the caller's, NULL stops the lookups.
+ **/
+void lexer_set_idents(lexer_t *lexer, identtab_t *idents)
+{
+    lexer->idents = idents;
 }
 
 
@@ -60,228 +409,1232 @@ void lexer_destroy(lexer_t *lexer)
 {
     assert(lexer != NULL);
 
-    reader_destroy(lexer->reader);
+    if (lexer->pipe != NULL) {
+        tokpipe_destroy(lexer->pipe);
+    }
+
+    reader_destroy(lexer->reader);
+
+    while (!array_is_empty(lexer->spans)) {
+        __lexer_drop_span__(lexer);
+    }
+
+    array_destroy(lexer->spans);
+
+    if (lexer->clean_arena) {
+        arena_destroy(lexer->arena);
+    }
+
+    cstring_free(lexer->scratch);
+    array_destroy(lexer->values);
+
+    pfree(lexer);
+}
+
+
+/**
+ * Hand the lexer an arena owned by the translation unit, or NULL to have
+ * every token allocated on its own. Must be called before scanning, and
+ * as tokens may point into the sources the arena must not outlive them.
+ **/
+void lexer_set_arena(lexer_t *lexer, arena_t *arena)
+{
+    if (lexer->clean_arena) {
+        assert(arena_allocated(lexer->arena) == 0);
+        arena_destroy(lexer->arena);
+    }
+
+    lexer->arena = arena;
+    lexer->clean_arena = false;
+}
+
+
+token_t* lexer_scan(lexer_t *lexer)
+{
+    stats_phase_t phase;
+    token_t *token;
+
+    phase = stats_enter(STATS_PHASE_LEX);
+    token = __lexer_next__(lexer);
+    stats_leave(phase);
+
+    stats_count(STATS_TOKENS_LEXED);
+    return token;
+}
+
+
+/**
+ * Up to n tokens of the streams into tokens, as many lexer_scan() calls
+ * would, and how many. The batch ends early after a token the
+ * preprocessor may act on before the next one is lexed: a line break, a
+ * '#' that begins a line, the end of a file or of the input.
+ **/
+size_t lexer_scan_batch(lexer_t *lexer, token_t **tokens, size_t n)
+{
+    stats_phase_t phase;
+    size_t i = 0;
+
+    phase = stats_enter(STATS_PHASE_LEX);
+
+    while (i < n) {
+        tokens[i] = __lexer_next__(lexer);
+        if (__lexer_ends_batch__(tokens[i++])) {
+            break;
+        }
+    }
+
+    stats_leave(phase);
+
+    stats_add(STATS_TOKENS_LEXED, i);
+    return i;
+}
+
+
+static inline
+token_t* __lexer_next__(lexer_t *lexer)
+{
+    token_t *token;
+
+    if (lexer->pipe != NULL && (token = __lexer_piped__(lexer)) != NULL) {
+        return token;
+    }
+
+    token = __lexer_scan__(lexer);
+
+    /* a file that left its pipe for a token to report goes on in a new one */
+    if (lexer->pipe != NULL && token->type == TOKEN_NEWLINE) {
+        tokpipe_open(lexer->pipe, lexer->reader, lexer->trivia, lexer->arena);
+    }
+
+    return token;
+}
+
+
+static inline
+bool __lexer_ends_batch__(token_t *token)
+{
+    switch (token->type) {
+    case TOKEN_NEWLINE:
+    case TOKEN_EOF:
+    case TOKEN_END:
+        return true;
+    case TOKEN_HASH:
+        return token->begin_of_line;
+    default:
+        return false;
+    }
+}
+
+
+/**
+ * The next token lexed ahead for the stream read, NULL to lex it here.
+ * It is named in the identtab_t, which is the reader's alone.
+ **/
+static
+token_t* __lexer_piped__(lexer_t *lexer)
+{
+    token_t *token;
+    const unsigned char *s;
+    size_t n;
+
+    token = tokpipe_get(lexer->pipe, lexer->reader, &lexer->begin_of_line);
+    if (token == NULL) {
+        return NULL;
+    }
+
+    token->arena = lexer->arena;
+
+    if (lexer->idents != NULL && token->type == TOKEN_IDENTIFIER) {
+        s = token_spelling(token, &n);
+        __lexer_name_identifier__(lexer, token, s, n);
+    }
+
+    return token;
+}
+
+
+static
+token_t* __lexer_scan__(lexer_t *lexer)
+{
+    int ch;
+    token_t *token;
+    const unsigned char *start;
+    unsigned char class;
+
+    if (reader_is_empty(lexer->reader)) {
+        return __lexer_make_token__(lexer, __lexer_new_token__(lexer), TOKEN_END);
+    }
+
+    token = __lexer_new_token__(lexer);
+
+again:
+    __lexer_mark_location__(lexer, token);
+
+    if (__lexer_parse_spaces__(lexer, token) && lexer->trivia) {
+        return __lexer_make_token__(lexer, token, TOKEN_SPACE);
+    }
+
+    /* heap tokens own their text, only arena tokens are sliced */
+    start = lexer->arena != NULL ? reader_cursor(lexer->reader) : NULL;
+
+    ch = reader_get(lexer->reader);
+    class = CHARCLASS(ch);
+
+    if (class & CHARCLASS_PUNCT) {
+        if (ch == '/' && (reader_test(lexer->reader, '/') || reader_test(lexer->reader, '*'))) {
+            if (__lexer_parse_comment__(lexer, token) == NULL) {
+                goto again;
+            }
+            return token;
+        }
+        if (ch == '.' && ISDIGIT(reader_peek(lexer->reader))) {
+            return __lexer_parse_number__(lexer, token, ch, __lexer_head__(lexer, start, 1));
+        }
+        return __lexer_make_token__(lexer, token, __lexer_parse_punctuator__(lexer, ch));
+    }
+
+    if (class & CHARCLASS_DIGIT) {
+        return __lexer_parse_number__(lexer, token, ch, __lexer_head__(lexer, start, 1));
+    }
+
+    switch (ch) {
+    case '\n':
+        return __lexer_make_token__(lexer, token, TOKEN_NEWLINE);
+    case 'u': case 'U': case 'L': {
+        const unsigned char *head;
+        encoding_type_t ent = __lexer_parse_encoding__(lexer, ch);
+
+        if (reader_test(lexer->reader, '\"')) {
+            __remark_location__(lexer, token);
+            reader_get(lexer->reader);
+            return __lexer_parse_string__(lexer, token, ent);
+        }
+
+        if (ent != ENCODING_UTF8 && reader_test(lexer->reader, '\'')) {
+            __remark_location__(lexer, token);
+            reader_get(lexer->reader);
+            return __lexer_parse_character__(lexer, token, ent);
+        }
+
+        head = __lexer_head__(lexer, start, ent == ENCODING_UTF8 ? 2 : 1);
+        if (head != NULL) {
+            return __lexer_parse_identifier__(lexer, token, head);
+        }
+
+        if (ent == ENCODING_UTF8) {
+            reader_unget(lexer->reader, '8');
+        }
+
+        reader_unget(lexer->reader, ch);
+        return __lexer_parse_identifier__(lexer, token, NULL);
+    }
+    case '\'':
+        return __lexer_parse_character__(lexer, token, ENCODING_NONE);
+    case '\"':
+        return __lexer_parse_string__(lexer, token, ENCODING_NONE);
+    case '\\':
+        if (reader_test(lexer->reader, 'u') || reader_test(lexer->reader, 'U'))
+            return __lexer_parse_identifier__(lexer, token, NULL);
+        return __lexer_make_token__(lexer, token, TOKEN_BACKSLASH);
+    case EOF:
+        reader_pop(lexer->reader);
+        return __lexer_make_token__(lexer, token, TOKEN_EOF);
+    default:
+        break;
+    }
+
+    if (class & CHARCLASS_IDENT) {
+        const unsigned char *head = __lexer_head__(lexer, start, 1);
+        if (head != NULL) {
+            return __lexer_parse_identifier__(lexer, token, head);
+        }
+        reader_unget(lexer->reader, ch);
+        return __lexer_parse_identifier__(lexer, token, NULL);
+    }
+
+    /* stray character, passed on as is */
+    token->cs = cstring_concat_ch(token->cs, ch);
+    return __lexer_make_token__(lexer, token, TOKEN_UNKNOWN);
+}
+
+
+/**
+ * What follows #include: a <...> or "..." header name, spelled with its
+ * delimiters, or when it is neither the next token as usual, for the
+ * preprocessor to expand.
+ **/
+token_t* lexer_scan_header_name(lexer_t *lexer)
+{
+    if ((!array_is_empty(lexer->spans) &&
+         !__lexer_streaming__(lexer, &array_cast_back(lexer_span_t, lexer->spans))) ||
+        reader_is_empty(lexer->reader)) {
+        return lexer_get(lexer);
+    }
+
+    return __lexer_scan_header_name__(lexer);
+}
+
+
+static
+token_t* __lexer_scan_header_name__(lexer_t *lexer)
+{
+    int ch, close;
+    token_t *token;
+
+    if (lexer->pipe != NULL && (token = __lexer_piped__(lexer)) != NULL) {
+        stats_count(STATS_TOKENS_LEXED);
+        return token;
+    }
+
+    for (ch = reader_peek(lexer->reader); ch == ' ' || ch == '\t'; ch = reader_peek(lexer->reader)) {
+        reader_get(lexer->reader);
+    }
+
+    if (ch != '"' && ch != '<') {
+        return lexer_scan(lexer);
+    }
+
+    token = __lexer_new_token__(lexer);
+    __lexer_mark_location__(lexer, token);
+
+    close = reader_get(lexer->reader) == '<' ? '>' : '"';
+    token->cs = cstring_concat_ch(token->cs, ch);
+
+    for (;;) {
+        ch = reader_peek(lexer->reader);
+        if (ch == '\n' || ch == EOF) {
+            __lexer_error__(lexer, token, close == '>' ?
+                "missing terminating > character" : "missing terminating \" character");
+            break;
+        }
+
+        reader_get(lexer->reader);
+        token->cs = cstring_concat_ch(token->cs, ch);
+        if (ch == close) {
+            break;
+        }
+    }
+
+    return __lexer_make_token__(lexer, token, TOKEN_PP_HEADER_NAME);
+}
+
+
+/**
+ * The next token, taken from the tokens handed back if there are any. A
+ * stash reads as TOKEN_END until lexer_unstash().
+ **/
+token_t* lexer_get(lexer_t *lexer)
+{
+    lexer_span_t *span;
+    token_t *token;
+
+    while (!array_is_empty(lexer->spans)) {
+        span = &array_cast_back(lexer_span_t, lexer->spans);
+
+        if (span->tokens == NULL) {
+            if (span->stream) {
+                if (__lexer_streaming__(lexer, span)) {
+                    return lexer_scan(lexer);
+                }
+
+                array_pop_back(lexer->spans);
+                continue;
+            }
+
+            if (span->token == NULL) {
+                return __lexer_make_token__(lexer, __lexer_new_token__(lexer), TOKEN_END);
+            }
+
+            token = span->token;
+            array_pop_back(lexer->spans);
+            return token;
+        }
+
+        /* a drained span stays until the next read, lexer_unget() may rewind it */
+        if (span->next < span->end) {
+            if (span->borrowed) {
+                return __lexer_copy_borrowed__(lexer, span, span->tokens[span->next++]);
+            }
+            return span->tokens[span->next++];
+        }
+
+        __lexer_drop_span__(lexer);
+    }
+
+    return lexer_scan(lexer);
+}
+
+
+/**
+ * Up to n of the next tokens into tokens, and how many, never none. A
+ * batch is taken from one span alone, or when there is none from the
+ * streams as lexer_scan_batch() has it.
+ **/
+size_t lexer_get_batch(lexer_t *lexer, token_t **tokens, size_t n)
+{
+    lexer_span_t *span;
+    size_t i = 0;
+
+    assert(n > 0);
+
+    while (!array_is_empty(lexer->spans)) {
+        span = &array_cast_back(lexer_span_t, lexer->spans);
+
+        if (span->tokens == NULL) {
+            if (__lexer_streaming__(lexer, span)) {
+                return lexer_scan_batch(lexer, tokens, n);
+            }
+
+            tokens[0] = lexer_get(lexer);
+            return 1;
+        }
+
+        if (span->next < span->end) {
+            for (; i < n && span->next < span->end; i++) {
+                tokens[i] = span->borrowed ?
+                    __lexer_copy_borrowed__(lexer, span, span->tokens[span->next]) :
+                    span->tokens[span->next];
+                span->next++;
+            }
+            return i;
+        }
+
+        __lexer_drop_span__(lexer);
+    }
+
+    return lexer_scan_batch(lexer, tokens, n);
+}
+
+
+token_t* lexer_peek(lexer_t *lexer)
+{
+    token_t *token = lexer_get(lexer);
+    lexer_unget(lexer, token);
+    return token;
+}
+
+
+void lexer_eat(lexer_t *lexer)
+{
+    token_destroy(lexer_get(lexer));
+}
+
+
+/**
+ * Ungetting the token just read from a span only steps the span back.
+ **/
+void lexer_unget(lexer_t *lexer, token_t *token)
+{
+    lexer_span_t *span;
+
+    assert(token != NULL);
+
+    if (token->type == TOKEN_NUMBER_RUN) {
+        __lexer_unget_run__(lexer, token);
+        return;
+    }
+
+    if (!array_is_empty(lexer->spans)) {
+        span = &array_cast_back(lexer_span_t, lexer->spans);
+        if (span->tokens != NULL && span->next > 0 && span->tokens[span->next - 1] == token) {
+            span->next--;
+            return;
+        }
+    }
+
+    span = array_push_back(lexer->spans);
+    span->tokens = NULL;
+    span->token = token;
+    span->next = 0;
+    span->end = 1;
+    span->array = NULL;
+    span->borrowed = false;
+    span->cached = false;
+    span->stream = false;
+    span->loc = SRCLOC_NONE;
+}
+
+
+/**
+ * Hands back the n tokens the caller did not use of those it just read,
+ * tokens[0] read next. Those taken from a span only step it back, the
+ * copies of a borrowed one are dropped for it.
+ **/
+void lexer_unget_batch(lexer_t *lexer, token_t **tokens, size_t n)
+{
+    lexer_span_t *span;
+
+    if (n == 0) {
+        return;
+    }
+
+    if (!array_is_empty(lexer->spans)) {
+        span = &array_cast_back(lexer_span_t, lexer->spans);
+        if (span->tokens != NULL && span->next >= n &&
+            span->tokens[span->next - 1] == tokens[n - 1] &&
+            span->tokens[span->next - n] == tokens[0]) {
+            span->next -= n;
+            return;
+        }
+
+        if (span->tokens != NULL && span->borrowed && span->next >= n &&
+            __lexer_is_copy__(span, span->tokens[span->next - 1], tokens[n - 1]) &&
+            __lexer_is_copy__(span, span->tokens[span->next - n], tokens[0])) {
+            span->next -= n;
+            while (n > 0) {
+                token_destroy(tokens[--n]);
+            }
+            return;
+        }
+    }
+
+    while (n > 0) {
+        lexer_unget(lexer, tokens[--n]);
+    }
+}
+
+
+/**
+ * Hands the whole array back in one go, its first token is read next.
+ * The lexer takes the array, not the tokens: they go to whoever reads
+ * them, as ever.
+ **/
+void lexer_unget_tokens(lexer_t *lexer, array_t *tokens)
+{
+    lexer_span_t *span;
+
+    if (array_is_empty(tokens)) {
+        array_destroy(tokens);
+        return;
+    }
+
+    span = array_push_back(lexer->spans);
+    span->tokens = array_prototype(tokens, token_t*);
+    span->token = NULL;
+    span->next = 0;
+    span->end = array_length(tokens);
+    span->array = tokens;
+    span->borrowed = false;
+    span->cached = false;
+    span->stream = false;
+    span->loc = SRCLOC_NONE;
+}
+
+
+/**
+ * Hands back n tokens that stay the caller's, to be read as copies. They
+ * must be left as they are until the span is read through.
+ **/
+void lexer_unget_borrowed(lexer_t *lexer, token_t **tokens, size_t n)
+{
+    lexer_span_t *span;
+
+    if (n == 0) {
+        return;
+    }
+
+    span = array_push_back(lexer->spans);
+    span->tokens = tokens;
+    span->token = NULL;
+    span->next = 0;
+    span->end = n;
+    span->array = NULL;
+    span->borrowed = true;
+    span->cached = false;
+    span->stream = false;
+    span->loc = SRCLOC_NONE;
+}
+
+
+/**
+ * Like lexer_push() of a file, but its tokens come from the cache when
+ * the same text was lexed before, and go into it when not. The file is
+ * loaded all the same, for its hash and its lines, only the lexing is
+ * saved. A file whose lexing has anything to report, in groups the
+ * preprocessor may skip as well, is not cached but lexed as usual.
+ **/
+bool lexer_push_cached(lexer_t *lexer, tokcache_t *cache, const unsigned char *fn)
+{
+    srcfile_t *file;
+    array_t *tokens;
+    unsigned flags = 0;
+
+    file = srcpool_load(lexer->reader->srcpool, (const char *) fn);
+    if (file == NULL || file->windowed) {
+        return lexer_push(lexer, STREAM_TYPE_FILE, fn);
+    }
+
+    if (lexer->trivia) {
+        flags |= TOKCACHE_TRIVIA;
+    }
+
+    if (option_get(prepass)) {
+        flags |= TOKCACHE_PREPASS;
+    }
+
+    if (option_get(reserve_comment)) {
+        flags |= TOKCACHE_RESERVE_COMMENT;
+    }
+
+    tokens = tokcache_find(cache, file->text, file->length, flags);
+    stats_count(tokens != NULL ? STATS_TOKCACHE_HITS : STATS_TOKCACHE_MISSES);
+
+    if (tokens == NULL) {
+        if (!lexer_push(lexer, STREAM_TYPE_FILE, fn)) {
+            return false;
+        }
+
+        tokens = __lexer_record__(lexer);
+        if (tokens == NULL ||
+            (tokens = tokcache_add(cache, file->text, file->length, flags, tokens)) == NULL) {
+            return lexer_push(lexer, STREAM_TYPE_FILE, fn);
+        }
+    }
+
+    lexer_replay(lexer, array_prototype(tokens, token_t*), array_length(tokens),
+                 srcloc_add_buffer(cspool_push_cs(lexer->reader->cspool, cstring_new((const char *) fn)),
+                                   file->lines, file->length));
+
+    /* where the file leaves the lexer, after its TOKEN_EOF */
+    lexer->begin_of_line = true;
+    return true;
+}
+
+
+/**
+ * Reads the n templates of lexer_record_line() next as the tokens of the
+ * buffer placed at loc: copies, each at loc plus its offset and named in
+ * the identtab_t as if just lexed. They stay the caller's and must be
+ * left as they are until read through.
+ **/
+void lexer_replay(lexer_t *lexer, token_t **tokens, size_t n, srcloc_t loc)
+{
+    lexer_span_t *span;
+
+    if (n == 0) {
+        return;
+    }
+
+    lexer_unget_borrowed(lexer, tokens, n);
+
+    span = &array_cast_back(lexer_span_t, lexer->spans);
+    span->cached = true;
+    span->stream = false;
+    span->loc = loc;
+}
+
+
+/**
+ * The span of lexer_replay() read next, unless something was handed back
+ * in front of it or stashed, those read through aside.
+ **/
+static inline
+lexer_span_t* __lexer_replay_span__(lexer_t *lexer)
+{
+    lexer_span_t *spans;
+    size_t i;
+
+    spans = array_prototype(lexer->spans, lexer_span_t);
+
+    for (i = array_length(lexer->spans); i-- > 0; ) {
+        if (spans[i].stream && !__lexer_streaming__(lexer, &spans[i])) {
+            continue;
+        }
+
+        if (spans[i].tokens == NULL || spans[i].cached) {
+            return spans[i].cached ? &spans[i] : NULL;
+        }
+
+        if (spans[i].next < spans[i].end) {
+            return NULL;
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Where the reading of the templates of lexer_replay() stands: the next
+ * to be read, one past the last once all were, NULL when anything else
+ * comes before it.
+ **/
+token_t** lexer_replay_cursor(lexer_t *lexer)
+{
+    lexer_span_t *span = __lexer_replay_span__(lexer);
+
+    return span != NULL ? span->tokens + span->next : NULL;
+}
+
+
+/**
+ * Skips the templates of lexer_replay() forward to cursor, one of theirs
+ * at or past lexer_replay_cursor(), those in between are never read.
+ **/
+void lexer_replay_seek(lexer_t *lexer, token_t **cursor)
+{
+    lexer_span_t *span = __lexer_replay_span__(lexer);
+
+    assert(span != NULL);
+    assert(span->tokens + span->next <= cursor && cursor <= span->tokens + span->end);
+
+    span->next = (size_t) (cursor - span->tokens);
+}
+
+
+bool lexer_try(lexer_t *lexer, token_type_t tt)
+{
+    token_t *token = lexer_get(lexer);
+
+    if (token->type == tt) {
+        token_destroy(token);
+        return true;
+    }
+
+    lexer_unget(lexer, token);
+    return false;
+}
+
+
+bool lexer_is_empty(lexer_t *lexer)
+{
+    return lexer_peek(lexer)->type == TOKEN_END;
+}
+
+
+/**
+ * Skips to the next '#' that begins a line, which is read next, for the
+ * groups of a false #if. The tokens handed back are read through, the
+ * streams are left to reader_skip_to_hash() so that what is passed over
+ * is never made into tokens. False at the end of the input or a stash,
+ * whose token is read next.
+ **/
+bool lexer_skip_to_directive(lexer_t *lexer)
+{
+    lexer_span_t *span;
+    token_t *token;
+
+    while (!array_is_empty(lexer->spans)) {
+        span = &array_cast_back(lexer_span_t, lexer->spans);
+
+        if (__lexer_streaming__(lexer, span)) {
+            break;
+        }
+
+        if (span->tokens == NULL && span->token == NULL && !span->stream) {
+            return false;
+        }
+
+        token = lexer_get(lexer);
+
+        if (token->type == TOKEN_EOF || token->type == TOKEN_END ||
+            (token->type == TOKEN_HASH && token->begin_of_line)) {
+            lexer_unget(lexer, token);
+            return token->type == TOKEN_HASH;
+        }
+
+        token_destroy(token);
+    }
+
+    /* what was lexed ahead is passed over as tokens */
+    while (lexer->pipe != NULL && (token = __lexer_piped__(lexer)) != NULL) {
+        if (token->type == TOKEN_HASH && token->begin_of_line) {
+            lexer_unget(lexer, token);
+            return true;
+        }
+    }
+
+    if (!reader_skip_to_hash(lexer->reader, lexer->begin_of_line)) {
+        return false;
+    }
+
+    lexer->begin_of_line = true;
+    return true;
+}
+
+
+/**
+ * A copy of a borrowed token. One from the cache is placed in the file it
+ * is replayed for, and named in the identtab_t as if it was just lexed.
+ **/
+static
+token_t* __lexer_copy_borrowed__(lexer_t *lexer, lexer_span_t *span, token_t *token)
+{
+    token_t *copy = token_instance(token);
+    const unsigned char *s;
+    size_t n;
+
+    if (span->cached) {
+        copy->loc = span->loc != SRCLOC_NONE ? span->loc + copy->loc : SRCLOC_NONE;
+
+        if (copy->type == TOKEN_IDENTIFIER) {
+            s = token_spelling(copy, &n);
+            __lexer_name_identifier__(lexer, copy, s, n);
+        }
+    }
+
+    return copy;
+}
+
+
+/**
+ * Whether copy is the one __lexer_copy_borrowed__() made of token, as far
+ * as a batch handed back straight away can tell.
+ **/
+static
+bool __lexer_is_copy__(lexer_span_t *span, token_t *token, token_t *copy)
+{
+    srcloc_t loc = token->loc;
+
+    if (span->cached) {
+        loc = span->loc != SRCLOC_NONE ? span->loc + loc : SRCLOC_NONE;
+    }
+
+    return copy != token && copy->type == token->type && copy->loc == loc &&
+           copy->spaces == token->spaces && copy->hideset == token->hideset;
+}
+
+
+/**
+ * Lexes the file just pushed up to its TOKEN_EOF, that one included, into
+ * templates for the cache. NULL if there was anything to report.
+ **/
+static
+array_t* __lexer_record__(lexer_t *lexer)
+{
+    array_t *tokens;
+    bool ok = true;
+
+    tokens = array_create_n(sizeof(token_t*), 256);
+
+    /* through to the end all the same, the file is read again after */
+    for (;;) {
+        ok = lexer_record_line(lexer, tokens) && ok;
+
+        if (array_cast_back(token_t*, tokens)->type != TOKEN_NEWLINE) {
+            break;
+        }
+    }
+
+    if (!ok) {
+        tokens_free(tokens);
+        return NULL;
+    }
+
+    return tokens;
+}
+
+
+/**
+ * Lexes the current stream to the end of the line, its TOKEN_NEWLINE or
+ * TOKEN_EOF included, into templates appended to tokens: each a copy of
+ * its own, located at its offset into the stream and named in no
+ * identtab_t. A header name is scanned after #include, as the
+ * preprocessor would ask for it. It is lexed speculatively, as a skipped
+ * group is, and false is returned if there was anything to report.
+ **/
+bool lexer_record_line(lexer_t *lexer, array_t *tokens)
+{
+    token_t *token, *copy;
+    const unsigned char *spelling;
+    size_t suppressed, reader_suppressed, n;
+    bool speculative, hash = false, include = false, ok;
+    srcloc_t base;
+
+    base = reader_loc(lexer->reader);
+    base = base != SRCLOC_NONE ? base - (srcloc_t) reader_offset(lexer->reader) : SRCLOC_NONE;
+
+    speculative = lexer->speculative;
+    suppressed = lexer->suppressed;
+    reader_suppressed = lexer->reader->suppressed;
+
+    lexer->speculative = true;
+    reader_set_speculative(lexer->reader, true);
+
+    for (;;) {
+        token = include ? __lexer_scan_header_name__(lexer) : lexer_scan(lexer);
+
+        if (token->type != TOKEN_SPACE && token->type != TOKEN_COMMENT) {
+            spelling = token_spelling(token, &n);
+
+            include = hash && token->type == TOKEN_IDENTIFIER &&
+                      n == 7 && memcmp(spelling, "include", 7) == 0;
+            hash = token->type == TOKEN_HASH && token->begin_of_line;
+        }
+
+        /* the offset into the file, whatever range a replay puts it in */
+        copy = token_copy(token);
+        copy->loc = token->loc != SRCLOC_NONE ? token->loc - base : 0;
+        copy->ident = NULL;
+        token_destroy(token);
+
+        array_cast_append(token_t*, tokens, copy);
+
+        if (copy->type == TOKEN_NEWLINE || copy->type == TOKEN_EOF || copy->type == TOKEN_END) {
+            break;
+        }
+    }
+
+    lexer->speculative = speculative;
+    reader_set_speculative(lexer->reader, speculative);
+
+    ok = lexer->suppressed == suppressed && lexer->reader->suppressed == reader_suppressed;
+
+    lexer->suppressed = suppressed;
+    lexer->reader->suppressed = reader_suppressed;
+
+    return ok;
+}
+
+
+/**
+ * From here on only the tokens ungot after the stash are read, then
+ * TOKEN_END, until lexer_unstash(). Whatever of them is left unread by
+ * then is dropped.
+ **/
+void lexer_stash(lexer_t *lexer)
+{
+    lexer_span_t *span;
+
+    span = array_push_back(lexer->spans);
+    span->tokens = NULL;
+    span->token = NULL;
+    span->next = 0;
+    span->end = 0;
+    span->array = NULL;
+    span->borrowed = false;
+    span->cached = false;
+    span->stream = false;
+    span->loc = SRCLOC_NONE;
+}
+
+
+void lexer_unstash(lexer_t *lexer)
+{
+    lexer_span_t *span;
+
+    for (;;) {
+        assert(!array_is_empty(lexer->spans));
+
+        span = &array_cast_back(lexer_span_t, lexer->spans);
+        if (span->tokens == NULL && span->token == NULL && !span->stream) {
+            array_pop_back(lexer->spans);
+            return;
+        }
+
+        __lexer_drop_span__(lexer);
+    }
+}
+
+
+/**
+ * Scans the current stream to its end, which pops it, and returns its
+ * tokens without the TOKEN_EOF. A big file is lexed in parallel chunks
+ * first, the outcome is the same as scanning it token by token.
+ **/
+array_t* lexer_tokenize(lexer_t *lexer)
+{
+    array_t *tokens;
+    token_t *token;
+    const unsigned char *rest;
+    size_t n;
+
+    tokens = array_create_n(sizeof(token_t*), 256);
+
+    n = reader_peek_rest(lexer->reader, &rest);
+    if (lexer->arena != NULL && n >= LEXER_PARALLEL_MIN &&
+        !__lexer_tokenize_parallel__(lexer, tokens, rest, rest + n)) {
+        return tokens;
+    }
+
+    for (;;) {
+        token = lexer_scan(lexer);
+        if (token->type == TOKEN_EOF || token->type == TOKEN_END) {
+            token_destroy(token);
+            break;
+        }
+        array_cast_append(token_t*, tokens, token);
+    }
+
+    return tokens;
+}
+
+
+/**
+ * lexer_tokenize() laid out as a tokbuf_t. The tokens stay in the lexer
+ * for whatever the side table points at.
+ **/
+tokbuf_t* lexer_tokenize_compact(lexer_t *lexer)
+{
+    tokbuf_t *tb;
+    array_t *tokens;
+    const unsigned char *text;
+    size_t length;
+
+    length = reader_text(lexer->reader, &text);
+
+    tb = tokbuf_create(text, length);
+    tokens = lexer_tokenize(lexer);
+
+    if (!tokbuf_push_tokens(tb, tokens)) {
+        tokbuf_destroy(tb);
+        tb = NULL;
+    }
+
+    array_destroy(tokens);
+    return tb;
+}
+
+
+/**
+ * Lexes [begin, end) of the current stream in chunks of whole lines,
+ * then takes them in order: a chunk is kept if the one before it ended
+ * cleanly right at its start, as far as it got without a comment left
+ * open or anything else to report. From there the real stream goes on one
+ * token at a time until it is back on a chunk boundary. Returns false if
+ * that ran into the end of the stream.
+ **/
+static
+bool __lexer_tokenize_parallel__(lexer_t *lexer, array_t *tokens,
+                                 const unsigned char *begin, const unsigned char *end)
+{
+    lexer_chunk_t chunks[LEXER_PARALLEL_JOBS];
+    const unsigned char *last, *p, *q, *pos;
+    size_t size, n, i;
+
+    /* the chunks end right after a '\n', the tail is left to lexer_scan */
+    for (last = end; last > begin && last[-1] != '\n'; last--) {
+        continue;
+    }
+
+    size = (last - begin) / LEXER_PARALLEL_JOBS;
+
+    for (n = 0, p = begin; n < LEXER_PARALLEL_JOBS && p < last; n++, p = q) {
+        lexer_chunk_t *chunk = &chunks[n];
+
+        q = n == LEXER_PARALLEL_JOBS - 1 || size > (size_t) (last - p) ?
+            last : scan_find(p + size, last, '\n', '\n', '\n', '\n');
+        q = q < last ? q + 1 : last;
+
+        chunk->begin = p;
+        chunk->end = q;
+        chunk->stop = p;
+        chunk->tokens = array_create_n(sizeof(token_t*), 256);
+        chunk->kept = 0;
+        chunk->ok = false;
+
+        chunk->lexer = lexer_create();
+        chunk->lexer->trivia = lexer->trivia;
+        chunk->lexer->begin_of_line = p == begin ? lexer->begin_of_line : true;
+        chunk->lexer->speculative = true;
+        reader_set_speculative(chunk->lexer->reader, true);
+        reader_push_range(chunk->lexer->reader, lexer->reader, p, q);
+
+        chunk->running = thread_create(&chunk->thread, __lexer_chunk_worker__, chunk);
+    }
+
+    for (i = 0; i < n; i++) {
+        if (chunks[i].running) {
+            thread_join(&chunks[i].thread);
+        } else {
+            __lexer_chunk_worker__(&chunks[i]);
+        }
+    }
+
+    pos = begin;
+
+    for (i = 0; i < n; i++) {
+        lexer_chunk_t *chunk = &chunks[i];
+
+        if (pos == NULL || chunk->begin < pos) {
+            continue;
+        }
+
+        if (chunk->kept > 0) {
+            token_t **chunk_tokens;
+            size_t j, length;
+
+            /* the tokens and their arena now belong to the lexer */
+            array_pop_back_n(chunk->tokens, array_length(chunk->tokens) - chunk->kept);
+            array_foreach(chunk->tokens, chunk_tokens, j) {
+                chunk_tokens[j]->arena = lexer->arena;
+
+                /* the table is not shared with the workers */
+                if (lexer->idents && chunk_tokens[j]->type == TOKEN_IDENTIFIER) {
+                    __lexer_name_identifier__(lexer, chunk_tokens[j],
+                                              token_spelling(chunk_tokens[j], &length), length);
+                }
+            }
+
+            arena_absorb(lexer->arena, chunk->lexer->arena);
+            chunk->lexer->clean_arena = false;
+            array_extend(tokens, chunk->tokens);
+        }
+
+        pos = chunk->stop;
+        if (chunk->ok) {
+            continue;
+        }
+
+        reader_seek(lexer->reader, pos);
+        if (pos != begin) {
+            lexer->begin_of_line = true;
+        }
+
+        pos = __lexer_resync__(lexer, tokens, chunks, n, i);
+    }
+
+    for (i = 0; i < n; i++) {
+        lexer_destroy(chunks[i].lexer);
+        array_destroy(chunks[i].tokens);
+    }
+
+    if (pos != NULL) {
+        reader_seek(lexer->reader, pos);
+        if (pos != begin) {
+            lexer->begin_of_line = true;
+        }
+    }
+
+    return pos != NULL;
+}
+
+
+/**
+ * Scans the real stream from inside chunks[i] on until a newline
+ * leaves it at the start of a later chunk, or past the start of the last
+ * one. Returns where it stopped, NULL at the end of the stream.
+ **/
+static
+const unsigned char* __lexer_resync__(lexer_t *lexer, array_t *tokens,
+                                      lexer_chunk_t *chunks, size_t n, size_t i)
+{
+    const unsigned char *cursor;
+    token_t *token;
+
+    for (;;) {
+        token = lexer_scan(lexer);
+        if (token->type == TOKEN_EOF) {
+            token_destroy(token);
+            return NULL;
+        }
+
+        array_cast_append(token_t*, tokens, token);
+
+        if (token->type != TOKEN_NEWLINE ||
+            (cursor = reader_cursor(lexer->reader)) == NULL) {
+            continue;
+        }
+
+        while (i < n && chunks[i].begin < cursor) {
+            i++;
+        }
+
+        if (i == n || chunks[i].begin == cursor) {
+            return cursor;
+        }
+    }
+}
+
+
+static
+void __lexer_chunk_worker__(void *ud)
+{
+    lexer_chunk_t *chunk = (lexer_chunk_t *) ud;
+    lexer_t *lexer = chunk->lexer;
+    const unsigned char *cursor;
+    token_t *token;
+
+    for (;;) {
+        token = lexer_scan(lexer);
+
+        /* the line with anything to report is read again for real */
+        if (lexer->suppressed != 0 || lexer->reader->suppressed != 0) {
+            return;
+        }
+
+        if (token->type == TOKEN_EOF) {
+            break;
+        }
+
+        array_cast_append(token_t*, chunk->tokens, token);
 
-    pfree(lexer);
+        if (token->type == TOKEN_NEWLINE &&
+            (cursor = reader_cursor(lexer->reader)) != NULL) {
+            chunk->stop = cursor;
+            chunk->kept = array_length(chunk->tokens);
+        }
+    }
+
+    chunk->stop = chunk->end;
+    chunk->kept = array_length(chunk->tokens);
+    chunk->ok = true;
 }
 
 
-token_t* lexer_scan(lexer_t *lexer)
+static inline
+void __lexer_drop_span__(lexer_t *lexer)
 {
-    int ch;
-    token_t *token;
+    lexer_span_t *span = &array_cast_back(lexer_span_t, lexer->spans);
 
-    if (reader_is_empty(lexer->reader)) {
-        return token_create(TOKEN_END, NULL, NULL);
+    if (span->array != NULL) {
+        array_destroy(span->array);
     }
 
-    token = token_create(TOKEN_UNKNOWN, cstring_new_n(NULL, 8), NULL);
-
-    __lexer_mark_location__(lexer, token);
-
-    if (__lexer_parse_spaces__(lexer, token)) {
-        return __lexer_make_token__(lexer, token, TOKEN_SPACE);
-    }
+    array_pop_back(lexer->spans);
+}
 
-    ch = reader_get(lexer->reader);
-    switch (ch) {
-    case '\n':
-        return __lexer_make_token__(lexer, token, TOKEN_NEWLINE);
-    case '[':
-        return __lexer_make_token__(lexer, token, TOKEN_L_SQUARE);
-    case ']':
-        return __lexer_make_token__(lexer, token, TOKEN_R_SQUARE);
-    case '(':
-        return __lexer_make_token__(lexer, token, TOKEN_L_PAREN);
-    case ')':
-        return __lexer_make_token__(lexer, token, TOKEN_R_PAREN);
-    case '{':
-        return __lexer_make_token__(lexer, token, TOKEN_L_BRACE);
-    case '}':
-        return __lexer_make_token__(lexer, token, TOKEN_R_BRACE);
-    case '.':
-        if (ISDIGIT(reader_peek(lexer->reader))) {
-            return __lexer_parse_number__(lexer, token, ch);
-        }
-        if (reader_try(lexer->reader, '.')) {
-            if (reader_try(lexer->reader, '.')) {
-                return __lexer_make_token__(lexer, token, TOKEN_ELLIPSIS);
-            }
 
-            reader_unget(lexer->reader, '.');
-            return __lexer_make_token__(lexer, token, TOKEN_PERIOD);
-        }
-        return __lexer_make_token__(lexer, token, TOKEN_PERIOD);
-    case '&':
-        if (reader_try(lexer->reader, '&')) {
-            return __lexer_make_token__(lexer, token, TOKEN_AMPAMP);
-        }
-        if (reader_try(lexer->reader, '=')) {
-            return __lexer_make_token__(lexer, token, TOKEN_AMPEQUAL);
-        }
-        return __lexer_make_token__(lexer, token, TOKEN_AMP);
-    case '*':
-        return __lexer_make_token__(lexer, token, reader_try(lexer->reader, '=') ?
-                                                  TOKEN_STAREQUAL : TOKEN_STAR);
-    case '+':
-        if (reader_try(lexer->reader, '+'))	{
-            return __lexer_make_token__(lexer, token, TOKEN_PLUSPLUS);
-        }
-        if (reader_try(lexer->reader, '=')) {
-            return __lexer_make_token__(lexer, token, TOKEN_PLUSEQUAL);
-        }
-        return __lexer_make_token__(lexer, token, TOKEN_PLUS);
-    case '-':
-        if (reader_try(lexer->reader, '>')) {
-            return __lexer_make_token__(lexer, token, TOKEN_ARROW);
-        }
-        if (reader_try(lexer->reader, '-')) {
-            return __lexer_make_token__(lexer, token, TOKEN_MINUSMINUS);
-        }
-        if (reader_try(lexer->reader, '=')) {
-            return __lexer_make_token__(lexer, token, TOKEN_MINUSEQUAL);
-        }
-        return __lexer_make_token__(lexer, token, TOKEN_MINUS);
-    case '~':
-        return __lexer_make_token__(lexer, token, TOKEN_TILDE);
-    case '!':
-        return __lexer_make_token__(lexer, token, reader_try(lexer->reader, '=') ?
-                                                  TOKEN_EXCLAIM : TOKEN_EXCLAIMEQUAL);
-    case '/':
-        if (reader_test(lexer->reader, '/') || reader_test(lexer->reader, '*')) {
-            return __lexer_parse_comment__(lexer, token);
-        }
-        return __lexer_make_token__(lexer, token, reader_try(lexer->reader, '=') ?
-                                                  TOKEN_SLASHEQUAL : TOKEN_SLASH);
-    case '%':
-        if (reader_try(lexer->reader, '=')) {
-            return __lexer_make_token__(lexer, token, TOKEN_PERCENTEQUAL);
-        }
-        if (reader_try(lexer->reader, '>')) {
-            return __lexer_make_token__(lexer, token, TOKEN_R_BRACE);
-        }
-        if (reader_try(lexer->reader, ':')) {
-            if (reader_try(lexer->reader, '%')) {
-                if (reader_try(lexer->reader, ':'))
-                    return __lexer_make_token__(lexer, token, TOKEN_HASHHASH);
-                reader_unget(lexer->reader, '%');
-            }
-            return __lexer_make_token__(lexer, token, TOKEN_HASH);
-        }
-        return __lexer_make_token__(lexer, token, TOKEN_PERCENT);
-    case '<':
-        if (reader_try(lexer->reader, '<')) {
-            return __lexer_make_token__(lexer, token, reader_try(lexer->reader, '=') ?
-                                                      TOKEN_LESSLESSEQUAL : TOKEN_LESSLESS);
-        }
-        if (reader_try(lexer->reader, '=')) {
-            return __lexer_make_token__(lexer, token, TOKEN_LESSEQUAL);
-        }
-        if (reader_try(lexer->reader, ':')) {
-            return __lexer_make_token__(lexer, token, TOKEN_L_SQUARE);
-        }
-        if (reader_try(lexer->reader, '%')) {
-            return __lexer_make_token__(lexer, token, TOKEN_L_BRACE);
-        }
-        return __lexer_make_token__(lexer, token, TOKEN_LESS);
-    case '>':
-        if (reader_try(lexer->reader, '>')) {
-            return __lexer_make_token__(lexer, token, reader_try(lexer->reader, '=') ?
-                                                      TOKEN_GREATERGREATEREQUAL : TOKEN_GREATERGREATER);
-        }
-        if (reader_try(lexer->reader, '=')) {
-            return __lexer_make_token__(lexer, token, TOKEN_GREATEREQUAL);
-        }
-        return __lexer_make_token__(lexer, token, TOKEN_GREATER);
-    case '^':
-        return __lexer_make_token__(lexer, token, reader_try(lexer->reader, '=') ?
-                                                  TOKEN_CARETEQUAL : TOKEN_CARET);
-    case '|':
-        if (reader_try(lexer->reader, '|'))
-            return __lexer_make_token__(lexer, token, TOKEN_PIPEPIPE);
-        if (reader_try(lexer->reader, '='))
-            return __lexer_make_token__(lexer, token, TOKEN_PIPEEQUAL);
-        return __lexer_make_token__(lexer, token, TOKEN_PIPE);
-    case '?':
-        return __lexer_make_token__(lexer, token, TOKEN_QUESTION);
-    case ':':
-        return __lexer_make_token__(lexer, token, reader_try(lexer->reader, '>') ?
-                                                  TOKEN_R_SQUARE : TOKEN_COLON);
-    case ';':
-        return __lexer_make_token__(lexer, token, TOKEN_SEMI);
-    case '=':
-        return __lexer_make_token__(lexer, token, reader_try(lexer->reader, '=') ?
-                                                  TOKEN_EQUALEQUAL : TOKEN_EQUAL);
-    case ',':
-        return __lexer_make_token__(lexer, token, TOKEN_COMMA);
-    case '#':
-        return __lexer_make_token__(lexer, token, reader_try(lexer->reader, '#') ?
-                                                  TOKEN_HASHHASH : TOKEN_HASH);
-    case '0': case '1': case '2': case '3': case '4': 
-    case '5': case '6': case '7': case '8': case '9':
-        return __lexer_parse_number__(lexer, token, ch);
-    case 'u': case 'U': case 'L': {
-        encoding_type_t ent = __lexer_parse_encoding__(lexer, ch);
+/**
+ * Maximal munch over the punctuator group of ch. The lookahead is read
+ * from the span without consuming it, so nothing is pushed back unless a
+ * candidate runs past the span, across a line splice for instance.
+ **/
+static inline
+token_type_t __lexer_parse_punctuator__(lexer_t *lexer, int ch)
+{
+    const punctuator_t *p;
+    const unsigned char *span;
+    size_t n, tail;
 
-        if (reader_test(lexer->reader, '\"')) {
-            __remark_location__(lexer, token);
-            reader_get(lexer->reader);
-            return __lexer_parse_string__(lexer, token, ent);
-        }
+    n = reader_peek_span(lexer->reader, &span);
 
-        if (ent != ENCODING_UTF8 && reader_test(lexer->reader, '\'')) {
-            __remark_location__(lexer, token);
-            reader_get(lexer->reader);
-            return __lexer_parse_character__(lexer, token, ent);
-        }
+    for (p = &__punctuators__[__punctuator_group__[ch]]; p->length > 1; p++) {
+        tail = p->length - 1;
 
-        if (ent == ENCODING_UTF8) {
-            reader_unget(lexer->reader, '8');
+        if (tail <= n) {
+            if (memcmp(p->spelling + 1, span, tail) == 0) {
+                reader_advance(lexer->reader, tail);
+                return p->type;
+            }
+            continue;
         }
 
-        reader_unget(lexer->reader, ch);
-        return __lexer_parse_identifier__(lexer, token);
-    }
-    case '\'':
-        return __lexer_parse_character__(lexer, token, ENCODING_NONE);
-    case '\"':
-        return __lexer_parse_string__(lexer, token, ENCODING_NONE);
-    case '\\':
-        if (reader_test(lexer->reader, 'u') || reader_test(lexer->reader, 'U'))
-            return __lexer_parse_identifier__(lexer, token);
-        return __lexer_make_token__(lexer, token, TOKEN_BACKSLASH);
-    case EOF:
-        reader_pop(lexer->reader);
-        return __lexer_make_token__(lexer, token, TOKEN_EOF);
-    default:
-        if (ISALPHA(ch) || (0x80 <= ch && ch <= 0xfd) || ch == '_' || ch == '$') {
-            reader_unget(lexer->reader, ch);
-            return __lexer_parse_identifier__(lexer, token);
+        if ((n == 0 || memcmp(p->spelling + 1, span, n) == 0) &&
+            __lexer_try_tail__(lexer, p->spelling + 1, tail)) {
+            return p->type;
         }
     }
-    
-    assert(false);
-    return NULL;
+
+    return p->type;
 }
 
 
-token_t* lexer_scan_header_name(lexer_t *lexer)
+static inline
+bool __lexer_try_tail__(lexer_t *lexer, const char *tail, size_t n)
 {
-    int ch;
-    token_t *token;
+    size_t i;
 
-    if (reader_is_empty(lexer->reader)) {
-        return token_create(TOKEN_END, NULL, NULL);
+    for (i = 0; i < n; i++) {
+        if (!reader_try(lexer->reader, tail[i])) {
+            while (i--) {
+                reader_unget(lexer->reader, tail[i]);
+            }
+            return false;
+        }
     }
 
-    ch = reader_peek(lexer->reader);
-    if (ch == '"') {
-
-    } else if (ch == '<') {
-
-    } else {
-
-    }
+    return true;
 }
 
 
@@ -291,6 +1644,19 @@ bool __lexer_parse_spaces__(lexer_t *lexer, token_t *token)
     int ch;
 
     for (;;) {
+        const unsigned char *span;
+        size_t n, i;
+
+        n = reader_peek_span(lexer->reader, &span);
+        if (n > 0) {
+            i = scan_skip_blank(span, span + n) - span;
+            reader_advance(lexer->reader, i);
+            token->spaces += i;
+            if (i < n) {
+                break;
+            }
+        }
+
         ch = reader_peek(lexer->reader);
         if (!ISSPACE(ch) || ch == '\n' || ch == EOF) {
             break;
@@ -306,10 +1672,13 @@ bool __lexer_parse_spaces__(lexer_t *lexer, token_t *token)
 static inline
 token_t* __lexer_parse_comment__(lexer_t *lexer, token_t *token)
 {
+    /* the text is of no use when the comment is folded into spaces */
+    bool reserve = lexer->trivia && option_get(reserve_comment);
+
 #undef  RESERVE_COMMENT
 #define RESERVE_COMMENT(ch)                                 \
     do {                                                    \
-        if (option_get(reserve_comment)) {                  \
+        if (reserve) {                                      \
             token->cs = cstring_push_ch(token->cs, ch);     \
         }                                                   \
     } while(false)
@@ -322,34 +1691,91 @@ token_t* __lexer_parse_comment__(lexer_t *lexer, token_t *token)
         RESERVE_COMMENT('/');
 
         while (!reader_is_empty(lexer->reader)) {
+            const unsigned char *span;
+            size_t n;
+
+            /* a line comment swallows everything up to the line break */
+
+            n = reader_get_span(lexer->reader, &span);
+            if (n > 0 && reserve) {
+                token->cs = cstring_concat_n(token->cs, span, n);
+            }
+
             if (reader_peek(lexer->reader) == '\n') {
-                return __lexer_make_token__(lexer, token, TOKEN_COMMENT);
+                return __lexer_make_comment__(lexer, token);
             }
             ch = reader_get(lexer->reader);
 
             RESERVE_COMMENT(ch);
         }
+
+        return __lexer_make_comment__(lexer, token);
+
     } else if (reader_try(lexer->reader, '*')) {
-        int ch;
+        int ch, prev = '\0';
 
         RESERVE_COMMENT('*');
 
-        while ((ch = reader_get(lexer->reader)) != EOF) {
+        for (;;) {
+            const unsigned char *span, *q;
+            size_t n;
+
+            /**
+             * Look for the '/' of the terminator rather than for '*',
+             * doc comments are full of stars but hardly have slashes.
+             * prev is the byte before the span, never the opening '*'.
+             **/
+
+            n = reader_peek_block(lexer->reader, &span);
+            if (n > 0) {
+                q = scan_find(span, span + n, '/', '/', '/', '/');
+                while (q < span + n && (q > span ? q[-1] : prev) != '*') {
+                    q = scan_find(q + 1, span + n, '/', '/', '/', '/');
+                }
+
+                if (q < span + n) {
+                    n = q + 1 - span;
+                    if (reserve) {
+                        token->cs = cstring_concat_n(token->cs, span, n);
+                    }
+                    reader_advance(lexer->reader, n);
+                    return __lexer_make_comment__(lexer, token);
+                }
+
+                if (reserve) {
+                    token->cs = cstring_concat_n(token->cs, span, n);
+                }
+                prev = span[n - 1];
+                reader_advance(lexer->reader, n);
+            }
+
+            if ((ch = reader_get(lexer->reader)) == EOF) {
+                break;
+            }
+
             RESERVE_COMMENT(ch);
 
+            if (ch == '/' && prev == '*') {
+                return __lexer_make_comment__(lexer, token);
+            }
+
             if (ch == '*' && reader_try(lexer->reader, '/')) {
                 RESERVE_COMMENT('/');
-                return __lexer_make_token__(lexer, token, TOKEN_COMMENT);
+                return __lexer_make_comment__(lexer, token);
             }
+
+            prev = ch;
         }
 
         /* Wrong, but make it look normal. */
 
-        token_add_linenote_caution(token, token->location.column, 2);
+        if (!lexer->speculative) {
+            token_add_linenote_caution(token, token_column(token), 2);
+        }
 
-        errorf_with_token(token, "unterminated comment");
+        __lexer_error__(lexer, token, "unterminated comment");
 
-        return __lexer_make_token__(lexer, token, TOKEN_COMMENT);
+        return __lexer_make_comment__(lexer, token);
     }
 
     assert(false);
@@ -360,7 +1786,8 @@ token_t* __lexer_parse_comment__(lexer_t *lexer, token_t *token)
 
 
 static inline
-token_t* __lexer_parse_number__(lexer_t *lexer, token_t *token, int ch)
+token_t* __lexer_parse_number__(lexer_t *lexer, token_t *token, int ch,
+                                const unsigned char *head)
 {
 #undef  VALID_SIGN
 #define VALID_SIGN(c, prevc) \
@@ -368,15 +1795,44 @@ token_t* __lexer_parse_number__(lexer_t *lexer, token_t *token, int ch)
    ((prevc) == 'e' || (prevc) == 'E' \
     || (((prevc) == 'p' || (prevc) == 'P') )))
 
+#undef  NUMBER_CHAR
+#define NUMBER_CHAR(c, prevc) \
+  (ISIDNUM(c) || (c) == '.' || VALID_SIGN(c, prevc) || (c) == '\'')
+
     /* lexer's grammar on numbers is not strict. */
 
     int prev = -1;
 
-    token->cs = cstring_concat_ch(token->cs, ch);
+    if (head != NULL) {
+        const unsigned char *span, *cursor;
+        size_t n, i;
+
+        /* the whole number usually sits in one span, slice it out */
+
+        n = reader_peek_span(lexer->reader, &span);
+        for (i = 0; i < n && NUMBER_CHAR(span[i], prev); i++) {
+            prev = span[i];
+        }
+        reader_advance(lexer->reader, i);
+
+        cursor = reader_cursor(lexer->reader);
+        ch = reader_peek(lexer->reader);
+        if (!NUMBER_CHAR(ch, prev)) {
+            if (lexer->runs && !lexer->speculative && !lexer->trivia) {
+                return __lexer_parse_run__(lexer, token, head, cursor - head);
+            }
+            return __lexer_make_slice__(lexer, token, TOKEN_NUMBER, head, cursor - head);
+        }
+
+        token->cs = cstring_concat_n(token->cs, head, cursor - head);
+
+    } else {
+        token->cs = cstring_concat_ch(token->cs, ch);
+    }
 
     for (;;) {
         ch = reader_peek(lexer->reader);
-        if (!(ISIDNUM(ch) || ch == '.' || VALID_SIGN(ch, prev) || ch == '\'')) {
+        if (!NUMBER_CHAR(ch, prev)) {
             break;
         }
 
@@ -388,11 +1844,208 @@ token_t* __lexer_parse_number__(lexer_t *lexer, token_t *token, int ch)
     }
 
     return __lexer_make_token__(lexer, token, TOKEN_NUMBER);
+}
+
+
+/**
+ * The number of n bytes at head just sliced out, or with at least
+ * LEXER_RUN_MIN integers in all the rest of a run that follows it in the
+ * span: a comma and an integer at a time, with spaces around the commas
+ * only. The run stops short of anything else, a number that is not a
+ * plain integer or does not fit in 64 bits, or one that may go on past
+ * the span into a splice, and those are scanned as ever.
+ **/
+static
+token_t* __lexer_parse_run__(lexer_t *lexer, token_t *token, const unsigned char *head, size_t n)
+{
+    const unsigned char *span, *rest, *p, *q, *pe, *number;
+    token_run_t *run;
+    uint64_t value;
+    size_t length;
+    bool whole;
+    int prev;
+
+    length = reader_peek_span(lexer->reader, &span);
+
+    /* most numbers are not in a table, a glance tells them */
+    if (length == 0 || (span[0] != ',' && span[0] != ' ') ||
+        !__lexer_decode_integer__(head, head + n, &value)) {
+        return __lexer_make_slice__(lexer, token, TOKEN_NUMBER, head, n);
+    }
+
+    /* a number the span ends in is whole if its line or a clean stream does */
+    whole = reader_peek_rest(lexer->reader, &rest) == length ||
+            (rest != NULL && (span[length] == '\n' || span[length] == '\r'));
+
+    array_clear(lexer->values);
+    array_cast_append(uint64_t, lexer->values, value);
+
+    for (p = span, pe = span + length; ; p = q) {
+        for (q = p; q < pe && *q == ' '; q++) ;
+        if (q == pe || *q++ != ',') {
+            break;
+        }
+
+        for (; q < pe && *q == ' '; q++) ;
+        if (q == pe || !ISDIGIT(*q)) {
+            break;
+        }
+
+        for (number = q, prev = -1; q < pe && NUMBER_CHAR(*q, prev); q++) {
+            prev = *q;
+        }
+
+        if ((q == pe && !whole) || !__lexer_decode_integer__(number, q, &value)) {
+            break;
+        }
+
+        array_cast_append(uint64_t, lexer->values, value);
+    }
+
+    if (array_length(lexer->values) < LEXER_RUN_MIN) {
+        return __lexer_make_slice__(lexer, token, TOKEN_NUMBER, head, n);
+    }
+
+    run = (token_run_t *) arena_alloc(lexer->arena,
+        sizeof(token_run_t) + array_length(lexer->values) * sizeof(uint64_t));
+    run->length = array_length(lexer->values);
+    run->values = (uint64_t *) (run + 1);
+    run->loc = reader_loc(lexer->reader) - (srcloc_t) n;
+    memcpy(run->values, array_prototype(lexer->values, uint64_t), run->length * sizeof(uint64_t));
+
+    reader_advance(lexer->reader, (size_t) (p - span));
 
+    token->run = run;
+    stats_count(STATS_NUMBER_RUNS);
+    return __lexer_make_slice__(lexer, token, TOKEN_NUMBER_RUN, head, (size_t) (p - head));
+
+#undef  NUMBER_CHAR
 #undef  VALID_SIGN
 }
 
 
+/**
+ * The value of the n bytes from s as an integer constant, in the radix
+ * of its prefix and with any of its suffixes, as #if reads it. False for
+ * a floating constant, digit separators, a bad digit, or one too big.
+ **/
+static
+bool __lexer_decode_integer__(const unsigned char *s, const unsigned char *end, uint64_t *value)
+{
+    const unsigned char *digits;
+    unsigned int radix = 10, d;
+    bool is_unsigned = false;
+    size_t longs = 0;
+    uint64_t v = 0;
+
+    if (end - s > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+        radix = 16, s += 2;
+    } else if (end - s > 2 && s[0] == '0' && (s[1] == 'b' || s[1] == 'B')) {
+        radix = 2, s += 2;
+    } else if (s < end && s[0] == '0') {
+        radix = 8;
+    }
+
+    for (digits = s; s < end; s++) {
+        if (*s >= '0' && *s <= '9') {
+            d = *s - '0';
+        } else if (radix == 16 && (*s | 0x20) >= 'a' && (*s | 0x20) <= 'f') {
+            d = (*s | 0x20) - 'a' + 10;
+        } else {
+            break;
+        }
+
+        if (d >= radix || v > (UINT64_MAX - d) / radix) {
+            return false;
+        }
+
+        v = v * radix + d;
+    }
+
+    if (s == digits) {
+        return false;
+    }
+
+    for (; s < end; s++) {
+        if ((*s == 'u' || *s == 'U') && !is_unsigned) {
+            is_unsigned = true;
+        } else if ((*s == 'l' || *s == 'L') && longs == 0) {
+            longs = (s + 1 < end && s[1] == s[0]) ? 2 : 1;
+            s += longs - 1;
+        } else {
+            return false;
+        }
+    }
+
+    *value = v;
+    return true;
+}
+
+
+/**
+ * Hands back the numbers and commas a TOKEN_NUMBER_RUN stands for, as
+ * they would have been scanned, and drops the run. In an arena they are
+ * slices of its spelling. A run comes from the lexer alone, it has no
+ * hideset to pass on.
+ **/
+static
+void __lexer_unget_run__(lexer_t *lexer, token_t *token)
+{
+    const unsigned char *s, *p, *q, *pe, *start;
+    token_type_t type;
+    array_t *tokens;
+    token_t *piece;
+    size_t n, length;
+
+    s = token_spelling(token, &n);
+    tokens = array_create_n(sizeof(token_t*), 2 * token->run->length);
+
+    for (p = s, pe = s + n; p < pe; p = q) {
+        for (start = p; *p == ' '; p++) ;
+
+        /* a punctuator is spelled by its type only */
+        if (*p == ',') {
+            type = TOKEN_COMMA, q = p + 1, length = 0;
+        } else {
+            for (type = TOKEN_NUMBER, q = p; q < pe && *q != ',' && *q != ' '; q++) ;
+            length = (size_t) (q - p);
+        }
+
+        if (token->arena != NULL) {
+            piece = (token_t *) arena_alloc(token->arena, sizeof(token_t));
+            piece->cs = NULL;
+            piece->arena = token->arena;
+            piece->hideset = NULL;
+            piece->run = NULL;
+            token_init(piece);
+            piece->spelling = length != 0 ? p : NULL;
+            piece->spelling_length = length;
+        } else {
+            piece = token_create(type, cstring_new_n(p, length), SRCLOC_NONE);
+        }
+
+        piece->type = type;
+        piece->caution_start = 0;
+        piece->caution_length = 0;
+
+        /* the first takes the place of the run, the others their offsets in it */
+        if (p == s) {
+            piece->loc = token->loc;
+            piece->spaces = token->spaces;
+            piece->begin_of_line = token->begin_of_line;
+        } else {
+            piece->loc = token->run->loc + (srcloc_t) (start - s);
+            piece->spaces = (size_t) (p - start);
+        }
+
+        array_cast_append(token_t*, tokens, piece);
+    }
+
+    token_destroy(token);
+    lexer_unget_tokens(lexer, tokens);
+}
+
+
 static inline
 bool __lexer_is_universal_char__(lexer_t *lexer, int ch)
 {
@@ -406,7 +2059,7 @@ int __lexer_parse_hex_escaped__(lexer_t *lexer, token_t *token)
     int hex = 0, ch = reader_peek(lexer->reader);
 
     if (!ISHEX(ch)) {
-        errorf_with_token(token, "\\x used with no following hex digits");
+        __lexer_error__(lexer, token, "\\x used with no following hex digits");
     }
 
     while (ISHEX(ch)) {
@@ -463,7 +2116,7 @@ int __lexer_parse_universal_char__(lexer_t *lexer, token_t *token, int len)
     for (i = 0; i < len; ++i) {
         ch = reader_get(lexer->reader);
         if (!ISHEX(ch)) {
-            errorf_with_token(token, "incomplete universal character name");
+            __lexer_error__(lexer, token, "incomplete universal character name");
         }
         u = (u << 4) + TODIGIT(ch);
     }
@@ -511,13 +2164,56 @@ int __lexer_parse_escaped__(lexer_t *lexer, token_t *token)
 
 
 static inline
-token_t* __lexer_parse_identifier__(lexer_t *lexer, token_t *token)
+bool __lexer_is_identifier_char__(int ch)
+{
+    return CHARCLASS_IS(ch, CHARCLASS_IDENT);
+}
+
+
+static inline
+token_t* __lexer_parse_identifier__(lexer_t *lexer, token_t *token,
+                                    const unsigned char *head)
 {
     int ch;
 
+    if (head != NULL) {
+        const unsigned char *span, *cursor;
+        size_t n, i;
+
+        /* head is where the characters already read start in the source */
+
+        n = reader_peek_span(lexer->reader, &span);
+        for (i = 0; i < n && __lexer_is_identifier_char__(span[i]); i++) {
+            continue;
+        }
+        reader_advance(lexer->reader, i);
+
+        cursor = reader_cursor(lexer->reader);
+        ch = reader_peek(lexer->reader);
+        if (!__lexer_is_identifier_char__(ch) && ch != '\\') {
+            __lexer_name_identifier__(lexer, token, head, cursor - head);
+            return __lexer_make_slice__(lexer, token, TOKEN_IDENTIFIER, head, cursor - head);
+        }
+
+        token->cs = cstring_concat_n(token->cs, head, cursor - head);
+    }
+
     for (;;) {
+        const unsigned char *span;
+        size_t n, i;
+
+        n = reader_peek_span(lexer->reader, &span);
+        for (i = 0; i < n && __lexer_is_identifier_char__(span[i]); i++) {
+            continue;
+        }
+
+        if (i > 0) {
+            token->cs = cstring_concat_n(token->cs, span, i);
+            reader_advance(lexer->reader, i);
+        }
+
         ch = reader_get(lexer->reader);
-        if (ISIDNUM(ch) || ch == '$' || (0x80 <= ch && ch <= 0xfd)) {
+        if (__lexer_is_identifier_char__(ch)) {
             token->cs = cstring_concat_ch(token->cs, ch);
             continue;
         }
@@ -531,10 +2227,24 @@ token_t* __lexer_parse_identifier__(lexer_t *lexer, token_t *token)
     }
 
     reader_unget(lexer->reader, ch);
+    __lexer_name_identifier__(lexer, token, token->cs, cstring_length(token->cs));
     return __lexer_make_token__(lexer, token, TOKEN_IDENTIFIER);
 }
 
 
+static inline
+void __lexer_name_identifier__(lexer_t *lexer, token_t *token, const unsigned char *s, size_t n)
+{
+    if (lexer->idents == NULL) {
+        token->keyword = keyword_lookup(s, n);
+        return;
+    }
+
+    token->ident = identtab_lookup(lexer->idents, s, n);
+    token->keyword = token->ident ? token->ident->keyword : keyword_lookup(s, n);
+}
+
+
 
 
 static inline
@@ -560,7 +2270,13 @@ token_t* __lexer_parse_character__(lexer_t *lexer, token_t *token, encoding_type
 
     for (; !reader_is_empty(lexer->reader) ;) {
         ch = reader_get(lexer->reader);
-        if (ch == '\'' || ch == '\n') {
+        if (ch == '\'') {
+            break;
+        }
+
+        /* the newline ends the line still, unterminated or not */
+        if (ch == '\n') {
+            reader_unget(lexer->reader, ch);
             break;
         }
 
@@ -577,9 +2293,9 @@ token_t* __lexer_parse_character__(lexer_t *lexer, token_t *token, encoding_type
     }
 
     if (ch != '\'') {
-        errorf_with_token(token, "missing terminating ' character");
+        __lexer_error__(lexer, token, "missing terminating ' character");
     } else if (cstring_length(token->cs) == 0) {
-        errorf_with_token(token, "empty character constant");
+        __lexer_error__(lexer, token, "empty character constant");
     }
    
     return __lexer_make_token__(lexer, token, ent2tokt(ent, CHAR));
@@ -589,11 +2305,43 @@ token_t* __lexer_parse_character__(lexer_t *lexer, token_t *token, encoding_type
 static inline 
 token_t* __lexer_parse_string__(lexer_t *lexer, token_t *token, encoding_type_t ent)
 {
+    const unsigned char *head;
     int ch;
 
+    head = lexer->arena != NULL ? reader_cursor(lexer->reader) : NULL;
+    if (head != NULL) {
+        const unsigned char *span;
+        size_t n, i;
+
+        /* no escapes and the closing quote in sight: slice it out */
+
+        n = reader_peek_span(lexer->reader, &span);
+        i = scan_find(span, span + n, '\"', '\\', '\"', '\"') - span;
+        if (i < n && span[i] == '\"') {
+            reader_advance(lexer->reader, i + 1);
+            return __lexer_make_slice__(lexer, token, ent2tokt(ent, STRING), head, i);
+        }
+    }
+
     for (; !reader_is_empty(lexer->reader) ;) {
+        const unsigned char *span;
+        size_t n;
+
+        n = reader_peek_span(lexer->reader, &span);
+        if (n > 0) {
+            n = scan_find(span, span + n, '\"', '\\', '\"', '\"') - span;
+            token->cs = cstring_concat_n(token->cs, span, n);
+            reader_advance(lexer->reader, n);
+        }
+
         ch = reader_get(lexer->reader);
-        if (ch == '\"' || ch == '\n') {
+        if (ch == '\"') {
+            break;
+        }
+
+        /* the newline ends the line still, unterminated or not */
+        if (ch == '\n') {
+            reader_unget(lexer->reader, ch);
             break;
         }
 
@@ -610,35 +2358,154 @@ token_t* __lexer_parse_string__(lexer_t *lexer, token_t *token, encoding_type_t
     }
 
     if (ch != '\"') {
-        errorf_with_token(token, "unterminated string literal");
+        __lexer_error__(lexer, token, "unterminated string literal");
     }
 
     return __lexer_make_token__(lexer, token, ent2tokt(ent, STRING));
 }
 
 
+static inline
+token_t* __lexer_new_token__(lexer_t *lexer)
+{
+    token_t *token;
+
+    if (lexer->arena == NULL) {
+        return token_create(TOKEN_UNKNOWN, cstring_new_n(NULL, 8), SRCLOC_NONE);
+    }
+
+    token = (token_t *) arena_alloc(lexer->arena, sizeof(token_t));
+
+    token->type = TOKEN_UNKNOWN;
+    token->keyword = TOKEN_UNKNOWN;
+    token->ident = NULL;
+    token->loc = SRCLOC_NONE;
+    token->caution_start = 0;
+    token->caution_length = 0;
+    token->hideset = NULL;
+    token->begin_of_line = false;
+    token->spaces = 0;
+    token->is_vararg = false;
+    token->arena = lexer->arena;
+    token->spelling = NULL;
+    token->spelling_length = 0;
+    token->run = NULL;
+
+    /* the text is built in the scratch string and copied out once done */
+    cstring_clear(lexer->scratch);
+    token->cs = lexer->scratch;
+
+    return token;
+}
+
+
+/**
+ * The head of a token can be sliced out of the source when the n
+ * characters read since start are exactly the n bytes there.
+ **/
+static inline
+const unsigned char* __lexer_head__(lexer_t *lexer, const unsigned char *start, size_t n)
+{
+    return start != NULL && reader_cursor(lexer->reader) == start + n ? start : NULL;
+}
+
+
+static inline
+token_t* __lexer_make_slice__(lexer_t *lexer, token_t *token, token_type_t type,
+                              const unsigned char *spelling, size_t length)
+{
+    /* nothing went into the scratch string, it stays with the lexer */
+    token->type = type;
+    __lexer_track_line__(lexer, token);
+    token->cs = NULL;
+    token->spelling = spelling;
+    token->spelling_length = length;
+    return token;
+}
+
+
 static inline
 token_t* __lexer_make_token__(lexer_t *lexer, token_t *token, token_type_t type)
 {
     token->type = type;
+    __lexer_track_line__(lexer, token);
+
+    if (token->arena != NULL) {
+        lexer->scratch = token->cs;
+        token->cs = arena_cstring(lexer->arena, lexer->scratch,
+            cstring_length(lexer->scratch));
+    }
+
     return token;
 }
 
 
+/**
+ * Without trivia a comment is one more space in front of the next token,
+ * NULL tells lexer_scan() to go on scanning into the same token.
+ **/
+static inline
+token_t* __lexer_make_comment__(lexer_t *lexer, token_t *token)
+{
+    if (lexer->trivia) {
+        return __lexer_make_token__(lexer, token, TOKEN_COMMENT);
+    }
+
+    token->spaces++;
+    return NULL;
+}
+
+
+/**
+ * begin_of_line holds until the first token that is neither trivia nor
+ * a line break. A TOKEN_END, of a stash as well, leaves it be.
+ **/
+static inline
+void __lexer_track_line__(lexer_t *lexer, token_t *token)
+{
+    token->begin_of_line = lexer->begin_of_line;
+
+    switch (token->type) {
+    case TOKEN_NEWLINE:
+    case TOKEN_EOF:
+        lexer->begin_of_line = true;
+        break;
+    case TOKEN_SPACE:
+    case TOKEN_COMMENT:
+    case TOKEN_END:
+        break;
+    default:
+        lexer->begin_of_line = false;
+        break;
+    }
+}
+
+
 static inline
 void __lexer_mark_location__(lexer_t *lexer, token_t *token)
 {
-    token->location.line = reader_line(lexer->reader);
-    token->location.column = reader_column(lexer->reader);
-    token->location.filename = reader_filename(lexer->reader);
-    token->location.linenote = reader_linenote(lexer->reader);
+    token->loc = reader_loc(lexer->reader);
 }
 
 
 static inline
 void __remark_location__(lexer_t *lexer, token_t *token)
 {
-    token->location.line = reader_line(lexer->reader);
-    token->location.column = reader_column(lexer->reader);
-    token->location.linenote = reader_linenote(lexer->reader);
+    token->loc = reader_loc(lexer->reader);
+}
+
+
+/**
+ * A speculative lexer may be reading input the wrong way, so it only
+ * counts its errors; they are reported when the input is read for real.
+ **/
+static inline
+void __lexer_error__(lexer_t *lexer, token_t *token, const char *msg)
+{
+    if (lexer->speculative) {
+        lexer->suppressed++;
+        return;
+    }
+
+    errorf_with_token(token, "%s", msg);
 }
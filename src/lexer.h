@@ -6,32 +6,96 @@
 
 #include "config.h"
 #include "cstring.h"
+#include "srcloc.h"
 
 
 typedef struct array_s     array_t;
+typedef struct arena_s     arena_t;
+typedef struct cspool_s    cspool_t;
+typedef struct identtab_s  identtab_t;
+typedef struct linemap_s   linemap_t;
 typedef struct reader_s    reader_t;
+typedef struct srcpool_s   srcpool_t;
 typedef struct token_s     token_t;
+typedef struct tokbuf_s    tokbuf_t;
+typedef struct tokcache_s  tokcache_t;
+typedef struct tokpipe_s   tokpipe_t;
 typedef enum token_type_e  token_type_t;
 typedef enum stream_type_e stream_type_t;
 
 
+/* what a caller of lexer_get_batch() has room for, as a rule */
+#define LEXER_BATCH         64
+
+
+/**
+ * Tokens returned by lexer_scan() live in the lexer arena and stay valid
+ * until lexer_destroy(); token_destroy() on them only drops the hideset.
+ * lexer_set_arena(lexer, NULL) brings back individually owned tokens.
+ * A speculative lexer counts its errors in suppressed, see reader_t.
+ *
+ * lexer_get() reads the spans of tokens handed back to the lexer, last
+ * in first out, before it goes on with the streams.
+ *
+ * Given an identtab_t, identifiers come with their ident_t and the
+ * keyword is taken from it.
+ *
+ * With -fpipeline the big files pushed are lexed ahead on a thread of
+ * their own, see tokpipe_t.
+ *
+ * With runs set a line's run of at least LEXER_RUN_MIN integers, commas
+ * and spaces between them, is scanned as one TOKEN_NUMBER_RUN, its
+ * integers decoded into values on the way. lexer_unget() hands one back
+ * as the tokens it stands for.
+ **/
 typedef struct lexer_s {
     reader_t *reader;
+    array_t *spans;
+    arena_t *arena;
+    bool clean_arena;
+    cstring_t scratch;
+    bool trivia;
+    bool begin_of_line;
+    bool speculative;
+    size_t suppressed;
+    identtab_t *idents;
+    tokpipe_t *pipe;
+    bool runs;
+    array_t *values;
 } lexer_t;
 
 
 lexer_t* lexer_create(void);
 lexer_t* lexer_create_csp(cspool_t *csp);
+lexer_t* lexer_create_srcpool(cspool_t *csp, srcpool_t *srcpool);
 void lexer_destroy(lexer_t *lexer);
+void lexer_set_arena(lexer_t *lexer, arena_t *arena);
+void lexer_set_trivia(lexer_t *lexer, bool trivia);
+void lexer_set_idents(lexer_t *lexer, identtab_t *idents);
 bool lexer_push(lexer_t *lexer, stream_type_t type, const unsigned char* s);
+bool lexer_push_cached(lexer_t *lexer, tokcache_t *cache, const unsigned char *fn);
+bool lexer_push_text(lexer_t *lexer, cstring_t fn, const unsigned char *text,
+                     size_t length, linemap_t *lines, srcloc_t loc);
 array_t* lexer_tokenize(lexer_t *lexer);
+tokbuf_t* lexer_tokenize_compact(lexer_t *lexer);
+bool lexer_record_line(lexer_t *lexer, array_t *tokens);
+void lexer_replay(lexer_t *lexer, token_t **tokens, size_t n, srcloc_t loc);
+token_t** lexer_replay_cursor(lexer_t *lexer);
+void lexer_replay_seek(lexer_t *lexer, token_t **cursor);
 token_t* lexer_scan(lexer_t *lexer);
+size_t lexer_scan_batch(lexer_t *lexer, token_t **tokens, size_t n);
 token_t* lexer_scan_header_name(lexer_t *lexer);
 token_t* lexer_get(lexer_t *lexer);
+size_t lexer_get_batch(lexer_t *lexer, token_t **tokens, size_t n);
 token_t* lexer_peek(lexer_t *lexer);
 void lexer_eat(lexer_t *lexer);
 void lexer_unget(lexer_t *lexer, token_t *tok);
+void lexer_unget_batch(lexer_t *lexer, token_t **tokens, size_t n);
+void lexer_unget_tokens(lexer_t *lexer, array_t *tokens);
+void lexer_unget_borrowed(lexer_t *lexer, token_t **tokens, size_t n);
 bool lexer_try(lexer_t *lexer, token_type_t tt);
+bool lexer_is_empty(lexer_t *lexer);
+bool lexer_skip_to_directive(lexer_t *lexer);
 
 void lexer_stash(lexer_t *lexer);
 void lexer_unstash(lexer_t *lexer);
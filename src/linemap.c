@@ -0,0 +1,104 @@
+
+
+#include "config.h"
+#include "pmalloc.h"
+#include "array.h"
+#include "scan.h"
+#include "linemap.h"
+
+
+static void __linemap_build__(linemap_t *map);
+
+
+linemap_t* linemap_create(const unsigned char *text, size_t length)
+{
+    linemap_t *map = (linemap_t *) pmalloc(sizeof(linemap_t));
+    map->text = text;
+    map->length = length;
+    map->starts = NULL;
+    return map;
+}
+
+
+void linemap_destroy(linemap_t *map)
+{
+    if (map->starts != NULL) {
+        array_destroy(map->starts);
+    }
+    pfree(map);
+}
+
+
+size_t linemap_lines(linemap_t *map)
+{
+    if (map->starts == NULL) {
+        __linemap_build__(map);
+    }
+    return array_length(map->starts);
+}
+
+
+/**
+ * Resolves a physical offset to its 1-based line and column and to the
+ * start of its line. "\r\n", "\r" and "\n" all end a line.
+ **/
+void linemap_resolve(linemap_t *map, size_t offset, size_t *line,
+                     size_t *column, const unsigned char **linenote)
+{
+    size_t *starts;
+    size_t lo, hi, mid;
+
+    if (map->starts == NULL) {
+        __linemap_build__(map);
+    }
+
+    starts = array_prototype(map->starts, size_t);
+    lo = 1;
+    hi = array_length(map->starts);
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (starts[mid] <= offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (line != NULL) {
+        *line = lo;
+    }
+
+    if (column != NULL) {
+        *column = offset - starts[lo - 1] + 1;
+    }
+
+    if (linenote != NULL) {
+        *linenote = &map->text[starts[lo - 1]];
+    }
+}
+
+
+static
+void __linemap_build__(linemap_t *map)
+{
+    const unsigned char *p = map->text;
+    const unsigned char *pe = &map->text[map->length];
+
+    map->starts = array_create_n(sizeof(size_t), map->length / 32 + 1);
+
+    array_cast_append(size_t, map->starts, 0);
+
+    for (;;) {
+        p = scan_find(p, pe, '\n', '\r', '\n', '\r');
+        if (p == pe) {
+            break;
+        }
+
+        if (*p++ == '\r' && p < pe && *p == '\n') {
+            p++;
+        }
+
+        array_cast_append(size_t, map->starts, (size_t) (p - map->text));
+    }
+}
@@ -0,0 +1,32 @@
+
+
+#ifndef __LINEMAP__H__
+#define __LINEMAP__H__
+
+
+#include "config.h"
+
+
+typedef struct array_s      array_t;
+
+
+/**
+ * Line-start offsets of one physical source buffer. The table is built
+ * on the first lookup: locations are kept as plain byte offsets and only
+ * turned into line and column when somebody asks.
+ **/
+typedef struct linemap_s {
+    const unsigned char *text;
+    size_t length;
+    array_t *starts;
+} linemap_t;
+
+
+linemap_t* linemap_create(const unsigned char *text, size_t length);
+void linemap_destroy(linemap_t *map);
+size_t linemap_lines(linemap_t *map);
+void linemap_resolve(linemap_t *map, size_t offset, size_t *line,
+                     size_t *column, const unsigned char **linenote);
+
+
+#endif
@@ -3,38 +3,134 @@
 #include "config.h"
 #include "option.h"
 #include "cstring.h"
+#include "driver.h"
+#include "server.h"
 
 
-static void parse_opts(option_t option, int argc, char *argv[]);
+static int run(server_t *srv, int argc, char **argv, void *ud);
+static int serve(const char *path);
+static const char* server_path(const char *arg, const char *flag);
+static bool parse_opts(option_t *option, driver_t *drv, size_t *jobs, int argc, char *argv[]);
 
 
+/**
+ * --serve[=socket] keeps a server running; --connect[=socket] has it run
+ * the rest of the command line, which runs here if there is none, and
+ * --shutdown[=socket] stops it.
+ **/
 int main(int argc, char **argv)
 {
-    option_t option;
-    
+    const char *path;
+    int status;
+
+    if (argc > 1 && (path = server_path(argv[1], "--serve")) != NULL) {
+        return serve(path);
+    }
+
+    if (argc > 1 && (path = server_path(argv[1], "--shutdown")) != NULL) {
+        return server_shutdown(path) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (argc > 1 && (path = server_path(argv[1], "--connect")) != NULL) {
+        argv[1] = argv[0];
+        argc--;
+        argv++;
+
+        if ((status = server_forward(path, argc, argv)) >= 0) {
+            return status;
+        }
+    }
+
+    return run(NULL, argc, argv, NULL);
+}
+
+
+/**
+ * A run of the command line, on its own or as a request to srv, which
+ * the buffers, tokens and include paths are shared with.
+ **/
+static
+int run(server_t *srv, int argc, char **argv, void *ud)
+{
+    option_t *option;
+    driver_t *drv;
+    size_t jobs = 1, nfailed = 1;
+
+    (void) ud;
+
     option = option_create();
+    drv = driver_create(option);
 
-    parse_opts(option, argc, argv);
+    if (parse_opts(option, drv, &jobs, argc, argv)) {
+        if (srv != NULL) {
+            driver_share(drv, srv->srcpool, server_include_paths(srv, drv->include_paths), srv->tokcache);
+        }
 
+        nfailed = driver_run(drv, jobs);
+    }
+
+    driver_destroy(drv);
     option_destroy(option);
 
-    return 0;
+    return nfailed != 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+static
+int serve(const char *path)
+{
+    server_t *srv;
+    bool ok;
+
+    if ((srv = server_create(path)) == NULL) {
+        fprintf(stderr, "occ: cannot serve on '%s'\n", path[0] != '\0' ? path : "the default socket");
+        return EXIT_FAILURE;
+    }
+
+    ok = server_serve(srv, run, NULL);
+    server_destroy(srv);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/* the socket of --flag or --flag=socket, "" for the default, else NULL */
+static
+const char* server_path(const char *arg, const char *flag)
+{
+    size_t n = strlen(flag);
+
+    if (strncmp(arg, flag, n) != 0) {
+        return NULL;
+    }
+
+    if (arg[n] == '\0') {
+        return "";
+    }
+
+    return arg[n] == '=' ? arg + n + 1 : NULL;
 }
 
 
-static 
-void parse_opts(option_t option, int argc, char *argv[])
+/**
+ * False for a command line that is not one, with what is wrong printed.
+ **/
+static
+bool parse_opts(option_t *option, driver_t *drv, size_t *jobs, int argc, char *argv[])
 {
-    for (int i = 1; i < argc; i++) {
+    int i;
+
+    for (i = 1; i < argc; i++) {
         char *arg = argv[i];
         if (strcmp(arg, "-o") == 0) {
             if (++i >= argc) {
                 printf("missing file name after '-o'");
+                return false;
             }
-            option->outfile = cstring_new(argv[i]);
+            option->outfile = argv[i];
         } else if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0 ||
             strcmp(arg, "-v") == 0 || strcmp(arg, "--version") == 0) {
-            exit(EXIT_FAILURE);
+            return false;
         } else if (!strcmp(arg, "-c")) {
             option->cflag = true;
         } else if (!strcmp(arg, "-S")) {
@@ -43,6 +139,63 @@ void parse_opts(option_t option, int argc, char *argv[])
             option->Eflag = true;
         } else if (!strcmp(arg, "-dump-ast")) {
             option->dump_ast = true;
+        } else if (!strncmp(arg, "-fdiagnostics-format=", 21)) {
+            option->diagnostics_json = !strcmp(arg + 21, "json");
+        } else if (!strcmp(arg, "-ftime-report")) {
+            option->time_report = true;
+        } else if (!strcmp(arg, "-print-stats")) {
+            option->print_stats = true;
+        } else if (!strcmp(arg, "-ftime-trace")) {
+            option->time_trace = true;
+        } else if (!strncmp(arg, "-ftime-trace-granularity=", 25)) {
+            option->time_trace_granularity = (size_t) strtoul(arg + 25, NULL, 10);
+        } else if (!strcmp(arg, "-fpipeline")) {
+            option->pipeline = true;
+        } else if (!strcmp(arg, "-fprefetch")) {
+            option->prefetch = true;
+        } else if (!strncmp(arg, "-fcache-dir=", 12)) {
+            option->cache_dir = arg + 12;
+        } else if (!strncmp(arg, "-fsave-snapshot=", 16)) {
+            option->save_snapshot = arg + 16;
+        } else if (!strncmp(arg, "-fload-snapshot=", 16)) {
+            option->load_snapshot = arg + 16;
+        } else if (!strcmp(arg, "-fliteral-runs") || !strcmp(arg, "-fno-literal-runs")) {
+            option->literal_runs = arg[2] != 'n';
+        } else if (!strcmp(arg, "-M") || !strcmp(arg, "-MM")) {
+            option->Mflag = true;
+            option->MMflag = arg[2] == 'M';
+            option->Eflag = true;
+        } else if (!strcmp(arg, "-MD") || !strcmp(arg, "-MMD")) {
+            option->MDflag = true;
+            option->MMflag = arg[2] == 'M';
+        } else if (!strcmp(arg, "-MF") || !strcmp(arg, "-MT") || !strcmp(arg, "-MQ")) {
+            if (++i >= argc) {
+                printf("missing file name after '%s'", arg);
+                return false;
+            }
+            if (arg[2] == 'F') {
+                option->MF = argv[i];
+            } else if (arg[2] == 'T') {
+                option->MT = argv[i];
+            } else {
+                option->MQ = argv[i];
+            }
+        } else if (!strncmp(arg, "-I", 2)) {
+            if (arg[2] == '\0' && ++i >= argc) {
+                printf("missing path after '-I'");
+                return false;
+            }
+            driver_add_include_path(drv, arg[2] != '\0' ? arg + 2 : argv[i]);
+        } else if (!strncmp(arg, "-j", 2)) {
+            if (arg[2] == '\0' && ++i >= argc) {
+                printf("missing number after '-j'");
+                return false;
+            }
+            *jobs = (size_t) strtoul(arg[2] != '\0' ? arg + 2 : argv[i], NULL, 10);
+        } else if (arg[0] != '-' || arg[1] == '\0') {
+            driver_add_input(drv, arg);
         }
     }
-}
\ No newline at end of file
+
+    return true;
+}
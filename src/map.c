@@ -6,26 +6,48 @@
 #include "map.h"
 
 
+/**
+ * The same keys are looked up over and over, their hash is kept on them.
+ **/
 static inline
 uint64_t __hash_fn__(const void *key) 
 {
-    return dict_gen_hash_function((unsigned char*)key, cstring_length((char*)key));
+    cstring_t cs = (cstring_t) key;
+    uint64_t hash;
+
+    if ((hash = cstring_get_hash(cs)) == 0) {
+        hash = dict_gen_hash_function(cs, (int) cstring_length(cs));
+        cstring_set_hash(cs, hash);
+    }
+
+    return hash;
 }
 
 
 static inline
 void* __key_dup__(void *privdata, const void *key)
 {
-    return cstring_dup((const cstring_t) key);
+    cstring_t cs;
+
+    if ((cs = cstring_dup((const cstring_t) key)) != NULL) {
+        cstring_set_hash(cs, cstring_get_hash((const cstring_t) key));
+    }
+
+    return cs;
 }
 
 
 static inline
 int __compare_fn__(void *privdata, const void *key1, const void *key2)
 {
-    int l1, l2;
+    size_t l1, l2;
+    uint64_t h1, h2;
     DICT_NOTUSED(privdata);
 
+    if (key1 == key2) {
+        return 1;
+    }
+
     l1 = cstring_length((cstring_t)key1);
     l2 = cstring_length((cstring_t)key2);
 
@@ -33,6 +55,13 @@ int __compare_fn__(void *privdata, const void *key1, const void *key2)
         return 0;
     }
 
+    h1 = cstring_get_hash((cstring_t)key1);
+    h2 = cstring_get_hash((cstring_t)key2);
+
+    if (h1 != 0 && h2 != 0 && h1 != h2) {
+        return 0;
+    }
+
     return memcmp(key1, key2, l1) == 0;
 }
 
@@ -61,6 +90,13 @@ map_t* map_create(void)
 }
 
 
+map_t* map_create_swiss(void)
+{
+    dict_t *dict = dict_create_swiss(&__map_dict_type__, NULL);
+    return (map_t*) dict;
+}
+
+
 void map_destroy(map_t *map)
 {
     dict_destroy((dict_t*)map);
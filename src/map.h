@@ -16,6 +16,7 @@ typedef void (*map_scan_pt)(void *privdata, const void *key, const void *value);
 
 
 map_t* map_create(void);
+map_t* map_create_swiss(void);
 void map_destroy(map_t *map);
 bool map_add(map_t *map, cstring_t key, void *val);
 bool map_has(map_t *map, cstring_t key);
@@ -1,23 +1,23 @@
-
-
 #include "config.h"
+#include "cstring.h"
+#include "encoding.h"
+#include "token.h"
 #include "number.h"
 #include "option.h"
 #include "diagnostor.h"
 #include "utils.h"
-#include "token.h"
-
 
-#undef  ERRORF
-#define ERRORF_WITH_TOKEN(diag, tok, fmt, ...) \
-    diag_errorf_with_tok((diag), (tok), fmt, __VA_ARGS__)
-
-
-#undef  WARNINGF
-#define WARNINGF_WITH_TOKEN(diag, tok, fmt, ...) \
-    diag_warningf_with_tok((diag), (tok), fmt, __VA_ARGS__)
+#include <assert.h>
+#include <errno.h>
+#include <float.h>
+#include <stdlib.h>
 
 
+/**
+ * What the language and the warnings asked for allow. There is no
+ * -pedantic or -Wtraditional, so the extensions go without a word, as
+ * they do in gcc without them.
+ **/
 #undef  CONFIG_DIGIT_SEPARATOR
 #define CONFIG_DIGIT_SEPARATOR(option)  true
 
@@ -27,17 +27,17 @@
 
 
 #undef  CONFIG_PEDANTIC
-#define CONFIG_PEDANTIC(option) true
+#define CONFIG_PEDANTIC(option) false
 
 
 #undef  CONFIG_EXTENDED_NUMBERS
 #define CONFIG_EXTENDED_NUMBERS(option) true
 
 #undef  CONFIG_CPLUSPLUS
-#define CONFIG_CPLUSPLUS(option) true
+#define CONFIG_CPLUSPLUS(option) false
 
 #undef  CONFIG_C99
-#define CONFIG_C99(option) true
+#define CONFIG_C99(option) ((option)->lang != LANG_STANDARD_ANSI && (option)->lang != LANG_STANDARD_C89)
 
 
 #undef  CONFIG_WTRADITIONAL
@@ -45,7 +45,7 @@
 
 
 #undef  CONFIG_WARNLONGLONG
-#define CONFIG_WARNLONGLONG(option) true
+#define CONFIG_WARNLONGLONG(option) false
 
 
 #undef  CONFIG_BINARY_CONSTANT
@@ -57,15 +57,38 @@
     ((ch) == '\'' && CONFIG_DIGIT_SEPARATOR(option))
 
 
+/**
+ * The powers of ten a long double holds exactly, with the mantissas it
+ * holds exactly: one of them times or divided by the other is rounded
+ * once, the way strtold() rounds the spelling.
+ **/
+#if LDBL_MANT_DIG >= 64
+#   define FAST_FLOAT_MAX_POW10      (27)
+#   define FAST_FLOAT_MAX_MANTISSA   UINT64_MAX
+#else
+#   define FAST_FLOAT_MAX_POW10      (22)
+#   define FAST_FLOAT_MAX_MANTISSA   ((uint64_t) 1 << 53)
+#endif
+
+
+/* the most decimal digits a uint64_t is sure to hold */
+#define FAST_MAX_DIGITS             (19)
+
+
 static number_property_t 
-__interpret_float_suffix__(option_t option, const unsigned char *p, size_t len);
+__interpret_float_suffix__(const unsigned char *p, size_t len);
 static number_property_t
-__interpret_int_suffix__(option_t option, const unsigned char *p, size_t len);
+__interpret_int_suffix__(const unsigned char *p, size_t len);
+static bool __fast_number__(token_t *tok, number_t *number);
+static bool __fast_integer__(const unsigned char *p, const unsigned char *q,
+    int radix, uint64_t value, number_t *number);
+static const unsigned char* __fast_digits__(const unsigned char *p, const unsigned char *q,
+    size_t max, uint64_t *value);
 static void __init_number__(number_t *number);
-static bool __to_number__(diag_t diag, cstring_t cs, int radix, number_property_t property, token_t tok, number_t *number);
+static bool __to_number__(cstring_t cs, int radix, number_property_t property, token_t *tok, number_t *number);
 
 
-bool parse_number(diag_t diag, option_t option, token_t tok, number_t *number)
+bool parse_number(token_t *tok, number_t *number)
 {
     unsigned int max_digit, radix;
     bool seen_digit;
@@ -79,12 +102,11 @@ bool parse_number(diag_t diag, option_t option, token_t tok, number_t *number)
         AFTER_EXPON,
     } float_flag;
 
-    const unsigned char *p = (unsigned char*)tok->cs;
-    const unsigned char *q = (unsigned char*)tok->cs + cstring_length(tok->cs);
-    cstring_t cs = cstring_new_n(NULL, 128);
+    const unsigned char *p, *q;
+    cstring_t cs;
 
     assert(tok->type == TOKEN_NUMBER);
-     
+
     radix = 10;
     float_flag = NOT_FLOAT;
     seen_digit = false;
@@ -93,6 +115,17 @@ bool parse_number(diag_t diag, option_t option, token_t tok, number_t *number)
     
     __init_number__(number);
 
+    /* most literals are short and plain, and need no copy of the digits */
+    if (__fast_number__(tok, number)) {
+        return true;
+    }
+
+    /* the rest reads on to the NUL, which a slice of the source lacks */
+    p = (const unsigned char *) token_cs(tok);
+    q = p + cstring_length(tok->cs);
+
+    cs = cstring_new_n(NULL, 128);
+
     if (*p == '0') {
         radix = 8;
         p++;
@@ -101,7 +134,7 @@ bool parse_number(diag_t diag, option_t option, token_t tok, number_t *number)
                 radix = 16;
                 p++;
             } else if (DIGIT_SEPARATOR(p[1], option)) {
-                ERRORF_WITH_TOKEN(diag, tok, "digit separator after base indicator");
+                errorf_with_token(tok, "digit separator after base indicator");
                 goto syntax_error;
             }
             cs = cstring_concat_n(cs, "0x", 2);
@@ -110,7 +143,7 @@ bool parse_number(diag_t diag, option_t option, token_t tok, number_t *number)
                 radix = 2;
                 p++;
             } else if (DIGIT_SEPARATOR(p[1], option)) {
-                ERRORF_WITH_TOKEN(diag, tok, "digit separator after base indicator");
+                errorf_with_token(tok, "digit separator after base indicator");
                 goto syntax_error;
             }
         }
@@ -129,14 +162,14 @@ bool parse_number(diag_t diag, option_t option, token_t tok, number_t *number)
             }
         } else if (DIGIT_SEPARATOR(ch, option)) {
             if (seen_digit_sep) {
-                ERRORF_WITH_TOKEN(diag, tok, "adjacent digit separators");
+                errorf_with_token(tok, "adjacent digit separators");
                 goto syntax_error;
             }
             seen_digit_sep = true;
             cstring_pop_ch(cs);
         } else if (ch == '.') {
             if (seen_digit_sep) {
-                ERRORF_WITH_TOKEN(diag, tok, "adjacent digit separators");
+                errorf_with_token(tok, "adjacent digit separators");
                 goto syntax_error;
             }
 
@@ -145,13 +178,13 @@ bool parse_number(diag_t diag, option_t option, token_t tok, number_t *number)
             if (float_flag == NOT_FLOAT) {
                 float_flag = AFTER_POINT;
             } else {
-                ERRORF_WITH_TOKEN(diag, tok, "too many decimal points in number");
+                errorf_with_token(tok, "too many decimal points in number");
                 goto syntax_error;
             }
         } else if ((radix <= 10 && (ch == 'e' || ch == 'E')) || 
                    (radix == 16 && (ch == 'p' || ch == 'P'))) {
             if (seen_digit_sep || DIGIT_SEPARATOR(*p, option)) {
-                ERRORF_WITH_TOKEN(diag, tok, "digit separator adjacent to exponent");
+                errorf_with_token(tok, "digit separator adjacent to exponent");
                 goto syntax_error;
             }
             float_flag = AFTER_EXPON;
@@ -164,12 +197,12 @@ bool parse_number(diag_t diag, option_t option, token_t tok, number_t *number)
     }
 
     if (seen_digit_sep && float_flag != AFTER_EXPON) {
-        ERRORF_WITH_TOKEN(diag, tok, "digit separator outside digit sequence");
+        errorf_with_token(tok, "digit separator outside digit sequence");
         goto syntax_error;
     }
 
     if (radix != 16 && float_flag == NOT_FLOAT) {
-        property = __interpret_float_suffix__(option, p, q - p);
+        property = __interpret_float_suffix__(p, q - p);
 
         if ((property & NUMBER_FRACT) || (property & NUMBER_ACCUM)) {
             property |= NUMBER_FLOATING;
@@ -180,7 +213,7 @@ bool parse_number(diag_t diag, option_t option, token_t tok, number_t *number)
             }
 
             if (CONFIG_PEDANTIC(option)) {
-                ERRORF_WITH_TOKEN(diag, tok, "fixed-point constants are a GCC extension");
+                errorf_with_token(tok, "fixed-point constants are a GCC extension");
             }
 
             goto syntax_ok;
@@ -195,73 +228,77 @@ bool parse_number(diag_t diag, option_t option, token_t tok, number_t *number)
 
     if (max_digit >= radix) {
         if (radix == 2) {
-            ERRORF_WITH_TOKEN(diag, tok, "invalid digit \"%c\" in binary constant", '0' + max_digit);
+            errorf_with_token(tok, "invalid digit \"%c\" in binary constant", '0' + max_digit);
             goto syntax_error;
         } else {
-            ERRORF_WITH_TOKEN(diag, tok, "invalid digit \"%c\" in octal constant", '0' + max_digit);
+            errorf_with_token(tok, "invalid digit \"%c\" in octal constant", '0' + max_digit);
             goto syntax_error;
         }
     }
 
     if (float_flag != NOT_FLOAT) {
         if (radix == 2) {
-            ERRORF_WITH_TOKEN(diag, tok, "invalid prefix \"0b\" for floating constant");
+            errorf_with_token(tok, "invalid prefix \"0b\" for floating constant");
             goto syntax_error;
         }
 
         if (radix == 16 && !seen_digit) {
-            ERRORF_WITH_TOKEN(diag, tok, "no digits in hexadecimal floating constant");
+            errorf_with_token(tok, "no digits in hexadecimal floating constant");
             goto syntax_error;
         }
 
         if (radix == 16 && CONFIG_PEDANTIC(option) && 
             !CONFIG_EXTENDED_NUMBERS(option)) {
             if (CONFIG_CPLUSPLUS(option)) {
-                ERRORF_WITH_TOKEN(diag, tok, "use of C++1z hexadecimal floating constant");
+                errorf_with_token(tok, "use of C++1z hexadecimal floating constant");
             } else {
-                ERRORF_WITH_TOKEN(diag, tok, "use of C99 hexadecimal floating constant");
+                errorf_with_token(tok, "use of C99 hexadecimal floating constant");
             }
         }
 
         if (float_flag == AFTER_EXPON) {
             if (*p == '+' || *p == '-') {
+                cs = cstring_concat_ch(cs, *p);
                 p++;
             }
 
             /* Exponent is decimal, even if string is a hex float.  */
             if (!ISDIGIT(*p)) {
                 if (DIGIT_SEPARATOR(*p, option)) {
-                    ERRORF_WITH_TOKEN(diag, tok, "digit separator adjacent to exponent");
+                    errorf_with_token(tok, "digit separator adjacent to exponent");
                     goto syntax_error;
                 } else {
-                    ERRORF_WITH_TOKEN(diag, tok, "exponent has no digits");
+                    errorf_with_token(tok, "exponent has no digits");
                     goto syntax_error;
                 }
             }
 
             do {
                 seen_digit_sep = DIGIT_SEPARATOR(*p, option);
+                if (!seen_digit_sep) {
+                    cs = cstring_concat_ch(cs, *p);
+                }
                 p++;
             } while (ISDIGIT(*p) || DIGIT_SEPARATOR(*p, option));
         } else if (radix == 16) {
-            ERRORF_WITH_TOKEN(diag, tok, "hexadecimal floating constants require an exponent");
+            errorf_with_token(tok, "hexadecimal floating constants require an exponent");
             goto syntax_error;
         }
 
         if (seen_digit_sep) {
-            ERRORF_WITH_TOKEN(diag, tok, "digit separator outside digit sequence");
+            errorf_with_token(tok, "digit separator outside digit sequence");
             goto syntax_error;
         }
 
-        property = __interpret_float_suffix__(option, p, q - p);
+        property = __interpret_float_suffix__(p, q - p);
         if (property == NUMBER_INVALID) {
-            ERRORF_WITH_TOKEN(diag, tok, "invalid suffix \"%.*s\" on floating constant", (intptr_t)(p-q), p);
+            errorf_with_token(tok, "invalid suffix \"%.*s\" on floating constant", (int) (q - p), p);
             goto syntax_error;
         }
 
         /* Traditional C didn't accept any floating suffixes. */
         if (q != p && CONFIG_WTRADITIONAL(option)) {
-            WARNINGF_WITH_TOKEN(diag, tok, "traditional C rejects the \"%.*s\" suffix", (intptr_t)(p - q), p);
+            warningf_with_token(tok, "traditional C rejects the \"%.*s\" suffix", (int) (q - p), p);
         }
 
         /* 
@@ -270,30 +307,30 @@ bool parse_number(diag_t diag, option_t option, token_t tok, number_t *number)
          * later.  
          */
         if ((property == NUMBER_MEDIUM) && CONFIG_PEDANTIC(option)) {
-            ERRORF_WITH_TOKEN(diag, tok, "suffix for double constant is a GCC extension");
+            errorf_with_token(tok, "suffix for double constant is a GCC extension");
         }
 
         /* Radix must be 10 for decimal floats.  */
         if ((property & NUMBER_DFLOAT) && radix != 10) {
-            ERRORF_WITH_TOKEN(diag, tok, 
+            errorf_with_token(tok, 
                 "invalid suffix \"%.*s\" with hexadecimal floating constant", 
-                (intptr_t)(p - q), p);
+                (int) (q - p), p);
             goto syntax_error;
         }
 
         if ((property & (NUMBER_FRACT | NUMBER_ACCUM)) && CONFIG_PEDANTIC(option)) {
-            ERRORF_WITH_TOKEN(diag, tok, "fixed-point constants are a GCC extension");
+            errorf_with_token(tok, "fixed-point constants are a GCC extension");
         }
 
         if ((property & NUMBER_DFLOAT) && CONFIG_PEDANTIC(option)) {
-            ERRORF_WITH_TOKEN(diag, tok, "decimal float constants are a GCC extension");
+            errorf_with_token(tok, "decimal float constants are a GCC extension");
         }
 
         property |= NUMBER_FLOATING;
     } else {
-        property = __interpret_int_suffix__(option, p, q - p);
+        property = __interpret_int_suffix__(p, q - p);
         if (property == NUMBER_INVALID) {
-            ERRORF_WITH_TOKEN(diag, tok, "invalid suffix \"%.*s\" on integer constant", (intptr_t)(p - q), p);
+            errorf_with_token(tok, "invalid suffix \"%.*s\" on integer constant", (int) (q - p), p);
             goto syntax_error;
         }
 
@@ -307,15 +344,15 @@ bool parse_number(diag_t diag, option_t option, token_t tok, number_t *number)
             int large = (property & NUMBER_WIDTH) == NUMBER_LARGE && CONFIG_WARNLONGLONG(option);
 
             if (u_or_i || large) {
-                WARNINGF_WITH_TOKEN(diag, tok, "traditional C rejects the \"%.*s\" suffix", (intptr_t)(p - q), p);
+                warningf_with_token(tok, "traditional C rejects the \"%.*s\" suffix", (int) (q - p), p);
             }
         }
 
         if ((property & NUMBER_WIDTH) == NUMBER_LARGE && CONFIG_WARNLONGLONG(option)) {
             if (CONFIG_C99(option)) {
-                WARNINGF_WITH_TOKEN(diag, tok, "use of C99 long long integer constant");
+                warningf_with_token(tok, "use of C99 long long integer constant");
             } else {
-                WARNINGF_WITH_TOKEN(diag, tok, "use of C++11 long long integer constant");
+                warningf_with_token(tok, "use of C++11 long long integer constant");
             }
         }
 
@@ -324,11 +361,11 @@ bool parse_number(diag_t diag, option_t option, token_t tok, number_t *number)
 
 syntax_ok:
     if ((property & NUMBER_IMAGINARY) && CONFIG_PEDANTIC(option)) {
-        ERRORF_WITH_TOKEN(diag, tok, "imaginary constants are a GCC extension");
+        errorf_with_token(tok, "imaginary constants are a GCC extension");
     }
   
-    if (radix == 2 && !CONFIG_BINARY_CONSTANT(option) && CONFIG_PEDANTIC(pfile)) {
-        ERRORF_WITH_TOKEN(diag, tok, "binary constants are a C++14 feature or GCC extension");
+    if (radix == 2 && !CONFIG_BINARY_CONSTANT(option) && CONFIG_PEDANTIC(option)) {
+        errorf_with_token(tok, "binary constants are a C++14 feature or GCC extension");
     }
 
     if (radix == 10) {
@@ -343,7 +380,7 @@ syntax_ok:
         assert(false);
     }
     
-    __to_number__(diag, cs, radix, property, tok, number);
+    __to_number__(cs, radix, property, tok, number);
     cstring_free(cs);
     return true;
 
@@ -353,9 +390,9 @@ syntax_error:
 }
     
 
-bool parse_char(diag_t diag, option_t option, token_t tok, number_t *number)
+bool parse_char(token_t *tok, number_t *number)
 {
-    cstring_t utf;
+    cstring_t cs, utf;
     uint32_t ch;
 
     assert(tok->type == TOKEN_CONSTANT_CHAR ||
@@ -365,31 +402,34 @@ bool parse_char(diag_t diag, option_t option, token_t tok, number_t *number)
     
     __init_number__(number);
 
-    if (cstring_length(tok->cs) <= 0) {
+    cs = token_cs(tok);
+    if (cs == NULL || cstring_length(cs) <= 0) {
         return false;
     }
 
     switch(tok->type) {
     case TOKEN_CONSTANT_CHAR:
-        ch = (uint32_t)tok->cs[0];
-        if (cstring_length(tok->cs) > sizeof(uint8_t)) {
-            WARNINGF_WITH_TOKEN(diag, tok, "multi-character character constant");
+        ch = (uint32_t)(unsigned char)cs[0];
+        if (cstring_length(cs) > sizeof(uint8_t)) {
+            warningf_with_token(tok, "multi-character character constant");
         }
         break;
     case TOKEN_CONSTANT_CHAR16:
-        utf = cstring_cast_to_utf16(tok->cs);
+        utf = cstring_cast_to_utf16(cs);
         ch = *(uint16_t*)utf;
         if (cstring_length(utf) > sizeof(uint16_t)) {
-            WARNINGF_WITH_TOKEN(diag, tok, "multi-character character constant");
+            warningf_with_token(tok, "multi-character character constant");
         }
+        cstring_free(utf);
         break;
     case TOKEN_CONSTANT_CHAR32:
     case TOKEN_CONSTANT_WCHAR:
-        utf = cstring_cast_to_utf32(tok->cs);
+        utf = cstring_cast_to_utf32(cs);
         ch = *(uint32_t*)utf;
         if (cstring_length(utf) > sizeof(uint32_t)) {
-            WARNINGF_WITH_TOKEN(diag, tok, "multi-character character constant");
+            warningf_with_token(tok, "multi-character character constant");
         }
+        cstring_free(utf);
         break;
     default:
         assert(false);
@@ -404,7 +444,7 @@ bool parse_char(diag_t diag, option_t option, token_t tok, number_t *number)
 
 
 static number_property_t
-__interpret_float_suffix__(option_t option, const unsigned char *p, size_t len)
+__interpret_float_suffix__(const unsigned char *p, size_t len)
 {
     size_t flags;
     size_t f, d, l, w, q, i;
@@ -557,7 +597,7 @@ __interpret_float_suffix__(option_t option, const unsigned char *p, size_t len)
 
 
 static number_property_t
-__interpret_int_suffix__(option_t option, const unsigned char *p, size_t len)
+__interpret_int_suffix__(const unsigned char *p, size_t len)
 {
     size_t u, l, i;
 
@@ -602,380 +642,232 @@ __interpret_int_suffix__(option_t option, const unsigned char *p, size_t len)
 }
 
 
-static
-void __init_number__(number_t *number)
+/**
+ * Decimal integers of up to FAST_MAX_DIGITS digits, hexadecimal ones of
+ * up to 16, and decimal floats whose digits and exponent make the value
+ * exact in one long double operation. A suffix that asks for a warning
+ * or an error, and everything else, is left to parse_number().
+ **/
+static bool
+__fast_number__(token_t *tok, number_t *number)
 {
-    number->property = NUMBER_INVALID;
-    number->radix = 0;
-    number->ul = 0;
+    const unsigned char *p, *q, *s;
+    number_property_t property;
+    uint64_t value = 0;
+    size_t ndigits;
+    int exponent = 0, n, sign;
+    long double ld;
+    size_t length;
+
+    static const long double pow10[FAST_FLOAT_MAX_POW10 + 1] = {
+        1e0L,  1e1L,  1e2L,  1e3L,  1e4L,  1e5L,  1e6L,  1e7L,
+        1e8L,  1e9L,  1e10L, 1e11L, 1e12L, 1e13L, 1e14L, 1e15L,
+        1e16L, 1e17L, 1e18L, 1e19L, 1e20L, 1e21L, 1e22L,
+#if FAST_FLOAT_MAX_POW10 > 22
+        1e23L, 1e24L, 1e25L, 1e26L, 1e27L,
+#endif
+    };
+
+    p = token_spelling(tok, &length);
+    q = p + length;
+
+    if (q - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+        for (p += 2, s = p; p < q && ISHEX(*p) && p - s < 16; p++) {
+            value = (value << 4) | (uint64_t) TODIGIT(*p);
+        }
+
+        if (p == s || (p < q && (ISHEX(*p) || *p == '.' || *p == 'p' || *p == 'P' ||
+                                 DIGIT_SEPARATOR(*p, option)))) {
+            return false;
+        }
+
+        return __fast_integer__(p, q, 16, value, number);
+    }
+
+    s = p;
+    p = __fast_digits__(p, q, FAST_MAX_DIGITS, &value);
+    ndigits = p - s;
+
+    if (p < q && (ISDIGIT(*p) || DIGIT_SEPARATOR(*p, option))) {
+        return false;
+    }
+
+    if (p == q || (*p != '.' && *p != 'e' && *p != 'E')) {
+        /* a lone 0 is octal as well, others starting with it are left */
+        if (ndigits == 0 || (*s == '0' && ndigits > 1)) {
+            return false;
+        }
+
+        return __fast_integer__(p, q, *s == '0' ? 8 : 10, value, number);
+    }
+
+    if (*p == '.') {
+        s = ++p;
+        p = __fast_digits__(p, q, FAST_MAX_DIGITS - ndigits, &value);
+        exponent = -(int) (p - s);
+        ndigits += p - s;
+
+        if (p < q && (ISDIGIT(*p) || DIGIT_SEPARATOR(*p, option))) {
+            return false;
+        }
+    }
+
+    if (ndigits == 0) {
+        return false;
+    }
+
+    if (p < q && (*p == 'e' || *p == 'E')) {
+        sign = 1;
+        if (++p < q && (*p == '+' || *p == '-')) {
+            sign = *p++ == '-' ? -1 : 1;
+        }
+
+        for (s = p, n = 0; p < q && ISDIGIT(*p) && p - s < 4; p++) {
+            n = n * 10 + (*p - '0');
+        }
+
+        if (p == s || (p < q && (ISDIGIT(*p) || DIGIT_SEPARATOR(*p, option)))) {
+            return false;
+        }
+
+        exponent += sign * n;
+    }
+
+    if (value > FAST_FLOAT_MAX_MANTISSA ||
+        exponent < -FAST_FLOAT_MAX_POW10 || exponent > FAST_FLOAT_MAX_POW10) {
+        return false;
+    }
+
+    property = __interpret_float_suffix__(p, q - p);
+    if (property != NUMBER_DEFAULT && property != NUMBER_SMALL && property != NUMBER_LARGE) {
+        return false;
+    }
+
+    if (q != p && CONFIG_WTRADITIONAL(option)) {
+        return false;
+    }
+
+    ld = (long double) value;
+    ld = exponent < 0 ? ld / pow10[-exponent] : ld * pow10[exponent];
+
+    number->ld = ld;
+    number->radix = 10;
+    number->property = property | NUMBER_FLOATING | NUMBER_DECIMAL;
+    return true;
 }
 
 
-static bool 
-__to_number__(diag_t diag, cstring_t cs, int radix, number_property_t property, token_t tok, number_t *number)
+static bool
+__fast_integer__(const unsigned char *p, const unsigned char *q,
+    int radix, uint64_t value, number_t *number)
 {
-    char *end;
+    number_property_t property;
 
-    if (property & NUMBER_INTEGER) {
-        number->ul = strtoull(cs, &end, radix);
-    } else if (property & NUMBER_FLOATING) {
-        number->ld = strtold(cs, &end);
-    } else {
-        assert(false);
+    property = __interpret_int_suffix__(p, q - p);
+    if (property == NUMBER_INVALID || (property & NUMBER_IMAGINARY) ||
+        (property & NUMBER_WIDTH) == NUMBER_LARGE) {
         return false;
     }
 
+    if ((property & NUMBER_UNSIGNED) && CONFIG_WTRADITIONAL(option)) {
+        return false;
+    }
+
+    number->ul = value;
     number->radix = radix;
-    number->property = property;
+    number->property = property | NUMBER_INTEGER |
+        (radix == 16 ? NUMBER_HEX : radix == 8 ? NUMBER_OCTAL : NUMBER_DECIMAL);
     return true;
 }
 
 
-#include <stdio.h>
-#include <string.h>
-#include <math.h>
-#include <ctype.h>
-#include <stdlib.h>
-
-#ifndef bool
-#define bool unsigned char
-enum {
-    false,
-    true,
-};
-#endif
-#define BN_SIZE 2
-#define STRING_MAX_SIZE     1024
-#define CONFIG_BINARY_CONSTANT true
+/* eight digits in the bytes of v, the first in the lowest */
+static inline
+bool __fast_eight_digits__(uint64_t v)
+{
+    return ((v & 0xF0F0F0F0F0F0F0F0ULL) |
+            (((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) == 0x3333333333333333ULL;
+}
 
-#define error printf
-#define expect printf
 
+/* the value of the eight digits in v, pairs then fours then all of them */
 static inline
-int ISDIGIT(int ch)
+uint32_t __fast_eight_value__(uint64_t v)
 {
-    return isdigit(ch);
+    const uint64_t mask = 0x000000FF000000FFULL;
+    const uint64_t mul1 = 0x000F424000000064ULL;    /* 100 + (1000000 << 32) */
+    const uint64_t mul2 = 0x0000271000000001ULL;    /* 1 + (10000 << 32) */
+
+    v -= 0x3030303030303030ULL;
+    v = (v * 10) + (v >> 8);
+    v = (((v & mask) * mul1) + (((v >> 16) & mask) * mul2)) >> 32;
+    return (uint32_t) v;
 }
 
-/* bn = (bn << shift) | or_val */
-void bn_lshift(unsigned long *bn, int shift, int or_val)
+
+/**
+ * Appends up to max decimal digits from p to *value, eight at a time
+ * while there are. The end of the digits taken.
+ **/
+static const unsigned char*
+__fast_digits__(const unsigned char *p, const unsigned char *q, size_t max, uint64_t *value)
 {
+    const unsigned char *s = p;
+    uint64_t v = *value, eight;
     int i;
-    unsigned int v;
-    for(i = 0; i < BN_SIZE; i++) {
-        v = bn[i];
-        bn[i] = (v << shift) | or_val;
-        or_val = v >> (32 - shift);
+
+    while (q - p >= 8 && (size_t) (p - s) + 8 <= max) {
+        for (eight = 0, i = 7; i >= 0; i--) {
+            eight = (eight << 8) | p[i];
+        }
+
+        if (!__fast_eight_digits__(eight)) {
+            break;
+        }
+
+        v = v * 100000000 + __fast_eight_value__(eight);
+        p += 8;
     }
-}
 
-void bn_zero(unsigned long *bn)
-{
-    int i;
-    for(i = 0; i < BN_SIZE; i++) {
-        bn[i] = 0;
+    for (; p < q && ISDIGIT(*p) && (size_t) (p - s) < max; p++) {
+        v = v * 10 + (uint64_t) (*p - '0');
     }
-}
 
+    *value = v;
+    return p;
+}
 
-typedef enum {
-    TOK_CLDOUBLE,
-    TOK_CFLOAT,
-    TOK_CDOUBLE,
-    TOK_CLLONG,
-    TOK_CULLONG,
-    TOK_CUINT,
-    TOK_CINT,
-}token_type_t;
 
-typedef union number_u {
-    long double ld;
-    double d;
-    float f;
-    int i;
-    unsigned int ui;
-    unsigned int ul; /* address (should be unsigned long on 64 bit cpu) */
-    long long ll;
-    unsigned long long ull;
-} number_t;
+static
+void __init_number__(number_t *number)
+{
+    number->property = NUMBER_INVALID;
+    number->radix = 0;
+    number->ul = 0;
+}
 
-int errno = 0;
 
+static bool 
+__to_number__(cstring_t cs, int radix, number_property_t property, token_t *tok, number_t *number)
+{
+    char *end;
 
-token_type_t tok;
-number_t tokc;
+    errno = 0;
 
-void parse_number(char *p,  char *token_buf)
-{
-    int b, t, shift, frac_bits, s, exp_val, ch;
-    char *q;
-    unsigned int bn[BN_SIZE];
-    double d;
-
-    /* number */
-    q = token_buf;
-    ch = *p++;
-    t = ch;
-    ch = *p++;
-    *q++ = t;
-    b = 10;
-    if (t == '.') {
-        goto float_frac_parse;
-    } else if (t == '0') {
-        if (ch == 'x' || ch == 'X') {
-            q--;
-            ch = *p++;
-            b = 16;
-        } else if (CONFIG_BINARY_CONSTANT && (ch == 'b' || ch == 'B')) {
-            q--;
-            ch = *p++;
-            b = 2;
-        }
-    }
-    /* parse all digits. cannot check octal numbers at this stage
-       because of floating point constants */
-    while (1) {
-        if (ch >= 'a' && ch <= 'f')
-            t = ch - 'a' + 10;
-        else if (ch >= 'A' && ch <= 'F')
-            t = ch - 'A' + 10;
-        else if (ISDIGIT(ch))
-            t = ch - '0';
-        else
-            break;
-        if (t >= b)
-            break;
-        if (q >= token_buf + STRING_MAX_SIZE) {
-            num_too_long:
-            error("number too long");
-        }
-        *q++ = ch;
-        ch = *p++;
-    }
-    if (ch == '.' ||
-        ((ch == 'e' || ch == 'E') && b == 10) ||
-        ((ch == 'p' || ch == 'P') && (b == 16 || b == 2))) {
-        if (b != 10) {
-            /* NOTE: strtox should support that for hexa numbers, but
-               non ISOC99 libcs do not support it, so we prefer to do
-               it by hand */
-            /* hexadecimal or binary floats */
-            /* XXX: handle overflows */
-            *q = '\0';
-            if (b == 16)
-                shift = 4;
-            else
-                shift = 2;
-            bn_zero(bn);
-            q = token_buf;
-            while (1) {
-                t = *q++;
-                if (t == '\0') {
-                    break;
-                } else if (t >= 'a') {
-                    t = t - 'a' + 10;
-                } else if (t >= 'A') {
-                    t = t - 'A' + 10;
-                } else {
-                    t = t - '0';
-                }
-                bn_lshift(bn, shift, t);
-            }
-            frac_bits = 0;
-            if (ch == '.') {
-                ch = *p++;
-                while (1) {
-                    t = ch;
-                    if (t >= 'a' && t <= 'f') {
-                        t = t - 'a' + 10;
-                    } else if (t >= 'A' && t <= 'F') {
-                        t = t - 'A' + 10;
-                    } else if (t >= '0' && t <= '9') {
-                        t = t - '0';
-                    } else {
-                        break;
-                    }
-                    if (t >= b)
-                        error("invalid digit");
-                    bn_lshift(bn, shift, t);
-                    frac_bits += shift;
-                    ch = *p++;
-                }
-            }
-            if (ch != 'p' && ch != 'P')
-                expect("exponent");
-            ch = *p++;
-            s = 1;
-            exp_val = 0;
-            if (ch == '+') {
-                ch = *p++;
-            } else if (ch == '-') {
-                s = -1;
-                ch = *p++;
-            }
-            if (ch < '0' || ch > '9')
-                expect("exponent digits");
-            while (ch >= '0' && ch <= '9') {
-                exp_val = exp_val * 10 + ch - '0';
-                ch = *p++;
-            }
-            exp_val = exp_val * s;
-
-            /* now we can generate the number */
-            /* XXX: should patch directly float number */
-            d = (double)bn[1] * 4294967296.0 + (double)bn[0];
-            d = ldexp(d, exp_val - frac_bits);
-            t = toupper(ch);
-            if (t == 'F') {
-                ch = *p++;
-                tok = TOK_CFLOAT;
-                /* float : should handle overflow */
-                tokc.f = (float)d;
-            } else if (t == 'L') {
-                ch = *p++;
-                tok = TOK_CLDOUBLE;
-                /* XXX: not large enough */
-                tokc.ld = (long double)d;
-            } else {
-                tok = TOK_CDOUBLE;
-                tokc.d = d;
-            }
-        } else {
-            /* decimal floats */
-            if (ch == '.') {
-                if (q >= token_buf + STRING_MAX_SIZE)
-                    goto num_too_long;
-                *q++ = ch;
-                ch = *p++;
-                float_frac_parse:
-                while (ch >= '0' && ch <= '9') {
-                    if (q >= token_buf + STRING_MAX_SIZE)
-                        goto num_too_long;
-                    *q++ = ch;
-                    ch = *p++;
-                }
-            }
-            if (ch == 'e' || ch == 'E') {
-                if (q >= token_buf + STRING_MAX_SIZE)
-                    goto num_too_long;
-                *q++ = ch;
-                ch = *p++;
-                if (ch == '-' || ch == '+') {
-                    if (q >= token_buf + STRING_MAX_SIZE)
-                        goto num_too_long;
-                    *q++ = ch;
-                    ch = *p++;
-                }
-                if (ch < '0' || ch > '9')
-                    expect("exponent digits");
-                while (ch >= '0' && ch <= '9') {
-                    if (q >= token_buf + STRING_MAX_SIZE)
-                        goto num_too_long;
-                    *q++ = ch;
-                    ch = *p++;
-                }
-            }
-            *q = '\0';
-            t = toupper(ch);
-            errno = 0;
-            if (t == 'F') {
-                ch = *p++;
-                tok = TOK_CFLOAT;
-                tokc.f = strtof(token_buf, NULL);
-            } else if (t == 'L') {
-                ch = *p++;
-                tok = TOK_CLDOUBLE;
-                tokc.ld = strtold(token_buf, NULL);
-            } else {
-                tok = TOK_CDOUBLE;
-                tokc.d = strtod(token_buf, NULL);
-            }
+    if (property & NUMBER_INTEGER) {
+        number->ul = strtoull(cs, &end, radix);
+        if (errno == ERANGE) {
+            warningf_with_token(tok, "integer constant is too large for its type");
         }
+    } else if (property & NUMBER_FLOATING) {
+        number->ld = strtold(cs, &end);
     } else {
-        unsigned long long n, n1;
-        int lcount, ucount;
-
-        /* integer number */
-        *q = '\0';
-        q = token_buf;
-        if (b == 10 && *q == '0') {
-            b = 8;
-            q++;
-        }
-        n = 0;
-        while(1) {
-            t = *q++;
-            /* no need for checks except for base 10 / 8 errors */
-            if (t == '\0') {
-                break;
-            } else if (t >= 'a') {
-                t = t - 'a' + 10;
-            } else if (t >= 'A') {
-                t = t - 'A' + 10;
-            } else {
-                t = t - '0';
-                if (t >= b)
-                    error("invalid digit");
-            }
-            n1 = n;
-            n = n * b + t;
-            /* detect overflow */
-            /* XXX: this test is not reliable */
-            if (n < n1)
-                error("integer constant overflow");
-        }
-
-        /* XXX: not exactly ANSI compliant */
-        if ((n & 0xffffffff00000000LL) != 0) {
-            if ((n >> 63) != 0)
-                tok = TOK_CULLONG;
-            else
-                tok = TOK_CLLONG;
-        } else if (n > 0x7fffffff) {
-            tok = TOK_CUINT;
-        } else {
-            tok = TOK_CINT;
-        }
-        lcount = 0;
-        ucount = 0;
-        for(;;) {
-            t = toupper(ch);
-            if (t == 'L') {
-                if (lcount >= 2)
-                    error("three 'l's in integer constant");
-                lcount++;
-                if (lcount == 2) {
-                    if (tok == TOK_CINT)
-                        tok = TOK_CLLONG;
-                    else if (tok == TOK_CUINT)
-                        tok = TOK_CULLONG;
-                }
-                ch = *p++;
-            } else if (t == 'U') {
-                if (ucount >= 1)
-                    error("two 'u's in integer constant");
-                ucount++;
-                if (tok == TOK_CINT)
-                    tok = TOK_CUINT;
-                else if (tok == TOK_CLLONG)
-                    tok = TOK_CULLONG;
-                ch = *p++;
-            } else {
-                break;
-            }
-        }
-        if (tok == TOK_CINT || tok == TOK_CUINT)
-            tokc.ui = n;
-        else
-            tokc.ull = n;
+        assert(false);
+        return false;
     }
-    if (ch)
-        error("invalid number\n");
-}
 
+    number->radix = radix;
+    number->property = property;
+    return true;
+}
 
-int main() {
-    const char p[] = "0x123";
-    parse_number(p, p);
-    return 0;
-}
\ No newline at end of file
@@ -8,8 +8,6 @@
 #include "cstring.h"
 
 
-typedef struct diag_s*      diag_t;
-typedef struct option_s*    option_t;
 typedef struct token_s      token_t;
 
 
@@ -60,8 +58,12 @@ typedef struct number_s {
     ((type)number.ul)
 
 
-bool parse_number(diag_t diag, option_t option, token_t tok, number_t *number);
-bool parse_char(diag_t diag, option_t option, token_t tok, number_t *number);
+/**
+ * The value of a TOKEN_NUMBER, or of a character constant, false if it is
+ * not one. The errors and warnings go to the diagnostor.
+ **/
+bool parse_number(token_t *tok, number_t *number);
+bool parse_char(token_t *tok, number_t *number);
 
 
 #endif
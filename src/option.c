@@ -18,10 +18,22 @@ static option_t __option__ = {
     true,
     true,
     true,
+    true,
+    false,
+    false,
+    false,
+    NULL,
+    NULL,
+    false,
+    false,
+    false,
+    false,
+    OPTION_TRACE_GRANULARITY,
+    false,
 };
 
 
-option_t *option = &__option__;
+THREAD_LOCAL option_t *option = &__option__;
 
 
 option_t* option_create(void)
@@ -55,4 +67,22 @@ void option_init(option_t *opt)
     opt->w_backslash_newline_space = true;
     opt->warn_no_newline_eof = true;
     opt->reserve_comment = true;
+    opt->prepass = true;
+    opt->Mflag = false;
+    opt->MMflag = false;
+    opt->MDflag = false;
+    opt->MF = NULL;
+    opt->MT = NULL;
+    opt->MQ = NULL;
+    opt->diagnostics_json = false;
+    opt->time_report = false;
+    opt->print_stats = false;
+    opt->time_trace = false;
+    opt->time_trace_granularity = OPTION_TRACE_GRANULARITY;
+    opt->pipeline = false;
+    opt->prefetch = false;
+    opt->literal_runs = true;
+    opt->cache_dir = NULL;
+    opt->save_snapshot = NULL;
+    opt->load_snapshot = NULL;
 }
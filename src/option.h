@@ -19,6 +19,10 @@ typedef enum lang_standard_e {
 } lang_standard_t;
 
 
+/* the spans -ftime-trace keeps at least this long, in microseconds */
+#define OPTION_TRACE_GRANULARITY    500
+
+
 typedef struct option_s {
     lang_standard_t lang;
 
@@ -36,10 +40,28 @@ typedef struct option_s {
     bool w_backslash_newline_space: 1;
     bool warn_no_newline_eof: 1;
     bool reserve_comment: 1;
+    bool prepass: 1;
+    bool Mflag: 1;                      /* -M, -MM: the rule instead of the output */
+    bool MMflag: 1;                     /* -MM, -MMD: no system headers in the rule */
+    bool MDflag: 1;                     /* -MD, -MMD: the rule besides the output */
+    const char* MF;                     /* where the rule goes, NULL for the default */
+    const char* MT;                     /* the target of the rule as it is, NULL for the object */
+    const char* MQ;                     /* a target quoted for make, after that of -MT */
+    bool diagnostics_json;              /* -fdiagnostics-format=json */
+    bool time_report;                   /* -ftime-report: the time of each phase */
+    bool print_stats;                   /* -print-stats: the counters */
+    bool time_trace;                    /* -ftime-trace: the spans, as trace events */
+    size_t time_trace_granularity;      /* -ftime-trace-granularity=: microseconds */
+    bool pipeline;                      /* -fpipeline: big files lexed on a thread */
+    bool prefetch;                      /* -fprefetch: the headers loaded ahead on a thread */
+    bool literal_runs;                  /* -fno-literal-runs: -E lexes integers one by one */
+    const char* cache_dir;              /* -fcache-dir=: the lexed headers kept for later runs */
+    const char* save_snapshot;          /* -fsave-snapshot=: the macros and guards the unit ends with */
+    const char* load_snapshot;          /* -fload-snapshot=: those of a prefix, bound before the unit */
 } option_t;
 
 
-extern option_t* option;
+extern THREAD_LOCAL option_t* option;
 
 #define option_get(filed) (option)->filed
 
@@ -37,6 +37,412 @@ static void __oom_handler__(const char *fn, long line)
 }
 
 
+/* the allocations and reallocations made by the thread, for benchmarks */
+static THREAD_LOCAL size_t __count__ = 0;
+
+
+size_t pmalloc_count(void)
+{
+    return __count__;
+}
+
+
+#if defined(PMALLOC_PROFILE)
+
+#if defined(_MSC_VER)
+#   include <intrin.h>
+#endif
+
+
+/* a power of two, the sites past it are counted as one */
+#ifndef PMALLOC_PROFILE_SITES
+#define PMALLOC_PROFILE_SITES       (1024)
+#endif
+
+
+/* the allocations and frees a thread counts before merging them */
+#ifndef PMALLOC_PROFILE_MERGE
+#define PMALLOC_PROFILE_MERGE       (4096)
+#endif
+
+
+/* up to 16 bytes, up to 32 and so on, the last one everything larger */
+#define PMALLOC_PROFILE_BUCKETS     (16)
+
+
+/**
+ * The counts of a call site. In the table of a thread live is what it
+ * allocated there less what it freed since the last merge, and peak the
+ * most live got meanwhile, so the peak merged is exact for one thread.
+ **/
+typedef struct pmalloc_site_s {
+    const char *fn;
+    long line;
+    size_t count;
+    long long live;
+    long long peak;
+    size_t histogram[PMALLOC_PROFILE_BUCKETS];
+} pmalloc_site_t;
+
+
+/* in front of every block, to tell the site and the size when it is freed */
+typedef struct pmalloc_header_s {
+    const char *fn;
+    long line;
+    size_t size;
+} pmalloc_header_t;
+
+
+#define __PROFILE_ALIGNMENT__       (2 * sizeof(void*))
+#define __PROFILE_HEADER__                                                  \
+    ((sizeof(pmalloc_header_t) + __PROFILE_ALIGNMENT__ - 1) & ~(__PROFILE_ALIGNMENT__ - 1))
+
+
+static void* __profile_alloc__(const char *fn, long line, void *raw, size_t size);
+static void __profile_record__(const char *fn, long line, size_t size, bool allocated);
+static pmalloc_site_t* __profile_site__(pmalloc_site_t *sites, const char *fn, long line, bool named);
+static void __profile_merge__(void);
+static void __profile_report__(void);
+static int __profile_order__(const void *a, const void *b);
+static void __profile_lock__(void);
+static void __profile_unlock__(void);
+
+
+static THREAD_LOCAL pmalloc_site_t *__local_sites__;
+static THREAD_LOCAL size_t __local_ops__;
+
+static pmalloc_site_t __sites__[PMALLOC_PROFILE_SITES + 1];
+static volatile long __sites_lock__;
+static bool __sites_reported__;
+
+
+void* p_malloc(const char *fn, long line, size_t size)
+{
+    void *raw;
+
+    if ((raw = malloc(__PROFILE_HEADER__ + size)) == NULL) {
+        __oom_handler__(fn, line);
+        return NULL;
+    }
+
+    return __profile_alloc__(fn, line, raw, size);
+}
+
+
+void* p_calloc(const char *fn, long line, size_t nmemb, size_t size)
+{
+    void *raw;
+
+    if ((size != 0 && nmemb > ((size_t) -1 - __PROFILE_HEADER__) / size) ||
+        (raw = calloc(1, __PROFILE_HEADER__ + nmemb * size)) == NULL) {
+        __oom_handler__(fn, line);
+        return NULL;
+    }
+
+    return __profile_alloc__(fn, line, raw, nmemb * size);
+}
+
+
+/**
+ * The bytes move to the site of the realloc, which counts as one more
+ * allocation there.
+ **/
+void* p_realloc(const char *fn, long line, void *ptr, size_t size)
+{
+    pmalloc_header_t header;
+    void *raw;
+
+    if (ptr == NULL) {
+        return p_malloc(fn, line, size);
+    }
+
+    header = *(pmalloc_header_t *) ((unsigned char *) ptr - __PROFILE_HEADER__);
+
+    raw = realloc((unsigned char *) ptr - __PROFILE_HEADER__, __PROFILE_HEADER__ + size);
+    if (raw == NULL) {
+        __oom_handler__(fn, line);
+        return NULL;
+    }
+
+    __profile_record__(header.fn, header.line, header.size, false);
+    return __profile_alloc__(fn, line, raw, size);
+}
+
+
+void p_free(const char *fn, long line, void *ptr)
+{
+    pmalloc_header_t *header;
+
+    if (ptr == NULL) {
+        return;
+    }
+
+    header = (pmalloc_header_t *) ((unsigned char *) ptr - __PROFILE_HEADER__);
+    __profile_record__(header->fn, header->line, header->size, false);
+    free(header);
+}
+
+
+/**
+ * Merges the counts of the calling thread and lets go of its table, for
+ * a thread about to exit.
+ **/
+void pmalloc_profile_merge(void)
+{
+    if (__local_sites__ != NULL) {
+        __profile_merge__();
+        free(__local_sites__);
+        __local_sites__ = NULL;
+    }
+}
+
+
+static
+void* __profile_alloc__(const char *fn, long line, void *raw, size_t size)
+{
+    pmalloc_header_t *header = (pmalloc_header_t *) raw;
+
+    __count__++;
+
+    header->fn = fn;
+    header->line = line;
+    header->size = size;
+
+    __profile_record__(fn, line, size, true);
+    return (unsigned char *) raw + __PROFILE_HEADER__;
+}
+
+
+static
+void __profile_record__(const char *fn, long line, size_t size, bool allocated)
+{
+    pmalloc_site_t *site;
+    size_t bucket;
+
+    if (__local_sites__ == NULL) {
+        /* the table is not counted itself, it comes straight from calloc() */
+        __local_sites__ = (pmalloc_site_t *) calloc(PMALLOC_PROFILE_SITES + 1, sizeof(pmalloc_site_t));
+        if (__local_sites__ == NULL) {
+            return;
+        }
+
+        __profile_lock__();
+        if (!__sites_reported__) {
+            __sites_reported__ = true;
+            atexit(__profile_report__);
+        }
+        __profile_unlock__();
+    }
+
+    site = __profile_site__(__local_sites__, fn, line, false);
+
+    if (allocated) {
+        for (bucket = 0; bucket < PMALLOC_PROFILE_BUCKETS - 1 && size > ((size_t) 16 << bucket); bucket++) {
+            continue;
+        }
+
+        site->count++;
+        site->histogram[bucket]++;
+        site->live += (long long) size;
+        if (site->live > site->peak) {
+            site->peak = site->live;
+        }
+
+    } else {
+        site->live -= (long long) size;
+    }
+
+    if (++__local_ops__ >= PMALLOC_PROFILE_MERGE) {
+        __profile_merge__();
+    }
+}
+
+
+/**
+ * The slot of fn:line in sites, taken if it was free. A thread tells the
+ * sites apart by the address of the name, the merged table by the name,
+ * as every file includes the static functions of the headers on its own.
+ **/
+static
+pmalloc_site_t* __profile_site__(pmalloc_site_t *sites, const char *fn, long line, bool named)
+{
+    uintptr_t hash;
+    const char *p;
+    size_t i, n;
+
+    hash = (uintptr_t) line * 2654435761u;
+    if (named) {
+        for (p = fn; *p; p++) {
+            hash = hash * 31 + (unsigned char) *p;
+        }
+    } else {
+        hash ^= (uintptr_t) fn >> 3;
+    }
+
+    for (n = 0; n < PMALLOC_PROFILE_SITES; n++) {
+        i = (hash + n) & (PMALLOC_PROFILE_SITES - 1);
+
+        if (sites[i].fn == NULL) {
+            sites[i].fn = fn;
+            sites[i].line = line;
+            return &sites[i];
+        }
+
+        if (sites[i].line == line &&
+            (sites[i].fn == fn || (named && strcmp(sites[i].fn, fn) == 0))) {
+            return &sites[i];
+        }
+    }
+
+    sites[PMALLOC_PROFILE_SITES].fn = "(other sites)";
+    return &sites[PMALLOC_PROFILE_SITES];
+}
+
+
+static
+void __profile_merge__(void)
+{
+    pmalloc_site_t *local, *site;
+    size_t i, j;
+
+    __profile_lock__();
+
+    for (i = 0; i <= PMALLOC_PROFILE_SITES; i++) {
+        local = &__local_sites__[i];
+        if (local->fn == NULL) {
+            continue;
+        }
+
+        site = i < PMALLOC_PROFILE_SITES ?
+            __profile_site__(__sites__, local->fn, local->line, true) : &__sites__[i];
+
+        site->fn = local->fn;
+        site->count += local->count;
+        if (site->live + local->peak > site->peak) {
+            site->peak = site->live + local->peak;
+        }
+        site->live += local->live;
+
+        for (j = 0; j < PMALLOC_PROFILE_BUCKETS; j++) {
+            site->histogram[j] += local->histogram[j];
+            local->histogram[j] = 0;
+        }
+
+        local->count = 0;
+        local->live = 0;
+        local->peak = 0;
+    }
+
+    __profile_unlock__();
+
+    __local_ops__ = 0;
+}
+
+
+/**
+ * The sites by peak bytes, then by allocations, each with the sizes it
+ * asked for.
+ **/
+static
+void __profile_report__(void)
+{
+    pmalloc_site_t **sorted;
+    pmalloc_site_t *site;
+    size_t i, j, n;
+
+    pmalloc_profile_merge();
+
+    sorted = (pmalloc_site_t **) malloc((PMALLOC_PROFILE_SITES + 1) * sizeof(pmalloc_site_t *));
+    if (sorted == NULL) {
+        return;
+    }
+
+    __profile_lock__();
+
+    for (i = n = 0; i <= PMALLOC_PROFILE_SITES; i++) {
+        if (__sites__[i].fn != NULL) {
+            sorted[n++] = &__sites__[i];
+        }
+    }
+
+    qsort(sorted, n, sizeof(pmalloc_site_t *), __profile_order__);
+
+    fprintf(stderr, "pmalloc profile, %lu sites:\n", (unsigned long) n);
+    fprintf(stderr, "%14s %14s %10s  %s\n", "peak", "live", "count", "site");
+
+    for (i = 0; i < n; i++) {
+        site = sorted[i];
+
+        fprintf(stderr, "%14lld %14lld %10lu  %s:%ld ",
+                site->peak, site->live, (unsigned long) site->count, site->fn, site->line);
+
+        for (j = 0; j < PMALLOC_PROFILE_BUCKETS; j++) {
+            if (site->histogram[j] == 0) {
+                continue;
+            }
+
+            if (j < PMALLOC_PROFILE_BUCKETS - 1) {
+                fprintf(stderr, " <=%lu:%lu", (unsigned long) 16 << j, (unsigned long) site->histogram[j]);
+            } else {
+                fprintf(stderr, " >%lu:%lu", (unsigned long) 16 << (j - 1), (unsigned long) site->histogram[j]);
+            }
+        }
+
+        fputc('\n', stderr);
+    }
+
+    __profile_unlock__();
+
+    free(sorted);
+}
+
+
+static
+int __profile_order__(const void *a, const void *b)
+{
+    const pmalloc_site_t *sa = *(const pmalloc_site_t * const *) a;
+    const pmalloc_site_t *sb = *(const pmalloc_site_t * const *) b;
+
+    if (sa->peak != sb->peak) {
+        return sa->peak > sb->peak ? -1 : 1;
+    }
+
+    if (sa->count != sb->count) {
+        return sa->count > sb->count ? -1 : 1;
+    }
+
+    return 0;
+}
+
+
+/* a spin lock, pmalloc.c goes without thread.c in most of the builds */
+static
+void __profile_lock__(void)
+{
+#if defined(_MSC_VER)
+    while (_InterlockedExchange(&__sites_lock__, 1) != 0) {
+        continue;
+    }
+#else
+    while (__atomic_exchange_n(&__sites_lock__, 1, __ATOMIC_ACQUIRE) != 0) {
+        continue;
+    }
+#endif
+}
+
+
+static
+void __profile_unlock__(void)
+{
+#if defined(_MSC_VER)
+    _InterlockedExchange(&__sites_lock__, 0);
+#else
+    __atomic_store_n(&__sites_lock__, 0, __ATOMIC_RELEASE);
+#endif
+}
+
+#else
+
 void* p_malloc(const char *fn, long line, size_t size)
 {
     void *ptr;
@@ -46,6 +452,7 @@ void* p_malloc(const char *fn, long line, size_t size)
         return NULL;
     }
 
+    __count__++;
     return ptr;
 }
 
@@ -59,6 +466,7 @@ void* p_calloc(const char *fn, long line, size_t nmemb, size_t size)
         return NULL;
     }
 
+    __count__++;
     return ptr;
 }
 
@@ -69,6 +477,8 @@ void* p_realloc(const char *fn, long line, void *ptr, size_t size)
         __oom_handler__(fn, line);
         return NULL;
     }
+
+    __count__++;
     return ptr;
 }
 
@@ -79,6 +489,9 @@ void p_free(const char *fn, long line, void *ptr)
 }
 
 
+#endif
+
+
 void set_alloc_oom_handler(palloc_oom_handler_pt handler, void *ud)
 {
     palloc_oom_handler[idx_alloc_oom_handler] = (void*) handler;
@@ -17,6 +17,8 @@ typedef void(*palloc_oom_handler_pt)(const char *fn, long line, void *ud);
 #   define prealloc(ptr, size)                  realloc(ptr, size)
 #   define pfree(ptr)                           free(ptr)
 #   define set_alloc_oom_handler(handler, ud)   
+#   define pmalloc_profile_merge()
+#   define pmalloc_count()                      ((size_t) 0)
 
 #else
 
@@ -31,6 +33,21 @@ void* p_realloc(const char *fn, long line, void *ptr, size_t size);
 void p_free(const char *fn, long line, void *ptr);
 void set_alloc_oom_handler(palloc_oom_handler_pt handler, void *ud);
 
+/* the allocations the calling thread made so far, a realloc counts as one */
+size_t pmalloc_count(void);
+
+/**
+ * With PMALLOC_PROFILE every call site is counted: allocations, bytes
+ * live and at the peak, and the sizes by powers of two. The counts a
+ * thread keeps are merged now and then, and by pmalloc_profile_merge()
+ * before it exits. The report goes to stderr at exit.
+ **/
+#   if defined(PMALLOC_PROFILE)
+void pmalloc_profile_merge(void);
+#   else
+#       define pmalloc_profile_merge()
+#   endif
+
 #endif
 
 
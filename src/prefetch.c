@@ -0,0 +1,348 @@
+
+
+#include "config.h"
+#include "pmalloc.h"
+#include "array.h"
+#include "cstring.h"
+#include "set.h"
+#include "scan.h"
+#include "srcpool.h"
+#include "prefetch.h"
+
+
+/**
+ * Headers are followed this many #include levels below a pushed file.
+ **/
+#ifndef PREFETCH_DEPTH
+#define PREFETCH_DEPTH      (8)
+#endif
+
+
+typedef struct prefetch_request_s {
+    cstring_t name;
+    cstring_t dir;
+    bool quoted;
+    int depth;
+} prefetch_request_t;
+
+
+static void __prefetch_worker__(void *ud);
+static void __prefetch_scan__(prefetch_t *prefetch, cstring_t dir,
+                              const unsigned char *text, size_t length, int depth);
+static void __prefetch_enqueue__(prefetch_t *prefetch, cstring_t dir,
+                                 const unsigned char *name, size_t n,
+                                 bool quoted, int depth);
+static srcfile_t* __prefetch_resolve__(prefetch_t *prefetch,
+                                       prefetch_request_t *request, cstring_t *fn);
+static cstring_t __prefetch_dirname__(const char *fn);
+
+
+prefetch_t* prefetch_create(srcpool_t *srcpool)
+{
+    prefetch_t *prefetch = (prefetch_t *) pmalloc(sizeof(prefetch_t));
+
+    prefetch->srcpool = srcpool;
+    prefetch->paths = array_create(sizeof(cstring_t));
+    prefetch->queue = array_create(sizeof(prefetch_request_t));
+    prefetch->head = 0;
+    prefetch->seen = set_create();
+    prefetch->busy = 0;
+    prefetch->stop = false;
+
+    mutex_init(&prefetch->mutex);
+    cond_init(&prefetch->wakeup);
+    cond_init(&prefetch->idle);
+
+    prefetch->running = thread_create(&prefetch->thread, __prefetch_worker__, prefetch);
+
+    return prefetch;
+}
+
+
+void prefetch_destroy(prefetch_t *prefetch)
+{
+    prefetch_request_t *requests;
+    cstring_t *paths;
+    size_t i;
+
+    mutex_lock(&prefetch->mutex);
+    prefetch->stop = true;
+    cond_broadcast(&prefetch->wakeup);
+    mutex_unlock(&prefetch->mutex);
+
+    if (prefetch->running) {
+        thread_join(&prefetch->thread);
+    }
+
+    array_foreach(prefetch->queue, requests, i) {
+        if (i >= prefetch->head) {
+            cstring_free(requests[i].name);
+            cstring_free(requests[i].dir);
+        }
+    }
+
+    array_foreach(prefetch->paths, paths, i) {
+        cstring_free(paths[i]);
+    }
+
+    array_destroy(prefetch->queue);
+    array_destroy(prefetch->paths);
+    set_destroy(prefetch->seen);
+
+    cond_destroy(&prefetch->idle);
+    cond_destroy(&prefetch->wakeup);
+    mutex_destroy(&prefetch->mutex);
+
+    pfree(prefetch);
+}
+
+
+void prefetch_add_path(prefetch_t *prefetch, const char *path)
+{
+    cstring_t cs = cstring_new(path);
+
+    if (cstring_length(cs) > 0 && cs[cstring_length(cs) - 1] != '/') {
+        cs = cstring_concat_ch(cs, '/');
+    }
+
+    array_cast_append(cstring_t, prefetch->paths, cs);
+}
+
+
+/**
+ * Queues the headers text includes. Cheap: the text is only scanned for
+ * '#', the I/O happens on the prefetch thread.
+ **/
+void prefetch_push(prefetch_t *prefetch, const char *fn,
+                   const unsigned char *text, size_t length)
+{
+    cstring_t dir = __prefetch_dirname__(fn);
+    __prefetch_scan__(prefetch, dir, text, length, 0);
+    cstring_free(dir);
+}
+
+
+/**
+ * Blocks until everything queued so far has been loaded or given up on.
+ **/
+void prefetch_wait(prefetch_t *prefetch)
+{
+    mutex_lock(&prefetch->mutex);
+
+    while (prefetch->running &&
+           (prefetch->busy > 0 || prefetch->head < array_length(prefetch->queue))) {
+        cond_wait(&prefetch->idle, &prefetch->mutex);
+    }
+
+    mutex_unlock(&prefetch->mutex);
+}
+
+
+static
+void __prefetch_worker__(void *ud)
+{
+    prefetch_t *prefetch = (prefetch_t *) ud;
+    prefetch_request_t request;
+    srcfile_t *file;
+    cstring_t fn, dir;
+
+    mutex_lock(&prefetch->mutex);
+
+    for (;;) {
+        while (!prefetch->stop && prefetch->head == array_length(prefetch->queue)) {
+            cond_wait(&prefetch->wakeup, &prefetch->mutex);
+        }
+
+        if (prefetch->stop) {
+            break;
+        }
+
+        request = array_cast_at(prefetch_request_t, prefetch->queue, prefetch->head);
+        prefetch->head++;
+        prefetch->busy++;
+
+        if (prefetch->head == array_length(prefetch->queue)) {
+            array_clear(prefetch->queue);
+            prefetch->head = 0;
+        }
+
+        mutex_unlock(&prefetch->mutex);
+
+        if ((file = __prefetch_resolve__(prefetch, &request, &fn)) != NULL) {
+            if (request.depth < PREFETCH_DEPTH && !file->windowed) {
+                dir = __prefetch_dirname__(fn);
+                __prefetch_scan__(prefetch, dir, file->text, file->length, request.depth + 1);
+                cstring_free(dir);
+            }
+            cstring_free(fn);
+        }
+
+        cstring_free(request.name);
+        cstring_free(request.dir);
+
+        mutex_lock(&prefetch->mutex);
+
+        prefetch->busy--;
+        if (prefetch->busy == 0 && prefetch->head == array_length(prefetch->queue)) {
+            cond_broadcast(&prefetch->idle);
+        }
+    }
+
+    cond_broadcast(&prefetch->idle);
+    mutex_unlock(&prefetch->mutex);
+}
+
+
+/**
+ * Picks out the #include lines of text. Conditionals are ignored, a
+ * header that ends up unused only costs a load.
+ **/
+static
+void __prefetch_scan__(prefetch_t *prefetch, cstring_t dir,
+                       const unsigned char *text, size_t length, int depth)
+{
+    const unsigned char *p = text, *pe = &text[length], *q, *name;
+    unsigned char close;
+
+    while ((p = scan_find(p, pe, '#', '#', '#', '#')) < pe) {
+        /* only a '#' that starts a line introduces a directive */
+
+        for (q = p; q > text && (q[-1] == ' ' || q[-1] == '\t'); q--) {
+            continue;
+        }
+
+        p++;
+
+        if (q > text && q[-1] != '\n' && q[-1] != '\r') {
+            continue;
+        }
+
+        while (p < pe && (*p == ' ' || *p == '\t')) {
+            p++;
+        }
+
+        if (pe - p < 7 || memcmp(p, "include", 7) != 0) {
+            continue;
+        }
+
+        p += 7;
+
+        while (p < pe && (*p == ' ' || *p == '\t')) {
+            p++;
+        }
+
+        if (p == pe || (*p != '"' && *p != '<')) {
+            continue;
+        }
+
+        close = *p == '"' ? '"' : '>';
+        name = ++p;
+
+        while (p < pe && *p != close && *p != '\n' && *p != '\r') {
+            p++;
+        }
+
+        if (p < pe && *p == close && p > name) {
+            __prefetch_enqueue__(prefetch, dir, name, p - name, close == '"', depth);
+        }
+    }
+}
+
+
+static
+void __prefetch_enqueue__(prefetch_t *prefetch, cstring_t dir,
+                          const unsigned char *name, size_t n,
+                          bool quoted, int depth)
+{
+    prefetch_request_t request;
+    cstring_t key;
+
+    /* <x.h> resolves the same from everywhere, "x.h" depends on the includer */
+
+    key = quoted ? cstring_dup(dir) : cstring_new("<");
+    key = cstring_concat_ch(key, '\n');
+    key = cstring_concat_n(key, name, n);
+
+    mutex_lock(&prefetch->mutex);
+
+    if (set_has(prefetch->seen, key)) {
+        mutex_unlock(&prefetch->mutex);
+        cstring_free(key);
+        return;
+    }
+
+    set_add(prefetch->seen, key);
+
+    request.name = cstring_new_n(name, n);
+    request.dir = cstring_dup(dir);
+    request.quoted = quoted;
+    request.depth = depth;
+
+    array_cast_append(prefetch_request_t, prefetch->queue, request);
+    cond_signal(&prefetch->wakeup);
+
+    mutex_unlock(&prefetch->mutex);
+
+    cstring_free(key);
+}
+
+
+/**
+ * Tries the places the preprocessor will look, in the same order: the
+ * includer's directory for "x.h", then the search paths.
+ **/
+static
+srcfile_t* __prefetch_resolve__(prefetch_t *prefetch,
+                                prefetch_request_t *request, cstring_t *fn)
+{
+    cstring_t *paths;
+    srcfile_t *file;
+    size_t i;
+
+    if (request->name[0] == '/') {
+        if ((file = srcpool_load(prefetch->srcpool, request->name)) != NULL) {
+            *fn = cstring_dup(request->name);
+        }
+        return file;
+    }
+
+    if (request->quoted) {
+        *fn = cstring_concat_n(cstring_dup(request->dir), request->name,
+                               cstring_length(request->name));
+        if ((file = srcpool_load(prefetch->srcpool, *fn)) != NULL) {
+            return file;
+        }
+        cstring_free(*fn);
+    }
+
+    array_foreach(prefetch->paths, paths, i) {
+        *fn = cstring_concat_n(cstring_dup(paths[i]), request->name,
+                               cstring_length(request->name));
+        if ((file = srcpool_load(prefetch->srcpool, *fn)) != NULL) {
+            return file;
+        }
+        cstring_free(*fn);
+    }
+
+    return NULL;
+}
+
+
+static
+cstring_t __prefetch_dirname__(const char *fn)
+{
+    const char *slash = strrchr(fn, '/');
+
+#if defined(WINDOWS)
+    const char *backslash = strrchr(fn, '\\');
+    if (backslash != NULL && (slash == NULL || backslash > slash)) {
+        slash = backslash;
+    }
+#endif
+
+    if (slash == NULL) {
+        return cstring_new("");
+    }
+
+    return cstring_new_n(fn, slash - fn + 1);
+}
@@ -0,0 +1,50 @@
+
+
+#ifndef __PREFETCH__H__
+#define __PREFETCH__H__
+
+
+#include "config.h"
+#include "thread.h"
+
+
+typedef struct array_s      array_t;
+typedef struct set_s        set_t;
+typedef struct srcpool_s    srcpool_t;
+
+
+/**
+ * Include prefetcher. Files pushed to it are scanned for #include lines
+ * and the headers they name are loaded into the srcpool by a background
+ * thread, so that by the time the preprocessor opens them they are warm.
+ * It is purely speculative: a header it misses is just loaded later.
+ **/
+typedef struct prefetch_s {
+    srcpool_t *srcpool;
+
+    /* -I style search directories, only changed before the first push */
+    array_t *paths;
+
+    array_t *queue;
+    size_t head;
+    set_t *seen;
+    size_t busy;
+    bool stop;
+    bool running;
+
+    thread_t thread;
+    mutex_t mutex;
+    cond_t wakeup;
+    cond_t idle;
+} prefetch_t;
+
+
+prefetch_t* prefetch_create(srcpool_t *srcpool);
+void prefetch_destroy(prefetch_t *prefetch);
+void prefetch_add_path(prefetch_t *prefetch, const char *path);
+void prefetch_push(prefetch_t *prefetch, const char *fn,
+                   const unsigned char *text, size_t length);
+void prefetch_wait(prefetch_t *prefetch);
+
+
+#endif
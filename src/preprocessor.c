@@ -2,36 +2,28 @@
 
 #include "config.h"
 #include "array.h"
+#include "arena.h"
 #include "cstring.h"
 #include "pmalloc.h"
 #include "token.h"
+#include "number.h"
+#include "reader.h"
 #include "lexer.h"
 #include "diagnostor.h"
 #include "map.h"
+#include "keyword.h"
 #include "set.h"
+#include "dict.h"
+#include "hideset.h"
+#include "ident.h"
+#include "incpath.h"
+#include "snapshot.h"
+#include "depfile.h"
+#include "stats.h"
+#include "trace.h"
 #include "preprocessor.h"
 
 
-#undef  ERRORF_WITH_TOKEN
-#define ERRORF_WITH_TOKEN(tok, fmt, ...) \
-    diag_errorf_with_tok((pp)->diag, (tok), fmt, __VA_ARGS__)
-
-
-#undef  WARNINGF_WITH_TOKEN
-#define WARNINGF_WITH_TOKEN(tok, fmt, ...) \
-    diag_warningf_with_tok((pp)->diag, (tok), fmt, __VA_ARGS__)
-
-
-#undef  ERRORF_WITH_LOC
-#define ERRORF_WITH_LOC(loc, fmt, ...) \
-    diag_errorf_with_loc((pp)->diag, (loc), fmt, __VA_ARGS__)
-
-
-#undef  WARNINGF_WITH_LOC
-#define WARNINGF_WITH_LOC(loc, fmt, ...) \
-    diag_warningf_with_loc((pp)->diag, (loc), fmt, __VA_ARGS__)
-
-
 #ifndef TOKEN_EXPAND_NUMBER
 #define TOKEN_EXPAND_NUMBER     24
 #endif
@@ -46,815 +38,3003 @@
 #define NATIVE_MACRO_DATE       "__DATE__"
 
 
-static token_t __preprocessor_expand__(preprocessor_t pp);
-static bool __preprocessor_parse_directive__(preprocessor_t pp, token_t hash);
-static inline array_t __preprocessor_substitute__(preprocessor_t pp, macro_t macro, map_t args, set_t hideset);
-static inline void __preprocessor_unget_tokens__(preprocessor_t pp, array_t tokens);
-static inline bool __preprocessor_parse_define__(preprocessor_t pp);
-static inline bool __preprocessor_predefined_std_include_paths__(preprocessor_t pp);
+/**
+ * A value of an #if expression, an intmax_t or a uintmax_t, 64 bits
+ * either way.
+ **/
+typedef struct pp_value_s {
+    uint64_t v;
+    bool is_unsigned;
+} pp_value_t;
+
+
+/**
+ * The state of one #if: the lookahead token, and how many operands deep
+ * evaluation is skipped.
+ **/
+typedef struct pp_eval_s {
+    preprocessor_t *pp;
+    token_t *directive_token;
+    token_t *token;
+    size_t skip;
+    bool ok;
+} pp_eval_t;
+
+
+/**
+ * An argument of an invocation: as written, and macro expanded once a
+ * use in the body needs it so, NULL until then.
+ **/
+typedef struct pp_arg_s {
+    array_t *raw;
+    array_t *expanded;
+} pp_arg_t;
+
+
+/**
+ * A snapshot being put together, count is that of the records written
+ * behind the placeholder for it.
+ **/
+typedef struct pp_snapshot_writer_s {
+    cstring_t buf;
+    size_t count;
+} pp_snapshot_writer_t;
+
+
+static token_t* __preprocessor_expand__(preprocessor_t *pp);
+static bool __preprocessor_parse_directive__(preprocessor_t *pp, token_t *hash);
+static inline array_t* __preprocessor_substitute__(preprocessor_t *pp, macro_t *macro, pp_arg_t *args, hideset_t *hideset);
+static inline bool __preprocessor_parse_define__(preprocessor_t *pp);
+static inline bool __preprocessor_parse_undef__(preprocessor_t *pp);
+static void __preprocessor_parse_include__(preprocessor_t *pp, token_t *directive_token);
+static void __preprocessor_parse_if__(preprocessor_t *pp, token_t *directive_token, token_type_t directive);
+static void __preprocessor_parse_else__(preprocessor_t *pp, token_t *directive_token, token_type_t directive);
+static void __preprocessor_parse_endif__(preprocessor_t *pp, token_t *directive_token);
+static void __preprocessor_parse_pragma__(preprocessor_t *pp);
+static void __preprocessor_parse_diagnostic__(preprocessor_t *pp, token_t *directive_token, token_type_t directive);
+static void __preprocessor_parse_line__(preprocessor_t *pp, token_t *directive_token);
+static void __preprocessor_skip__(preprocessor_t *pp, token_t *directive_token);
+static void __preprocessor_skip_groups__(preprocessor_t *pp);
+static token_type_t __preprocessor_skip_group__(preprocessor_t *pp, token_t **directive_token);
+static bool __preprocessor_eval__(preprocessor_t *pp, token_t *directive_token);
+static void __preprocessor_finish_line__(preprocessor_t *pp, const char *directive);
+static bool __preprocessor_leave__(preprocessor_t *pp, token_t *eof);
+static inline include_frame_t* __preprocessor_frame__(preprocessor_t *pp);
+static inline size_t __preprocessor_base__(preprocessor_t *pp);
+static inline void __preprocessor_guard_token__(preprocessor_t *pp);
+static inline void __preprocessor_guard_directive__(preprocessor_t *pp, token_type_t directive);
 
 
 static inline
-void __preprocessor_add_macro__(preprocessor_t pp, token_t macroname_token,
+void __preprocessor_add_macro__(preprocessor_t *pp, token_t *macroname_token,
     macro_type_t type, native_macro_pt native_macro_fn,
-    array_t body, array_t params, bool is_variadic);
+    token_ptr_array_t *body, array_t *params, array_t *refs, array_t *uses, bool is_variadic);
 static inline
-macro_t __macro_create__(macro_type_t type, token_t macroname_token, 
-    native_macro_pt native_macro_fn, array_t body, array_t params, bool is_variadic);
+macro_t* __macro_create__(macro_type_t type, token_t *macroname_token, 
+    native_macro_pt native_macro_fn, token_ptr_array_t *body, array_t *params,
+    array_t *refs, array_t *uses, bool is_variadic);
 static inline
-void __macro_destroy__(macro_t macro);
-
-static array_t __create_tokens__(void);
-static void __destroy_tokens__(array_t a);
-
-
-preprocessor_t preprocessor_create(lexer_t lexer, option_t option, diag_t diag)
+void __macro_destroy__(macro_t *macro);
+static void __macro_cache_destroy__(macro_cache_t *cache);
+static void __preprocessor_save_macro__(void *ud, ident_t *ident);
+static cstring_t __preprocessor_save_guards__(cstring_t buf, dict_t *d);
+static void __preprocessor_save_once__(void *privdata, const cstring_t identity);
+static bool __preprocessor_walk_snapshot__(preprocessor_t *pp, snapshot_t *snap, bool apply);
+static void __preprocessor_read_in__(macro_t *macro, token_t *use);
+
+static inline ident_t* __preprocessor_ident__(preprocessor_t *pp, token_t *token);
+static inline void __preprocessor_consult__(preprocessor_t *pp, ident_t *ident);
+static inline void __preprocessor_consult_cache__(preprocessor_t *pp, macro_cache_t *cache);
+static inline void __preprocessor_bind__(preprocessor_t *pp, ident_t *ident, macro_t *macro);
+static void __preprocessor_add_once__(preprocessor_t *pp, cstring_t identity);
+static inline cstring_t __preprocessor_name__(token_t *token);
+static inline array_t* __preprocessor_copy_tokens__(array_t *tokens);
+static bool __add_hide_set__(hideset_t *hideset, array_t *expand_tokens);
+static void __preprocessor_place_expansion__(token_ptr_array_t *body, array_t *expand_tokens, token_t *token);
+static array_t* __create_tokens__(void);
+static void __destroy_tokens__(array_t *a);
+static void __destroy_body__(token_ptr_array_t *body);
+
+
+preprocessor_t* preprocessor_create(lexer_t *lexer)
 {
-    preprocessor_t pp;
+    preprocessor_t *pp;
+
+    pp = (preprocessor_t*) pmalloc(sizeof(struct preprocessor_s));
+
+    pp->include_paths = incpath_create();
+    pp->clean_include_paths = true;
+    pp->snapshots = array_create_n(sizeof(snapshot_t*), 2);
+    pp->tokcache = NULL;
+    pp->depends = NULL;
+    pp->condition_directive_stack = array_create_n(sizeof(condition_directive_t), 8);
+    pp->includes = array_create_n(sizeof(include_frame_t), 8);
+    pp->include_guard = map_create();
+    pp->once_guard = set_create();
+    pp->idents = identtab_create();
+    pp->defines = 0;
+    pp->recording = NULL;
+    pp->expanding = 0;
+    pp->expansion = 0;
+    pp->included = 0;
+    pp->runs = false;
+    pp->journal = NULL;
+    pp->macros = NULL;
+    pp->consulted = NULL;
+    pp->mark = 0;
+    pp->lexer = lexer;
 
-    pp = (preprocessor_t) pmalloc(sizeof(struct preprocessor_s));
+    lexer_set_idents(lexer, pp->idents);
 
-    pp->std_include_paths = array_create_n(sizeof(cstring_t), 8);
-    pp->macros = map_create();
-    pp->lexer = lexer;
-    pp->diag = diag;
+    incpath_add_std(pp->include_paths);
+
+    return pp;
+}
 
-    __preprocessor_predefined_std_include_paths__(pp);
 
+/**
+ * A preprocessor searching inc, which it does not own and which others
+ * may search at the same time, the paths it has are all it searches.
+ **/
+preprocessor_t* preprocessor_create_incpath(lexer_t *lexer, incpath_t *inc)
+{
+    preprocessor_t *pp = preprocessor_create(lexer);
+    incpath_destroy(pp->include_paths);
+    pp->include_paths = inc;
+    pp->clean_include_paths = false;
     return pp;
 }
 
 
-void map_scan_fn(void *privdata, const void *key, const void *value)
+static
+void __preprocessor_unbind__(void *ud, ident_t *ident)
 {
-    macro_t macro = (macro_t)value;
-    __macro_destroy__(macro);
+    if (ident->macro != NULL) {
+        __macro_destroy__(ident->macro);
+        ident->macro = NULL;
+    }
 }
 
 
-void preprocessor_destroy(preprocessor_t pp)
+void preprocessor_destroy(preprocessor_t *pp)
 {
-    cstring_t *std_include_paths;
+    include_frame_t *frames;
+    snapshot_t **snapshots;
+    pp_journal_t *entries;
+    macro_t **macros;
     size_t i;
 
-    array_foreach(pp->std_include_paths, std_include_paths, i) {
-        cstring_free(std_include_paths[i]);
+    if (pp->clean_include_paths) {
+        incpath_destroy(pp->include_paths);
     }
 
-    array_destroy(pp->std_include_paths);
-    
-    map_scan(pp->macros, map_scan_fn, NULL);
+    array_foreach(pp->includes, frames, i) {
+        cstring_free(frames[i].identity);
+    }
 
-    map_destroy(pp->macros);
+    array_destroy(pp->includes);
+    array_destroy(pp->condition_directive_stack);
+    map_destroy(pp->include_guard);
+    set_destroy(pp->once_guard);
+
+    if (pp->journal != NULL) {
+        /* every macro bound is one of those made */
+        array_foreach(pp->macros, macros, i) {
+            __macro_destroy__(macros[i]);
+        }
+
+        array_foreach(pp->journal, entries, i) {
+            if (entries[i].once != NULL) {
+                cstring_free(entries[i].once);
+            }
+        }
+
+        array_destroy(pp->macros);
+        array_destroy(pp->journal);
+        array_destroy(pp->consulted);
+    } else {
+        identtab_scan(pp->idents, __preprocessor_unbind__, NULL);
+    }
+
+    if (pp->lexer->idents == pp->idents) {
+        lexer_set_idents(pp->lexer, NULL);
+    }
+
+    identtab_destroy(pp->idents);
+
+    /* the macros read in from them are gone, the snapshots can go too */
+    array_foreach(pp->snapshots, snapshots, i) {
+        snapshot_close(snapshots[i]);
+    }
+
+    array_destroy(pp->snapshots);
 
     pfree(pp);
 }
 
 
-void preprocessor_add_include_path(preprocessor_t pp, const char *path)
+void preprocessor_add_include_path(preprocessor_t *pp, const char *path)
 {
-    array_cast_append(cstring_t, pp->std_include_paths, cstring_new(path));
+    incpath_add(pp->include_paths, path);
 }
 
 
-token_t preprocessor_expand(preprocessor_t pp)
+/**
+ * Included files are lexed through the cache from then on, NULL to stop.
+ * The cache stays the caller's, and may be shared by preprocessors run
+ * one after the other.
+ **/
+void preprocessor_set_tokcache(preprocessor_t *pp, tokcache_t *cache)
 {
-    for (;;) {
-        token_t tok = __preprocessor_expand__(pp);
-        if (__preprocessor_parse_directive__(pp, tok)) {
-            continue;
-        }
-        return tok;
-    }
+    pp->tokcache = cache;
 }
 
 
-token_t preprocessor_peek(preprocessor_t pp)
+/**
+ * Every file an #include resolves to is added to dep, which stays the
+ * caller's, a header a guard skips as well.
+ **/
+void preprocessor_set_depfile(preprocessor_t *pp, depfile_t *dep)
 {
-    token_t tok = preprocessor_get(pp);
-    if (tok->type != TOKEN_END) preprocessor_unget(pp, tok);
-    return tok;
+    pp->depends = dep;
 }
 
 
-token_t preprocessor_get(preprocessor_t pp)
+/**
+ * Lets preprocessor_expand() hand out the runs of integers of the text
+ * as TOKEN_NUMBER_RUN tokens, for a caller that writes them out as they
+ * are. Directives, the arguments of macros and what is cached are lexed
+ * as ever.
+ **/
+void preprocessor_set_runs(preprocessor_t *pp, bool runs)
 {
-    for (;;) {
-        token_t tok = preprocessor_expand(pp);
-        if (tok->type == TOKEN_NEWLINE) {
-            continue;
-        }
-        return tok;
-    }
+    pp->runs = runs;
 }
 
 
-void preprocessor_unget(preprocessor_t pp, token_t tok)
+/**
+ * Keeps a journal from here on, before the first macro is defined: what
+ * was done to the macros can then be undone back to a checkpoint and done
+ * again, for a text preprocessed anew after an edit.
+ **/
+void preprocessor_set_journal(preprocessor_t *pp)
 {
-    assert(tok && tok->type != TOKEN_END);
-    lexer_unget(pp->lexer, tok);
+    assert(pp->defines == 0 && pp->journal == NULL);
+
+    pp->journal = array_create_n(sizeof(pp_journal_t), 64);
+    pp->macros = array_create_n(sizeof(macro_t*), 64);
+    pp->consulted = array_create_n(sizeof(ident_t*), 256);
+    pp->mark = 1;
 }
 
 
-static inline
-bool __preprocessor_predefined_std_include_paths__(preprocessor_t pp)
+/**
+ * Takes down in cp where the preprocessor stands, if it stands between
+ * two lines of the text it was given and not inside a file it included,
+ * a condition or an expansion: what it knows then is in the journal. The
+ * names looked up from here on are noted down afresh.
+ **/
+bool preprocessor_checkpoint(preprocessor_t *pp, pp_checkpoint_t *cp)
 {
-    const char *std_paths[] = {
-        "/usr/local/lib/occ/include",
-        "/usr/local/include",
-        "/usr/include",
-        "/usr/include/linux",
-        "/usr/include/x86_64-linux-gnu",
-    };
+    assert(pp->journal != NULL);
 
-    size_t npaths = sizeof(std_paths) / sizeof(const char*);
-    size_t i;
-
-    for (i = 0; i < npaths; i++) {
-        preprocessor_add_include_path(pp, std_paths[i]);
+    if (!array_is_empty(pp->includes) || !array_is_empty(pp->condition_directive_stack) ||
+        pp->expanding != 0 || pp->recording != NULL) {
+        return false;
     }
 
+    cp->journal = array_length(pp->journal);
+    cp->consulted = array_length(pp->consulted);
+    cp->included = pp->included;
+
+    pp->mark++;
     return true;
 }
 
 
-static inline
-void __propagate_space__(array_t expand_tokens, token_t token)
+/**
+ * Undoes the journal back to cp, the macros are bound as they were then.
+ * The caller puts the lexer back where it stood.
+ **/
+void preprocessor_restore(preprocessor_t *pp, const pp_checkpoint_t *cp)
 {
-    if ((expand_tokens != NULL) && (array_length(expand_tokens) > 0)) {
-        token_t t = array_cast_front(token_t, expand_tokens);
-        t->spaces = token->spaces;
-    }
-}
+    pp_journal_t *entry;
 
+    assert(cp->journal <= array_length(pp->journal));
+    assert(cp->consulted <= array_length(pp->consulted));
 
-static inline
-void __preprocessor_expand_object_macro__(preprocessor_t pp, token_t token, macro_t macro)
-{
-    array_t expand_tokens;
-    set_t hideset;
+    while (array_length(pp->journal) > cp->journal) {
+        entry = &array_cast_back(pp_journal_t, pp->journal);
 
-    hideset = token->hideset ? set_dup(token->hideset) : set_create();
+        if (entry->ident != NULL) {
+            entry->ident->macro = entry->before;
+            entry->ident->version++;
+            pp->defines++;
+        } else {
+            set_del(pp->once_guard, entry->once);
+            cstring_free(entry->once);
+        }
 
-    set_add(hideset, token->cs);
+        array_pop_back(pp->journal);
+    }
 
-    expand_tokens = __preprocessor_substitute__(pp, macro, NULL, hideset);
+    array_pop_back_n(pp->consulted, array_length(pp->consulted) - cp->consulted);
 
-    __propagate_space__(expand_tokens, token);
+    /* a condition the text left open was not when cp was taken */
+    array_clear(pp->condition_directive_stack);
 
-    __preprocessor_unget_tokens__(pp, expand_tokens);
+    pp->included = cp->included;
+    pp->mark++;
+}
 
-    set_destroy(hideset);
 
-    token_destroy(token);
+/**
+ * Does what a stretch of text read before did to the macros again, the
+ * #define and #undef in entries, taken from the journal then, instead of
+ * reading it; the names it looked up are noted down as if it was.
+ **/
+void preprocessor_redo(preprocessor_t *pp, const pp_journal_t *entries, size_t n,
+                       ident_t *const *consulted, size_t nconsulted)
+{
+    size_t i;
+
+    assert(pp->journal != NULL);
+
+    for (i = 0; i < n; i++) {
+        assert(entries[i].ident != NULL);
+        __preprocessor_bind__(pp, entries[i].ident, entries[i].after);
+    }
 
-    array_destroy(expand_tokens);
+    for (i = 0; i < nconsulted; i++) {
+        __preprocessor_consult__(pp, consulted[i]);
+    }
 }
 
 
-static
-array_t __preprocessor_parse_function_like_argument__(preprocessor_t pp, bool is_vararg)
+/**
+ * Writes the macros defined so far but the native ones, and the include
+ * guards and #pragma once met, to fn. Loading it into another run stands
+ * for reading the same prefix headers there, as far as the preprocessor
+ * state goes: the tokens the prefix expanded to are not kept.
+ **/
+bool preprocessor_save_snapshot(preprocessor_t *pp, const char *fn)
 {
-    array_t arg = __create_tokens__();
-    size_t level = 0;
+    pp_snapshot_writer_t w;
+    bool ok;
 
-    for (; !lexer_is_eos(pp->lexer); ) {
-        token_t token = lexer_peek(pp->lexer);
-        if (((token->type == TOKEN_R_PAREN) || 
-             (token->type == TOKEN_COMMA && is_vararg == false)) && level == 0) {
-            break;
-        }
+    w.buf = cstring_new_n(NULL, 4096);
+    w.count = 0;
 
-        if (token->type == TOKEN_L_PAREN) {
-            level++;
-        }
+    w.buf = snapshot_put_u32(w.buf, 0);
+    identtab_scan(pp->idents, __preprocessor_save_macro__, &w);
+    snapshot_patch_u32(w.buf, 0, (uint32_t) w.count);
 
-        if (token->type == TOKEN_R_PAREN) {
-            level--;
-        }
+    w.buf = __preprocessor_save_guards__(w.buf, (dict_t *) pp->include_guard);
+    w.buf = snapshot_put_u32(w.buf, (uint32_t) set_length(pp->once_guard));
+    set_scan(pp->once_guard, __preprocessor_save_once__, &w.buf);
 
-        array_cast_append(token_t, arg, token);
-        lexer_get(pp->lexer);
-    }
+    ok = snapshot_write(fn, w.buf);
 
-    return arg;
+    cstring_free(w.buf);
+    return ok;
 }
 
 
-static
-bool __preprocessor_parse_function_like_arguments__(preprocessor_t pp, 
-    token_t macroname_token, macro_t macro, map_t args)
+/**
+ * Binds the macros and guards of a snapshot, over any of the same names.
+ * Only the names are looked at, a macro body is read in from the mapped
+ * file when the macro is first expanded. Nothing is changed if the file
+ * is not a snapshot or does not read to its end.
+ **/
+bool preprocessor_load_snapshot(preprocessor_t *pp, const char *fn)
 {
-    token_t separator;
-    token_t *param_tokens;
-    size_t i, nparams;
-    
-    nparams = array_length(macro->function_like.params);
-    param_tokens = array_prototype(macro->function_like.params, token_t);
-    for (i = 0; !lexer_is_eos(pp->lexer); i++) {
-        if (i < nparams) {
-            array_t arg = __preprocessor_parse_function_like_argument__(pp,
-                param_tokens[i]->is_vararg);
-            map_add(args, param_tokens[i]->cs, arg);
-        } else {
-            array_t arg = __preprocessor_parse_function_like_argument__(pp,
-                false);
-            __destroy_tokens__(arg);
-        }
-        
-        separator = lexer_peek(pp->lexer);
-        if (separator->type == TOKEN_R_PAREN) {
-            break;
-        }
+    snapshot_t *snap;
 
-        if (separator->type != TOKEN_COMMA) {
-            ERRORF_WITH_TOKEN(macroname_token,
-                "unterminated argument list invoking macro \"%s\"", token_as_text(macroname_token));
-            return false;
-        }
+    snap = snapshot_open(fn);
+    if (snap == NULL) {
+        return false;
+    }
 
-        lexer_eat(pp->lexer);
+    if (!__preprocessor_walk_snapshot__(pp, snap, false)) {
+        snapshot_close(snap);
+        return false;
     }
 
+    __preprocessor_walk_snapshot__(pp, snap, true);
+    array_cast_append(snapshot_t*, pp->snapshots, snap);
     return true;
 }
 
 
-static
-bool __preprocessor_expand_function_macro__(preprocessor_t pp, token_t token, macro_t macro)
+token_t* preprocessor_expand(preprocessor_t *pp)
 {
-    map_t args = map_create();
-    token_t r_paren_token;
-    array_t expand_tokens;
-    set_t hideset;
+    token_t *tok;
 
-    if (!lexer_try(pp->lexer, TOKEN_L_PAREN)) {
-        return false;
-    }
-   
-    if (!__preprocessor_parse_function_like_arguments__(pp, token, macro, args)) {
-        return false;
-    }
+    for (;;) {
+        /* for the first token only, __preprocessor_expand__() turns it off */
+        pp->lexer->runs = pp->runs;
 
-    r_paren_token = lexer_peek(pp->lexer);
-    if (r_paren_token->type != TOKEN_R_PAREN) {
-        ERRORF_WITH_TOKEN(token,
-            "unterminated argument list invoking macro \"%s\"", token_as_text(token));
-        return false;
-    }
-    lexer_get(pp->lexer);
+        tok = __preprocessor_expand__(pp);
+        if (__preprocessor_parse_directive__(pp, tok)) {
+            continue;
+        }
 
-    hideset = token->hideset ? set_dup(token->hideset) : set_create();
+        if (tok->type == TOKEN_EOF) {
+            if (__preprocessor_leave__(pp, tok)) {
+                continue;
+            }
+        } else if (tok->type != TOKEN_NEWLINE && tok->type != TOKEN_END) {
+            __preprocessor_guard_token__(pp);
+            stats_count(STATS_TOKENS_OUT);
+        }
 
-    if (r_paren_token->hideset != NULL) {
-        hideset = set_intersection(hideset, r_paren_token->hideset);
+        return tok;
     }
+}
 
-    set_add(hideset, token->cs);
-    
-    expand_tokens = __create_tokens__();//__preprocessor_substitute__(pp, macro, args, hideset);
 
-    __propagate_space__(expand_tokens, token);
+/**
+ * Up to n tokens of preprocessor_expand() into tokens, and how many. The
+ * batch ends early after TOKEN_END or TOKEN_EOF.
+ **/
+size_t preprocessor_expand_batch(preprocessor_t *pp, token_t **tokens, size_t n)
+{
+    token_t *token;
+    size_t i = 0;
+
+    while (i < n) {
+        token = tokens[i++] = preprocessor_expand(pp);
+        if (token->type == TOKEN_END || token->type == TOKEN_EOF) {
+            break;
+        }
+    }
 
-    __preprocessor_unget_tokens__(pp, expand_tokens);
+    return i;
+}
 
-    set_destroy(hideset);
 
-    token_destroy(token);
+/**
+ * The same, the newlines left out as preprocessor_get() does.
+ **/
+size_t preprocessor_get_batch(preprocessor_t *pp, token_t **tokens, size_t n)
+{
+    token_t *token;
+    size_t i = 0;
 
-    array_destroy(expand_tokens);
+    while (i < n) {
+        token = tokens[i++] = preprocessor_get(pp);
+        if (token->type == TOKEN_END || token->type == TOKEN_EOF) {
+            break;
+        }
+    }
 
-    return true;
+    return i;
 }
 
 
-static 
-token_t __preprocessor_expand__(preprocessor_t pp)
+token_t* preprocessor_peek(preprocessor_t *pp)
 {
-    token_t token;
-    macro_t macro;
+    token_t *tok = preprocessor_get(pp);
+    if (tok->type != TOKEN_END) preprocessor_unget(pp, tok);
+    return tok;
+}
 
-    for (;;) {
-        token = lexer_get(pp->lexer);
 
-        if ((token->type != TOKEN_IDENTIFIER) || 
-            (token->type == TOKEN_NEWLINE) || 
-            (token->hideset && set_has(token->hideset, token->cs)) || 
-            ((macro = map_find(pp->macros, token->cs)) == NULL)) {
-            return token;
-        }
-   
-        if (macro->type == PP_MACRO_OBJECT) {
-            __preprocessor_expand_object_macro__(pp, token, macro);
-            break;
-        } else if (macro->type == PP_MACRO_FUNCTION) {
-            if (!__preprocessor_expand_function_macro__(pp, token, macro)) {
-                return token;
-            }
-            break;
-        } else if (macro->type == PP_MACRO_NATIVE) {
-            macro->native_macro_fn(token);
-            break;
-        } else {
-            assert(false);
+token_t* preprocessor_get(preprocessor_t *pp)
+{
+    for (;;) {
+        token_t *tok = preprocessor_expand(pp);
+        if (tok->type == TOKEN_NEWLINE) {
+            continue;
         }
+        return tok;
     }
+}
 
-    return __preprocessor_expand__(pp);
+
+void preprocessor_unget(preprocessor_t *pp, token_t *tok)
+{
+    assert(tok && tok->type != TOKEN_END);
+    lexer_unget(pp->lexer, tok);
 }
 
 
-static inline 
-array_t __preprocessor_substitute_object_like__(preprocessor_t pp, array_t macro_body)
+static inline
+void __propagate_space__(array_t *expand_tokens, token_t *token)
+{
+    if ((expand_tokens != NULL) && (array_length(expand_tokens) > 0)) {
+        token_t *t = array_cast_front(token_t*, expand_tokens);
+        t->spaces = token->spaces;
+    }
+}
+
+
+static inline
+hideset_t* __preprocessor_hideset_add__(hideset_t *hs, token_t *token)
+{
+    hideset_t *added = hideset_add(hs, __preprocessor_name__(token));
+    hideset_release(hs);
+    return added;
+}
+
+
+/**
+ * Notes down the name as one the cache being worked out depends on.
+ **/
+static
+void __preprocessor_record__(preprocessor_t *pp, token_t *token)
 {
-    array_t expand_tokens;
-    token_t *macro_tokens;
+    macro_cache_t *cache = pp->recording;
+    macro_depend_t *depend;
+    ident_t *ident;
     size_t i;
-    
-    expand_tokens = __create_tokens__();
 
-    array_foreach(macro_body, macro_tokens, i) {
-        token_t token = token_dup(macro_tokens[i]);
-        array_cast_append(token_t, expand_tokens, token);
+    ident = __preprocessor_ident__(pp, token);
+
+    array_foreach(cache->depends, depend, i) {
+        if (depend[i].ident == ident) {
+            return;
+        }
     }
-   
-    return expand_tokens;
+
+    depend = array_push_back(cache->depends);
+    depend->ident = ident;
+    depend->version = ident->version;
 }
 
 
 static
-bool __add_hide_set__(set_t hideset, array_t expand_tokens)
+bool __preprocessor_cache_valid__(preprocessor_t *pp, macro_cache_t *cache)
 {
-    token_t *tokens;
+    macro_depend_t *depend;
     size_t i;
 
-    array_foreach(expand_tokens, tokens, i) {
-        set_t token_hs = tokens[i]->hideset;
-        if (token_hs != NULL) {
-            tokens[i]->hideset = set_union(hideset, token_hs);
-            set_destroy(token_hs);
-        } else {
-            tokens[i]->hideset = set_dup(hideset);
+    if (cache->stamp == pp->defines) {
+        return true;
+    }
+
+    array_foreach(cache->depends, depend, i) {
+        if (depend[i].ident->version != depend[i].version) {
+            return false;
         }
     }
 
+    cache->stamp = pp->defines;
     return true;
 }
 
 
 /**
-* Select an argument for expansion.
-*/
-static inline
-array_t __preprocessor_select__(map_t args, token_t index)
+ * Works the expansion of the object-like macro named by token out on its
+ * own, as if the body were all that is left, noting down what it goes
+ * through. No cache is worked out inside another.
+ **/
+static
+macro_cache_t* __preprocessor_cache__(preprocessor_t *pp, token_t *token, macro_t *macro)
 {
-    array_t arg;
+    macro_cache_t *cache = macro->object_like.cache;
+    array_t *expand_tokens, *tokens;
+    hideset_t *hideset;
+    token_t *t;
+
+    if (cache != NULL) {
+        if (__preprocessor_cache_valid__(pp, cache)) {
+            stats_count(STATS_MACRO_CACHE_HITS);
+            return cache;
+        }
+
+        __macro_cache_destroy__(cache);
+        macro->object_like.cache = NULL;
+    }
+
+    stats_count(STATS_MACRO_CACHE_MISSES);
 
-    if (index->type != TOKEN_IDENTIFIER) {
+    cache = (macro_cache_t *) pmalloc(sizeof(macro_cache_t));
+    if (!cache) {
         return NULL;
     }
 
-    arg = map_find(args, index->cs);
-    if (arg != NULL) {
-        array_t replacements;
-        size_t i, n;
+    cache->tokens = NULL;
+    cache->depends = array_create_n(sizeof(macro_depend_t), 4);
+    cache->expanded = hideset_add(NULL, __preprocessor_name__(token));
+    cache->stamp = pp->defines;
+    cache->contextual = false;
+
+    expand_tokens = __preprocessor_substitute__(pp, macro, NULL, cache->expanded);
+    tokens = __create_tokens__();
 
-        replacements = array_create_n(sizeof(token_t), 2);
+    pp->recording = cache;
+    lexer_stash(pp->lexer);
+    lexer_unget_tokens(pp->lexer, expand_tokens);
 
-        for (i = 0, n = array_length(arg); i < n; i++) {
-            token_t token = array_cast_at(token_t, arg, i);
-            array_cast_append(token_t, replacements, token);
+    for (;;) {
+        t = __preprocessor_expand__(pp);
+        if (t->type == TOKEN_END) {
+            token_destroy(t);
+            break;
         }
 
-        __propagate_space__(replacements, index);
-        return replacements;
+        array_cast_append(token_t*, tokens, t);
     }
 
-    return NULL;
+    lexer_unstash(pp->lexer);
+    pp->recording = NULL;
+
+    if (cache->contextual) {
+        __destroy_tokens__(tokens);
+    } else {
+        cache->tokens = tokens;
+    }
+
+    macro->object_like.cache = cache;
+    return cache;
 }
 
 
+/**
+ * The names a cached expansion was worked out with are looked up by its
+ * use as much as by the expansion.
+ **/
 static inline
-token_t __preprocessor_stringify__(preprocessor_t pp, token_t template, array_t arg)
+void __preprocessor_consult_cache__(preprocessor_t *pp, macro_cache_t *cache)
 {
-    token_t dst;
-    cstring_t cs = cstring_new_n(NULL, 24);
-    token_t *tokens;
-    size_t i, spaces;
+    macro_depend_t *depend;
+    size_t i;
 
-    array_foreach(arg, tokens, i) {
-        spaces = tokens[i]->spaces;
-        while (spaces--) {
-            cs = cstring_concat_ch(cs, ' ');
-        }
-        cs = cstring_concat_n(cs, token_as_text(tokens[i]), strlen(token_as_text(tokens[i])));
+    if (pp->consulted == NULL) {
+        return;
     }
 
-    dst = token_dup(template);
-    if (dst->cs) {
-        cstring_free(dst->cs);
+    array_foreach(cache->depends, depend, i) {
+        __preprocessor_consult__(pp, depend[i].ident);
     }
-
-    dst->type = TOKEN_CONSTANT_STRING;
-    dst->cs = cs;
-    return dst;
 }
 
 
-static inline 
-array_t __preprocessor_glue_token__(preprocessor_t pp, token_t left, token_t right)
-{
+/**
+ * The cached expansion goes back by reference when the use has no
+ * hideset to add, only its first token is made anew for the spacing.
+ **/
+static
+void __preprocessor_splice_cache__(preprocessor_t *pp, token_t *token, macro_cache_t *cache)
+{
+    token_t **tokens;
+    array_t *expand_tokens;
+    token_t *first;
+    size_t n;
+
+    n = array_length(cache->tokens);
+    tokens = array_prototype(cache->tokens, token_t*);
+
+    pp->expansion = n;
+
+    if (n == 0) {
+        return;
+    }
+
+    if (token->hideset != NULL) {
+        expand_tokens = __preprocessor_copy_tokens__(cache->tokens);
+        __add_hide_set__(token->hideset, expand_tokens);
+        __propagate_space__(expand_tokens, token);
+        lexer_unget_tokens(pp->lexer, expand_tokens);
+        return;
+    }
+
+    first = token_instance(tokens[0]);
+    first->spaces = token->spaces;
+
+    lexer_unget_borrowed(pp->lexer, tokens + 1, n - 1);
+    lexer_unget(pp->lexer, first);
+}
+
+
+static inline
+void __preprocessor_expand_object_macro__(preprocessor_t *pp, token_t *token, macro_t *macro)
+{
+    array_t *expand_tokens;
+    hideset_t *hideset, *shared;
+    macro_cache_t *cache;
+
+    if (pp->recording == NULL) {
+        cache = __preprocessor_cache__(pp, token, macro);
+
+        if (cache != NULL && cache->tokens != NULL) {
+            shared = hideset_intersection(token->hideset, cache->expanded);
+
+            if (shared == NULL) {
+                __preprocessor_consult_cache__(pp, cache);
+                __preprocessor_splice_cache__(pp, token, cache);
+                token_destroy(token);
+                return;
+            }
+
+            hideset_release(shared);
+        }
+    }
+
+    hideset = hideset_add(token->hideset, __preprocessor_name__(token));
+
+    expand_tokens = __preprocessor_substitute__(pp, macro, NULL, hideset);
+
+    __preprocessor_place_expansion__(macro->object_like.body, expand_tokens, token);
+    __propagate_space__(expand_tokens, token);
+
+    /* the whole expansion goes back as one span */
+    pp->expansion = array_length(expand_tokens);
+    lexer_unget_tokens(pp->lexer, expand_tokens);
+
+    hideset_release(hideset);
+
+    token_destroy(token);
+}
+
+
+/**
+ * The tokens of an argument, read a batch at a time; what follows it, the
+ * ',' or ')' and the rest of the batch, is handed back.
+ **/
+static
+array_t* __preprocessor_parse_function_like_argument__(preprocessor_t *pp, bool is_vararg)
+{
+    array_t *arg = __create_tokens__();
+    token_t *batch[LEXER_BATCH];
+    token_t *token;
+    size_t level = 0, i, n;
+
+    for (;;) {
+        n = lexer_get_batch(pp->lexer, batch, LEXER_BATCH);
+
+        for (i = 0; i < n; i++) {
+            token = batch[i];
+
+            if (token->type == TOKEN_END ||
+                (((token->type == TOKEN_R_PAREN) ||
+                  (token->type == TOKEN_COMMA && is_vararg == false)) && level == 0)) {
+                lexer_unget_batch(pp->lexer, batch + i, n - i);
+                return arg;
+            }
+
+            if (token->type == TOKEN_L_PAREN) {
+                level++;
+            }
+
+            if (token->type == TOKEN_R_PAREN) {
+                level--;
+            }
+
+            array_cast_append(token_t*, arg, token);
+        }
+    }
+}
+
+
+/**
+ * The arguments of an invocation go to args by parameter index, those
+ * missing stay NULL and read as empty.
+ **/
+static
+bool __preprocessor_parse_function_like_arguments__(preprocessor_t *pp, 
+    token_t *macroname_token, macro_t *macro, pp_arg_t *args)
+{
+    token_t *separator;
+    token_t **param_tokens;
+    size_t i, nparams;
+    
+    nparams = array_length(macro->function_like.params);
+    param_tokens = array_prototype(macro->function_like.params, token_t*);
+    for (i = 0; !lexer_is_empty(pp->lexer); i++) {
+        if (i < nparams) {
+            args[i].raw = __preprocessor_parse_function_like_argument__(pp,
+                param_tokens[i]->is_vararg);
+        } else {
+            array_t *arg = __preprocessor_parse_function_like_argument__(pp,
+                false);
+            __destroy_tokens__(arg);
+        }
+        
+        separator = lexer_peek(pp->lexer);
+        if (separator->type == TOKEN_R_PAREN) {
+            break;
+        }
+
+        if (separator->type != TOKEN_COMMA) {
+            errorf_with_token(macroname_token,
+                "unterminated argument list invoking macro \"%s\"", token_as_text(macroname_token));
+            return false;
+        }
+
+        lexer_eat(pp->lexer);
+    }
+
+    return true;
+}
+
+
+static
+bool __preprocessor_expand_function_macro__(preprocessor_t *pp, token_t *token, macro_t *macro)
+{
+    pp_arg_t local[PP_MACRO_ARGS];
+    pp_arg_t *args = local;
+    arena_t *arena = NULL;
+    arena_mark_t mark;
+    token_t *r_paren_token;
+    array_t *expand_tokens;
+    hideset_t *hideset, *shared;
+    size_t i, nparams;
+    bool expanded = false;
+
+    if (!lexer_try(pp->lexer, TOKEN_L_PAREN)) {
+        return false;
+    }
+
+    /* the arguments are bound by index, few enough for the stack mostly */
+    nparams = array_length(macro->function_like.params);
+    if (nparams > PP_MACRO_ARGS) {
+        arena = arena_of(ARENA_PHASE_EXPANSION);
+        mark = arena_mark(arena);
+        args = (pp_arg_t *) arena_alloc(arena, nparams * sizeof(pp_arg_t));
+    }
+
+    for (i = 0; i < nparams; i++) {
+        args[i].raw = NULL;
+        args[i].expanded = NULL;
+    }
+   
+    if (!__preprocessor_parse_function_like_arguments__(pp, token, macro, args)) {
+        goto done;
+    }
+
+    r_paren_token = lexer_peek(pp->lexer);
+    if (r_paren_token->type != TOKEN_R_PAREN) {
+        errorf_with_token(token,
+            "unterminated argument list invoking macro \"%s\"", token_as_text(token));
+        goto done;
+    }
+    lexer_get(pp->lexer);
+
+    /* (HS(name) & HS(rparen)) | {name} */
+    shared = hideset_intersection(token->hideset, r_paren_token->hideset);
+    hideset = hideset_add(shared, __preprocessor_name__(token));
+    hideset_release(shared);
+    token_destroy(r_paren_token);
+
+    expand_tokens = __preprocessor_substitute__(pp, macro, args, hideset);
+
+    __preprocessor_place_expansion__(macro->function_like.body, expand_tokens, token);
+    __propagate_space__(expand_tokens, token);
+
+    /* the whole expansion goes back as one span */
+    pp->expansion = array_length(expand_tokens);
+    lexer_unget_tokens(pp->lexer, expand_tokens);
+
+    hideset_release(hideset);
+
+    token_destroy(token);
+
+    expanded = true;
+
+done:
+    for (i = 0; i < nparams; i++) {
+        if (args[i].raw != NULL) {
+            __destroy_tokens__(args[i].raw);
+        }
+
+        if (args[i].expanded != NULL) {
+            __destroy_tokens__(args[i].expanded);
+        }
+    }
+
+    if (arena != NULL) {
+        arena_reset(arena, mark);
+    }
+
+    return expanded;
+}
+
+
+static 
+token_t* __preprocessor_expand__(preprocessor_t *pp)
+{
+    stats_phase_t phase;
+    token_t *token;
+    ident_t *ident;
+    macro_t *macro;
+    cstring_t name;
+    size_t span;
+
+    for (;;) {
+        token = lexer_get(pp->lexer);
+        pp->lexer->runs = false;
+
+        if ((token->type != TOKEN_IDENTIFIER) || 
+            (token->type == TOKEN_NEWLINE)) {
+            return token;
+        }
+
+        if (pp->recording != NULL) {
+            __preprocessor_record__(pp, token);
+        }
+
+        ident = __preprocessor_ident__(pp, token);
+        if (pp->consulted != NULL) {
+            __preprocessor_consult__(pp, ident);
+        }
+
+        if ((macro = ident->macro) == NULL || hideset_has(token->hideset, ident->name)) {
+            return token;
+        }
+
+        if (macro->record != NULL) {
+            __preprocessor_read_in__(macro, token);
+        }
+
+        if (pp->recording != NULL) {
+            if (macro->type != PP_MACRO_OBJECT) {
+                /* what it makes depends on the tokens after, not to be cached */
+                pp->recording->contextual = true;
+                return token;
+            }
+
+            pp->recording->expanded = __preprocessor_hideset_add__(pp->recording->expanded, token);
+        }
+   
+        phase = stats_enter(STATS_PHASE_EXPAND);
+
+        /* the trace has the expansions of the text, not those they go through */
+        name = token->ident->name;
+        span = pp->expanding++ == 0 ? trace_enter(TRACE_MACRO, name, cstring_length(name)) : 0;
+        pp->expansion = 1;
+
+        if (macro->type == PP_MACRO_OBJECT) {
+            __preprocessor_expand_object_macro__(pp, token, macro);
+        } else if (macro->type == PP_MACRO_FUNCTION) {
+            if (!__preprocessor_expand_function_macro__(pp, token, macro)) {
+                pp->expanding--;
+                trace_drop(span);
+                stats_leave(phase);
+                return token;
+            }
+        } else if (macro->type == PP_MACRO_NATIVE) {
+            macro->native_macro_fn(token);
+        } else {
+            assert(false);
+        }
+
+        pp->expanding--;
+        trace_leave(span, pp->expansion);
+        stats_leave(phase);
+        stats_count(STATS_MACROS_EXPANDED);
+        break;
+    }
+
+    return __preprocessor_expand__(pp);
+}
+
+
+static inline 
+array_t* __preprocessor_substitute_object_like__(preprocessor_t *pp, token_ptr_array_t *macro_body)
+{
+    array_t *expand_tokens;
+    token_t **macro_tokens;
+    size_t i;
+    
+    expand_tokens = __create_tokens__();
+
+    array_foreach(macro_body, macro_tokens, i) {
+        token_t *token = token_instance(macro_tokens[i]);
+        array_cast_append(token_t*, expand_tokens, token);
+    }
+   
+    return expand_tokens;
+}
+
+
+/**
+ * Moves the tokens copied from the body into a range of their own, made
+ * for this use of the macro at token: each is as far into it as it was
+ * into the body, which stays its spelling, and the use is its expansion.
+ * Tokens of the arguments or pasted together are left where they are.
+ * A cached expansion goes back as it was recorded, with no range.
+ **/
+static
+void __preprocessor_place_expansion__(token_ptr_array_t *body, array_t *expand_tokens, token_t *token)
+{
+    token_t **tokens;
+    srcloc_t lo = SRCLOC_NONE, hi = SRCLOC_NONE, base, loc;
+    size_t i;
+
+    array_foreach(body, tokens, i) {
+        loc = tokens[i]->loc;
+
+        if (loc != SRCLOC_NONE && (lo == SRCLOC_NONE || loc < lo)) {
+            lo = loc;
+        }
+
+        if (loc > hi) {
+            hi = loc;
+        }
+    }
+
+    /* a body is spelled in one buffer, unless it was made up */
+    if (lo == SRCLOC_NONE || srcloc_range(lo) != srcloc_range(hi)) {
+        return;
+    }
+
+    if ((base = srcloc_add_expansion(lo, hi - lo + 1, token->loc)) == SRCLOC_NONE) {
+        return;
+    }
+
+    array_foreach(expand_tokens, tokens, i) {
+        loc = tokens[i]->loc;
+
+        if (loc >= lo && loc <= hi) {
+            tokens[i]->loc = base + (loc - lo);
+        }
+    }
+}
+
+
+static
+bool __add_hide_set__(hideset_t *hideset, array_t *expand_tokens)
+{
+    token_t **tokens;
+    hideset_t *token_hs;
+    size_t i;
+
+    array_foreach(expand_tokens, tokens, i) {
+        token_hs = tokens[i]->hideset;
+        tokens[i]->hideset = hideset_union(hideset, token_hs);
+        hideset_release(token_hs);
+    }
+
+    return true;
+}
+
+
+static inline
+array_t* __preprocessor_copy_tokens__(array_t *tokens)
+{
+    array_t *copies;
+    token_t **base;
+    size_t i;
+
+    copies = array_create_n(sizeof(token_t*), tokens ? array_length(tokens) : 2);
+
+    if (tokens != NULL) {
+        array_foreach(tokens, base, i) {
+            array_cast_append(token_t*, copies, token_instance(base[i]));
+        }
+    }
+
+    return copies;
+}
+
+
+/**
+ * The argument macro expanded on its own, as if it were the rest of the
+ * file. The raw tokens go into it when no # or ## needs them after.
+ **/
+static
+array_t* __preprocessor_expand_argument__(preprocessor_t *pp, pp_arg_t *arg, bool take)
+{
+    array_t *expanded;
+    token_t *token;
+
+    expanded = __create_tokens__();
+
+    lexer_stash(pp->lexer);
+
+    if (take && arg->raw != NULL) {
+        lexer_unget_tokens(pp->lexer, arg->raw);
+        arg->raw = NULL;
+    } else {
+        lexer_unget_tokens(pp->lexer, __preprocessor_copy_tokens__(arg->raw));
+    }
+
+    for (;;) {
+        token = __preprocessor_expand__(pp);
+        if (token->type == TOKEN_END) {
+            token_destroy(token);
+            break;
+        }
+
+        array_cast_append(token_t*, expanded, token);
+    }
+
+    lexer_unstash(pp->lexer);
+
+    return expanded;
+}
+
+
+/**
+ * The tokens of the argument for the parameter ref, NULL if ref is none.
+ * As an operand of # or ## the argument is taken as written, otherwise
+ * macro expanded, which happens once however often the body names it.
+ * A form needed by one use only is handed over, the array with it,
+ * others are copied for each use.
+ **/
+static inline
+array_t* __preprocessor_select__(preprocessor_t *pp, macro_t *macro, pp_arg_t *args,
+    int ref, token_t *index, bool raw)
+{
+    macro_uses_t *uses;
+    array_t *replacements;
+    pp_arg_t *arg;
+
+    if (ref == PP_MACRO_NO_PARAM) {
+        return NULL;
+    }
+
+    arg = &args[ref];
+    uses = &array_cast_at(macro_uses_t, macro->function_like.uses, ref);
+
+    if (raw) {
+        replacements = __preprocessor_copy_tokens__(arg->raw);
+    } else {
+        if (arg->expanded == NULL) {
+            arg->expanded = __preprocessor_expand_argument__(pp, arg, uses->raw == 0);
+        }
+
+        if (uses->expanded == 1) {
+            replacements = arg->expanded;
+            arg->expanded = NULL;
+        } else {
+            replacements = __preprocessor_copy_tokens__(arg->expanded);
+        }
+    }
+
+    __propagate_space__(replacements, index);
+    return replacements;
+}
+
+
+static inline
+token_t* __preprocessor_stringify__(preprocessor_t *pp, token_t *template, array_t *arg)
+{
+    token_t *dst;
+    cstring_t cs = cstring_new_n(NULL, 24);
+    token_t **tokens;
+    size_t i, spaces;
+
+    /* an argument left out reads as nothing */
+    if (arg != NULL) {
+        array_foreach(arg, tokens, i) {
+            spaces = tokens[i]->spaces;
+            while (spaces--) {
+                cs = cstring_concat_ch(cs, ' ');
+            }
+            cs = cstring_concat_n(cs, token_as_text(tokens[i]), strlen(token_as_text(tokens[i])));
+        }
+    }
+
+    dst = token_instance(template);
+    if (dst->cs) {
+        cstring_free(dst->cs);
+    }
+
+    dst->type = TOKEN_CONSTANT_STRING;
+    dst->cs = cs;
+    return dst;
+}
+
+
+static inline 
+array_t* __preprocessor_glue_token__(preprocessor_t *pp, token_t *left, token_t *right)
+{
     cstring_t cs;
+    array_t *tokens;
+    bool begin_of_line;
+
     cs = cstring_new(token_as_text(left));
     cs = cstring_concat_n(cs, token_as_text(right), strlen(token_as_text(right)));
+
+    /* the pasted text is a stream of its own, which must not disturb ours */
+    begin_of_line = pp->lexer->begin_of_line;
     lexer_push(pp->lexer, STREAM_TYPE_STRING, cs);
-    return lexer_tokenize(pp->lexer);
+    tokens = lexer_tokenize(pp->lexer);
+    pp->lexer->begin_of_line = begin_of_line;
+
+    cstring_free(cs);
+
+    /* without the newline made up at the end of the string */
+    if (!array_is_empty(tokens) &&
+        array_cast_back(token_t*, tokens)->type == TOKEN_NEWLINE) {
+        array_pop_back(tokens);
+    }
+
+    return tokens;
+}
+
+
+static inline 
+void __preprocessor_glue__(preprocessor_t *pp, array_t *expand_tokens, token_t *token)
+{
+    token_t *last;
+    array_t *glue_token;
+
+    last = array_cast_back(token_t*, expand_tokens);
+
+    array_pop_back(expand_tokens);
+
+    glue_token = __preprocessor_glue_token__(pp, last, token);
+
+    __propagate_space__(glue_token, last);
+
+    array_extend(expand_tokens, glue_token);
+
+    array_destroy(glue_token);
+
+    /* the left operand was the expansion's own, the right is the caller's */
+    token_destroy(last);
+}
+
+
+/**
+ * The body with the parameters replaced, each body token told apart by
+ * the index resolved at #define, see macro_t.
+ **/
+static inline 
+array_t* __preprocessor_substitute_function_like__(preprocessor_t *pp, macro_t *macro, pp_arg_t *args)
+{
+    array_t *expand_tokens;
+    token_t **body;
+    int *refs;
+    size_t i, n;
+
+    expand_tokens = array_create_n(sizeof(token_t*), 8);
+
+    body = macro->function_like.body->elts;
+    refs = array_prototype(macro->function_like.refs, int);
+    n = array_length(macro->function_like.body);
+
+    for (i = 0; i < n; i++) {
+        token_t *token = body[i];
+
+        if (token->type == TOKEN_HASH && i + 1 < n) {
+            array_t *arg;
+
+            i++;
+            arg = refs[i] == PP_MACRO_NO_PARAM ? NULL : args[refs[i]].raw;
+
+            array_cast_append(token_t*, expand_tokens, __preprocessor_stringify__(pp, token, arg));
+            continue;
+        } else if (token->type == TOKEN_HASHHASH && i + 1 < n) {
+            token_t *stringify = body[++i];
+            array_t *replacements = __preprocessor_select__(pp, macro, args, refs[i], stringify, true);
+            if (replacements == NULL) {
+                __preprocessor_glue__(pp, expand_tokens, stringify);
+                continue;
+            } else {
+                size_t j, m;
+
+                if (array_length(replacements) == 0) {
+                    array_destroy(replacements);
+                    continue;
+                } else {
+                    stringify = array_cast_front(token_t*, replacements);
+                    __preprocessor_glue__(pp, expand_tokens, stringify);
+                    token_destroy(stringify);
+
+                    for (j = 1, m = array_length(replacements); j < m; j++) {
+                        array_cast_append(token_t*, expand_tokens, array_cast_at(token_t*, replacements, j));
+                    }
+
+                    array_destroy(replacements);
+                    continue;
+                }
+            }
+            
+        } else {
+            bool pasted = i + 1 < n && body[i + 1]->type == TOKEN_HASHHASH;
+            array_t *replacements = __preprocessor_select__(pp, macro, args, refs[i], token, pasted);
+            if (replacements != NULL) {
+                if (pasted && array_length(replacements) == 0) {
+                    i++;
+                } else {
+                    array_extend(expand_tokens, replacements);
+                }
+
+                array_destroy(replacements);
+                continue;
+            } 
+        }
+
+        token = token_instance(token);
+        array_cast_append(token_t*, expand_tokens, token);
+    }
+
+    return expand_tokens;
+}
+
+
+static inline 
+array_t* __preprocessor_substitute__(preprocessor_t *pp, macro_t *macro, pp_arg_t *args, hideset_t *hideset)
+{
+    array_t *expand_tokens;
+
+    switch (macro->type) {
+    case PP_MACRO_OBJECT:
+        expand_tokens = __preprocessor_substitute_object_like__(pp, 
+            macro->object_like.body);
+        break;
+    case PP_MACRO_FUNCTION:
+        expand_tokens = __preprocessor_substitute_function_like__(pp, macro, args);
+        break;
+    default:
+        assert(false);
+    }
+
+    __add_hide_set__(hideset, expand_tokens);
+
+    return expand_tokens;
+}
+
+
+static
+bool __preprocessor_check_macro_body__(preprocessor_t *pp, token_ptr_array_t *body)
+{
+    token_t *token;
+
+    if (array_is_empty(body)) {
+        return true;
+    }
+
+    token = body->elts[0];
+    if (token->type == TOKEN_HASHHASH) {
+        errorf_with_token(token, "'##' cannot appear at start of macro expansion");
+        return false;
+    }
+
+    token = *token_ptr_array_back(body);
+    if (token->type == TOKEN_HASHHASH) {
+        errorf_with_token(token, "'##' cannot appear at end of macro expansion");
+        return false;
+    }
+
+    return true;
+}
+
+
+static
+void __preprocessor_skip_one_line__(preprocessor_t *pp)
+{
+    for (; !lexer_is_empty(pp->lexer); ) {
+        token_t *token = lexer_get(pp->lexer);
+        if (token->type == TOKEN_NEWLINE) {
+            token_destroy(token);
+            break;
+        }
+        token_destroy(token);
+    }
+}
+
+
+static
+bool __preprocessor_parse_object_like__(preprocessor_t *pp, token_t *macroname_token)
+{
+    token_ptr_array_t *macro_body;
+
+    macro_body = token_ptr_array_create();
+
+    for (;;) {
+        token_t *token = lexer_peek(pp->lexer);
+        if (token->type == TOKEN_NEWLINE || token->type == TOKEN_EOF || token->type == TOKEN_END) {
+            break;
+        }
+        lexer_get(pp->lexer);
+        token_ptr_array_append(macro_body, token);
+    }
+
+    if (!__preprocessor_check_macro_body__(pp, macro_body)) {
+        token_destroy(macroname_token);
+        __destroy_body__(macro_body);
+        __preprocessor_skip_one_line__(pp);
+        return false;
+    }
+
+    __preprocessor_add_macro__(pp, macroname_token,
+        PP_MACRO_OBJECT, NULL, macro_body, NULL, NULL, NULL, false);
+
+    return true;
+}
+
+
+static
+bool __preprocessor_add_function_like_param__(preprocessor_t *pp,
+    array_t *params, token_t *identifier_token)
+{
+    token_t **tokens;
+    size_t i;
+
+    array_foreach(params, tokens, i) {
+        if (cstring_compare_cs(token_cs(tokens[i]), token_cs(identifier_token)) == 0) {
+            errorf_with_token(identifier_token,
+                "duplicate macro parameter \"%s\"", token_as_text(identifier_token));
+            return false;
+        }
+    }
+
+    array_cast_append(token_t*, params, identifier_token);
+    return true;
+}
+
+
+static
+bool __preprocessor_parse_function_like_params__(preprocessor_t *pp, array_t *params, bool *variadic)
+{
+    token_t *token;
+    bool prev_ident = false;
+
+    for (;;) {
+        token = lexer_peek(pp->lexer);
+        switch (token->type) {
+        case TOKEN_IDENTIFIER:
+            if (prev_ident == true) {
+                errorf_with_token(token, "macro parameters must be comma-separated");
+                return false;
+            }
+
+            prev_ident = true;
+
+            if (!__preprocessor_add_function_like_param__(pp, params, token)) {
+                return false;
+            }
+
+            lexer_get(pp->lexer);
+            continue;
+        case TOKEN_R_PAREN:
+            if (prev_ident == true || array_is_empty(params)) {
+                lexer_eat(pp->lexer);
+                return true;
+            }
+        case TOKEN_COMMA:
+            if (prev_ident == false) {
+                errorf_with_token(token, "parameter name missing");
+                return false;
+            }
+            lexer_eat(pp->lexer);
+            prev_ident = false;
+            continue;
+        case TOKEN_ELLIPSIS:
+            *variadic = true;
+
+            if (prev_ident == false) {
+                /* anonymous variadic macros */
+                const char *va_args = "__VA_ARGS__";
+                const size_t n_va_args = 11;
+                token = token_copy(token);
+                token->type = TOKEN_IDENTIFIER;
+                token->cs = cstring_copy_n(token_cs(token), va_args, n_va_args);
+                token->is_vararg = true;
+                if (!__preprocessor_add_function_like_param__(pp, params, token)) {
+                    return false;
+                }
+
+            } else {
+                /* named variadic macros */
+                array_cast_back(token_t*, params)->is_vararg = true;
+            }
+
+            lexer_eat(pp->lexer);
+
+            if (lexer_try(pp->lexer, TOKEN_R_PAREN)) {
+                return true;
+            }
+        case TOKEN_NEWLINE:
+        case TOKEN_END:
+            errorf_with_token(token, "missing ')' in macro parameter list");
+            return false;
+        default:
+            errorf_with_token(token, 
+                "\"%s\" may not appear in macro parameter list", token_as_text(token));
+            return false;
+        }
+    }
+
+    return false;
+}
+
+
+/**
+ * How each parameter is used, counted off the body once it is read: an
+ * operand of # or ## takes the argument as written, any other use takes
+ * it macro expanded.
+ **/
+static
+void __preprocessor_count_uses__(token_ptr_array_t *macro_body, array_t *refs, array_t *uses)
+{
+    token_t **body = macro_body->elts;
+    int *ref = array_prototype(refs, int);
+    macro_uses_t *use;
+    size_t i, n = array_length(macro_body);
+
+    for (i = 0; i < n; i++) {
+        if (ref[i] == PP_MACRO_NO_PARAM) {
+            continue;
+        }
+
+        use = &array_cast_at(macro_uses_t, uses, ref[i]);
+
+        if ((i > 0 && (body[i - 1]->type == TOKEN_HASH || body[i - 1]->type == TOKEN_HASHHASH)) ||
+            (i + 1 < n && body[i + 1]->type == TOKEN_HASHHASH)) {
+            use->raw++;
+        } else {
+            use->expanded++;
+        }
+    }
+}
+
+
+/**
+ * The body, with the parameter each of its tokens names resolved to an
+ * index in refs once and for all, and in uses how each is named.
+ **/
+static
+bool __preprocessor_parse_function_like_body__(preprocessor_t *pp, array_t *params,
+    token_ptr_array_t *macro_body, array_t *refs, array_t *uses)
+{
+    token_t **param_tokens;
+    macro_uses_t *use;
+    size_t i, nparams;
+    ident_t *ident;
+    int ref;
+
+    nparams = array_length(params);
+    param_tokens = array_prototype(params, token_t*);
+
+    for (i = 0; i < nparams; i++) {
+        use = array_push_back(uses);
+        use->expanded = 0;
+        use->raw = 0;
+    }
+
+    for (; !lexer_is_empty(pp->lexer); ) {
+        token_t *token = lexer_peek(pp->lexer);
+        if (token->type == TOKEN_NEWLINE) {
+            /* left for the caller, like after an object-like macro */
+            __preprocessor_count_uses__(macro_body, refs, uses);
+            return __preprocessor_check_macro_body__(pp, macro_body);
+        }
+
+        ref = PP_MACRO_NO_PARAM;
+
+        if (token->type == TOKEN_IDENTIFIER) {
+            ident = __preprocessor_ident__(pp, token);
+
+            for (i = 0; i < nparams; i++) {
+                if (__preprocessor_ident__(pp, param_tokens[i]) == ident) {
+                    ref = (int) i;
+                    break;
+                }
+            }
+        }
+
+        token_ptr_array_append(macro_body, token);
+        array_cast_append(int, refs, ref);
+        lexer_get(pp->lexer);
+    }
+
+    return false;
+}
+
+
+static
+bool __preprocessor_parse_function_like__(preprocessor_t *pp, token_t *macroname_token)
+{
+    array_t *macro_params;
+    token_ptr_array_t *macro_body;
+    array_t *macro_refs;
+    array_t *macro_uses;
+    bool is_variadic = false;
+
+    /* eat '(' */
+    lexer_eat(pp->lexer);
+
+    macro_params = __create_tokens__();
+    if (!__preprocessor_parse_function_like_params__(pp, macro_params, &is_variadic)) {
+        assert((is_variadic == false) || (is_variadic == true && !array_is_empty(macro_params)));
+        __preprocessor_skip_one_line__(pp);
+        __destroy_tokens__(macro_params);
+        token_destroy(macroname_token);
+        return false;
+    }
+
+    macro_body = token_ptr_array_create();
+    macro_refs = array_create_n(sizeof(int), 8);
+    macro_uses = array_create_n(sizeof(macro_uses_t), 4);
+    if (!__preprocessor_parse_function_like_body__(pp, macro_params, macro_body,
+                                                   macro_refs, macro_uses)) {
+        __preprocessor_skip_one_line__(pp);
+        __destroy_tokens__(macro_params);
+        __destroy_body__(macro_body);
+        array_destroy(macro_refs);
+        array_destroy(macro_uses);
+        token_destroy(macroname_token);
+        return false;
+    }
+
+    __preprocessor_add_macro__(pp, macroname_token,
+        PP_MACRO_FUNCTION, NULL, macro_body, macro_params, macro_refs, macro_uses, is_variadic);
+
+    return true;
+}
+
+
+static
+bool __preprocessor_parse_define__(preprocessor_t *pp)
+{
+    token_t *macroname_token;
+    token_t *l_paren_token;
+
+    macroname_token = lexer_get(pp->lexer);
+    if (macroname_token->type != TOKEN_IDENTIFIER) {
+        errorf_with_token(macroname_token, "macro names must be identifiers");
+        token_destroy(macroname_token);
+        __preprocessor_skip_one_line__(pp);
+        return false;
+    }
+
+    l_paren_token = lexer_peek(pp->lexer);
+    if (l_paren_token->type == TOKEN_L_PAREN && l_paren_token->spaces == 0) {
+        return __preprocessor_parse_function_like__(pp, macroname_token);
+    }
+
+    return __preprocessor_parse_object_like__(pp, macroname_token);
+}
+
+
+static inline
+bool __preprocessor_parse_undef__(preprocessor_t *pp)
+{
+    token_t *macroname_token;
+    token_t *token;
+    ident_t *ident;
+
+    macroname_token = lexer_get(pp->lexer);
+    if (macroname_token->type != TOKEN_IDENTIFIER) {
+        errorf_with_token(macroname_token, "macro names must be identifiers");
+        token_destroy(macroname_token);
+        __preprocessor_skip_one_line__(pp);
+        return false;
+    }
+
+    ident = __preprocessor_ident__(pp, macroname_token);
+    __preprocessor_bind__(pp, ident, NULL);
+
+    token_destroy(macroname_token);
+
+    __preprocessor_finish_line__(pp, "undef");
+    return true;
+}
+
+
+/**
+ * The rest of a directive line goes, but for the newline which stays as
+ * after #define.
+ **/
+static
+void __preprocessor_finish_line__(preprocessor_t *pp, const char *directive)
+{
+    token_t *token;
+
+    token = lexer_peek(pp->lexer);
+    if (token->type == TOKEN_NEWLINE || token->type == TOKEN_END || token->type == TOKEN_EOF) {
+        return;
+    }
+
+    if (directive != NULL) {
+        warningf_with_token(token, "extra tokens at end of #%s directive", directive);
+    }
+
+    while (token->type != TOKEN_NEWLINE && token->type != TOKEN_END && token->type != TOKEN_EOF) {
+        lexer_eat(pp->lexer);
+        token = lexer_peek(pp->lexer);
+    }
+}
+
+
+static inline
+include_frame_t* __preprocessor_frame__(preprocessor_t *pp)
+{
+    return array_is_empty(pp->includes) ? NULL : &array_cast_back(include_frame_t, pp->includes);
+}
+
+
+/**
+ * The conditions open before the current file, which it may not close.
+ **/
+static inline
+size_t __preprocessor_base__(preprocessor_t *pp)
+{
+    include_frame_t *frame = __preprocessor_frame__(pp);
+    return frame != NULL ? frame->depth : 0;
+}
+
+
+/**
+ * A token other than a newline came out of the current file.
+ **/
+static inline
+void __preprocessor_guard_token__(preprocessor_t *pp)
+{
+    include_frame_t *frame = __preprocessor_frame__(pp);
+
+    if (frame != NULL && array_length(pp->condition_directive_stack) == frame->depth) {
+        frame->guard_state = PP_GUARD_NONE;
+    }
+}
+
+
+/**
+ * Called on every directive of the current file, taken or skipped, before
+ * it is acted upon. Only an #ifndef may come first and nothing may come
+ * after its #endif; an #else or #elif of the guard is not a guard.
+ **/
+static inline
+void __preprocessor_guard_directive__(preprocessor_t *pp, token_type_t directive)
+{
+    include_frame_t *frame = __preprocessor_frame__(pp);
+    size_t depth;
+
+    if (frame == NULL || frame->guard_state == PP_GUARD_NONE) {
+        return;
+    }
+
+    depth = array_length(pp->condition_directive_stack);
+
+    if (depth == frame->depth) {
+        frame->guard_state = frame->guard_state == PP_GUARD_START && directive == TOKEN_PP_IFNDEF ?
+            PP_GUARD_INSIDE : PP_GUARD_NONE;
+    } else if (depth == frame->depth + 1 && frame->guard_state == PP_GUARD_INSIDE &&
+               (directive == TOKEN_PP_ELSE || directive == TOKEN_PP_ELIF)) {
+        frame->guard_state = PP_GUARD_NONE;
+    }
+}
+
+
+/**
+ * The end of a file: its conditions must be closed, and a file found to
+ * be guarded is remembered by identity. False for the main file, whose
+ * TOKEN_EOF is for the caller.
+ **/
+static
+bool __preprocessor_leave__(preprocessor_t *pp, token_t *eof)
+{
+    include_frame_t *frame;
+    size_t base;
+
+    base = __preprocessor_base__(pp);
+
+    if (array_length(pp->condition_directive_stack) > base) {
+        errorf_with_token(eof, "unterminated conditional directive");
+        array_pop_back_n(pp->condition_directive_stack,
+                         array_length(pp->condition_directive_stack) - base);
+    }
+
+    frame = __preprocessor_frame__(pp);
+    if (frame == NULL) {
+        return false;
+    }
+
+    if (frame->guard_state == PP_GUARD_AFTER && frame->guard != NULL) {
+        map_add(pp->include_guard, frame->identity, frame->guard);
+    }
+
+    trace_leave(frame->span, 0);
+    cstring_free(frame->identity);
+    array_pop_back(pp->includes);
+
+    token_destroy(eof);
+    return true;
+}
+
+
+/**
+ * "name" is looked for next to the file including it first, both forms
+ * then go through the include paths in order.
+ **/
+static
+incpath_file_t* __preprocessor_search__(preprocessor_t *pp, cstring_t name, bool angled)
+{
+    include_frame_t *frame;
+    incpath_file_t *file;
+    arena_t *arena;
+    arena_mark_t mark;
+    cstring_t fn, from = NULL;
+    const char *slash;
+
+    arena = arena_of(ARENA_PHASE_DIRECTIVE);
+    mark = arena_mark(arena);
+
+    if (!angled) {
+        /* a file replayed from the cache has no stream to ask */
+        frame = __preprocessor_frame__(pp);
+        fn = frame != NULL ? frame->path : reader_filename(pp->lexer->reader);
+        slash = fn != NULL ? strrchr((const char *) fn, '/') : NULL;
+
+        from = arena_cstring(arena, fn, slash != NULL ? slash - (const char *) fn + 1 : 0);
+    }
+
+    file = incpath_resolve(pp->include_paths, name, from, 0);
+
+    arena_reset(arena, mark);
+
+    return file;
+}
+
+
+/**
+ * The name an #include asks for, consumed up to the end of the line. A
+ * computed #include is expanded, to a string or to the spellings between
+ * < and >.
+ **/
+static
+cstring_t __preprocessor_header_name__(preprocessor_t *pp, bool *angled)
+{
+    token_t *token;
+    cstring_t name = NULL, cs;
+
+    token = lexer_scan_header_name(pp->lexer);
+
+    if (token->type == TOKEN_IDENTIFIER) {
+        lexer_unget(pp->lexer, token);
+        token = __preprocessor_expand__(pp);
+    }
+
+    if (token->type == TOKEN_PP_HEADER_NAME) {
+        cs = token_cs(token);
+        if (cstring_length(cs) >= 2 && cs[cstring_length(cs) - 1] == (cs[0] == '<' ? '>' : '"')) {
+            name = cstring_new_n(cs + 1, cstring_length(cs) - 2);
+            *angled = cs[0] == '<';
+        }
+    } else if (token->type == TOKEN_CONSTANT_STRING) {
+        name = cstring_new(token_as_text(token));
+        *angled = false;
+    } else if (token->type == TOKEN_LESS) {
+        name = cstring_new_n(NULL, 16);
+        *angled = true;
+
+        for (;;) {
+            token_destroy(token);
+            token = __preprocessor_expand__(pp);
+
+            if (token->type == TOKEN_GREATER) {
+                break;
+            }
+
+            if (token->type == TOKEN_NEWLINE || token->type == TOKEN_END || token->type == TOKEN_EOF) {
+                cstring_free(name);
+                name = NULL;
+                break;
+            }
+
+            if (token->spaces > 0 && cstring_length(name) > 0) {
+                name = cstring_concat_ch(name, ' ');
+            }
+
+            name = cstring_concat_n(name, token_as_text(token), strlen(token_as_text(token)));
+        }
+    }
+
+    if (name == NULL) {
+        errorf_with_token(token, "#include expects \"FILENAME\" or <FILENAME>");
+    }
+
+    if (token->type == TOKEN_NEWLINE) {
+        token_destroy(token);
+        return name;
+    }
+
+    token_destroy(token);
+
+    __preprocessor_finish_line__(pp, name != NULL ? "include" : NULL);
+
+    /* the newline is read before the file comes in front of it */
+    token = lexer_get(pp->lexer);
+    if (token->type == TOKEN_NEWLINE) {
+        token_destroy(token);
+    } else {
+        lexer_unget(pp->lexer, token);
+    }
+
+    return name;
+}
+
+
+static
+void __preprocessor_parse_include__(preprocessor_t *pp, token_t *directive_token)
+{
+    include_frame_t *frame;
+    incpath_file_t *file;
+    ident_t *guard;
+    cstring_t name, identity;
+    bool angled = false;
+    size_t span;
+
+    pp->included++;
+
+    name = __preprocessor_header_name__(pp, &angled);
+    if (name == NULL) {
+        return;
+    }
+
+    file = __preprocessor_search__(pp, name, angled);
+    if (file == NULL) {
+        errorf_with_token(directive_token, "'%s' file not found", name);
+        cstring_free(name);
+        return;
+    }
+
+    if (pp->depends != NULL) {
+        depfile_add(pp->depends, file->path, file->system);
+    }
+
+    identity = cstring_dup(file->identity);
+    guard = map_find(pp->include_guard, identity);
+
+    if (set_has(pp->once_guard, identity) || (guard != NULL && guard->macro != NULL)) {
+        /* it would come to nothing, the file is not even opened */
+        goto done;
+    }
+
+    if (array_length(pp->includes) >= PP_INCLUDE_DEPTH) {
+        errorf_with_token(directive_token, "#include nested too deeply");
+        goto done;
+    }
+
+    /* the span has the reading of the file, all of it if its tokens are cached */
+    span = trace_enter(TRACE_SOURCE, file->path, cstring_length(file->path));
+
+    if (pp->tokcache != NULL ?
+        !lexer_push_cached(pp->lexer, pp->tokcache, (const unsigned char *) file->path) :
+        !lexer_push(pp->lexer, STREAM_TYPE_FILE, (const unsigned char *) file->path)) {
+        trace_drop(span);
+        errorf_with_token(directive_token, "cannot open '%s'", file->path);
+        goto done;
+    }
+
+    frame = array_push_back(pp->includes);
+    frame->span = span;
+    frame->identity = identity;
+    frame->path = file->path;
+    frame->depth = array_length(pp->condition_directive_stack);
+    frame->guard_state = PP_GUARD_START;
+    frame->guard = NULL;
+    identity = NULL;
+
+done:
+    if (identity != NULL) {
+        cstring_free(identity);
+    }
+
+    cstring_free(name);
+}
+
+
+static
+void __preprocessor_parse_if__(preprocessor_t *pp, token_t *directive_token, token_type_t directive)
+{
+    condition_directive_t *cond;
+    include_frame_t *frame;
+    token_t *name;
+    ident_t *ident;
+    bool taken = false;
+
+    if (directive == TOKEN_PP_IF) {
+        taken = __preprocessor_eval__(pp, directive_token);
+        __preprocessor_finish_line__(pp, "if");
+    } else {
+        name = lexer_get(pp->lexer);
+
+        if (name->type != TOKEN_IDENTIFIER) {
+            errorf_with_token(name, "macro names must be identifiers");
+        } else {
+            ident = __preprocessor_ident__(pp, name);
+            if (pp->consulted != NULL) {
+                __preprocessor_consult__(pp, ident);
+            }
+
+            taken = (ident->macro != NULL) == (directive == TOKEN_PP_IFDEF);
+
+            frame = __preprocessor_frame__(pp);
+            if (directive == TOKEN_PP_IFNDEF && frame != NULL &&
+                frame->guard_state == PP_GUARD_INSIDE &&
+                array_length(pp->condition_directive_stack) == frame->depth) {
+                frame->guard = ident;
+            }
+        }
+
+        if (name->type == TOKEN_NEWLINE) {
+            lexer_unget(pp->lexer, name);
+        } else {
+            token_destroy(name);
+        }
+
+        __preprocessor_finish_line__(pp, directive == TOKEN_PP_IFDEF ? "ifdef" : "ifndef");
+    }
+
+    cond = array_push_back(pp->condition_directive_stack);
+    cond->condiction = taken;
+    cond->has_else = false;
+
+    if (!taken) {
+        __preprocessor_skip__(pp, directive_token);
+    }
+}
+
+
+/**
+ * An #else or #elif ending a group that was taken, the rest is skipped.
+ **/
+static
+void __preprocessor_parse_else__(preprocessor_t *pp, token_t *directive_token, token_type_t directive)
+{
+    condition_directive_t *cond;
+    const char *name = directive == TOKEN_PP_ELSE ? "else" : "elif";
+
+    if (array_length(pp->condition_directive_stack) <= __preprocessor_base__(pp)) {
+        errorf_with_token(directive_token, "#%s without #if", name);
+        __preprocessor_finish_line__(pp, NULL);
+        return;
+    }
+
+    cond = &array_cast_back(condition_directive_t, pp->condition_directive_stack);
+    if (cond->has_else) {
+        errorf_with_token(directive_token, "#%s after #else", name);
+    }
+
+    if (directive == TOKEN_PP_ELSE) {
+        cond->has_else = true;
+        __preprocessor_finish_line__(pp, name);
+    } else {
+        __preprocessor_finish_line__(pp, NULL);
+    }
+
+    __preprocessor_skip__(pp, directive_token);
+}
+
+
+static
+void __preprocessor_parse_endif__(preprocessor_t *pp, token_t *directive_token)
+{
+    include_frame_t *frame;
+
+    if (array_length(pp->condition_directive_stack) <= __preprocessor_base__(pp)) {
+        errorf_with_token(directive_token, "#endif without #if");
+        __preprocessor_finish_line__(pp, NULL);
+        return;
+    }
+
+    array_pop_back(pp->condition_directive_stack);
+
+    frame = __preprocessor_frame__(pp);
+    if (frame != NULL && frame->guard_state == PP_GUARD_INSIDE &&
+        array_length(pp->condition_directive_stack) == frame->depth) {
+        frame->guard_state = PP_GUARD_AFTER;
+    }
+
+    __preprocessor_finish_line__(pp, "endif");
+}
+
+
+static
+void __preprocessor_parse_pragma__(preprocessor_t *pp)
+{
+    include_frame_t *frame;
+    token_t *token;
+
+    token = lexer_peek(pp->lexer);
+
+    if (token->type == TOKEN_IDENTIFIER && cstring_compare(token_cs(token), "once") == 0) {
+        lexer_eat(pp->lexer);
+
+        frame = __preprocessor_frame__(pp);
+        if (frame != NULL) {
+            __preprocessor_add_once__(pp, frame->identity);
+        }
+
+        __preprocessor_finish_line__(pp, "pragma once");
+        return;
+    }
+
+    /* no other pragma is ours */
+    __preprocessor_finish_line__(pp, NULL);
+}
+
+
+/**
+ * #error and #warning say the rest of the line as it is written, #error
+ * counts as an error and so fails the unit. The line is lexed without
+ * complaint, as in "#error don't", where the quote is left open.
+ **/
+static
+void __preprocessor_parse_diagnostic__(preprocessor_t *pp, token_t *directive_token, token_type_t directive)
+{
+    token_t *token;
+    cstring_t text = cstring_new_n(NULL, 64);
+    const char *prefix;
+    size_t spaces, suppressed, n;
+    bool speculative, closed;
+    char quote;
+
+    speculative = pp->lexer->speculative;
+    suppressed = pp->lexer->suppressed;
+    pp->lexer->speculative = true;
+
+    for (;;) {
+        n = pp->lexer->suppressed;
+        token = lexer_get(pp->lexer);
+
+        if (token->type == TOKEN_NEWLINE || token->type == TOKEN_END || token->type == TOKEN_EOF) {
+            lexer_unget(pp->lexer, token);
+            break;
+        }
+
+        /* a literal the lexer complained of was not closed */
+        closed = pp->lexer->suppressed == n;
+
+        for (spaces = cstring_length(text) > 0 ? token->spaces : 0; spaces > 0; spaces--) {
+            text = cstring_concat_ch(text, ' ');
+        }
+
+        /* literals hold what is between the quotes, as the writer has it */
+        switch (token->type) {
+        case TOKEN_CONSTANT_STRING:     prefix = "";   quote = '"';  break;
+        case TOKEN_CONSTANT_WSTRING:    prefix = "L";  quote = '"';  break;
+        case TOKEN_CONSTANT_STRING16:   prefix = "u";  quote = '"';  break;
+        case TOKEN_CONSTANT_STRING32:   prefix = "U";  quote = '"';  break;
+        case TOKEN_CONSTANT_UTF8STRING: prefix = "u8"; quote = '"';  break;
+        case TOKEN_CONSTANT_CHAR:       prefix = "";   quote = '\''; break;
+        case TOKEN_CONSTANT_WCHAR:      prefix = "L";  quote = '\''; break;
+        case TOKEN_CONSTANT_CHAR16:     prefix = "u";  quote = '\''; break;
+        case TOKEN_CONSTANT_CHAR32:     prefix = "U";  quote = '\''; break;
+        case TOKEN_CONSTANT_UTF8CHAR:   prefix = "u8"; quote = '\''; break;
+        default:                        prefix = NULL; quote = 0;    break;
+        }
+
+        if (prefix != NULL) {
+            text = cstring_concat_n(text, prefix, strlen(prefix));
+            text = cstring_concat_ch(text, quote);
+        }
+
+        text = cstring_concat_n(text, token_as_text(token), strlen(token_as_text(token)));
+
+        if (prefix != NULL && closed) {
+            text = cstring_concat_ch(text, quote);
+        }
+
+        token_destroy(token);
+    }
+
+    pp->lexer->speculative = speculative;
+    pp->lexer->suppressed = suppressed;
+
+    if (directive == TOKEN_PP_ERROR) {
+        errorf_with_token(directive_token, "#error %s", text);
+    } else {
+        warningf_with_token(directive_token, "#warning %s", text);
+    }
+
+    cstring_free(text);
+}
+
+
+/**
+ * #line takes a line number and maybe a file name, after expansion. It is
+ * checked and let go: locations keep to the physical lines.
+ **/
+static
+void __preprocessor_parse_line__(preprocessor_t *pp, token_t *directive_token)
+{
+    token_t *token;
+    const char *s;
+
+    token = __preprocessor_expand__(pp);
+
+    if (token->type == TOKEN_NEWLINE || token->type == TOKEN_END || token->type == TOKEN_EOF) {
+        errorf_with_token(directive_token, "unexpected end of #line directive");
+        lexer_unget(pp->lexer, token);
+        return;
+    }
+
+    for (s = token->type == TOKEN_NUMBER ? token_as_text(token) : ""; *s >= '0' && *s <= '9'; s++) {
+        continue;
+    }
+
+    if (token->type != TOKEN_NUMBER || *s != '\0') {
+        errorf_with_token(token, "\"%s\" after #line is not a positive integer", token_as_text(token));
+        token_destroy(token);
+        __preprocessor_finish_line__(pp, NULL);
+        return;
+    }
+
+    token_destroy(token);
+    token = __preprocessor_expand__(pp);
+
+    if (token->type == TOKEN_NEWLINE || token->type == TOKEN_END || token->type == TOKEN_EOF) {
+        lexer_unget(pp->lexer, token);
+        return;
+    }
+
+    if (token->type != TOKEN_CONSTANT_STRING) {
+        errorf_with_token(token, "invalid filename \"%s\"", token_as_text(token));
+        token_destroy(token);
+        __preprocessor_finish_line__(pp, NULL);
+        return;
+    }
+
+    token_destroy(token);
+    __preprocessor_finish_line__(pp, "line");
+}
+
+
+/**
+ * The groups skipped after the directive, a span of the trace of its
+ * file and line.
+ **/
+static
+void __preprocessor_skip__(preprocessor_t *pp, token_t *directive_token)
+{
+    cstring_t fn;
+    size_t span = 0;
+
+    if (tracing && (fn = token_filename(directive_token)) != NULL) {
+        span = trace_enter(TRACE_SKIP, fn, cstring_length(fn));
+    }
+
+    __preprocessor_skip_groups__(pp);
+
+    trace_leave(span, span != 0 ? token_line(directive_token) : 0);
+}
+
+
+/**
+ * Skips the groups of the innermost condition up to the one taken, or
+ * its #endif.
+ **/
+static
+void __preprocessor_skip_groups__(preprocessor_t *pp)
+{
+    condition_directive_t *cond;
+    token_t *directive_token;
+    token_type_t directive;
+
+    for (;;) {
+        directive = __preprocessor_skip_group__(pp, &directive_token);
+        if (directive == TOKEN_EOF) {
+            return;
+        }
+
+        __preprocessor_guard_directive__(pp, directive);
+
+        cond = &array_cast_back(condition_directive_t, pp->condition_directive_stack);
+
+        switch (directive) {
+        case TOKEN_PP_ENDIF:
+            __preprocessor_parse_endif__(pp, directive_token);
+            token_destroy(directive_token);
+            return;
+
+        case TOKEN_PP_ELSE:
+            if (cond->has_else) {
+                errorf_with_token(directive_token, "#else after #else");
+            }
+
+            cond->has_else = true;
+            __preprocessor_finish_line__(pp, "else");
+
+            if (!cond->condiction) {
+                cond->condiction = true;
+                token_destroy(directive_token);
+                return;
+            }
+            break;
+
+        case TOKEN_PP_ELIF:
+            if (cond->has_else) {
+                errorf_with_token(directive_token, "#elif after #else");
+            }
+
+            if (!cond->condiction && __preprocessor_eval__(pp, directive_token)) {
+                cond->condiction = true;
+                __preprocessor_finish_line__(pp, "elif");
+                token_destroy(directive_token);
+                return;
+            }
+            break;
+
+        default:
+            assert(false);
+        }
+
+        token_destroy(directive_token);
+    }
 }
 
 
-static inline 
-void __preprocessor_glue__(preprocessor_t pp, array_t expand_tokens, token_t token)
+/**
+ * Reads past a skipped group, nested conditions and all, to the #elif,
+ * #else or #endif that ends it, whose directive name is left for the
+ * caller along with the rest of its line. TOKEN_EOF if the file ends
+ * first, the TOKEN_EOF itself is handed back to the lexer. Only the
+ * directive lines of the group are made into tokens, the reader skips
+ * the rest, see lexer_skip_to_directive().
+ **/
+static
+token_type_t __preprocessor_skip_group__(preprocessor_t *pp, token_t **directive_token)
 {
-    token_t last;
-    array_t glue_token;
+    lexer_t *lexer = pp->lexer;
+    token_type_t directive = TOKEN_EOF;
+    bool speculative = lexer->speculative;
+    size_t depth = 0;
+    token_t *token;
+
+    /* a skipped group need not be made of valid tokens */
+    lexer->speculative = true;
+    reader_set_speculative(lexer->reader, true);
+
+    while (lexer_skip_to_directive(lexer)) {
+        token_destroy(lexer_get(lexer));
+        token = lexer_get(lexer);
+
+        directive = token->type == TOKEN_IDENTIFIER ?
+            __preprocessor_ident__(pp, token)->directive : TOKEN_UNKNOWN;
+
+        if (directive == TOKEN_PP_IF || directive == TOKEN_PP_IFDEF || directive == TOKEN_PP_IFNDEF) {
+            depth++;
+        } else if (directive == TOKEN_PP_ENDIF && depth > 0) {
+            depth--;
+        } else if ((directive == TOKEN_PP_ENDIF || directive == TOKEN_PP_ELSE ||
+                    directive == TOKEN_PP_ELIF) && depth == 0) {
+            *directive_token = token;
+            break;
+        }
 
-    last = array_cast_back(token_t, expand_tokens);
+        directive = TOKEN_EOF;
 
-    array_pop_back(expand_tokens);
+        if (token->type == TOKEN_EOF || token->type == TOKEN_END) {
+            lexer_unget(lexer, token);
+            break;
+        }
 
-    glue_token = __preprocessor_glue_token__(pp, last, token);
+        token_destroy(token);
+    }
 
-    array_extend(expand_tokens, glue_token);
+    lexer->speculative = speculative;
+    reader_set_speculative(lexer->reader, speculative);
+
+    return directive;
 }
 
 
-static inline 
-array_t __preprocessor_substitute_function_like__(preprocessor_t pp, bool is_variadic, 
-    array_t macro_body, map_t args)
+/**
+ * The expression of an #if or #elif, read straight off the token stream
+ * by precedence climbing. Operands that cannot matter, the right of a
+ * decided && or || and the arm of ?: not chosen, are parsed with skip
+ * raised: read as the lexer gives them, never macro expanded, the calls
+ * of macros read past, and never an error for dividing by zero. The line
+ * is left at the newline.
+ **/
+static void __preprocessor_eval_advance__(pp_eval_t *e);
+static void __preprocessor_eval_skip_call__(pp_eval_t *e);
+static pp_value_t __preprocessor_eval_conditional__(pp_eval_t *e);
+
+
+static inline
+token_t* __preprocessor_eval_read__(pp_eval_t *e)
 {
-    array_t expand_tokens;
-    size_t i, n;
+    return e->skip > 0 ? lexer_get(e->pp->lexer) : __preprocessor_expand__(e->pp);
+}
 
-    expand_tokens = array_create_n(sizeof(token_t), 8);
 
-    n = array_length(macro_body);
+static
+void __preprocessor_eval_advance__(pp_eval_t *e)
+{
+    token_destroy(e->token);
+    e->token = __preprocessor_eval_read__(e);
+}
 
-    for (i = 0; i < n; i++) {
-        token_t token;
-        
-        token = array_cast_at(token_t, macro_body, i);
-        if (token->type == TOKEN_HASH) {
-            token_t stringify = array_cast_at(token_t, macro_body, ++i);
-            array_t replacements = __preprocessor_select__(args, stringify);
 
-            array_cast_append(token_t, expand_tokens, __preprocessor_stringify__(pp, token, replacements));
-            continue;
-        } else if (token->type == TOKEN_HASHHASH) {
-            token_t stringify = array_cast_at(token_t, macro_body, ++i);
-            array_t replacements = __preprocessor_select__(args, stringify);
-            if (replacements == NULL) {
-                __preprocessor_glue__(pp, expand_tokens, stringify);
+/**
+ * Leaves an operand parsed with skip raised. The lookahead was read
+ * unexpanded, if it is a name it gets its expansion now.
+ **/
+static inline
+void __preprocessor_eval_resume__(pp_eval_t *e)
+{
+    if (--e->skip == 0 && e->token->type == TOKEN_IDENTIFIER) {
+        lexer_unget(e->pp->lexer, e->token);
+        e->token = __preprocessor_expand__(e->pp);
+    }
+}
 
-            } else {
-                size_t j, n;
 
-                if (array_length(replacements) == 0) {
-                    i++;
-                    continue;
-                } else {
-                    stringify = array_cast_front(token_t, replacements);
-                    __preprocessor_glue__(pp, expand_tokens, stringify);
+/**
+ * Reads past a name in an operand parsed with skip raised and, if it is
+ * a macro and a '(' follows, the arguments it would have been called
+ * with, up to the closing ')'. They are not expanded. A call the line
+ * ends in leaves the newline as the lookahead.
+ **/
+static
+void __preprocessor_eval_skip_call__(pp_eval_t *e)
+{
+    ident_t *ident;
+    size_t depth = 0;
 
-                    for (j = 1, n = array_length(replacements); j < n; j++) {
-                        array_cast_append(token_t, expand_tokens, array_cast_at(token_t, replacements, j));
-                    }
-                    continue;
-                }
-            }
-            
-        } else {
-            array_t replacements = __preprocessor_select__(args, token);
-            if (cstring_compare(token->cs, "c") == 0) {
-                printf("");
+    ident = __preprocessor_ident__(e->pp, e->token);
+    if (e->pp->consulted != NULL) {
+        __preprocessor_consult__(e->pp, ident);
+    }
+
+    __preprocessor_eval_advance__(e);
+
+    if (ident->macro == NULL || e->token->type != TOKEN_L_PAREN) {
+        return;
+    }
+
+    for (;;) {
+        switch (e->token->type) {
+        case TOKEN_L_PAREN:
+            depth++;
+            break;
+        case TOKEN_R_PAREN:
+            if (--depth == 0) {
+                __preprocessor_eval_advance__(e);
+                return;
             }
-            if (replacements != NULL) {
-                if (i + 1 < n && array_cast_at(token_t, macro_body, i + 1)->type == TOKEN_HASHHASH) {
-                    if (array_length(replacements) == 0) {
-                        i++;
-                    } else {
-                        array_extend(expand_tokens, replacements);
-                    }
-                } else {
-                    array_extend(expand_tokens, replacements);
-                }
-                continue;
-            } 
+            break;
+        case TOKEN_NEWLINE:
+        case TOKEN_EOF:
+        case TOKEN_END:
+            return;
+        default:
+            break;
         }
 
-        token = token_dup(token);
-        array_cast_append(token_t, expand_tokens, token);
+        __preprocessor_eval_advance__(e);
     }
-
-    return expand_tokens;
 }
 
 
-static inline 
-array_t __preprocessor_substitute__(preprocessor_t pp, macro_t macro, map_t args, set_t hideset)
+static
+void __preprocessor_eval_error__(pp_eval_t *e, token_t *token, const char *message)
 {
-    array_t expand_tokens;
-
-    switch (macro->type) {
-    case PP_MACRO_OBJECT:
-        expand_tokens = __preprocessor_substitute_object_like__(pp, 
-            macro->object_like.body);
-        break;
-    case PP_MACRO_FUNCTION:
-        expand_tokens = __preprocessor_substitute_function_like__(pp,
-            macro->function_like.is_variadic, macro->function_like.body, args);
-        break;
-    default:
-        assert(false);
+    if (e->ok) {
+        errorf_with_token(token, message, token_as_text(token));
+        e->ok = false;
     }
+}
 
-    __add_hide_set__(hideset, expand_tokens);
 
-    return expand_tokens;
+static inline
+pp_value_t __preprocessor_eval_value__(uint64_t v, bool is_unsigned)
+{
+    pp_value_t value;
+
+    value.v = v;
+    value.is_unsigned = is_unsigned;
+    return value;
 }
 
 
+/**
+ * An integer constant, by parse_number(), which says what is wrong with
+ * one. The floating, fixed-point and imaginary ones it takes have no
+ * place here.
+ **/
 static
-bool __preprocessor_check_macro_body__(preprocessor_t pp, array_t body)
+pp_value_t __preprocessor_eval_number__(pp_eval_t *e, token_t *token)
 {
-    token_t token;
+    number_t number;
+    bool is_unsigned;
 
-    if (array_is_empty(body)) {
-        return true;
+    /* the first error of an expression is the one said */
+    if (!e->ok) {
+        return __preprocessor_eval_value__(0, false);
     }
 
-    token = array_cast_front(token_t, body);
-    if (token->type == TOKEN_HASHHASH) {
-        ERRORF_WITH_TOKEN(token, "'##' cannot appear at start of macro expansion");
-        return false;
+    if (!parse_number(token, &number)) {
+        e->ok = false;
+        return __preprocessor_eval_value__(0, false);
     }
 
-    token = array_cast_back(token_t, body);
-    if (token->type == TOKEN_HASHHASH) {
-        ERRORF_WITH_TOKEN(token, "'##' cannot appear at end of macro expansion");
-        return false;
+    if ((number.property & NUMBER_CATEGORY) != NUMBER_INTEGER) {
+        __preprocessor_eval_error__(e, token, "floating constant \"%s\" in preprocessor expression");
+        return __preprocessor_eval_value__(0, false);
     }
 
-    return true;
-}
+    if (number.property & NUMBER_IMAGINARY) {
+        __preprocessor_eval_error__(e, token, "imaginary number \"%s\" in preprocessor expression");
+        return __preprocessor_eval_value__(0, false);
+    }
 
+    is_unsigned = (number.property & NUMBER_UNSIGNED) != 0;
 
-static
-void __preprocessor_skip_one_line__(preprocessor_t pp)
-{
-    for (; !lexer_is_eos(pp->lexer); ) {
-        token_t token = lexer_get(pp->lexer);
-        if (token->type == TOKEN_NEWLINE) {
-            token_destroy(token);
-            break;
+    if (!is_unsigned && number.ul > INT64_MAX) {
+        if ((number.property & NUMBER_RADIX) == NUMBER_DECIMAL) {
+            warningf_with_token(token, "integer constant \"%s\" is so large that it is unsigned",
+                token_as_text(token));
         }
-        token_destroy(token);
+        is_unsigned = true;
     }
+
+    return __preprocessor_eval_value__(number.ul, is_unsigned);
 }
 
 
+/**
+ * A character constant is an int, the lexer has resolved the escapes.
+ * More than one character go in as GCC does, one byte after the other.
+ **/
 static
-bool __preprocessor_parse_object_like__(preprocessor_t pp, token_t macroname_token)
+pp_value_t __preprocessor_eval_char__(token_t *token)
 {
-    array_t macro_body;
+    const unsigned char *p;
+    size_t i, n;
+    int64_t v = 0;
 
-    macro_body = array_create_n(sizeof(token_t), 8);
+    p = token_spelling(token, &n);
 
-    for (;;) {
-        token_t token = lexer_peek(pp->lexer);
-        if (token->type == TOKEN_NEWLINE) {
-            break;
-        }
-        lexer_get(pp->lexer);
-        array_cast_append(token_t, macro_body, token);
+    if (n == 1 && token->type == TOKEN_CONSTANT_CHAR) {
+        return __preprocessor_eval_value__((uint64_t) (int64_t) (signed char) p[0], false);
     }
 
-    if (!__preprocessor_check_macro_body__(pp, macro_body)) {
-        token_destroy(macroname_token);
-        __destroy_tokens__(macro_body);
-        __preprocessor_skip_one_line__(pp);
-        return false;
+    for (i = 0; i < n; i++) {
+        v = (int64_t) (((uint64_t) v << 8) | p[i]);
     }
 
-    __preprocessor_add_macro__(pp, macroname_token,
-        PP_MACRO_OBJECT, NULL, macro_body, NULL, false);
+    return __preprocessor_eval_value__((uint64_t) (int32_t) v, false);
+}
 
-    return true;
+
+/**
+ * defined NAME or defined ( NAME ), the name looked up and not expanded.
+ **/
+static
+pp_value_t __preprocessor_eval_defined__(pp_eval_t *e)
+{
+    lexer_t *lexer = e->pp->lexer;
+    token_t *name;
+    ident_t *ident;
+    bool paren, defined;
+
+    paren = lexer_try(lexer, TOKEN_L_PAREN);
+    name = lexer_get(lexer);
+
+    if (name->type != TOKEN_IDENTIFIER) {
+        __preprocessor_eval_error__(e, name, "operator \"defined\" requires an identifier");
+        token_destroy(e->token);
+        e->token = name;
+        return __preprocessor_eval_value__(0, false);
+    }
+
+    ident = __preprocessor_ident__(e->pp, name);
+    if (e->pp->consulted != NULL) {
+        __preprocessor_consult__(e->pp, ident);
+    }
+
+    defined = ident->macro != NULL;
+    token_destroy(name);
+
+    if (paren && !lexer_try(lexer, TOKEN_R_PAREN)) {
+        __preprocessor_eval_error__(e, e->directive_token, "missing ')' after \"defined\"");
+    }
+
+    __preprocessor_eval_advance__(e);
+    return __preprocessor_eval_value__(defined, false);
 }
 
 
 static
-bool __preprocessor_add_function_like_param__(preprocessor_t pp,
-    array_t params, token_t identifier_token)
+pp_value_t __preprocessor_eval_unary__(pp_eval_t *e)
 {
-    token_t *tokens;
-    size_t i;
+    token_t *token = e->token;
+    token_type_t op = token->type;
+    const unsigned char *spelling;
+    pp_value_t value;
+    size_t n;
+
+    switch (op) {
+    case TOKEN_NUMBER:
+        value = __preprocessor_eval_number__(e, token);
+        __preprocessor_eval_advance__(e);
+        return value;
+
+    case TOKEN_CONSTANT_CHAR:
+    case TOKEN_CONSTANT_WCHAR:
+    case TOKEN_CONSTANT_CHAR16:
+    case TOKEN_CONSTANT_CHAR32:
+    case TOKEN_CONSTANT_UTF8CHAR:
+        value = __preprocessor_eval_char__(token);
+        __preprocessor_eval_advance__(e);
+        return value;
+
+    case TOKEN_IDENTIFIER:
+        spelling = token_spelling(token, &n);
+        if (n == 7 && memcmp(spelling, "defined", 7) == 0) {
+            return __preprocessor_eval_defined__(e);
+        }
 
-    array_foreach(params, tokens, i) {
-        if (cstring_compare(tokens[i]->cs, identifier_token->cs) == 0) {
-            ERRORF_WITH_TOKEN(identifier_token,
-                "duplicate macro parameter \"%s\"", token_as_text(identifier_token));
-            return false;
+        /* a name left after expansion is 0, a call not expanded as well */
+        if (e->skip > 0) {
+            __preprocessor_eval_skip_call__(e);
+        } else {
+            __preprocessor_eval_advance__(e);
+        }
+        return __preprocessor_eval_value__(0, false);
+
+    case TOKEN_L_PAREN:
+        __preprocessor_eval_advance__(e);
+        value = __preprocessor_eval_conditional__(e);
+
+        if (e->token->type != TOKEN_R_PAREN) {
+            __preprocessor_eval_error__(e, e->directive_token, "missing ')' in expression");
+            return value;
+        }
+
+        __preprocessor_eval_advance__(e);
+        return value;
+
+    case TOKEN_PLUS:
+    case TOKEN_MINUS:
+    case TOKEN_TILDE:
+    case TOKEN_EXCLAIM:
+        __preprocessor_eval_advance__(e);
+        value = __preprocessor_eval_unary__(e);
+
+        if (op == TOKEN_MINUS) {
+            value.v = 0 - value.v;
+        } else if (op == TOKEN_TILDE) {
+            value.v = ~value.v;
+        } else if (op == TOKEN_EXCLAIM) {
+            value = __preprocessor_eval_value__(value.v == 0, false);
         }
+        return value;
+
+    case TOKEN_NEWLINE:
+    case TOKEN_EOF:
+    case TOKEN_END:
+        __preprocessor_eval_error__(e, e->directive_token, "expected a value in #%s expression");
+        return __preprocessor_eval_value__(0, false);
+
+    default:
+        __preprocessor_eval_error__(e, token, "token \"%s\" is not valid in preprocessor expressions");
+        return __preprocessor_eval_value__(0, false);
     }
+}
 
-    array_cast_append(token_t, params, identifier_token);
-    return true;
+
+static inline
+int __preprocessor_eval_precedence__(token_type_t op)
+{
+    switch (op) {
+    case TOKEN_STAR:
+    case TOKEN_SLASH:
+    case TOKEN_PERCENT:
+        return 10;
+    case TOKEN_PLUS:
+    case TOKEN_MINUS:
+        return 9;
+    case TOKEN_LESSLESS:
+    case TOKEN_GREATERGREATER:
+        return 8;
+    case TOKEN_LESS:
+    case TOKEN_GREATER:
+    case TOKEN_LESSEQUAL:
+    case TOKEN_GREATEREQUAL:
+        return 7;
+    case TOKEN_EQUALEQUAL:
+    case TOKEN_EXCLAIMEQUAL:
+        return 6;
+    case TOKEN_AMP:
+        return 5;
+    case TOKEN_CARET:
+        return 4;
+    case TOKEN_PIPE:
+        return 3;
+    case TOKEN_AMPAMP:
+        return 2;
+    case TOKEN_PIPEPIPE:
+        return 1;
+    default:
+        return 0;
+    }
 }
 
 
 static
-bool __preprocessor_parse_function_like_params__(preprocessor_t pp, array_t params, bool *variadic)
+uint64_t __preprocessor_eval_shift__(uint64_t v, bool is_unsigned, uint64_t count, bool left)
 {
-    token_t token;
-    bool prev_ident = false;
+    if (count >= 64) {
+        return left || is_unsigned || (int64_t) v >= 0 ? 0 : (uint64_t) -1;
+    }
 
-    for (;;) {
-        token = lexer_peek(pp->lexer);
-        switch (token->type) {
-        case TOKEN_IDENTIFIER:
-            if (prev_ident == true) {
-                ERRORF_WITH_TOKEN(token, "macro parameters must be comma-separated");
-                return false;
-            }
+    if (left) {
+        return v << count;
+    }
 
-            prev_ident = true;
+    if (is_unsigned || (int64_t) v >= 0) {
+        return v >> count;
+    }
 
-            if (!__preprocessor_add_function_like_param__(pp, params, token)) {
-                return false;
-            }
+    return ~(~v >> count);
+}
 
-            lexer_get(pp->lexer);
-            continue;
-        case TOKEN_R_PAREN:
-            if (prev_ident == true || array_is_empty(params)) {
-                lexer_eat(pp->lexer);
-                return true;
-            }
-        case TOKEN_COMMA:
-            if (prev_ident == false) {
-                ERRORF_WITH_TOKEN(token, "parameter name missing");
-                return false;
+
+/**
+ * lhs op rhs for the operators other than && and ||, in uintmax_t when
+ * either side is unsigned and in intmax_t otherwise.
+ **/
+static
+pp_value_t __preprocessor_eval_apply__(pp_eval_t *e, token_t *token, pp_value_t lhs, pp_value_t rhs)
+{
+    token_type_t op = token->type;
+    bool u = lhs.is_unsigned || rhs.is_unsigned;
+    int64_t a = (int64_t) lhs.v, b = (int64_t) rhs.v;
+    bool left;
+
+    switch (op) {
+    case TOKEN_STAR:
+        return __preprocessor_eval_value__(lhs.v * rhs.v, u);
+
+    case TOKEN_SLASH:
+    case TOKEN_PERCENT:
+        if (rhs.v == 0) {
+            if (e->skip == 0) {
+                __preprocessor_eval_error__(e, token, "division by zero in preprocessor expression");
             }
-            lexer_eat(pp->lexer);
-            prev_ident = false;
-            continue;
-        case TOKEN_ELLIPSIS:
-            *variadic = true;
+            return __preprocessor_eval_value__(0, u);
+        }
 
-            if (prev_ident == false) {
-                /* anonymous variadic macros */
-                const char *va_args = "__VA_ARGS__";
-                const size_t n_va_args = 11;
-                token = token_dup(token);
-                token->type = TOKEN_IDENTIFIER;
-                token->cs = cstring_copy_n(token->cs, va_args, n_va_args);
-                token->is_vararg = true;
-                if (!__preprocessor_add_function_like_param__(pp, params, token)) {
-                    return false;
-                }
+        if (u) {
+            return __preprocessor_eval_value__(op == TOKEN_SLASH ? lhs.v / rhs.v : lhs.v % rhs.v, u);
+        }
 
-            } else {
-                /* named variadic macros */
-                array_cast_back(token_t, params)->is_vararg = true;
-            }
+        if (a == INT64_MIN && b == -1) {
+            return __preprocessor_eval_value__(op == TOKEN_SLASH ? lhs.v : 0, u);
+        }
 
-            lexer_eat(pp->lexer);
+        return __preprocessor_eval_value__((uint64_t) (op == TOKEN_SLASH ? a / b : a % b), u);
 
-            if (lexer_try(pp->lexer, TOKEN_R_PAREN)) {
-                return true;
-            }
-        case TOKEN_NEWLINE:
-        case TOKEN_END:
-            ERRORF_WITH_TOKEN(token, "missing ')' in macro parameter list");
-            return false;
-        default:
-            ERRORF_WITH_TOKEN(token, 
-                "\"%s\" may not appear in macro parameter list", token_as_text(token));
-            return false;
+    case TOKEN_PLUS:
+        return __preprocessor_eval_value__(lhs.v + rhs.v, u);
+    case TOKEN_MINUS:
+        return __preprocessor_eval_value__(lhs.v - rhs.v, u);
+
+    case TOKEN_LESSLESS:
+    case TOKEN_GREATERGREATER:
+        /* the type is that of the left operand, a negative count turns round */
+        left = op == TOKEN_LESSLESS;
+        if (!rhs.is_unsigned && b < 0) {
+            left = !left;
+            rhs.v = 0 - rhs.v;
         }
-    }
+        return __preprocessor_eval_value__(
+            __preprocessor_eval_shift__(lhs.v, lhs.is_unsigned, rhs.v, left), lhs.is_unsigned);
+
+    case TOKEN_LESS:
+        return __preprocessor_eval_value__(u ? lhs.v < rhs.v : a < b, false);
+    case TOKEN_GREATER:
+        return __preprocessor_eval_value__(u ? lhs.v > rhs.v : a > b, false);
+    case TOKEN_LESSEQUAL:
+        return __preprocessor_eval_value__(u ? lhs.v <= rhs.v : a <= b, false);
+    case TOKEN_GREATEREQUAL:
+        return __preprocessor_eval_value__(u ? lhs.v >= rhs.v : a >= b, false);
+    case TOKEN_EQUALEQUAL:
+        return __preprocessor_eval_value__(lhs.v == rhs.v, false);
+    case TOKEN_EXCLAIMEQUAL:
+        return __preprocessor_eval_value__(lhs.v != rhs.v, false);
+
+    case TOKEN_AMP:
+        return __preprocessor_eval_value__(lhs.v & rhs.v, u);
+    case TOKEN_CARET:
+        return __preprocessor_eval_value__(lhs.v ^ rhs.v, u);
+    case TOKEN_PIPE:
+        return __preprocessor_eval_value__(lhs.v | rhs.v, u);
 
-    return false;
+    default:
+        assert(false);
+        return lhs;
+    }
 }
 
 
 static
-bool __preprocessor_parse_function_like_body__(preprocessor_t pp, array_t macro_body)
+pp_value_t __preprocessor_eval_binary__(pp_eval_t *e, int min_precedence)
 {
-    for (; !lexer_is_empty(pp->lexer); ) {
-        token_t token = lexer_peek(pp->lexer);
-        if (token->type == TOKEN_NEWLINE) {
-            lexer_eat(pp->lexer);
-            return true;
+    pp_value_t lhs, rhs;
+    token_t *op;
+    int precedence;
+    bool decided;
+
+    lhs = __preprocessor_eval_unary__(e);
+
+    for (;;) {
+        precedence = __preprocessor_eval_precedence__(e->token->type);
+        if (!e->ok || precedence == 0 || precedence < min_precedence) {
+            return lhs;
         }
 
-        array_cast_append(token_t, macro_body, token);
-        lexer_get(pp->lexer);
-    }
+        op = e->token;
 
-    if (!__preprocessor_check_macro_body__(pp, macro_body)) {
-        __destroy_tokens__(macro_body);
-        return false;
-    }
+        if (op->type == TOKEN_AMPAMP || op->type == TOKEN_PIPEPIPE) {
+            decided = (lhs.v != 0) == (op->type == TOKEN_PIPEPIPE);
 
-    return false;
+            if (decided) {
+                e->skip++;
+            }
+
+            __preprocessor_eval_advance__(e);
+            rhs = __preprocessor_eval_binary__(e, precedence + 1);
+
+            if (decided) {
+                __preprocessor_eval_resume__(e);
+                lhs = __preprocessor_eval_value__(lhs.v != 0, false);
+            } else {
+                lhs = __preprocessor_eval_value__(rhs.v != 0, false);
+            }
+            continue;
+        }
+
+        /* the operator token is still needed for a diagnostic */
+        e->token = __preprocessor_eval_read__(e);
+        rhs = __preprocessor_eval_binary__(e, precedence + 1);
+        lhs = __preprocessor_eval_apply__(e, op, lhs, rhs);
+        token_destroy(op);
+    }
 }
 
 
 static
-bool __preprocessor_parse_function_like__(preprocessor_t pp, token_t macroname_token)
+pp_value_t __preprocessor_eval_conditional__(pp_eval_t *e)
 {
-    array_t macro_params;
-    array_t macro_body;
-    bool is_variadic = false;
+    pp_value_t cond, then, otherwise;
+    bool taken;
 
-    /* eat '(' */
-    lexer_eat(pp->lexer);
+    cond = __preprocessor_eval_binary__(e, 1);
+    if (!e->ok || e->token->type != TOKEN_QUESTION) {
+        return cond;
+    }
 
-    macro_params = __create_tokens__();
-    if (!__preprocessor_parse_function_like_params__(pp, macro_params, &is_variadic)) {
-        assert((is_variadic == false) || (is_variadic == true && !array_is_empty(macro_params)));
-        __preprocessor_skip_one_line__(pp);
-        __destroy_tokens__(macro_params);
-        token_destroy(macroname_token);
-        return false;
+    taken = cond.v != 0;
+
+    if (!taken) {
+        e->skip++;
+    }
+
+    __preprocessor_eval_advance__(e);
+    then = __preprocessor_eval_conditional__(e);
+
+    if (!taken) {
+        __preprocessor_eval_resume__(e);
     }
 
-    macro_body = __create_tokens__();
-    if (!__preprocessor_parse_function_like_body__(pp, macro_body)) {
-        __preprocessor_skip_one_line__(pp);
-        __destroy_tokens__(macro_params);
-        __destroy_tokens__(macro_body);
-        token_destroy(macroname_token);
-        return false;
+    if (e->token->type != TOKEN_COLON) {
+        __preprocessor_eval_error__(e, e->directive_token, "'?' without following ':' in #%s");
+        return then;
     }
 
-    __preprocessor_add_macro__(pp, macroname_token,
-        PP_MACRO_FUNCTION, NULL, macro_body, macro_params, is_variadic);
+    if (taken) {
+        e->skip++;
+    }
 
-    return true;
+    __preprocessor_eval_advance__(e);
+    otherwise = __preprocessor_eval_conditional__(e);
+
+    if (taken) {
+        __preprocessor_eval_resume__(e);
+    }
+
+    return __preprocessor_eval_value__(taken ? then.v : otherwise.v,
+                                       then.is_unsigned || otherwise.is_unsigned);
 }
 
 
 static
-bool __preprocessor_parse_define__(preprocessor_t pp)
+bool __preprocessor_eval__(preprocessor_t *pp, token_t *directive_token)
 {
-    token_t macroname_token;
-    token_t l_paren_token;
+    pp_eval_t e;
+    pp_value_t value;
 
-    macroname_token = lexer_get(pp->lexer);
-    if (macroname_token->type != TOKEN_IDENTIFIER) {
-        ERRORF_WITH_TOKEN(macroname_token, "macro names must be identifiers");
-        token_destroy(macroname_token);
-        __preprocessor_skip_one_line__(pp);
-        return false;
+    e.pp = pp;
+    e.directive_token = directive_token;
+    e.skip = 0;
+    e.ok = true;
+    e.token = __preprocessor_eval_read__(&e);
+
+    value = __preprocessor_eval_conditional__(&e);
+
+    if (e.ok && e.token->type != TOKEN_NEWLINE && e.token->type != TOKEN_EOF &&
+        e.token->type != TOKEN_END) {
+        __preprocessor_eval_error__(&e, e.token, "missing binary operator before token \"%s\"");
     }
 
-    l_paren_token = lexer_peek(pp->lexer);
-    if (l_paren_token->type == TOKEN_L_PAREN && l_paren_token->spaces == 0) {
-        return __preprocessor_parse_function_like__(pp, macroname_token);
+    lexer_unget(pp->lexer, e.token);
+
+    if (!e.ok) {
+        __preprocessor_finish_line__(pp, NULL);
+        return false;
     }
 
-    return __preprocessor_parse_object_like__(pp, macroname_token);
+    return value.v != 0;
 }
 
 
 static
-bool __preprocessor_parse_directive__(preprocessor_t pp, token_t hash)
+bool __preprocessor_parse_directive__(preprocessor_t *pp, token_t *hash)
 {
     if (hash->begin_of_line && 
         hash->type == TOKEN_HASH && 
-        (hash->hideset == NULL || set_is_empty(hash->hideset))) {
-        token_t directive_token;
+        hash->hideset == NULL) {
+        token_t *directive_token;
+        token_type_t directive;
+        stats_phase_t phase;
 
+        phase = stats_enter(STATS_PHASE_DIRECTIVE);
         directive_token = lexer_get(pp->lexer);
 
         if (directive_token->type == TOKEN_NEWLINE) {
+            /* the null directive */
+            lexer_unget(pp->lexer, directive_token);
             token_destroy(hash);
-            return false;
+            stats_leave(phase);
+            return true;
         }
 
-        if (directive_token->type == TOKEN_NUMBER) {
-            /* TODO: GNU remark linenum */
-            return false;
-        }
+        directive = directive_token->type == TOKEN_IDENTIFIER ?
+            __preprocessor_ident__(pp, directive_token)->directive : TOKEN_UNKNOWN;
 
-        if (cstring_compare(directive_token->cs, "define") == 0) {
+        __preprocessor_guard_directive__(pp, directive);
+
+        switch (directive) {
+        case TOKEN_PP_DEFINE:
             __preprocessor_parse_define__(pp);
+            break;
+        case TOKEN_PP_UNDEF:
+            __preprocessor_parse_undef__(pp);
+            break;
+        case TOKEN_PP_INCLUDE:
+            __preprocessor_parse_include__(pp, directive_token);
+            break;
+        case TOKEN_PP_IF:
+        case TOKEN_PP_IFDEF:
+        case TOKEN_PP_IFNDEF:
+            __preprocessor_parse_if__(pp, directive_token, directive);
+            break;
+        case TOKEN_PP_ELIF:
+        case TOKEN_PP_ELSE:
+            __preprocessor_parse_else__(pp, directive_token, directive);
+            break;
+        case TOKEN_PP_ENDIF:
+            __preprocessor_parse_endif__(pp, directive_token);
+            break;
+        case TOKEN_PP_PRAGMA:
+            __preprocessor_parse_pragma__(pp);
+            break;
+        case TOKEN_PP_ERROR:
+        case TOKEN_PP_WARNING:
+            __preprocessor_parse_diagnostic__(pp, directive_token, directive);
+            break;
+        case TOKEN_PP_LINE:
+            __preprocessor_parse_line__(pp, directive_token);
+            break;
+        default:
+            /* a GNU linemarker, # 12 "file.c" 2, goes as #line does */
+            if (directive_token->type == TOKEN_NUMBER) {
+                __preprocessor_finish_line__(pp, NULL);
+                break;
+            }
+
+            errorf_with_token(directive_token, "invalid preprocessing directive #%s",
+                token_as_text(directive_token));
+            __preprocessor_finish_line__(pp, NULL);
+            break;
         }
 
         token_destroy(hash);
         token_destroy(directive_token);
+        stats_leave(phase);
         return true;
     }
 
@@ -862,52 +3042,53 @@ bool __preprocessor_parse_directive__(preprocessor_t pp, token_t hash)
 }
 
 
-static inline 
-void __preprocessor_unget_tokens__(preprocessor_t pp, array_t tokens)
-{
-    size_t i;
-    if (tokens != NULL) {
-        for (i = array_length(tokens); i--; ) {
-            lexer_unget(pp->lexer, array_cast_at(token_t, tokens, i));
-        }
-    }
-}
-
-
 static inline
-void __preprocessor_add_macro__(preprocessor_t pp, token_t macroname_token,
+void __preprocessor_add_macro__(preprocessor_t *pp, token_t *macroname_token,
     macro_type_t type, native_macro_pt native_macro_fn,
-    array_t body, array_t params, bool is_variadic)
+    token_ptr_array_t *body, array_t *params, array_t *refs, array_t *uses, bool is_variadic)
 {
-    macro_t macro;
+    ident_t *ident;
+    macro_t *macro;
+
+    ident = __preprocessor_ident__(pp, macroname_token);
 
-    if (map_has(pp->macros, macroname_token->cs)) {
-        WARNINGF_WITH_TOKEN(macroname_token, "\"%s\" redefined", macroname_token->cs);
-        __macro_destroy__(map_find(pp->macros, macroname_token->cs));
-        map_del(pp->macros, macroname_token->cs);
+    if (ident->macro != NULL) {
+        warningf_with_token(macroname_token, "\"%s\" redefined", token_as_text(macroname_token));
     }
 
-    macro = __macro_create__(type, macroname_token, native_macro_fn, body, params, is_variadic);
+    macro = __macro_create__(type, macroname_token, native_macro_fn, body, params,
+                             refs, uses, is_variadic);
+    if (pp->macros != NULL) {
+        array_cast_append(macro_t*, pp->macros, macro);
+    }
+
+    __preprocessor_bind__(pp, ident, macro);
 
-    map_add(pp->macros, macroname_token->cs, macro);
+    if (type != PP_MACRO_NATIVE) {
+        stats_count(STATS_MACROS_DEFINED);
+    }
 }
 
 
 static inline
-macro_t __macro_create__(macro_type_t type, token_t macroname_token,
-    native_macro_pt native_macro_fn, array_t body, array_t params, bool is_variadic)
+macro_t* __macro_create__(macro_type_t type, token_t *macroname_token,
+    native_macro_pt native_macro_fn, token_ptr_array_t *body, array_t *params,
+    array_t *refs, array_t *uses, bool is_variadic)
 {
-    macro_t macro = (macro_t) pmalloc(sizeof(struct macro_s));
+    macro_t *macro = (macro_t*) pmalloc(sizeof(struct macro_s));
 
     switch (type) {
     case PP_MACRO_OBJECT: {
         macro->object_like.body = body;
+        macro->object_like.cache = NULL;
         break;
     }
     case PP_MACRO_FUNCTION: {
         macro->function_like.is_variadic = is_variadic;
         macro->function_like.params = params;
         macro->function_like.body = body;
+        macro->function_like.refs = refs;
+        macro->function_like.uses = uses;
         break;
     }
     case PP_MACRO_NATIVE: {
@@ -920,36 +3101,44 @@ macro_t __macro_create__(macro_type_t type, token_t macroname_token,
 
     macro->name_token = macroname_token;
     macro->type = type;
+    macro->snapshot = NULL;
+    macro->record = NULL;
+    macro->record_length = 0;
     return macro;
 }
 
 
 static inline
-void __macro_destroy__(macro_t macro)
+void __macro_destroy__(macro_t *macro)
 {
-    token_t *tokens;
+    token_t **tokens;
     size_t i;
 
+    if (macro->record != NULL) {
+        /* never read in from its snapshot, there is nothing but the name */
+        goto done;
+    }
+
     switch (macro->type) {
     case PP_MACRO_OBJECT: {
-        array_foreach(macro->object_like.body, tokens, i) {
-            token_destroy(tokens[i]);
+        __destroy_body__(macro->object_like.body);
+
+        if (macro->object_like.cache != NULL) {
+            __macro_cache_destroy__(macro->object_like.cache);
         }
-        array_destroy(macro->object_like.body);
 
         break;
     }
     case PP_MACRO_FUNCTION: {
-        array_foreach(macro->function_like.body, tokens, i) {
-            token_destroy(tokens[i]);
-        }
-        array_destroy(macro->function_like.body);
+        __destroy_body__(macro->function_like.body);
 
         array_foreach(macro->function_like.params, tokens, i) {
             token_destroy(tokens[i]);
         }
 
         array_destroy(macro->function_like.params);
+        array_destroy(macro->function_like.refs);
+        array_destroy(macro->function_like.uses);
 
         break;
     }
@@ -960,6 +3149,7 @@ void __macro_destroy__(macro_t macro)
         assert(false);
     }
 
+done:
     if (macro->name_token != NULL) {
         token_destroy(macro->name_token);
     }
@@ -968,16 +3158,468 @@ void __macro_destroy__(macro_t macro)
 
 
 static
-array_t __create_tokens__(void)
+cstring_t __preprocessor_save_token__(cstring_t buf, token_t *token)
+{
+    const unsigned char *spelling;
+    size_t n;
+
+    spelling = token_spelling(token, &n);
+
+    buf = snapshot_put_u32(buf, (uint32_t) token->type);
+    buf = snapshot_put_u32(buf, (uint32_t) token->keyword);
+    buf = snapshot_put_u32(buf, (uint32_t) token->spaces);
+    buf = snapshot_put_u32(buf, (token->begin_of_line ? 1 : 0) | (token->is_vararg ? 2 : 0));
+    return snapshot_put_bytes(buf, spelling, n);
+}
+
+
+/**
+ * The record of a macro: the body tokens, and for a function-like one
+ * whether it is variadic and the parameters first, the parameter index
+ * after each body token and the counts of uses at the end.
+ **/
+static
+cstring_t __preprocessor_save_body__(cstring_t buf, macro_t *macro)
+{
+    macro_uses_t *uses;
+    token_t **tokens;
+    token_ptr_array_t *body;
+    int *refs = NULL;
+    size_t i;
+
+    if (macro->type == PP_MACRO_FUNCTION) {
+        buf = snapshot_put_u32(buf, macro->function_like.is_variadic ? 1 : 0);
+        buf = snapshot_put_u32(buf, (uint32_t) array_length(macro->function_like.params));
+
+        array_foreach(macro->function_like.params, tokens, i) {
+            buf = __preprocessor_save_token__(buf, tokens[i]);
+        }
+
+        body = macro->function_like.body;
+        refs = array_prototype(macro->function_like.refs, int);
+    } else {
+        body = macro->object_like.body;
+    }
+
+    buf = snapshot_put_u32(buf, (uint32_t) array_length(body));
+
+    array_foreach(body, tokens, i) {
+        buf = __preprocessor_save_token__(buf, tokens[i]);
+        if (refs != NULL) {
+            buf = snapshot_put_u32(buf, (uint32_t) refs[i]);
+        }
+    }
+
+    if (macro->type == PP_MACRO_FUNCTION) {
+        array_foreach(macro->function_like.uses, uses, i) {
+            buf = snapshot_put_u32(buf, (uint32_t) uses[i].expanded);
+            buf = snapshot_put_u32(buf, (uint32_t) uses[i].raw);
+        }
+    }
+
+    return buf;
+}
+
+
+static
+void __preprocessor_save_macro__(void *ud, ident_t *ident)
+{
+    pp_snapshot_writer_t *w = (pp_snapshot_writer_t *) ud;
+    macro_t *macro = ident->macro;
+    size_t at;
+
+    if (macro == NULL || macro->type == PP_MACRO_NATIVE) {
+        return;
+    }
+
+    w->buf = snapshot_put_bytes(w->buf, ident->name, cstring_length(ident->name));
+    w->buf = snapshot_put_u32(w->buf, (uint32_t) macro->type);
+
+    if (macro->record != NULL) {
+        /* not used since it was loaded, the record is the same */
+        w->buf = snapshot_put_bytes(w->buf, macro->record, macro->record_length);
+    } else {
+        at = cstring_length(w->buf);
+        w->buf = snapshot_put_u32(w->buf, 0);
+        w->buf = __preprocessor_save_body__(w->buf, macro);
+        snapshot_patch_u32(w->buf, at, (uint32_t) (cstring_length(w->buf) - at - 4));
+    }
+
+    w->count++;
+}
+
+
+/**
+ * The file identities of the include guards with the guard names.
+ **/
+static
+cstring_t __preprocessor_save_guards__(cstring_t buf, dict_t *d)
+{
+    dict_iterator_t *iter;
+    dict_entry_t *entry;
+    cstring_t identity;
+    ident_t *guard;
+
+    buf = snapshot_put_u32(buf, (uint32_t) dict_length(d));
+
+    iter = dict_get_iterator(d);
+    if (!iter) {
+        return buf;
+    }
+
+    while ((entry = dict_next(iter)) != NULL) {
+        identity = (cstring_t) dict_get_key(entry);
+        buf = snapshot_put_bytes(buf, identity, cstring_length(identity));
+
+        guard = (ident_t *) dict_get_val(entry);
+        buf = snapshot_put_bytes(buf, guard->name, cstring_length(guard->name));
+    }
+
+    dict_release_iterator(iter);
+    return buf;
+}
+
+
+/* the file identity of a #pragma once */
+static
+void __preprocessor_save_once__(void *privdata, const cstring_t identity)
+{
+    cstring_t *buf = (cstring_t *) privdata;
+
+    *buf = snapshot_put_bytes(*buf, identity, cstring_length(identity));
+}
+
+
+/**
+ * Goes over a snapshot, binding what it holds if apply, else only making
+ * sure it reads to its end.
+ **/
+static
+bool __preprocessor_walk_snapshot__(preprocessor_t *pp, snapshot_t *snap, bool apply)
+{
+    snapshot_reader_t r;
+    const unsigned char *name, *record, *identity;
+    size_t name_length, record_length, identity_length;
+    uint32_t type, i, n;
+    macro_t *macro;
+    ident_t *ident;
+    cstring_t cs;
+
+    snapshot_reader_init(&r, snap->data, snap->length);
+
+    n = snapshot_get_u32(&r);
+
+    for (i = 0; i < n && r.ok; i++) {
+        name = snapshot_get_bytes(&r, &name_length);
+        type = snapshot_get_u32(&r);
+        record = snapshot_get_bytes(&r, &record_length);
+
+        if (type != PP_MACRO_OBJECT && type != PP_MACRO_FUNCTION) {
+            r.ok = false;
+        }
+
+        if (!apply || !r.ok) {
+            continue;
+        }
+
+        ident = identtab_lookup(pp->idents, name, name_length);
+
+        macro = __macro_create__((macro_type_t) type, NULL, NULL, NULL, NULL, NULL, NULL, false);
+        macro->snapshot = snap;
+        macro->record = record;
+        macro->record_length = record_length;
+
+        if (pp->macros != NULL) {
+            array_cast_append(macro_t*, pp->macros, macro);
+        }
+
+        __preprocessor_bind__(pp, ident, macro);
+    }
+
+    n = snapshot_get_u32(&r);
+
+    for (i = 0; i < n && r.ok; i++) {
+        identity = snapshot_get_bytes(&r, &identity_length);
+        name = snapshot_get_bytes(&r, &name_length);
+
+        if (apply && r.ok) {
+            cs = cstring_new_n(identity, identity_length);
+            map_add(pp->include_guard, cs, identtab_lookup(pp->idents, name, name_length));
+            cstring_free(cs);
+        }
+    }
+
+    n = snapshot_get_u32(&r);
+
+    for (i = 0; i < n && r.ok; i++) {
+        identity = snapshot_get_bytes(&r, &identity_length);
+
+        if (apply && r.ok) {
+            cs = cstring_new_n(identity, identity_length);
+            set_add(pp->once_guard, cs);
+            cstring_free(cs);
+        }
+    }
+
+    return r.ok && r.p == r.end;
+}
+
+
+static
+token_t* __preprocessor_load_token__(snapshot_reader_t *r, srcloc_t loc)
+{
+    const unsigned char *spelling;
+    uint32_t type, keyword, spaces, flags;
+    token_t *token;
+    size_t n;
+
+    type = snapshot_get_u32(r);
+    keyword = snapshot_get_u32(r);
+    spaces = snapshot_get_u32(r);
+    flags = snapshot_get_u32(r);
+    spelling = snapshot_get_bytes(r, &n);
+
+    if (!r->ok) {
+        return NULL;
+    }
+
+    token = token_create((token_type_t) (int32_t) type, cstring_new_n(spelling, n), loc);
+    token->keyword = (token_type_t) (int32_t) keyword;
+    token->spaces = spaces;
+    token->begin_of_line = (flags & 1) != 0;
+    token->is_vararg = (flags & 2) != 0;
+
+    return token;
+}
+
+
+/**
+ * Reads in the body of a macro loaded from a snapshot, when it is first
+ * expanded. A record that does not read leaves it empty.
+ **/
+static
+void __preprocessor_read_in__(macro_t *macro, token_t *use)
+{
+    snapshot_reader_t r;
+    token_ptr_array_t *body;
+    array_t *params = NULL, *refs = NULL, *uses = NULL;
+    macro_uses_t *counts;
+    token_t *token, **tokens;
+    bool is_variadic = false;
+    uint32_t i, n, nparams = 0;
+    srcloc_t loc;
+    int ref;
+
+    /* the tokens are all at the snapshot, which has no lines */
+    loc = srcloc_add_buffer(macro->snapshot->filename, NULL, 0);
+
+    snapshot_reader_init(&r, macro->record, macro->record_length);
+
+    if (macro->type == PP_MACRO_FUNCTION) {
+        is_variadic = snapshot_get_u32(&r) != 0;
+        nparams = snapshot_get_u32(&r);
+
+        params = __create_tokens__();
+        refs = array_create_n(sizeof(int), 8);
+        uses = array_create_n(sizeof(macro_uses_t), 4);
+
+        for (i = 0; i < nparams && r.ok; i++) {
+            if ((token = __preprocessor_load_token__(&r, loc)) != NULL) {
+                array_cast_append(token_t*, params, token);
+            }
+        }
+    }
+
+    body = token_ptr_array_create();
+    n = snapshot_get_u32(&r);
+
+    for (i = 0; i < n && r.ok; i++) {
+        if ((token = __preprocessor_load_token__(&r, loc)) == NULL) {
+            break;
+        }
+
+        token_ptr_array_append(body, token);
+
+        if (refs != NULL) {
+            ref = (int) (int32_t) snapshot_get_u32(&r);
+            if (ref != PP_MACRO_NO_PARAM && (ref < 0 || (uint32_t) ref >= nparams)) {
+                r.ok = false;
+            }
+
+            array_cast_append(int, refs, ref);
+        }
+    }
+
+    for (i = 0; uses != NULL && i < nparams && r.ok; i++) {
+        counts = array_push_back(uses);
+        counts->expanded = snapshot_get_u32(&r);
+        counts->raw = snapshot_get_u32(&r);
+    }
+
+    if (!r.ok || r.p != r.end) {
+        errorf_with_token(use, "macro \"%s\" is damaged in '%s'", token_as_text(use),
+            macro->snapshot->filename);
+
+        is_variadic = false;
+
+        array_foreach(body, tokens, i) {
+            token_destroy(tokens[i]);
+        }
+        array_clear(body);
+
+        if (params != NULL) {
+            array_foreach(params, tokens, i) {
+                token_destroy(tokens[i]);
+            }
+            array_clear(params);
+            array_clear(refs);
+            array_clear(uses);
+        }
+    }
+
+    if (macro->type == PP_MACRO_FUNCTION) {
+        macro->function_like.is_variadic = is_variadic;
+        macro->function_like.params = params;
+        macro->function_like.body = body;
+        macro->function_like.refs = refs;
+        macro->function_like.uses = uses;
+    } else {
+        macro->object_like.body = body;
+        macro->object_like.cache = NULL;
+    }
+
+    macro->snapshot = NULL;
+    macro->record = NULL;
+    macro->record_length = 0;
+}
+
+
+/**
+ * Tokens that did not come from the lexer with our table, pasted ones or
+ * those made by hand, get their record on first use.
+ **/
+static inline
+ident_t* __preprocessor_ident__(preprocessor_t *pp, token_t *token)
+{
+    const unsigned char *s;
+    size_t n;
+
+    if (token->ident == NULL) {
+        s = token_spelling(token, &n);
+        token->ident = identtab_lookup(pp->idents, s, n);
+    }
+
+    return token->ident;
+}
+
+
+/**
+ * Notes the name down as looked up by the text read since the last mark,
+ * for the journal.
+ **/
+static inline
+void __preprocessor_consult__(preprocessor_t *pp, ident_t *ident)
+{
+    if (ident->consulted != pp->mark) {
+        ident->consulted = pp->mark;
+        array_cast_append(ident_t*, pp->consulted, ident);
+    }
+}
+
+
+/**
+ * Binds macro, NULL for none, to ident. The one it replaces is destroyed,
+ * or with a journal kept for an undo.
+ **/
+static inline
+void __preprocessor_bind__(preprocessor_t *pp, ident_t *ident, macro_t *macro)
+{
+    pp_journal_t *entry;
+
+    if (pp->journal != NULL) {
+        entry = array_push_back(pp->journal);
+        entry->ident = ident;
+        entry->before = ident->macro;
+        entry->after = macro;
+        entry->once = NULL;
+    } else if (ident->macro != NULL) {
+        __macro_destroy__(ident->macro);
+    }
+
+    ident->macro = macro;
+    ident->was_macro = ident->was_macro || macro != NULL;
+    ident->version++;
+    pp->defines++;
+}
+
+
+static
+void __preprocessor_add_once__(preprocessor_t *pp, cstring_t identity)
+{
+    pp_journal_t *entry;
+
+    if (pp->journal != NULL && !set_has(pp->once_guard, identity)) {
+        entry = array_push_back(pp->journal);
+        entry->ident = NULL;
+        entry->before = NULL;
+        entry->after = NULL;
+        entry->once = cstring_dup(identity);
+    }
+
+    set_add(pp->once_guard, identity);
+}
+
+
+/**
+ * The spelling of an identifier without making it the token's own, that
+ * of its record when it has one.
+ **/
+static inline
+cstring_t __preprocessor_name__(token_t *token)
+{
+    return token->ident != NULL ? token->ident->name : token_cs(token);
+}
+
+
+static
+array_t* __create_tokens__(void)
+{
+    return array_create_n(sizeof(token_t*), 8);
+}
+
+
+static
+void __macro_cache_destroy__(macro_cache_t *cache)
+{
+    if (cache->tokens != NULL) {
+        __destroy_tokens__(cache->tokens);
+    }
+
+    array_destroy(cache->depends);
+    hideset_release(cache->expanded);
+    pfree(cache);
+}
+
+
+/* a macro body and the tokens in it */
+static
+void __destroy_body__(token_ptr_array_t *body)
 {
-    return array_create_n(sizeof(token_t), 8);
+    token_t **tokens;
+    size_t i;
+
+    array_foreach(body, tokens, i) {
+        token_destroy(tokens[i]);
+    }
+
+    token_ptr_array_destroy(body);
 }
 
 
 static
-void __destroy_tokens__(array_t a)
+void __destroy_tokens__(array_t *a)
 {
-    token_t *tokens;
+    token_t **tokens;
     size_t i;
 
     array_foreach(a, tokens, i) {
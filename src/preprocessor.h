@@ -9,12 +9,17 @@
 #include "set.h"
 
 
-typedef struct array_s*     array_t;
-typedef struct token_s*     token_t;
-typedef struct lexer_s*     lexer_t;
-typedef struct dict_s*      dict_t;
-typedef struct option_s*    option_t;
-typedef struct reader_s*    reader_t;
+typedef struct array_s      array_t;
+typedef struct token_s      token_t;
+typedef struct token_ptr_array_s token_ptr_array_t;
+typedef struct lexer_s      lexer_t;
+typedef struct identtab_s   identtab_t;
+typedef struct ident_s      ident_t;
+typedef struct hideset_s    hideset_t;
+typedef struct incpath_s    incpath_t;
+typedef struct snapshot_s   snapshot_t;
+typedef struct tokcache_s   tokcache_t;
+typedef struct depfile_s    depfile_t;
 
 
 typedef enum macro_type_e {
@@ -24,7 +29,44 @@ typedef enum macro_type_e {
 } macro_type_t;
 
 
-typedef bool (*native_macro_pt) (token_t tok);
+typedef bool (*native_macro_pt) (token_t *tok);
+
+
+/**
+ * A name an expansion was worked out with, at the ident_t version it had.
+ **/
+typedef struct macro_depend_s {
+    ident_t *ident;
+    size_t version;
+} macro_depend_t;
+
+
+/**
+ * The full expansion of an object-like macro, worked out once for every
+ * use whose hideset leaves alone the macros in expanded. None if the
+ * outcome depends on what follows the use, a function-like or native
+ * macro lies on the way, but the depends are kept all the same. Good so
+ * long as no name in depends was defined or undefined, which is checked
+ * when the preprocessor's count of #define and #undef is past stamp.
+ **/
+typedef struct macro_cache_s {
+    array_t *tokens;
+    array_t *depends;
+    hideset_t *expanded;
+    size_t stamp;
+    bool contextual;
+} macro_cache_t;
+
+
+/**
+ * How often a function-like body names a parameter: as an operand of #
+ * or ## which take the argument as written, and otherwise, where it is
+ * macro expanded first.
+ **/
+typedef struct macro_uses_s {
+    size_t expanded;
+    size_t raw;
+} macro_uses_t;
 
 
 typedef struct macro_s {
@@ -32,50 +74,174 @@ typedef struct macro_s {
 
     union {
         struct {
-            array_t body;
+            token_ptr_array_t *body;
+            macro_cache_t *cache;
         } object_like;
 
+        /**
+         * refs holds an int for each body token, the index of the parameter
+         * it names or PP_MACRO_NO_PARAM, and uses a macro_uses_t for each
+         * parameter.
+         **/
         struct {
-            array_t body;
-            array_t params;
+            token_ptr_array_t *body;
+            array_t *params;
+            array_t *refs;
+            array_t *uses;
             bool is_variadic;
         } function_like;
 
         native_macro_pt native_macro_fn;
     };
 
-    token_t name_token;
-} *macro_t;
+    token_t *name_token;
+
+    /* a macro loaded from a snapshot is read in on first use, from record */
+    snapshot_t *snapshot;
+    const unsigned char *record;
+    size_t record_length;
+} macro_t;
+
+
+#define PP_MACRO_NO_PARAM       (-1)
+
+
+/* the arguments of an invocation up to this many are bound on the stack */
+#ifndef PP_MACRO_ARGS
+#define PP_MACRO_ARGS           16
+#endif
+
+
+#ifndef PP_INCLUDE_DEPTH
+#define PP_INCLUDE_DEPTH        200
+#endif
 
 
+/**
+ * An open #if: condiction once one of its groups was taken, the rest are
+ * skipped then.
+ **/
 typedef struct condition_directive_s {
     bool condiction;
-} *condition_directive_t;
+    bool has_else;
+} condition_directive_t;
+
+
+/**
+ * Where a file stands in covering itself with #ifndef X ... #endif, the
+ * multiple-include optimization: anything but newlines outside of it, or
+ * an #else or #elif of its own, and it is not a guard.
+ **/
+typedef enum guard_state_e {
+    PP_GUARD_START,
+    PP_GUARD_INSIDE,
+    PP_GUARD_AFTER,
+    PP_GUARD_NONE,
+} guard_state_t;
+
+
+/**
+ * An #include being read. identity is that of srcfile_t, the device and
+ * inode, depth the number of conditions open when the file was entered.
+ * path is the one it was opened by, held by the include paths.
+ **/
+typedef struct include_frame_s {
+    cstring_t identity;
+    cstring_t path;
+    size_t depth;
+    guard_state_t guard_state;
+    ident_t *guard;
+    size_t span;                        /* of the trace, 0 if none */
+} include_frame_t;
+
+
+/**
+ * What a #define or #undef did to the binding of ident, or without one
+ * the #pragma once of the file of identity, which the entry owns.
+ **/
+typedef struct pp_journal_s {
+    ident_t *ident;
+    macro_t *before;
+    macro_t *after;
+    cstring_t once;
+} pp_journal_t;
+
+
+/**
+ * Where a preprocessor with a journal stood between two lines of the
+ * text, see preprocessor_checkpoint(): all it knew then is the journal up
+ * to there, the names looked up and the #include directives run so far.
+ **/
+typedef struct pp_checkpoint_s {
+    size_t journal;
+    size_t consulted;
+    size_t included;
+} pp_checkpoint_t;
 
 
 typedef struct preprocessor_s {
-    array_t std_include_paths;
-   
-    array_t condition_directive_stack;
-  
-    array_t snapshot;
-    lexer_t lexer;
-
-    map_t macros;
-    set_t include_guard;
-    set_t once_guard;
-
-    diag_t diag;
-} *preprocessor_t;
-
-
-preprocessor_t preprocessor_create(lexer_t lexer, option_t option, diag_t diag);
-void preprocessor_destroy(preprocessor_t pp);
-void preprocessor_add_include_path(preprocessor_t pp, const char *path);
-token_t preprocessor_expand(preprocessor_t pp);
-token_t preprocessor_peek(preprocessor_t pp);
-token_t preprocessor_get(preprocessor_t pp);
-void preprocessor_unget(preprocessor_t pp, token_t tok);
+    incpath_t *include_paths;
+    bool clean_include_paths;
+
+    array_t *condition_directive_stack;
+    array_t *includes;
+
+    /* the snapshots loaded, held open for the macros still to read in */
+    array_t *snapshots;
+    /* the tokens of the files included, if they are to be cached */
+    tokcache_t *tokcache;
+    /* the headers included, for -M and -MD, NULL if no rule is wanted */
+    depfile_t *depends;
+    lexer_t *lexer;
+
+    /* the macros are bound on the identifiers */
+    identtab_t *idents;
+    /* the number of #define and #undef, and the cache being worked out */
+    size_t defines;
+    macro_cache_t *recording;
+    /* the depth of the expansions going on, the tokens of the last one */
+    size_t expanding;
+    size_t expansion;
+    /* file identity to the ident_t of its guard, and the #pragma once */
+    map_t *include_guard;
+    set_t *once_guard;
+    /* the #include directives run */
+    size_t included;
+    /* whether the text, outside directives, may come in number runs */
+    bool runs;
+    /**
+     * With preprocessor_set_journal(), the changes to the macros in the
+     * order made, and the macros made, which are not destroyed before the
+     * preprocessor is. consulted has the names looked up, once for each
+     * mark: the ident_t is noted with the mark it was looked up at.
+     **/
+    array_t *journal;
+    array_t *macros;
+    array_t *consulted;
+    size_t mark;
+} preprocessor_t;
+
+
+preprocessor_t* preprocessor_create(lexer_t *lexer);
+preprocessor_t* preprocessor_create_incpath(lexer_t *lexer, incpath_t *inc);
+void preprocessor_destroy(preprocessor_t *pp);
+void preprocessor_add_include_path(preprocessor_t *pp, const char *path);
+void preprocessor_set_tokcache(preprocessor_t *pp, tokcache_t *cache);
+void preprocessor_set_depfile(preprocessor_t *pp, depfile_t *dep);
+void preprocessor_set_runs(preprocessor_t *pp, bool runs);
+bool preprocessor_save_snapshot(preprocessor_t *pp, const char *fn);
+bool preprocessor_load_snapshot(preprocessor_t *pp, const char *fn);
+token_t* preprocessor_expand(preprocessor_t *pp);
+size_t preprocessor_expand_batch(preprocessor_t *pp, token_t **tokens, size_t n);
+token_t* preprocessor_peek(preprocessor_t *pp);
+token_t* preprocessor_get(preprocessor_t *pp);
+size_t preprocessor_get_batch(preprocessor_t *pp, token_t **tokens, size_t n);
+void preprocessor_unget(preprocessor_t *pp, token_t *tok);
+void preprocessor_set_journal(preprocessor_t *pp);
+bool preprocessor_checkpoint(preprocessor_t *pp, pp_checkpoint_t *cp);
+void preprocessor_restore(preprocessor_t *pp, const pp_checkpoint_t *cp);
+void preprocessor_redo(preprocessor_t *pp, const pp_journal_t *entries, size_t n,
+                       ident_t *const *consulted, size_t nconsulted);
 
 
 #endif
@@ -24,6 +24,13 @@
 #include "pmalloc.h"
 #include "cstring.h"
 #include "cspool.h"
+#include "srcpool.h"
+#include "scan.h"
+#include "splice.h"
+#include "linemap.h"
+#include "srcloc.h"
+#include "stats.h"
+#include "prefetch.h"
 #include "reader.h"
 #include "utils.h"
 #include "option.h"
@@ -40,6 +47,19 @@
 #endif
 
 
+/**
+ * A windowed stream gives the pages more than READER_WINDOW_HISTORY
+ * bytes behind it back every READER_WINDOW_SIZE bytes.
+ **/
+#ifndef READER_WINDOW_SIZE
+#define READER_WINDOW_SIZE      (8 * 1024 * 1024)
+#endif
+
+#ifndef READER_WINDOW_HISTORY
+#define READER_WINDOW_HISTORY   (1024 * 1024)
+#endif
+
+
 struct stream_s {
     stream_type_t type;
 
@@ -47,37 +67,61 @@ struct stream_s {
 
     cstring_t stashed;
 
-    linenote_t line_note;
+    const unsigned char *pc;
+    const unsigned char *pe;
 
-    unsigned char *pc;
-    unsigned char *pe;
+    /**
+     * A clean stream walks the output of the phase 1/2 pre-pass and
+     * replays its splices to keep the physical offset of pc in delta.
+     * Otherwise base == raw and delta stays 0.
+     **/
+    const unsigned char *raw;
+    const unsigned char *base;
+    const splice_t *splice;
+    const splice_t *splice_end;
+    size_t delta;
+    bool clean;
 
-    size_t line;
-    size_t column;
+    /* lines, columns and linenotes are resolved from offsets on demand */
+    linemap_t *lines;
+
+    /* the location of offset 0, the stream has a range of its own */
+    srcloc_t loc;
+
+    /* windowed files only, next point at which to evict history */
+    srcfile_t *file;
+    const unsigned char *evict_at;
 
     time_t modify_time;
     time_t change_time;
     time_t access_time;
 
     int lastch;
+
+    reader_t *reader;
 };
 
 
-#define STREAM_STEP_BY_LINE(stream)         \
-    do {                                    \
-        (stream)->line++;                   \
-        (stream)->column = 1;               \
-        (stream)->line_note = (stream)->pc; \
-    } while (false)
+/* the include stack, the first READER_STREAM_DEPTH streams inline */
+ARRAY_DEFINE(stream, stream_t, READER_STREAM_DEPTH)
+
 
+#define STREAM_OFFSET(stream)               \
+    ((size_t) ((stream)->pc - (stream)->base) + (stream)->delta)
 
-static bool __stream_init__(cspool_t *cspool, stream_t *stream,
+
+static bool __stream_init__(reader_t *reader, stream_t *stream,
                             stream_type_t type, const unsigned char *s);
 static void __stream_uninit__(stream_t *stream);
 static void __stream_push__(stream_t *stream, int ch);
 static int __stream_pop__(stream_t *stream);
 static int __stream_next__(stream_t *stream);
 static int __stream_peek__(stream_t *stream);
+static void __stream_replay__(stream_t *stream, bool crlf_only);
+static int __stream_next_clean__(stream_t *stream);
+static void __stream_warning__(stream_t *stream, size_t offset, const char *msg);
+static void __stream_evict__(stream_t *stream);
+static void __stream_seek__(stream_t *stream, const unsigned char *p);
 
 
 reader_t* reader_create(void)
@@ -85,7 +129,13 @@ reader_t* reader_create(void)
     reader_t *reader = (reader_t*) pmalloc(sizeof(reader_t));
     reader->cspool = cspool_create();
     reader->clean_csp = true;
-    reader->streams = array_create_n(sizeof(stream_t), READER_STREAM_DEPTH);
+    reader->srcpool = srcpool_create();
+    reader->clean_srcpool = true;
+    reader->streams = stream_array_create();
+    reader->linemaps = array_create(sizeof(linemap_t*));
+    reader->prefetch = NULL;
+    reader->speculative = false;
+    reader->suppressed = 0;
     reader->last = NULL;
     return reader;
 }
@@ -94,15 +144,27 @@ reader_t* reader_create(void)
 reader_t* reader_create_csp(cspool_t *csp)
 {
     reader_t *reader = reader_create();
+    cspool_destroy(reader->cspool);
     reader->cspool = csp;
     reader->clean_csp = false;
     return reader;
 }
 
 
+reader_t* reader_create_srcpool(cspool_t *csp, srcpool_t *srcpool)
+{
+    reader_t *reader = reader_create_csp(csp);
+    srcpool_destroy(reader->srcpool);
+    reader->srcpool = srcpool;
+    reader->clean_srcpool = false;
+    return reader;
+}
+
+
 void reader_destroy(reader_t *reader)
 {
     stream_t *streams;
+    linemap_t **linemaps;
     size_t i;
 
     if (reader->clean_csp) {
@@ -113,12 +175,43 @@ void reader_destroy(reader_t *reader)
         __stream_uninit__(&streams[i]);
     }
 
-    array_destroy(reader->streams);
+    stream_array_destroy(reader->streams);
+
+    /**
+     * Buffers outlive their streams: tokens keep offsets into them until
+     * the whole reader goes away.
+     **/
+    array_foreach(reader->linemaps, linemaps, i) {
+        linemap_destroy(linemaps[i]);
+    }
+
+    array_destroy(reader->linemaps);
+
+    if (reader->clean_srcpool) {
+        srcpool_destroy(reader->srcpool);
+    }
 
     pfree(reader);
 }
 
 
+/**
+ * Every file pushed from now on has its includes handed to prefetch,
+ * which must load into the reader's srcpool. The reader does not own it.
+ **/
+void reader_set_prefetch(reader_t *reader, prefetch_t *prefetch)
+{
+    assert(prefetch == NULL || prefetch->srcpool == reader->srcpool);
+    reader->prefetch = prefetch;
+}
+
+
+void reader_set_speculative(reader_t *reader, bool speculative)
+{
+    reader->speculative = speculative;
+}
+
+
 size_t reader_depth(reader_t *reader)
 {
     return array_length(reader->streams);
@@ -155,13 +248,103 @@ time_t reader_access_time(reader_t *reader)
 bool reader_push(reader_t *reader, stream_type_t type, const unsigned char *s)
 {
     stream_t *stream;
+    stats_phase_t phase;
+    bool ok;
+
+    if ((stream = stream_array_push_back(reader->streams)) == NULL) {
+        return false;
+    }
+
+    phase = stats_enter(STATS_PHASE_READ);
+    ok = __stream_init__(reader, stream, type, s);
+    stats_leave(phase);
 
-    stream = array_push_back(reader->streams);
+    if (!ok) {
+        array_pop_back(reader->streams);
+        return false;
+    }
+
+    reader->last = stream;
+    return true;
+}
+
+
+/**
+ * Reads the clean bytes [begin, end) of the current stream of from, a
+ * clean stream, which must outlive the reader. begin is at or after the
+ * read position of from. Offsets and locations
+ * come out as when from reads them, but no newline is made up at end:
+ * end is expected right after a '\n'.
+ **/
+bool reader_push_range(reader_t *reader, reader_t *from,
+                       const unsigned char *begin, const unsigned char *end)
+{
+    stream_t *source = from->last, *stream;
+
+    assert(source != NULL && source->clean);
+    assert(source->pc <= begin && begin <= end && end <= source->pe);
+
+    if ((stream = stream_array_push_back(reader->streams)) == NULL) {
+        return false;
+    }
+
+    *stream = *source;
+    stream->stashed = NULL;
+    stream->pe = end;
+    stream->reader = reader;
+
+    /* the splice at end, if any, is replayed by whoever reads on */
+    while (stream->splice_end > stream->splice &&
+           stream->base + stream->splice_end[-1].clean >= end) {
+        stream->splice_end--;
+    }
 
-    if (!__stream_init__(reader->cspool, stream, type, s)) {
+    __stream_seek__(stream, begin);
+
+    reader->last = stream;
+    return true;
+}
+
+
+/**
+ * Reads length bytes of text, named fn, as a string stream that borrows
+ * both the text and its lines instead of copying them: they, and fn, must
+ * outlive the reader and the tokens read. A text read again is placed at
+ * the loc it was given the first time, SRCLOC_NONE gives it a range.
+ **/
+bool reader_push_text(reader_t *reader, cstring_t fn, const unsigned char *text,
+                      size_t length, linemap_t *lines, srcloc_t loc)
+{
+    stream_t *stream;
+
+    if ((stream = stream_array_push_back(reader->streams)) == NULL) {
         return false;
     }
 
+    stream->type = STREAM_TYPE_STRING;
+    stream->fn = fn;
+    stream->modify_time = 0;
+    stream->access_time = 0;
+    stream->change_time = 0;
+    stream->raw = text;
+    stream->splice = stream->splice_end = NULL;
+    stream->clean = false;
+    stream->file = NULL;
+    stream->evict_at = NULL;
+    stream->lines = lines;
+    stream->loc = loc;
+    stream->reader = reader;
+    stream->stashed = NULL;
+    stream->base = stream->pc = text;
+    stream->pe = &text[length];
+    stream->delta = 0;
+    stream->lastch = '\0';
+
+    if (loc == SRCLOC_NONE) {
+        stream->loc = srcloc_add_buffer(fn, lines, length);
+        stats_add(STATS_BYTES_READ, length);
+    }
+
     reader->last = stream;
     return true;
 }
@@ -178,7 +361,7 @@ void reader_pop(reader_t *reader)
     if (array_is_empty(reader->streams)) {
         reader->last = NULL;
     } else {
-        reader->last = &(array_cast_back(struct stream_s, reader->streams));
+        reader->last = stream_array_back(reader->streams);
     }
 }
 
@@ -224,24 +407,356 @@ bool reader_test(reader_t *reader, int ch)
 }
 
 
+/**
+ * Returns the longest run of ordinary bytes at the read position, that is
+ * up to the next '\\', '\r', '\n' or the end of the stream. Such bytes
+ * read back exactly as reader_get() would return them. The run is empty
+ * while characters are stashed. Nothing is consumed, see reader_advance().
+ **/
+size_t reader_peek_span(reader_t *reader, const unsigned char **span)
+{
+    stream_t *stream = reader->last;
+
+    if (stream == NULL ||
+        (stream->stashed != NULL && cstring_length(stream->stashed) > 0)) {
+        *span = NULL;
+        return 0;
+    }
+
+    *span = stream->pc;
+
+    if (stream->clean) {
+        const unsigned char *limit = stream->pe;
+
+        __stream_replay__(stream, false);
+
+        if (stream->splice < stream->splice_end) {
+            limit = stream->base + stream->splice->clean;
+        }
+
+        return scan_find(stream->pc, limit, '\n', '\n', '\n', '\n') - stream->pc;
+    }
+
+    return scan_find_special(stream->pc, stream->pe) - stream->pc;
+}
+
+
+size_t reader_get_span(reader_t *reader, const unsigned char **span)
+{
+    size_t n = reader_peek_span(reader, span);
+    reader_advance(reader, n);
+    return n;
+}
+
+
+/**
+ * Like reader_peek_span() but the run goes on across '\n', for callers
+ * such as block comments that take line breaks like any other byte.
+ **/
+size_t reader_peek_block(reader_t *reader, const unsigned char **span)
+{
+    stream_t *stream = reader->last;
+
+    if (stream == NULL ||
+        (stream->stashed != NULL && cstring_length(stream->stashed) > 0)) {
+        *span = NULL;
+        return 0;
+    }
+
+    *span = stream->pc;
+
+    if (stream->clean) {
+        const unsigned char *limit = stream->pe;
+
+        __stream_replay__(stream, false);
+
+        if (stream->splice < stream->splice_end) {
+            limit = stream->base + stream->splice->clean;
+        }
+
+        return limit - stream->pc;
+    }
+
+    return scan_find(stream->pc, stream->pe, '\\', '\r', '\r', '\r') - stream->pc;
+}
+
+
+/**
+ * Consumes n bytes of the span returned by reader_peek_span() or
+ * reader_peek_block().
+ **/
+void reader_advance(reader_t *reader, size_t n)
+{
+    stream_t *stream = reader->last;
+
+    if (n == 0) {
+        return;
+    }
+
+    assert(stream != NULL && n <= (size_t) (stream->pe - stream->pc));
+
+    stream->pc += n;
+    stream->lastch = stream->pc[-1];
+
+    if (stream->evict_at != NULL && stream->pc >= stream->evict_at) {
+        __stream_evict__(stream);
+    }
+}
+
+
+/**
+ * The skip scanner, for the groups of a false #if: reads on without making
+ * tokens, minding only comments, literals and line starts, up to a '#'
+ * that begins a line, which is left unread. bol is whether the read
+ * position is at a line start. False if the stream ends first.
+ **/
+bool reader_skip_to_hash(reader_t *reader, bool bol)
+{
+    const unsigned char *span, *p, *pe;
+    int ch, quote = 0;
+    bool comment_bol = false;
+    size_t n;
+    enum {
+        SKIP_BOL,
+        SKIP_CODE,
+        SKIP_LITERAL,
+        SKIP_BLOCK_COMMENT,
+        SKIP_LINE_COMMENT,
+    } state = bol ? SKIP_BOL : SKIP_CODE;
+
+    for (;;) {
+        n = reader_peek_block(reader, &span);
+        p = span;
+        pe = span + n;
+
+        /* runs of bytes that do not matter go at once, the rest one by one */
+
+        switch (state) {
+        case SKIP_BOL:
+            p = scan_skip_blank(p, pe);
+            break;
+        case SKIP_CODE:
+            p = scan_find(p, pe, '\n', '"', '\'', '/');
+            break;
+        case SKIP_LITERAL:
+            p = scan_find(p, pe, (unsigned char) quote, '\\', '\n', '\n');
+            break;
+        case SKIP_BLOCK_COMMENT:
+            p = scan_find(p, pe, '*', '*', '*', '*');
+            break;
+        case SKIP_LINE_COMMENT:
+            p = scan_find(p, pe, '\n', '\n', '\n', '\n');
+            break;
+        }
+
+        reader_advance(reader, p - span);
+
+        ch = reader_peek(reader);
+        if (ch == EOF) {
+            return false;
+        }
+
+        if (state == SKIP_BOL) {
+            if (ch == '#') {
+                return true;
+            }
+
+            if (ch != ' ' && ch != '\t' && ch != '\v' && ch != '\f' && ch != '\n' && ch != '/') {
+                state = SKIP_CODE;
+                continue;
+            }
+        }
+
+        reader_get(reader);
+
+        switch (state) {
+        case SKIP_BOL:
+        case SKIP_CODE:
+            if (ch == '\n') {
+                state = SKIP_BOL;
+            } else if (ch == '"' || ch == '\'') {
+                state = SKIP_LITERAL;
+                quote = ch;
+            } else if (ch == '/' && reader_try(reader, '*')) {
+                comment_bol = state == SKIP_BOL;
+                state = SKIP_BLOCK_COMMENT;
+            } else if (ch == '/' && reader_try(reader, '/')) {
+                state = SKIP_LINE_COMMENT;
+            } else if (ch == '/') {
+                state = SKIP_CODE;
+            }
+            break;
+
+        case SKIP_LITERAL:
+            if (ch == quote) {
+                state = SKIP_CODE;
+            } else if (ch == '\n') {
+                state = SKIP_BOL;
+            } else if (ch == '\\' && reader_peek(reader) != '\n' && reader_peek(reader) != EOF) {
+                reader_get(reader);
+            }
+            break;
+
+        case SKIP_BLOCK_COMMENT:
+            if (ch == '*' && reader_try(reader, '/')) {
+                state = comment_bol ? SKIP_BOL : SKIP_CODE;
+            }
+            break;
+
+        case SKIP_LINE_COMMENT:
+            if (ch == '\n') {
+                state = SKIP_BOL;
+            }
+            break;
+        }
+    }
+}
+
+
+/**
+ * All that is left of a clean stream, including the bytes of splices not
+ * yet replayed. Lazy streams and stashed characters give an empty rest.
+ **/
+size_t reader_peek_rest(reader_t *reader, const unsigned char **rest)
+{
+    stream_t *stream = reader->last;
+
+    if (stream == NULL || !stream->clean ||
+        (stream->stashed != NULL && cstring_length(stream->stashed) > 0)) {
+        *rest = NULL;
+        return 0;
+    }
+
+    *rest = stream->pc;
+    return stream->pe - stream->pc;
+}
+
+
+/**
+ * Skips a clean stream forward to p, a position inside its rest right
+ * after a '\n'. The splices in between are taken without a word. A stream
+ * read as it is, of reader_push_text(), has no splices to take.
+ **/
+void reader_seek(reader_t *reader, const unsigned char *p)
+{
+    stream_t *stream = reader->last;
+
+    assert(stream != NULL && (stream->clean || stream->splice == NULL));
+    assert(stream->stashed == NULL || cstring_length(stream->stashed) == 0);
+    assert(stream->pc <= p && p <= stream->pe);
+
+    __stream_seek__(stream, p);
+}
+
+
 linenote_t reader_linenote(reader_t *reader)
 {
+    linenote_t linenote;
+
     assert(reader->last != NULL);
-    return reader->last->line_note;
+    linemap_resolve(reader->last->lines, STREAM_OFFSET(reader->last),
+                    NULL, NULL, &linenote);
+    return linenote;
 }
 
 
 size_t reader_line(reader_t *reader)
 {
+    size_t line;
+
     assert(reader->last != NULL);
-    return reader->last->line;
+    linemap_resolve(reader->last->lines, STREAM_OFFSET(reader->last),
+                    &line, NULL, NULL);
+    return line;
 }
 
 
 size_t reader_column(reader_t *reader)
+{
+    size_t column;
+
+    assert(reader->last != NULL);
+    linemap_resolve(reader->last->lines, STREAM_OFFSET(reader->last),
+                    NULL, &column, NULL);
+    return column;
+}
+
+
+/**
+ * Physical offset of the next character to be read. Stashed characters
+ * were read just before the read position, so they are stepped back over.
+ **/
+size_t reader_offset(reader_t *reader)
+{
+    stream_t *stream = reader->last;
+    size_t offset, stashed;
+
+    assert(stream != NULL);
+
+    offset = STREAM_OFFSET(stream);
+    stashed = stream->stashed != NULL ? cstring_length(stream->stashed) : 0;
+
+    return stashed < offset ? offset - stashed : 0;
+}
+
+
+/**
+ * The read position inside the buffer of the current stream, NULL while
+ * characters are stashed or when the buffer may be evicted. If the cursor
+ * moved by exactly as many bytes as characters were read, those bytes are
+ * the characters; the buffer lives as long as the reader.
+ **/
+const unsigned char* reader_cursor(reader_t *reader)
+{
+    stream_t *stream = reader->last;
+
+    if (stream == NULL || stream->evict_at != NULL ||
+        (stream->stashed != NULL && cstring_length(stream->stashed) > 0)) {
+        return NULL;
+    }
+
+    return stream->pc;
+}
+
+
+/**
+ * The whole buffer of the current stream, which reader_cursor() points
+ * into: the clean copy for a prepassed file. Empty for windowed files.
+ **/
+size_t reader_text(reader_t *reader, const unsigned char **text)
+{
+    stream_t *stream = reader->last;
+
+    if (stream == NULL || stream->evict_at != NULL) {
+        *text = NULL;
+        return 0;
+    }
+
+    *text = stream->base;
+    return stream->pe - stream->base;
+}
+
+
+/**
+ * The location of reader_offset(), SRCLOC_NONE if the space had no room
+ * left for the stream.
+ **/
+srcloc_t reader_loc(reader_t *reader)
 {
     assert(reader->last != NULL);
-    return reader->last->column;
+
+    if (reader->last->loc == SRCLOC_NONE) {
+        return SRCLOC_NONE;
+    }
+
+    return reader->last->loc + (srcloc_t) reader_offset(reader);
+}
+
+
+linemap_t* reader_linemap(reader_t *reader)
+{
+    assert(reader->last != NULL);
+    return reader->last->lines;
 }
 
 
@@ -269,49 +784,79 @@ cstring_t linenote2cs(linenote_t linenote)
 
 
 static
-bool __stream_init__(cspool_t *cspool, stream_t *stream,
+bool __stream_init__(reader_t *reader, stream_t *stream,
                      stream_type_t type, const unsigned char *s)
 {
-    cstring_t text = NULL;
+    const unsigned char *text = NULL;
+    size_t length = 0;
 
     switch (type) {
     case STREAM_TYPE_FILE: {
-        void *buf;
-        FILE *fp;
-        struct stat st;
+        srcfile_t *file;
 
-        if ((fp = fopen(s, "rb")) == NULL) {
+        if ((file = srcpool_load(reader->srcpool, s)) == NULL) {
             return false;
         }
 
-        if (fstat(fileno(fp), &st) != 0) {
-            goto failure;
+        stream->fn = cspool_push_cs(reader->cspool, cstring_new(s));
+        stream->modify_time = (time_t) file->modify_time;
+        stream->access_time = file->access_time;
+        stream->change_time = file->change_time;
+        stream->raw = file->text;
+        stream->lines = file->lines;
+        stream->loc = srcloc_add_buffer(stream->fn, stream->lines, file->length);
+        stats_add(STATS_BYTES_READ, file->length);
+
+        if (reader->prefetch != NULL && !file->windowed) {
+            prefetch_push(reader->prefetch, s, file->text, file->length);
         }
 
-        buf = pmalloc(st.st_size);
-        if (fread(buf, sizeof(unsigned char), st.st_size, fp) != st.st_size) {
-            goto failure;
+        /**
+         * A windowed file stays on the lazy path, a clean copy would make
+         * it resident all over again.
+         **/
+        if (file->windowed) {
+            stream->file = file;
+            stream->evict_at = file->text + READER_WINDOW_SIZE;
+        } else {
+            stream->file = NULL;
+            stream->evict_at = NULL;
+        }
+
+        if (option_get(prepass) && !file->windowed) {
+            srcpool_prepare(reader->srcpool, file);
+            stream->splice = array_prototype(file->splices, splice_t);
+            stream->splice_end = stream->splice + array_length(file->splices);
+            stream->clean = true;
+            text = file->clean;
+            length = file->clean_length;
+        } else {
+            stream->splice = stream->splice_end = NULL;
+            stream->clean = false;
+            text = file->text;
+            length = file->length;
         }
-       
-        stream->fn = cspool_push_cs(cspool, cstring_new(s));
-        stream->modify_time = st.st_mtime;
-        stream->access_time = st.st_atime;
-        stream->change_time = st.st_ctime;
-        text = cspool_push_cs(cspool, cstring_new_n(buf, st.st_size));
-
-        pfree(buf);
-        fclose(fp);
         break;
-    failure:
-        fclose(fp);
-        return false;
     }
     case STREAM_TYPE_STRING: {
-        stream->fn = cspool_push(cspool, "<string>");
+        cstring_t cs;
+
+        stream->fn = cspool_push(reader->cspool, "<string>");
         stream->modify_time = 0;
         stream->access_time = 0;
         stream->change_time = 0;
-        text = cspool_push(cspool, s);
+        cs = cspool_push(reader->cspool, s);
+        text = cs;
+        length = cstring_length(cs);
+        stream->raw = text;
+        stream->splice = stream->splice_end = NULL;
+        stream->clean = false;
+        stream->file = NULL;
+        stream->evict_at = NULL;
+        stream->lines = linemap_create(text, length);
+        stream->loc = srcloc_add_buffer(stream->fn, stream->lines, length);
+        stats_add(STATS_BYTES_READ, length);
+        array_cast_append(linemap_t*, reader->linemaps, stream->lines);
         break;
     }
     default:
@@ -319,11 +864,11 @@ bool __stream_init__(cspool_t *cspool, stream_t *stream,
     }
 
     stream->type = type;
+    stream->reader = reader;
     stream->stashed = NULL;
-    stream->line_note = stream->pc = text;
-    stream->pe = &text[cstring_length(text)];
-    stream->line = 1;
-    stream->column = 1;
+    stream->base = stream->pc = text;
+    stream->pe = &text[length];
+    stream->delta = 0;
     stream->lastch = '\0';
     return true;
 }
@@ -365,7 +910,16 @@ int __stream_next__(stream_t *stream)
         goto done;
     }
 
+    if (stream->clean) {
+        ch = __stream_next_clean__(stream);
+        goto done;
+    }
+
 nextch:
+    if (stream->evict_at != NULL && stream->pc >= stream->evict_at) {
+        __stream_evict__(stream);
+    }
+
     if (stream->pc >= stream->pe) {
         ch = stream->lastch == '\n' || 
             stream->lastch == EOF ? EOF : '\n';
@@ -381,15 +935,11 @@ nextch:
          * "\r\n" or "\r" are canonicalized to "\n" 
          **/
 
-        if (*stream->pc == '\n') {
+        if (stream->pc < stream->pe && *stream->pc == '\n') {
             stream->pc++;
         }
 
         ch = '\n';
-        STREAM_STEP_BY_LINE(stream);
-
-    } else if (ch == '\n') {
-        STREAM_STEP_BY_LINE(stream);
 
     } else if (ch == '\\') {
         /**
@@ -398,30 +948,24 @@ nextch:
          * physical source lines to form logical source lines
          **/
 
-        unsigned char *pc = stream->pc;
+        const unsigned char *pc = stream->pc;
         uintptr_t step = 0;
         while (pc < stream->pe && ISSPACE(*pc)) {
             switch (*pc) {
             case '\r':
-                if (*(pc + 1) == '\n') {
+                if (pc + 1 < stream->pe && *(pc + 1) == '\n') {
                     pc++;
                     step++;
                 }
             case '\n':
                 if (pc > stream->pc + step) {
                     if (option_get(w_backslash_newline_space)) {
-                        warningf_with_linenote_position(stream->fn,
-                                                        stream->line,
-                                                        stream->column,
-                                                        stream->line_note,
-                                                        stream->column,
-                                                        1,
-                                                        "backslash and newline separated by space");
+                        __stream_warning__(stream, STREAM_OFFSET(stream) - 1,
+                                           "backslash and newline separated by space");
                     }
                 }
 
                 stream->pc = pc + 1;
-                STREAM_STEP_BY_LINE(stream);
                 goto nextch;
             }
             pc++;
@@ -429,21 +973,13 @@ nextch:
 
         if (pc == stream->pe) {
             if (option_get(warn_no_newline_eof)) {
-                warningf_with_linenote_position(stream->fn,
-                                                stream->line,
-                                                stream->column,
-                                                stream->line_note,
-                                                stream->column,
-                                                1,
-                                                "backslash-newline at end of file");
+                __stream_warning__(stream, STREAM_OFFSET(stream) - 1,
+                                   "backslash-newline at end of file");
             }
 
             ch = '\n';
             stream->pc = pc;
         }
-
-    } else {
-        stream->column++;
     }
 
 done:
@@ -455,13 +991,21 @@ done:
 static int __stream_peek__(stream_t *stream)
 {
     int ch;
-    unsigned char *pc;
+    const unsigned char *pc;
 
     if (stream->stashed != NULL &&
         cstring_length(stream->stashed) > 0) {
         return stream->stashed[cstring_length(stream->stashed) - 1];
     }
 
+    if (stream->clean) {
+        if (stream->pc >= stream->pe) {
+            return stream->lastch == '\n' ||
+                stream->lastch == EOF ? EOF : '\n';
+        }
+        return *stream->pc;
+    }
+
     pc = stream->pc;
 nextch:
     if (pc >= stream->pe) {
@@ -480,7 +1024,7 @@ nextch:
         while (pc < stream->pe && ISSPACE(*pc)) {
             switch (*pc) {
             case '\r':
-                if (*(pc + 1) == '\n') {
+                if (pc + 1 < stream->pe && *(pc + 1) == '\n') {
                     pc++;
                 }
             case '\n':
@@ -496,3 +1040,123 @@ nextch:
     
     return ch;
 }
+
+
+static
+int __stream_next_clean__(stream_t *stream)
+{
+    int ch;
+
+    __stream_replay__(stream, false);
+
+    if (stream->pc >= stream->pe) {
+        return stream->lastch == '\n' ||
+            stream->lastch == EOF ? EOF : '\n';
+    }
+
+    ch = *stream->pc++;
+
+    if (ch == '\n') {
+        /* a "\r\n" must move the offset on to the start of the next line */
+        __stream_replay__(stream, true);
+    }
+
+    return ch;
+}
+
+
+/**
+ * Applies the splices recorded at the read position: moves the physical
+ * offset on and reports what the lazy path in __stream_next__ would have
+ * reported.
+ **/
+static
+void __stream_replay__(stream_t *stream, bool crlf_only)
+{
+    size_t offset = stream->pc - stream->base;
+    const splice_t *splice;
+
+    while (stream->splice < stream->splice_end &&
+           stream->splice->clean == offset) {
+
+        splice = stream->splice;
+        if (crlf_only && splice->type != SPLICE_CRLF) {
+            break;
+        }
+
+        switch (splice->type) {
+        case SPLICE_CRLF:
+            stream->delta = splice->phys - splice->clean;
+            break;
+        case SPLICE_SPACED:
+            if (option_get(w_backslash_newline_space)) {
+                __stream_warning__(stream, STREAM_OFFSET(stream),
+                                   "backslash and newline separated by space");
+            }
+        case SPLICE_NEWLINE:
+            stream->delta = splice->phys - splice->clean;
+            break;
+        case SPLICE_EOF:
+            if (option_get(warn_no_newline_eof)) {
+                __stream_warning__(stream, STREAM_OFFSET(stream),
+                                   "backslash-newline at end of file");
+            }
+            stream->delta = splice->phys - splice->clean;
+            break;
+        }
+
+        stream->splice++;
+    }
+}
+
+
+static
+void __stream_warning__(stream_t *stream, size_t offset, const char *msg)
+{
+    size_t line, column;
+    linenote_t linenote;
+
+    if (stream->reader->speculative) {
+        stream->reader->suppressed++;
+        return;
+    }
+
+    linemap_resolve(stream->lines, offset, &line, &column, &linenote);
+    warningf_with_linenote_position(stream->fn, line, column, linenote,
+                                    column, 1, "%s", msg);
+}
+
+
+static
+void __stream_evict__(stream_t *stream)
+{
+    size_t offset = stream->pc - stream->raw;
+
+    if (offset > READER_WINDOW_HISTORY) {
+        srcfile_evict(stream->file, offset - READER_WINDOW_HISTORY);
+    }
+
+    stream->evict_at = stream->pc + READER_WINDOW_SIZE;
+}
+
+
+/**
+ * Moves a clean stream to p, applying the splices before it as
+ * __stream_replay__ would and the "\r\n" at p itself.
+ **/
+static
+void __stream_seek__(stream_t *stream, const unsigned char *p)
+{
+    size_t offset = p - stream->base;
+
+    while (stream->splice < stream->splice_end &&
+           stream->splice->clean < offset) {
+        stream->delta = stream->splice->phys - stream->splice->clean;
+        stream->splice++;
+    }
+
+    stream->pc = p;
+    stream->lastch = p > stream->base ? p[-1] : '\0';
+
+    __stream_replay__(stream, true);
+}
@@ -6,11 +6,16 @@
 
 #include "config.h"
 #include "cstring.h"
+#include "srcloc.h"
 
 
 typedef struct array_s      array_t;
 typedef struct stream_s     stream_t;
+typedef struct stream_array_s stream_array_t;
 typedef struct cspool_s     cspool_t;
+typedef struct srcpool_s    srcpool_t;
+typedef struct linemap_s    linemap_t;
+typedef struct prefetch_s   prefetch_t;
 
 
 typedef enum stream_type_e {
@@ -22,28 +27,57 @@ typedef enum stream_type_e {
 typedef const unsigned char* linenote_t;
 
 
+/**
+ * A speculative reader counts its warnings in suppressed instead of
+ * reporting them, for input that may be read again later.
+ **/
 typedef struct reader_s {
-    array_t *streams;
+    stream_array_t *streams;
+    array_t *linemaps;
     stream_t *last;
     cspool_t *cspool;
     bool clean_csp;
+    srcpool_t *srcpool;
+    bool clean_srcpool;
+    prefetch_t *prefetch;
+    bool speculative;
+    size_t suppressed;
 } reader_t;
 
 
 reader_t* reader_create(void);
 reader_t* reader_create_csp(cspool_t *csp);
+reader_t* reader_create_srcpool(cspool_t *csp, srcpool_t *srcpool);
 void reader_destroy(reader_t *reader);
+void reader_set_prefetch(reader_t *reader, prefetch_t *prefetch);
+void reader_set_speculative(reader_t *reader, bool speculative);
 size_t reader_depth(reader_t *reader);
 bool reader_is_empty(reader_t *reader);
 bool reader_push(reader_t *reader, stream_type_t type, const unsigned char *s);
+bool reader_push_range(reader_t *reader, reader_t *from,
+                       const unsigned char *begin, const unsigned char *end);
+bool reader_push_text(reader_t *reader, cstring_t fn, const unsigned char *text,
+                      size_t length, linemap_t *lines, srcloc_t loc);
 void reader_pop(reader_t *reader);
 int reader_get(reader_t *reader);
 int reader_peek(reader_t *reader);
 void reader_unget(reader_t *reader, int ch);
 bool reader_try(reader_t *reader, int ch);
 bool reader_test(reader_t *reader, int ch);
+size_t reader_peek_span(reader_t *reader, const unsigned char **span);
+size_t reader_get_span(reader_t *reader, const unsigned char **span);
+size_t reader_peek_block(reader_t *reader, const unsigned char **span);
+void reader_advance(reader_t *reader, size_t n);
+bool reader_skip_to_hash(reader_t *reader, bool bol);
+size_t reader_peek_rest(reader_t *reader, const unsigned char **rest);
+void reader_seek(reader_t *reader, const unsigned char *p);
 size_t reader_line(reader_t *reader);
 size_t reader_column(reader_t *reader);
+size_t reader_offset(reader_t *reader);
+srcloc_t reader_loc(reader_t *reader);
+const unsigned char* reader_cursor(reader_t *reader);
+size_t reader_text(reader_t *reader, const unsigned char **text);
+linemap_t* reader_linemap(reader_t *reader);
 cstring_t reader_filename(reader_t *reader);
 time_t reader_modify_time(reader_t *reader);
 time_t reader_change_time(reader_t *reader);
@@ -0,0 +1,181 @@
+
+
+#include "config.h"
+#include "scan.h"
+
+
+#if defined(__AVX2__)
+#   include <immintrin.h>
+#   define SCAN_USE_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   include <emmintrin.h>
+#   define SCAN_USE_SSE2
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#   include <arm_neon.h>
+#   define SCAN_USE_NEON
+#endif
+
+
+#if defined(_MSC_VER)
+#   include <intrin.h>
+#endif
+
+
+static inline
+unsigned int __scan_ctz__(unsigned int mask)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned int) __builtin_ctz(mask);
+#elif defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (unsigned int) index;
+#else
+    unsigned int n = 0;
+    while ((mask & 1) == 0) {
+        mask >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+
+/**
+ * Returns a pointer to the first byte in [p, pe) equal to one of a, b, c
+ * or d, or pe when there is none. Pass a byte twice to look for fewer.
+ * Only whole vectors inside the range are loaded, the tail is scanned
+ * byte by byte.
+ **/
+const unsigned char* scan_find(const unsigned char *p, const unsigned char *pe,
+                               unsigned char a, unsigned char b,
+                               unsigned char c, unsigned char d)
+{
+#if defined(SCAN_USE_AVX2)
+    __m256i va = _mm256_set1_epi8((char) a);
+    __m256i vb = _mm256_set1_epi8((char) b);
+    __m256i vc = _mm256_set1_epi8((char) c);
+    __m256i vd = _mm256_set1_epi8((char) d);
+
+    while (pe - p >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) p);
+        __m256i m = _mm256_or_si256(
+                        _mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)),
+                        _mm256_or_si256(_mm256_cmpeq_epi8(v, vc), _mm256_cmpeq_epi8(v, vd)));
+        unsigned int mask = (unsigned int) _mm256_movemask_epi8(m);
+        if (mask != 0) {
+            return p + __scan_ctz__(mask);
+        }
+        p += 32;
+    }
+#elif defined(SCAN_USE_SSE2)
+    __m128i va = _mm_set1_epi8((char) a);
+    __m128i vb = _mm_set1_epi8((char) b);
+    __m128i vc = _mm_set1_epi8((char) c);
+    __m128i vd = _mm_set1_epi8((char) d);
+
+    while (pe - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) p);
+        __m128i m = _mm_or_si128(
+                        _mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)),
+                        _mm_or_si128(_mm_cmpeq_epi8(v, vc), _mm_cmpeq_epi8(v, vd)));
+        unsigned int mask = (unsigned int) _mm_movemask_epi8(m);
+        if (mask != 0) {
+            return p + __scan_ctz__(mask);
+        }
+        p += 16;
+    }
+#elif defined(SCAN_USE_NEON)
+    uint8x16_t va = vdupq_n_u8(a);
+    uint8x16_t vb = vdupq_n_u8(b);
+    uint8x16_t vc = vdupq_n_u8(c);
+    uint8x16_t vd = vdupq_n_u8(d);
+
+    while (pe - p >= 16) {
+        uint8x16_t v = vld1q_u8(p);
+        uint8x16_t m = vorrq_u8(vorrq_u8(vceqq_u8(v, va), vceqq_u8(v, vb)),
+                                vorrq_u8(vceqq_u8(v, vc), vceqq_u8(v, vd)));
+        if (vmaxvq_u8(m) != 0) {
+            break;
+        }
+        p += 16;
+    }
+#endif
+
+    for (; p < pe; p++) {
+        if (*p == a || *p == b || *p == c || *p == d) {
+            break;
+        }
+    }
+
+    return p;
+}
+
+
+/**
+ * The complement of scan_find(): returns a pointer to the first byte in
+ * [p, pe) that is none of a, b, c and d, or pe.
+ **/
+const unsigned char* scan_skip(const unsigned char *p, const unsigned char *pe,
+                               unsigned char a, unsigned char b,
+                               unsigned char c, unsigned char d)
+{
+#if defined(SCAN_USE_AVX2)
+    __m256i va = _mm256_set1_epi8((char) a);
+    __m256i vb = _mm256_set1_epi8((char) b);
+    __m256i vc = _mm256_set1_epi8((char) c);
+    __m256i vd = _mm256_set1_epi8((char) d);
+
+    while (pe - p >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) p);
+        __m256i m = _mm256_or_si256(
+                        _mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)),
+                        _mm256_or_si256(_mm256_cmpeq_epi8(v, vc), _mm256_cmpeq_epi8(v, vd)));
+        unsigned int mask = ~(unsigned int) _mm256_movemask_epi8(m);
+        if (mask != 0) {
+            return p + __scan_ctz__(mask);
+        }
+        p += 32;
+    }
+#elif defined(SCAN_USE_SSE2)
+    __m128i va = _mm_set1_epi8((char) a);
+    __m128i vb = _mm_set1_epi8((char) b);
+    __m128i vc = _mm_set1_epi8((char) c);
+    __m128i vd = _mm_set1_epi8((char) d);
+
+    while (pe - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) p);
+        __m128i m = _mm_or_si128(
+                        _mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)),
+                        _mm_or_si128(_mm_cmpeq_epi8(v, vc), _mm_cmpeq_epi8(v, vd)));
+        unsigned int mask = ~(unsigned int) _mm_movemask_epi8(m) & 0xffff;
+        if (mask != 0) {
+            return p + __scan_ctz__(mask);
+        }
+        p += 16;
+    }
+#elif defined(SCAN_USE_NEON)
+    uint8x16_t va = vdupq_n_u8(a);
+    uint8x16_t vb = vdupq_n_u8(b);
+    uint8x16_t vc = vdupq_n_u8(c);
+    uint8x16_t vd = vdupq_n_u8(d);
+
+    while (pe - p >= 16) {
+        uint8x16_t v = vld1q_u8(p);
+        uint8x16_t m = vorrq_u8(vorrq_u8(vceqq_u8(v, va), vceqq_u8(v, vb)),
+                                vorrq_u8(vceqq_u8(v, vc), vceqq_u8(v, vd)));
+        if (vminvq_u8(m) == 0) {
+            break;
+        }
+        p += 16;
+    }
+#endif
+
+    for (; p < pe; p++) {
+        if (*p != a && *p != b && *p != c && *p != d) {
+            break;
+        }
+    }
+
+    return p;
+}
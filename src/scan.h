@@ -0,0 +1,36 @@
+
+
+#ifndef __SCAN__H__
+#define __SCAN__H__
+
+
+#include "config.h"
+
+
+const unsigned char* scan_find(const unsigned char *p, const unsigned char *pe,
+                               unsigned char a, unsigned char b,
+                               unsigned char c, unsigned char d);
+
+
+const unsigned char* scan_skip(const unsigned char *p, const unsigned char *pe,
+                               unsigned char a, unsigned char b,
+                               unsigned char c, unsigned char d);
+
+
+/**
+ * Finds the first byte the reader has to look at one by one: a possible
+ * line splice or a line terminator.
+ **/
+#define scan_find_special(p, pe)                    \
+    scan_find((p), (pe), '\\', '\r', '\n', '\n')
+
+
+/**
+ * Skips the blanks of a whitespace run, line terminators are left to the
+ * caller.
+ **/
+#define scan_skip_blank(p, pe)                      \
+    scan_skip((p), (pe), ' ', '\t', '\v', '\f')
+
+
+#endif
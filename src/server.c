@@ -0,0 +1,623 @@
+
+
+#include "config.h"
+#include "pmalloc.h"
+#include "array.h"
+#include "dict.h"
+#include "cstring.h"
+#include "srcpool.h"
+#include "tokcache.h"
+#include "incpath.h"
+#include "server.h"
+
+
+#if defined(UNIX)
+#   include <errno.h>
+#   include <fcntl.h>
+#   include <signal.h>
+#   include <unistd.h>
+#   include <sys/stat.h>
+#   include <sys/socket.h>
+#   include <sys/un.h>
+#endif
+
+
+/**
+ * A request is a header, the magic, its kind and the length of what
+ * follows: for a run the directory and the arguments, each with a NUL.
+ **/
+#define SERVER_MAGIC        0x5343434fu
+#define SERVER_RUN          1
+#define SERVER_SHUTDOWN     2
+
+
+#if defined(UNIX)
+static const char* __server_path__(const char *path, char *buf);
+static int __server_connect__(const char *path);
+static bool __server_send__(int fd, uint32_t kind, cstring_t payload, bool stdio);
+static bool __server_read__(int fd, void *buf, size_t n);
+static bool __server_write__(int fd, const void *buf, size_t n);
+static void __server_request__(server_t *srv, int conn, server_handler_pt handler, void *ud, int home);
+static int __server_run__(server_t *srv, char *payload, size_t length, server_handler_pt handler, void *ud,
+    int out, int err, int home);
+#endif
+
+
+static inline
+uint64_t __hash_fn__(const void *key)
+{
+    return dict_gen_hash_function((unsigned char*)key, cstring_length((cstring_t)key));
+}
+
+
+static inline
+int __compare_fn__(void *privdata, const void *key1, const void *key2)
+{
+    size_t l1, l2;
+    DICT_NOTUSED(privdata);
+
+    l1 = cstring_length((cstring_t)key1);
+    l2 = cstring_length((cstring_t)key2);
+
+    return l1 == l2 && memcmp(key1, key2, l1) == 0;
+}
+
+
+static inline
+void __key_free_fn__(void *privdata, void *key)
+{
+    DICT_NOTUSED(privdata);
+    cstring_free((cstring_t)key);
+}
+
+
+static inline
+void __incpath_free_fn__(void *privdata, void *val)
+{
+    DICT_NOTUSED(privdata);
+    incpath_destroy((incpath_t *)val);
+}
+
+
+dict_type_t __server_dict_type__ = {
+    __hash_fn__,
+    NULL,
+    NULL,
+    __compare_fn__,
+    __key_free_fn__,
+    __incpath_free_fn__
+};
+
+
+/**
+ * Listens on path, SERVER_DEFAULT_PATH for NULL. A socket left behind by
+ * a server that is gone is taken over, NULL if one answers on it.
+ **/
+server_t* server_create(const char *path)
+{
+#if defined(UNIX)
+    struct sockaddr_un addr;
+    struct stat st;
+    server_t *srv;
+    char buf[64];
+    int fd;
+
+    path = __server_path__(path, buf);
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return NULL;
+    }
+
+    if ((fd = __server_connect__(path)) >= 0) {
+        close(fd);
+        return NULL;
+    }
+
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        return NULL;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, SERVER_BACKLOG) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    srv = (server_t *) pmalloc(sizeof(server_t));
+    if (!srv) {
+        close(fd);
+        return NULL;
+    }
+
+    srv->path = cstring_new(path);
+    srv->fd = fd;
+    srv->srcpool = srcpool_create();
+    srv->tokcache = tokcache_create(NULL);
+    srv->include_paths = dict_create(&__server_dict_type__, NULL);
+    srv->cwd = NULL;
+    srv->key = cstring_new_n(NULL, 256);
+    srv->requests = 0;
+    srv->stop = false;
+
+    return srv;
+#else
+    (void) path;
+    return NULL;
+#endif
+}
+
+
+void server_destroy(server_t *srv)
+{
+#if defined(UNIX)
+    close(srv->fd);
+    unlink((const char *) srv->path);
+#endif
+
+    cstring_free(srv->path);
+    srcpool_destroy(srv->srcpool);
+    tokcache_destroy(srv->tokcache);
+    dict_destroy(srv->include_paths);
+    cstring_free(srv->key);
+    pfree(srv);
+}
+
+
+/**
+ * Answers requests until one asks it to stop, false if it could not go
+ * on listening. handler runs each, in the directory of the client with
+ * its output and error for the standard ones, and its return is the
+ * exit status sent back.
+ **/
+bool server_serve(server_t *srv, server_handler_pt handler, void *ud)
+{
+#if defined(UNIX)
+    int conn, home;
+
+    /* a client gone is told by the write that failed, not by a signal */
+    signal(SIGPIPE, SIG_IGN);
+
+    if ((home = open(".", O_RDONLY)) < 0) {
+        return false;
+    }
+
+    while (!srv->stop) {
+        if ((conn = accept(srv->fd, NULL, NULL)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            close(home);
+            return false;
+        }
+
+        __server_request__(srv, conn, handler, ud, home);
+        close(conn);
+    }
+
+    close(home);
+    return true;
+#else
+    (void) srv;
+    (void) handler;
+    (void) ud;
+    return false;
+#endif
+}
+
+
+/**
+ * The include paths for a run with the search directories of inc, in
+ * the directory of the request: those of an earlier run with the same,
+ * refreshed, or a copy of inc kept for the next. inc stays the caller's.
+ **/
+incpath_t* server_include_paths(server_t *srv, incpath_t *inc)
+{
+    incpath_dir_t *dirs;
+    incpath_t *warm;
+    dict_entry_t *entry;
+    const char *cwd;
+    size_t i;
+
+    cwd = srv->cwd != NULL ? srv->cwd : "";
+
+    cstring_clear(srv->key);
+    srv->key = cstring_concat_n(srv->key, cwd, strlen(cwd));
+    srv->key = cstring_concat_ch(srv->key, '\0');
+
+    array_foreach(inc->dirs, dirs, i) {
+        srv->key = cstring_concat_ch(srv->key, dirs[i].system ? 'S' : 'I');
+        srv->key = cstring_concat_n(srv->key, dirs[i].path, cstring_length(dirs[i].path));
+        srv->key = cstring_concat_ch(srv->key, '\0');
+    }
+
+    if ((entry = dict_find(srv->include_paths, srv->key)) != NULL) {
+        warm = (incpath_t *) dict_get_val(entry);
+        incpath_refresh(warm);
+        return warm;
+    }
+
+    warm = incpath_create();
+
+    array_foreach(inc->dirs, dirs, i) {
+        if (dirs[i].system) {
+            incpath_add_system(warm, (const char *) dirs[i].path);
+        } else {
+            incpath_add(warm, (const char *) dirs[i].path);
+        }
+    }
+
+    warm->std = inc->std;
+
+    dict_add(srv->include_paths, cstring_dup(srv->key), warm);
+    return warm;
+}
+
+
+/**
+ * Has the server at path run the command line in the current directory,
+ * with the standard output and error of the caller. Its exit status, -1
+ * if no server took the request.
+ **/
+int server_forward(const char *path, int argc, char **argv)
+{
+#if defined(UNIX)
+    cstring_t payload;
+    uint32_t status;
+    char buf[64], cwd[4096];
+    int fd, i;
+
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        return -1;
+    }
+
+    if ((fd = __server_connect__(__server_path__(path, buf))) < 0) {
+        return -1;
+    }
+
+    payload = cstring_new_n(NULL, 256);
+    payload = cstring_concat_n(payload, cwd, strlen(cwd) + 1);
+
+    for (i = 0; i < argc; i++) {
+        payload = cstring_concat_n(payload, argv[i], strlen(argv[i]) + 1);
+    }
+
+    if (!__server_send__(fd, SERVER_RUN, payload, true)) {
+        cstring_free(payload);
+        close(fd);
+        return -1;
+    }
+
+    cstring_free(payload);
+
+    /* the run may have written some of its output, it is not run again */
+    if (!__server_read__(fd, &status, sizeof(status))) {
+        fprintf(stderr, "occ: the server at '%s' went away\n", __server_path__(path, buf));
+        status = EXIT_FAILURE;
+    }
+
+    close(fd);
+    return (int) status;
+#else
+    (void) path;
+    (void) argc;
+    (void) argv;
+    return -1;
+#endif
+}
+
+
+/**
+ * Asks the server at path to stop after the request it is running.
+ **/
+bool server_shutdown(const char *path)
+{
+#if defined(UNIX)
+    cstring_t payload;
+    uint32_t status;
+    char buf[64];
+    int fd;
+    bool ok;
+
+    if ((fd = __server_connect__(__server_path__(path, buf))) < 0) {
+        return false;
+    }
+
+    payload = cstring_new_n(NULL, 0);
+    ok = __server_send__(fd, SERVER_SHUTDOWN, payload, false) && __server_read__(fd, &status, sizeof(status));
+
+    cstring_free(payload);
+    close(fd);
+    return ok;
+#else
+    (void) path;
+    return false;
+#endif
+}
+
+
+#if defined(UNIX)
+
+
+static
+const char* __server_path__(const char *path, char *buf)
+{
+    if (path != NULL && path[0] != '\0') {
+        return path;
+    }
+
+    sprintf(buf, SERVER_DEFAULT_PATH, (unsigned long) getuid());
+    return buf;
+}
+
+
+static
+int __server_connect__(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path) || (fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+/**
+ * Sends the header and payload, with the standard output and error of
+ * the caller along with the header if stdio.
+ **/
+static
+bool __server_send__(int fd, uint32_t kind, cstring_t payload, bool stdio)
+{
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+    } control;
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec iov;
+    uint32_t header[3];
+    int fds[2];
+    ssize_t n;
+
+    header[0] = SERVER_MAGIC;
+    header[1] = kind;
+    header[2] = (uint32_t) cstring_length(payload);
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = header;
+    iov.iov_len = sizeof(header);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (stdio) {
+        fds[0] = fileno(stdout);
+        fds[1] = fileno(stderr);
+
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    }
+
+    do {
+        n = sendmsg(fd, &msg, 0);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0) {
+        return false;
+    }
+
+    return __server_write__(fd, (const char *) header + n, sizeof(header) - (size_t) n) &&
+           __server_write__(fd, payload, cstring_length(payload));
+}
+
+
+static
+bool __server_read__(int fd, void *buf, size_t n)
+{
+    ssize_t got;
+
+    while (n != 0) {
+        if ((got = read(fd, buf, n)) <= 0) {
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+
+        buf = (char *) buf + got;
+        n -= (size_t) got;
+    }
+
+    return true;
+}
+
+
+static
+bool __server_write__(int fd, const void *buf, size_t n)
+{
+    ssize_t put;
+
+    while (n != 0) {
+        if ((put = write(fd, buf, n)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+
+        buf = (const char *) buf + put;
+        n -= (size_t) put;
+    }
+
+    return true;
+}
+
+
+/**
+ * Reads a request off conn and answers it with the exit status of the
+ * run, EXIT_FAILURE for a request that is not one.
+ **/
+static
+void __server_request__(server_t *srv, int conn, server_handler_pt handler, void *ud, int home)
+{
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+    } control;
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec iov;
+    uint32_t header[3], status = EXIT_FAILURE;
+    int fds[2] = {-1, -1};
+    char *payload;
+    ssize_t n;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = header;
+    iov.iov_len = sizeof(header);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    do {
+        n = recvmsg(conn, &msg, 0);
+    } while (n < 0 && errno == EINTR);
+
+    if (n <= 0) {
+        return;
+    }
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+            cmsg->cmsg_len == CMSG_LEN(sizeof(fds))) {
+            memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+        }
+    }
+
+    if (!__server_read__(conn, (char *) header + n, sizeof(header) - (size_t) n) ||
+        header[0] != SERVER_MAGIC || header[2] > SERVER_MAX_REQUEST) {
+        goto done;
+    }
+
+    if (header[1] == SERVER_SHUTDOWN) {
+        srv->stop = true;
+        status = EXIT_SUCCESS;
+    } else if (header[1] == SERVER_RUN && fds[0] >= 0 && fds[1] >= 0) {
+        payload = (char *) pmalloc(header[2] + 1);
+        if (payload != NULL && __server_read__(conn, payload, header[2])) {
+            payload[header[2]] = '\0';
+            status = (uint32_t) __server_run__(srv, payload, header[2], handler, ud, fds[0], fds[1], home);
+        }
+
+        if (payload != NULL) {
+            pfree(payload);
+        }
+    }
+
+    __server_write__(conn, &status, sizeof(status));
+
+done:
+    if (fds[0] >= 0) {
+        close(fds[0]);
+    }
+
+    if (fds[1] >= 0) {
+        close(fds[1]);
+    }
+}
+
+
+/**
+ * Runs the command line of payload with out and err for the standard
+ * output and error, then puts them and the directory back. The source
+ * buffers no run asked for in a while are let go.
+ **/
+static
+int __server_run__(server_t *srv, char *payload, size_t length, server_handler_pt handler, void *ud,
+    int out, int err, int home)
+{
+    char **argv, *p, *end = payload + length;
+    int argc = 0, saved_out, saved_err, status = EXIT_FAILURE;
+
+    /* the directory first, then the arguments */
+    for (p = payload; p < end; p += strlen(p) + 1) {
+        argc++;
+    }
+
+    if (--argc < 1) {
+        return EXIT_FAILURE;
+    }
+
+    argv = (char **) pmalloc(sizeof(char*) * (size_t) (argc + 1));
+    if (!argv) {
+        return EXIT_FAILURE;
+    }
+
+    for (p = payload + strlen(payload) + 1, argc = 0; p < end; p += strlen(p) + 1) {
+        argv[argc++] = p;
+    }
+    argv[argc] = NULL;
+
+    /* what was buffered for the old ones goes out before they change */
+    fflush(stdout);
+    fflush(stderr);
+
+    saved_out = dup(fileno(stdout));
+    saved_err = dup(fileno(stderr));
+    dup2(out, fileno(stdout));
+    dup2(err, fileno(stderr));
+
+    if (chdir(payload) != 0) {
+        fprintf(stderr, "occ: cannot change to '%s'\n", payload);
+    } else {
+        srv->cwd = payload;
+        status = handler(srv, argc, argv, ud);
+        srv->cwd = NULL;
+
+        if (fchdir(home) != 0) {
+            srv->stop = true;
+        }
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+
+    dup2(saved_out, fileno(stdout));
+    dup2(saved_err, fileno(stderr));
+    close(saved_out);
+    close(saved_err);
+
+    srv->requests++;
+    srcpool_sweep(srv->srcpool, SERVER_KEEP);
+
+    pfree(argv);
+    return status;
+}
+
+
+#endif
@@ -0,0 +1,62 @@
+
+
+#ifndef __SERVER__H__
+#define __SERVER__H__
+
+
+#include "config.h"
+#include "cstring.h"
+
+
+typedef struct dict_s       dict_t;
+typedef struct srcpool_s    srcpool_t;
+typedef struct tokcache_s   tokcache_t;
+typedef struct incpath_s    incpath_t;
+
+
+/* where a server listens when no socket is named, %lu the user id */
+#define SERVER_DEFAULT_PATH     "/tmp/occ-%lu.sock"
+
+/* the requests a source file not loaded in is kept for */
+#define SERVER_KEEP             64
+
+#define SERVER_BACKLOG          16
+#define SERVER_MAX_REQUEST      (1024 * 1024)
+
+
+/**
+ * A compiler that outlives its runs, for --serve: a request is the
+ * command line of a run and the directory it was made in, the standard
+ * output and error of the client passed along with it, which the run
+ * writes to as its own. The reply is the exit status.
+ * What runs learn stays for the next: the source buffers, by identity,
+ * so that an edited file is read again; the lexed tokens of included
+ * files, by content; and the include paths with what they resolved,
+ * one set for each directory and search path, refreshed before a run.
+ * Requests are run one at a time, on the thread of server_serve().
+ **/
+typedef struct server_s {
+    cstring_t path;
+    int fd;
+    srcpool_t *srcpool;
+    tokcache_t *tokcache;
+    dict_t *include_paths;
+    const char *cwd;
+    cstring_t key;
+    size_t requests;
+    bool stop;
+} server_t;
+
+
+typedef int (*server_handler_pt)(server_t *srv, int argc, char **argv, void *ud);
+
+
+server_t* server_create(const char *path);
+void server_destroy(server_t *srv);
+bool server_serve(server_t *srv, server_handler_pt handler, void *ud);
+incpath_t* server_include_paths(server_t *srv, incpath_t *inc);
+int server_forward(const char *path, int argc, char **argv);
+bool server_shutdown(const char *path);
+
+
+#endif
@@ -1,30 +1,59 @@
 
 
 #include "config.h"
+#include "pmalloc.h"
 #include "dict.h"
 #include "set.h"
 
 
+static set_t* __set_create__(bool swiss);
+static bool __set_promote__(set_t *set);
+static bool __set_append__(set_t *set, cstring_t cs);
+static int __set_order__(const cstring_t a, const cstring_t b);
+
+
+/**
+ * The same keys are looked up over and over, their hash is kept on them.
+ **/
 static inline
 uint64_t __hash_fn__(const void *key) 
 {
-    return dict_gen_hash_function((unsigned char*)key, cstring_length((char*)key));
+    cstring_t cs = (cstring_t) key;
+    uint64_t hash;
+
+    if ((hash = cstring_get_hash(cs)) == 0) {
+        hash = dict_gen_hash_function(cs, (int) cstring_length(cs));
+        cstring_set_hash(cs, hash);
+    }
+
+    return hash;
 }
 
 
 static inline
 void* __key_dup__(void *privdata, const void *key)
 {
-    return cstring_dup((const cstring_t) key);
+    cstring_t cs;
+
+    if ((cs = cstring_dup((const cstring_t) key)) != NULL) {
+        cstring_set_hash(cs, cstring_get_hash((const cstring_t) key));
+    }
+
+    return cs;
 }
 
 
 static inline
 int __compare_fn__(void *privdata, const void *key1, const void *key2)
 {
-    int l1, l2;
+    size_t l1, l2;
+    uint64_t h1, h2;
     DICT_NOTUSED(privdata);
 
+    if (key1 == key2) {
+        return 1;
+    }
+
     l1 = cstring_length((cstring_t)key1);
     l2 = cstring_length((cstring_t)key2);
 
@@ -32,6 +61,13 @@ int __compare_fn__(void *privdata, const void *key1, const void *key2)
         return 0;
     }
 
+    h1 = cstring_get_hash((cstring_t)key1);
+    h2 = cstring_get_hash((cstring_t)key2);
+
+    if (h1 != 0 && h2 != 0 && h1 != h2) {
+        return 0;
+    }
+
     return memcmp(key1, key2, l1) == 0;
 }
 
@@ -56,38 +92,113 @@ dict_type_t __set_dict_type__ = {
 
 set_t* set_create(void)
 {
-    dict_t *dict = dict_create(&__set_dict_type__, NULL);
-    return (set_t*) dict;
+    return __set_create__(false);
+}
+
+
+set_t* set_create_swiss(void)
+{
+    return __set_create__(true);
 }
 
 
 void set_destroy(set_t *set)
 {
-    dict_destroy((dict_t*)set);
+    size_t i;
+
+    if (set->d != NULL) {
+        dict_destroy(set->d);
+    }
+
+    for (i = 0; i < set->length; i++) {
+        cstring_free(set->small[i]);
+    }
+
+    pfree(set);
 }
 
 
 bool set_add(set_t *set, cstring_t cs)
 {
-    return dict_add_or_find((dict_t*)set, cs) != NULL;
+    size_t i;
+    int order = 1;
+
+    if (set->d != NULL) {
+        return dict_add_or_find(set->d, cs) != NULL;
+    }
+
+    for (i = 0; i < set->length && (order = __set_order__(set->small[i], cs)) < 0; i++) {
+        continue;
+    }
+
+    if (order == 0) {
+        return true;
+    }
+
+    if (set->length == SET_SMALL_SIZE) {
+        return __set_promote__(set) && dict_add_or_find(set->d, cs) != NULL;
+    }
+
+    if ((cs = cstring_dup(cs)) == NULL) {
+        return false;
+    }
+
+    memmove(&set->small[i + 1], &set->small[i], (set->length - i) * sizeof(cstring_t));
+    set->small[i] = cs;
+    set->length++;
+    return true;
 }
 
 
 bool set_del(set_t *set, cstring_t cs)
 {
-    return dict_delete((dict_t*)set, cs);
+    size_t i;
+
+    if (set->d != NULL) {
+        return dict_delete(set->d, cs);
+    }
+
+    for (i = 0; i < set->length; i++) {
+        if (__set_order__(set->small[i], cs) == 0) {
+            cstring_free(set->small[i]);
+            set->length--;
+            memmove(&set->small[i], &set->small[i + 1], (set->length - i) * sizeof(cstring_t));
+            return true;
+        }
+    }
+
+    return false;
 }
 
 
 bool set_has(set_t *set, cstring_t cs)
 {
-    return dict_find((dict_t*)set, cs) != NULL;
+    size_t i;
+    int order;
+
+    if (set->d != NULL) {
+        return dict_find(set->d, cs) != NULL;
+    }
+
+    for (i = 0; i < set->length; i++) {
+        if ((order = __set_order__(set->small[i], cs)) >= 0) {
+            return order == 0;
+        }
+    }
+
+    return false;
 }
 
 
 bool set_is_empty(set_t *set)
 {
-    return dict_length((dict_t*)set) == 0;
+    return set_length(set) == 0;
+}
+
+
+size_t set_length(set_t *set)
+{
+    return set->d != NULL ? dict_length(set->d) : set->length;
 }
 
 
@@ -95,13 +206,23 @@ void set_concat_union(set_t *a, set_t *b)
 {
     dict_iterator_t *iter;
     dict_entry_t *entry;
+    size_t i;
+
+    if (b->d == NULL) {
+        for (i = 0; i < b->length; i++) {
+            if (!set_add(a, b->small[i])) {
+                break;
+            }
+        }
+        return;
+    }
 
-    if ((iter = dict_get_iterator((dict_t*)b)) == NULL) {
+    if ((iter = dict_get_iterator(b->d)) == NULL) {
         return;
     }
 
     while (entry = dict_next(iter)) {
-        if (dict_add_or_find(a, entry->key) == NULL) {
+        if (!set_add(a, entry->key)) {
             break;
         }
     }
@@ -114,8 +235,21 @@ void set_concat_intersection(set_t *a, set_t *b)
 {
     dict_iterator_t *iter;
     dict_entry_t *entry;
+    size_t i, n;
+
+    if (a->d == NULL) {
+        for (i = n = 0; i < a->length; i++) {
+            if (set_has(b, a->small[i])) {
+                a->small[n++] = a->small[i];
+            } else {
+                cstring_free(a->small[i]);
+            }
+        }
+        a->length = n;
+        return;
+    }
 
-    if ((iter = dict_get_safe_iterator((dict_t*)a)) == NULL) {
+    if ((iter = dict_get_safe_iterator(a->d)) == NULL) {
         return;
     }
 
@@ -129,35 +263,52 @@ void set_concat_intersection(set_t *a, set_t *b)
 }
 
 
+/**
+ * Two small sets are merged, anything else is the smaller copied and the
+ * larger added to it.
+ **/
 set_t* set_union(set_t *a, set_t *b)
 {
     set_t *r;
-    dict_iterator_t *iter;
-    dict_entry_t *entry;
+    size_t i, j;
+    int order;
 
-    if ((r = set_dup(a)) == NULL) { 
-        goto done;
+    if (a->d != NULL || b->d != NULL) {
+        if (set_length(a) < set_length(b)) {
+            r = a; a = b; b = r;
+        }
+
+        if ((r = set_dup(a)) == NULL) {
+            return NULL;
+        }
+
+        set_concat_union(r, b);
+        return r;
     }
 
-    if ((iter = dict_get_iterator((dict_t*)b)) == NULL) {
-        goto clean_set;
+    if ((r = __set_create__(a->swiss)) == NULL) {
+        return NULL;
     }
 
-    while (entry = dict_next(iter)) {
-        if (dict_add_or_find(r, entry->key) == NULL) {
-            goto clean_iter;
+    for (i = j = 0; i < a->length || j < b->length; ) {
+        if (j == b->length) {
+            order = -1;
+        } else if (i == a->length) {
+            order = 1;
+        } else {
+            order = __set_order__(a->small[i], b->small[j]);
         }
+
+        if (!__set_append__(r, order <= 0 ? a->small[i] : b->small[j])) {
+            set_destroy(r);
+            return NULL;
+        }
+
+        i += order <= 0;
+        j += order >= 0;
     }
 
-    dict_release_iterator(iter);
     return r;
-
-clean_iter:
-    dict_release_iterator(iter);
-clean_set:
-    set_destroy(r);
-done:
-    return NULL;
 }
 
 
@@ -166,16 +317,37 @@ set_t* set_intersection(set_t *a, set_t *b)
     set_t *r;
     dict_iterator_t *iter;
     dict_entry_t *entry;
-    
-    if (dict_length(a) > dict_length(b)) {
+    size_t i, j;
+    int order;
+
+    if (set_length(a) > set_length(b)) {
         r = a; a = b; b = r;
     }
 
-    if ((r = set_create()) == NULL) {
+    if ((r = __set_create__(a->swiss)) == NULL) {
         goto done;
     }
 
-    if ((iter = dict_get_iterator((dict_t*)a)) == NULL) {
+    if (a->d == NULL) {
+        for (i = j = 0; i < a->length && (b->d != NULL || j < b->length); ) {
+            /* the smaller is walked, the larger looked into */
+            if (b->d != NULL) {
+                order = set_has(b, a->small[i]) ? 0 : -1;
+            } else {
+                order = __set_order__(a->small[i], b->small[j]);
+            }
+
+            if (order == 0 && !__set_append__(r, a->small[i])) {
+                goto clean_set;
+            }
+
+            i += order <= 0;
+            j += order >= 0;
+        }
+        return r;
+    }
+
+    if ((iter = dict_get_iterator(a->d)) == NULL) {
         goto clean_set;
     }
 
@@ -204,12 +376,22 @@ set_t* set_dup(set_t *set)
     set_t *r;
     dict_iterator_t *iter;
     dict_entry_t *entry;
+    size_t i;
 
-    if ((r = set_create()) == NULL) {
+    if ((r = __set_create__(set->swiss)) == NULL) {
         goto done;
     }
 
-    if ((iter = dict_get_iterator((dict_t*)set)) == NULL) {
+    if (set->d == NULL) {
+        for (i = 0; i < set->length; i++) {
+            if (!__set_append__(r, set->small[i])) {
+                goto clean_set;
+            }
+        }
+        return r;
+    }
+
+    if ((iter = dict_get_iterator(set->d)) == NULL) {
         goto clean_set;
     }
 
@@ -231,7 +413,136 @@ done:
 }
 
 
+/**
+ * A set that was promoted keeps its dict, it is likely to fill up again.
+ **/
 void set_clear(set_t *set)
 {
-    dict_empty((dict_t*)set, NULL);
+    size_t i;
+
+    if (set->d != NULL) {
+        dict_reset(set->d);
+        return;
+    }
+
+    for (i = 0; i < set->length; i++) {
+        cstring_free(set->small[i]);
+    }
+
+    set->length = 0;
+}
+
+
+/**
+ * Calls fn on every string of set, which must not change meanwhile.
+ **/
+void set_scan(set_t *set, set_scan_pt fn, void *privdata)
+{
+    dict_iterator_t *iter;
+    dict_entry_t *entry;
+    size_t i;
+
+    if (set->d == NULL) {
+        for (i = 0; i < set->length; i++) {
+            fn(privdata, set->small[i]);
+        }
+        return;
+    }
+
+    if ((iter = dict_get_iterator(set->d)) == NULL) {
+        return;
+    }
+
+    while ((entry = dict_next(iter)) != NULL) {
+        fn(privdata, (cstring_t) dict_get_key(entry));
+    }
+
+    dict_release_iterator(iter);
+}
+
+
+static
+set_t* __set_create__(bool swiss)
+{
+    set_t *set;
+
+    set = (set_t *) pmalloc(sizeof(set_t));
+    if (!set) {
+        return NULL;
+    }
+
+    set->d = NULL;
+    set->length = 0;
+    set->swiss = swiss;
+    return set;
+}
+
+
+/**
+ * Moves the strings of a small set into a dict, which makes copies of
+ * them: only a set past SET_SMALL_SIZE gets here, once.
+ **/
+static
+bool __set_promote__(set_t *set)
+{
+    dict_t *d;
+    size_t i;
+
+    d = set->swiss ? dict_create_swiss(&__set_dict_type__, NULL) : dict_create(&__set_dict_type__, NULL);
+    if (!d) {
+        return false;
+    }
+
+    for (i = 0; i < set->length; i++) {
+        if (dict_add_or_find(d, set->small[i]) == NULL) {
+            dict_destroy(d);
+            return false;
+        }
+    }
+
+    for (i = 0; i < set->length; i++) {
+        cstring_free(set->small[i]);
+    }
+
+    set->d = d;
+    set->length = 0;
+    return true;
+}
+
+
+/* a copy of cs, which comes after all the strings of set while it is small */
+static
+bool __set_append__(set_t *set, cstring_t cs)
+{
+    if (set->d != NULL || set->length == SET_SMALL_SIZE) {
+        return set_add(set, cs);
+    }
+
+    if ((cs = cstring_dup(cs)) == NULL) {
+        return false;
+    }
+
+    set->small[set->length++] = cs;
+    return true;
+}
+
+
+/* shorter strings first, then by bytes: lengths are compared first anyway */
+static inline
+int __set_order__(const cstring_t a, const cstring_t b)
+{
+    size_t la, lb;
+
+    if (a == b) {
+        return 0;
+    }
+
+    la = cstring_length(a);
+    lb = cstring_length(b);
+
+    if (la != lb) {
+        return la < lb ? -1 : 1;
+    }
+
+    return memcmp(a, b, la);
 }
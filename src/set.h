@@ -8,23 +8,44 @@
 #include "cstring.h"
 
 
-#define set_s dict_s
+#ifndef SET_SMALL_SIZE
+#define SET_SMALL_SIZE      8
+#endif
+
+
+typedef struct dict_s dict_t;
+typedef void (*set_scan_pt)(void *privdata, const cstring_t cs);
+
 
-typedef struct set_s set_t;
+/**
+ * Up to SET_SMALL_SIZE strings are kept in small, sorted by length and
+ * then bytes, so that union and intersection of two small sets merge
+ * them without hashing. A set that grows past it moves them to d, a dict
+ * of the backend it was created for, and stays there.
+ **/
+typedef struct set_s {
+    dict_t *d;
+    size_t length;
+    bool swiss;
+    cstring_t small[SET_SMALL_SIZE];
+} set_t;
 
 
 set_t* set_create(void);
+set_t* set_create_swiss(void);
 void set_destroy(set_t *set);
 bool set_add(set_t *set, cstring_t cs);
 bool set_del(set_t *set, cstring_t cs);
 bool set_has(set_t *set, cstring_t cs);
 bool set_is_empty(set_t *set);
+size_t set_length(set_t *set);
 void set_concat_union(set_t *a, set_t *b);
 void set_concat_intersection(set_t *a, set_t *b);
 set_t* set_union(set_t *a, set_t *b);
 set_t* set_intersection(set_t *a, set_t *b);
 set_t* set_dup(set_t *set);
 void set_clear(set_t *set);
+void set_scan(set_t *set, set_scan_pt fn, void *privdata);
 
 
 #endif
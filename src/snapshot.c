@@ -0,0 +1,260 @@
+
+
+#include "config.h"
+#include "pmalloc.h"
+#include "cstring.h"
+#include "snapshot.h"
+
+
+#if defined(UNIX)
+#   include <sys/mman.h>
+#   include <unistd.h>
+#endif
+
+
+/* the magic with its '\0', then the version */
+#define SNAPSHOT_HEADER_SIZE    (sizeof(SNAPSHOT_MAGIC) + 4)
+
+
+static bool __snapshot_read__(snapshot_t *snap, FILE *fp, size_t size);
+
+
+static inline
+uint32_t __snapshot_decode_u32__(const unsigned char *p)
+{
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+
+/**
+ * Opens a snapshot written by snapshot_write(), NULL if there is none or
+ * it is not one of this version.
+ **/
+snapshot_t* snapshot_open(const char *fn)
+{
+    snapshot_t *snap;
+    struct stat st;
+    FILE *fp;
+
+    if (stat(fn, &st) != 0 || !S_ISREG(st.st_mode) || (size_t) st.st_size < SNAPSHOT_HEADER_SIZE) {
+        return NULL;
+    }
+
+    fp = fopen(fn, "rb");
+    if (fp == NULL) {
+        return NULL;
+    }
+
+    snap = (snapshot_t *) pmalloc(sizeof(snapshot_t));
+    if (!snap) {
+        fclose(fp);
+        return NULL;
+    }
+
+    if (!__snapshot_read__(snap, fp, (size_t) st.st_size)) {
+        fclose(fp);
+        pfree(snap);
+        return NULL;
+    }
+
+    fclose(fp);
+
+    if (memcmp(snap->base, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 ||
+        __snapshot_decode_u32__((const unsigned char *) snap->base + sizeof(SNAPSHOT_MAGIC)) != SNAPSHOT_VERSION) {
+        snap->filename = NULL;
+        snapshot_close(snap);
+        return NULL;
+    }
+
+    snap->filename = cstring_new(fn);
+    snap->data = (const unsigned char *) snap->base + SNAPSHOT_HEADER_SIZE;
+    snap->length = snap->size - SNAPSHOT_HEADER_SIZE;
+    return snap;
+}
+
+
+void snapshot_close(snapshot_t *snap)
+{
+#if defined(UNIX)
+    if (snap->mapped) {
+        munmap(snap->base, snap->size);
+    } else {
+        pfree(snap->base);
+    }
+#else
+    pfree(snap->base);
+#endif
+
+    if (snap->filename != NULL) {
+        cstring_free(snap->filename);
+    }
+
+    pfree(snap);
+}
+
+
+/**
+ * Writes the payload behind the header, to a file next to fn first so
+ * that a reader never sees half of it, nor another writer of fn.
+ **/
+bool snapshot_write(const char *fn, cstring_t payload)
+{
+    unsigned char version[4];
+#if defined(UNIX)
+    char pid[24];
+#endif
+    cstring_t tmp;
+    FILE *fp;
+    bool ok;
+
+    tmp = cstring_new(fn);
+#if defined(UNIX)
+    /* processes sharing a directory each write a file of their own */
+    sprintf(pid, ".%ld", (long) getpid());
+    tmp = cstring_concat_n(tmp, pid, strlen(pid));
+#endif
+    tmp = cstring_concat_n(tmp, ".tmp", 4);
+
+    fp = fopen((const char *) tmp, "wb");
+    if (fp == NULL) {
+        cstring_free(tmp);
+        return false;
+    }
+
+    version[0] = (unsigned char) (SNAPSHOT_VERSION & 0xff);
+    version[1] = (unsigned char) ((SNAPSHOT_VERSION >> 8) & 0xff);
+    version[2] = (unsigned char) ((SNAPSHOT_VERSION >> 16) & 0xff);
+    version[3] = (unsigned char) ((SNAPSHOT_VERSION >> 24) & 0xff);
+
+    ok = fwrite(SNAPSHOT_MAGIC, 1, sizeof(SNAPSHOT_MAGIC), fp) == sizeof(SNAPSHOT_MAGIC) &&
+         fwrite(version, 1, sizeof(version), fp) == sizeof(version) &&
+         fwrite(payload, 1, cstring_length(payload), fp) == cstring_length(payload);
+
+    ok = fclose(fp) == 0 && ok;
+
+    if (ok) {
+        remove(fn);
+        ok = rename((const char *) tmp, fn) == 0;
+    }
+
+    if (!ok) {
+        remove((const char *) tmp);
+    }
+
+    cstring_free(tmp);
+    return ok;
+}
+
+
+/**
+ * Numbers are written little endian a byte at a time, the file reads the
+ * same whatever the host and with no alignment to keep.
+ **/
+cstring_t snapshot_put_u32(cstring_t buf, uint32_t v)
+{
+    unsigned char p[4];
+
+    p[0] = (unsigned char) (v & 0xff);
+    p[1] = (unsigned char) ((v >> 8) & 0xff);
+    p[2] = (unsigned char) ((v >> 16) & 0xff);
+    p[3] = (unsigned char) ((v >> 24) & 0xff);
+
+    return cstring_concat_n(buf, p, sizeof(p));
+}
+
+
+cstring_t snapshot_put_bytes(cstring_t buf, const void *data, size_t n)
+{
+    buf = snapshot_put_u32(buf, (uint32_t) n);
+    return cstring_concat_n(buf, data, n);
+}
+
+
+/**
+ * Fills in a number put as a placeholder at offset at, for a length only
+ * known once what follows it is written.
+ **/
+void snapshot_patch_u32(cstring_t buf, size_t at, uint32_t v)
+{
+    buf[at] = (unsigned char) (v & 0xff);
+    buf[at + 1] = (unsigned char) ((v >> 8) & 0xff);
+    buf[at + 2] = (unsigned char) ((v >> 16) & 0xff);
+    buf[at + 3] = (unsigned char) ((v >> 24) & 0xff);
+}
+
+
+void snapshot_reader_init(snapshot_reader_t *r, const unsigned char *data, size_t n)
+{
+    r->p = data;
+    r->end = data + n;
+    r->ok = true;
+}
+
+
+uint32_t snapshot_get_u32(snapshot_reader_t *r)
+{
+    uint32_t v;
+
+    if (!r->ok || (size_t) (r->end - r->p) < 4) {
+        r->ok = false;
+        return 0;
+    }
+
+    v = __snapshot_decode_u32__(r->p);
+    r->p += 4;
+    return v;
+}
+
+
+/**
+ * The bytes put by snapshot_put_bytes(), in place in the snapshot.
+ **/
+const unsigned char* snapshot_get_bytes(snapshot_reader_t *r, size_t *n)
+{
+    const unsigned char *p;
+    uint32_t length;
+
+    length = snapshot_get_u32(r);
+
+    if (!r->ok || (size_t) (r->end - r->p) < length) {
+        r->ok = false;
+        *n = 0;
+        return NULL;
+    }
+
+    p = r->p;
+    r->p += length;
+    *n = length;
+    return p;
+}
+
+
+static
+bool __snapshot_read__(snapshot_t *snap, FILE *fp, size_t size)
+{
+#if defined(UNIX)
+    void *base;
+
+    base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+    if (base != MAP_FAILED) {
+        snap->base = base;
+        snap->size = size;
+        snap->mapped = true;
+        return true;
+    }
+#endif
+
+    snap->base = pmalloc(size);
+    if (!snap->base) {
+        return false;
+    }
+
+    if (fread(snap->base, 1, size, fp) != size) {
+        pfree(snap->base);
+        return false;
+    }
+
+    snap->size = size;
+    snap->mapped = false;
+    return true;
+}
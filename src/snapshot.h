@@ -0,0 +1,56 @@
+
+
+#ifndef __SNAPSHOT__H__
+#define __SNAPSHOT__H__
+
+
+#include "config.h"
+#include "cstring.h"
+
+
+#define SNAPSHOT_MAGIC          "occsnap"
+#define SNAPSHOT_VERSION        2
+
+
+/**
+ * A snapshot file read back, mapped where the platform allows. data and
+ * length are the payload behind the magic and version, which stays in
+ * place for as long as the snapshot is open.
+ **/
+typedef struct snapshot_s {
+    cstring_t filename;
+    const unsigned char *data;
+    size_t length;
+
+    void *base;
+    size_t size;
+    bool mapped;
+} snapshot_t;
+
+
+/**
+ * Reads the payload front to back. Any read past the end clears ok and
+ * yields 0 or NULL from then on, so a damaged file is found out with a
+ * single check at the end.
+ **/
+typedef struct snapshot_reader_s {
+    const unsigned char *p;
+    const unsigned char *end;
+    bool ok;
+} snapshot_reader_t;
+
+
+snapshot_t* snapshot_open(const char *fn);
+void snapshot_close(snapshot_t *snap);
+bool snapshot_write(const char *fn, cstring_t payload);
+
+cstring_t snapshot_put_u32(cstring_t buf, uint32_t v);
+cstring_t snapshot_put_bytes(cstring_t buf, const void *data, size_t n);
+void snapshot_patch_u32(cstring_t buf, size_t at, uint32_t v);
+
+void snapshot_reader_init(snapshot_reader_t *r, const unsigned char *data, size_t n);
+uint32_t snapshot_get_u32(snapshot_reader_t *r);
+const unsigned char* snapshot_get_bytes(snapshot_reader_t *r, size_t *n);
+
+
+#endif
@@ -0,0 +1,180 @@
+
+
+#include "config.h"
+#include "pmalloc.h"
+#include "array.h"
+#include "utils.h"
+#include "scan.h"
+#include "splice.h"
+
+
+static const unsigned char* __splice_find__(const unsigned char *p,
+                                            const unsigned char *pe);
+static const unsigned char* __splice_match__(const unsigned char *p,
+                                             const unsigned char *pe,
+                                             splice_type_t *type);
+
+
+/**
+ * Runs translation phases 1 and 2 over text: "\r\n" and "\r" become "\n"
+ * and every backslash-newline is deleted. Files without either take the
+ * zero-copy path: false is returned and text is used as is. Otherwise
+ * *clean receives a '\0'-terminated pmalloc'ed copy and splices records
+ * where the two buffers drift apart, in order.
+ **/
+bool splice_prepare(const unsigned char *text, size_t length,
+                    unsigned char **clean, size_t *clean_length,
+                    array_t *splices)
+{
+    const unsigned char *p, *pe, *q;
+    unsigned char *out, *o;
+    splice_type_t type;
+    splice_t splice;
+
+    pe = &text[length];
+
+    if ((p = __splice_find__(text, pe)) == pe) {
+        return false;
+    }
+
+    /* the clean buffer never gets longer, only the EOF case rewrites a byte */
+
+    out = o = (unsigned char *) pmalloc(length + 1);
+
+    memcpy(o, text, p - text);
+    o += p - text;
+
+    while (p < pe) {
+        switch (*p) {
+        case '\r':
+            *o++ = '\n';
+            p++;
+            if (p < pe && *p == '\n') {
+                p++;
+                splice.clean = o - out;
+                splice.phys = p - text;
+                splice.type = SPLICE_CRLF;
+                array_cast_append(splice_t, splices, splice);
+            }
+            break;
+        case '\\':
+            if ((q = __splice_match__(p, pe, &type)) == NULL) {
+                *o++ = *p++;
+                break;
+            }
+
+            if (type == SPLICE_EOF) {
+                /* reading the "\n" brings the offset to the end of file */
+                splice.clean = o - out;
+                splice.phys = (q - text) - 1;
+                *o++ = '\n';
+            } else {
+                splice.clean = o - out;
+                splice.phys = q - text;
+            }
+
+            splice.type = type;
+            array_cast_append(splice_t, splices, splice);
+            p = q;
+            break;
+        default:
+            q = __splice_find__(p, pe);
+            memcpy(o, p, q - p);
+            o += q - p;
+            p = q;
+            break;
+        }
+    }
+
+    *o = '\0';
+    *clean = out;
+    *clean_length = o - out;
+    return true;
+}
+
+
+/**
+ * Translates an offset into the clean buffer back to the physical one.
+ **/
+size_t splice_physical(array_t *splices, size_t offset)
+{
+    splice_t *base = array_prototype(splices, splice_t);
+    size_t lo = 0, hi = array_length(splices);
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (base[mid].clean <= offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo == 0) {
+        return offset;
+    }
+
+    return base[lo - 1].phys + (offset - base[lo - 1].clean);
+}
+
+
+/**
+ * Finds the first byte phases 1 and 2 may have to rewrite.
+ **/
+static
+const unsigned char* __splice_find__(const unsigned char *p, const unsigned char *pe)
+{
+    for (;;) {
+        p = scan_find(p, pe, '\\', '\r', '\r', '\r');
+        if (p == pe || *p == '\r') {
+            return p;
+        }
+
+        if (__splice_match__(p, pe, NULL) != NULL) {
+            return p;
+        }
+
+        p++;
+    }
+}
+
+
+/**
+ * p points to a backslash. Returns the end of the backslash-newline that
+ * starts there, or NULL if the backslash is an ordinary character. Like
+ * the reader, spaces are allowed in between.
+ **/
+static
+const unsigned char* __splice_match__(const unsigned char *p,
+                                      const unsigned char *pe,
+                                      splice_type_t *type)
+{
+    const unsigned char *q = p + 1;
+
+    while (q < pe && ISSPACE(*q)) {
+        switch (*q) {
+        case '\r':
+            if (q + 1 < pe && *(q + 1) == '\n') {
+                if (type != NULL) {
+                    *type = q == p + 1 ? SPLICE_NEWLINE : SPLICE_SPACED;
+                }
+                return q + 2;
+            }
+        case '\n':
+            if (type != NULL) {
+                *type = q == p + 1 ? SPLICE_NEWLINE : SPLICE_SPACED;
+            }
+            return q + 1;
+        }
+        q++;
+    }
+
+    if (q == pe) {
+        if (type != NULL) {
+            *type = SPLICE_EOF;
+        }
+        return q;
+    }
+
+    return NULL;
+}
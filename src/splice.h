@@ -0,0 +1,38 @@
+
+
+#ifndef __SPLICE__H__
+#define __SPLICE__H__
+
+
+#include "config.h"
+
+
+typedef struct array_s      array_t;
+
+
+typedef enum splice_type_e {
+    SPLICE_CRLF,                /* "\r\n" canonicalized to "\n" */
+    SPLICE_NEWLINE,             /* backslash-newline deleted */
+    SPLICE_SPACED,              /* backslash, spaces and newline deleted */
+    SPLICE_EOF,                 /* backslash at end of file turned into "\n" */
+} splice_type_t;
+
+
+/**
+ * From clean offset `clean` on, the clean buffer is a plain copy of the
+ * physical buffer starting at offset `phys`, up to the next splice.
+ **/
+typedef struct splice_s {
+    size_t clean;
+    size_t phys;
+    splice_type_t type;
+} splice_t;
+
+
+bool splice_prepare(const unsigned char *text, size_t length,
+                    unsigned char **clean, size_t *clean_length,
+                    array_t *splices);
+size_t splice_physical(array_t *splices, size_t offset);
+
+
+#endif
@@ -0,0 +1,201 @@
+#include "config.h"
+#include "pmalloc.h"
+#include "array.h"
+#include "linemap.h"
+#include "srcloc.h"
+
+
+#ifndef SRCLOC_INIT_RANGES
+#define SRCLOC_INIT_RANGES      (64)
+#endif
+
+
+/**
+ * Each thread has a space of its own, as it has hidesets: a unit is read
+ * and expanded on one thread and its locations do not leave it. The
+ * ranges are sorted by base, last is the one found by the last lookup.
+ **/
+static THREAD_LOCAL array_t *__srcloc_ranges__ = NULL;
+static THREAD_LOCAL srcloc_t __srcloc_next__ = 1;
+static THREAD_LOCAL size_t __srcloc_last__ = 0;
+
+
+static srcloc_t __srcloc_add__(size_t size, cstring_t filename, linemap_t *lines,
+                               srcloc_t spelling, srcloc_t expansion);
+
+
+/**
+ * A range for the length bytes of a buffer and its end, where its EOF is.
+ * SRCLOC_NONE once the space is used up: the tokens read from it have no
+ * location, as made up ones.
+ **/
+srcloc_t srcloc_add_buffer(cstring_t filename, linemap_t *lines, size_t length)
+{
+    assert(filename != NULL);
+    return __srcloc_add__(length + 1, filename, lines, SRCLOC_NONE, SRCLOC_NONE);
+}
+
+
+/**
+ * A range for size locations from spelling on, those of the tokens of a
+ * macro body, used at expansion.
+ **/
+srcloc_t srcloc_add_expansion(srcloc_t spelling, size_t size, srcloc_t expansion)
+{
+    if (spelling == SRCLOC_NONE || size == 0) {
+        return SRCLOC_NONE;
+    }
+
+    return __srcloc_add__(size, NULL, NULL, spelling, expansion);
+}
+
+
+srcloc_range_t* srcloc_range(srcloc_t loc)
+{
+    srcloc_range_t *ranges;
+    size_t lo, hi, mid;
+
+    if (loc == SRCLOC_NONE || loc >= __srcloc_next__ || __srcloc_ranges__ == NULL) {
+        return NULL;
+    }
+
+    ranges = array_prototype(__srcloc_ranges__, srcloc_range_t);
+
+    /* tokens come mostly in order, from the range of the one before */
+    if (loc - ranges[__srcloc_last__].base < ranges[__srcloc_last__].size) {
+        return &ranges[__srcloc_last__];
+    }
+
+    for (lo = 0, hi = array_length(__srcloc_ranges__); lo + 1 < hi; ) {
+        mid = lo + (hi - lo) / 2;
+
+        if (ranges[mid].base <= loc) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    __srcloc_last__ = lo;
+    return &ranges[lo];
+}
+
+
+/**
+ * The range of the buffer loc was spelled in, through the expansions it
+ * came out of, and the offset into that buffer. NULL for SRCLOC_NONE.
+ **/
+srcloc_range_t* srcloc_buffer(srcloc_t loc, size_t *offset)
+{
+    srcloc_range_t *range;
+
+    while ((range = srcloc_range(loc)) != NULL && srcloc_is_expansion(range)) {
+        loc = range->spelling + (loc - range->base);
+    }
+
+    if (range != NULL && offset != NULL) {
+        *offset = loc - range->base;
+    }
+
+    return range;
+}
+
+
+/**
+ * Where in a buffer the macro loc came out of was used, that of the
+ * outermost expansion. loc itself if it is not in one.
+ **/
+srcloc_t srcloc_expansion(srcloc_t loc)
+{
+    srcloc_range_t *range;
+
+    while ((range = srcloc_range(loc)) != NULL && srcloc_is_expansion(range)) {
+        loc = range->expansion;
+    }
+
+    return loc;
+}
+
+
+/**
+ * Decodes the spelling of loc. False without a buffer, with filename and
+ * linenote set to NULL; line and column are 0 when it has no lines.
+ **/
+bool srcloc_resolve(srcloc_t loc, cstring_t *filename, size_t *line,
+                    size_t *column, const unsigned char **linenote)
+{
+    srcloc_range_t *range;
+    size_t offset;
+
+    range = srcloc_buffer(loc, &offset);
+
+    if (filename != NULL) {
+        *filename = range != NULL ? range->filename : NULL;
+    }
+
+    if (range != NULL && range->lines != NULL) {
+        linemap_resolve(range->lines, offset, line, column, linenote);
+        return true;
+    }
+
+    if (line != NULL) {
+        *line = 0;
+    }
+
+    if (column != NULL) {
+        *column = 0;
+    }
+
+    if (linenote != NULL) {
+        *linenote = NULL;
+    }
+
+    return range != NULL;
+}
+
+
+/**
+ * Drops the space of the thread, once no token of its unit is left.
+ **/
+void srcloc_cleanup(void)
+{
+    if (__srcloc_ranges__ != NULL) {
+        array_destroy(__srcloc_ranges__);
+    }
+
+    __srcloc_ranges__ = NULL;
+    __srcloc_next__ = 1;
+    __srcloc_last__ = 0;
+}
+
+
+static
+srcloc_t __srcloc_add__(size_t size, cstring_t filename, linemap_t *lines,
+                        srcloc_t spelling, srcloc_t expansion)
+{
+    srcloc_range_t *range;
+    srcloc_t base = __srcloc_next__;
+
+    if (size > (size_t) (UINT32_MAX - base)) {
+        return SRCLOC_NONE;
+    }
+
+    if (__srcloc_ranges__ == NULL &&
+        (__srcloc_ranges__ = array_create_n(sizeof(srcloc_range_t), SRCLOC_INIT_RANGES)) == NULL) {
+        return SRCLOC_NONE;
+    }
+
+    if ((range = array_push_back(__srcloc_ranges__)) == NULL) {
+        return SRCLOC_NONE;
+    }
+
+    range->base = base;
+    range->size = (uint32_t) size;
+    range->filename = filename;
+    range->lines = lines;
+    range->spelling = spelling;
+    range->expansion = expansion;
+
+    __srcloc_next__ = base + (srcloc_t) size;
+    return base;
+}
@@ -0,0 +1,59 @@
+
+
+#ifndef __SRCLOC__H__
+#define __SRCLOC__H__
+
+
+#include "config.h"
+#include "cstring.h"
+
+
+typedef struct linemap_s    linemap_t;
+
+
+/**
+ * A place in the source as one number: the buffers read and the macro
+ * expansions made by a thread take consecutive ranges of one space, a
+ * location is an offset into it. SRCLOC_NONE is no place at all.
+ **/
+typedef uint32_t srcloc_t;
+
+
+#define SRCLOC_NONE             ((srcloc_t) 0)
+
+
+/**
+ * A range of the space, [base, base + size). A buffer has the file name
+ * and the lines it was read with, lines is NULL when there is no text to
+ * resolve lines from. An expansion has neither: its locations are those
+ * from spelling on, made again for the use of the macro at expansion.
+ * filename and lines are not owned, they must outlive the range.
+ **/
+typedef struct srcloc_range_s {
+    srcloc_t base;
+    uint32_t size;
+    cstring_t filename;
+    linemap_t *lines;
+    srcloc_t spelling;
+    srcloc_t expansion;
+} srcloc_range_t;
+
+
+srcloc_t srcloc_add_buffer(cstring_t filename, linemap_t *lines, size_t length);
+srcloc_t srcloc_add_expansion(srcloc_t spelling, size_t size, srcloc_t expansion);
+srcloc_range_t* srcloc_range(srcloc_t loc);
+srcloc_range_t* srcloc_buffer(srcloc_t loc, size_t *offset);
+srcloc_t srcloc_expansion(srcloc_t loc);
+bool srcloc_resolve(srcloc_t loc, cstring_t *filename, size_t *line,
+                    size_t *column, const unsigned char **linenote);
+void srcloc_cleanup(void);
+
+
+static inline
+bool srcloc_is_expansion(srcloc_range_t *range)
+{
+    return range->filename == NULL;
+}
+
+
+#endif
@@ -0,0 +1,411 @@
+
+
+#include "config.h"
+#include "pmalloc.h"
+#include "thread.h"
+#include "dict.h"
+#include "array.h"
+#include "splice.h"
+#include "linemap.h"
+#include "srcpool.h"
+
+
+#if defined(UNIX)
+#   include <sys/mman.h>
+#   include <unistd.h>
+#endif
+
+
+/**
+ * Files smaller than this are read into a heap buffer, mapping them
+ * costs more than the single copy.
+ **/
+#ifndef SRCPOOL_MMAP_THRESHOLD
+#define SRCPOOL_MMAP_THRESHOLD   (16 * 1024)
+#endif
+
+
+/**
+ * Files at least this big are windowed: read sequentially and evicted
+ * behind the reader, see srcfile_evict().
+ **/
+#ifndef SRCPOOL_WINDOW_THRESHOLD
+#define SRCPOOL_WINDOW_THRESHOLD (64 * 1024 * 1024)
+#endif
+
+
+#if defined(UNIX) && !defined(MAP_ANONYMOUS)
+#   define MAP_ANONYMOUS    MAP_ANON
+#endif
+
+
+static bool __srcfile_load__(srcfile_t *file, FILE *fp);
+#if defined(UNIX)
+static bool __srcfile_map__(srcfile_t *file, FILE *fp, size_t size, size_t pagesize);
+#endif
+static void __srcfile_release__(srcfile_t *file);
+
+
+static inline
+uint64_t __hash_fn__(const void *key)
+{
+    const srcfile_t *file = (const srcfile_t *) key;
+    uint64_t identity[5];
+
+    identity[0] = file->device;
+    identity[1] = file->inode;
+    identity[2] = (uint64_t) file->modify_time;
+    identity[3] = (uint64_t) file->modify_nsec;
+    identity[4] = file->size;
+
+    return dict_gen_hash_function((unsigned char*)identity, sizeof(identity));
+}
+
+
+static inline
+int __compare_fn__(void *privdata, const void *key1, const void *key2)
+{
+    const srcfile_t *file1 = (const srcfile_t *) key1;
+    const srcfile_t *file2 = (const srcfile_t *) key2;
+
+    DICT_NOTUSED(privdata);
+
+    return file1->device == file2->device &&
+           file1->inode == file2->inode &&
+           file1->modify_time == file2->modify_time &&
+           file1->modify_nsec == file2->modify_nsec &&
+           file1->size == file2->size;
+}
+
+
+static inline
+void __free_fn__(void *privdata, void *key) {
+    DICT_NOTUSED(privdata);
+    __srcfile_release__((srcfile_t *) key);
+    pfree(key);
+}
+
+
+dict_type_t __srcpool_dict_type__ = {
+    __hash_fn__,
+    NULL,
+    NULL,
+    __compare_fn__,
+    __free_fn__,
+    NULL
+};
+
+
+srcpool_t* srcpool_create(void)
+{
+    srcpool_t *pool = (srcpool_t *)pmalloc(sizeof(srcpool_t));
+    pool->d = dict_create(&__srcpool_dict_type__, NULL);
+    pool->serial = 0;
+    pool->generation = 0;
+    mutex_init(&pool->mutex);
+    return pool;
+}
+
+
+void srcpool_destroy(srcpool_t *pool)
+{
+    dict_destroy(pool->d);
+    mutex_destroy(&pool->mutex);
+    pfree(pool);
+}
+
+
+/**
+ * Returns the buffer of fn, loading it on first use. Buffers stay valid
+ * until the pool is destroyed: tokens keep offsets into them.
+ **/
+srcfile_t* srcpool_load(srcpool_t *pool, const char *fn)
+{
+    srcfile_t key, *file;
+    dict_entry_t *entry;
+    struct stat st;
+    FILE *fp;
+
+    if ((fp = fopen(fn, "rb")) == NULL) {
+        return NULL;
+    }
+
+    if (fstat(fileno(fp), &st) != 0) {
+        goto failure;
+    }
+
+    memset(&key, 0, sizeof(key));
+    key.device = (uint64_t) st.st_dev;
+    key.inode = (uint64_t) st.st_ino;
+    key.modify_time = (int64_t) st.st_mtime;
+#if defined(__linux__)
+    key.modify_nsec = (int64_t) st.st_mtim.tv_nsec;
+#endif
+    key.size = (uint64_t) st.st_size;
+
+    mutex_lock(&pool->mutex);
+
+#if defined(WINDOWS)
+    /**
+     * st_ino is always zero here, so the identity can not tell two files
+     * of the same size apart; fall back to loading every file.
+     **/
+    key.inode = ++pool->serial;
+#endif
+
+    entry = dict_find(pool->d, &key);
+    if (entry != NULL) {
+        ((srcfile_t *) dict_get_key(entry))->used = pool->generation;
+    }
+
+    mutex_unlock(&pool->mutex);
+
+    if (entry != NULL) {
+        fclose(fp);
+        return (srcfile_t *) dict_get_key(entry);
+    }
+
+    /* the file is read without the lock, a prefetcher may be racing us */
+
+    key.access_time = st.st_atime;
+    key.change_time = st.st_ctime;
+
+    if (!__srcfile_load__(&key, fp)) {
+        goto failure;
+    }
+
+    fclose(fp);
+
+    file = (srcfile_t *) pmalloc(sizeof(srcfile_t));
+    *file = key;
+    file->used = pool->generation;
+    file->lines = linemap_create(file->text, file->length);
+
+    mutex_lock(&pool->mutex);
+
+    if ((entry = dict_find(pool->d, file)) != NULL) {
+        mutex_unlock(&pool->mutex);
+        __srcfile_release__(file);
+        pfree(file);
+        return (srcfile_t *) dict_get_key(entry);
+    }
+
+    if (!dict_add(pool->d, file, NULL)) {
+        mutex_unlock(&pool->mutex);
+        __srcfile_release__(file);
+        pfree(file);
+        return NULL;
+    }
+
+    mutex_unlock(&pool->mutex);
+    return file;
+
+failure:
+    fclose(fp);
+    return NULL;
+}
+
+
+/**
+ * Runs the phase 1/2 pre-pass over file once. Most files contain neither
+ * "\r" nor backslash-newline, their clean text is the buffer itself.
+ **/
+void srcpool_prepare(srcpool_t *pool, srcfile_t *file)
+{
+    unsigned char *clean;
+    size_t clean_length;
+
+    mutex_lock(&pool->mutex);
+
+    if (file->splices != NULL) {
+        mutex_unlock(&pool->mutex);
+        return;
+    }
+
+    file->splices = array_create(sizeof(splice_t));
+
+    if (splice_prepare(file->text, file->length, &clean, &clean_length, file->splices)) {
+        file->clean = clean;
+        file->clean_length = clean_length;
+    } else {
+        file->clean = file->text;
+        file->clean_length = file->length;
+    }
+
+    mutex_unlock(&pool->mutex);
+}
+
+
+/**
+ * Tells the kernel the pages of a windowed file before offset are not
+ * needed any more. They are clean file pages, a late diagnostic that
+ * looks at them again just faults them back in.
+ **/
+void srcfile_evict(srcfile_t *file, size_t offset)
+{
+#if defined(UNIX)
+    long pagesize = sysconf(_SC_PAGESIZE);
+
+    if (!file->windowed || pagesize <= 0) {
+        return;
+    }
+
+    offset -= offset % (size_t) pagesize;
+    if (offset > 0) {
+        madvise((void *) file->text, offset, MADV_DONTNEED);
+    }
+#else
+    (void) file;
+    (void) offset;
+#endif
+}
+
+
+size_t srcpool_length(srcpool_t *pool)
+{
+    size_t length;
+
+    mutex_lock(&pool->mutex);
+    length = dict_length(pool->d);
+    mutex_unlock(&pool->mutex);
+
+    return length;
+}
+
+
+/**
+ * Drops the files not loaded in the last age generations, a file edited
+ * since is left behind by its old identity, and starts a new one. None
+ * of the buffers may be in use. The number of files dropped.
+ **/
+size_t srcpool_sweep(srcpool_t *pool, size_t age)
+{
+    dict_iterator_t *iter;
+    dict_entry_t *entry;
+    srcfile_t *file;
+    size_t n = 0;
+
+    mutex_lock(&pool->mutex);
+
+    iter = dict_get_safe_iterator(pool->d);
+
+    while ((entry = dict_next(iter)) != NULL) {
+        file = (srcfile_t *) dict_get_key(entry);
+
+        if (pool->generation - file->used >= age) {
+            dict_delete(pool->d, file);
+            n++;
+        }
+    }
+
+    dict_release_iterator(iter);
+    pool->generation++;
+
+    mutex_unlock(&pool->mutex);
+    return n;
+}
+
+
+/**
+ * Every buffer is followed by at least one '\0' byte, linenote2cs() and
+ * the diagnostor rely on it to find the end of the last line.
+ **/
+static
+bool __srcfile_load__(srcfile_t *file, FILE *fp)
+{
+    unsigned char *buf;
+    size_t size = (size_t) file->size;
+
+#if defined(UNIX)
+    long pagesize = sysconf(_SC_PAGESIZE);
+
+    if (size >= SRCPOOL_MMAP_THRESHOLD && pagesize > 0 &&
+        __srcfile_map__(file, fp, size, (size_t) pagesize)) {
+        return true;
+    }
+#endif
+
+    buf = (unsigned char *) pmalloc(size + 1);
+    if (fread(buf, sizeof(unsigned char), size, fp) != size) {
+        pfree(buf);
+        return false;
+    }
+
+    buf[size] = '\0';
+    file->text = buf;
+    file->length = size;
+    file->extent = size + 1;
+    file->mapped = false;
+    file->windowed = false;
+    return true;
+}
+
+
+#if defined(UNIX)
+/**
+ * A mapping gets its '\0' from the zero-filled tail of the last page.
+ * When the size is an exact page multiple there is no tail, so one more
+ * anonymous page is reserved behind the file to carry it.
+ **/
+static
+bool __srcfile_map__(srcfile_t *file, FILE *fp, size_t size, size_t pagesize)
+{
+    void *base;
+    size_t extent = size;
+
+    if (size % pagesize == 0) {
+        extent += pagesize;
+
+        base = mmap(NULL, extent, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED) {
+            return false;
+        }
+
+        if (mmap(base, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fileno(fp), 0) == MAP_FAILED) {
+            munmap(base, extent);
+            return false;
+        }
+    } else {
+        base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+        if (base == MAP_FAILED) {
+            return false;
+        }
+    }
+
+    file->windowed = size >= SRCPOOL_WINDOW_THRESHOLD;
+    if (file->windowed) {
+        madvise(base, size, MADV_SEQUENTIAL);
+    }
+
+    file->text = (const unsigned char *) base;
+    file->length = size;
+    file->extent = extent;
+    file->mapped = true;
+    return true;
+}
+#endif
+
+
+static
+void __srcfile_release__(srcfile_t *file)
+{
+    if (file->splices != NULL) {
+        array_destroy(file->splices);
+    }
+
+    if (file->lines != NULL) {
+        linemap_destroy(file->lines);
+    }
+
+    if (file->clean != NULL && file->clean != file->text) {
+        pfree((void *) file->clean);
+    }
+
+#if defined(UNIX)
+    if (file->mapped) {
+        munmap((void *) file->text, file->extent);
+        return;
+    }
+#endif
+    pfree((void *) file->text);
+}
@@ -0,0 +1,71 @@
+
+
+#ifndef __SRCPOOL__H__
+#define __SRCPOOL__H__
+
+
+#include "config.h"
+#include "thread.h"
+
+
+typedef struct dict_s dict_t;
+typedef struct array_s array_t;
+typedef struct linemap_s linemap_t;
+
+
+/**
+ * A source file is identified by (device, inode, mtime, size), so the
+ * same header reached through different paths, or opened by several
+ * readers, is loaded only once. The mtime has its nanoseconds where the
+ * system keeps them, for two edits within a second.
+ **/
+typedef struct srcfile_s {
+    uint64_t device;
+    uint64_t inode;
+    int64_t modify_time;
+    int64_t modify_nsec;
+    uint64_t size;
+
+    time_t access_time;
+    time_t change_time;
+
+    const unsigned char *text;
+    size_t length;
+    size_t extent;
+    bool mapped;
+    bool windowed;
+    linemap_t *lines;
+
+    /* translation phases 1 and 2, filled in by srcpool_prepare() */
+    const unsigned char *clean;
+    size_t clean_length;
+    array_t *splices;
+
+    /* the generation of the pool it was last loaded in */
+    size_t used;
+} srcfile_t;
+
+
+/**
+ * Loads may come from the reader and from the prefetcher at the same
+ * time, the dict and the pre-pass are guarded by mutex. A pool that
+ * lives on across runs is swept now and then, each sweep a generation.
+ **/
+typedef struct srcpool_s {
+    dict_t *d;
+    uint64_t serial;
+    size_t generation;
+    mutex_t mutex;
+} srcpool_t;
+
+
+srcpool_t* srcpool_create(void);
+void srcpool_destroy(srcpool_t *pool);
+srcfile_t* srcpool_load(srcpool_t *pool, const char *fn);
+void srcpool_prepare(srcpool_t *pool, srcfile_t *file);
+void srcfile_evict(srcfile_t *file, size_t offset);
+size_t srcpool_length(srcpool_t *pool);
+size_t srcpool_sweep(srcpool_t *pool, size_t age);
+
+
+#endif
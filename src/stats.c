@@ -0,0 +1,196 @@
+#include "config.h"
+#include "dict.h"
+#include "stats.h"
+
+
+THREAD_LOCAL stats_t stats;
+THREAD_LOCAL stats_phase_t stats_phase = STATS_PHASE_OTHER;
+THREAD_LOCAL bool stats_timing = false;
+
+
+/* the wall and CPU clocks at the last change of phase, the rest at stats_begin() */
+static THREAD_LOCAL double __stats_wall__;
+static THREAD_LOCAL double __stats_cpu__;
+static THREAD_LOCAL unsigned long __stats_rehashes__;
+
+
+static const char *__stats_phases__[STATS_PHASE_MAX] = {
+    "other",
+    "reading",
+    "lexing",
+    "directives",
+    "macro expansion",
+    "output",
+};
+
+
+static const char *__stats_counters__[STATS_COUNTER_MAX] = {
+    "bytes read",
+    "tokens lexed",
+    "tokens out",
+    "number runs",
+    "macros defined",
+    "macros expanded",
+    "macro cache hits",
+    "macro cache misses",
+    "hideset unions",
+    "hideset memo hits",
+    "hideset memo misses",
+    "include lookup hits",
+    "include lookup misses",
+    "token cache hits",
+    "token cache misses",
+    "dict rehashes",
+};
+
+
+static double __stats_wall_clock__(void);
+static double __stats_cpu_clock__(void);
+static void __stats_rate__(FILE *fp, const char *name, uint64_t hits, uint64_t misses);
+
+
+/**
+ * Starts the counts of a unit on the calling thread over, timing it
+ * when timing is true.
+ **/
+void stats_begin(bool timing)
+{
+    memset(&stats, 0, sizeof(stats));
+    stats_phase = STATS_PHASE_OTHER;
+    stats_timing = timing;
+    __stats_rehashes__ = dict_rehashes();
+
+    if (timing) {
+        __stats_cpu__ = __stats_cpu_clock__();
+        __stats_wall__ = __stats_wall_clock__();
+    }
+}
+
+
+/**
+ * Ends the unit and adds its counts to total, under whatever lock the
+ * caller shares total with.
+ **/
+void stats_end(stats_t *total)
+{
+    size_t i;
+
+    if (stats_timing) {
+        stats_switch(STATS_PHASE_OTHER);
+    }
+
+    stats.counters[STATS_DICT_REHASHES] = dict_rehashes() - __stats_rehashes__;
+
+    for (i = 0; i < STATS_COUNTER_MAX; i++) {
+        total->counters[i] += stats.counters[i];
+    }
+
+    for (i = 0; i < STATS_PHASE_MAX; i++) {
+        total->wall[i] += stats.wall[i];
+        total->cpu[i] += stats.cpu[i];
+    }
+
+    total->units++;
+    stats_timing = false;
+    stats_phase = STATS_PHASE_OTHER;
+}
+
+
+/**
+ * Charges the wall and CPU time since the last change to the phase left,
+ * the CPU time being that of the calling thread.
+ **/
+void stats_switch(stats_phase_t phase)
+{
+    double wall = __stats_wall_clock__(), cpu = __stats_cpu_clock__();
+
+    stats.wall[stats_phase] += wall - __stats_wall__;
+    stats.cpu[stats_phase] += cpu - __stats_cpu__;
+    __stats_wall__ = wall;
+    __stats_cpu__ = cpu;
+    stats_phase = phase;
+}
+
+
+/**
+ * The phases with their share of the total, then the counters, what
+ * has a hit rate with it. The seconds are summed over the units, which
+ * may have run side by side.
+ **/
+void stats_report(stats_t *s, FILE *fp, bool times, bool counters)
+{
+    double wall = 0, cpu = 0;
+    size_t i;
+
+    if (times) {
+        for (i = 0; i < STATS_PHASE_MAX; i++) {
+            wall += s->wall[i];
+            cpu += s->cpu[i];
+        }
+
+        fprintf(fp, "time report, %lu unit%s:\n", (unsigned long) s->units, s->units != 1 ? "s" : "");
+        fprintf(fp, "  %-18s %12s %7s %12s %7s\n", "phase", "wall (s)", "", "cpu (s)", "");
+
+        for (i = 0; i < STATS_PHASE_MAX; i++) {
+            fprintf(fp, "  %-18s %12.6f %6.1f%% %12.6f %6.1f%%\n", __stats_phases__[i],
+                    s->wall[i], wall > 0 ? s->wall[i] * 100 / wall : 0.0,
+                    s->cpu[i], cpu > 0 ? s->cpu[i] * 100 / cpu : 0.0);
+        }
+
+        fprintf(fp, "  %-18s %12.6f %7s %12.6f\n", "total", wall, "", cpu);
+    }
+
+    if (counters) {
+        fprintf(fp, "statistics, %lu unit%s:\n", (unsigned long) s->units, s->units != 1 ? "s" : "");
+
+        for (i = 0; i < STATS_COUNTER_MAX; i++) {
+            fprintf(fp, "  %-24s %14llu\n", __stats_counters__[i], (unsigned long long) s->counters[i]);
+        }
+
+        __stats_rate__(fp, "macro cache hit rate", s->counters[STATS_MACRO_CACHE_HITS],
+                       s->counters[STATS_MACRO_CACHE_MISSES]);
+        __stats_rate__(fp, "hideset memo hit rate", s->counters[STATS_HIDESET_MEMO_HITS],
+                       s->counters[STATS_HIDESET_MEMO_MISSES]);
+        __stats_rate__(fp, "include lookup hit rate", s->counters[STATS_INCLUDE_HITS],
+                       s->counters[STATS_INCLUDE_MISSES]);
+        __stats_rate__(fp, "token cache hit rate", s->counters[STATS_TOKCACHE_HITS],
+                       s->counters[STATS_TOKCACHE_MISSES]);
+    }
+}
+
+
+static
+double __stats_wall_clock__(void)
+{
+#if defined(UNIX)
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+#else
+    return (double) clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+
+static
+double __stats_cpu_clock__(void)
+{
+#if defined(UNIX)
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+#else
+    return (double) clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+
+static
+void __stats_rate__(FILE *fp, const char *name, uint64_t hits, uint64_t misses)
+{
+    if (hits + misses != 0) {
+        fprintf(fp, "  %-24s %13.1f%%\n", name, (double) hits * 100 / (double) (hits + misses));
+    }
+}
@@ -0,0 +1,98 @@
+
+
+#ifndef __STATS__H__
+#define __STATS__H__
+
+
+#include "config.h"
+
+
+typedef enum stats_phase_e {
+    STATS_PHASE_OTHER,
+    STATS_PHASE_READ,                   /* loading and preparing the files */
+    STATS_PHASE_LEX,
+    STATS_PHASE_DIRECTIVE,
+    STATS_PHASE_EXPAND,
+    STATS_PHASE_OUTPUT,
+    STATS_PHASE_MAX,
+} stats_phase_t;
+
+
+typedef enum stats_counter_e {
+    STATS_BYTES_READ,
+    STATS_TOKENS_LEXED,
+    STATS_TOKENS_OUT,
+    STATS_NUMBER_RUNS,
+    STATS_MACROS_DEFINED,
+    STATS_MACROS_EXPANDED,
+    STATS_MACRO_CACHE_HITS,
+    STATS_MACRO_CACHE_MISSES,
+    STATS_HIDESET_UNIONS,
+    STATS_HIDESET_MEMO_HITS,
+    STATS_HIDESET_MEMO_MISSES,
+    STATS_INCLUDE_HITS,
+    STATS_INCLUDE_MISSES,
+    STATS_TOKCACHE_HITS,
+    STATS_TOKCACHE_MISSES,
+    STATS_DICT_REHASHES,
+    STATS_COUNTER_MAX,
+} stats_counter_t;
+
+
+/**
+ * What the units of a thread went through: the counters and, with
+ * timing on, the wall and CPU seconds of each phase. A phase has the
+ * time spent in it less that of the phases it went into, the lexing
+ * an expansion does is lexing. Counting is an increment, always on;
+ * timing reads the wall clock and the CPU clock of the thread each time
+ * the phase changes, only when asked to by stats_begin().
+ **/
+typedef struct stats_s {
+    uint64_t counters[STATS_COUNTER_MAX];
+    double wall[STATS_PHASE_MAX];
+    double cpu[STATS_PHASE_MAX];
+    size_t units;
+} stats_t;
+
+
+extern THREAD_LOCAL stats_t stats;
+extern THREAD_LOCAL stats_phase_t stats_phase;
+extern THREAD_LOCAL bool stats_timing;
+
+
+#define stats_count(counter)        (stats.counters[counter]++)
+#define stats_add(counter, n)       (stats.counters[counter] += (n))
+
+
+void stats_begin(bool timing);
+void stats_end(stats_t *total);
+void stats_switch(stats_phase_t phase);
+void stats_report(stats_t *s, FILE *fp, bool times, bool counters);
+
+
+/**
+ * Goes into phase, the one left is handed back for stats_leave().
+ **/
+static inline
+stats_phase_t stats_enter(stats_phase_t phase)
+{
+    stats_phase_t prev = stats_phase;
+
+    if (stats_timing && prev != phase) {
+        stats_switch(phase);
+    } else {
+        stats_phase = phase;
+    }
+
+    return prev;
+}
+
+
+static inline
+void stats_leave(stats_phase_t prev)
+{
+    stats_enter(prev);
+}
+
+
+#endif
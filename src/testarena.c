@@ -0,0 +1,172 @@
+
+
+#include "config.h"
+#include "cstring.h"
+#include "arena.h"
+#include "unittest.h"
+
+
+static void test_arena(void)
+{
+    arena_t *arena;
+    unsigned char *a, *b, *big;
+    cstring_t cs;
+    size_t i;
+    bool aligned = true;
+
+    arena = arena_create_n(1024);
+
+    TEST_COND("arena_allocated()", arena_allocated(arena) == 0);
+
+    a = arena_alloc(arena, 3);
+    b = arena_alloc(arena, 5);
+    TEST_COND("arena_alloc()", a != NULL && b != NULL);
+    TEST_COND("arena_alloc() aligned", ((size_t) a % ARENA_ALIGNMENT) == 0 &&
+                                       ((size_t) b % ARENA_ALIGNMENT) == 0);
+    TEST_COND("arena_alloc() bump", b == a + ARENA_ALIGNMENT);
+
+    memset(a, 'a', 3);
+    memset(b, 'b', 5);
+
+    for (i = 0; i < 1000; i++) {
+        unsigned char *p = arena_alloc(arena, i % 37 + 1);
+        if (((size_t) p % ARENA_ALIGNMENT) != 0) {
+            aligned = false;
+        }
+        memset(p, 0xcc, i % 37 + 1);
+    }
+    TEST_COND("arena_alloc() new block aligned", aligned);
+    TEST_COND("arena_alloc() keeps data", a[0] == 'a' && a[2] == 'a' &&
+                                          b[0] == 'b' && b[4] == 'b');
+
+    big = arena_alloc(arena, 4096);
+    memset(big, 'x', 4096);
+    TEST_COND("arena_alloc() oversized", big != NULL && big[4095] == 'x');
+
+    cs = arena_cstring(arena, (const unsigned char *) "hello", 5);
+    TEST_COND("arena_cstring()", cstring_compare(cs, "hello") == 0);
+    TEST_COND("arena_cstring() length", cstring_length(cs) == 5);
+
+    cs = arena_cstring(arena, NULL, 0);
+    TEST_COND("arena_cstring() empty", cstring_length(cs) == 0 && cs[0] == '\0');
+
+    arena_destroy(arena);
+}
+
+
+static void test_arena_absorb(void)
+{
+    arena_t *arena, *from;
+    cstring_t a, b, c;
+    size_t allocated;
+
+    arena = arena_create_n(1024);
+    from = arena_create_n(1024);
+
+    a = arena_cstring(arena, (const unsigned char *) "one", 3);
+    b = arena_cstring(from, (const unsigned char *) "two", 3);
+
+    allocated = arena_allocated(arena) + arena_allocated(from);
+
+    arena_absorb(arena, from);
+    TEST_COND("arena_absorb() allocated", arena_allocated(arena) == allocated);
+
+    c = arena_cstring(arena, (const unsigned char *) "three", 5);
+    TEST_COND("arena_absorb() keeps data", cstring_compare(a, "one") == 0 &&
+                                           cstring_compare(b, "two") == 0 &&
+                                           cstring_compare(c, "three") == 0);
+    TEST_COND("arena_absorb() fills its own block", c > a && c < a + 1024);
+
+    from = arena_create();
+    arena_absorb(arena, from);
+    TEST_COND("arena_absorb() empty", cstring_compare(b, "two") == 0);
+
+    arena_destroy(arena);
+}
+
+
+static void test_arena_reset(void)
+{
+    arena_t *arena, *from;
+    arena_mark_t outer, inner;
+    arena_block_t *spare;
+    unsigned char *a, *b, *c;
+    size_t i;
+
+    arena = arena_create_n(1024);
+
+    outer = arena_mark(arena);
+    a = arena_alloc(arena, 16);
+    memset(a, 'a', 16);
+
+    inner = arena_mark(arena);
+    for (i = 0; i < 100; i++) {
+        memset(arena_alloc(arena, 40), 0xcc, 40);
+    }
+    memset(arena_alloc(arena, 4000), 0xdd, 4000);
+
+    arena_reset(arena, inner);
+    TEST_COND("arena_reset() inner", arena_allocated(arena) == 16 && a[0] == 'a' && a[15] == 'a');
+    TEST_COND("arena_reset() keeps a spare", arena->spare != NULL && arena->block->next == NULL);
+
+    spare = arena->spare;
+    b = arena_alloc(arena, 16);
+    TEST_COND("arena_reset() bumps from the mark", b == a + 16);
+
+    for (i = 0; i < 30; i++) {
+        arena_alloc(arena, 40);
+    }
+    TEST_COND("arena_alloc() takes the spare", arena->spare == NULL && arena->block == spare);
+
+    /* an oversized block and an arena absorbed behind the marked block */
+    inner = arena_mark(arena);
+    c = arena_alloc(arena, 900);
+    from = arena_create_n(1024);
+    arena_alloc(from, 100);
+    arena_absorb(arena, from);
+    TEST_COND("arena_mark() oversized", c != NULL && arena_allocated(arena) > outer.allocated);
+
+    arena_reset(arena, inner);
+    TEST_COND("arena_reset() oversized", arena->block->next == inner.next);
+
+    arena_reset(arena, outer);
+    TEST_COND("arena_reset() outer", arena_allocated(arena) == 0 && arena->block == NULL);
+
+    arena_destroy(arena);
+}
+
+
+static void test_arena_of(void)
+{
+    arena_t *unit, *expansion;
+    arena_mark_t mark;
+
+    unit = arena_of(ARENA_PHASE_UNIT);
+    expansion = arena_of(ARENA_PHASE_EXPANSION);
+
+    TEST_COND("arena_of()", unit != NULL && expansion != NULL && unit != expansion);
+    TEST_COND("arena_of() the same", arena_of(ARENA_PHASE_UNIT) == unit);
+    TEST_COND("arena_of() scratch", expansion->block_size == ARENA_SCRATCH_BLOCK_SIZE);
+
+    mark = arena_mark(expansion);
+    arena_cstring(expansion, (const unsigned char *) "scratch", 7);
+    arena_reset(expansion, mark);
+    TEST_COND("arena_of() reset", arena_allocated(expansion) == 0);
+
+    arena_cleanup();
+}
+
+
+int main(void)
+{
+#ifdef WIN32
+    _CrtSetDbgFlag(_CrtSetDbgFlag(_CRTDBG_REPORT_FLAG) | _CRTDBG_LEAK_CHECK_DF);
+#endif
+
+    test_arena();
+    test_arena_absorb();
+    test_arena_reset();
+    test_arena_of();
+    TEST_REPORT();
+    return 0;
+}
@@ -50,6 +50,57 @@ static void test_array(void)
 }
 
 
+ARRAY_DEFINE(int, int, 4)
+
+
+static void test_typed_array(void)
+{
+    int_array_t *array;
+    int ints[10];
+    int *a;
+    int i;
+
+    array = int_array_create();
+
+    TEST_COND("int_array_create()", array_is_empty(array) && array->elts == array->inlined);
+    TEST_COND("array_capacity()", array_capacity(array) == 4);
+
+    for (i = 0; i < 4; i++) {
+        int_array_append(array, i);
+    }
+
+    TEST_COND("int_array_append()", array_length(array) == 4 && array->elts == array->inlined);
+
+    *int_array_push_back(array) = 4;
+    TEST_COND("int_array_push_back()", array_length(array) == 5 && array->elts != array->inlined);
+
+    for (i = 0; i < 10; i++) {
+        ints[i] = 5 + i;
+    }
+
+    TEST_COND("int_array_append_n()", int_array_append_n(array, ints, 10));
+    TEST_COND("int_array_append_n()", array_length(array) == 15);
+
+    for (i = 0; i < 15; i++) {
+        TEST_COND("int_array_at()", *int_array_at(array, i) == i);
+    }
+
+    TEST_COND("int_array_back()", *int_array_back(array) == 14);
+
+    array_foreach(array, a, i) {
+        TEST_COND("array_foreach()", a[i] == i);
+    }
+
+    TEST_COND("int_array_reserve()", int_array_reserve(array, 100) && array->nalloc == 100);
+    TEST_COND("int_array_reserve()", array_length(array) == 15 && *int_array_back(array) == 14);
+
+    array_clear(array);
+    TEST_COND("array_clear()", array_is_empty(array) && array_capacity(array) == 100);
+
+    int_array_destroy(array);
+}
+
+
 int main(void)
 {
 #ifdef WIN32
@@ -57,6 +108,7 @@ int main(void)
 #endif
 
     test_array();
+    test_typed_array();
     TEST_REPORT();
     return 0;
 }
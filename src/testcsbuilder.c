@@ -0,0 +1,120 @@
+
+
+#include "config.h"
+#include "cstring.h"
+#include "csbuilder.h"
+#include "unittest.h"
+
+#if defined(UNIX)
+#   include <unistd.h>
+#endif
+
+
+static void test_csbuilder(void)
+{
+    csbuilder_t *b;
+    cstring_t cs;
+    size_t i;
+    bool same;
+    char *big;
+
+    b = csbuilder_create();
+    TEST_COND("csbuilder_create()", csbuilder_length(b) == 0);
+
+    cs = csbuilder_to_cstring(b);
+    TEST_COND("csbuilder_to_cstring() empty", cs != NULL && cstring_length(cs) == 0);
+    cstring_free(cs);
+
+    csbuilder_append(b, "x = ");
+    csbuilder_append_ll(b, -42);
+    csbuilder_append_ch(b, ';');
+    csbuilder_append_ull(b, 255, 16);
+    csbuilder_append_pf(b, " %s:%d", "a.c", 7);
+
+    cs = csbuilder_to_cstring(b);
+    TEST_COND("csbuilder_append_*()", cstring_compare(cs, "x = -42;FF a.c:7") == 0);
+    TEST_COND("csbuilder_length()", csbuilder_length(b) == cstring_length(cs));
+    cstring_free(cs);
+
+    csbuilder_clear(b);
+    TEST_COND("csbuilder_clear()", csbuilder_length(b) == 0);
+
+    /* enough to run over several chunks, some pieces across two */
+    for (i = 0; i < 5000; i++) {
+        csbuilder_append_pf(b, "%lu,", (unsigned long) i);
+        csbuilder_append(b, "abc ");
+    }
+
+    cs = csbuilder_to_cstring(b);
+    TEST_COND("csbuilder_to_cstring() chunks", cstring_length(cs) == csbuilder_length(b) &&
+                                              csbuilder_length(b) > 4 * CSBUILDER_CHUNK_SIZE);
+    TEST_COND("csbuilder_to_cstring() chunks", strncmp((const char *) cs, "0,abc 1,abc 2,abc ", 18) == 0 &&
+                                              strcmp((const char *) cs + cstring_length(cs) - 9, "4999,abc ") == 0);
+    cstring_free(cs);
+    csbuilder_clear(b);
+
+    big = malloc(3 * CSBUILDER_CHUNK_SIZE + 1);
+    memset(big, 'z', 3 * CSBUILDER_CHUNK_SIZE);
+    big[3 * CSBUILDER_CHUNK_SIZE] = '\0';
+
+    csbuilder_append(b, "<");
+    csbuilder_append_pf(b, "%s", big);
+    csbuilder_append(b, big);
+    csbuilder_append(b, ">");
+
+    cs = csbuilder_to_cstring(b);
+    for (same = cs[0] == '<', i = 1; i <= 6 * CSBUILDER_CHUNK_SIZE; i++) {
+        same = same && cs[i] == 'z';
+    }
+    TEST_COND("csbuilder_append_pf() large", same && cstring_length(cs) == 6 * CSBUILDER_CHUNK_SIZE + 2 &&
+                                            cs[cstring_length(cs) - 1] == '>');
+    cstring_free(cs);
+    free(big);
+
+    csbuilder_destroy(b);
+}
+
+
+#if defined(UNIX)
+static void test_csbuilder_flush(void)
+{
+    csbuilder_t *b;
+    char buf[64];
+    int fds[2];
+    ssize_t n;
+
+    if (pipe(fds) != 0) {
+        return;
+    }
+
+    b = csbuilder_create();
+    csbuilder_append(b, "hello ");
+    csbuilder_append_ll(b, 2024);
+    csbuilder_append_ch(b, '\n');
+
+    TEST_COND("csbuilder_flush()", csbuilder_flush(b, fds[1]));
+    TEST_COND("csbuilder_flush() empties", csbuilder_length(b) == 0);
+
+    close(fds[1]);
+    n = read(fds[0], buf, sizeof(buf));
+    TEST_COND("csbuilder_flush() writes", n == 11 && memcmp(buf, "hello 2024\n", 11) == 0);
+    close(fds[0]);
+
+    csbuilder_destroy(b);
+}
+#endif
+
+
+int main(void)
+{
+#ifdef WIN32
+    _CrtSetDbgFlag(_CrtSetDbgFlag(_CRTDBG_REPORT_FLAG) | _CRTDBG_LEAK_CHECK_DF);
+#endif
+
+    test_csbuilder();
+#if defined(UNIX)
+    test_csbuilder_flush();
+#endif
+    TEST_REPORT();
+    return 0;
+}
@@ -2,9 +2,15 @@
 
 #include "config.h"
 #include "cspool.h"
+#include "cstable.h"
+#include "thread.h"
 #include "unittest.h"
 
 
+#define TEST_THREADS    4
+#define TEST_STRINGS    4000
+
+
 static void test_cspool(void)
 {
     cspool_t *pool;
@@ -22,6 +28,97 @@ static void test_cspool(void)
 }
 
 
+static void test_cstable(void)
+{
+    cstable_t *table;
+    cstring_t cs, dup;
+
+    table = cstable_create();
+
+    TEST_COND("cstable_find() none", cstable_find(table, "HelloWorld", 10) == NULL);
+
+    cs = cstable_push(table, "HelloWorld");
+    TEST_COND("cstable_push()", cs != NULL && cstring_compare(cs, "HelloWorld") == 0);
+    TEST_COND("cstable_push() again", cstable_push(table, "HelloWorld") == cs);
+    TEST_COND("cstable_find()", cstable_find(table, "HelloWorld", 10) == cs);
+    TEST_COND("cstable_push_n()", cstable_push_n(table, "HelloWorld!", 10) == cs);
+
+    dup = cstable_push_cs(table, cstring_new("HelloWorld"));
+    TEST_COND("cstable_push_cs()", dup == cs);
+    TEST_COND("cstable_push_n() binary", cstable_push_n(table, "a\0b", 3) != cstable_push_n(table, "a\0c", 3));
+    TEST_COND("cstable_length()", cstable_length(table) == 3);
+
+    cstable_destroy(table);
+}
+
+
+typedef struct test_worker_s {
+    cstable_t *table;
+    size_t id;
+    cstring_t interned[TEST_STRINGS];
+} test_worker_t;
+
+
+static void test_cstable_worker(void *ud)
+{
+    test_worker_t *worker = (test_worker_t *) ud;
+    char buf[32];
+    size_t i, k;
+
+    /* each thread takes the strings in an order of its own */
+    for (i = 0; i < TEST_STRINGS; i++) {
+        k = worker->id & 1 ? TEST_STRINGS - 1 - i : (i * 7 + worker->id) % TEST_STRINGS;
+        sprintf(buf, "string-%lu", (unsigned long) k);
+
+        if (i % 3 == 0) {
+            worker->interned[k] = cstable_push_cs(worker->table, cstring_new(buf));
+        } else {
+            worker->interned[k] = cstable_push(worker->table, buf);
+        }
+    }
+}
+
+
+static void test_cstable_threads(void)
+{
+    static test_worker_t workers[TEST_THREADS];
+    thread_t threads[TEST_THREADS];
+    cstable_t *table;
+    size_t i, k, same = 0;
+    char buf[32];
+
+    table = cstable_create();
+
+    for (i = 0; i < TEST_THREADS; i++) {
+        workers[i].table = table;
+        workers[i].id = i;
+        thread_create(&threads[i], test_cstable_worker, &workers[i]);
+    }
+
+    for (i = 0; i < TEST_THREADS; i++) {
+        thread_join(&threads[i]);
+    }
+
+    for (k = 0; k < TEST_STRINGS; k++) {
+        sprintf(buf, "string-%lu", (unsigned long) k);
+
+        for (i = 1; i < TEST_THREADS && workers[i].interned[k] == workers[0].interned[k]; i++) {
+            continue;
+        }
+
+        if (i == TEST_THREADS && cstring_compare(workers[0].interned[k], buf) == 0 &&
+            cstable_find(table, buf, strlen(buf)) == workers[0].interned[k]) {
+            same++;
+        }
+    }
+
+    TEST_COND("cstable_push() across threads", same == TEST_STRINGS);
+    TEST_COND("cstable_length() across threads", cstable_length(table) == TEST_STRINGS);
+
+    cstable_destroy(table);
+}
+
+
 int main(void)
 {
 
@@ -30,6 +127,8 @@ int main(void)
 #endif
 
     test_cspool();
+    test_cstable();
+    test_cstable_threads();
     TEST_REPORT();
     return 0;
 }
@@ -68,6 +68,87 @@ static void test_cstring(void)
 }
 
 
+static void test_cstring_hash(void)
+{
+    cstring_t cs;
+
+    cs = cstring_new("Hello");
+    TEST_COND("cstring_get_hash() none", cstring_get_hash(cs) == 0);
+
+    cstring_set_hash(cs, 42);
+    TEST_COND("cstring_set_hash()", cstring_get_hash(cs) == 42);
+
+    cs = cstring_concat_n(cs, "World", 5);
+    TEST_COND("cstring_concat_n() drops the hash", cstring_get_hash(cs) == 0);
+
+    cstring_set_hash(cs, 42);
+    cs = cstring_copy_n(cs, "Hi", 2);
+    TEST_COND("cstring_copy_n() drops the hash", cstring_get_hash(cs) == 0);
+
+    cstring_set_hash(cs, 42);
+    cstring_toupper(cs);
+    TEST_COND("cstring_toupper() drops the hash", cstring_get_hash(cs) == 0);
+
+    cstring_set_hash(cs, 42);
+    cstring_pop_ch(cs);
+    TEST_COND("cstring_pop_ch() drops the hash", cstring_get_hash(cs) == 0);
+
+    cstring_set_hash(cs, 42);
+    cstring_clear(cs);
+    TEST_COND("cstring_clear() drops the hash", cstring_get_hash(cs) == 0);
+    cstring_free(cs);
+}
+
+
+static void test_cstring_headers(void)
+{
+    uint64_t mem[8];
+    cstring_t cs;
+    size_t i;
+    bool same;
+
+    cs = cstring_new("if");
+    TEST_COND("cstring_new() header", cstring_type(cs) == CSTRING_TYPE_8 &&
+                                   cstring_sizeof(cs) == __cstring_offset(cstring_header8_t) + 3);
+
+    cstring_set_hash(cs, 42);
+
+    for (i = 0; i < 300; i++) {
+        cs = cstring_concat_ch(cs, (unsigned char) ('a' + i % 26));
+    }
+
+    TEST_COND("cstring_concat_n() header", cstring_type(cs) == CSTRING_TYPE_16);
+    TEST_COND("cstring_concat_n() header", cstring_length(cs) == 302 &&
+                                          cstring_get_hash(cs) == 0);
+
+    for (same = cs[0] == 'i' && cs[1] == 'f', i = 0; i < 300; i++) {
+        same = same && cs[i + 2] == 'a' + i % 26;
+    }
+
+    TEST_COND("cstring_concat_n() header", same && cs[302] == '\0');
+
+    cs = cstring_concat_n(cs, NULL, 0);
+    cstring_clear(cs);
+    TEST_COND("cstring_clear() header", cstring_length(cs) == 0 &&
+                                       cstring_capacity(cs) >= 302 &&
+                                       cstring_type(cs) == CSTRING_TYPE_16);
+    cstring_free(cs);
+
+    cs = cstring_new_n(NULL, 70000);
+    TEST_COND("cstring_new_n() header", cstring_type(cs) == CSTRING_TYPE_32 &&
+                                       cstring_length(cs) == 0 &&
+                                       cstring_capacity(cs) == 70000);
+    cstring_free(cs);
+
+    TEST_COND("cstring_space()", cstring_space(5) <= 32);
+    cs = cstring_place_n(mem, "hello", 5);
+    TEST_COND("cstring_place_n()", cstring_compare(cs, "hello") == 0 &&
+                                  cstring_capacity(cs) == 0 &&
+                                  cstring_of(cs) == (void *) mem &&
+                                  cstring_get_hash(cs) == 0);
+}
+
+
 int main(void)
 {
 #ifdef WIN32
@@ -75,6 +156,8 @@ int main(void)
 #endif
 
     test_cstring();
+    test_cstring_hash();
+    test_cstring_headers();
     TEST_REPORT();
     return 0;
 }
@@ -3,7 +3,9 @@
 #include "config.h"
 
 #include "token.h"
+#include "array.h"
 #include "diagnostor.h"
+#include "unittest.h"
 
 
 static void test_diagnostor()
@@ -27,6 +29,37 @@ static void test_diagnostor()
 }
 
 
+static void test_queue(void)
+{
+    diagnostor_t *diag, *saved;
+    size_t i;
+
+    diag = diagnostor_create();
+    saved = diagnostor;
+    diagnostor = diag;
+
+    for (i = 0; i < 1000; i++) {
+        warningf_with_location("<string>", 1, 2, "backslash and newline separated by space");
+    }
+    warningf_with_location("<string>", 2, 2, "backslash and newline separated by space");
+    diagnostor_notef(diag, DIAGNOSTOR_LEVEL_NOTE, "noted");
+    diagnostor_notef(diag, DIAGNOSTOR_LEVEL_NOTE, "noted");
+
+    TEST_COND("diagnostor drops the same warning", diag->nwarnings == 2);
+    TEST_COND("diagnostor queues until the flush", array_length(diag->queue) == 4);
+
+    diagnostor_flush(diag);
+    TEST_COND("diagnostor_flush()", array_length(diag->queue) == 0 && diag->nwarnings == 2);
+
+    warningf_with_location("<string>", 1, 2, "backslash and newline separated by space");
+    TEST_COND("diagnostor_flush() forgets what it wrote", diag->nwarnings == 3);
+
+    diagnostor_flush(diag);
+    diagnostor = saved;
+    diagnostor_destroy(diag);
+}
+
+
 static void test_panic(void)
 {
     panicf("panicf...");
@@ -40,6 +73,9 @@ int main(void)
     _CrtSetDbgFlag(_CrtSetDbgFlag(_CRTDBG_REPORT_FLAG) | _CRTDBG_LEAK_CHECK_DF);
 #endif
 
+    test_queue();
+    TEST_REPORT();
+
     test_diagnostor();
     test_panic();
     return 0;
@@ -4,6 +4,7 @@
 #include "unittest.h"
 #include "cstring.h"
 #include "dict.h"
+#include "hash.h"
 
 
 static uint64_t hash_callback(const void *key) {
@@ -123,6 +124,203 @@ static void test_dict(void)
 }
 
 
+static uint64_t collide_callback(const void *key) {
+    /* every key in the same group and with the same control byte */
+    return cstring_length((cstring_t)key) & 1;
+}
+
+
+dict_type_t dict_collide_type = {
+        collide_callback,
+        NULL,
+        NULL,
+        compare_callback,
+        free_callback,
+        NULL,
+};
+
+
+static void __test_dict_swiss__(dict_type_t *type, int n)
+{
+    dict_t *dict;
+    dict_entry_t *de;
+    dict_iterator_t *iter;
+    cstring_t key;
+    int j, count;
+    bool ok;
+
+    dict = dict_create_swiss(type, NULL);
+
+    TEST_COND("dict_create_swiss()", dict != NULL && dict_length(dict) == 0);
+    key = cstring_from_ll(0);
+    TEST_COND("dict_find() empty", dict_find(dict, key) == NULL);
+    cstring_free(key);
+
+    for (ok = true, j = 0; j < n; j++) {
+        ok = ok && dict_add(dict, cstring_from_ll(j), (void*)(intptr_t)j);
+    }
+    TEST_COND("dict_add() swiss", ok && dict_length(dict) == (unsigned long) n);
+
+    key = cstring_from_ll(n / 2);
+    TEST_COND("dict_add() swiss existing", !dict_add(dict, key, NULL) && dict_length(dict) == (unsigned long) n);
+    cstring_free(key);
+
+    for (ok = true, j = 0; j < n; j++) {
+        key = cstring_from_ll(j);
+        de = dict_find(dict, key);
+        ok = ok && de != NULL && (int)(intptr_t)dict_get_val(de) == j;
+        cstring_free(key);
+    }
+    TEST_COND("dict_find() swiss", ok);
+
+    for (ok = true, j = 0; j < n; j += 2) {
+        key = cstring_from_ll(j);
+        ok = ok && dict_delete(dict, key);
+        cstring_free(key);
+    }
+    TEST_COND("dict_delete() swiss", ok && dict_length(dict) == (unsigned long) n / 2);
+
+    for (ok = true, j = 0; j < n; j++) {
+        key = cstring_from_ll(j);
+        ok = ok && (dict_find(dict, key) != NULL) == (j % 2 == 1);
+        cstring_free(key);
+    }
+    TEST_COND("dict_find() swiss after dict_delete()", ok);
+
+    /* the deleted slots are taken again */
+    for (ok = true, j = 0; j < n; j += 2) {
+        ok = ok && dict_add(dict, cstring_from_ll(j), (void*)(intptr_t)j);
+    }
+    TEST_COND("dict_add() swiss after dict_delete()", ok && dict_length(dict) == (unsigned long) n);
+
+    key = cstring_from_ll(1);
+    de = dict_unlink(dict, key);
+    TEST_COND("dict_unlink() swiss", de != NULL && dict_find(dict, key) == NULL &&
+              cstring_compare(dict_get_key(de), key) == 0);
+    dict_free_unlinked_entry(dict, de);
+    cstring_free(key);
+
+    key = cstring_from_ll(3);
+    TEST_COND("dict_replace() swiss", !dict_replace(dict, key, (void*)(intptr_t)-3) &&
+              (int)(intptr_t)dict_fetch_value(dict, key) == -3);
+    cstring_free(key);
+
+    count = 0;
+    iter = dict_get_iterator(dict);
+    while ((de = dict_next(iter)) != NULL) {
+        count++;
+    }
+    dict_release_iterator(iter);
+    TEST_COND("dict_next() swiss", count == n - 1);
+
+    iter = dict_get_safe_iterator(dict);
+    while ((de = dict_next(iter)) != NULL) {
+        dict_delete(dict, dict_get_key(de));
+    }
+    dict_release_iterator(iter);
+    TEST_COND("dict_delete() swiss while iterating", dict_length(dict) == 0);
+
+    dict_empty(dict, NULL);
+    TEST_COND("dict_add() swiss after dict_empty()", dict_add(dict, cstring_from_ll(7), NULL) && dict_length(dict) == 1);
+
+    dict_destroy(dict);
+}
+
+
+static void test_dict_swiss(void)
+{
+    __test_dict_swiss__(&dict_type, 1000);
+    __test_dict_swiss__(&dict_collide_type, 100);
+}
+
+
+static void __test_dict_reset__(dict_t *dict)
+{
+    dict_entry_t *de, *reused;
+    cstring_t key;
+    bool ok;
+    int j;
+
+    for (j = 0; j < 500; j++) {
+        dict_add(dict, cstring_from_ll(j), NULL);
+    }
+
+    key = cstring_from_ll(7);
+    de = dict_unlink(dict, key);
+    dict_free_unlinked_entry(dict, de);
+    cstring_free(key);
+
+    if (!dict->swiss) {
+        reused = dict_add_raw(dict, cstring_from_ll(1000), NULL);
+        TEST_COND("dict_add_raw() takes the freed entry", reused == de);
+    }
+
+    dict_reset(dict);
+    TEST_COND("dict_reset()", dict_length(dict) == 0 && dict->free_entries == NULL &&
+              (dict->slabs == NULL || dict->slabs->next == NULL));
+
+    key = cstring_from_ll(3);
+    TEST_COND("dict_find() after dict_reset()", dict_find(dict, key) == NULL);
+    cstring_free(key);
+
+    for (ok = true, j = 0; j < 500; j++) {
+        ok = ok && dict_add(dict, cstring_from_ll(j), (void*)(intptr_t)j);
+    }
+    for (j = 0; j < 500; j++) {
+        key = cstring_from_ll(j);
+        ok = ok && (int)(intptr_t)dict_fetch_value(dict, key) == j;
+        cstring_free(key);
+    }
+    TEST_COND("dict_add() after dict_reset()", ok && dict_length(dict) == 500);
+
+    dict_empty(dict, NULL);
+    TEST_COND("dict_empty()", dict_length(dict) == 0 && dict->slabs == NULL);
+
+    dict_destroy(dict);
+}
+
+
+static void test_dict_reset(void)
+{
+    __test_dict_reset__(dict_create(&dict_type, NULL));
+    __test_dict_reset__(dict_create_swiss(&dict_type, NULL));
+}
+
+
+static void test_dict_hash_functions(void)
+{
+    static const char text[] = "preprocessor_expand_macro_arguments_with_hidesets";
+    uint64_t (*fns[3])(const void *key, int len);
+    uint64_t seen[sizeof(text)];
+    bool distinct, stable;
+    int i, j, n;
+
+    TEST_COND("crc32c()", crc32c(0, "123456789", 9) == 0xE3069283);
+    TEST_COND("crc32c() in pieces", crc32c(crc32c(0, "1234", 4), "56789", 5) == 0xE3069283);
+
+    fns[0] = dict_gen_siphash_function;
+    fns[1] = dict_gen_wyhash_function;
+    fns[2] = dict_gen_crc32c_function;
+
+    for (i = 0; i < 3; i++) {
+        distinct = stable = true;
+
+        /* every prefix, across the short key and the word boundaries */
+        for (n = 0; n < (int) sizeof(text); n++) {
+            seen[n] = fns[i](text, n);
+            stable = stable && fns[i](text, n) == seen[n];
+            for (j = 0; j < n; j++) {
+                distinct = distinct && seen[j] != seen[n];
+            }
+        }
+
+        TEST_COND("dict_gen_*_function() stable", stable);
+        TEST_COND("dict_gen_*_function() prefixes", distinct);
+        TEST_COND("dict_gen_*_function() a\\0", fns[i]("a", 1) != fns[i]("a\0", 2));
+    }
+}
+
+
 int main(void)
 {
 #ifdef WIN32
@@ -130,6 +328,9 @@ int main(void)
 #endif
 
     test_dict();
+    test_dict_swiss();
+    test_dict_reset();
+    test_dict_hash_functions();
 
     TEST_REPORT();
     return 0;
@@ -0,0 +1,328 @@
+
+
+#include "config.h"
+#include "unittest.h"
+#include "cstring.h"
+#include "option.h"
+#include "token.h"
+#include "diagnostor.h"
+#include "srcpool.h"
+#include "driver.h"
+
+#if defined(UNIX)
+#   include <fcntl.h>
+#   include <unistd.h>
+#   include <dirent.h>
+#endif
+
+
+#define TEST_HEADER         "testdriver.h.tmp"
+#define TEST_OUTPUT         "testdriver.out.tmp"
+#define TEST_PREPROCESSED   "testdriver.bo.i"
+#define TEST_DEPENDS        "testdriver.bo.d"
+#define TEST_CACHE_DIR      "testdriver.cache.tmp"
+#define TEST_PREFIX         "testdriver.p.c"
+#define TEST_PREFIXED       "testdriver.q.c"
+#define TEST_SNAPSHOT       "testdriver.snap.tmp"
+
+
+static const char *__units__[] = {
+    "testdriver.a.c", "testdriver.b.c", "testdriver.c.c", "testdriver.d.c",
+};
+
+
+static cstring_t __read_file__(const char *fn)
+{
+    cstring_t cs;
+    FILE *fp;
+    char buf[256];
+    size_t n;
+
+    cs = cstring_new_n(NULL, 256);
+    if ((fp = fopen(fn, "rb")) == NULL) {
+        return cs;
+    }
+
+    while ((n = fread(buf, 1, sizeof(buf), fp)) != 0) {
+        cs = cstring_concat_n(cs, buf, n);
+    }
+
+    fclose(fp);
+    return cs;
+}
+
+
+static void test_driver(void)
+{
+    option_t *opt, *saved_option;
+    diagnostor_t *saved_diagnostor;
+    driver_t *drv;
+    cstring_t cs;
+    size_t i, n = sizeof(__units__) / sizeof(__units__[0]);
+    char fn[96];
+#if defined(UNIX)
+    size_t n_errors, n_entries;
+    int saved, fd;
+    DIR *dir;
+    struct dirent *entry;
+#endif
+
+    __write_file__(TEST_HEADER, "#ifndef H\n#define H\nint h;\n#endif\n", 1);
+    __write_file__(__units__[0], "#include \"" TEST_HEADER "\"\nint a;\n", 1);
+    __write_file__(__units__[1], "#include \"" TEST_HEADER "\"\n#include \"" TEST_HEADER "\"\nint b;\n", 1);
+    __write_file__(__units__[2], "int c;\n", 1);
+    __write_file__(__units__[3], "#include \"testdriver.none.tmp\"\n", 1);
+
+    saved_option = option;
+    saved_diagnostor = diagnostor;
+
+    opt = option_create();
+    opt->MDflag = true;
+
+    drv = driver_create(opt);
+    for (i = 0; i < n; i++) {
+        driver_add_input(drv, __units__[i]);
+    }
+
+    TEST_COND("driver_run()", driver_run(drv, 3) == 1);
+    TEST_COND("driver_run() counts the errors", drv->nerrors == 1);
+    TEST_COND("driver_run() puts option back", option == saved_option);
+    TEST_COND("driver_run() puts diagnostor back",
+              diagnostor == saved_diagnostor && diagnostor->nerrors == 0);
+
+    cs = __read_file__("testdriver.a.d");
+    TEST_COND("driver_run() -MD", cstring_compare(cs, "testdriver.a.o: testdriver.a.c \\\n  " TEST_HEADER "\n") == 0);
+    cstring_free(cs);
+
+    cs = __read_file__("testdriver.b.d");
+    TEST_COND("driver_run() -MD shared include paths",
+              cstring_compare(cs, "testdriver.b.o: testdriver.b.c \\\n  " TEST_HEADER "\n") == 0);
+    cstring_free(cs);
+
+    cs = __read_file__("testdriver.c.d");
+    TEST_COND("driver_run() -MD no headers", cstring_compare(cs, "testdriver.c.o: testdriver.c.c\n") == 0);
+    cstring_free(cs);
+
+    driver_destroy(drv);
+
+    /* one -o or -MF is not for several units, which are not run then */
+    opt->Eflag = true;
+    opt->outfile = TEST_OUTPUT;
+    diagnostor = diagnostor_create();
+
+    drv = driver_create(opt);
+    driver_add_input(drv, __units__[0]);
+    driver_add_input(drv, __units__[2]);
+    TEST_COND("driver_run() -o with multiple files", driver_run(drv, 1) == 2 &&
+                                                     diagnostor->nerrors == 1);
+    cs = __read_file__(TEST_OUTPUT);
+    TEST_COND("driver_run() -o with multiple files writes nothing", cstring_length(cs) == 0);
+    cstring_free(cs);
+    driver_destroy(drv);
+
+    opt->outfile = NULL;
+    opt->MF = TEST_OUTPUT;
+
+    drv = driver_create(opt);
+    driver_add_input(drv, __units__[0]);
+    driver_add_input(drv, __units__[2]);
+    TEST_COND("driver_run() -MF with multiple files", driver_run(drv, 1) == 2 &&
+                                                      diagnostor->nerrors == 2);
+    driver_destroy(drv);
+
+    opt->MF = NULL;
+    diagnostor_destroy(diagnostor);
+    diagnostor = saved_diagnostor;
+
+    /* a single unit writes its output where -o says */
+    opt->MDflag = false;
+    opt->Eflag = true;
+    opt->outfile = TEST_OUTPUT;
+
+    drv = driver_create(opt);
+    driver_add_input(drv, __units__[0]);
+
+    TEST_COND("driver_run() -E -o", driver_run(drv, 8) == 0);
+    cs = __read_file__(TEST_OUTPUT);
+    TEST_COND("driver_run() -E output",
+              cstring_compare(cs, "# 3 \"" TEST_HEADER "\"\nint h;\n# 2 \"testdriver.a.c\"\nint a;\n") == 0);
+    cstring_free(cs);
+
+    driver_destroy(drv);
+
+    /* -fprefetch loads the header ahead, the unit reads it from the buffers all the same */
+    opt->prefetch = true;
+
+    drv = driver_create(opt);
+    driver_add_input(drv, __units__[0]);
+
+    TEST_COND("driver_run() -fprefetch", driver_run(drv, 1) == 0 && drv->prefetch == NULL &&
+                                         srcpool_length(drv->srcpool) == 2);
+    cs = __read_file__(TEST_OUTPUT);
+    TEST_COND("driver_run() -fprefetch output",
+              cstring_compare(cs, "# 3 \"" TEST_HEADER "\"\nint h;\n# 2 \"testdriver.a.c\"\nint a;\n") == 0);
+    cstring_free(cs);
+
+    driver_destroy(drv);
+
+    opt->prefetch = false;
+
+#if defined(UNIX)
+    /* -fcache-dir keeps the header for the next run, which reads it back */
+    opt->cache_dir = TEST_CACHE_DIR;
+
+    drv = driver_create(opt);
+    driver_add_input(drv, __units__[0]);
+    TEST_COND("driver_run() -fcache-dir", driver_run(drv, 1) == 0 &&
+                                          drv->stats.counters[STATS_TOKCACHE_HITS] == 0);
+    driver_destroy(drv);
+
+    n_entries = 0;
+    if ((dir = opendir(TEST_CACHE_DIR)) != NULL) {
+        while ((entry = readdir(dir)) != NULL) {
+            n_entries += strstr(entry->d_name, ".tok") != NULL;
+        }
+        closedir(dir);
+    }
+    TEST_COND("driver_run() -fcache-dir writes the header", n_entries == 1);
+
+    drv = driver_create(opt);
+    driver_add_input(drv, __units__[0]);
+    TEST_COND("driver_run() -fcache-dir again", driver_run(drv, 1) == 0 &&
+                                                drv->stats.counters[STATS_TOKCACHE_HITS] == 1);
+    cs = __read_file__(TEST_OUTPUT);
+    TEST_COND("driver_run() -fcache-dir output",
+              cstring_compare(cs, "# 3 \"" TEST_HEADER "\"\nint h;\n# 2 \"testdriver.a.c\"\nint a;\n") == 0);
+    cstring_free(cs);
+    driver_destroy(drv);
+
+    if ((dir = opendir(TEST_CACHE_DIR)) != NULL) {
+        while ((entry = readdir(dir)) != NULL) {
+            if (entry->d_name[0] != '.') {
+                sprintf(fn, "%s/%.64s", TEST_CACHE_DIR, entry->d_name);
+                remove(fn);
+            }
+        }
+        closedir(dir);
+    }
+    rmdir(TEST_CACHE_DIR);
+
+    opt->cache_dir = NULL;
+#endif
+
+    /* a unit after -fload-snapshot reads as if it began with the prefix saved */
+    __write_file__(TEST_PREFIX, "#include \"" TEST_HEADER "\"\n#define PREFIX 42\n", 1);
+    __write_file__(TEST_PREFIXED, "#include \"" TEST_HEADER "\"\nint x = PREFIX;\n", 1);
+
+    opt->save_snapshot = TEST_SNAPSHOT;
+    opt->outfile = NULL;
+
+    drv = driver_create(opt);
+    driver_add_input(drv, TEST_PREFIX);
+    driver_add_input(drv, TEST_PREFIXED);
+    TEST_COND("driver_run() -fsave-snapshot with multiple files", driver_run(drv, 1) == 2);
+    driver_destroy(drv);
+
+    opt->outfile = TEST_OUTPUT;
+
+    drv = driver_create(opt);
+    driver_add_input(drv, TEST_PREFIX);
+    TEST_COND("driver_run() -fsave-snapshot", driver_run(drv, 1) == 0);
+    driver_destroy(drv);
+
+    opt->save_snapshot = NULL;
+    opt->load_snapshot = TEST_SNAPSHOT;
+
+    drv = driver_create(opt);
+    driver_add_input(drv, TEST_PREFIXED);
+    TEST_COND("driver_run() -fload-snapshot", driver_run(drv, 1) == 0);
+    cs = __read_file__(TEST_OUTPUT);
+    TEST_COND("driver_run() -fload-snapshot output",
+              strstr(cs, "int x = 42;") != NULL && strstr(cs, "int h;") == NULL);
+    cstring_free(cs);
+    driver_destroy(drv);
+
+    opt->load_snapshot = TEST_PREFIX;
+
+    drv = driver_create(opt);
+    driver_add_input(drv, TEST_PREFIXED);
+    TEST_COND("driver_run() -fload-snapshot not a snapshot", driver_run(drv, 1) == 1);
+    driver_destroy(drv);
+
+    opt->load_snapshot = NULL;
+
+    /* -MD names the rule after -o, -MT goes in as it is and -MQ quoted */
+    opt->MDflag = true;
+    opt->outfile = TEST_PREPROCESSED;
+    opt->MT = "a b$";
+    opt->MQ = "c d$";
+
+    drv = driver_create(opt);
+    driver_add_input(drv, __units__[2]);
+
+    TEST_COND("driver_run() -MD -o", driver_run(drv, 1) == 0);
+    cs = __read_file__(TEST_DEPENDS);
+    TEST_COND("driver_run() -MD -o -MT -MQ", cstring_compare(cs, "a b$ c\\ d$$: testdriver.c.c\n") == 0);
+    cstring_free(cs);
+
+    driver_destroy(drv);
+
+    opt->MDflag = false;
+    opt->MT = NULL;
+    opt->MQ = NULL;
+
+#if defined(UNIX)
+    /* the diagnostics of a unit do not go into its output on stdout */
+    opt->outfile = NULL;
+
+    drv = driver_create(opt);
+    driver_add_input(drv, __units__[3]);
+
+    fflush(stdout);
+    saved = dup(fileno(stdout));
+    fd = open(TEST_OUTPUT, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    dup2(fd, fileno(stdout));
+    close(fd);
+
+    n_errors = driver_run(drv, 1);
+
+    fflush(stdout);
+    dup2(saved, fileno(stdout));
+    close(saved);
+
+    cs = __read_file__(TEST_OUTPUT);
+    TEST_COND("driver_run() -E diagnostics on stderr", n_errors == 1 && strstr(cs, "error") == NULL);
+    cstring_free(cs);
+
+    driver_destroy(drv);
+#endif
+
+    option_destroy(opt);
+
+    for (i = 0; i < n; i++) {
+        remove(__units__[i]);
+        strcpy(fn, __units__[i]);
+        fn[strlen(fn) - 1] = 'd';
+        remove(fn);
+    }
+
+    remove(TEST_HEADER);
+    remove(TEST_OUTPUT);
+    remove(TEST_PREPROCESSED);
+    remove(TEST_DEPENDS);
+    remove(TEST_PREFIX);
+    remove(TEST_PREFIXED);
+    remove(TEST_SNAPSHOT);
+}
+
+
+int main(void)
+{
+#ifdef WIN32
+    _CrtSetDbgFlag(_CrtSetDbgFlag(_CRTDBG_REPORT_FLAG) | _CRTDBG_LEAK_CHECK_DF);
+#endif
+
+    test_driver();
+    TEST_REPORT();
+    return 0;
+}
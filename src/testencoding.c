@@ -0,0 +1,173 @@
+
+
+#include "config.h"
+#include "cstring.h"
+#include "encoding.h"
+#include "unittest.h"
+
+
+static uint32_t __unit32__(cstring_t cs, size_t i)
+{
+    const unsigned char *p = (const unsigned char *) cs + 4 * i;
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+
+static uint16_t __unit16__(cstring_t cs, size_t i)
+{
+    const unsigned char *p = (const unsigned char *) cs + 2 * i;
+    return (uint16_t) (p[0] | (p[1] << 8));
+}
+
+
+static void test_cast(void)
+{
+    cstring_t cs, to;
+    size_t i;
+    bool same;
+
+    cs = cstring_new_n(NULL, 0);
+    for (i = 0; i < 100; i++) {
+        cs = cstring_push_ch(cs, 'a' + i % 26);
+    }
+
+    to = cstring_cast_to_utf16(cs);
+    for (same = to != NULL && cstring_length(to) == 200, i = 0; same && i < 100; i++) {
+        same = __unit16__(to, i) == cs[i];
+    }
+    TEST_COND("cstring_cast_to_utf16() ASCII", same);
+    cstring_free(to);
+
+    to = cstring_cast_to_utf32(cs);
+    for (same = to != NULL && cstring_length(to) == 400, i = 0; same && i < 100; i++) {
+        same = __unit32__(to, i) == cs[i];
+    }
+    TEST_COND("cstring_cast_to_utf32() ASCII", same);
+    cstring_free(to);
+    cstring_free(cs);
+
+    cs = cstring_new("a\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80z");
+
+    to = cstring_cast_to_utf16(cs);
+    TEST_COND("cstring_cast_to_utf16()", to != NULL && cstring_length(to) == 12 &&
+        __unit16__(to, 0) == 'a' && __unit16__(to, 1) == 0xE9 && __unit16__(to, 2) == 0x20AC &&
+        __unit16__(to, 3) == 0xD83D && __unit16__(to, 4) == 0xDE00 && __unit16__(to, 5) == 'z');
+    cstring_free(to);
+
+    to = cstring_cast_to_utf32(cs);
+    TEST_COND("cstring_cast_to_utf32()", to != NULL && cstring_length(to) == 20 &&
+        __unit32__(to, 0) == 'a' && __unit32__(to, 1) == 0xE9 && __unit32__(to, 2) == 0x20AC &&
+        __unit32__(to, 3) == 0x1F600 && __unit32__(to, 4) == 'z');
+    cstring_free(to);
+    cstring_free(cs);
+}
+
+
+static void test_validate(void)
+{
+    static const char *bad[] = {
+        "\xC0\xAF",             /* overlong */
+        "\xE0\x80\xAF",
+        "\xED\xA0\x80",         /* a surrogate */
+        "\xF4\x90\x80\x80",     /* past U+10FFFF */
+        "\xE2\x82",             /* cut short */
+        "\x80",
+        "\xFF",
+    };
+    cstring_t cs;
+    size_t i;
+    bool rejected = true;
+
+    TEST_COND("utf8_validate()", utf8_validate((const unsigned char *) "plain \xC3\xA9\xF4\x8F\xBF\xBF", 12));
+    TEST_COND("utf8_validate() empty", utf8_validate((const unsigned char *) "", 0));
+
+    for (i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        cs = cstring_new(bad[i]);
+        cs = cstring_concat_n(cs, "0123456789abcdef", 16);
+
+        rejected = rejected && !utf8_validate(cs, cstring_length(cs)) &&
+            cstring_cast_to_utf16(cs) == NULL && cstring_cast_to_utf32(cs) == NULL;
+
+        cstring_free(cs);
+    }
+
+    TEST_COND("utf8_validate() rejects", rejected);
+}
+
+
+/* random runes among runs of ASCII, through UTF-8 and back */
+static void test_roundtrip(void)
+{
+    cstring_t cs, to16, to32;
+    uint32_t runes[2048], rune;
+    size_t i, j, n;
+    bool same = true;
+    int round;
+
+    srand(7);
+
+    for (round = 0; round < 200 && same; round++) {
+        cs = cstring_new_n(NULL, 0);
+
+        for (n = 0; n < 2048 - 40; ) {
+            if (rand() % 2) {
+                for (j = rand() % 40; j > 0; j--) {
+                    runes[n++] = 0x20 + rand() % 0x5F;
+                }
+                continue;
+            }
+
+            do {
+                rune = (uint32_t) rand() % 0x110000;
+            } while (rune >= 0xD800 && rune <= 0xDFFF);
+
+            runes[n++] = rune;
+        }
+
+        for (i = 0; i < n; i++) {
+            cs = cstring_append_utf8(cs, runes[i]);
+        }
+
+        same = utf8_validate(cs, cstring_length(cs));
+
+        to32 = cstring_cast_to_utf32(cs);
+        same = same && to32 != NULL && cstring_length(to32) == 4 * n;
+        for (i = 0; same && i < n; i++) {
+            same = __unit32__(to32, i) == runes[i];
+        }
+
+        to16 = cstring_cast_to_utf16(cs);
+        same = same && to16 != NULL;
+        for (i = j = 0; same && i < n; i++) {
+            if (runes[i] < 0x10000) {
+                same = __unit16__(to16, j++) == runes[i];
+            } else {
+                rune = 0x10000 + (((uint32_t) __unit16__(to16, j) - 0xD800) << 10) +
+                    (__unit16__(to16, j + 1) - 0xDC00);
+                same = rune == runes[i];
+                j += 2;
+            }
+        }
+        same = same && cstring_length(to16) == 2 * j;
+
+        cstring_free(to16);
+        cstring_free(to32);
+        cstring_free(cs);
+    }
+
+    TEST_COND("cstring_cast_to_utf16/32() round trip", same);
+}
+
+
+int main(void)
+{
+#ifdef WIN32
+    _CrtSetDbgFlag(_CrtSetDbgFlag(_CRTDBG_REPORT_FLAG) | _CRTDBG_LEAK_CHECK_DF);
+#endif
+
+    test_cast();
+    test_validate();
+    test_roundtrip();
+    TEST_REPORT();
+    return 0;
+}
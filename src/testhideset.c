@@ -0,0 +1,113 @@
+
+
+#include "config.h"
+#include "unittest.h"
+#include "cstring.h"
+#include "hideset.h"
+
+
+static hideset_t* make_range(int from, int to)
+{
+    hideset_t *hs = NULL, *next;
+    cstring_t cs;
+    int i;
+
+    for (i = from; i < to; i++) {
+        cs = cstring_from_ll(i);
+        next = hideset_add(hs, cs);
+        hideset_release(hs);
+        hs = next;
+        cstring_free(cs);
+    }
+
+    return hs;
+}
+
+
+static bool has_range(hideset_t *hs, int from, int to)
+{
+    cstring_t cs;
+    bool has;
+    int i;
+
+    for (i = 0; i < 20; i++) {
+        cs = cstring_from_ll(i);
+        has = hideset_has(hs, cs);
+        cstring_free(cs);
+
+        if (has != (i >= from && i < to)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+static void test_hideset(void)
+{
+    hideset_t *a, *b, *u, *v, *x, *y, *z;
+    cstring_t cs;
+    size_t count;
+
+    a = make_range(0, 10);
+    b = make_range(5, 20);
+
+    TEST_COND("hideset_add()", has_range(a, 0, 10) && a->length == 10);
+    TEST_COND("hideset_has() empty", !hideset_has(NULL, "0"));
+
+    u = hideset_union(a, b);
+    TEST_COND("hideset_union()", has_range(u, 0, 20) && u->length == 20);
+
+    x = hideset_intersection(a, b);
+    TEST_COND("hideset_intersection()", has_range(x, 5, 10) && x->length == 5);
+
+    v = hideset_union(b, a);
+    TEST_COND("hideset_union() interned", v == u && u->refs >= 2);
+
+    y = make_range(5, 10);
+    TEST_COND("hideset_add() interned", y == x);
+
+    cs = cstring_new("5");
+    z = hideset_add(y, cs);
+    TEST_COND("hideset_add() present", z == y);
+    hideset_release(z);
+    cstring_free(cs);
+
+    TEST_COND("hideset_union() empty", hideset_union(NULL, a) == a);
+    hideset_release(a);
+    TEST_COND("hideset_intersection() empty", hideset_intersection(a, NULL) == NULL);
+
+    cs = cstring_new("a");
+    z = hideset_add(NULL, cs);
+    TEST_COND("hideset_intersection() disjoint", hideset_intersection(z, a) == NULL);
+    hideset_release(z);
+    cstring_free(cs);
+
+    count = hideset_count();
+    hideset_release(hideset_union(a, b));
+    hideset_release(hideset_intersection(b, a));
+    TEST_COND("hideset memo", hideset_count() == count);
+
+    hideset_release(a);
+    hideset_release(b);
+    hideset_release(u);
+    hideset_release(v);
+    hideset_release(x);
+    hideset_release(y);
+
+    hideset_cleanup();
+    TEST_COND("hideset_cleanup()", hideset_count() == 0);
+}
+
+
+int main(void)
+{
+#ifdef WIN32
+    _CrtSetDbgFlag(_CrtSetDbgFlag(_CRTDBG_REPORT_FLAG) | _CRTDBG_LEAK_CHECK_DF);
+#endif
+
+    test_hideset();
+    TEST_REPORT();
+    return 0;
+}
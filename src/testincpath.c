@@ -0,0 +1,134 @@
+
+
+#include "config.h"
+#include "unittest.h"
+#include "cstring.h"
+#include "incpath.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+
+static void touch(const char *path)
+{
+    FILE *fp = fopen(path, "w");
+    if (fp != NULL) {
+        fclose(fp);
+    }
+}
+
+
+static void testincpath(void)
+{
+    incpath_t *inc;
+    incpath_file_t *x, *y, *z, *w;
+    cstring_t name, from;
+
+    mkdir("incpath.tmp", 0755);
+    mkdir("incpath.tmp/a", 0755);
+    mkdir("incpath.tmp/b", 0755);
+    mkdir("incpath.tmp/b/sub", 0755);
+    touch("incpath.tmp/a/x.h");
+    touch("incpath.tmp/b/x.h");
+    touch("incpath.tmp/b/y.h");
+    touch("incpath.tmp/b/sub/z.h");
+
+    inc = incpath_create();
+    TEST_COND("incpath_create()", inc != NULL);
+
+    incpath_add(inc, "incpath.tmp/a");
+    incpath_add(inc, "incpath.tmp/b");
+    TEST_COND("incpath_count()", incpath_count(inc) == 2);
+
+    name = cstring_new("x.h");
+    x = incpath_resolve(inc, name, NULL, 0);
+    TEST_COND("incpath_resolve() first directory",
+        x != NULL && strcmp((const char *) x->path, "incpath.tmp/a/x.h") == 0);
+    TEST_COND("incpath_resolve() remembers", incpath_resolve(inc, name, NULL, 0) == x);
+
+    y = incpath_resolve(inc, name, NULL, 1);
+    TEST_COND("incpath_resolve() from the search index",
+        y != NULL && strcmp((const char *) y->path, "incpath.tmp/b/x.h") == 0);
+    TEST_COND("incpath_resolve() identities differ",
+        cstring_compare(x->identity, y->identity) != 0);
+    cstring_free(name);
+
+    name = cstring_new("sub/z.h");
+    z = incpath_resolve(inc, name, NULL, 0);
+    TEST_COND("incpath_resolve() below a directory",
+        z != NULL && strcmp((const char *) z->path, "incpath.tmp/b/sub/z.h") == 0);
+    cstring_free(name);
+
+    name = cstring_new("y.h");
+    from = cstring_new("incpath.tmp/b/");
+    y = incpath_resolve(inc, name, from, 0);
+    TEST_COND("incpath_resolve() next to the includer",
+        y != NULL && strcmp((const char *) y->path, "incpath.tmp/b/y.h") == 0);
+    cstring_free(from);
+
+    from = cstring_new("incpath.tmp/b/sub/");
+    w = incpath_resolve(inc, name, from, 0);
+    TEST_COND("incpath_resolve() falls back to the search path", w == y);
+    cstring_free(from);
+    cstring_free(name);
+
+    name = cstring_new("w.h");
+    TEST_COND("incpath_resolve() miss", incpath_resolve(inc, name, NULL, 0) == NULL);
+
+    /* a miss is remembered, the file system is not asked again */
+    touch("incpath.tmp/a/w.h");
+    TEST_COND("incpath_resolve() miss remembered", incpath_resolve(inc, name, NULL, 0) == NULL);
+
+    /* until it is told to look again */
+    TEST_COND("incpath_refresh()", incpath_refresh(inc));
+    w = incpath_resolve(inc, name, NULL, 0);
+    TEST_COND("incpath_refresh() finds the new file",
+        w != NULL && strcmp((const char *) w->path, "incpath.tmp/a/w.h") == 0);
+    TEST_COND("incpath_refresh() nothing changed", !incpath_refresh(inc));
+    TEST_COND("incpath_refresh() keeps a hit", incpath_resolve(inc, name, NULL, 0) == w);
+    cstring_free(name);
+
+    name = cstring_new("sub");
+    TEST_COND("incpath_resolve() not a file", incpath_resolve(inc, name, NULL, 1) == NULL);
+    cstring_free(name);
+
+    incpath_destroy(inc);
+
+    inc = incpath_create();
+    incpath_add(inc, "incpath.tmp/a");
+    incpath_add_system(inc, "incpath.tmp/b");
+
+    name = cstring_new("y.h");
+    y = incpath_resolve(inc, name, NULL, 0);
+    TEST_COND("incpath_add_system()", y != NULL && y->system);
+    cstring_free(name);
+
+    name = cstring_new("x.h");
+    x = incpath_resolve(inc, name, NULL, 0);
+    TEST_COND("incpath_add() not a system directory", x != NULL && !x->system);
+    cstring_free(name);
+
+    incpath_destroy(inc);
+
+    remove("incpath.tmp/a/w.h");
+    remove("incpath.tmp/a/x.h");
+    remove("incpath.tmp/b/x.h");
+    remove("incpath.tmp/b/y.h");
+    remove("incpath.tmp/b/sub/z.h");
+    rmdir("incpath.tmp/b/sub");
+    rmdir("incpath.tmp/a");
+    rmdir("incpath.tmp/b");
+    rmdir("incpath.tmp");
+}
+
+
+int main(void)
+{
+#ifdef WIN32
+    _CrtSetDbgFlag(_CrtSetDbgFlag(_CRTDBG_REPORT_FLAG) | _CRTDBG_LEAK_CHECK_DF);
+#endif
+
+    testincpath();
+    TEST_REPORT();
+    return 0;
+}
@@ -0,0 +1,329 @@
+
+
+#include "config.h"
+#include "unittest.h"
+#include "cstring.h"
+#include "array.h"
+#include "srcloc.h"
+#include "option.h"
+#include "token.h"
+#include "diagnostor.h"
+#include "reader.h"
+#include "lexer.h"
+#include "preprocessor.h"
+#include "incremental.h"
+
+
+#define TEST_HEADER     "testincremental.h.tmp"
+
+
+static const char *__text__ =
+    "#define N 1\n"
+    "#define F(x) (x + N)\n"
+    "int a = N;\n"
+    "int b = F(2);\n"
+    "#ifdef N\n"
+    "int c = F(N);\n"
+    "#else\n"
+    "int c = 0;\n"
+    "#endif\n"
+    "int d = F(\n"
+    "  3);\n"
+    "/* a comment\n"
+    "   over lines */ int e;\n"
+    "#define M N\n"
+    "int f = M;\n"
+    "int g;\n"
+    "int h = F(M);\n"
+    "#undef M\n"
+    "int i = M;\n";
+
+
+/**
+ * The tokens out, each preceded by its spaces and followed by the line
+ * and column of where it was used.
+ **/
+static cstring_t __render__(array_t *tokens)
+{
+    token_t **toks;
+    cstring_t cs;
+    size_t i, line, column;
+
+    cs = cstring_new_n(NULL, 64);
+    toks = array_prototype(tokens, token_t*);
+
+    for (i = 0; i < array_length(tokens); i++) {
+        if (toks[i]->type == TOKEN_EOF) {
+            continue;
+        }
+
+        if (toks[i]->type == TOKEN_NEWLINE) {
+            cs = cstring_concat_ch(cs, '\n');
+            continue;
+        }
+
+        srcloc_resolve(srcloc_expansion(toks[i]->loc), NULL, &line, &column, NULL);
+        cs = cstring_concat_pf(cs, "%s%s@%lu:%lu", toks[i]->spaces ? " " : "",
+                               token_as_text(toks[i]), (unsigned long) line, (unsigned long) column);
+    }
+
+    return cs;
+}
+
+
+/* what a session made from scratch of the text of inc comes to */
+static bool __same_as_fresh__(incremental_t *inc)
+{
+    incremental_t *fresh;
+    cstring_t cs1, cs2;
+    bool same;
+
+    fresh = incremental_create(inc->fn);
+    incremental_set_text(fresh, inc->text, cstring_length(inc->text));
+
+    cs1 = __render__(inc->output);
+    cs2 = __render__(fresh->output);
+    same = cstring_compare_cs(cs1, cs2) == 0;
+
+    if (!same) {
+        fprintf(stderr, "incremental:\n%s\nfresh:\n%s\n", cs1, cs2);
+    }
+
+    cstring_free(cs1);
+    cstring_free(cs2);
+    incremental_destroy(fresh);
+    return same;
+}
+
+
+static bool __edit__(incremental_t *inc, const char *at, const char *remove, const char *insert)
+{
+    const char *text = (const char *) inc->text;
+    const char *p = strstr(text, at);
+    size_t start;
+
+    if (p == NULL) {
+        return false;
+    }
+
+    start = (size_t) (p - text) + strlen(at);
+    return incremental_edit(inc, start, start + strlen(remove), insert, strlen(insert)) &&
+           __same_as_fresh__(inc);
+}
+
+
+static void test_incremental_set_text(void)
+{
+    incremental_t *inc;
+    preprocessor_t *pp;
+    lexer_t *lexer;
+    array_t *tokens;
+    token_t *token;
+    cstring_t cs1, cs2;
+
+    inc = incremental_create("<string>");
+    incremental_set_text(inc, __text__, strlen(__text__));
+
+    lexer = lexer_create();
+    lexer_push(lexer, STREAM_TYPE_STRING, (const unsigned char *) __text__);
+    pp = preprocessor_create(lexer);
+    tokens = array_create(sizeof(token_t*));
+
+    for (;;) {
+        token = preprocessor_expand(pp);
+        if (token->type == TOKEN_END) {
+            token_destroy(token);
+            break;
+        }
+
+        array_cast_append(token_t*, tokens, token);
+    }
+
+    cs1 = __render__(inc->output);
+    cs2 = __render__(tokens);
+    TEST_COND("incremental_set_text()", cstring_compare_cs(cs1, cs2) == 0);
+    TEST_COND("incremental_set_text() checkpoints", inc->replayed && array_length(inc->checkpoints) > 10);
+
+    cstring_free(cs1);
+    cstring_free(cs2);
+    tokens_free(tokens);
+    preprocessor_destroy(pp);
+    lexer_destroy(lexer);
+
+    incremental_set_text(inc, "int a;\n/* open", 14);
+    TEST_COND("incremental_set_text() lexing to report", !inc->replayed && array_length(inc->output) == 5);
+    TEST_COND("incremental_edit() lexing to report", incremental_edit(inc, 7, 14, "int b;", 6) &&
+                                                     inc->replayed && __same_as_fresh__(inc));
+
+    incremental_destroy(inc);
+}
+
+
+static void test_incremental_edit(void)
+{
+    incremental_t *inc;
+
+    inc = incremental_create("<string>");
+    incremental_set_text(inc, __text__, strlen(__text__));
+
+    TEST_COND("incremental_edit() range", !incremental_edit(inc, 3, 2, "", 0) &&
+                                         !incremental_edit(inc, 0, strlen(__text__) + 1, "", 0));
+
+    TEST_COND("incremental_edit() a line", __edit__(inc, "int a", "", "a"));
+    TEST_COND("incremental_edit() reuses the rest", inc->reused > 5 && inc->expanded <= 2 && inc->relexed < 10);
+
+    TEST_COND("incremental_edit() a macro", __edit__(inc, "#define N ", "1", "2"));
+    TEST_COND("incremental_edit() its uses read again", inc->expanded > 5);
+
+    TEST_COND("incremental_edit() a macro spelled alike", __edit__(inc, "#define N 2", "", " "));
+    TEST_COND("incremental_edit() alike reused", inc->reused > 10);
+
+    TEST_COND("incremental_edit() a #define", __edit__(inc, "int g;\n", "", "#define g G\n"));
+    TEST_COND("incremental_edit() a line gone", __edit__(inc, "int f = M;\n", "int g;\n", ""));
+    TEST_COND("incremental_edit() a comment opened", __edit__(inc, "int b", "", "/*"));
+    TEST_COND("incremental_edit() a comment closed", __edit__(inc, "int b/*", "", "*/"));
+    TEST_COND("incremental_edit() an #if 0", __edit__(inc, "int a", "", "\n#if 0\n"));
+    TEST_COND("incremental_edit() its #endif", __edit__(inc, "int c = 0;\n", "", "#endif\n"));
+    TEST_COND("incremental_edit() an #undef", __edit__(inc, "int d", "", "\n#undef F\n"));
+    TEST_COND("incremental_edit() the start", __edit__(inc, "", "", "int z;\n"));
+    TEST_COND("incremental_edit() the end", __edit__(inc, "int i = M;\n", "", "int j = N"));
+    TEST_COND("incremental_edit() the end again", __edit__(inc, "int j = N", "", ";\n"));
+    TEST_COND("incremental_edit() CRLF", __edit__(inc, "int z;", "\n", "\r\n"));
+    TEST_COND("incremental_edit() CRLF joined", __edit__(inc, "int z;\r", "\n", "") &&
+                                                 __edit__(inc, "int z;\r", "", "\n"));
+    TEST_COND("incremental_edit() a line spliced", __edit__(inc, "  3)", "", "\\\n"));
+    TEST_COND("incremental_edit() all of it", incremental_edit(inc, 0, cstring_length(inc->text), "x", 1) &&
+                                             __same_as_fresh__(inc));
+
+    incremental_destroy(inc);
+}
+
+
+static void test_incremental_include(void)
+{
+    incremental_t *inc;
+    const char *text = "int a;\n#include \"" TEST_HEADER "\"\nint b = H;\n";
+
+    __write_file__(TEST_HEADER, "#define H 1\nint h;\n#pragma once\n", 1);
+
+    inc = incremental_create("testincremental.c.tmp");
+    incremental_set_text(inc, text, strlen(text));
+
+    TEST_COND("incremental_edit() before an #include", __edit__(inc, "int a", "", "a"));
+    TEST_COND("incremental_edit() the #include read again", inc->expanded >= 2);
+    TEST_COND("incremental_edit() an #include", __edit__(inc, "int b = H;\n", "", "#include \"" TEST_HEADER "\"\n"));
+    TEST_COND("incremental_edit() after an #include", __edit__(inc, "int b = H", "", "+H"));
+
+    incremental_destroy(inc);
+    remove(TEST_HEADER);
+}
+
+
+static void test_incremental_corners(void)
+{
+    incremental_t *inc;
+
+    inc = incremental_create("<string>");
+
+    incremental_set_text(inc, "\\\n", 2);
+    TEST_COND("incremental_edit() after a splice at the end", __edit__(inc, "\\\n", "", "*/"));
+
+    incremental_set_text(inc, "#define F()\n#ifdef F\nF(\n#endif\n#else\n", 37);
+    TEST_COND("incremental_edit() a condition left open", __edit__(inc, "#ifdef", " F", ""));
+
+    incremental_set_text(inc, "#define N M\nN\n", 14);
+    TEST_COND("incremental_edit() spaces before a body", __edit__(inc, "#define N", "", " "));
+
+    incremental_destroy(inc);
+}
+
+
+static void test_incremental_diagnostics(void)
+{
+    static const char text[] = "#error 1\n#error 2\n#error 3\n#error 4\n#error 5\n#error 6\nint x;\n";
+    incremental_t *inc;
+    size_t nerrors = diagnostor->nerrors;
+
+    inc = incremental_create("<string>");
+
+    /* past -ferror-limit, and none of it in the diagnostor of the caller */
+    incremental_set_text(inc, text, sizeof(text) - 1);
+    TEST_COND("incremental_set_text() past the error limit",
+              inc->diag->nerrors == 6 && array_length(inc->diag->queue) == 6 &&
+              diagnostor->nerrors == nerrors);
+
+    TEST_COND("incremental_edit() reports the errors again", __edit__(inc, "int", " x", "y") &&
+              inc->diag->nerrors == 6 && inc->reused == 0);
+
+    incremental_set_text(inc, "#define N\nint x;\n", 17);
+    TEST_COND("incremental_set_text() counts its own run", inc->diag->nerrors == 0);
+
+    TEST_COND("incremental_edit() an error made", __edit__(inc, "", "", "#error e\n") &&
+              inc->diag->nerrors == 1);
+    TEST_COND("incremental_edit() counts its own run", __edit__(inc, "", "#error e\n", "") &&
+              inc->diag->nerrors == 0);
+
+    incremental_destroy(inc);
+}
+
+
+static void test_incremental_fuzz(void)
+{
+    static const char *snippets[] = {
+        "\n", "N", "M", "F(", ")", "F(1)", "#define N 3\n", "#define M F\n",
+        "#undef N\n", "#ifdef N\n", "#ifndef M\n", "#else\n", "#endif\n", "#if N\n",
+        "/*", "*/", "\"", " ", "int x;", "\\\n", "#define F(a, b) a ## b\n", "\r\n",
+    };
+    incremental_t *inc;
+    size_t i, start, end, length, failed = 0, reused = 0;
+    const char *s;
+
+    srand(20261014);
+
+    inc = incremental_create("<string>");
+    incremental_set_text(inc, __text__, strlen(__text__));
+
+    for (i = 0; i < 400; i++) {
+        length = cstring_length(inc->text);
+        start = length != 0 ? (size_t) rand() % length : 0;
+        end = start + (rand() % 4 == 0 ? (size_t) rand() % 8 : 0);
+        if (end > length) {
+            end = length;
+        }
+
+        s = rand() % 3 == 0 ? "" : snippets[(size_t) rand() % (sizeof(snippets) / sizeof(snippets[0]))];
+
+        if (!incremental_edit(inc, start, end, s, strlen(s)) || !__same_as_fresh__(inc)) {
+            failed++;
+        }
+
+        reused += inc->reused;
+
+        /* the text stays about the size it began with */
+        if (cstring_length(inc->text) > 2 * strlen(__text__)) {
+            incremental_set_text(inc, __text__, strlen(__text__));
+        }
+    }
+
+    TEST_COND("incremental_edit() random edits", failed == 0);
+    TEST_COND("incremental_edit() random edits reuse", reused > 0);
+
+    incremental_destroy(inc);
+}
+
+
+int main(void)
+{
+#ifdef WIN32
+    _CrtSetDbgFlag(_CrtSetDbgFlag(_CRTDBG_REPORT_FLAG) | _CRTDBG_LEAK_CHECK_DF);
+#endif
+
+    test_incremental_set_text();
+    test_incremental_edit();
+    test_incremental_include();
+    test_incremental_corners();
+    test_incremental_diagnostics();
+    test_incremental_fuzz();
+    TEST_REPORT();
+    return 0;
+}
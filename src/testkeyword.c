@@ -0,0 +1,104 @@
+
+
+#include "config.h"
+#include "token.h"
+#include "keyword.h"
+#include "unittest.h"
+
+
+typedef struct expect_s {
+    const char *spelling;
+    token_type_t type;
+} expect_t;
+
+
+static const expect_t __keywords__[] = {
+#define KEYWORD(s, t)       {#s, t},
+#define DIRECTIVE(s, t)
+#include "keyword.def"
+#undef  KEYWORD
+#undef  DIRECTIVE
+};
+
+
+static const expect_t __directives__[] = {
+#define KEYWORD(s, t)
+#define DIRECTIVE(s, t)     {#s, t},
+#include "keyword.def"
+#undef  KEYWORD
+#undef  DIRECTIVE
+};
+
+
+#define LOOKUP(fn, s)                                                   \
+    fn((const unsigned char *) (s), strlen(s))
+
+
+static void test_keyword(void)
+{
+    static const char *others[] = {
+        "", "i", "in", "ints", "Int", "cons", "constant", "_Atomics",
+        "__attribute", "define", "ifdef", "main", "_", "sizeo", NULL
+    };
+    size_t i;
+    bool all = true;
+
+    for (i = 0; i < sizeof(__keywords__) / sizeof(__keywords__[0]); i++) {
+        if (LOOKUP(keyword_lookup, __keywords__[i].spelling) != __keywords__[i].type) {
+            all = false;
+        }
+    }
+    TEST_COND("keyword_lookup() keyword.def", all);
+
+    TEST_COND("keyword_lookup(int)", LOOKUP(keyword_lookup, "int") == TOKEN_INT);
+    TEST_COND("keyword_lookup(char)", LOOKUP(keyword_lookup, "char") == TOKEN_CHAR);
+    TEST_COND("keyword_lookup(_Static_assert)",
+              LOOKUP(keyword_lookup, "_Static_assert") == TOKEN_STATIC_ASSERT);
+
+    for (i = 0; others[i] != NULL; i++) {
+        TEST_COND("keyword_lookup() non keyword",
+                  LOOKUP(keyword_lookup, others[i]) == TOKEN_UNKNOWN);
+    }
+
+    /* only the first n bytes are looked at */
+    TEST_COND("keyword_lookup() prefix",
+              keyword_lookup((const unsigned char *) "while(", 5) == TOKEN_WHILE);
+}
+
+
+static void test_directive(void)
+{
+    static const char *others[] = {
+        "", "i", "int", "defined", "includ", "include_next", "Define", NULL
+    };
+    size_t i;
+    bool all = true;
+
+    for (i = 0; i < sizeof(__directives__) / sizeof(__directives__[0]); i++) {
+        if (LOOKUP(directive_lookup, __directives__[i].spelling) != __directives__[i].type) {
+            all = false;
+        }
+    }
+    TEST_COND("directive_lookup() keyword.def", all);
+
+    TEST_COND("directive_lookup(if)", LOOKUP(directive_lookup, "if") == TOKEN_PP_IF);
+    TEST_COND("directive_lookup(define)", LOOKUP(directive_lookup, "define") == TOKEN_PP_DEFINE);
+
+    for (i = 0; others[i] != NULL; i++) {
+        TEST_COND("directive_lookup() non directive",
+                  LOOKUP(directive_lookup, others[i]) == TOKEN_UNKNOWN);
+    }
+}
+
+
+int main(void)
+{
+#ifdef WIN32
+    _CrtSetDbgFlag(_CrtSetDbgFlag(_CRTDBG_REPORT_FLAG) | _CRTDBG_LEAK_CHECK_DF);
+#endif
+
+    test_keyword();
+    test_directive();
+    TEST_REPORT();
+    return 0;
+}
@@ -6,9 +6,26 @@
 #include "reader.h"
 #include "lexer.h"
 #include "dict.h"
+#include "arena.h"
+#include "option.h"
 #include "unittest.h"
 
 
+#define TEST_LEXER_TOKENIZE_FILE    "testlexer.tokenize.tmp"
+#define TEST_LEXER_TOKENIZE_SIZE    (3 * 1024 * 1024 / 2)
+#define TEST_LEXER_RUNS_FILE        "testlexer.runs.tmp"
+
+
+/* the offset into its buffer, which two lexers each have a range for */
+static size_t __offset__(token_t *token)
+{
+    size_t offset = 0;
+
+    srcloc_buffer(token->loc, &offset);
+    return offset;
+}
+
+
 static void test_restore_text(void)
 {
     lexer_t *lexer;
@@ -57,7 +74,7 @@ static void test_lexer(void)
         }
 
         if (token->type == TOKEN_COMMENT) {
-            printf("%s\n", token->cs);
+            printf("%s\n", token_cs(token));
         } else {
             printf("%s\n", token_as_name(token));
         }
@@ -67,6 +84,431 @@ static void test_lexer(void)
 }
 
 
+static void test_lexer_arena(void)
+{
+    static const char *text =
+        "int main(void) { return L\"wide\" 'c' 0x1fUL; } // tail\n"
+        "u8x us 1e+5 .5f ab\\\ncd 12\\\n34 \"a\\tb\" \"\" \"x\\\ny\" end\n";
+    lexer_t *pooled, *heap;
+    token_t *a, *b;
+    token_type_t type;
+    bool same = true, owned = true;
+
+    pooled = lexer_create();
+    heap = lexer_create();
+    lexer_set_arena(heap, NULL);
+
+    lexer_push(pooled, STREAM_TYPE_STRING, text);
+    lexer_push(heap, STREAM_TYPE_STRING, text);
+
+    do {
+        a = lexer_scan(pooled);
+        b = lexer_scan(heap);
+
+        if (a->type != b->type || cstring_compare_cs(token_cs(a), token_cs(b)) != 0 ||
+            __offset__(a) != __offset__(b)) {
+            same = false;
+        }
+
+        if (a->arena == NULL || b->arena != NULL) {
+            owned = false;
+        }
+
+        type = a->type;
+        token_destroy(a);
+        token_destroy(b);
+    } while (type != TOKEN_END);
+
+    TEST_COND("lexer_scan() arena tokens match heap tokens", same);
+    TEST_COND("lexer_set_arena()", owned);
+    TEST_COND("lexer arena used", arena_allocated(pooled->arena) > 0);
+
+    lexer_destroy(pooled);
+    lexer_destroy(heap);
+}
+
+
+static void test_lexer_slice(void)
+{
+    static const char *expect[] = {
+        "foo", "0x1f", "wide", "x\ty", "ab", "1e+5", NULL
+    };
+    static const bool sliced[] = {
+        true, true, true, false, false, true
+    };
+    lexer_t *lexer;
+    token_t *token;
+    const unsigned char *spelling;
+    size_t length, i = 0;
+
+    lexer = lexer_create();
+    lexer_push(lexer, STREAM_TYPE_STRING, "foo 0x1f L\"wide\" \"x\\ty\" a\\\nb 1e+5");
+
+    while ((token = lexer_scan(lexer))->type != TOKEN_END) {
+        if (token->type == TOKEN_SPACE || token->type == TOKEN_EOF ||
+            token->type == TOKEN_NEWLINE || expect[i] == NULL) {
+            continue;
+        }
+
+        spelling = token_spelling(token, &length);
+        TEST_COND("token_spelling()", length == strlen(expect[i]) &&
+                                      memcmp(spelling, expect[i], length) == 0);
+        TEST_COND("lexer_scan() slices", (token->cs == NULL) == sliced[i]);
+        TEST_COND("token_cs()", cstring_compare(token_cs(token), expect[i]) == 0);
+        i++;
+    }
+
+    TEST_COND("lexer_scan() all spellings seen", expect[i] == NULL);
+
+    lexer_destroy(lexer);
+}
+
+
+/* the tokens lexed, runs handed back to be read as the tokens in them */
+static cstring_t __lex_runs__(bool runs)
+{
+    lexer_t *lexer;
+    token_t *token;
+    const unsigned char *spelling;
+    cstring_t cs;
+    size_t n, line, column;
+
+    cs = cstring_new_n(NULL, 256);
+    lexer = lexer_create();
+    lexer->runs = runs;
+    lexer_push(lexer, STREAM_TYPE_FILE, (const unsigned char *) TEST_LEXER_RUNS_FILE);
+
+    while ((token = lexer_get(lexer))->type != TOKEN_END) {
+        if (token->type == TOKEN_NUMBER_RUN) {
+            lexer_unget(lexer, token);
+            continue;
+        }
+
+        spelling = token_spelling(token, &n);
+        srcloc_resolve(token->loc, NULL, &line, &column, NULL);
+        cs = cstring_concat_pf(cs, "%d:%.*s:%lu@%lu:%lu:%d ", (int) token->type, (int) n,
+                               spelling != NULL ? (const char *) spelling : "",
+                               (unsigned long) token->spaces, (unsigned long) line,
+                               (unsigned long) column, (int) token->begin_of_line);
+    }
+
+    lexer_destroy(lexer);
+    return cs;
+}
+
+
+static void test_lexer_runs(void)
+{
+    static const char *text =
+        "int t[] = { 1, 2, 0x3, 4u , 5,6, 07, 8,  9, N, 10 };\n"
+        "  10, 11, 12, 13, 14, 15, 16, 17\n"
+        "x = 1, 2, 3;\n"
+        "y = 1, 2, 3, 4, 5, 6, 7, 1.5, 8, 9, 10, 11, 12, 13, 14;\n";
+    static const uint64_t values[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+    lexer_t *lexer;
+    token_t *token;
+    const unsigned char *spelling;
+    size_t n, runs = 0;
+    cstring_t cs1, cs2;
+    bool decoded = false, after = false, line = false;
+
+    /* a file is read clean, the number a line ends in may end a run */
+    __write_file__(TEST_LEXER_RUNS_FILE, text, 1);
+
+    lexer = lexer_create();
+    lexer->runs = true;
+    lexer_push(lexer, STREAM_TYPE_FILE, (const unsigned char *) TEST_LEXER_RUNS_FILE);
+
+    while ((token = lexer_scan(lexer))->type != TOKEN_END) {
+        if (token->type != TOKEN_NUMBER_RUN) {
+            continue;
+        }
+
+        spelling = token_spelling(token, &n);
+        if (runs++ == 0) {
+            decoded = token->run->length == 9 &&
+                      memcmp(token->run->values, values, sizeof(values)) == 0 &&
+                      n == 30 && memcmp(spelling, "1, 2, 0x3, 4u , 5,6, 07, 8,  9", n) == 0;
+            after = lexer_scan(lexer)->type == TOKEN_COMMA &&
+                    lexer_scan(lexer)->type == TOKEN_IDENTIFIER;
+        } else {
+            line = token->begin_of_line && token->spaces == 2 &&
+                   token->run->length == 8 && token->run->values[7] == 17;
+        }
+    }
+
+    TEST_COND("lexer_scan() runs", runs == 2);
+    TEST_COND("lexer_scan() run decoded", decoded);
+    TEST_COND("lexer_scan() run ends before a name", after);
+    TEST_COND("lexer_scan() run starts a line", line);
+
+    lexer_destroy(lexer);
+
+    cs1 = __lex_runs__(false);
+    cs2 = __lex_runs__(true);
+    TEST_COND("lexer_unget() run", cstring_compare_cs(cs1, cs2) == 0);
+
+    cstring_free(cs1);
+    cstring_free(cs2);
+    remove(TEST_LEXER_RUNS_FILE);
+}
+
+
+static void test_lexer_keyword(void)
+{
+    lexer_t *lexer;
+    token_t *token;
+
+    lexer = lexer_create();
+    lexer_push(lexer, STREAM_TYPE_STRING, "while whilst wh\\\nile");
+
+    token = lexer_scan(lexer);
+    TEST_COND("lexer_scan() keyword", token->type == TOKEN_IDENTIFIER &&
+                                      token->keyword == TOKEN_WHILE);
+    token = lexer_scan(lexer);
+    TEST_COND("lexer_scan() not keyword", token->keyword == TOKEN_UNKNOWN);
+    token = lexer_scan(lexer);
+    TEST_COND("lexer_scan() spliced keyword", token->keyword == TOKEN_WHILE);
+
+    lexer_destroy(lexer);
+}
+
+
+static void test_lexer_punctuator(void)
+{
+    static const token_type_t expect[] = {
+        TOKEN_ELLIPSIS, TOKEN_PERIOD, TOKEN_PERIOD, TOKEN_GREATERGREATEREQUAL,
+        TOKEN_GREATERGREATER, TOKEN_GREATEREQUAL, TOKEN_EXCLAIMEQUAL,
+        TOKEN_EXCLAIM, TOKEN_HASHHASH, TOKEN_HASH, TOKEN_PERCENT,
+        TOKEN_L_SQUARE, TOKEN_R_SQUARE, TOKEN_L_BRACE, TOKEN_R_BRACE,
+        TOKEN_ARROW, TOKEN_MINUSMINUS, TOKEN_MINUS, TOKEN_LESSLESSEQUAL,
+        TOKEN_PIPEPIPE, TOKEN_AMPEQUAL, TOKEN_GREATERGREATEREQUAL,
+        TOKEN_PERIOD, TOKEN_PERIOD, TOKEN_SLASHEQUAL, TOKEN_END
+    };
+    lexer_t *lexer;
+    token_t *token;
+    size_t i = 0;
+    bool same = true;
+
+    lexer = lexer_create();
+    lexer_push(lexer, STREAM_TYPE_STRING,
+               "... .. >>= >> >= != ! %:%: %:% <: :> <% %> -> -- - <<= || &= "
+               ">\\\n>= .\\\n. /=");
+
+    do {
+        token = lexer_scan(lexer);
+        if (token->type == TOKEN_SPACE || token->type == TOKEN_EOF ||
+            token->type == TOKEN_NEWLINE) {
+            continue;
+        }
+        if (i >= sizeof(expect) / sizeof(expect[0]) || token->type != expect[i]) {
+            same = false;
+        }
+        i++;
+    } while (token->type != TOKEN_END);
+
+    TEST_COND("lexer_scan() punctuators", same && i == sizeof(expect) / sizeof(expect[0]));
+
+    lexer_destroy(lexer);
+}
+
+
+static void test_lexer_comment(void)
+{
+    static const char *expect[] = {
+        "/* a * b ** c */",
+        "/*/ still open */",
+        "/**/",
+        "/*****************************************************************\n"
+        " * banner banner banner banner banner banner banner banner banner\n"
+        " *****************************************************************/",
+        "/* spliced */",
+        "// line continued",
+        NULL
+    };
+    lexer_t *lexer;
+    token_t *token;
+    size_t i = 0, spaces = 0;
+    bool reserve = option_get(reserve_comment);
+
+    option->reserve_comment = true;
+
+    lexer = lexer_create();
+    lexer_set_trivia(lexer, true);
+    lexer_push(lexer, STREAM_TYPE_STRING,
+               "/* a * b ** c */x /*/ still open *//**/"
+               "/*****************************************************************\n"
+               " * banner banner banner banner banner banner banner banner banner\n"
+               " *****************************************************************/"
+               "                                        \t\t"
+               "/* spliced *\\\n/// line \\\ncontinued\n");
+
+    do {
+        token = lexer_scan(lexer);
+        if (token->type == TOKEN_SPACE) {
+            spaces = token->spaces > spaces ? token->spaces : spaces;
+        }
+        if (token->type == TOKEN_COMMENT) {
+            TEST_COND("lexer_scan() comment", expect[i] != NULL &&
+                                              cstring_compare(token_cs(token), expect[i]) == 0);
+            if (expect[i] != NULL) {
+                i++;
+            }
+        }
+    } while (token->type != TOKEN_END);
+
+    TEST_COND("lexer_scan() all comments seen", expect[i] == NULL);
+    TEST_COND("lexer_scan() long space run", spaces == 42);
+
+    lexer_destroy(lexer);
+
+    option->reserve_comment = false;
+
+    lexer = lexer_create();
+    lexer_set_trivia(lexer, true);
+    lexer_push(lexer, STREAM_TYPE_STRING, "/* a *\\\n/b/* * / */c");
+
+    token = lexer_scan(lexer);
+    TEST_COND("lexer_scan() comment not reserved", token->type == TOKEN_COMMENT &&
+                                                   cstring_length(token_cs(token)) == 0);
+    token = lexer_scan(lexer);
+    TEST_COND("lexer_scan() after spliced terminator", token->type == TOKEN_IDENTIFIER &&
+                                                       cstring_compare(token_cs(token), "b") == 0);
+    token = lexer_scan(lexer);
+    token = lexer_scan(lexer);
+    TEST_COND("lexer_scan() after comment", cstring_compare(token_cs(token), "c") == 0);
+
+    lexer_destroy(lexer);
+
+    option->reserve_comment = reserve;
+}
+
+
+static void test_lexer_trivia(void)
+{
+    static const struct {
+        token_type_t type;
+        size_t spaces;
+        bool begin_of_line;
+    } expect[] = {
+        {TOKEN_IDENTIFIER,  0, true},
+        {TOKEN_IDENTIFIER,  4, false},
+        {TOKEN_NEWLINE,     0, false},
+        {TOKEN_HASH,        3, true},
+        {TOKEN_IDENTIFIER,  1, false},
+        {TOKEN_NEWLINE,     2, false},
+        {TOKEN_NUMBER,      0, true},
+        {TOKEN_NEWLINE,     0, false},
+        {TOKEN_EOF,         0, true},
+        {TOKEN_END,         0, true},
+    };
+    lexer_t *lexer;
+    token_t *token;
+    size_t i = 0;
+    bool same = true;
+
+    lexer = lexer_create();
+    lexer_set_trivia(lexer, false);
+    lexer_push(lexer, STREAM_TYPE_STRING,
+               "a  /* c */ b\n /**/ # x // note\n1\n");
+
+    do {
+        token = lexer_scan(lexer);
+        if (i >= sizeof(expect) / sizeof(expect[0]) ||
+            token->type != expect[i].type ||
+            token->spaces != expect[i].spaces ||
+            token->begin_of_line != expect[i].begin_of_line) {
+            same = false;
+        }
+        i++;
+    } while (token->type != TOKEN_END);
+
+    TEST_COND("lexer_scan() without trivia", same && i == sizeof(expect) / sizeof(expect[0]));
+
+    lexer_destroy(lexer);
+}
+
+
+/**
+ * lexer_tokenize() of a file far above LEXER_PARALLEL_MIN must give what
+ * lexer_scan() gives one token at a time.
+ **/
+static bool __same_tokenize__(const char *text, bool trivia)
+{
+    lexer_t *serial, *parallel;
+    array_t *tokens;
+    token_t *a, *b;
+    const unsigned char *sa, *sb;
+    size_t i, na, nb;
+    bool same = true;
+
+    if (!__write_file__(TEST_LEXER_TOKENIZE_FILE, text,
+                        (TEST_LEXER_TOKENIZE_SIZE + strlen(text) - 1) / strlen(text))) {
+        return false;
+    }
+
+    serial = lexer_create();
+    parallel = lexer_create();
+    lexer_set_trivia(serial, trivia);
+    lexer_set_trivia(parallel, trivia);
+    lexer_push(serial, STREAM_TYPE_FILE, TEST_LEXER_TOKENIZE_FILE);
+    lexer_push(parallel, STREAM_TYPE_FILE, TEST_LEXER_TOKENIZE_FILE);
+
+    tokens = lexer_tokenize(parallel);
+
+    for (i = 0; same; i++) {
+        a = lexer_scan(serial);
+        if (a->type == TOKEN_EOF) {
+            same = i == array_length(tokens);
+            break;
+        }
+
+        if (i >= array_length(tokens)) {
+            same = false;
+            break;
+        }
+
+        b = array_cast_at(token_t*, tokens, i);
+        sa = token_spelling(a, &na);
+        sb = token_spelling(b, &nb);
+
+        same = a->type == b->type &&
+               __offset__(a) == __offset__(b) &&
+               a->spaces == b->spaces &&
+               a->begin_of_line == b->begin_of_line &&
+               na == nb && memcmp(sa, sb, na) == 0;
+    }
+
+    same = same && lexer_scan(parallel)->type == TOKEN_END;
+
+    array_destroy(tokens);
+    lexer_destroy(serial);
+    lexer_destroy(parallel);
+    remove(TEST_LEXER_TOKENIZE_FILE);
+    return same;
+}
+
+
+static void test_lexer_tokenize(void)
+{
+    TEST_COND("lexer_tokenize() code", __same_tokenize__(
+        "int main(int argc, char **argv) {\r\n"
+        "    return f(argc, \"str\\n\", 'c') + 0x1f;\\\n"
+        "}\n"
+        "#define X(a) a ## b /* note */\n", false));
+
+    /* nearly every line is inside a comment, so are the chunk starts */
+    TEST_COND("lexer_tokenize() comments", __same_tokenize__(
+        "/* open\n"
+        " * it's a line\n"
+        " * \"another\" one\n"
+        " * and a /* nested opener\n"
+        " * and more\n"
+        " */ x = 1; // tail \\\n"
+        " still the tail\n", true));
+}
+
+
 int main(void)
 {
 #ifdef WIN32
@@ -74,6 +516,14 @@ int main(void)
 #endif
 
     test_restore_text();
+    test_lexer_arena();
+    test_lexer_slice();
+    test_lexer_runs();
+    test_lexer_keyword();
+    test_lexer_punctuator();
+    test_lexer_comment();
+    test_lexer_trivia();
+    test_lexer_tokenize();
     //test_lexer();
 
     TEST_REPORT();
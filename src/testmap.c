@@ -39,6 +39,28 @@ static void testmap(void)
 }
 
 
+static void testmap_hash(void)
+{
+    cstring_t cs;
+    map_t *map;
+
+    map = map_create_swiss();
+
+    cs = cstring_new("name");
+    map_add(map, cs, (void*) 1);
+    TEST_COND("map_find() caches the hash", map_find(map, cs) == (void*) 1 && cstring_get_hash(cs) != 0);
+
+    /* a key changed after it was hashed is hashed again */
+    cs = cstring_concat_n(cs, "s", 1);
+    TEST_COND("map_has() changed key", map_has(map, cs) == false);
+    cstring_pop_ch(cs);
+    TEST_COND("map_has() changed back", map_has(map, cs) == true);
+    cstring_free(cs);
+
+    map_destroy(map);
+}
+
+
 int main(void)
 {
 #ifdef WIN32
@@ -46,6 +68,7 @@ int main(void)
 #endif
 
     testmap();
+    testmap_hash();
     TEST_REPORT();
     return 0;
 }
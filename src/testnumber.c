@@ -2,29 +2,31 @@
 
 #include "config.h"
 #include "unittest.h"
+#include "cstring.h"
+#include "token.h"
 #include "diagnostor.h"
 #include "option.h"
 #include "number.h"
-#include "token.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <limits.h>
 
 
 #define EXCEPT_INTEGER_EQ(tok, expect, num)                                                 \
     do {                                                                                    \
         number_t n;                                                                         \
         (tok)->cs = cstring_copy_n((tok)->cs, num, strlen(num));                             \
-        TEST_COND(num, parse_number(diag, &option, tok, &n)== true && n.ul == expect);      \
+        TEST_COND(num, parse_number(tok, &n)== true && n.ul == expect);      \
     } while(0)
 
 #define EXCEPT_INTEGER_NEQ(tok, expect, num)                                                \
     do {                                                                                    \
         number_t n;                                                                         \
         (tok)->cs = cstring_copy_n((tok)->cs, num, strlen(num));                             \
-        TEST_COND(num, !parse_number(diag, &option, tok, &n));                              \
+        TEST_COND(num, !parse_number(tok, &n));                              \
     } while(0)
 
 #define EXCEPT_HEX_CONST(except)    \
@@ -52,14 +54,9 @@
 static
 void test_number1()
 {
-    diag_t diag;
-    struct option_s option;
-    token_t tok;
-
-    diag = diag_create();
-    tok = token_create();
+    token_t *tok;
 
-    tok->type = TOKEN_NUMBER;
+    tok = token_create(TOKEN_NUMBER, cstring_new(""), 0);
 
     CHECK_DEC_CONST(1);
     CHECK_DEC_CONST(2);
@@ -579,36 +576,80 @@ void test_number1()
     EXCEPT_INTEGER_NEQ(tok, 0, "0b1234");
 
     token_destroy(tok);
-    diag_destroy(diag);
 }
 
 static
 void test_number2()
 {
-    diag_t diag;
-    struct option_s option;
-    token_t tok;
+    token_t *tok;
     number_t n;
+    size_t nwarnings;
 
-    diag = diag_create();
-    tok = token_create();
-
-    tok->type = TOKEN_NUMBER;
+    tok = token_create(TOKEN_NUMBER, cstring_new(""), 0);
 
     CHECK_HEX_CONST(fful);
     CHECK_HEX_CONST(ffull);
     CHECK_HEX_CONST(ffllu);
     
+    nwarnings = diagnostor->nwarnings;
     tok->cs = cstring_copy_n(tok->cs, "0xFFFFFFFFFFFFFFFFFFFFull", strlen("0xFFFFFFFFFFFFFFFFFFFFull"));
-    parse_number(diag, &option, tok, &n);
-    printf("%llu\n", n.ul);
+    TEST_COND("too large", parse_number(tok, &n) && n.ul == ULLONG_MAX &&
+                           diagnostor->nwarnings == nwarnings + 1);
     CHECK_DEP_CONST(123456, "12'3'4'56");
-    CHECK_DEP_CONST(123456, "12'3'4'56'");
+    EXCEPT_INTEGER_NEQ(tok, 0, "12'3'4'56'");
 
     token_destroy(tok);
-    diag_destroy(diag);
 }
 
+/**
+ * The spellings parse_number() takes the fast path for against strtoull()
+ * and strtold(), which the slow one ends in.
+ **/
+static
+void test_number_fast()
+{
+    token_t *tok;
+    number_t n;
+    char buf[64];
+    unsigned long long u;
+    size_t i, nint, nhex, nfloat;
+
+    tok = token_create(TOKEN_NUMBER, cstring_new(""), 0);
+
+    srand(42);
+    nint = nhex = nfloat = 0;
+
+    for (i = 0; i < 100000; i++) {
+        u = ((unsigned long long) rand() << 42) ^ ((unsigned long long) rand() << 21) ^ rand();
+        u >>= rand() % 64;
+
+        sprintf(buf, "%llu", u);
+        tok->cs = cstring_copy_n(tok->cs, buf, strlen(buf));
+        if (!parse_number(tok, &n) || n.ul != strtoull(buf, NULL, 10)) {
+            nint++;
+        }
+
+        sprintf(buf, "0x%llxu", u);
+        tok->cs = cstring_copy_n(tok->cs, buf, strlen(buf));
+        if (!parse_number(tok, &n) || n.ul != strtoull(buf, NULL, 16)) {
+            nhex++;
+        }
+
+        sprintf(buf, "%llu.%de%d", u % 10000000000ULL, rand() % 1000, rand() % 55 - 27);
+        tok->cs = cstring_copy_n(tok->cs, buf, strlen(buf));
+        if (!parse_number(tok, &n) || n.ld != strtold(buf, NULL)) {
+            nfloat++;
+        }
+    }
+
+    TEST_COND("fast decimal integers", nint == 0);
+    TEST_COND("fast hexadecimal integers", nhex == 0);
+    TEST_COND("fast decimal floats", nfloat == 0);
+
+    token_destroy(tok);
+}
+
+
 int main(void)
 {
 #ifdef WIN32
@@ -617,6 +658,7 @@ int main(void)
 
     test_number1();
     test_number2();
+    test_number_fast();
     TEST_REPORT();
     return 0;
 }
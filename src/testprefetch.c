@@ -0,0 +1,102 @@
+
+
+#include "config.h"
+#include "srcpool.h"
+#include "prefetch.h"
+#include "unittest.h"
+
+
+static void test_prefetch(void)
+{
+    const char *main_c = "#include \"testprefetch.a.tmp\"\n"
+                         "  #  include <testprefetch.b.tmp>\n"
+                         "int x; /* #include \"testprefetch.none.tmp\" */\n"
+                         "#include \"testprefetch.a.tmp\"\n";
+    const char *missing_c = "#include \"testprefetch.none.tmp\"\n"
+                            "#include <testprefetch.b.tmp>\n";
+    srcpool_t *srcpool;
+    prefetch_t *prefetch;
+    srcfile_t *file, *raced;
+
+    if (!__write_file__("testprefetch.a.tmp", "#include \"testprefetch.c.tmp\"\n", 1) ||
+        !__write_file__("testprefetch.b.tmp", "int b;\n", 1) ||
+        !__write_file__("testprefetch.c.tmp", "#include \"testprefetch.a.tmp\"\n", 1)) {
+        return;
+    }
+
+    srcpool = srcpool_create();
+    prefetch = prefetch_create(srcpool);
+    prefetch_add_path(prefetch, ".");
+
+    prefetch_push(prefetch, "testprefetch.c", (const unsigned char *) main_c, strlen(main_c));
+    prefetch_wait(prefetch);
+
+    TEST_COND("prefetch_push()", srcpool_length(srcpool) == 3);
+
+    /* the preprocessor opening a prefetched header finds it loaded */
+    file = srcpool_load(srcpool, "testprefetch.b.tmp");
+    TEST_COND("prefetch_push() serves the header", file != NULL && srcpool_length(srcpool) == 3 &&
+                                                   file->length == 7 && !memcmp(file->text, "int b;\n", 7));
+
+    /* a header changed since is loaded again, not served stale */
+    __write_file__("testprefetch.b.tmp", "int bb;\n", 1);
+    file = srcpool_load(srcpool, "testprefetch.b.tmp");
+    TEST_COND("prefetch_push() changed header", file != NULL && srcpool_length(srcpool) == 4 &&
+                                                file->length == 8 && !memcmp(file->text, "int bb;\n", 8));
+
+    prefetch_destroy(prefetch);
+    srcpool_destroy(srcpool);
+
+    /* a header not there is given up on, the later load still finds it */
+    srcpool = srcpool_create();
+    prefetch = prefetch_create(srcpool);
+    prefetch_add_path(prefetch, ".");
+
+    prefetch_push(prefetch, "testprefetch.c", (const unsigned char *) missing_c, strlen(missing_c));
+    prefetch_wait(prefetch);
+
+    TEST_COND("prefetch_push() missing header", srcpool_length(srcpool) == 1 &&
+                                                srcpool_load(srcpool, "testprefetch.none.tmp") == NULL);
+
+    __write_file__("testprefetch.none.tmp", "int none;\n", 1);
+    TEST_COND("prefetch_push() missing header loaded later",
+              srcpool_load(srcpool, "testprefetch.none.tmp") != NULL && srcpool_length(srcpool) == 2);
+
+    prefetch_destroy(prefetch);
+    srcpool_destroy(srcpool);
+
+    /* a load racing the prefetcher for the header ends up with the one srcfile_t */
+    srcpool = srcpool_create();
+    prefetch = prefetch_create(srcpool);
+    prefetch_add_path(prefetch, ".");
+
+    prefetch_push(prefetch, "testprefetch.c", (const unsigned char *) missing_c, strlen(missing_c));
+    raced = srcpool_load(srcpool, "testprefetch.none.tmp");
+    file = srcpool_load(srcpool, "./testprefetch.b.tmp");
+    prefetch_wait(prefetch);
+
+    TEST_COND("prefetch_push() racing load", raced != NULL && file != NULL && srcpool_length(srcpool) == 2 &&
+                                             srcpool_load(srcpool, "testprefetch.none.tmp") == raced &&
+                                             srcpool_load(srcpool, "testprefetch.b.tmp") == file);
+
+    prefetch_destroy(prefetch);
+    srcpool_destroy(srcpool);
+
+    remove("testprefetch.a.tmp");
+    remove("testprefetch.b.tmp");
+    remove("testprefetch.c.tmp");
+    remove("testprefetch.none.tmp");
+}
+
+
+int main(void)
+{
+
+#ifdef WIN32
+    _CrtSetDbgFlag(_CrtSetDbgFlag(_CRTDBG_REPORT_FLAG) | _CRTDBG_LEAK_CHECK_DF);
+#endif
+
+    test_prefetch();
+    TEST_REPORT();
+    return 0;
+}
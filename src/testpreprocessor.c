@@ -2,81 +2,1328 @@
 
 #include "config.h"
 #include "unittest.h"
+#include "cstring.h"
+#include "array.h"
+#include "cspool.h"
+#include "dict.h"
+#include "token.h"
+#include "reader.h"
 #include "diagnostor.h"
 #include "lexer.h"
 #include "option.h"
-#include "token.h"
-#include "reader.h"
+#include "ident.h"
+#include "tokcache.h"
+#include "snapshot.h"
+#include "depfile.h"
 #include "preprocessor.h"
+#include "writer.h"
+#include "stats.h"
+#include "trace.h"
+
+#include <unistd.h>
+#include <dirent.h>
+
 
+#define TEST_INCLUDE_A      "testpreprocessor.a.tmp"
+#define TEST_INCLUDE_B      "testpreprocessor.b.tmp"
+#define TEST_INCLUDE_C      "testpreprocessor.c.tmp"
+#define TEST_SNAPSHOT       "testpreprocessor.snap.tmp"
+#define TEST_TOKCACHE       "testpreprocessor.cache.tmp"
+#define TEST_OUTPUT         "testpreprocessor.out.tmp"
 
-static 
-void print_pp(preprocessor_t pp)
+
+/**
+ * What the preprocessor makes of the stream, newlines kept and each token
+ * preceded by its spaces.
+ **/
+static cstring_t __drain__(preprocessor_t *pp)
 {
-    unsigned int spaces;
+    token_t *tok;
+    cstring_t cs;
+    size_t spaces;
+
+    cs = cstring_new_n(NULL, 64);
+
     for (;;) {
-        token_t tok = preprocessor_expand(pp);
+        tok = preprocessor_expand(pp);
         if (tok->type == TOKEN_END || tok->type == TOKEN_EOF) {
             token_destroy(tok);
             break;
         }
 
         if (tok->type == TOKEN_NEWLINE) {
+            cs = cstring_concat_ch(cs, '\n');
             token_destroy(tok);
-            printf("\n");
             continue;
         }
 
-        spaces = tok->spaces;
-        while (spaces--)
-            printf(" ");
-            ;
+        for (spaces = tok->spaces; spaces--; ) {
+            cs = cstring_concat_ch(cs, ' ');
+        }
 
-        printf("%s", token_as_text(tok));
+        cs = cstring_concat_n(cs, token_as_text(tok), strlen(token_as_text(tok)));
         token_destroy(tok);
     }
+
+    return cs;
+}
+
+
+static cstring_t __preprocess__(const char *text)
+{
+    preprocessor_t *pp;
+    lexer_t *lexer;
+    cstring_t cs;
+
+    lexer = lexer_create();
+    lexer_push(lexer, STREAM_TYPE_STRING, text);
+
+    pp = preprocessor_create(lexer);
+    cs = __drain__(pp);
+
+    preprocessor_destroy(pp);
+    lexer_destroy(lexer);
+
+    return cs;
+}
+
+
+#define TEST_PREPROCESS(name, text, expect)                 \
+    do {                                                    \
+        cstring_t __cs__ = __preprocess__(text);            \
+        TEST_COND(name, cstring_compare(__cs__, expect) == 0); \
+        cstring_free(__cs__);                               \
+    } while (false)
+
+
+/**
+ * Preprocesses text into a diagnostor of its own, true if it made expect
+ * with the errors and warnings counted and, unless message is NULL, the
+ * last diagnostic saying it.
+ **/
+static bool __preprocess_diagnosed__(const char *text, const char *expect,
+    size_t nerrors, size_t nwarnings, const char *message)
+{
+    diagnostor_t *saved_diagnostor;
+    diagnostor_entry_t *entry;
+    cstring_t cs;
+    bool ok;
+
+    saved_diagnostor = diagnostor;
+    diagnostor = diagnostor_create();
+
+    cs = __preprocess__(text);
+    ok = cstring_compare(cs, expect) == 0 &&
+         diagnostor->nerrors == nerrors && diagnostor->nwarnings == nwarnings;
+
+    if (ok && message != NULL) {
+        entry = &array_cast_at(diagnostor_entry_t, diagnostor->queue, array_length(diagnostor->queue) - 1);
+        ok = strcmp(entry->message, message) == 0;
+    }
+
+    cstring_free(cs);
+    diagnostor_destroy(diagnostor);
+    diagnostor = saved_diagnostor;
+    return ok;
+}
+
+
+static void test_preprocessor(void)
+{
+    TEST_PREPROCESS("no macros", "int x = 1;\n", "int x = 1;\n");
+
+    TEST_PREPROCESS("object-like macro",
+                    "#define A 1 + 2\n"
+                    "x = A;\n",
+                    "\nx = 1 + 2;\n");
+
+    TEST_PREPROCESS("nested object-like macros",
+                    "#define A B B\n"
+                    "#define B C\n"
+                    "#define C 3\n"
+                    "A\n",
+                    "\n\n\n3 3\n");
+
+    TEST_PREPROCESS("self-referential macro",
+                    "#define A x A\n"
+                    "A\n",
+                    "\nx A\n");
+
+    TEST_PREPROCESS("mutually recursive macros",
+                    "#define A B a\n"
+                    "#define B A b\n"
+                    "A B\n",
+                    "\n\nA b a B a b\n");
+
+    TEST_PREPROCESS("function-like macro",
+                    "#define F(a, b) b + a\n"
+                    "F(1, (2, 3))\n",
+                    "\n(2, 3) + 1\n");
+
+    /* token_as_text() leaves the quotes out */
+    TEST_PREPROCESS("stringify",
+                    "#define S(a) #a\n"
+                    "S(x  +   y)\n",
+                    "\nx  +   y\n");
+
+    TEST_PREPROCESS("undef",
+                    "#define A 1\n"
+                    "A\n"
+                    "#undef A\n"
+                    "A\n",
+                    "\n1\n\nA\n");
+
+    TEST_PREPROCESS("paste",
+                    "#define P(a, b) a ## b\n"
+                    "P(x, 1) P(,y)\n",
+                    "\nx1 y\n");
+
+    TEST_PREPROCESS("parameter named twice",
+                    "#define D(a, b) a b a #a P(b, a)\n"
+                    "#define P(a, b) a ## b c\n"
+                    "D(1 2, 3) P(x,)\n",
+                    "\n\n1 2 3 1 2 1 2 31 2 c x c\n");
+
+    TEST_PREPROCESS("arguments past the stack",
+                    "#define M(a, b, c, d, e, f, g, h, i, j, k, l, m, n, o, p, q, r) r q a\n"
+                    "M(1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18) M(x)\n",
+                    "\n18 17 1 x\n");
+
+    TEST_PREPROCESS("arguments expanded first",
+                    "#define F(x) x\n"
+                    "#define A 1\n"
+                    "#define T(x) x x ## 2 x\n"
+                    "#define S(x) #x x x\n"
+                    "F(F(A)) T(A) S(F(A))\n",
+                    "\n\n\n\n1 1 A2 1 F(A) 1 1\n");
+
+    TEST_PREPROCESS("variadic arguments",
+                    "#define V(a, ...) a: __VA_ARGS__\n"
+                    "V(1, 2, 3)\n",
+                    "\n1: 2, 3\n");
+}
+
+
+static void test_conditions(void)
+{
+    TEST_PREPROCESS("#ifdef",
+                    "#define A\n"
+                    "#ifdef A\n"
+                    "a\n"
+                    "#else\n"
+                    "b\n"
+                    "#endif\n",
+                    "\n\na\n\n");
+
+    TEST_PREPROCESS("#ifndef #elif",
+                    "#define A\n"
+                    "#ifndef A\n"
+                    "a\n"
+                    "#elif defined(A) && !defined B\n"
+                    "b\n"
+                    "#else\n"
+                    "c\n"
+                    "#endif\n",
+                    "\n\nb\n\n");
+
+    TEST_PREPROCESS("nested skipped groups",
+                    "#if 0\n"
+                    "#if 1\n"
+                    "a\n"
+                    "#else\n"
+                    "' b\n"
+                    "#endif\n"
+                    "#elif 1\n"
+                    "c\n"
+                    "#endif\n",
+                    "\nc\n\n");
+
+    TEST_PREPROCESS("skipped literals and comments",
+                    "#if 0\n"
+                    "x = \"\\\" #else\"; '#';\n"
+                    "/* \n#else\n */ x // \\\n#else\n"
+                    "/* c */ # else\n"
+                    "y\n"
+                    "#endif\n",
+                    "\ny\n\n");
+
+    TEST_PREPROCESS("#undef then #ifdef",
+                    "#define A\n"
+                    "#undef A\n"
+                    "#ifdef A\n"
+                    "a\n"
+                    "#endif\n",
+                    "\n\n\n");
+}
+
+
+static void test_if_expressions(void)
+{
+    TEST_PREPROCESS("#if arithmetic",
+                    "#if 1 + 2 * 3 == 7 && (10 - 4) / 3 == 2 && 7 % 4 == 3 && 1 << 4 == 0x10\n"
+                    "a\n"
+                    "#endif\n"
+                    "#if -1 >> 1 == -1 && ~0 == -1 && (2 | 1 ^ 3 & 1) == 2 && 010 == 8 && 0b101 == 5\n"
+                    "b\n"
+                    "#endif\n",
+                    "\na\n\n\nb\n\n");
+
+    TEST_PREPROCESS("#if unsigned",
+                    "#if -1 > 0u && 0xffffffffffffffff == -1 && -1 < 0 && 18446744073709551615ULL > 0\n"
+                    "a\n"
+                    "#endif\n",
+                    "\na\n\n");
+
+    TEST_PREPROCESS("#if suffixes",
+                    "#if 1lu == 1 && 2uLL == 2 && 0XFFl == 255 && 0b11U == 3 && 00 == 0\n"
+                    "a\n"
+                    "#endif\n",
+                    "\na\n\n");
+
+    TEST_COND("#if number errors", __preprocess_diagnosed__(
+        "#if 08\n#endif\n#if 1.5\n#endif\n#if 2i\n#endif\n#if 1lul\n#endif\n",
+        "\n\n\n\n", 4, 0, "invalid suffix \"lul\" on integer constant"));
+
+    TEST_COND("#if so large", __preprocess_diagnosed__(
+        "#if 9223372036854775808 > 0\na\n#endif\n", "\na\n\n", 0, 1, NULL));
+
+    TEST_PREPROCESS("#if macros and defined",
+                    "#define ZERO 0\n"
+                    "#define INC(x) ((x) + 1)\n"
+                    "#if INC(ZERO) == 1 && defined ZERO && !defined(NOPE) && NOPE == 0\n"
+                    "a\n"
+                    "#endif\n",
+                    "\n\n\na\n\n");
+
+    TEST_PREPROCESS("#if short-circuit",
+                    "#if 0 && 1 / 0\n"
+                    "a\n"
+                    "#elif (1 || 1 % 0) && (1 ? 2 : 1 / 0) == 2 && (0 ? 1 / 0 : 3) == 3\n"
+                    "b\n"
+                    "#endif\n",
+                    "\nb\n\n");
+
+    TEST_PREPROCESS("#if short-circuit calls",
+                    "#define P(a, b) 1\n"
+                    "#define Q(a, b) (a / b)\n"
+                    "#if (1 || P(1, 2)) && (P(1, 2) || Q(1, 0)) && !(0 && Q((1, 2), 0))\n"
+                    "a\n"
+                    "#endif\n"
+                    "#if (1 ? 2 : Q(1, 0)) == 2 && (0 ? Q(Q(1, 0), 0) : 3) == 3\n"
+                    "b\n"
+                    "#endif\n",
+                    "\n\n\na\n\n\nb\n\n");
+
+    TEST_PREPROCESS("#if characters",
+                    "#if 'a' == 97 && '\\n' == 10 && '\\377' < 0 && 'ab' == 24930\n"
+                    "a\n"
+                    "#endif\n",
+                    "\na\n\n");
+
+    TEST_PREPROCESS("#if errors",
+                    "#if 1 +\n"
+                    "a\n"
+                    "#elif 1.0\n"
+                    "b\n"
+                    "#elif 2 3\n"
+                    "c\n"
+                    "#else\n"
+                    "d\n"
+                    "#endif\n",
+                    "\nd\n\n");
 }
 
 
-static
-void test_preprocessor(void)
+static void test_directives(void)
 {
-    preprocessor_t pp;
-    reader_t reader;
-    diag_t diag;
-    lexer_t lexer;
-    struct option_s option;
+    TEST_COND("#error", __preprocess_diagnosed__(
+        "#error don't \"do\" it\na\n", "\na\n", 1, 0, "#error don't \"do\" it"));
+    TEST_COND("#error literals", __preprocess_diagnosed__(
+        "#define X 1\n#error X L\"w\" 'c'\n", "\n\n", 1, 0, "#error X L\"w\" 'c'"));
+    TEST_COND("#warning", __preprocess_diagnosed__(
+        "#warning  soon\na\n", "\na\n", 0, 1, "#warning soon"));
+    TEST_COND("#line", __preprocess_diagnosed__(
+        "#define N 7\n#define F \"f.c\"\n#line 10\n#line 20 \"a.c\"\n#line N F\na\n",
+        "\n\n\n\n\na\n", 0, 0, NULL));
+    TEST_COND("#line errors", __preprocess_diagnosed__(
+        "#line x\n#line 0x10\n#line 3 y\n#line\na\n", "\n\n\n\na\n", 4, 0, NULL));
+    TEST_COND("#line extra tokens", __preprocess_diagnosed__(
+        "#line 3 \"a.c\" 1\na\n", "\na\n", 0, 1, "extra tokens at end of #line directive"));
+    TEST_COND("GNU linemarker", __preprocess_diagnosed__(
+        "# 5 \"b.c\" 1 3\na\n", "\na\n", 0, 0, NULL));
+    TEST_COND("invalid directive", __preprocess_diagnosed__(
+        "#foo bar\na\n", "\na\n", 1, 0, "invalid preprocessing directive #foo"));
+    TEST_COND("directives in skipped groups", __preprocess_diagnosed__(
+        "#if 0\n#foo\n#error no\n#warning no\n#line x\n#endif\na\n",
+        "\na\n", 0, 0, NULL));
+}
+
+
+static void test_include_guards(void)
+{
+    preprocessor_t *pp;
+    lexer_t *lexer;
+    cstring_t cs;
 
-    diag = diag_create();
+    __write_file__(TEST_INCLUDE_A, "#ifndef A_H\n#define A_H\nint a;\n#endif\n\n", 1);
+    __write_file__(TEST_INCLUDE_B, "#pragma once\nint b;\n", 1);
+    __write_file__(TEST_INCLUDE_C, "int c;\n#ifndef C_H\n#define C_H\n#endif\n", 1);
 
-    reader = reader_create(diag, &option);
+    lexer = lexer_create();
+    lexer_push(lexer, STREAM_TYPE_STRING,
+               "#include \"" TEST_INCLUDE_A "\"\n"
+               "#include \"" TEST_INCLUDE_B "\"\n"
+               "#include \"" TEST_INCLUDE_C "\"\n"
+               "#include \"" TEST_INCLUDE_A "\"\n"
+               "#include \"" TEST_INCLUDE_B "\"\n"
+               "#include \"" TEST_INCLUDE_C "\"\n");
 
-    lexer = lexer_create(reader, &option, diag);
+    pp = preprocessor_create(lexer);
 
-    lexer_push(lexer, STREAM_TYPE_FILE, "1.c");
+    cs = __drain__(pp);
+    TEST_COND("#include", cstring_compare(cs, "\n\nint a;\n\n\n\nint b;\n"
+                                              "int c;\n\n\n\nint c;\n\n") == 0);
+    cstring_free(cs);
 
-    pp = preprocessor_create(lexer, &option, diag);
+    TEST_COND("#ifndef guard", dict_length((dict_t *) pp->include_guard) == 1);
+    TEST_COND("#pragma once", set_length(pp->once_guard) == 1);
 
-    preprocessor_add_include_path(pp, "/usr/include");
+    /* a guarded file is not read again, what it says now does not matter */
+    __write_file__(TEST_INCLUDE_A, "int changed;\n", 1);
 
-    print_pp(pp);
+    lexer_push(lexer, STREAM_TYPE_STRING, "#include \"" TEST_INCLUDE_A "\"\nx\n");
+    cs = __drain__(pp);
+    TEST_COND("#include guarded", cstring_compare(cs, "x\n") == 0);
+    cstring_free(cs);
 
     preprocessor_destroy(pp);
+    lexer_destroy(lexer);
+
+    remove(TEST_INCLUDE_A);
+    remove(TEST_INCLUDE_B);
+    remove(TEST_INCLUDE_C);
+}
+
+
+static void test_lexer_spans(void)
+{
+    lexer_t *lexer;
+    array_t *tokens;
+    token_t *a, *b, *token;
+
+    lexer = lexer_create();
+    lexer_push(lexer, STREAM_TYPE_STRING, "x y\n");
+
+    a = token_create(TOKEN_IDENTIFIER, cstring_new("a"), SRCLOC_NONE);
+    b = token_create(TOKEN_IDENTIFIER, cstring_new("b"), SRCLOC_NONE);
+
+    tokens = array_create_n(sizeof(token_t*), 2);
+    array_cast_append(token_t*, tokens, a);
+    array_cast_append(token_t*, tokens, b);
+
+    lexer_unget_tokens(lexer, tokens);
+
+    TEST_COND("lexer_peek() span", lexer_peek(lexer) == a);
+    TEST_COND("lexer_get() span", lexer_get(lexer) == a);
+    lexer_unget(lexer, a);
+    TEST_COND("lexer_unget() rewinds the span", lexer_get(lexer) == a);
+    TEST_COND("lexer_get() span again", lexer_get(lexer) == b);
+
+    token = lexer_get(lexer);
+    TEST_COND("lexer_get() after the span", token->type == TOKEN_IDENTIFIER &&
+                                            cstring_compare(token_cs(token), "x") == 0);
+
+    lexer_stash(lexer);
+    lexer_unget(lexer, a);
+    TEST_COND("lexer_stash() reads the ungot", lexer_get(lexer) == a);
+    TEST_COND("lexer_stash() then END", lexer_get(lexer)->type == TOKEN_END);
+    lexer_unstash(lexer);
+
+    TEST_COND("lexer_try()", lexer_try(lexer, TOKEN_IDENTIFIER));
+    TEST_COND("lexer_try() no", !lexer_try(lexer, TOKEN_IDENTIFIER));
 
     lexer_destroy(lexer);
-    reader_destroy(reader);
-    diag_destroy(diag);
+    token_destroy(a);
+    token_destroy(b);
 }
 
 
-int main(void)
+static void test_lexer_batch(void)
 {
+    lexer_t *lexer;
+    array_t *tokens;
+    token_t *a, *b, *batch[LEXER_BATCH];
+    size_t n;
+
+    lexer = lexer_create();
+    lexer_set_trivia(lexer, false);
+    lexer_push(lexer, STREAM_TYPE_STRING, "x y\n# z\n");
+
+    a = token_create(TOKEN_IDENTIFIER, cstring_new("a"), SRCLOC_NONE);
+    b = token_create(TOKEN_IDENTIFIER, cstring_new("b"), SRCLOC_NONE);
+
+    tokens = array_create_n(sizeof(token_t*), 2);
+    array_cast_append(token_t*, tokens, a);
+    array_cast_append(token_t*, tokens, b);
+
+    lexer_unget_tokens(lexer, tokens);
+
+    n = lexer_get_batch(lexer, batch, LEXER_BATCH);
+    TEST_COND("lexer_get_batch() span", n == 2 && batch[0] == a && batch[1] == b);
+
+    lexer_unget_batch(lexer, batch + 1, 1);
+    TEST_COND("lexer_unget_batch() rewinds the span", lexer_get(lexer) == b);
+
+    n = lexer_get_batch(lexer, batch, LEXER_BATCH);
+    TEST_COND("lexer_get_batch() to the line break", n == 3 &&
+                                                     batch[2]->type == TOKEN_NEWLINE);
+
+    lexer_unget_batch(lexer, batch, n);
+    TEST_COND("lexer_unget_batch() streams", lexer_get_batch(lexer, batch, 1) == 1 &&
+                                             cstring_compare(token_cs(batch[0]), "x") == 0);
+    lexer_eat(lexer);
+    lexer_eat(lexer);
+
+    n = lexer_get_batch(lexer, batch, LEXER_BATCH);
+    TEST_COND("lexer_get_batch() to a directive", n == 1 && batch[0]->type == TOKEN_HASH &&
+                                                  batch[0]->begin_of_line);
+
+    lexer_destroy(lexer);
+    token_destroy(a);
+    token_destroy(b);
+}
+
+
+static void test_preprocessor_batch(void)
 {
-    #ifdef WIN32
-    _CrtSetDbgFlag(_CrtSetDbgFlag(_CRTDBG_REPORT_FLAG) | _CRTDBG_LEAK_CHECK_DF);
-    #endif
+    preprocessor_t *pp;
+    lexer_t *lexer;
+    token_t *batch[4];
+    size_t i, n, total = 0;
+    bool end = false;
+
+    /* the arguments are read ahead past the line, the directive still holds */
+    TEST_PREPROCESS("arguments then a directive",
+                    "#define M(a, b) a b\n"
+                    "x M(1,\n2) y\n"
+                    "#define Q 3\n"
+                    "Q\n",
+                    "\nx 1\n2 y\n\n3\n");
+
+    lexer = lexer_create();
+    lexer_push(lexer, STREAM_TYPE_STRING, "#define F(x) x + x\nF(a) F(b)\nc\n");
+    pp = preprocessor_create(lexer);
+
+    while (!end) {
+        n = preprocessor_get_batch(pp, batch, 4);
+        end = batch[n - 1]->type == TOKEN_END || batch[n - 1]->type == TOKEN_EOF;
+        total += n - end;
+
+        for (i = 0; i < n; i++) {
+            token_destroy(batch[i]);
+        }
+    }
+
+    TEST_COND("preprocessor_get_batch()", total == 7);
+
+    preprocessor_destroy(pp);
+    lexer_destroy(lexer);
+}
+
+
+static void test_instances(void)
+{
+    preprocessor_t *pp;
+    lexer_t *lexer;
+    token_t *token, *end;
+    const unsigned char *s;
+    size_t n;
+
+    lexer = lexer_create();
+    lexer_push(lexer, STREAM_TYPE_STRING, "#define A name\n#define F(x) x name\nA F(A)\n");
+    pp = preprocessor_create(lexer);
+
+    token = preprocessor_get(pp);
+    s = token_spelling(token, &n);
+    TEST_COND("token_instance() shares the text", token->cs == NULL && token->arena == NULL &&
+                                                  n == 4 && memcmp(s, "name", 4) == 0);
+    TEST_COND("token_instance() own text", cstring_compare(token_cs(token), "name") == 0 &&
+                                           (const unsigned char *) token->cs != s);
+    token_destroy(token);
+
+    token = preprocessor_get(pp);
+    TEST_COND("token_instance() of an argument", token->cs == NULL &&
+                                                 cstring_compare(token_cs(token), "name") == 0);
+    token_destroy(token);
+
+    token = preprocessor_get(pp);
+    TEST_COND("token_instance() of a body", token->cs == NULL &&
+                                            cstring_compare(token_cs(token), "name") == 0);
+    token_destroy(token);
+
+    preprocessor_destroy(pp);
+    lexer_destroy(lexer);
+
+    /* tokens that own their text have it copied */
+    token = token_create(TOKEN_IDENTIFIER, cstring_new("name"), SRCLOC_NONE);
+    end = token_instance(token);
+    TEST_COND("token_instance() of an owner", end->cs != NULL && end->cs != token->cs &&
+                                               cstring_compare(end->cs, "name") == 0);
+    token_destroy(token);
+    token_destroy(end);
 }
 
+
+static void test_idents(void)
+{
+    preprocessor_t *pp;
+    lexer_t *lexer;
+    token_t *a, *b, *kw;
+    ident_t *ident;
+
+    lexer = lexer_create();
+    lexer_push(lexer, STREAM_TYPE_STRING, "#define A 1\nA while A\n");
+
+    pp = preprocessor_create(lexer);
+
+    TEST_COND("preprocessor_expand() bound", preprocessor_expand(pp)->type == TOKEN_NEWLINE);
+
+    ident = identtab_lookup(pp->idents, (const unsigned char *) "A", 1);
+    TEST_COND("ident_t macro", ident->macro != NULL && ident->was_macro);
+
+    a = lexer_get(lexer);
+    kw = lexer_get(lexer);
+    b = lexer_get(lexer);
+    TEST_COND("ident_t shared", a->ident == ident && b->ident == ident);
+    TEST_COND("ident_t keyword", kw->ident != NULL && kw->keyword == TOKEN_WHILE &&
+                                 kw->ident->keyword == TOKEN_WHILE &&
+                                 kw->ident->macro == NULL);
+
+    ident = identtab_lookup(pp->idents, (const unsigned char *) "define", 6);
+    TEST_COND("ident_t directive", ident->directive == TOKEN_PP_DEFINE &&
+                                   ident->keyword == TOKEN_UNKNOWN);
+
+    preprocessor_destroy(pp);
+    TEST_COND("preprocessor_destroy() idents", lexer->idents == NULL);
+
+    lexer_destroy(lexer);
+}
+
+
+static void test_macro_cache(void)
+{
+    preprocessor_t *pp;
+    lexer_t *lexer;
+    ident_t *ident;
+    cstring_t cs;
+
+    TEST_PREPROCESS("cached expansion redefined",
+                    "#define A B + B\n"
+                    "A\n"
+                    "#define B 2\n"
+                    "A A\n"
+                    "#undef B\n"
+                    "A\n",
+                    "\nB + B\n\n2 + 2 2 + 2\n\nB + B\n");
+
+    TEST_PREPROCESS("cached expansion in context",
+                    "#define A B a\n"
+                    "#define B A b\n"
+                    "A A B B\n",
+                    "\n\nA b a A b a B a b B a b\n");
+
+    TEST_PREPROCESS("function-like macro not cached",
+                    "#define F(x) [x]\n"
+                    "#define A F\n"
+                    "A(1) A\n",
+                    "\n\n[1] F\n");
+
+    lexer = lexer_create();
+    lexer_push(lexer, STREAM_TYPE_STRING,
+               "#define F(x) x\n#define B 2\n#define A B\n#define C F\nA C\n");
+
+    pp = preprocessor_create(lexer);
+    cs = __drain__(pp);
+
+    ident = identtab_lookup(pp->idents, (const unsigned char *) "A", 1);
+    TEST_COND("macro_cache_t", ident->macro->object_like.cache != NULL &&
+                               ident->macro->object_like.cache->tokens != NULL &&
+                               array_length(ident->macro->object_like.cache->depends) == 1);
+
+    ident = identtab_lookup(pp->idents, (const unsigned char *) "C", 1);
+    TEST_COND("macro_cache_t contextual", ident->macro->object_like.cache != NULL &&
+                                          ident->macro->object_like.cache->tokens == NULL);
+
+    cstring_free(cs);
+    preprocessor_destroy(pp);
+    lexer_destroy(lexer);
+}
+
+
+static void test_locations(void)
+{
+    preprocessor_t *pp;
+    lexer_t *lexer;
+    token_t *paren, *y;
+    cstring_t fn;
+    size_t line, column;
+
+    lexer = lexer_create();
+    lexer_push(lexer, STREAM_TYPE_STRING, "#define F(x)(x + 1)\nF(y)\n");
+
+    pp = preprocessor_create(lexer);
+
+    token_destroy(preprocessor_expand(pp));
+    paren = preprocessor_expand(pp);
+    y = preprocessor_expand(pp);
+
+    TEST_COND("srcloc_t spelling", paren->type == TOKEN_L_PAREN &&
+                                   token_line(paren) == 1 && token_column(paren) == 13 &&
+                                   cstring_compare(token_filename(paren), "<string>") == 0);
+
+    TEST_COND("srcloc_expansion()", srcloc_resolve(srcloc_expansion(paren->loc), &fn, &line, &column, NULL) &&
+                                    line == 2 && column == 1);
+
+    TEST_COND("srcloc_expansion() argument", srcloc_expansion(y->loc) == y->loc &&
+                                             token_line(y) == 2 && token_column(y) == 3);
+
+    token_destroy(paren);
+    token_destroy(y);
+    cstring_free(__drain__(pp));
+    preprocessor_destroy(pp);
+    lexer_destroy(lexer);
+}
+
+
+static void test_stats(void)
+{
+    stats_phase_t phase;
+    stats_t total;
+    cstring_t cs;
+
+    memset(&total, 0, sizeof(total));
+
+    stats_begin(true);
+    cs = __preprocess__("#define A 1\n#define F(x) x + A\nF(2) A A\n");
+    stats_end(&total);
+
+    TEST_COND("stats_end()", cstring_compare(cs, "\n\n2 + 1 1 1\n") == 0 && total.units == 1);
+
+    TEST_COND("stats_t counters", total.counters[STATS_MACROS_DEFINED] == 2 &&
+                                  total.counters[STATS_MACROS_EXPANDED] == 4 &&
+                                  total.counters[STATS_TOKENS_OUT] == 5 &&
+                                  total.counters[STATS_MACRO_CACHE_MISSES] == 1 &&
+                                  total.counters[STATS_MACRO_CACHE_HITS] == 2 &&
+                                  total.counters[STATS_BYTES_READ] == 40);
+
+    TEST_COND("stats_t phases", total.wall[STATS_PHASE_LEX] > 0 &&
+                                total.wall[STATS_PHASE_DIRECTIVE] > 0 &&
+                                total.wall[STATS_PHASE_EXPAND] > 0 &&
+                                total.wall[STATS_PHASE_OUTPUT] == 0 &&
+                                stats_phase == STATS_PHASE_OTHER);
+
+    cstring_free(cs);
+
+    /* a phase that waits takes wall time and next to no CPU time */
+    memset(&total, 0, sizeof(total));
+
+    stats_begin(true);
+    phase = stats_enter(STATS_PHASE_READ);
+    usleep(20000);
+    stats_leave(phase);
+    stats_end(&total);
+
+    TEST_COND("stats_t cpu of a phase", total.wall[STATS_PHASE_READ] > 0.015 &&
+                                        total.cpu[STATS_PHASE_READ] < total.wall[STATS_PHASE_READ] / 2);
+}
+
+
+static void test_trace(void)
+{
+    cstring_t cs, json;
+    char buf[1024];
+    FILE *fp;
+    size_t n;
+
+    __write_file__(TEST_INCLUDE_A, "#define ONE 1\n", 1);
+
+    trace_begin(0);
+    cs = __preprocess__("#include \"" TEST_INCLUDE_A "\"\n"
+                        "#define F(x) x + ONE\n"
+                        "#define G(x) x\n"
+                        "F(2) ONE G\n"
+                        "#if 0\n"
+                        "skipped\n"
+                        "#endif\n");
+
+    json = cstring_new_n(NULL, 1024);
+    fp = tmpfile();
+    TEST_COND("trace_write()", fp != NULL && trace_write(fp, "unit"));
+
+    if (fp != NULL) {
+        rewind(fp);
+        while ((n = fread(buf, 1, sizeof(buf), fp)) != 0) {
+            json = cstring_concat_n(json, buf, n);
+        }
+        fclose(fp);
+    }
+
+    trace_end();
+
+    TEST_COND("trace_end()", cstring_compare(cs, "\n\n\n2 + 1 1 G\n\n") == 0 && !tracing);
+
+    TEST_COND("trace_write() spans",
+              strstr(json, "\"name\":\"Source\",\"args\":{\"detail\":\"" TEST_INCLUDE_A "\"}") != NULL &&
+              strstr(json, "\"detail\":\"F\",\"tokens\":3") != NULL &&
+              strstr(json, "\"detail\":\"ONE\",\"tokens\":1") != NULL &&
+              strstr(json, "\"name\":\"Skip\"") != NULL &&
+              strstr(json, "\"line\":5") != NULL);
+
+    TEST_COND("trace_drop()", strstr(json, "\"detail\":\"G\"") == NULL);
+
+    cstring_free(json);
+    cstring_free(cs);
+    remove(TEST_INCLUDE_A);
+}
+
+
+static void test_snapshot(void)
+{
+    preprocessor_t *pp;
+    lexer_t *lexer;
+    ident_t *ident;
+    cstring_t cs;
+
+    __write_file__(TEST_INCLUDE_A, "#ifndef A_H\n#define A_H\n#define ONE 1\n#endif\n", 1);
+
+    lexer = lexer_create();
+    lexer_push(lexer, STREAM_TYPE_STRING,
+               "#include \"" TEST_INCLUDE_A "\"\n"
+               "#define TWO ONE + ONE\n"
+               "#define CAT(a, b) a ## b\n"
+               "#define STR(x) #x\n"
+               "#define LOG(fmt, ...) f(fmt, __VA_ARGS__)\n"
+               "#define GONE\n"
+               "#undef GONE\n");
+
+    pp = preprocessor_create(lexer);
+    cs = __drain__(pp);
+    cstring_free(cs);
+
+    TEST_COND("preprocessor_save_snapshot()", preprocessor_save_snapshot(pp, TEST_SNAPSHOT));
+
+    preprocessor_destroy(pp);
+    lexer_destroy(lexer);
+
+    /* the header changes, the snapshot says it is guarded all the same */
+    __write_file__(TEST_INCLUDE_A, "int changed;\n", 1);
+
+    lexer = lexer_create();
+    pp = preprocessor_create(lexer);
+
+    TEST_COND("preprocessor_load_snapshot()", preprocessor_load_snapshot(pp, TEST_SNAPSHOT));
+
+    ident = identtab_lookup(pp->idents, (const unsigned char *) "TWO", 3);
+    TEST_COND("snapshot macro read in lazily", ident->macro != NULL && ident->macro->record != NULL);
+
+    ident = identtab_lookup(pp->idents, (const unsigned char *) "GONE", 4);
+    TEST_COND("snapshot #undef", ident->macro == NULL);
+
+    lexer_push(lexer, STREAM_TYPE_STRING,
+               "#include \"" TEST_INCLUDE_A "\"\n"
+               "#ifdef STR\n"
+               "TWO CAT(x, y) STR(a + b) LOG(\"%d\", 1, 2)\n"
+               "#endif\n");
+
+    cs = __drain__(pp);
+    TEST_COND("snapshot expansion",
+              cstring_compare(cs, "\n1 + 1 xy a + b f(%d, 1, 2)\n\n") == 0);
+    cstring_free(cs);
+
+    ident = identtab_lookup(pp->idents, (const unsigned char *) "TWO", 3);
+    TEST_COND("snapshot macro read in", ident->macro->record == NULL);
+
+    /* saved again, the macros not used yet go as they were loaded */
+    TEST_COND("preprocessor_save_snapshot() again", preprocessor_save_snapshot(pp, TEST_SNAPSHOT));
+
+    preprocessor_destroy(pp);
+    lexer_destroy(lexer);
+
+    lexer = lexer_create();
+    pp = preprocessor_create(lexer);
+
+    TEST_COND("preprocessor_load_snapshot() again", preprocessor_load_snapshot(pp, TEST_SNAPSHOT));
+
+    lexer_push(lexer, STREAM_TYPE_STRING, "TWO CAT(1, 2) STR(x)\n");
+    cs = __drain__(pp);
+    TEST_COND("snapshot expansion again", cstring_compare(cs, "1 + 1 12 x\n") == 0);
+    cstring_free(cs);
+
+    preprocessor_destroy(pp);
+    lexer_destroy(lexer);
+
+    __write_file__(TEST_SNAPSHOT, "occsnap", 1);
+
+    lexer = lexer_create();
+    pp = preprocessor_create(lexer);
+    TEST_COND("preprocessor_load_snapshot() damaged", !preprocessor_load_snapshot(pp, TEST_SNAPSHOT));
+    TEST_COND("preprocessor_load_snapshot() missing", !preprocessor_load_snapshot(pp, TEST_INCLUDE_B));
+    preprocessor_destroy(pp);
+    lexer_destroy(lexer);
+
+    remove(TEST_INCLUDE_A);
+    remove(TEST_SNAPSHOT);
+}
+
+
+static cstring_t __preprocess_cached__(tokcache_t *cache, const char *text)
+{
+    preprocessor_t *pp;
+    lexer_t *lexer;
+    cstring_t cs;
+
+    lexer = lexer_create();
+    lexer_push(lexer, STREAM_TYPE_STRING, text);
+
+    pp = preprocessor_create(lexer);
+    preprocessor_set_tokcache(pp, cache);
+    cs = __drain__(pp);
+
+    preprocessor_destroy(pp);
+    lexer_destroy(lexer);
+
+    return cs;
+}
+
+
+/* writes v over the 4 bytes at of every entry, after the snapshot header */
+static void __damage_tokcache__(long at, uint32_t v)
+{
+    struct dirent *ent;
+    unsigned char bytes[4];
+    char fn[256];
+    DIR *dir;
+    FILE *fp;
+
+    bytes[0] = (unsigned char) (v & 0xff);
+    bytes[1] = (unsigned char) ((v >> 8) & 0xff);
+    bytes[2] = (unsigned char) ((v >> 16) & 0xff);
+    bytes[3] = (unsigned char) ((v >> 24) & 0xff);
+
+    if ((dir = opendir(TEST_TOKCACHE)) == NULL) {
+        return;
+    }
+
+    while ((ent = readdir(dir)) != NULL) {
+        if (strstr(ent->d_name, ".tok") == NULL) {
+            continue;
+        }
+
+        sprintf(fn, "%s/%s", TEST_TOKCACHE, ent->d_name);
+        if ((fp = fopen(fn, "r+b")) != NULL) {
+            fseek(fp, (long) (sizeof(SNAPSHOT_MAGIC) + 4) + at, SEEK_SET);
+            fwrite(bytes, 1, sizeof(bytes), fp);
+            fclose(fp);
+        }
+    }
+
+    closedir(dir);
+}
+
+
+static void test_tokcache(void)
+{
+    tokcache_t *cache;
+    array_t *tokens;
+    struct dirent *ent;
+    cstring_t cs, expect;
+    DIR *dir;
+    FILE *fp;
+    char text[256];
+    size_t n;
+    unsigned flags;
+
+    __write_file__(TEST_INCLUDE_A, "#define N 1\nint a = N;\n#include \"" TEST_INCLUDE_B "\"\n", 1);
+    __write_file__(TEST_INCLUDE_B, "#ifdef N\nint b[N];\n#endif\n", 1);
+    __write_file__(TEST_INCLUDE_C, "#if 0\ndon't\n#endif\nint c;\n", 1);
+
+    mkdir(TEST_TOKCACHE, 0755);
+
+    cache = tokcache_create(TEST_TOKCACHE);
+
+    cs = __preprocess_cached__(cache, "#include \"" TEST_INCLUDE_A "\"\n"
+                                      "#undef N\n"
+                                      "#include \"" TEST_INCLUDE_A "\"\n");
+    TEST_COND("lexer_push_cached()", cstring_compare(cs, "\nint a = 1;\n\nint b[1];\n\n\n"
+                                                      "\nint a = 1;\n\nint b[1];\n\n") == 0);
+    cstring_free(cs);
+    TEST_COND("tokcache_add()", tokcache_length(cache) == 2);
+
+    cs = __preprocess_cached__(cache, "#include \"" TEST_INCLUDE_C "\"\n"
+                                      "#include \"" TEST_INCLUDE_C "\"\n");
+    expect = __preprocess__("#include \"" TEST_INCLUDE_C "\"\n"
+                            "#include \"" TEST_INCLUDE_C "\"\n");
+    TEST_COND("lexer_push_cached() skipped group", cstring_compare(cs, expect) == 0);
+    cstring_free(expect);
+    cstring_free(cs);
+    TEST_COND("tokcache_add() not with a warning", tokcache_length(cache) == 2);
+
+    tokcache_destroy(cache);
+
+    /* another run finds the entries in the directory */
+    cache = tokcache_create(TEST_TOKCACHE);
+
+    fp = fopen(TEST_INCLUDE_A, "rb");
+    n = fp != NULL ? fread(text, 1, sizeof(text), fp) : 0;
+    if (fp != NULL) {
+        fclose(fp);
+    }
+
+    for (tokens = NULL, flags = 0; tokens == NULL && flags < 8; flags++) {
+        tokens = tokcache_find(cache, (const unsigned char *) text, n, flags);
+    }
+
+    TEST_COND("tokcache_find() from the directory", tokens != NULL && tokcache_length(cache) == 1);
+
+    cs = __preprocess_cached__(cache, "#include \"" TEST_INCLUDE_A "\"\n");
+    TEST_COND("lexer_push_cached() from the directory",
+              cstring_compare(cs, "\nint a = 1;\n\nint b[1];\n\n") == 0);
+    cstring_free(cs);
+
+    tokcache_destroy(cache);
+
+    /* a damaged entry is a miss, the file is lexed and written again */
+    __damage_tokcache__(8, 0xfffffff0);
+    cache = tokcache_create(TEST_TOKCACHE);
+
+    for (tokens = NULL, flags = 0; tokens == NULL && flags < 8; flags++) {
+        tokens = tokcache_find(cache, (const unsigned char *) text, n, flags);
+    }
+    TEST_COND("tokcache_find() damaged count", tokens == NULL && tokcache_length(cache) == 0);
+
+    cs = __preprocess_cached__(cache, "#include \"" TEST_INCLUDE_A "\"\n");
+    TEST_COND("lexer_push_cached() damaged count",
+              cstring_compare(cs, "\nint a = 1;\n\nint b[1];\n\n") == 0 && tokcache_length(cache) == 2);
+    cstring_free(cs);
+
+    tokcache_destroy(cache);
+
+    __damage_tokcache__(12, 0x7ffffff0);
+    cache = tokcache_create(TEST_TOKCACHE);
+
+    for (tokens = NULL, flags = 0; tokens == NULL && flags < 8; flags++) {
+        tokens = tokcache_find(cache, (const unsigned char *) text, n, flags);
+    }
+    TEST_COND("tokcache_find() damaged type", tokens == NULL && tokcache_length(cache) == 0);
+
+    cs = __preprocess_cached__(cache, "#include \"" TEST_INCLUDE_A "\"\n");
+    TEST_COND("lexer_push_cached() damaged type",
+              cstring_compare(cs, "\nint a = 1;\n\nint b[1];\n\n") == 0 && tokcache_length(cache) == 2);
+    cstring_free(cs);
+
+    tokcache_destroy(cache);
+
+    /* a file lexed from its stream comes out where a replayed one includes it */
+    __write_file__(TEST_INCLUDE_B, "int b = 'b;\n", 1);
+    __write_file__(TEST_INCLUDE_C, "#include \"" TEST_INCLUDE_B "\"\nint c;\n", 1);
+
+    cache = tokcache_create(TEST_TOKCACHE);
+
+    cs = __preprocess_cached__(cache, "#include \"" TEST_INCLUDE_C "\"\n"
+                                      "#include \"" TEST_INCLUDE_C "\"\n");
+    expect = __preprocess__("#include \"" TEST_INCLUDE_C "\"\n"
+                            "#include \"" TEST_INCLUDE_C "\"\n");
+    TEST_COND("lexer_push_cached() including a stream", cstring_compare(cs, expect) == 0 &&
+                                                        tokcache_length(cache) == 1);
+    cstring_free(expect);
+    cstring_free(cs);
+
+    tokcache_destroy(cache);
+
+    /* the entries are named by their keys, whatever is there goes */
+    if ((dir = opendir(TEST_TOKCACHE)) != NULL) {
+        while ((ent = readdir(dir)) != NULL) {
+            sprintf(text, "%s/%s", TEST_TOKCACHE, ent->d_name);
+            remove(text);
+        }
+        closedir(dir);
+    }
+
+    rmdir(TEST_TOKCACHE);
+    remove(TEST_INCLUDE_A);
+    remove(TEST_INCLUDE_B);
+    remove(TEST_INCLUDE_C);
+}
+
+
+static void test_depfile(void)
+{
+    preprocessor_t *pp;
+    lexer_t *lexer;
+    depfile_t *dep;
+    cstring_t cs, target;
+
+    __write_file__(TEST_INCLUDE_A, "#include \"" TEST_INCLUDE_B "\"\n#include \"" TEST_INCLUDE_C "\"\n", 1);
+    __write_file__(TEST_INCLUDE_B, "#ifndef B\n#define B\nint b;\n#endif\n", 1);
+    __write_file__(TEST_INCLUDE_C, "#pragma once\n#include \"" TEST_INCLUDE_B "\"\nint c;\n", 1);
+
+    dep = depfile_create();
+
+    lexer = lexer_create();
+    lexer_push(lexer, STREAM_TYPE_STRING, "#include \"" TEST_INCLUDE_C "\"\n"
+                                          "#include \"" TEST_INCLUDE_A "\"\n");
+
+    pp = preprocessor_create(lexer);
+    preprocessor_set_depfile(pp, dep);
+    cs = __drain__(pp);
+    cstring_free(cs);
+
+    preprocessor_destroy(pp);
+    lexer_destroy(lexer);
+
+    /* B and C are skipped the second time, still each is in the rule once */
+    TEST_COND("preprocessor_set_depfile()", depfile_length(dep) == 3);
+
+    cs = depfile_rule(dep, "x.o", "x.c", true);
+    TEST_COND("depfile_rule()", cstring_compare(cs, "x.o: x.c \\\n"
+                                                    "  " TEST_INCLUDE_C " \\\n"
+                                                    "  " TEST_INCLUDE_B " \\\n"
+                                                    "  " TEST_INCLUDE_A "\n") == 0);
+    cstring_free(cs);
+
+    target = cstring_new("/usr/include/stdio.h");
+    depfile_add(dep, target, true);
+    cstring_free(target);
+
+    cs = depfile_rule(dep, "x.o", NULL, false);
+    TEST_COND("depfile_rule() without system headers",
+              cstring_compare(cs, "x.o: \\\n"
+                                  "  " TEST_INCLUDE_C " \\\n"
+                                  "  " TEST_INCLUDE_B " \\\n"
+                                  "  " TEST_INCLUDE_A "\n") == 0);
+    cstring_free(cs);
+
+    target = depfile_target("dir/a b.c");
+    TEST_COND("depfile_target()", cstring_compare(target, "a b.o") == 0);
+    cs = depfile_quote((const char *) target);
+    TEST_COND("depfile_quote()", cstring_compare(cs, "a\\ b.o") == 0);
+    cstring_free(target);
+    cstring_free(cs);
+
+    cs = depfile_rule(dep, "a b.o $$", "$x#.c", true);
+    TEST_COND("depfile_rule() escapes but the target", strncmp((const char *) cs, "a b.o $$: $$x\\#.c ", 18) == 0);
+    cstring_free(cs);
+
+    depfile_destroy(dep);
+
+    remove(TEST_INCLUDE_A);
+    remove(TEST_INCLUDE_B);
+    remove(TEST_INCLUDE_C);
+}
+
+
+/**
+ * What the preprocessor makes of fn, lexed ahead or not.
+ **/
+static cstring_t __preprocess_file__(const char *fn, bool pipeline)
+{
+    preprocessor_t *pp;
+    lexer_t *lexer;
+    cstring_t cs;
+
+    option->pipeline = pipeline;
+
+    lexer = lexer_create();
+    lexer_push(lexer, STREAM_TYPE_FILE, fn);
+    pp = preprocessor_create(lexer);
+
+    cs = __drain__(pp);
+
+    preprocessor_destroy(pp);
+    lexer_destroy(lexer);
+
+    option->pipeline = false;
+    return cs;
+}
+
+
+/**
+ * Files big enough for a pipe, one included in the other, with groups
+ * skipped that the pipe leaves for the reader, come out as without one.
+ **/
+static void test_pipeline(void)
+{
+    cstring_t a, b, piped, plain;
+    const char *p;
+    size_t i;
+    char line[128];
+
+    a = cstring_new("#define N(x) ((x) + \\\n 1)\n");
+    b = cstring_new_n(NULL, 256);
+
+    for (i = 0; i < 4000; i++) {
+        if (i % 97 == 0) {
+            sprintf(line, "#if 0\nchar c%lu = 'ab;\n#endif\n", (unsigned long) i);
+        } else if (i % 89 == 0) {
+            sprintf(line, "int crlf%lu;\r\n", (unsigned long) i);
+        } else {
+            sprintf(line, "static int f%lu(int a) { return N(a) * %lu; } /* c */\n",
+                    (unsigned long) i, (unsigned long) i);
+        }
+
+        a = cstring_concat_n(a, line, strlen(line));
+        b = cstring_concat_n(b, line, strlen(line));
+
+        if (i == 2000) {
+            a = cstring_concat_n(a, "#include \"" TEST_INCLUDE_B "\"\n",
+                                 strlen("#include \"" TEST_INCLUDE_B "\"\n"));
+        }
+    }
+
+    a = cstring_concat_n(a, "int last", 8);
+
+    __write_file__(TEST_INCLUDE_A, a, 1);
+    __write_file__(TEST_INCLUDE_B, b, 1);
+
+    plain = __preprocess_file__(TEST_INCLUDE_A, false);
+    piped = __preprocess_file__(TEST_INCLUDE_A, true);
+
+    TEST_COND("pipeline", cstring_compare(piped, plain) == 0);
+    p = strstr(piped, "f3999(");
+    TEST_COND("pipeline include", p != NULL && strstr(p + 1, "f3999(") != NULL &&
+                                  strstr(piped, "int last") != NULL);
+
+    cstring_free(plain);
+    cstring_free(piped);
+    cstring_free(a);
+    cstring_free(b);
+
+    remove(TEST_INCLUDE_A);
+    remove(TEST_INCLUDE_B);
+}
+
+
+/**
+ * What writer_preprocess() makes of fn, with a buffer of the given size.
+ **/
+static cstring_t __write_preprocessed__(const char *fn, size_t size)
+{
+    preprocessor_t *pp;
+    lexer_t *lexer;
+    writer_t *w;
+    cstring_t cs;
+    FILE *fp;
+    char buf[256];
+    size_t n;
+
+    fp = fopen(TEST_OUTPUT, "wb");
+
+    lexer = lexer_create();
+    lexer_push(lexer, STREAM_TYPE_FILE, fn);
+    pp = preprocessor_create(lexer);
+
+    w = writer_create(fileno(fp), size);
+    writer_preprocess(w, pp);
+    writer_destroy(w);
+    fclose(fp);
+
+    preprocessor_destroy(pp);
+    lexer_destroy(lexer);
+
+    cs = cstring_new_n(NULL, 256);
+    fp = fopen(TEST_OUTPUT, "rb");
+    while ((n = fread(buf, 1, sizeof(buf), fp)) != 0) {
+        cs = cstring_concat_n(cs, buf, n);
+    }
+    fclose(fp);
+
+    remove(TEST_OUTPUT);
+    return cs;
+}
+
+
+static void test_writer(void)
+{
+    cstring_t cs, expect;
+
+    __write_file__(TEST_INCLUDE_B, "#ifndef B\n#define B\nint b;\n#endif\n", 1);
+    __write_file__(TEST_INCLUDE_A, "#include \"" TEST_INCLUDE_B "\"\n"
+                                   "#define N 1\n"
+                                   "char *s = \"a\\n\\\"b\\x01\";\n"
+                                   "\n"
+                                   "int c = L'\\'' + N;\n"
+                                   "\n\n\n\n\n\n\n\n\n\n"
+                                   "int d;\n", 1);
+
+    expect = cstring_new("# 3 \"" TEST_INCLUDE_B "\"\n"
+                         "int b;\n"
+                         "# 3 \"" TEST_INCLUDE_A "\"\n"
+                         "char *s = \"a\\n\\\"b\\001\";\n"
+                         "\n"
+                         "int c = L'\\'' + 1;\n"
+                         "# 16 \"" TEST_INCLUDE_A "\"\n"
+                         "int d;\n");
+
+    cs = __write_preprocessed__(TEST_INCLUDE_A, 0);
+    TEST_COND("writer_preprocess()", cstring_compare(cs, expect) == 0);
+    cstring_free(cs);
+
+    /* the same through a buffer smaller than some of the writes */
+    cs = __write_preprocessed__(TEST_INCLUDE_A, 8);
+    TEST_COND("writer_preprocess() small buffer", cstring_compare(cs, expect) == 0);
+    cstring_free(cs);
+
+    cstring_free(expect);
+
+    /* a table is written as with its numbers lexed one by one */
+    __write_file__(TEST_INCLUDE_A, "#define N 9\n"
+                                   "int t[] = {\n"
+                                   "  1, 2, 3, 4, 5, 6, 7, 8,\n"
+                                   "  1, 2, 3, 4, N, 6, 7, 8, 9, 10, 11, 12\n"
+                                   "#if 1\n"
+                                   "  0x1, 2u, 3,  4 , 5, 6, 7, 1.5\n"
+                                   "#endif\n"
+                                   "};\n", 1);
+
+    option->literal_runs = false;
+    expect = __write_preprocessed__(TEST_INCLUDE_A, 0);
+    option->literal_runs = true;
+    cs = __write_preprocessed__(TEST_INCLUDE_A, 0);
+    TEST_COND("writer_preprocess() number runs", cstring_compare(cs, expect) == 0 &&
+                                                 strstr(cs, "  1, 2, 3, 4, 9, 6, 7,") != NULL);
+    cstring_free(cs);
+
+    cstring_free(expect);
+    remove(TEST_INCLUDE_A);
+    remove(TEST_INCLUDE_B);
+}
+
+
+int main(void)
+{
+#ifdef WIN32
+    _CrtSetDbgFlag(_CrtSetDbgFlag(_CRTDBG_REPORT_FLAG) | _CRTDBG_LEAK_CHECK_DF);
+#endif
+
     test_preprocessor();
+    test_conditions();
+    test_if_expressions();
+    test_directives();
+    test_include_guards();
+    test_lexer_spans();
+    test_lexer_batch();
+    test_preprocessor_batch();
+    test_instances();
+    test_idents();
+    test_macro_cache();
+    test_locations();
+    test_stats();
+    test_trace();
+    test_snapshot();
+    test_tokcache();
+    test_depfile();
+    test_writer();
+    test_pipeline();
+    TEST_REPORT();
     return 0;
 }
@@ -2,6 +2,7 @@
 
 #include "config.h"
 #include "reader.h"
+#include "option.h"
 #include "unittest.h"
 
 #include <stdlib.h>
@@ -120,6 +121,113 @@ static void test_reader_case2()
 }
 
 
+static void test_reader_span(void)
+{
+    reader_t *reader;
+    const unsigned char *span;
+    size_t n;
+
+    reader = reader_create();
+    reader_push(reader, STREAM_TYPE_STRING, "int abcdefghijklmnopqrstuvwxyz_0123456789 = 1;\\\nx\r\ny");
+
+    n = reader_peek_span(reader, &span);
+    TEST_COND("reader_peek_span()", n == 46 && memcmp(span, "int ", 4) == 0);
+    TEST_COND("reader_peek_span()", reader_column(reader) == 1);
+
+    reader_advance(reader, 4);
+    TEST_COND("reader_advance()", reader_column(reader) == 5);
+    TEST_COND("reader_get()", reader_get(reader) == 'a');
+
+    reader_unget(reader, 'a');
+    TEST_COND("reader_peek_span()", reader_peek_span(reader, &span) == 0);
+    TEST_COND("reader_get()", reader_get(reader) == 'a');
+
+    n = reader_get_span(reader, &span);
+    TEST_COND("reader_get_span()", n == 41 && span[n - 1] == ';');
+    TEST_COND("reader_get_span()", reader_peek_span(reader, &span) == 0);
+
+    TEST_COND("reader_get()", reader_get(reader) == 'x');
+    TEST_COND("reader_line()", reader_line(reader) == 2);
+    TEST_COND("reader_get()", reader_get(reader) == '\n');
+    TEST_COND("reader_get_span()", reader_get_span(reader, &span) == 1 && *span == 'y');
+    TEST_COND("reader_get()", reader_get(reader) == '\n');
+    TEST_COND("reader_get()", reader_get(reader) == EOF);
+
+    reader_destroy(reader);
+}
+
+
+static void test_reader_skip(void)
+{
+    reader_t *reader;
+
+    reader = reader_create();
+    reader_push(reader, STREAM_TYPE_STRING,
+                "a # b \"#\" '#' /* \n# */ // \\\n#\n"
+                "  /* x */ #if\r\n"
+                "x\\\n#\n");
+
+    TEST_COND("reader_skip_to_hash()", reader_skip_to_hash(reader, true));
+    TEST_COND("reader_skip_to_hash()", reader_line(reader) == 4 && reader_get(reader) == '#');
+    TEST_COND("reader_skip_to_hash()", reader_get(reader) == 'i');
+
+    TEST_COND("reader_skip_to_hash() end", !reader_skip_to_hash(reader, false));
+    TEST_COND("reader_skip_to_hash() end", reader_get(reader) == EOF);
+
+    reader_destroy(reader);
+}
+
+
+static void test_reader_prepass(void)
+{
+    const char *fn = "testreader.prepass.tmp";
+    const char *sourcecode = "#in\\\r"
+        "clude<stdio.h>\r"
+        "int main(void) \\ { \r\n"
+        " printf(\"HelloWorld\"); \\\r\n"
+        "\\\n\\\r\n"
+        " \\ \n"                             /* warning */
+        "\\  \r "                            /* warning */
+        "\r\n"
+        "} x\\   ";                          /* warning */
+    reader_t *lazy, *clean;
+    cstring_t note1, note2;
+    bool same = true;
+    int ch;
+
+    if (!__write_file__(fn, sourcecode, 1)) {
+        return;
+    }
+
+    option->prepass = false;
+    lazy = reader_create();
+    reader_push(lazy, STREAM_TYPE_FILE, fn);
+
+    option->prepass = true;
+    clean = reader_create();
+    reader_push(clean, STREAM_TYPE_FILE, fn);
+
+    do {
+        same = same && reader_peek(lazy) == reader_peek(clean);
+        same = same && reader_line(lazy) == reader_line(clean);
+        same = same && reader_column(lazy) == reader_column(clean);
+        note1 = linenote2cs(reader_linenote(lazy));
+        note2 = linenote2cs(reader_linenote(clean));
+        same = same && cstring_compare_cs(note1, note2) == 0;
+        cstring_free(note1);
+        cstring_free(note2);
+        ch = reader_get(lazy);
+        same = same && ch == reader_get(clean);
+    } while (same && ch != EOF);
+
+    TEST_COND("prepass", same);
+
+    reader_destroy(lazy);
+    reader_destroy(clean);
+    remove(fn);
+}
+
+
 int main(void)
 {
 #ifdef WIN32
@@ -128,6 +236,9 @@ int main(void)
 
     test_reader_case1();
     test_reader_case2();
+    test_reader_span();
+    test_reader_skip();
+    test_reader_prepass();
     TEST_REPORT();
     return 0;
 }
@@ -0,0 +1,149 @@
+
+
+#include "config.h"
+#include "unittest.h"
+#include "cstring.h"
+#include "option.h"
+#include "thread.h"
+#include "srcpool.h"
+#include "driver.h"
+#include "server.h"
+
+
+#define TEST_SOCKET     "testserver.sock.tmp"
+#define TEST_HEADER     "testserver.h.tmp"
+#define TEST_UNIT       "testserver.c.tmp"
+#define TEST_BAD        "testserver.bad.tmp"
+#define TEST_OUTPUT     "testserver.out.tmp"
+
+
+static cstring_t __read_file__(const char *fn)
+{
+    cstring_t cs;
+    FILE *fp;
+    char buf[256];
+    size_t n;
+
+    cs = cstring_new_n(NULL, 256);
+    if ((fp = fopen(fn, "rb")) == NULL) {
+        return cs;
+    }
+
+    while ((n = fread(buf, 1, sizeof(buf), fp)) != 0) {
+        cs = cstring_concat_n(cs, buf, n);
+    }
+
+    fclose(fp);
+    return cs;
+}
+
+
+/* occ -E -o <output> <input>, as main() would run it */
+static int __run__(server_t *srv, int argc, char **argv, void *ud)
+{
+    option_t *opt;
+    driver_t *drv;
+    size_t nfailed;
+
+    (void) ud;
+
+    if (argc != 4 || strcmp(argv[1], "-o") != 0) {
+        return 2;
+    }
+
+    opt = option_create();
+    opt->Eflag = true;
+    opt->outfile = argv[2];
+
+    drv = driver_create(opt);
+    driver_add_input(drv, argv[3]);
+    driver_share(drv, srv->srcpool, server_include_paths(srv, drv->include_paths), srv->tokcache);
+
+    nfailed = driver_run(drv, 1);
+
+    driver_destroy(drv);
+    option_destroy(opt);
+
+    return nfailed != 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+static void __serve__(void *ud)
+{
+    server_serve((server_t *) ud, __run__, NULL);
+}
+
+
+static void test_server(void)
+{
+    server_t *srv;
+    thread_t thread;
+    cstring_t cs;
+    char *argv[] = {"occ", "-o", TEST_OUTPUT, TEST_UNIT};
+    char *bad[] = {"occ", "-x"};
+    char *errors[] = {"occ", "-o", TEST_OUTPUT, TEST_BAD};
+
+    __write_file__(TEST_HEADER, "int h;\n", 1);
+    __write_file__(TEST_UNIT, "#include \"" TEST_HEADER "\"\nint a;\n", 1);
+    __write_file__(TEST_BAD, "#include \"n1.tmp\"\n#include \"n2.tmp\"\n#include \"n3.tmp\"\n"
+                             "#include \"n4.tmp\"\n#include \"n5.tmp\"\n#include \"n6.tmp\"\n", 1);
+
+    srv = server_create(TEST_SOCKET);
+    TEST_COND("server_create()", srv != NULL);
+    if (srv == NULL) {
+        return;
+    }
+
+    TEST_COND("server_create() one server a socket", server_create(TEST_SOCKET) == NULL);
+    TEST_COND("server_forward() no server", server_forward("testserver.none.tmp", 4, argv) == -1);
+
+    if (!thread_create(&thread, __serve__, srv)) {
+        server_destroy(srv);
+        return;
+    }
+
+    TEST_COND("server_forward()", server_forward(TEST_SOCKET, 4, argv) == EXIT_SUCCESS);
+    cs = __read_file__(TEST_OUTPUT);
+    TEST_COND("server_forward() output", cstring_compare(cs, "# 1 \"" TEST_HEADER "\"\nint h;\n# 2 \"" TEST_UNIT "\"\nint a;\n") == 0);
+    cstring_free(cs);
+
+    TEST_COND("server_forward() exit status", server_forward(TEST_SOCKET, 2, bad) == 2);
+
+    /* an edit of the same size within the second is seen all the same */
+    __write_file__(TEST_HEADER, "int g;\n", 1);
+    TEST_COND("server_forward() again", server_forward(TEST_SOCKET, 4, argv) == EXIT_SUCCESS);
+    cs = __read_file__(TEST_OUTPUT);
+    TEST_COND("server_forward() reads an edited file", cstring_compare(cs, "# 1 \"" TEST_HEADER "\"\nint g;\n# 2 \"" TEST_UNIT "\"\nint a;\n") == 0);
+    cstring_free(cs);
+
+    remove(TEST_HEADER);
+    TEST_COND("server_forward() a header gone", server_forward(TEST_SOCKET, 4, argv) == EXIT_FAILURE);
+
+    /* too many errors end the unit, not the server */
+    TEST_COND("server_forward() errors", server_forward(TEST_SOCKET, 4, errors) == EXIT_FAILURE);
+    TEST_COND("server_forward() after errors", server_forward(TEST_SOCKET, 2, bad) == 2);
+
+    TEST_COND("server_shutdown()", server_shutdown(TEST_SOCKET));
+    thread_join(&thread);
+
+    TEST_COND("server_serve() keeps the sources", srcpool_length(srv->srcpool) != 0);
+    TEST_COND("server_serve() counts the requests", srv->requests == 6);
+
+    server_destroy(srv);
+
+    remove(TEST_UNIT);
+    remove(TEST_BAD);
+    remove(TEST_OUTPUT);
+}
+
+
+int main(void)
+{
+#ifdef WIN32
+    _CrtSetDbgFlag(_CrtSetDbgFlag(_CRTDBG_REPORT_FLAG) | _CRTDBG_LEAK_CHECK_DF);
+#endif
+
+    test_server();
+    TEST_REPORT();
+    return 0;
+}
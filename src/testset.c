@@ -97,6 +97,105 @@ static void test_set(void)
 }
 
 
+static set_t* __make_set__(int from, int to, bool swiss)
+{
+    set_t *set;
+    cstring_t cs;
+    int i;
+
+    set = swiss ? set_create_swiss() : set_create();
+    for (i = from; i < to; i++) {
+        cs = cstring_from_ll(i);
+        set_add(set, cs);
+        cstring_free(cs);
+    }
+
+    return set;
+}
+
+
+static bool __set_is__(set_t *set, int from, int to)
+{
+    cstring_t cs;
+    bool ok;
+    int i;
+
+    ok = set_length(set) == (size_t) (to - from);
+    for (i = from - 5; i < to + 5; i++) {
+        cs = cstring_from_ll(i);
+        ok = ok && set_has(set, cs) == (i >= from && i < to);
+        cstring_free(cs);
+    }
+
+    return ok;
+}
+
+
+static void test_small_set(bool swiss)
+{
+    set_t *a, *b, *c, *d;
+    cstring_t cs;
+
+    a = __make_set__(0, 4, swiss);
+    b = __make_set__(2, 6, swiss);
+
+    TEST_COND("small set_add()", a->d == NULL && __set_is__(a, 0, 4));
+
+    cs = cstring_from_ll(3);
+    TEST_COND("small set_add() existing", set_add(a, cs) && set_length(a) == 4);
+    cstring_free(cs);
+
+    c = set_union(a, b);
+    TEST_COND("small set_union()", c->d == NULL && __set_is__(c, 0, 6));
+    set_destroy(c);
+
+    c = set_intersection(a, b);
+    TEST_COND("small set_intersection()", c->d == NULL && __set_is__(c, 2, 4));
+    set_destroy(c);
+
+    c = set_dup(a);
+    TEST_COND("small set_dup()", c->d == NULL && __set_is__(c, 0, 4));
+    set_destroy(c);
+
+    set_concat_intersection(a, b);
+    TEST_COND("small set_concat_intersection()", __set_is__(a, 2, 4));
+    set_destroy(a);
+
+    /* past SET_SMALL_SIZE a union ends up in a dict */
+    a = __make_set__(0, 6, swiss);
+    set_destroy(b);
+    b = __make_set__(6, 12, swiss);
+
+    c = set_union(a, b);
+    TEST_COND("small set_union() promoted", c->d != NULL && __set_is__(c, 0, 12));
+
+    set_concat_union(a, b);
+    TEST_COND("small set_concat_union() promoted", a->d != NULL && __set_is__(a, 0, 12));
+
+    /* a small set against a promoted one */
+    set_destroy(b);
+    d = __make_set__(4, 8, swiss);
+    b = set_intersection(d, c);
+    set_destroy(d);
+    TEST_COND("set_intersection() small and promoted", b->d == NULL && __set_is__(b, 4, 8));
+
+    cs = cstring_from_ll(5);
+    TEST_COND("small set_del()", set_del(b, cs) && !set_has(b, cs) && set_length(b) == 3);
+    TEST_COND("small set_del() missing", !set_del(b, cs));
+    cstring_free(cs);
+
+    set_clear(b);
+    TEST_COND("small set_clear()", set_is_empty(b));
+
+    set_clear(c);
+    TEST_COND("set_clear() promoted", set_is_empty(c) && c->d != NULL);
+
+    set_destroy(a);
+    set_destroy(b);
+    set_destroy(c);
+}
+
+
 int main(void)
 {
 
@@ -105,6 +204,8 @@ int main(void)
 #endif
 
     test_set();
+    test_small_set(false);
+    test_small_set(true);
     TEST_REPORT();
     return 0;
 }
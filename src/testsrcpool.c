@@ -0,0 +1,115 @@
+
+
+#include "config.h"
+#include "array.h"
+#include "splice.h"
+#include "linemap.h"
+#include "srcpool.h"
+#include "unittest.h"
+
+
+#define TEST_SRCPOOL_SMALL_FILE     "testsrcpool.small.tmp"
+#define TEST_SRCPOOL_LARGE_FILE     "testsrcpool.large.tmp"
+#define TEST_SRCPOOL_SPLICE_FILE    "testsrcpool.splice.tmp"
+
+
+static void test_srcpool(void)
+{
+    srcpool_t *pool;
+    srcfile_t *file;
+
+    pool = srcpool_create();
+
+    TEST_COND("srcpool_load()", srcpool_load(pool, "testsrcpool.none.tmp") == NULL);
+
+    if (__write_file__(TEST_SRCPOOL_SMALL_FILE, "int a;\n", 1)) {
+        file = srcpool_load(pool, TEST_SRCPOOL_SMALL_FILE);
+        TEST_COND("srcpool_load()", file != NULL);
+        TEST_COND("srcpool_load()", file->length == 7);
+        TEST_COND("srcpool_load()", memcmp(file->text, "int a;\n", 7) == 0);
+        TEST_COND("srcpool_load()", file->text[file->length] == '\0');
+        TEST_COND("srcpool_load()", srcpool_load(pool, TEST_SRCPOOL_SMALL_FILE) == file);
+        TEST_COND("srcpool_length()", srcpool_length(pool) == 1);
+        remove(TEST_SRCPOOL_SMALL_FILE);
+    }
+
+    if (__write_file__(TEST_SRCPOOL_LARGE_FILE, "static int abc;\n", 6000)) {
+        file = srcpool_load(pool, TEST_SRCPOOL_LARGE_FILE);
+        TEST_COND("srcpool_load()", file != NULL);
+        TEST_COND("srcpool_load()", file->length == 16 * 6000);
+        TEST_COND("srcpool_load()", memcmp(&file->text[16 * 5999], "static int abc;\n", 16) == 0);
+        TEST_COND("srcpool_load()", srcpool_load(pool, TEST_SRCPOOL_LARGE_FILE) == file);
+        TEST_COND("srcpool_length()", srcpool_length(pool) == 2);
+        remove(TEST_SRCPOOL_LARGE_FILE);
+    }
+
+    /* both were loaded in this generation, none in the next */
+    TEST_COND("srcpool_sweep()", srcpool_sweep(pool, 1) == 0);
+    TEST_COND("srcpool_sweep()", srcpool_sweep(pool, 1) == 2 && srcpool_length(pool) == 0);
+
+    /* an exact page multiple still gets its '\0' */
+
+    if (__write_file__(TEST_SRCPOOL_LARGE_FILE, "static int abc;\n", 4096)) {
+        file = srcpool_load(pool, TEST_SRCPOOL_LARGE_FILE);
+        TEST_COND("srcpool_load()", file != NULL);
+        TEST_COND("srcpool_load()", file->length == 16 * 4096);
+        TEST_COND("srcpool_load()", file->text[file->length] == '\0');
+        remove(TEST_SRCPOOL_LARGE_FILE);
+    }
+
+    srcpool_destroy(pool);
+}
+
+
+static void test_srcpool_prepare(void)
+{
+    srcpool_t *pool;
+    srcfile_t *file;
+    size_t line, column;
+    const unsigned char *linenote;
+
+    pool = srcpool_create();
+
+    if (__write_file__(TEST_SRCPOOL_SMALL_FILE, "int a;\n", 2)) {
+        file = srcpool_load(pool, TEST_SRCPOOL_SMALL_FILE);
+        srcpool_prepare(pool, file);
+        TEST_COND("srcpool_prepare()", file->clean == file->text);
+        TEST_COND("srcpool_prepare()", array_length(file->splices) == 0);
+        remove(TEST_SRCPOOL_SMALL_FILE);
+    }
+
+    if (__write_file__(TEST_SRCPOOL_SPLICE_FILE, "a\r\nb\\\nc \\ d\\", 1)) {
+        file = srcpool_load(pool, TEST_SRCPOOL_SPLICE_FILE);
+        srcpool_prepare(pool, file);
+        TEST_COND("srcpool_prepare()", file->clean != file->text);
+        TEST_COND("srcpool_prepare()", file->clean_length == 9);
+        TEST_COND("srcpool_prepare()", memcmp(file->clean, "a\nbc \\ d\n", 10) == 0);
+        TEST_COND("srcpool_prepare()", array_length(file->splices) == 3);
+        TEST_COND("splice_physical()", splice_physical(file->splices, 1) == 1);
+        TEST_COND("splice_physical()", splice_physical(file->splices, 2) == 3);
+        TEST_COND("splice_physical()", splice_physical(file->splices, 3) == 6);
+        TEST_COND("splice_physical()", splice_physical(file->splices, 8) == 11);
+        TEST_COND("linemap_lines()", linemap_lines(file->lines) == 3);
+        linemap_resolve(file->lines, 7, &line, &column, &linenote);
+        TEST_COND("linemap_resolve()", line == 3 && column == 2 && *linenote == 'c');
+        linemap_resolve(file->lines, 1, &line, &column, &linenote);
+        TEST_COND("linemap_resolve()", line == 1 && column == 2 && *linenote == 'a');
+        remove(TEST_SRCPOOL_SPLICE_FILE);
+    }
+
+    srcpool_destroy(pool);
+}
+
+
+int main(void)
+{
+
+#ifdef WIN32
+    _CrtSetDbgFlag(_CrtSetDbgFlag(_CRTDBG_REPORT_FLAG) | _CRTDBG_LEAK_CHECK_DF);
+#endif
+
+    test_srcpool();
+    test_srcpool_prepare();
+    TEST_REPORT();
+    return 0;
+}
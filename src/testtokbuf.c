@@ -0,0 +1,136 @@
+
+
+#include "config.h"
+#include "cstring.h"
+#include "token.h"
+#include "cspool.h"
+#include "reader.h"
+#include "lexer.h"
+#include "tokbuf.h"
+#include "unittest.h"
+
+
+/* the offset into its buffer, each of the two lexers has a range for it */
+static size_t __offset__(srcloc_t loc)
+{
+    size_t offset = 0;
+
+    srcloc_buffer(loc, &offset);
+    return offset;
+}
+
+
+static void test_tokbuf(void)
+{
+    lexer_t *serial, *lexer;
+    tokbuf_t *tb;
+    token_t *token, *copy;
+    cstring_t source, cs;
+    const unsigned char *spelling, *expect;
+    size_t i, n, length, sides = 0;
+    bool same = true;
+
+    source = cstring_new("while (x1 > 0x10) { s = \"a\\tb\"; }\n"
+                         "#  define Y 'c' @\n");
+    for (i = 0; i < 300; i++) {
+        source = cstring_push_ch(source, ' ');
+    }
+    source = cstring_concat_n(source, "far\n", 4);
+
+    serial = lexer_create();
+    lexer = lexer_create();
+    lexer_push(serial, STREAM_TYPE_STRING, source);
+    lexer_push(lexer, STREAM_TYPE_STRING, source);
+
+    tb = lexer_tokenize_compact(lexer);
+    TEST_COND("lexer_tokenize_compact()", tb != NULL);
+
+    for (i = 0; ; i++) {
+        token = lexer_scan(serial);
+        if (token->type == TOKEN_EOF) {
+            break;
+        }
+
+        if (i >= tokbuf_length(tb)) {
+            same = false;
+            break;
+        }
+
+        expect = token_spelling(token, &length);
+        spelling = tokbuf_spelling(tb, i, &n);
+
+        if (tokbuf_type(tb, i) != token->type ||
+            tokbuf_keyword(tb, i) != token->keyword ||
+            __offset__(tokbuf_loc(tb, i)) != __offset__(token->loc) ||
+            tokbuf_spaces(tb, i) != token->spaces ||
+            tokbuf_begin_of_line(tb, i) != token->begin_of_line ||
+            tokbuf_hideset(tb, i) != NULL ||
+            n != length || memcmp(spelling, expect, n) != 0) {
+            same = false;
+        }
+
+        if (tokbuf_side(tb, i) != NULL) {
+            sides++;
+        }
+    }
+
+    TEST_COND("tokbuf_t same as the tokens", same && i == tokbuf_length(tb));
+    TEST_COND("tokbuf_t side table", sides == array_length(tb->sides) && sides == 4);
+
+    /* the escaped string is not a slice, the last identifier has 300 spaces */
+    TEST_COND("tokbuf_spelling() side", tokbuf_length(tb) > 9 &&
+                                        tokbuf_type(tb, 9) == TOKEN_CONSTANT_STRING &&
+                                        cstring_compare((cstring_t) tokbuf_spelling(tb, 9, &n),
+                                                        "a\tb") == 0);
+    TEST_COND("tokbuf_spaces() side", tokbuf_spaces(tb, tokbuf_length(tb) - 2) == 300);
+    TEST_COND("tokbuf_type() unknown", tokbuf_type(tb, tokbuf_length(tb) - 4) == TOKEN_UNKNOWN);
+
+    copy = tokbuf_token(tb, 0);
+    cs = token_cs(copy);
+    TEST_COND("tokbuf_token()", copy->type == TOKEN_IDENTIFIER &&
+                                copy->keyword == TOKEN_WHILE &&
+                                copy->begin_of_line &&
+                                cstring_compare(cs, "while") == 0);
+    token_destroy(copy);
+
+    tokbuf_destroy(tb);
+    lexer_destroy(serial);
+    lexer_destroy(lexer);
+    cstring_free(source);
+}
+
+
+static void test_tokbuf_heap(void)
+{
+    tokbuf_t *tb;
+    token_t *token;
+    const unsigned char *spelling;
+    size_t n;
+
+    tb = tokbuf_create(NULL, 0);
+
+    token = token_create(TOKEN_IDENTIFIER, cstring_new("name"), SRCLOC_NONE);
+    token->is_vararg = true;
+    tokbuf_push(tb, token);
+
+    spelling = tokbuf_spelling(tb, 0, &n);
+    TEST_COND("tokbuf_push() heap token", n == 4 && memcmp(spelling, "name", 4) == 0 &&
+                                          tokbuf_is_vararg(tb, 0) &&
+                                          tokbuf_side(tb, 0) != NULL);
+
+    tokbuf_destroy(tb);
+    token_destroy(token);
+}
+
+
+int main(void)
+{
+#ifdef WIN32
+    _CrtSetDbgFlag(_CrtSetDbgFlag(_CRTDBG_REPORT_FLAG) | _CRTDBG_LEAK_CHECK_DF);
+#endif
+
+    test_tokbuf();
+    test_tokbuf_heap();
+    TEST_REPORT();
+    return 0;
+}
@@ -0,0 +1,188 @@
+
+
+#include "config.h"
+#include "pmalloc.h"
+#include "thread.h"
+
+
+typedef struct thread_start_s {
+    thread_routine_pt routine;
+    void *ud;
+} thread_start_t;
+
+
+#if defined(WINDOWS)
+
+static
+DWORD WINAPI __thread_start__(LPVOID arg)
+{
+    thread_start_t start = *(thread_start_t *) arg;
+    pfree(arg);
+    start.routine(start.ud);
+    return 0;
+}
+
+
+bool thread_create(thread_t *thread, thread_routine_pt routine, void *ud)
+{
+    thread_start_t *start = (thread_start_t *) pmalloc(sizeof(thread_start_t));
+
+    start->routine = routine;
+    start->ud = ud;
+
+    if ((*thread = CreateThread(NULL, 0, __thread_start__, start, 0, NULL)) == NULL) {
+        pfree(start);
+        return false;
+    }
+    return true;
+}
+
+
+void thread_join(thread_t *thread)
+{
+    WaitForSingleObject(*thread, INFINITE);
+    CloseHandle(*thread);
+}
+
+
+void mutex_init(mutex_t *mutex)
+{
+    InitializeCriticalSection(mutex);
+}
+
+
+void mutex_destroy(mutex_t *mutex)
+{
+    DeleteCriticalSection(mutex);
+}
+
+
+void mutex_lock(mutex_t *mutex)
+{
+    EnterCriticalSection(mutex);
+}
+
+
+void mutex_unlock(mutex_t *mutex)
+{
+    LeaveCriticalSection(mutex);
+}
+
+
+void cond_init(cond_t *cond)
+{
+    InitializeConditionVariable(cond);
+}
+
+
+void cond_destroy(cond_t *cond)
+{
+    (void) cond;
+}
+
+
+void cond_wait(cond_t *cond, mutex_t *mutex)
+{
+    SleepConditionVariableCS(cond, mutex, INFINITE);
+}
+
+
+void cond_signal(cond_t *cond)
+{
+    WakeConditionVariable(cond);
+}
+
+
+void cond_broadcast(cond_t *cond)
+{
+    WakeAllConditionVariable(cond);
+}
+
+
+#else
+
+static
+void* __thread_start__(void *arg)
+{
+    thread_start_t start = *(thread_start_t *) arg;
+    pfree(arg);
+    start.routine(start.ud);
+    return NULL;
+}
+
+
+bool thread_create(thread_t *thread, thread_routine_pt routine, void *ud)
+{
+    thread_start_t *start = (thread_start_t *) pmalloc(sizeof(thread_start_t));
+
+    start->routine = routine;
+    start->ud = ud;
+
+    if (pthread_create(thread, NULL, __thread_start__, start) != 0) {
+        pfree(start);
+        return false;
+    }
+    return true;
+}
+
+
+void thread_join(thread_t *thread)
+{
+    pthread_join(*thread, NULL);
+}
+
+
+void mutex_init(mutex_t *mutex)
+{
+    pthread_mutex_init(mutex, NULL);
+}
+
+
+void mutex_destroy(mutex_t *mutex)
+{
+    pthread_mutex_destroy(mutex);
+}
+
+
+void mutex_lock(mutex_t *mutex)
+{
+    pthread_mutex_lock(mutex);
+}
+
+
+void mutex_unlock(mutex_t *mutex)
+{
+    pthread_mutex_unlock(mutex);
+}
+
+
+void cond_init(cond_t *cond)
+{
+    pthread_cond_init(cond, NULL);
+}
+
+
+void cond_destroy(cond_t *cond)
+{
+    pthread_cond_destroy(cond);
+}
+
+
+void cond_wait(cond_t *cond, mutex_t *mutex)
+{
+    pthread_cond_wait(cond, mutex);
+}
+
+
+void cond_signal(cond_t *cond)
+{
+    pthread_cond_signal(cond);
+}
+
+
+void cond_broadcast(cond_t *cond)
+{
+    pthread_cond_broadcast(cond);
+}
+
+#endif
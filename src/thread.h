@@ -0,0 +1,68 @@
+
+
+#ifndef __THREAD__H__
+#define __THREAD__H__
+
+
+#include "config.h"
+
+
+#if defined(WINDOWS)
+#   include <Windows.h>
+#else
+#   include <pthread.h>
+#endif
+
+
+/**
+ * Thin wrappers over pthreads and the Win32 primitives, just what the
+ * background workers need.
+ **/
+#if defined(WINDOWS)
+
+typedef HANDLE              thread_t;
+typedef CRITICAL_SECTION    mutex_t;
+typedef CONDITION_VARIABLE  cond_t;
+
+#else
+
+typedef pthread_t           thread_t;
+typedef pthread_mutex_t     mutex_t;
+typedef pthread_cond_t      cond_t;
+
+#endif
+
+
+typedef void (*thread_routine_pt)(void *ud);
+
+
+/**
+ * A pointer published with a release store is seen with everything
+ * written before it by a reader that loads it with acquire. MSVC gives
+ * volatile accesses those semantics.
+ **/
+#if defined(_MSC_VER)
+#   define atomic_load_acquire(p)       (*(void * volatile *) (p))
+#   define atomic_store_release(p, v)   (*(void * volatile *) (p) = (void *) (v))
+#else
+#   define atomic_load_acquire(p)       __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#   define atomic_store_release(p, v)   __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#endif
+
+
+bool thread_create(thread_t *thread, thread_routine_pt routine, void *ud);
+void thread_join(thread_t *thread);
+
+void mutex_init(mutex_t *mutex);
+void mutex_destroy(mutex_t *mutex);
+void mutex_lock(mutex_t *mutex);
+void mutex_unlock(mutex_t *mutex);
+
+void cond_init(cond_t *cond);
+void cond_destroy(cond_t *cond);
+void cond_wait(cond_t *cond, mutex_t *mutex);
+void cond_signal(cond_t *cond);
+void cond_broadcast(cond_t *cond);
+
+
+#endif
@@ -0,0 +1,278 @@
+
+
+#include "config.h"
+#include "pmalloc.h"
+#include "array.h"
+#include "cstring.h"
+#include "token.h"
+#include "hideset.h"
+#include "tokbuf.h"
+
+
+#ifndef TOKBUF_INIT_CAPACITY
+#define TOKBUF_INIT_CAPACITY    (256)
+#endif
+
+
+static bool __tokbuf_grow__(tokbuf_t *tb);
+static bool __tokbuf_in_text__(tokbuf_t *tb, const unsigned char *p, size_t n);
+
+
+/**
+ * text is the buffer the spellings of the tokens to come are sliced
+ * from, NULL if there is none.
+ **/
+tokbuf_t* tokbuf_create(const unsigned char *text, size_t length)
+{
+    tokbuf_t *tb;
+
+    tb = (tokbuf_t *) pmalloc(sizeof(tokbuf_t));
+    if (!tb) {
+        return NULL;
+    }
+
+    tb->text = text;
+    tb->text_length = length;
+
+    tb->length = 0;
+    tb->capacity = 0;
+    tb->types = NULL;
+    tb->keywords = NULL;
+    tb->flags = NULL;
+    tb->spaces = NULL;
+    tb->locs = NULL;
+    tb->spellings = NULL;
+    tb->lengths = NULL;
+
+    tb->sides = array_create(sizeof(tokbuf_side_t));
+
+    return tb;
+}
+
+
+void tokbuf_destroy(tokbuf_t *tb)
+{
+    assert(tb != NULL);
+
+    pfree(tb->types);
+    pfree(tb->keywords);
+    pfree(tb->flags);
+    pfree(tb->spaces);
+    pfree(tb->locs);
+    pfree(tb->spellings);
+    pfree(tb->lengths);
+
+    array_destroy(tb->sides);
+    pfree(tb);
+}
+
+
+/**
+ * Records the token, which must outlive the buffer if its spelling or
+ * hideset end up in the side table.
+ **/
+bool tokbuf_push(tokbuf_t *tb, token_t *token)
+{
+    const unsigned char *spelling;
+    size_t length, i;
+    unsigned char flags = 0;
+
+    assert(token->type < TOKBUF_NONE && token->keyword < TOKBUF_NONE);
+
+    if (tb->length == tb->capacity && !__tokbuf_grow__(tb)) {
+        return false;
+    }
+
+    i = tb->length;
+    spelling = token_spelling(token, &length);
+
+    if (token->begin_of_line) {
+        flags |= TOKBUF_BEGIN_OF_LINE;
+    }
+
+    if (token->is_vararg) {
+        flags |= TOKBUF_VARARG;
+    }
+
+    tb->types[i] = token->type == TOKEN_UNKNOWN ? TOKBUF_NONE : (unsigned char) token->type;
+    tb->keywords[i] = token->keyword == TOKEN_UNKNOWN ? TOKBUF_NONE : (unsigned char) token->keyword;
+    tb->spaces[i] = token->spaces < UCHAR_MAX ? (unsigned char) token->spaces : UCHAR_MAX;
+    tb->locs[i] = token->loc;
+
+    if (length == 0) {
+        tb->spellings[i] = 0;
+        tb->lengths[i] = 0;
+    } else if (__tokbuf_in_text__(tb, spelling, length)) {
+        tb->spellings[i] = (uint32_t) (spelling - tb->text);
+        tb->lengths[i] = (uint32_t) length;
+    } else {
+        tb->spellings[i] = 0;
+        tb->lengths[i] = UINT32_MAX;
+    }
+
+    if (tb->lengths[i] == UINT32_MAX ||
+        token->hideset != NULL ||
+        token->spaces >= UCHAR_MAX) {
+
+        tokbuf_side_t *side = array_push_back(tb->sides);
+        if (!side) {
+            return false;
+        }
+
+        side->index = i;
+        side->cs = tb->lengths[i] == UINT32_MAX ? token_cs(token) : NULL;
+        side->hideset = token->hideset;
+        side->spaces = token->spaces;
+
+        flags |= TOKBUF_SIDE;
+    }
+
+    tb->flags[i] = flags;
+    tb->length++;
+
+    return true;
+}
+
+
+bool tokbuf_push_tokens(tokbuf_t *tb, array_t *tokens)
+{
+    token_t **toks;
+    size_t i;
+
+    array_foreach(tokens, toks, i) {
+        if (!tokbuf_push(tb, toks[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+tokbuf_side_t* tokbuf_side(tokbuf_t *tb, size_t i)
+{
+    tokbuf_side_t *sides;
+    size_t lo, hi, mid;
+
+    if (!(tb->flags[i] & TOKBUF_SIDE)) {
+        return NULL;
+    }
+
+    sides = array_prototype(tb->sides, tokbuf_side_t);
+
+    for (lo = 0, hi = array_length(tb->sides); lo < hi; ) {
+        mid = lo + (hi - lo) / 2;
+
+        if (sides[mid].index < i) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    assert(lo < array_length(tb->sides) && sides[lo].index == i);
+    return &sides[lo];
+}
+
+
+/**
+ * The spelling without going through a token_t, not NUL terminated unless
+ * it comes from the side table.
+ **/
+const unsigned char* tokbuf_spelling(tokbuf_t *tb, size_t i, size_t *length)
+{
+    if (tb->lengths[i] == UINT32_MAX) {
+        cstring_t cs = tokbuf_side(tb, i)->cs;
+        *length = cstring_length(cs);
+        return cs;
+    }
+
+    *length = tb->lengths[i];
+    return tb->lengths[i] != 0 ? tb->text + tb->spellings[i] : (const unsigned char *) "";
+}
+
+
+srcloc_t tokbuf_loc(tokbuf_t *tb, size_t i)
+{
+    return tb->locs[i];
+}
+
+
+size_t tokbuf_spaces(tokbuf_t *tb, size_t i)
+{
+    return tb->flags[i] & TOKBUF_SIDE ? tokbuf_side(tb, i)->spaces : tb->spaces[i];
+}
+
+
+hideset_t* tokbuf_hideset(tokbuf_t *tb, size_t i)
+{
+    return tb->flags[i] & TOKBUF_SIDE ? tokbuf_side(tb, i)->hideset : NULL;
+}
+
+
+/**
+ * A token_t of its own for code that wants one, the spelling is copied
+ * and the hideset referenced.
+ **/
+token_t* tokbuf_token(tokbuf_t *tb, size_t i)
+{
+    tokbuf_side_t *side;
+    const unsigned char *spelling;
+    size_t length;
+    token_t *token;
+
+    side = tokbuf_side(tb, i);
+    spelling = tokbuf_spelling(tb, i, &length);
+
+    token = token_create(tokbuf_type(tb, i), cstring_new_n(spelling, length), tb->locs[i]);
+    if (!token) {
+        return NULL;
+    }
+
+    token->keyword = tokbuf_keyword(tb, i);
+    token->ident = NULL;
+    token->hideset = side ? hideset_ref(side->hideset) : NULL;
+    token->begin_of_line = tokbuf_begin_of_line(tb, i);
+    token->spaces = side ? side->spaces : tb->spaces[i];
+    token->is_vararg = tokbuf_is_vararg(tb, i);
+
+    return token;
+}
+
+
+static
+bool __tokbuf_grow__(tokbuf_t *tb)
+{
+    size_t capacity = tb->capacity ? tb->capacity * 2 : TOKBUF_INIT_CAPACITY;
+
+#undef  TOKBUF_RESIZE
+#define TOKBUF_RESIZE(field)                                                \
+    do {                                                                    \
+        void *p = prealloc(tb->field, capacity * sizeof(tb->field[0]));     \
+        if (!p) {                                                           \
+            return false;                                                   \
+        }                                                                   \
+        tb->field = p;                                                      \
+    } while (false)
+
+    TOKBUF_RESIZE(types);
+    TOKBUF_RESIZE(keywords);
+    TOKBUF_RESIZE(flags);
+    TOKBUF_RESIZE(spaces);
+    TOKBUF_RESIZE(locs);
+    TOKBUF_RESIZE(spellings);
+    TOKBUF_RESIZE(lengths);
+
+#undef TOKBUF_RESIZE
+
+    tb->capacity = capacity;
+    return true;
+}
+
+
+static inline
+bool __tokbuf_in_text__(tokbuf_t *tb, const unsigned char *p, size_t n)
+{
+    return tb->text != NULL && p >= tb->text && p + n <= tb->text + tb->text_length &&
+           tb->text_length <= UINT32_MAX;
+}
@@ -0,0 +1,105 @@
+
+
+#ifndef __TOKBUF__H__
+#define __TOKBUF__H__
+
+
+#include "config.h"
+#include "cstring.h"
+#include "token.h"
+
+
+#define TOKBUF_BEGIN_OF_LINE    0x01
+#define TOKBUF_VARARG           0x02
+#define TOKBUF_SIDE             0x04    /* the rest is in the side table */
+
+
+#define TOKBUF_NONE             0xff    /* TOKEN_UNKNOWN as a byte */
+
+
+/**
+ * The fields of a token that do not fit the arrays: a spelling that is
+ * not a slice of the text, a hideset or more spaces than a byte holds.
+ * The entry holds all of them.
+ **/
+typedef struct tokbuf_side_s {
+    size_t index;
+    cstring_t cs;
+    hideset_t *hideset;
+    size_t spaces;
+} tokbuf_side_t;
+
+
+/**
+ * The tokens of a stream laid out as parallel arrays, for passes that walk
+ * them in order. Spellings are ranges of text, the buffer of the stream,
+ * and tokens with anything unusual have an entry in sides, sorted by
+ * index. Nothing is owned but the arrays: the text, the spellings and
+ * hidesets of the side table live as long as the tokens they came from.
+ **/
+typedef struct tokbuf_s {
+    const unsigned char *text;
+    size_t text_length;
+
+    size_t length;
+    size_t capacity;
+    unsigned char *types;
+    unsigned char *keywords;
+    unsigned char *flags;
+    unsigned char *spaces;
+    srcloc_t *locs;
+    uint32_t *spellings;
+    uint32_t *lengths;
+
+    array_t *sides;
+} tokbuf_t;
+
+
+tokbuf_t* tokbuf_create(const unsigned char *text, size_t length);
+void tokbuf_destroy(tokbuf_t *tb);
+bool tokbuf_push(tokbuf_t *tb, token_t *token);
+bool tokbuf_push_tokens(tokbuf_t *tb, array_t *tokens);
+tokbuf_side_t* tokbuf_side(tokbuf_t *tb, size_t i);
+const unsigned char* tokbuf_spelling(tokbuf_t *tb, size_t i, size_t *length);
+srcloc_t tokbuf_loc(tokbuf_t *tb, size_t i);
+size_t tokbuf_spaces(tokbuf_t *tb, size_t i);
+hideset_t* tokbuf_hideset(tokbuf_t *tb, size_t i);
+token_t* tokbuf_token(tokbuf_t *tb, size_t i);
+
+
+static inline
+size_t tokbuf_length(tokbuf_t *tb)
+{
+    return tb->length;
+}
+
+
+static inline
+token_type_t tokbuf_type(tokbuf_t *tb, size_t i)
+{
+    return tb->types[i] == TOKBUF_NONE ? TOKEN_UNKNOWN : (token_type_t) tb->types[i];
+}
+
+
+static inline
+token_type_t tokbuf_keyword(tokbuf_t *tb, size_t i)
+{
+    return tb->keywords[i] == TOKBUF_NONE ? TOKEN_UNKNOWN : (token_type_t) tb->keywords[i];
+}
+
+
+static inline
+bool tokbuf_begin_of_line(tokbuf_t *tb, size_t i)
+{
+    return (tb->flags[i] & TOKBUF_BEGIN_OF_LINE) != 0;
+}
+
+
+static inline
+bool tokbuf_is_vararg(tokbuf_t *tb, size_t i)
+{
+    return (tb->flags[i] & TOKBUF_VARARG) != 0;
+}
+
+
+#endif
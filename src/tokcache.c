@@ -0,0 +1,290 @@
+
+
+#include "config.h"
+#include "pmalloc.h"
+#include "array.h"
+#include "dict.h"
+#include "hash.h"
+#include "cstring.h"
+#include "token.h"
+#include "snapshot.h"
+#include "tokcache.h"
+
+
+/**
+ * A fixed key, unlike the dict seed, so that a text hashes the same in
+ * every run that reads the directory.
+ **/
+static const uint8_t __tokcache_seed__[16] = {
+    'o', 'c', 'c', '-', 't', 'o', 'k', 'c', 'a', 'c', 'h', 'e', '-', 'k', 'e', 'y'
+};
+
+
+static void __tokcache_key__(tokcache_t *cache, const unsigned char *text, size_t length, unsigned flags);
+static cstring_t __tokcache_path__(tokcache_t *cache);
+static array_t* __tokcache_load__(tokcache_t *cache, size_t length, unsigned flags);
+static void __tokcache_save__(tokcache_t *cache, array_t *tokens, size_t length, unsigned flags);
+
+
+static inline
+uint64_t __hash_fn__(const void *key)
+{
+    return dict_gen_hash_function((unsigned char*)key, cstring_length((cstring_t)key));
+}
+
+
+static inline
+int __compare_fn__(void *privdata, const void *key1, const void *key2)
+{
+    size_t l1, l2;
+    DICT_NOTUSED(privdata);
+
+    l1 = cstring_length((cstring_t)key1);
+    l2 = cstring_length((cstring_t)key2);
+
+    return l1 == l2 && memcmp(key1, key2, l1) == 0;
+}
+
+
+static inline
+void __key_free_fn__(void *privdata, void *key)
+{
+    DICT_NOTUSED(privdata);
+    cstring_free((cstring_t)key);
+}
+
+
+static inline
+void __tokens_free_fn__(void *privdata, void *val)
+{
+    DICT_NOTUSED(privdata);
+    tokens_free((array_t *)val);
+}
+
+
+dict_type_t __tokcache_dict_type__ = {
+    __hash_fn__,
+    NULL,
+    NULL,
+    __compare_fn__,
+    __key_free_fn__,
+    __tokens_free_fn__
+};
+
+
+/**
+ * dir is where entries are read from and written to, NULL to keep them
+ * in memory only.
+ **/
+tokcache_t* tokcache_create(const char *dir)
+{
+    tokcache_t *cache;
+
+    cache = (tokcache_t *)pmalloc(sizeof(tokcache_t));
+    if (!cache) {
+        return NULL;
+    }
+
+    cache->dir = dir != NULL ? cstring_new(dir) : NULL;
+    cache->d = dict_create(&__tokcache_dict_type__, NULL);
+    cache->key = cstring_new_n(NULL, 32);
+
+    return cache;
+}
+
+
+void tokcache_destroy(tokcache_t *cache)
+{
+    if (cache->dir != NULL) {
+        cstring_free(cache->dir);
+    }
+
+    dict_destroy(cache->d);
+    cstring_free(cache->key);
+    pfree(cache);
+}
+
+
+/**
+ * The templates a text was lexed into, from memory or else from the
+ * directory, NULL if neither has them.
+ **/
+array_t* tokcache_find(tokcache_t *cache, const unsigned char *text, size_t length, unsigned flags)
+{
+    dict_entry_t *entry;
+    array_t *tokens;
+
+    __tokcache_key__(cache, text, length, flags);
+
+    entry = dict_find(cache->d, cache->key);
+    if (entry) {
+        return dict_get_val(entry);
+    }
+
+    if (cache->dir == NULL || (tokens = __tokcache_load__(cache, length, flags)) == NULL) {
+        return NULL;
+    }
+
+    dict_add(cache->d, cstring_dup(cache->key), tokens);
+    return tokens;
+}
+
+
+/**
+ * Takes the templates text was lexed into, token_t the cache now owns,
+ * and writes them through to the directory.
+ **/
+array_t* tokcache_add(tokcache_t *cache, const unsigned char *text, size_t length, unsigned flags,
+    array_t *tokens)
+{
+    __tokcache_key__(cache, text, length, flags);
+
+    if (!dict_add(cache->d, cstring_dup(cache->key), tokens)) {
+        tokens_free(tokens);
+        return NULL;
+    }
+
+    if (cache->dir != NULL) {
+        __tokcache_save__(cache, tokens, length, flags);
+    }
+
+    return tokens;
+}
+
+
+size_t tokcache_length(tokcache_t *cache)
+{
+    return dict_length(cache->d);
+}
+
+
+static
+void __tokcache_key__(tokcache_t *cache, const unsigned char *text, size_t length, unsigned flags)
+{
+    uint64_t hash = siphash(text, length, __tokcache_seed__);
+
+    cstring_clear(cache->key);
+    cache->key = cstring_concat_pf(cache->key, "%016llx-%lx-%x",
+        (unsigned long long) hash, (unsigned long) length, flags);
+}
+
+
+static
+cstring_t __tokcache_path__(tokcache_t *cache)
+{
+    cstring_t path;
+
+    path = cstring_dup(cache->dir);
+    path = cstring_concat_ch(path, '/');
+    path = cstring_concat_n(path, cache->key, cstring_length(cache->key));
+    path = cstring_concat_n(path, ".tok", 4);
+    return path;
+}
+
+
+/**
+ * An entry file holds the length and flags it was made for, which are
+ * checked again, then type, keyword, spaces, begin of line and vararg,
+ * offset and spelling for each token.
+ **/
+static
+array_t* __tokcache_load__(tokcache_t *cache, size_t length, unsigned flags)
+{
+    snapshot_reader_t r;
+    snapshot_t *snap;
+    array_t *tokens;
+    token_t *token;
+    const unsigned char *spelling;
+    uint32_t i, n, spaces, bits, loc;
+    int32_t type, keyword;
+    cstring_t path;
+    size_t spelling_length;
+
+    path = __tokcache_path__(cache);
+    snap = snapshot_open((const char *) path);
+    cstring_free(path);
+
+    if (snap == NULL) {
+        return NULL;
+    }
+
+    snapshot_reader_init(&r, snap->data, snap->length);
+
+    if (snapshot_get_u32(&r) != (uint32_t) length || snapshot_get_u32(&r) != flags) {
+        snapshot_close(snap);
+        return NULL;
+    }
+
+    /* the count is only what the file says, the array grows as tokens read */
+    n = snapshot_get_u32(&r);
+    tokens = array_create(sizeof(token_t*));
+
+    for (i = 0; i < n && r.ok; i++) {
+        type = (int32_t) snapshot_get_u32(&r);
+        keyword = (int32_t) snapshot_get_u32(&r);
+        spaces = snapshot_get_u32(&r);
+        bits = snapshot_get_u32(&r);
+        loc = snapshot_get_u32(&r);
+        spelling = snapshot_get_bytes(&r, &spelling_length);
+
+        /* a type this build does not have is a damaged entry, lexed again */
+        if (type < TOKEN_EOF || type >= TOKEN_LAST || keyword < TOKEN_UNKNOWN || keyword >= TOKEN_LAST) {
+            r.ok = false;
+        }
+
+        if (!r.ok) {
+            break;
+        }
+
+        token = token_create((token_type_t) type, cstring_new_n(spelling, spelling_length), SRCLOC_NONE);
+        token->keyword = (token_type_t) keyword;
+        token->spaces = spaces;
+        token->begin_of_line = (bits & 1) != 0;
+        token->is_vararg = (bits & 2) != 0;
+        token->loc = loc;
+
+        array_cast_append(token_t*, tokens, token);
+    }
+
+    if (!r.ok || r.p != r.end) {
+        tokens_free(tokens);
+        tokens = NULL;
+    }
+
+    snapshot_close(snap);
+    return tokens;
+}
+
+
+static
+void __tokcache_save__(tokcache_t *cache, array_t *tokens, size_t length, unsigned flags)
+{
+    const unsigned char *spelling;
+    token_t **base;
+    cstring_t buf, path;
+    size_t i, n;
+
+    buf = cstring_new_n(NULL, 64 + array_length(tokens) * 24);
+
+    buf = snapshot_put_u32(buf, (uint32_t) length);
+    buf = snapshot_put_u32(buf, flags);
+    buf = snapshot_put_u32(buf, (uint32_t) array_length(tokens));
+
+    array_foreach(tokens, base, i) {
+        buf = snapshot_put_u32(buf, (uint32_t) base[i]->type);
+        buf = snapshot_put_u32(buf, (uint32_t) base[i]->keyword);
+        buf = snapshot_put_u32(buf, (uint32_t) base[i]->spaces);
+        buf = snapshot_put_u32(buf, (base[i]->begin_of_line ? 1 : 0) | (base[i]->is_vararg ? 2 : 0));
+        buf = snapshot_put_u32(buf, base[i]->loc);
+
+        spelling = token_spelling(base[i], &n);
+        buf = snapshot_put_bytes(buf, spelling, n);
+    }
+
+    /* a cache that cannot be written only makes the next run slower */
+    path = __tokcache_path__(cache);
+    snapshot_write((const char *) path, buf);
+
+    cstring_free(path);
+    cstring_free(buf);
+}
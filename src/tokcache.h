@@ -0,0 +1,44 @@
+
+
+#ifndef __TOKCACHE__H__
+#define __TOKCACHE__H__
+
+
+#include "config.h"
+#include "cstring.h"
+
+
+typedef struct array_s      array_t;
+typedef struct dict_s       dict_t;
+
+
+/* what changes the tokens a text is lexed into, part of the key */
+#define TOKCACHE_TRIVIA             0x01
+#define TOKCACHE_PREPASS            0x02
+#define TOKCACHE_RESERVE_COMMENT    0x04
+
+
+/**
+ * The tokens files were lexed into, by content: a hash of the text, its
+ * length and the TOKCACHE_ flags. They are kept as token_t templates whose
+ * loc is the offset into the file, which the include that replays them
+ * adds to a range of its own. With a directory the entries are also
+ * written there, one file per key, for later runs to read back.
+ * Like identtab_t, only the owning thread may use it.
+ **/
+typedef struct tokcache_s {
+    cstring_t dir;
+    dict_t *d;
+    cstring_t key;
+} tokcache_t;
+
+
+tokcache_t* tokcache_create(const char *dir);
+void tokcache_destroy(tokcache_t *cache);
+array_t* tokcache_find(tokcache_t *cache, const unsigned char *text, size_t length, unsigned flags);
+array_t* tokcache_add(tokcache_t *cache, const unsigned char *text, size_t length, unsigned flags,
+    array_t *tokens);
+size_t tokcache_length(tokcache_t *cache);
+
+
+#endif
@@ -2,6 +2,10 @@
 
 #include "config.h"
 #include "token.h"
+#include "srcloc.h"
+#include "arena.h"
+#include "hideset.h"
+#include "csbuilder.h"
 
 
 typedef struct token_dictionary_s {
@@ -73,6 +77,7 @@ token_dictionary_t __token_dictionary__[] = {
     TOKEN_DICTIONARY_ITEM(TOKEN_HASHHASH,            "##"),
 
     TOKEN_DICTIONARY_ITEM(TOKEN_NUMBER,              ""),
+    TOKEN_DICTIONARY_ITEM(TOKEN_NUMBER_RUN,          ""),
     TOKEN_DICTIONARY_ITEM(TOKEN_IDENTIFIER,          ""),
 
     TOKEN_DICTIONARY_ITEM(TOKEN_CONSTANT_STRING,     ""),
@@ -88,29 +93,27 @@ token_dictionary_t __token_dictionary__[] = {
 };
 
 
-token_t* token_create(token_type_t type, cstring_t cs, token_location_t *location)
+token_t* token_create(token_type_t type, cstring_t cs, srcloc_t loc)
 {
     token_t *token = (token_t*) pmalloc(sizeof(token_t));
 
-    if (location) {
-        token->location = *location;
-
-    } else {
-        token->location.filename = NULL;
-        token->location.linenote = NULL;
-        token->location.line = 0;
-        token->location.column = 0;
-        token->location.linenote_caution.start = 0;
-        token->location.linenote_caution.length = 0;
-    }
+    token->loc = loc;
+    token->caution_start = 0;
+    token->caution_length = 0;
 
     token->type = type;
     token->cs = cs;
+    token->spelling = NULL;
+    token->spelling_length = 0;
 
+    token->keyword = TOKEN_UNKNOWN;
+    token->ident = NULL;
     token->hideset = NULL;
     token->begin_of_line = false;
     token->spaces = 0;
     token->is_vararg = false;
+    token->arena = NULL;
+    token->run = NULL;
 
     return token;
 }
@@ -122,26 +125,41 @@ void token_destroy(token_t *token)
 
 //    source_location_destroy(token->loc);
 
-    if (token->hideset != NULL) {
-        set_destroy(token->hideset);
+    hideset_release(token->hideset);
+
+    if (token->arena != NULL) {
+        return;
     }
 
     if (token->cs) {
         cstring_free(token->cs);
     }
 
+    if (token->run != NULL) {
+        pfree(token->run);
+    }
+
     pfree(token);
 }
 
 
 void token_init(token_t *token)
 {
-    cstring_clear(token->cs);
+    if (token->cs != NULL) {
+        cstring_clear(token->cs);
+    }
+
+    token->spelling = NULL;
+    token->spelling_length = 0;
 
-    if (token->hideset != NULL) set_destroy(token->hideset);
+    hideset_release(token->hideset);
 
     token->type = TOKEN_UNKNOWN;
 
+    token->keyword = TOKEN_UNKNOWN;
+
+    token->ident = NULL;
+
     token->hideset = NULL;
     
     token->spaces = 0;
@@ -150,6 +168,12 @@ void token_init(token_t *token)
 
     token->is_vararg = false;
 
+    if (token->run != NULL && token->arena == NULL) {
+        pfree(token->run);
+    }
+
+    token->run = NULL;
+
     //source_location_mark(token->loc, 0, 0, NULL, NULL);
 }
 
@@ -162,11 +186,63 @@ token_t* token_copy(token_t *tok)
     ret = pmalloc(sizeof(token_t));
 
     ret->type = tok->type;
-    ret->hideset = tok->hideset ? set_dup(tok->hideset) : NULL;// set_dup(tok->hideset);
+    ret->keyword = tok->keyword;
+    ret->ident = tok->ident;
+    ret->hideset = hideset_ref(tok->hideset);
     ret->begin_of_line = tok->begin_of_line;
     ret->spaces = tok->spaces;
-    ret->cs = cstring_dup(tok->cs);
+    ret->cs = cstring_dup(token_cs(tok));
+    ret->spelling = NULL;
+    ret->spelling_length = 0;
     ret->is_vararg = false;
+    ret->arena = NULL;
+    ret->loc = tok->loc;
+    ret->caution_start = tok->caution_start;
+    ret->caution_length = tok->caution_length;
+    ret->run = NULL;
+
+    /* the integers go along in the same block */
+    if (tok->run != NULL) {
+        ret->run = pmalloc(sizeof(token_run_t) + tok->run->length * sizeof(uint64_t));
+        ret->run->length = tok->run->length;
+        ret->run->values = (uint64_t *) (ret->run + 1);
+        ret->run->loc = tok->run->loc;
+        memcpy(ret->run->values, tok->run->values, tok->run->length * sizeof(uint64_t));
+    }
+
+    return ret;
+}
+
+
+/**
+ * The text of a token in an arena, or one it shares, lives as long as
+ * the unit does; that of a token on its own goes with it and is copied,
+ * as is a run, whose integers a copy has in a block of its own.
+ **/
+token_t* token_instance(token_t *tok)
+{
+    token_t* ret;
+
+    if ((tok->arena == NULL && tok->cs != NULL) || tok->run != NULL) {
+        return token_copy(tok);
+    }
+
+    ret = pmalloc(sizeof(token_t));
+
+    ret->type = tok->type;
+    ret->keyword = tok->keyword;
+    ret->ident = tok->ident;
+    ret->hideset = hideset_ref(tok->hideset);
+    ret->begin_of_line = tok->begin_of_line;
+    ret->spaces = tok->spaces;
+    ret->cs = NULL;
+    ret->spelling = token_spelling(tok, &ret->spelling_length);
+    ret->is_vararg = false;
+    ret->arena = NULL;
+    ret->loc = tok->loc;
+    ret->caution_start = tok->caution_start;
+    ret->caution_length = tok->caution_length;
+    ret->run = NULL;
 
     return ret;
 }
@@ -183,7 +259,7 @@ const char* token_as_name(token_t *token)
         }
     }
 
-    return token->cs;
+    return token_cs(token);
 }
 
 
@@ -192,7 +268,7 @@ const char* token_as_text(token_t *token)
     size_t i, length;
     length = sizeof(__token_dictionary__) / sizeof(struct token_dictionary_s);
 
-    if (token->cs && cstring_length(token->cs)) {
+    if (token_cs(token) && cstring_length(token->cs)) {
         return token->cs;
     }
 
@@ -206,41 +282,112 @@ const char* token_as_text(token_t *token)
 }
 
 
+/**
+ * Materializes the spelling of a sliced token, in the token's arena when
+ * it has one.
+ **/
+cstring_t token_cs(token_t *token)
+{
+    if (token->cs == NULL && token->spelling != NULL) {
+        token->cs = token->arena != NULL ?
+            arena_cstring(token->arena, token->spelling, token->spelling_length) :
+            cstring_new_n(token->spelling, token->spelling_length);
+    }
+
+    return token->cs;
+}
+
+
+/**
+ * The spelling without materializing it, not NUL terminated for slices.
+ **/
+const unsigned char* token_spelling(token_t *token, size_t *length)
+{
+    if (token->cs != NULL) {
+        *length = cstring_length(token->cs);
+        return token->cs;
+    }
+
+    *length = token->spelling_length;
+    return token->spelling;
+}
+
+
+/* the part of its line to mark, past 0xffff it is the end of the line */
 void token_add_linenote_caution(token_t *token, size_t start, size_t length)
 {
-    token->location.linenote_caution.start = start;
-    token->location.linenote_caution.length = length;
+    token->caution_start = start < UINT16_MAX ? (uint16_t) start : UINT16_MAX;
+    token->caution_length = length < UINT16_MAX ? (uint16_t) length : UINT16_MAX;
+}
+
+
+cstring_t token_filename(token_t *token)
+{
+    cstring_t filename;
+
+    srcloc_resolve(token->loc, &filename, NULL, NULL, NULL);
+    return filename;
+}
+
+
+size_t token_line(token_t *token)
+{
+    size_t line;
+
+    srcloc_resolve(token->loc, NULL, &line, NULL, NULL);
+    return line;
+}
+
+
+size_t token_column(token_t *token)
+{
+    size_t column;
+
+    srcloc_resolve(token->loc, NULL, NULL, &column, NULL);
+    return column;
+}
+
+
+linenote_t token_linenote(token_t *token)
+{
+    linenote_t linenote;
+
+    srcloc_resolve(token->loc, NULL, NULL, NULL, &linenote);
+    return linenote;
 }
 
 
 cstring_t tokens_to_text(array_t *tokens)
 {
     token_t **toks;
+    csbuilder_t *b;
     cstring_t cs;
-    int i, j;
+    int i;
 
-    cs = cstring_new_n(NULL, array_length(tokens) * 8);
+    if ((b = csbuilder_create()) == NULL) {
+        return NULL;
+    }
 
     array_foreach(tokens, toks, i) {
         int spaces;
-        const char *s;
 
         if (toks[i]->type == TOKEN_UNKNOWN ||
                 toks[i]->type == TOKEN_EOF ||
                 toks[i]->type == TOKEN_END) {
-            cstring_free(cs);
+            csbuilder_destroy(b);
             return NULL;
         }
 
         spaces  = toks[i]->spaces;
         while (spaces--) {
-            cs = cstring_push_ch(cs, ' ');
+            csbuilder_append_ch(b, ' ');
         }
 
-        s = token_as_text(toks[i]);
-        cs = cstring_concat_n(cs, s, strlen(s));
+        csbuilder_append(b, token_as_text(toks[i]));
     }
 
+    cs = csbuilder_to_cstring(b);
+    csbuilder_destroy(b);
     return cs;
 }
 
@@ -9,6 +9,12 @@
 #include "set.h"
 #include "cstring.h"
 #include "encoding.h"
+#include "srcloc.h"
+
+
+typedef struct arena_s arena_t;
+typedef struct hideset_s hideset_t;
+typedef struct ident_s ident_t;
 
 
 typedef enum token_type_e {
@@ -94,6 +100,7 @@ typedef enum token_type_e {
     TOKEN_ATOMIC,
 
     TOKEN_VOID,
+    TOKEN_CHAR,
     TOKEN_SHORT,
     TOKEN_INT,
     TOKEN_LONG,
@@ -159,10 +166,15 @@ typedef enum token_type_e {
     TOKEN_PP_UNDEF,
     TOKEN_PP_LINE,
     TOKEN_PP_ERROR,
+    TOKEN_PP_WARNING,
     TOKEN_PP_PRAGMA,
     TOKEN_PP_NONE,
     TOKEN_PP_EMPTY,
 
+    TOKEN_NUMBER_RUN,                       /* number, number, ... */
+
+    TOKEN_LAST                              /* not a token, below it are the types */
+
 } token_type_t;
 
 typedef const unsigned char* linenote_t;
@@ -174,36 +186,79 @@ typedef struct linenote_caution_s {
 } linenote_caution_t;
 
 
-typedef struct token_location_s {
-    cstring_t filename;
-    linenote_t linenote;
-    size_t line;
-    size_t column;
-    linenote_caution_t linenote_caution;
-} token_location_t;
-
-
+/**
+ * The integers of a TOKEN_NUMBER_RUN in the order they are written, and
+ * loc, where the first of them is spelled.
+ **/
+typedef struct token_run_s {
+    size_t length;
+    uint64_t *values;
+    srcloc_t loc;
+} token_run_t;
+
+
+/**
+ * Tokens whose spelling is an unmodified range of the source buffer only
+ * carry the slice, cs stays NULL until token_cs() is asked for it. The
+ * location is one in the space of srcloc.h, token_filename(), token_line(),
+ * token_column() and token_linenote() decode it. Few tokens have part of
+ * their line marked, by a start and length in caution.
+ *
+ * token_instance() copies a token for an expansion: the copy shares the
+ * text unless the token owns it, and has its own made by token_cs() on
+ * the way to being changed.
+ *
+ * A TOKEN_NUMBER_RUN stands for the integers, commas and spaces of a run
+ * in a line, spelled as they are, and has them decoded in run.
+ **/
 typedef struct token_s {
     token_type_t type;
     cstring_t cs;
+    const unsigned char *spelling;
+    size_t spelling_length;
 
-    token_location_t location;
+    srcloc_t loc;
+    uint16_t caution_start;
+    uint16_t caution_length;
+
+    /* keyword an identifier spells, TOKEN_UNKNOWN if none */
+    token_type_t keyword;
+
+    /* the record of an identifier, when the lexer has an identtab_t */
+    ident_t *ident;
 
     /* used by the preprocessor for macro expansion */
-    set_t *hideset;
+    hideset_t *hideset;
     bool begin_of_line;
     size_t spaces;
     bool is_vararg;
+
+    /* the arena holding the token and its text, if any */
+    arena_t *arena;
+
+    /* the integers of a TOKEN_NUMBER_RUN, in the arena or the token's own */
+    token_run_t *run;
 } token_t;
 
 
-token_t* token_create(token_type_t type, cstring_t cs, token_location_t *location);
+/* the tokens of a macro body, most of which are short enough to be inline */
+ARRAY_DEFINE(token_ptr, token_t*, 4)
+
+
+token_t* token_create(token_type_t type, cstring_t cs, srcloc_t loc);
 void token_init(token_t *token);
 void token_destroy(token_t *token);
 token_t* token_copy(token_t *token);
+token_t* token_instance(token_t *token);
 const char* token_as_name(token_t *token);
 const char* token_as_text(token_t *token);
+cstring_t token_cs(token_t *token);
+const unsigned char* token_spelling(token_t *token, size_t *length);
 void token_add_linenote_caution(token_t *token, size_t start, size_t length);
+cstring_t token_filename(token_t *token);
+size_t token_line(token_t *token);
+size_t token_column(token_t *token);
+linenote_t token_linenote(token_t *token);
 
 cstring_t tokens_to_text(array_t *tokens);
 void tokens_free(array_t *tokens);
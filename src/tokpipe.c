@@ -0,0 +1,419 @@
+#include "config.h"
+#include "pmalloc.h"
+#include "array.h"
+#include "arena.h"
+#include "option.h"
+#include "token.h"
+#include "reader.h"
+#include "lexer.h"
+#include "tokpipe.h"
+
+
+static void __tokpipe_worker__(void *ud);
+static tokpipe_file_t* __tokpipe_pick__(tokpipe_t *pipe);
+static bool __tokpipe_fill__(tokpipe_file_t *file);
+static tokpipe_batch_t* __tokpipe_take__(tokpipe_t *pipe, tokpipe_file_t *file);
+static void __tokpipe_release__(tokpipe_t *pipe, tokpipe_file_t *file);
+static void __tokpipe_close__(tokpipe_t *pipe, tokpipe_file_t *file);
+
+
+/**
+ * The thread is started with the first file, if it cannot be the files
+ * are lexed a batch at a time as the tokens are asked for.
+ **/
+tokpipe_t* tokpipe_create(void)
+{
+    tokpipe_t *pipe;
+
+    pipe = (tokpipe_t *) pmalloc(sizeof(tokpipe_t));
+    if (!pipe) {
+        return NULL;
+    }
+
+    pipe->files = array_create_n(sizeof(tokpipe_file_t*), 4);
+    pipe->busy = NULL;
+    pipe->waiting = false;
+    pipe->idle = false;
+    pipe->stop = false;
+    pipe->running = false;
+
+    mutex_init(&pipe->mutex);
+    cond_init(&pipe->ready);
+    cond_init(&pipe->wakeup);
+
+    return pipe;
+}
+
+
+void tokpipe_destroy(tokpipe_t *pipe)
+{
+    if (pipe->running) {
+        mutex_lock(&pipe->mutex);
+        pipe->stop = true;
+        cond_signal(&pipe->wakeup);
+        mutex_unlock(&pipe->mutex);
+
+        thread_join(&pipe->thread);
+        pipe->running = false;
+    }
+
+    while (!array_is_empty(pipe->files)) {
+        __tokpipe_close__(pipe, array_cast_back(tokpipe_file_t*, pipe->files));
+    }
+
+    array_destroy(pipe->files);
+
+    cond_destroy(&pipe->wakeup);
+    cond_destroy(&pipe->ready);
+    mutex_destroy(&pipe->mutex);
+
+    pfree(pipe);
+}
+
+
+/**
+ * Has the rest of the current stream of reader lexed ahead, up to its last
+ * '\n', the tail left to the reader. Only a clean stream with enough of
+ * it left is worth it. The tokens stay in an arena of the pipe, which
+ * goes to arena when the file is done.
+ **/
+bool tokpipe_open(tokpipe_t *pipe, reader_t *reader, bool trivia, arena_t *arena)
+{
+    tokpipe_file_t *file;
+    const unsigned char *rest, *last;
+    size_t n, i;
+
+    n = reader_peek_rest(reader, &rest);
+    if (n < TOKPIPE_MIN || arena == NULL || reader_cursor(reader) == NULL) {
+        return false;
+    }
+
+    for (last = rest + n; last > rest && last[-1] != '\n'; last--) {
+        continue;
+    }
+
+    if ((size_t) (last - rest) < TOKPIPE_MIN) {
+        return false;
+    }
+
+    file = (tokpipe_file_t *) pmalloc(sizeof(tokpipe_file_t));
+    if (!file) {
+        return false;
+    }
+
+    for (i = 0; i < TOKPIPE_RING; i++) {
+        file->ring[i] = NULL;
+        file->batches[i].tokens = array_create_n(sizeof(token_t*), TOKPIPE_BATCH);
+        file->batches[i].last = false;
+        file->batches[i].resume = NULL;
+        file->batches[i].begin_of_line = true;
+    }
+
+    file->head = 0;
+    file->next = 0;
+    file->tail = 0;
+    file->depth = reader_depth(reader);
+    reader_text(reader, &file->text);
+
+    /* the range reads the buffer of the stream and places tokens as it does */
+    file->lexer = lexer_create();
+    file->lexer->trivia = trivia;
+    file->lexer->speculative = true;
+    reader_set_speculative(file->lexer->reader, true);
+    reader_push_range(file->lexer->reader, reader, rest, last);
+
+    file->option = option;
+    file->arena = arena;
+    file->resume = rest;
+    file->begin_of_line = true;
+    file->hash = false;
+    file->include = false;
+    file->done = false;
+    file->cancelled = false;
+
+    if (!pipe->running && !pipe->stop) {
+        pipe->running = thread_create(&pipe->thread, __tokpipe_worker__, pipe);
+
+        /* a thread that could not be started is not tried again */
+        if (!pipe->running) {
+            pipe->stop = true;
+        }
+    }
+
+    mutex_lock(&pipe->mutex);
+    array_cast_append(tokpipe_file_t*, pipe->files, file);
+    if (pipe->idle) {
+        cond_signal(&pipe->wakeup);
+    }
+    mutex_unlock(&pipe->mutex);
+
+    return true;
+}
+
+
+/**
+ * The next token of the current stream of reader, if that is the file of
+ * the pipe read now. NULL when it is not, and once the file is read
+ * through: reader is then at where it goes on from, and begin_of_line
+ * as the lexer had it there.
+ **/
+token_t* tokpipe_get(tokpipe_t *pipe, reader_t *reader, bool *begin_of_line)
+{
+    tokpipe_file_t *file;
+    tokpipe_batch_t *batch;
+    const unsigned char *text;
+    size_t depth;
+
+    depth = reader_depth(reader);
+
+    /* a file whose stream was read through some other way is dropped */
+    for (;;) {
+        if (array_is_empty(pipe->files)) {
+            return NULL;
+        }
+
+        file = array_cast_back(tokpipe_file_t*, pipe->files);
+        if (file->depth < depth) {
+            return NULL;
+        }
+
+        if (file->depth == depth) {
+            reader_text(reader, &text);
+            if (text == file->text) {
+                break;
+            }
+        }
+
+        __tokpipe_close__(pipe, file);
+    }
+
+    for (;;) {
+        batch = __tokpipe_take__(pipe, file);
+
+        if (file->next < array_length(batch->tokens)) {
+            return array_cast_at(token_t*, batch->tokens, file->next++);
+        }
+
+        if (batch->last) {
+            break;
+        }
+
+        __tokpipe_release__(pipe, file);
+    }
+
+    reader_seek(reader, batch->resume);
+    *begin_of_line = batch->begin_of_line;
+
+    __tokpipe_close__(pipe, file);
+    return NULL;
+}
+
+
+static
+void __tokpipe_worker__(void *ud)
+{
+    tokpipe_t *pipe = (tokpipe_t *) ud;
+    tokpipe_file_t *file;
+    bool last;
+
+    mutex_lock(&pipe->mutex);
+
+    while (!pipe->stop) {
+        if ((file = __tokpipe_pick__(pipe)) == NULL) {
+            pipe->idle = true;
+            cond_wait(&pipe->wakeup, &pipe->mutex);
+            pipe->idle = false;
+            continue;
+        }
+
+        pipe->busy = file;
+        mutex_unlock(&pipe->mutex);
+
+        last = __tokpipe_fill__(file);
+
+        mutex_lock(&pipe->mutex);
+        pipe->busy = NULL;
+        file->done = last;
+
+        if (pipe->waiting) {
+            cond_signal(&pipe->ready);
+        }
+    }
+
+    mutex_unlock(&pipe->mutex);
+    pmalloc_profile_merge();
+}
+
+
+/* the innermost file with room for a batch, under the mutex */
+static
+tokpipe_file_t* __tokpipe_pick__(tokpipe_t *pipe)
+{
+    tokpipe_file_t **files, *file;
+    size_t i;
+
+    files = array_prototype(pipe->files, tokpipe_file_t*);
+
+    for (i = array_length(pipe->files); i > 0; i--) {
+        file = files[i - 1];
+
+        if (!file->done && !file->cancelled &&
+            atomic_load_acquire(&file->ring[file->tail % TOKPIPE_RING]) == NULL) {
+            return file;
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Lexes the next batch of file and publishes it, true if it is the last.
+ * The batch is cut where the reader can be put back, at a token after
+ * which no character is stashed. A token with anything to report ends
+ * the file with the tokens before it; it is lexed again by the reader,
+ * for real.
+ **/
+static
+bool __tokpipe_fill__(tokpipe_file_t *file)
+{
+    tokpipe_batch_t *batch = &file->batches[file->tail % TOKPIPE_RING];
+    lexer_t *lexer = file->lexer;
+    option_t *saved_option = option;
+    const unsigned char *cursor, *spelling;
+    token_t *token;
+    size_t suppressed, synced = 0, n;
+
+    option = file->option;
+
+    array_clear(batch->tokens);
+    batch->last = false;
+
+    for (;;) {
+        suppressed = lexer->suppressed + lexer->reader->suppressed;
+        token = file->include ? lexer_scan_header_name(lexer) : lexer_scan(lexer);
+
+        if (token->type == TOKEN_EOF || token->type == TOKEN_END ||
+            lexer->suppressed + lexer->reader->suppressed != suppressed) {
+            array_pop_back_n(batch->tokens, array_length(batch->tokens) - synced);
+            batch->last = true;
+            break;
+        }
+
+        /* a header name after #include, as the preprocessor would ask for it */
+        if (token->type != TOKEN_SPACE && token->type != TOKEN_COMMENT) {
+            spelling = token_spelling(token, &n);
+
+            file->include = file->hash && token->type == TOKEN_IDENTIFIER &&
+                            n == 7 && memcmp(spelling, "include", 7) == 0;
+            file->hash = token->type == TOKEN_HASH && token->begin_of_line;
+        }
+
+        array_cast_append(token_t*, batch->tokens, token);
+
+        if ((cursor = reader_cursor(lexer->reader)) != NULL) {
+            file->resume = cursor;
+            file->begin_of_line = lexer->begin_of_line;
+            synced = array_length(batch->tokens);
+
+            if (synced >= TOKPIPE_BATCH) {
+                break;
+            }
+        }
+    }
+
+    batch->resume = file->resume;
+    batch->begin_of_line = file->begin_of_line;
+
+    option = saved_option;
+
+    atomic_store_release(&file->ring[file->tail % TOKPIPE_RING], batch);
+    file->tail++;
+
+    return batch->last;
+}
+
+
+/**
+ * The batch at the head of the ring, waited for if it is not there yet.
+ * Without the thread the consumer lexes it itself.
+ **/
+static
+tokpipe_batch_t* __tokpipe_take__(tokpipe_t *pipe, tokpipe_file_t *file)
+{
+    tokpipe_batch_t **slot = &file->ring[file->head % TOKPIPE_RING];
+    tokpipe_batch_t *batch;
+
+    if ((batch = atomic_load_acquire(slot)) != NULL) {
+        return batch;
+    }
+
+    if (!pipe->running) {
+        __tokpipe_fill__(file);
+        return atomic_load_acquire(slot);
+    }
+
+    mutex_lock(&pipe->mutex);
+
+    while ((batch = atomic_load_acquire(slot)) == NULL) {
+        pipe->waiting = true;
+        cond_wait(&pipe->ready, &pipe->mutex);
+    }
+
+    pipe->waiting = false;
+    mutex_unlock(&pipe->mutex);
+
+    return batch;
+}
+
+
+/* hands the batch read through back to the producer */
+static
+void __tokpipe_release__(tokpipe_t *pipe, tokpipe_file_t *file)
+{
+    atomic_store_release(&file->ring[file->head % TOKPIPE_RING], (tokpipe_batch_t *) NULL);
+    file->head++;
+    file->next = 0;
+
+    if (pipe->running) {
+        mutex_lock(&pipe->mutex);
+        if (pipe->idle) {
+            cond_signal(&pipe->wakeup);
+        }
+        mutex_unlock(&pipe->mutex);
+    }
+}
+
+
+/**
+ * Drops the innermost file once the producer is off it. The tokens it
+ * handed out live on in the arena of the reader.
+ **/
+static
+void __tokpipe_close__(tokpipe_t *pipe, tokpipe_file_t *file)
+{
+    size_t i;
+
+    mutex_lock(&pipe->mutex);
+
+    file->cancelled = true;
+    while (pipe->busy == file) {
+        pipe->waiting = true;
+        cond_wait(&pipe->ready, &pipe->mutex);
+    }
+
+    pipe->waiting = false;
+    array_pop_back(pipe->files);
+
+    mutex_unlock(&pipe->mutex);
+
+    arena_absorb(file->arena, file->lexer->arena);
+    file->lexer->clean_arena = false;
+    lexer_destroy(file->lexer);
+
+    for (i = 0; i < TOKPIPE_RING; i++) {
+        array_destroy(file->batches[i].tokens);
+    }
+
+    pfree(file);
+}
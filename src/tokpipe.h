@@ -0,0 +1,102 @@
+
+
+#ifndef __TOKPIPE__H__
+#define __TOKPIPE__H__
+
+
+#include "config.h"
+#include "thread.h"
+
+
+typedef struct array_s      array_t;
+typedef struct arena_s      arena_t;
+typedef struct token_s      token_t;
+typedef struct reader_s     reader_t;
+typedef struct lexer_s      lexer_t;
+typedef struct option_s     option_t;
+
+
+/**
+ * A file has a pipe when at least TOKPIPE_MIN bytes of it are lexed ahead,
+ * TOKPIPE_BATCH tokens at a time, as many as TOKPIPE_RING batches ahead.
+ **/
+#ifndef TOKPIPE_MIN
+#define TOKPIPE_MIN         (64 * 1024)
+#endif
+
+#define TOKPIPE_BATCH       256
+#define TOKPIPE_RING        8
+
+
+/**
+ * Tokens of a file lexed on the guess that nothing in it is to be
+ * reported. A batch is the last when the guess failed or the file is
+ * lexed to its last '\n': the lexer goes on from resume, with the
+ * begin_of_line it had there.
+ **/
+typedef struct tokpipe_batch_s {
+    array_t *tokens;
+    bool last;
+    const unsigned char *resume;
+    bool begin_of_line;
+} tokpipe_batch_t;
+
+
+/**
+ * A file being lexed ahead, the stream at depth of the reader it is for,
+ * told from another by its text.
+ * The ring is single producer, single consumer: a slot is published by
+ * the producer with a release store, NULL until then, and handed back
+ * by the consumer the same way. head and next are the consumer's, tail
+ * and the lexer the producer's.
+ **/
+typedef struct tokpipe_file_s {
+    tokpipe_batch_t *ring[TOKPIPE_RING];
+    tokpipe_batch_t batches[TOKPIPE_RING];
+    size_t head;
+    size_t next;
+    size_t tail;
+    size_t depth;
+    const unsigned char *text;
+
+    lexer_t *lexer;
+    option_t *option;
+    arena_t *arena;
+    const unsigned char *resume;
+    bool begin_of_line;
+    bool hash;
+    bool include;
+    bool done;
+    bool cancelled;
+} tokpipe_file_t;
+
+
+/**
+ * The files of a lexer read through pipes, innermost last, and the one
+ * thread lexing them, each time a batch of the innermost file with room
+ * in its ring. The batches go without a lock; the mutex is taken only
+ * to change the files and to sleep or wake a side that ran out of room
+ * or of tokens.
+ **/
+typedef struct tokpipe_s {
+    array_t *files;
+    tokpipe_file_t *busy;
+    bool waiting;
+    bool idle;
+    bool stop;
+    bool running;
+
+    thread_t thread;
+    mutex_t mutex;
+    cond_t ready;
+    cond_t wakeup;
+} tokpipe_t;
+
+
+tokpipe_t* tokpipe_create(void);
+void tokpipe_destroy(tokpipe_t *pipe);
+bool tokpipe_open(tokpipe_t *pipe, reader_t *reader, bool trivia, arena_t *arena);
+token_t* tokpipe_get(tokpipe_t *pipe, reader_t *reader, bool *begin_of_line);
+
+
+#endif
@@ -0,0 +1,364 @@
+#include "config.h"
+#include "pmalloc.h"
+#include "cstring.h"
+#include "array.h"
+#include "map.h"
+#include "trace.h"
+
+
+/**
+ * What the spans of one kind and name came to: how many there were,
+ * the sum of their values and of their time, the self time less that
+ * of the spans inside them. Microseconds.
+ **/
+typedef struct trace_entry_s {
+    cstring_t name;
+    trace_kind_t kind;
+    size_t count;
+    uint64_t value;
+    double total;
+    double self;
+} trace_entry_t;
+
+
+typedef struct trace_span_s {
+    trace_entry_t *entry;
+    double start;
+    double inner;
+} trace_span_t;
+
+
+typedef struct trace_event_s {
+    trace_entry_t *entry;
+    double start;
+    double duration;
+    size_t value;
+} trace_event_t;
+
+
+THREAD_LOCAL bool tracing = false;
+
+
+static THREAD_LOCAL array_t *__trace_spans__;
+static THREAD_LOCAL array_t *__trace_events__;
+static THREAD_LOCAL array_t *__trace_entries__;
+static THREAD_LOCAL map_t *__trace_names__[TRACE_KIND_MAX];
+static THREAD_LOCAL cstring_t __trace_key__;
+static THREAD_LOCAL double __trace_origin__;
+static THREAD_LOCAL double __trace_granularity__;
+
+
+static const char *__trace_kinds__[TRACE_KIND_MAX] = {
+    "Source",
+    "Macro",
+    "Skip",
+};
+
+
+static double __trace_clock__(void);
+static trace_entry_t* __trace_entry__(trace_kind_t kind, const char *name, size_t length);
+static void __trace_record__(double now, size_t value);
+static void __trace_string__(FILE *fp, const char *s, size_t n);
+static void __trace_top__(FILE *fp, trace_kind_t kind, size_t top);
+static int __trace_order__(const void *a, const void *b);
+
+
+/**
+ * Starts the trace of a unit on the calling thread, the spans shorter
+ * than granularity microseconds aggregated but not kept as events.
+ **/
+void trace_begin(size_t granularity)
+{
+    size_t i;
+
+    if (tracing) {
+        trace_end();
+    }
+
+    __trace_spans__ = array_create_n(sizeof(trace_span_t), 16);
+    __trace_events__ = array_create_n(sizeof(trace_event_t), 256);
+    __trace_entries__ = array_create_n(sizeof(trace_entry_t*), 64);
+
+    for (i = 0; i < TRACE_KIND_MAX; i++) {
+        __trace_names__[i] = map_create();
+    }
+
+    __trace_key__ = cstring_new_n(NULL, 64);
+    __trace_granularity__ = (double) granularity;
+    __trace_origin__ = 0;
+    __trace_origin__ = __trace_clock__();
+    tracing = true;
+}
+
+
+void trace_end(void)
+{
+    trace_entry_t **entries;
+    size_t i;
+
+    if (!tracing) {
+        return;
+    }
+
+    array_foreach(__trace_entries__, entries, i) {
+        cstring_free(entries[i]->name);
+        pfree(entries[i]);
+    }
+
+    for (i = 0; i < TRACE_KIND_MAX; i++) {
+        map_destroy(__trace_names__[i]);
+        __trace_names__[i] = NULL;
+    }
+
+    array_destroy(__trace_spans__);
+    array_destroy(__trace_events__);
+    array_destroy(__trace_entries__);
+    cstring_free(__trace_key__);
+
+    __trace_spans__ = __trace_events__ = __trace_entries__ = NULL;
+    __trace_key__ = NULL;
+    tracing = false;
+}
+
+
+size_t trace_open(trace_kind_t kind, const char *name, size_t length)
+{
+    trace_span_t *span;
+
+    if ((span = array_push_back(__trace_spans__)) == NULL) {
+        return 0;
+    }
+
+    span->entry = __trace_entry__(kind, name, length);
+    span->inner = 0;
+    span->start = __trace_clock__();
+
+    return array_length(__trace_spans__);
+}
+
+
+/**
+ * Closes span and what is still open inside it, value going to span
+ * alone. The time of a span not kept stays with the one around it.
+ **/
+void trace_close(size_t span, size_t value, bool keep)
+{
+    double now;
+
+    if (span > array_length(__trace_spans__)) {
+        return;
+    }
+
+    now = __trace_clock__();
+
+    while (array_length(__trace_spans__) > span) {
+        __trace_record__(now, 0);
+    }
+
+    if (keep) {
+        __trace_record__(now, value);
+    } else {
+        array_pop_back(__trace_spans__);
+    }
+}
+
+
+/**
+ * The events in the trace event format of chrome://tracing, which
+ * Perfetto and speedscope read as well; process names the unit.
+ **/
+bool trace_write(FILE *fp, const char *process)
+{
+    trace_event_t *events;
+    const char *kind;
+    size_t i;
+
+    fputs("{\"traceEvents\":[\n", fp);
+    fputs("{\"pid\":1,\"tid\":0,\"ph\":\"M\",\"name\":\"process_name\",\"args\":{\"name\":", fp);
+    __trace_string__(fp, process, strlen(process));
+    fputs("}}", fp);
+
+    array_foreach(__trace_events__, events, i) {
+        kind = __trace_kinds__[events[i].entry->kind];
+
+        fprintf(fp, ",\n{\"pid\":1,\"tid\":0,\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"name\":\"%s\",\"args\":{\"detail\":",
+                events[i].start, events[i].duration, kind);
+        __trace_string__(fp, events[i].entry->name, cstring_length(events[i].entry->name));
+
+        if (events[i].entry->kind == TRACE_MACRO) {
+            fprintf(fp, ",\"tokens\":%lu", (unsigned long) events[i].value);
+        } else if (events[i].entry->kind == TRACE_SKIP) {
+            fprintf(fp, ",\"line\":%lu", (unsigned long) events[i].value);
+        }
+
+        fputs("}}", fp);
+    }
+
+    fputs("\n],\"displayTimeUnit\":\"ms\"}\n", fp);
+
+    return fflush(fp) == 0 && !ferror(fp);
+}
+
+
+/**
+ * The top files by their time with what they included, and the top
+ * macros by the time of their expansions, the one expanded inside
+ * another counted with it.
+ **/
+void trace_summary(FILE *fp, const char *unit, size_t top)
+{
+    fprintf(fp, "time trace of %s:\n", unit);
+    __trace_top__(fp, TRACE_SOURCE, top);
+    __trace_top__(fp, TRACE_MACRO, top);
+}
+
+
+static
+double __trace_clock__(void)
+{
+#if defined(UNIX)
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((double) ts.tv_sec * 1e6 + (double) ts.tv_nsec / 1e3) - __trace_origin__;
+#else
+    return (double) clock() * 1e6 / CLOCKS_PER_SEC - __trace_origin__;
+#endif
+}
+
+
+static
+trace_entry_t* __trace_entry__(trace_kind_t kind, const char *name, size_t length)
+{
+    trace_entry_t *entry;
+
+    __trace_key__ = cstring_copy_n(__trace_key__, name, length);
+    cstring_set_hash(__trace_key__, 0);
+
+    if ((entry = map_find(__trace_names__[kind], __trace_key__)) != NULL) {
+        return entry;
+    }
+
+    entry = (trace_entry_t *) pmalloc(sizeof(trace_entry_t));
+    entry->name = cstring_new_n(name, length);
+    entry->kind = kind;
+    entry->count = 0;
+    entry->value = 0;
+    entry->total = 0;
+    entry->self = 0;
+
+    map_add(__trace_names__[kind], entry->name, entry);
+    array_cast_append(trace_entry_t*, __trace_entries__, entry);
+    return entry;
+}
+
+
+/* closes the innermost span */
+static
+void __trace_record__(double now, size_t value)
+{
+    trace_span_t span;
+    trace_event_t *event;
+    double duration;
+
+    span = array_cast_back(trace_span_t, __trace_spans__);
+    array_pop_back(__trace_spans__);
+
+    duration = now - span.start;
+
+    span.entry->count++;
+    span.entry->value += value;
+    span.entry->total += duration;
+    span.entry->self += duration - span.inner;
+
+    if (!array_is_empty(__trace_spans__)) {
+        array_cast_back(trace_span_t, __trace_spans__).inner += duration;
+    }
+
+    if (duration >= __trace_granularity__ &&
+        (event = array_push_back(__trace_events__)) != NULL) {
+        event->entry = span.entry;
+        event->start = span.start;
+        event->duration = duration;
+        event->value = value;
+    }
+}
+
+
+static
+void __trace_string__(FILE *fp, const char *s, size_t n)
+{
+    size_t i;
+
+    fputc('"', fp);
+
+    for (i = 0; i < n; i++) {
+        if (s[i] == '"' || s[i] == '\\') {
+            fputc('\\', fp);
+            fputc(s[i], fp);
+        } else if ((unsigned char) s[i] < 0x20) {
+            fprintf(fp, "\\u%04x", (unsigned) (unsigned char) s[i]);
+        } else {
+            fputc(s[i], fp);
+        }
+    }
+
+    fputc('"', fp);
+}
+
+
+static
+void __trace_top__(FILE *fp, trace_kind_t kind, size_t top)
+{
+    trace_entry_t **entries, **sorted;
+    size_t i, n = 0;
+
+    sorted = (trace_entry_t **) pmalloc((array_length(__trace_entries__) + 1) * sizeof(trace_entry_t *));
+    if (sorted == NULL) {
+        return;
+    }
+
+    array_foreach(__trace_entries__, entries, i) {
+        if (entries[i]->kind == kind) {
+            sorted[n++] = entries[i];
+        }
+    }
+
+    qsort(sorted, n, sizeof(trace_entry_t *), __trace_order__);
+
+    if (kind == TRACE_SOURCE) {
+        fprintf(fp, "  %-40s %8s %12s %12s\n", "files", "count", "total (ms)", "self (ms)");
+    } else {
+        fprintf(fp, "  %-40s %8s %12s %12s\n", "macros", "count", "tokens", "total (ms)");
+    }
+
+    for (i = 0; i < n && i < top; i++) {
+        if (kind == TRACE_SOURCE) {
+            fprintf(fp, "  %-40s %8lu %12.3f %12.3f\n", sorted[i]->name, (unsigned long) sorted[i]->count,
+                    sorted[i]->total / 1e3, sorted[i]->self / 1e3);
+        } else {
+            fprintf(fp, "  %-40s %8lu %12llu %12.3f\n", sorted[i]->name, (unsigned long) sorted[i]->count,
+                    (unsigned long long) sorted[i]->value, sorted[i]->total / 1e3);
+        }
+    }
+
+    if (n > top) {
+        fprintf(fp, "  ... %lu more\n", (unsigned long) (n - top));
+    }
+
+    pfree(sorted);
+}
+
+
+static
+int __trace_order__(const void *a, const void *b)
+{
+    const trace_entry_t *ea = *(const trace_entry_t * const *) a;
+    const trace_entry_t *eb = *(const trace_entry_t * const *) b;
+
+    if (ea->total != eb->total) {
+        return ea->total > eb->total ? -1 : 1;
+    }
+
+    return strcmp(ea->name, eb->name);
+}
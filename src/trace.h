@@ -0,0 +1,76 @@
+
+
+#ifndef __TRACE__H__
+#define __TRACE__H__
+
+
+#include "config.h"
+
+
+/* the files and the macros in the summary */
+#define TRACE_TOP           10
+
+
+typedef enum trace_kind_e {
+    TRACE_SOURCE,                       /* a file included, with its path */
+    TRACE_MACRO,                        /* a macro expanded, with its name */
+    TRACE_SKIP,                         /* the groups skipped by a condition */
+    TRACE_KIND_MAX,
+} trace_kind_t;
+
+
+/**
+ * The spans of a unit, for -ftime-trace: each one opened by trace_enter()
+ * and closed by trace_leave(). Those of a kind are added up by name for
+ * the summary, those at least the granularity long are kept as events
+ * of the trace. A span closed closes those opened inside it and left
+ * open. All of it is of the calling thread, nothing is done, nor the
+ * clock read, while tracing is false.
+ **/
+extern THREAD_LOCAL bool tracing;
+
+
+void trace_begin(size_t granularity);
+void trace_end(void);
+size_t trace_open(trace_kind_t kind, const char *name, size_t length);
+void trace_close(size_t span, size_t value, bool keep);
+bool trace_write(FILE *fp, const char *process);
+void trace_summary(FILE *fp, const char *unit, size_t top);
+
+
+/**
+ * Opens a span, the handle is for trace_leave(); 0 when not tracing.
+ **/
+static inline
+size_t trace_enter(trace_kind_t kind, const char *name, size_t length)
+{
+    return tracing ? trace_open(kind, name, length) : 0;
+}
+
+
+/**
+ * Closes the span with the count of what it made, the tokens of an
+ * expansion or the line of a skip.
+ **/
+static inline
+void trace_leave(size_t span, size_t value)
+{
+    if (span != 0 && tracing) {
+        trace_close(span, value, true);
+    }
+}
+
+
+/**
+ * Closes the span as if it was never opened, an expansion that was not.
+ **/
+static inline
+void trace_drop(size_t span)
+{
+    if (span != 0 && tracing) {
+        trace_close(span, 0, false);
+    }
+}
+
+
+#endif
@@ -4,6 +4,8 @@
 #define __UNITTEST__H__
 
 
+#include "config.h"
+
 #include <stdio.h>
 
 
@@ -24,6 +26,26 @@ static int __unittest_test_num__ = 0;
     } while(0)
 
 
+/**
+ * Writes text n times over to the file fn, false if it cannot be made.
+ **/
+static inline bool __write_file__(const char *fn, const char *text, size_t n)
+{
+    FILE *fp;
+
+    if ((fp = fopen(fn, "wb")) == NULL) {
+        return false;
+    }
+
+    for (; n != 0; n--) {
+        fputs(text, fp);
+    }
+
+    fclose(fp);
+    return true;
+}
+
+
 #define TEST_REPORT()                                                                           \
     do {                                                                                        \
         printf("====== TEST REPORT ======\n%d tests, %d passed, %d failed\n",                   \
@@ -5,6 +5,7 @@
 
 
 #include "config.h"
+#include "charclass.h"
 
 
 static inline
@@ -32,42 +33,42 @@ int ISOCT(int ch)
 static inline
 int ISHEX(int ch)
 {
-    return isxdigit(ch);
+    return CHARCLASS_IS(ch, CHARCLASS_HEX);
 }
 
 
 static inline
 int ISALNUM(int ch)
 {
-    return isalnum(ch);
+    return CHARCLASS_IS(ch, CHARCLASS_ALPHA | CHARCLASS_DIGIT);
 }
 
 
 static inline
 int ISALPHA(int ch)
 {
-    return isalpha(ch);
+    return CHARCLASS_IS(ch, CHARCLASS_ALPHA);
 }
 
 
 static inline
 int ISSPACE(int ch)
 {
-    return isspace(ch);
+    return CHARCLASS_IS(ch, CHARCLASS_SPACE);
 }
 
 
 static inline
 int ISDIGIT(int ch)
 {
-    return isdigit(ch);
+    return CHARCLASS_IS(ch, CHARCLASS_DIGIT);
 }
 
 
 static inline
 int ISIDNUM(int ch)
 {
-    return isalnum(ch) || ch == '_';
+    return CHARCLASS_IS(ch, CHARCLASS_WORD);
 }
 
 
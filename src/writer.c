@@ -0,0 +1,362 @@
+
+
+#include "config.h"
+#include "pmalloc.h"
+#include "cstring.h"
+#include "option.h"
+#include "token.h"
+#include "preprocessor.h"
+#include "stats.h"
+#include "writer.h"
+
+#include <errno.h>
+
+#if defined(UNIX)
+#   include <unistd.h>
+#   include <sys/uio.h>
+#else
+#   include <io.h>
+#endif
+
+
+static bool __writer_out__(writer_t *w, const void *data, size_t n);
+static void __writer_sync__(writer_t *w, token_t *tok);
+static void __writer_literal__(writer_t *w, token_t *tok, const char *prefix, char quote);
+
+
+static inline
+void __writer_ch__(writer_t *w, unsigned char ch)
+{
+    if (w->used == w->size) {
+        writer_flush(w);
+    }
+
+    w->buf[w->used++] = ch;
+}
+
+
+writer_t* writer_create(int fd, size_t size)
+{
+    writer_t *w;
+
+    w = (writer_t *) pmalloc(sizeof(writer_t));
+    if (!w) {
+        return NULL;
+    }
+
+    w->size = size != 0 ? size : WRITER_BUFFER_SIZE;
+    w->buf = (unsigned char *) pmalloc(w->size);
+    if (!w->buf) {
+        pfree(w);
+        return NULL;
+    }
+
+    w->fd = fd;
+    w->used = 0;
+    w->ok = true;
+    w->filename = NULL;
+    w->line = 0;
+    w->pending = 0;
+    w->begin_of_line = true;
+
+    return w;
+}
+
+
+/**
+ * Flushes what is left, false if any of the output could not be written.
+ **/
+bool writer_destroy(writer_t *w)
+{
+    bool ok;
+
+    ok = writer_flush(w);
+
+    if (w->filename != NULL) {
+        cstring_free(w->filename);
+    }
+
+    pfree(w->buf);
+    pfree(w);
+    return ok;
+}
+
+
+/**
+ * Small writes are gathered in the buffer. One that does not fit and is
+ * at least half of it is not copied, the buffer and it go out together.
+ **/
+void writer_write(writer_t *w, const void *data, size_t n)
+{
+    if (n <= w->size - w->used) {
+        memcpy(w->buf + w->used, data, n);
+        w->used += n;
+        return;
+    }
+
+    if (n < w->size / 2) {
+        writer_flush(w);
+        memcpy(w->buf, data, n);
+        w->used = n;
+        return;
+    }
+
+    __writer_out__(w, data, n);
+}
+
+
+bool writer_flush(writer_t *w)
+{
+    return __writer_out__(w, NULL, 0);
+}
+
+
+/**
+ * Writes a token where it belongs: first on its line when a newline came
+ * before it, after the spaces it had, literals in quotes again and with
+ * their escapes, since the lexer kept only what they stand for.
+ **/
+void writer_token(writer_t *w, token_t *tok)
+{
+    const unsigned char *spelling;
+    const char *text;
+    size_t n;
+
+    if (tok->type == TOKEN_NEWLINE) {
+        if (w->begin_of_line) {
+            /* a blank line, left to the next token to write or mark */
+            w->pending++;
+        } else {
+            __writer_ch__(w, '\n');
+            w->line++;
+            w->begin_of_line = true;
+        }
+        return;
+    }
+
+    if (w->begin_of_line) {
+        __writer_sync__(w, tok);
+        w->begin_of_line = false;
+    }
+
+    for (n = tok->spaces; n != 0; n--) {
+        __writer_ch__(w, ' ');
+    }
+
+    switch (tok->type) {
+    case TOKEN_CONSTANT_STRING:     __writer_literal__(w, tok, "", '"'); return;
+    case TOKEN_CONSTANT_WSTRING:    __writer_literal__(w, tok, "L", '"'); return;
+    case TOKEN_CONSTANT_STRING16:   __writer_literal__(w, tok, "u", '"'); return;
+    case TOKEN_CONSTANT_STRING32:   __writer_literal__(w, tok, "U", '"'); return;
+    case TOKEN_CONSTANT_UTF8STRING: __writer_literal__(w, tok, "u8", '"'); return;
+    case TOKEN_CONSTANT_CHAR:       __writer_literal__(w, tok, "", '\''); return;
+    case TOKEN_CONSTANT_WCHAR:      __writer_literal__(w, tok, "L", '\''); return;
+    case TOKEN_CONSTANT_CHAR16:     __writer_literal__(w, tok, "u", '\''); return;
+    case TOKEN_CONSTANT_CHAR32:     __writer_literal__(w, tok, "U", '\''); return;
+    case TOKEN_CONSTANT_UTF8CHAR:   __writer_literal__(w, tok, "u8", '\''); return;
+    default:
+        break;
+    }
+
+    spelling = token_spelling(tok, &n);
+    if (spelling != NULL && n != 0) {
+        writer_write(w, spelling, n);
+        return;
+    }
+
+    /* punctuators are spelled by their type only */
+    text = token_as_text(tok);
+    if (text != NULL) {
+        writer_write(w, text, strlen(text));
+    }
+}
+
+
+/**
+ * Writes out the preprocessor's tokens up to the end of the translation
+ * unit. preprocessor_expand() is pulled rather than preprocessor_get(),
+ * its newlines are what keeps the lines of the output, a batch at a time.
+ * The runs of integers of the text come as one token each, spelled as
+ * they were written, unless -fno-literal-runs.
+ **/
+bool writer_preprocess(writer_t *w, preprocessor_t *pp)
+{
+    stats_phase_t phase;
+    token_t *batch[WRITER_BATCH];
+    size_t i, n;
+    bool end = false, ok;
+
+    preprocessor_set_runs(pp, option_get(literal_runs));
+
+    while (!end) {
+        n = preprocessor_expand_batch(pp, batch, WRITER_BATCH);
+        end = batch[n - 1]->type == TOKEN_END || batch[n - 1]->type == TOKEN_EOF;
+
+        phase = stats_enter(STATS_PHASE_OUTPUT);
+        for (i = 0; i < n - end; i++) {
+            writer_token(w, batch[i]);
+        }
+        stats_leave(phase);
+
+        for (i = 0; i < n; i++) {
+            token_destroy(batch[i]);
+        }
+    }
+
+    phase = stats_enter(STATS_PHASE_OUTPUT);
+
+    if (!w->begin_of_line) {
+        __writer_ch__(w, '\n');
+        w->begin_of_line = true;
+    }
+
+    ok = writer_flush(w);
+    stats_leave(phase);
+
+    return ok;
+}
+
+
+/**
+ * Writes the buffer, then data, with as few system calls as it takes.
+ **/
+static
+bool __writer_out__(writer_t *w, const void *data, size_t n)
+{
+#if defined(UNIX)
+    struct iovec iov[2];
+    ssize_t written;
+    int i = 0, cnt;
+
+    iov[0].iov_base = w->buf;
+    iov[0].iov_len = w->used;
+    iov[1].iov_base = (void *) data;
+    iov[1].iov_len = n;
+    cnt = n != 0 ? 2 : 1;
+
+    while (w->ok && i < cnt) {
+        if (iov[i].iov_len == 0) {
+            i++;
+            continue;
+        }
+
+        written = writev(w->fd, iov + i, cnt - i);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            w->ok = false;
+            break;
+        }
+
+        for (; i < cnt && (size_t) written >= iov[i].iov_len; i++) {
+            written -= (ssize_t) iov[i].iov_len;
+        }
+
+        if (i < cnt) {
+            iov[i].iov_base = (unsigned char *) iov[i].iov_base + written;
+            iov[i].iov_len -= (size_t) written;
+        }
+    }
+#else
+    if (w->ok && w->used != 0) {
+        w->ok = _write(w->fd, w->buf, (unsigned int) w->used) == (int) w->used;
+    }
+
+    if (w->ok && n != 0) {
+        w->ok = _write(w->fd, data, (unsigned int) n) == (int) n;
+    }
+#endif
+
+    w->used = 0;
+    return w->ok;
+}
+
+
+/**
+ * At the first token of a line, brings the output to its line: with a
+ * few blank lines if it is not far below in the same file, with a line
+ * marker otherwise. Tokens of a macro expansion are where the macro was
+ * defined, for those only the blank lines counted are written.
+ **/
+static
+void __writer_sync__(writer_t *w, token_t *tok)
+{
+    cstring_t filename;
+    size_t line;
+    char marker[32];
+
+    /* lines start at 1, 0 is a buffer without them */
+    if (tok->hideset != NULL || !srcloc_resolve(tok->loc, &filename, &line, NULL, NULL) || line == 0) {
+        for (; w->pending != 0; w->pending--) {
+            __writer_ch__(w, '\n');
+            w->line++;
+        }
+        return;
+    }
+
+    w->pending = 0;
+
+    if (w->filename != NULL && cstring_compare(w->filename, filename) == 0 && line >= w->line) {
+        if (line - w->line <= WRITER_MAX_BLANK_LINES) {
+            for (; w->line < line; w->line++) {
+                __writer_ch__(w, '\n');
+            }
+            return;
+        }
+    } else {
+        if (w->filename != NULL) {
+            cstring_free(w->filename);
+        }
+        w->filename = cstring_dup(filename);
+    }
+
+    sprintf(marker, "# %lu \"", (unsigned long) line);
+    writer_write(w, marker, strlen(marker));
+    writer_write(w, filename, cstring_length(filename));
+    writer_write(w, "\"\n", 2);
+
+    w->line = line;
+}
+
+
+static
+void __writer_literal__(writer_t *w, token_t *tok, const char *prefix, char quote)
+{
+    const unsigned char *s;
+    size_t i, n;
+    char octal[5];
+
+    writer_write(w, prefix, strlen(prefix));
+    __writer_ch__(w, (unsigned char) quote);
+
+    s = token_spelling(tok, &n);
+
+    for (i = 0; i < n; i++) {
+        switch (s[i]) {
+        case '\\': writer_write(w, "\\\\", 2); continue;
+        case '\n': writer_write(w, "\\n", 2); continue;
+        case '\t': writer_write(w, "\\t", 2); continue;
+        case '\r': writer_write(w, "\\r", 2); continue;
+        case '\a': writer_write(w, "\\a", 2); continue;
+        case '\b': writer_write(w, "\\b", 2); continue;
+        case '\f': writer_write(w, "\\f", 2); continue;
+        case '\v': writer_write(w, "\\v", 2); continue;
+        default:
+            break;
+        }
+
+        if (s[i] == (unsigned char) quote) {
+            __writer_ch__(w, '\\');
+            __writer_ch__(w, s[i]);
+        } else if (s[i] < 0x20 || s[i] == 0x7f) {
+            /* three digits, so that a digit after it is not taken in */
+            sprintf(octal, "\\%03o", (unsigned) s[i]);
+            writer_write(w, octal, 4);
+        } else {
+            __writer_ch__(w, s[i]);
+        }
+    }
+
+    __writer_ch__(w, (unsigned char) quote);
+}
@@ -0,0 +1,54 @@
+
+
+#ifndef __WRITER__H__
+#define __WRITER__H__
+
+
+#include "config.h"
+#include "cstring.h"
+
+
+typedef struct token_s          token_t;
+typedef struct preprocessor_s   preprocessor_t;
+
+
+#define WRITER_BUFFER_SIZE      (64 * 1024)
+
+/* the most blank lines written instead of a line marker */
+#define WRITER_MAX_BLANK_LINES  8
+
+/* the tokens taken from the preprocessor at a time */
+#define WRITER_BATCH            64
+
+
+/**
+ * The -E output, written as it is made through a buffer of a fixed size
+ * that is reused, so that memory does not grow with the output. Writes
+ * too large for the buffer go out with it in a single writev(). filename
+ * and line are where the output is in the source, for the line markers,
+ * pending the blank lines not written yet. ok is cleared by the first
+ * write that fails.
+ **/
+typedef struct writer_s {
+    int fd;
+    unsigned char *buf;
+    size_t size;
+    size_t used;
+    bool ok;
+
+    cstring_t filename;
+    size_t line;
+    size_t pending;
+    bool begin_of_line;
+} writer_t;
+
+
+writer_t* writer_create(int fd, size_t size);
+bool writer_destroy(writer_t *w);
+void writer_write(writer_t *w, const void *data, size_t n);
+bool writer_flush(writer_t *w);
+void writer_token(writer_t *w, token_t *tok);
+bool writer_preprocess(writer_t *w, preprocessor_t *pp);
+
+
+#endif